@@ -65,8 +65,13 @@ infinoted_config_reload(InfinotedRun* run,
   gnutls_dh_params_t dh_params;
   InfdTcpServer* tcp6;
   InfdTcpServer* tcp4;
+  InfdTcpServer* tcp_unix;
+  InfXmppConnectionSecurityPolicy unix_policy;
+  InfCommunicationManager* communication_manager;
+  InfCommunicationCongestionPolicy congestion_policy;
 
   guint port;
+  guint timeout;
   InfIpAddress* addr4;
   InfIpAddress* addr6;
   GError* local_error;
@@ -87,6 +92,8 @@ infinoted_config_reload(InfinotedRun* run,
   startup = infinoted_startup_new(NULL, NULL, error);
   if(!startup) return FALSE;
 
+  timeout = MIN(startup->options->slow_client_timeout, G_MAXUINT / 1000);
+
   /* Acquire DH params if necessary (if security policy changed from
    * no-tls to one of allow-tls or require-tls). */
   dh_params = run->dh_params;
@@ -126,6 +133,36 @@ infinoted_config_reload(InfinotedRun* run,
     return FALSE;
   }
 
+  if(g_strcmp0(startup->options->unix_socket,
+               run->startup->options->unix_socket) != 0)
+  {
+    g_set_error_literal(
+      error,
+      g_quark_from_static_string("INFINOTED_CONFIG_RELOAD_ERROR"),
+      0,
+      _("Changing the Unix domain socket at runtime is not supported")
+    );
+
+    infinoted_startup_free(startup);
+    return FALSE;
+  }
+
+  /* The worker threads keep using the credentials and SASL context they
+   * have been started with, and cannot be replaced while connections they
+   * accepted are open. */
+  if(startup->options->worker_threads > 0 || run->n_workers > 0)
+  {
+    g_set_error_literal(
+      error,
+      g_quark_from_static_string("INFINOTED_CONFIG_RELOAD_ERROR"),
+      0,
+      _("Reloading the configuration is not supported with worker threads")
+    );
+
+    infinoted_startup_free(startup);
+    return FALSE;
+  }
+
   /* Find out the port we are currently running on */
   tcp4 = tcp6 = NULL;
   if(run->xmpp6)
@@ -162,6 +199,7 @@ infinoted_config_reload(InfinotedRun* run,
       "io", run->io,
       "local-address", addr6,
       "local-port", startup->options->port,
+      "congestion-timeout", timeout * 1000,
       NULL
     );
 
@@ -179,6 +217,7 @@ infinoted_config_reload(InfinotedRun* run,
       "io", run->io,
       "local-address", addr4,
       "local-port", startup->options->port,
+      "congestion-timeout", timeout * 1000,
       NULL
     );
 
@@ -315,6 +354,12 @@ infinoted_config_reload(InfinotedRun* run,
 
       g_object_unref(tcp6);
 
+      g_object_set(
+        G_OBJECT(run->xmpp6),
+        "compression", startup->options->compression,
+        NULL
+      );
+
       infd_server_pool_add_server(run->pool, INFD_XML_SERVER(run->xmpp6));
 
 #ifdef LIBINFINITY_HAVE_AVAHI
@@ -338,6 +383,12 @@ infinoted_config_reload(InfinotedRun* run,
 
       g_object_unref(tcp4);
 
+      g_object_set(
+        G_OBJECT(run->xmpp4),
+        "compression", startup->options->compression,
+        NULL
+      );
+
       infd_server_pool_add_server(run->pool, INFD_XML_SERVER(run->xmpp4));
 
 #ifdef LIBINFINITY_HAVE_AVAHI
@@ -360,8 +411,14 @@ infinoted_config_reload(InfinotedRun* run,
         G_OBJECT(run->xmpp6),
         "credentials", startup->credentials,
         "security-policy", startup->options->security_policy,
+        "compression", startup->options->compression,
         NULL
       );
+
+      g_object_get(G_OBJECT(run->xmpp6), "tcp-server", &tcp6, NULL);
+      g_object_set(G_OBJECT(tcp6), "congestion-timeout", timeout * 1000, NULL);
+      g_object_unref(tcp6);
+      tcp6 = NULL;
     }
 
     if(run->xmpp4 != NULL)
@@ -370,11 +427,60 @@ infinoted_config_reload(InfinotedRun* run,
         G_OBJECT(run->xmpp4),
         "credentials", startup->credentials,
         "security-policy", startup->options->security_policy,
+        "compression", startup->options->compression,
         NULL
       );
+
+      g_object_get(G_OBJECT(run->xmpp4), "tcp-server", &tcp4, NULL);
+      g_object_set(G_OBJECT(tcp4), "congestion-timeout", timeout * 1000, NULL);
+      g_object_unref(tcp4);
+      tcp4 = NULL;
     }
   }
 
+  /* The local server keeps its socket, and TLS stays optional on it */
+  if(run->xmpp_unix != NULL)
+  {
+    if(startup->credentials != NULL)
+      unix_policy = INF_XMPP_CONNECTION_SECURITY_BOTH_PREFER_UNSECURED;
+    else
+      unix_policy = INF_XMPP_CONNECTION_SECURITY_ONLY_UNSECURED;
+
+    g_object_set(
+      G_OBJECT(run->xmpp_unix),
+      "credentials", startup->credentials,
+      "security-policy", unix_policy,
+      "compression", startup->options->compression,
+      NULL
+    );
+
+    g_object_get(G_OBJECT(run->xmpp_unix), "tcp-server", &tcp_unix, NULL);
+    g_object_set(
+      G_OBJECT(tcp_unix),
+      "congestion-timeout", timeout * 1000,
+      NULL
+    );
+    g_object_unref(tcp_unix);
+  }
+
+  if(startup->options->pause_slow_clients == TRUE)
+    congestion_policy = INF_COMMUNICATION_CONGESTION_POLICY_PAUSE;
+  else
+    congestion_policy = INF_COMMUNICATION_CONGESTION_POLICY_NONE;
+
+  communication_manager =
+    infd_directory_get_communication_manager(run->directory);
+
+  inf_communication_registry_set_congestion_policy(
+    inf_communication_manager_get_registry(communication_manager),
+    congestion_policy
+  );
+
+  infd_directory_set_memory_budget(
+    run->directory,
+    (guint64)startup->options->session_memory_budget * 1024 * 1024
+  );
+
   /* Now, re-initialize plugins. This is a bit tricky, because it can fail,
    * and because we need to unload the previous plugins first.
    *
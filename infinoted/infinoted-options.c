@@ -101,6 +101,19 @@ const InfinotedParameterInfo INFINOTED_OPTIONS[] = {
     0,
     N_("The IP address to listen on."),
     N_("ADDRESS"),
+  }, {
+    "unix-socket",
+    INFINOTED_PARAMETER_STRING,
+    0,
+    offsetof(InfinotedOptions, unix_socket),
+    infinoted_parameter_convert_filename,
+    0,
+    N_("Path of a Unix domain socket on which to accept connections from "
+       "clients running on the same machine, in addition to the TCP port. "
+       "TLS is optional on this socket, and access to it is controlled by "
+       "the file permissions of the socket and its directory. Not "
+       "available on Windows."),
+    N_("PATH"),
   }, {
     "security-policy",
     INFINOTED_PARAMETER_STRING,
@@ -117,6 +130,41 @@ const InfinotedParameterInfo INFINOTED_OPTIONS[] = {
        "TLS. It is strongly encouraged to always require TLS. "
        "[Default=require-tls]"),
     N_("no-tls|allow-tls|require-tls")
+  }, {
+    "tls-session-resumption",
+    INFINOTED_PARAMETER_BOOLEAN,
+    0,
+    offsetof(InfinotedOptions, tls_session_resumption),
+    infinoted_parameter_convert_boolean,
+    0,
+    N_("Whether to issue TLS session tickets to clients, which allows them "
+       "to skip most of the TLS handshake when they reconnect. "
+       "[Default=false]"),
+    NULL
+  }, {
+    "session-ticket-key-file",
+    INFINOTED_PARAMETER_STRING,
+    0,
+    offsetof(InfinotedOptions, session_ticket_key_file),
+    infinoted_parameter_convert_filename,
+    0,
+    N_("File to store the key in which TLS session tickets are encrypted "
+       "with, so that tickets remain valid across server restarts. The file "
+       "is created if it does not exist. If not given, a new key is "
+       "generated on every start. Only used when tls-session-resumption is "
+       "enabled."),
+    N_("KEY-FILE")
+  }, {
+    "compression",
+    INFINOTED_PARAMETER_BOOLEAN,
+    0,
+    offsetof(InfinotedOptions, compression),
+    infinoted_parameter_convert_boolean,
+    0,
+    N_("Whether to offer zlib stream compression to clients. This saves "
+       "bandwidth on slow links, but compressing data before encrypting it "
+       "can leak information about its content. [Default=false]"),
+    NULL
   }, {
     "root-directory",
     INFINOTED_PARAMETER_STRING,
@@ -128,6 +176,55 @@ const InfinotedParameterInfo INFINOTED_OPTIONS[] = {
        "documents on the server, and where they are read from after a "
        "server restart. [Default=~/.infinote]"),
     N_("DIRECTORY")
+  }, {
+    "pause-slow-clients",
+    INFINOTED_PARAMETER_BOOLEAN,
+    0,
+    offsetof(InfinotedOptions, pause_slow_clients),
+    infinoted_parameter_convert_boolean,
+    0,
+    N_("Whether to hold back messages for clients which do not read data "
+       "as fast as it is sent to them, until they have caught up. This "
+       "keeps the server's send buffers from growing without bounds. "
+       "[Default=false]"),
+    NULL
+  }, {
+    "slow-client-timeout",
+    INFINOTED_PARAMETER_INT,
+    0,
+    offsetof(InfinotedOptions, slow_client_timeout),
+    infinoted_parameter_convert_nonnegative,
+    0,
+    N_("Time in seconds after which a client which does not read data "
+       "sent to it is disconnected, or 0 to never disconnect such "
+       "clients. [Default=0]"),
+    N_("SECONDS")
+  }, {
+    "session-memory-budget",
+    INFINOTED_PARAMETER_INT,
+    0,
+    offsetof(InfinotedOptions, session_memory_budget),
+    infinoted_parameter_convert_nonnegative,
+    0,
+    N_("Amount of memory in megabytes that open documents may use. When it "
+       "is exceeded, documents nobody is subscribed to are saved and "
+       "unloaded, starting with the least recently used one. If 0, such "
+       "documents are only unloaded after having been unused for a "
+       "minute. [Default=0]"),
+    N_("MEGABYTES")
+  }, {
+    "worker-threads",
+    INFINOTED_PARAMETER_INT,
+    0,
+    offsetof(InfinotedOptions, worker_threads),
+    infinoted_parameter_convert_nonnegative,
+    0,
+    N_("Number of additional threads which accept client connections and "
+       "handle encryption, compression and authentication for them, so "
+       "that many clients can be served using several processor cores. "
+       "Documents are still processed in the main thread. This option "
+       "cannot be combined with the certificate-auth plugin. [Default=0]"),
+    N_("THREADS")
   }, {
     "plugins",
     INFINOTED_PARAMETER_STRING_LIST,
@@ -202,9 +299,31 @@ infinoted_options_validate(InfinotedOptions* options,
 {
   InfXmppConnectionSecurityPolicy security_policy;
   gboolean requires_password;
+  gchar** plugin;
 
   security_policy = options->security_policy;
 
+  /* The certificate-auth plugin needs to install a certificate callback on
+   * new connections before the TLS handshake, but connections accepted by a
+   * worker thread only reach the directory once they are open. */
+  if(options->worker_threads > 0 && options->plugins != NULL)
+  {
+    for(plugin = options->plugins; *plugin != NULL; ++plugin)
+    {
+      if(strcmp(*plugin, "certificate-auth") == 0)
+      {
+        g_set_error_literal(
+          error,
+          infinoted_options_error_quark(),
+          INFINOTED_OPTIONS_ERROR_INVALID_WORKER_SETTINGS,
+          _("The certificate-auth plugin cannot be used with worker threads.")
+        );
+
+        return FALSE;
+      }
+    }
+  }
+
 #ifdef LIBINFINITY_HAVE_PAM
   if(options->password != NULL && options->pam_service != NULL)
   {
@@ -972,9 +1091,17 @@ infinoted_options_new(const gchar* const* config_files,
   options->create_certificate = FALSE;
   options->port = inf_protocol_get_default_port();
   options->listen_address = NULL;
+  options->unix_socket = NULL;
   options->security_policy = INF_XMPP_CONNECTION_SECURITY_ONLY_TLS;
+  options->tls_session_resumption = FALSE;
+  options->session_ticket_key_file = NULL;
+  options->compression = FALSE;
   options->root_directory =
     g_build_filename(g_get_home_dir(), ".infinote", NULL);
+  options->pause_slow_clients = FALSE;
+  options->slow_client_timeout = 0;
+  options->session_memory_budget = 0;
+  options->worker_threads = 0;
   options->plugins = g_malloc(2 * sizeof(gchar*));
   options->plugins[0] = g_strdup("note-text");
   options->plugins[1] = NULL;
@@ -1012,9 +1139,11 @@ infinoted_options_free(InfinotedOptions* options)
   g_free(options->key_file);
   g_free(options->certificate_file);
   g_free(options->certificate_chain_file);
+  g_free(options->session_ticket_key_file);
   g_free(options->root_directory);
   if(options->listen_address != NULL)
     inf_ip_address_free(options->listen_address);
+  g_free(options->unix_socket);
   g_strfreev(options->plugins);
   g_free(options->password);
 #ifdef LIBINFINITY_HAVE_PAM
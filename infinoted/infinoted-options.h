@@ -40,9 +40,20 @@ struct _InfinotedOptions {
   gboolean create_certificate;
   guint port;
   InfIpAddress *listen_address;
+  gchar* unix_socket;
   InfXmppConnectionSecurityPolicy security_policy;
+  gboolean tls_session_resumption;
+  gboolean compression;
+  gchar* session_ticket_key_file;
   gchar* root_directory;
 
+  gboolean pause_slow_clients;
+  guint slow_client_timeout;
+
+  guint session_memory_budget;
+
+  guint worker_threads;
+
   gchar** plugins;
 
   gchar* password;
@@ -66,7 +77,8 @@ typedef enum _InfinotedOptionsError {
   INFINOTED_OPTIONS_ERROR_INVALID_CREATE_OPTIONS,
   INFINOTED_OPTIONS_ERROR_EMPTY_KEY_FILE,
   INFINOTED_OPTIONS_ERROR_EMPTY_CERTIFICATE_FILE,
-  INFINOTED_OPTIONS_ERROR_INVALID_AUTHENTICATION_SETTINGS
+  INFINOTED_OPTIONS_ERROR_INVALID_AUTHENTICATION_SETTINGS,
+  INFINOTED_OPTIONS_ERROR_INVALID_WORKER_SETTINGS
 } InfinotedOptionsError;
 
 InfinotedOptions*
@@ -67,6 +67,19 @@ infinoted_run_load_directory(InfinotedRun* run,
 
   infd_directory_enable_chat(run->directory, TRUE);
 
+  infd_directory_set_memory_budget(
+    run->directory,
+    (guint64)startup->options->session_memory_budget * 1024 * 1024
+  );
+
+  if(startup->options->pause_slow_clients == TRUE)
+  {
+    inf_communication_registry_set_congestion_policy(
+      inf_communication_manager_get_registry(communication_manager),
+      INF_COMMUNICATION_CONGESTION_POLICY_PAUSE
+    );
+  }
+
   g_object_unref(communication_manager);
 
   /* Load server plugins via plugin manager */
@@ -152,6 +165,32 @@ infinoted_run_load_directory(InfinotedRun* run,
   return TRUE;
 }
 
+static InfdXmppServer*
+infinoted_run_create_xmpp_server(InfinotedRun* run,
+                                 InfinotedStartup* startup,
+                                 InfdTcpServer* tcp,
+                                 InfXmppConnectionSecurityPolicy policy)
+{
+  InfdXmppServer* xmpp;
+
+  xmpp = infd_xmpp_server_new(
+    tcp,
+    policy,
+    startup->credentials,
+    startup->sasl_context,
+    startup->sasl_context ? "PLAIN" : NULL
+  );
+
+  g_object_set(
+    G_OBJECT(xmpp),
+    "compression", startup->options->compression,
+    NULL
+  );
+
+  infd_server_pool_add_server(run->pool, INFD_XML_SERVER(xmpp));
+  return xmpp;
+}
+
 static InfdXmppServer*
 infinoted_run_create_server(InfinotedRun* run,
                             InfinotedStartup* startup,
@@ -160,6 +199,9 @@ infinoted_run_create_server(InfinotedRun* run,
 {
   InfdTcpServer* tcp;
   InfdXmppServer* xmpp;
+  guint timeout;
+
+  timeout = MIN(startup->options->slow_client_timeout, G_MAXUINT / 1000);
 
   tcp = INFD_TCP_SERVER(
     g_object_new(
@@ -167,6 +209,8 @@ infinoted_run_create_server(InfinotedRun* run,
       "io", INF_IO(run->io),
       "local-address", address,
       "local-port", startup->options->port,
+      "congestion-timeout", timeout * 1000,
+      "reuse-port", startup->options->worker_threads > 0,
       NULL
     )
   );
@@ -179,16 +223,13 @@ infinoted_run_create_server(InfinotedRun* run,
     return NULL;
   }
 
-  xmpp = infd_xmpp_server_new(
+  xmpp = infinoted_run_create_xmpp_server(
+    run,
+    startup,
     tcp,
-    startup->options->security_policy,
-    startup->credentials,
-    startup->sasl_context,
-    startup->sasl_context ? "PLAIN" : NULL
+    startup->options->security_policy
   );
 
-  infd_server_pool_add_server(run->pool, INFD_XML_SERVER(xmpp));
-
 #ifdef LIBINFINITY_HAVE_AVAHI
   infd_server_pool_add_local_publisher(
     run->pool,
@@ -201,6 +242,48 @@ infinoted_run_create_server(InfinotedRun* run,
   return xmpp;
 }
 
+static InfdXmppServer*
+infinoted_run_create_unix_server(InfinotedRun* run,
+                                 InfinotedStartup* startup,
+                                 GError** error)
+{
+  InfdTcpServer* tcp;
+  InfdXmppServer* xmpp;
+  InfXmppConnectionSecurityPolicy policy;
+  guint timeout;
+
+  timeout = MIN(startup->options->slow_client_timeout, G_MAXUINT / 1000);
+
+  tcp = INFD_TCP_SERVER(
+    g_object_new(
+      INFD_TYPE_TCP_SERVER,
+      "io", INF_IO(run->io),
+      "unix-path", startup->options->unix_socket,
+      "congestion-timeout", timeout * 1000,
+      NULL
+    )
+  );
+
+  if(!infd_tcp_server_bind(tcp, error))
+  {
+    g_object_unref(tcp);
+    return NULL;
+  }
+
+  /* Encryption buys nothing for clients on the same machine, so leave it up
+   * to them whether to use TLS. The socket is not published via avahi,
+   * since it is not reachable from the network. */
+  if(startup->credentials != NULL)
+    policy = INF_XMPP_CONNECTION_SECURITY_BOTH_PREFER_UNSECURED;
+  else
+    policy = INF_XMPP_CONNECTION_SECURITY_ONLY_UNSECURED;
+
+  xmpp = infinoted_run_create_xmpp_server(run, startup, tcp, policy);
+
+  g_object_unref(tcp);
+  return xmpp;
+}
+
 /**
  * infinoted_run_new:
  * @startup: Startup parameters for the Infinote Server.
@@ -230,6 +313,8 @@ infinoted_run_new(InfinotedStartup* startup,
   run = g_slice_new(InfinotedRun);
   run->startup = startup;
   run->dh_params = NULL;
+  run->workers = NULL;
+  run->n_workers = 0;
 
   if(infinoted_run_load_directory(run, startup, error) == FALSE)
   {
@@ -304,6 +389,23 @@ infinoted_run_new(InfinotedStartup* startup,
 
   inf_ip_address_free(address);
 
+  if(run != NULL)
+  {
+    run->xmpp_unix = NULL;
+
+    if(startup->options->unix_socket != NULL)
+    {
+      run->xmpp_unix = infinoted_run_create_unix_server(run, startup, error);
+      if(run->xmpp_unix == NULL)
+      {
+        /* Ownership of startup is only taken on success */
+        run->startup = NULL;
+        infinoted_run_free(run);
+        run = NULL;
+      }
+    }
+  }
+
   return run;
 }
 
@@ -317,6 +419,7 @@ void
 infinoted_run_free(InfinotedRun* run)
 {
   InfdXmlServerStatus status;
+  guint i;
 
   if(inf_standalone_io_loop_running(run->io))
     inf_standalone_io_loop_quit(run->io);
@@ -339,6 +442,18 @@ infinoted_run_free(InfinotedRun* run)
     g_object_unref(run->xmpp4);
   }
 
+  if(run->xmpp_unix != NULL)
+  {
+    g_object_get(G_OBJECT(run->xmpp_unix), "status", &status, NULL);
+    infd_server_pool_remove_server(
+      run->pool,
+      INFD_XML_SERVER(run->xmpp_unix)
+    );
+    if(status != INFD_XML_SERVER_CLOSED)
+      infd_xml_server_close(INFD_XML_SERVER(run->xmpp_unix));
+    g_object_unref(run->xmpp_unix);
+  }
+
 #ifdef LIBINFINITY_HAVE_AVAHI
   g_object_unref(run->avahi);
 #endif
@@ -353,6 +468,13 @@ infinoted_run_free(InfinotedRun* run)
   g_object_unref(run->directory);
   g_object_unref(run->pool);
 
+  /* Only stop the workers once the directory, which the pool held the last
+   * reference on, and the connections the workers handed to it have been
+   * released, so that these can still be closed in the worker threads. */
+  for(i = 0; i < run->n_workers; ++i)
+    infinoted_worker_free(run->workers[i]);
+  g_free(run->workers);
+
   if(run->dh_params != NULL)
     gnutls_dh_params_deinit(run->dh_params);
 
@@ -362,6 +484,72 @@ infinoted_run_free(InfinotedRun* run)
   g_slice_free(InfinotedRun, run);
 }
 
+static void
+infinoted_run_start_workers(InfinotedRun* run)
+{
+  InfdTcpServer* servers[2];
+  guint n_servers;
+  GError* error;
+  guint i;
+
+  n_servers = 0;
+  if(run->xmpp6 != NULL)
+  {
+    g_object_get(G_OBJECT(run->xmpp6), "tcp-server", &servers[n_servers], NULL);
+    ++n_servers;
+  }
+
+  if(run->xmpp4 != NULL)
+  {
+    g_object_get(G_OBJECT(run->xmpp4), "tcp-server", &servers[n_servers], NULL);
+    ++n_servers;
+  }
+
+  run->workers = g_malloc(
+    run->startup->options->worker_threads * sizeof(InfinotedWorker*)
+  );
+
+  error = NULL;
+  for(i = 0; i < run->startup->options->worker_threads; ++i)
+  {
+    run->workers[run->n_workers] = infinoted_worker_new(
+      run->startup,
+      INF_IO(run->io),
+      run->directory,
+      servers,
+      n_servers,
+      &error
+    );
+
+    if(run->workers[run->n_workers] == NULL)
+    {
+      /* The main thread still accepts connections on its own */
+      infinoted_log_error(
+        run->startup->log,
+        _("Failed to start worker thread: %s"),
+        error->message
+      );
+
+      g_error_free(error);
+      break;
+    }
+
+    ++run->n_workers;
+  }
+
+  if(run->n_workers > 0)
+  {
+    infinoted_log_info(
+      run->startup->log,
+      _("Accepting connections in %u worker threads"),
+      run->n_workers
+    );
+  }
+
+  for(i = 0; i < n_servers; ++i)
+    g_object_unref(servers[i]);
+}
+
 /**
  * infinoted_run_start:
  * @run: A #InfinotedRun.
@@ -452,6 +640,36 @@ infinoted_run_start(InfinotedRun* run)
     g_object_unref(tcp);
   }
 
+  if(run->xmpp_unix != NULL)
+  {
+    g_object_get(G_OBJECT(run->xmpp_unix), "tcp-server", &tcp, NULL);
+    if(infd_tcp_server_open(tcp, &error) == TRUE)
+    {
+      infinoted_log_info(
+        run->startup->log,
+        _("Local server running on %s"),
+        run->startup->options->unix_socket
+      );
+    }
+    else
+    {
+      infinoted_log_error(
+        run->startup->log,
+        _("Failed to start local server: %s"),
+        error->message
+      );
+
+      g_error_free(error);
+      error = NULL;
+
+      g_object_unref(run->xmpp_unix);
+      run->xmpp_unix = NULL;
+      infd_tcp_server_close(tcp);
+    }
+
+    g_object_unref(tcp);
+  }
+
   if(run->xmpp4 == NULL && run->xmpp6 == NULL)
   {
     g_assert(error4 != NULL || error6 != NULL);
@@ -467,6 +685,9 @@ infinoted_run_start(InfinotedRun* run)
   if(error4 != NULL) g_error_free(error4);
   if(error6 != NULL) g_error_free(error6);
 
+  if(run->xmpp4 != NULL || run->xmpp6 != NULL)
+    infinoted_run_start_workers(run);
+
   /* Make sure messages are shown. This explicit flush is for example
    * required when running in an MSYS shell on Windows. */
   fflush(stderr);
@@ -477,7 +698,7 @@ infinoted_run_start(InfinotedRun* run)
   sd_notify(0, "READY=1");
 #endif
 
-  if(run->xmpp4 != NULL || run->xmpp6 != NULL)
+  if(run->xmpp4 != NULL || run->xmpp6 != NULL || run->xmpp_unix != NULL)
   {
     inf_standalone_io_loop(run->io);
 
@@ -24,6 +24,7 @@
 
 #include <infinoted/infinoted-startup.h>
 #include <infinoted/infinoted-plugin-manager.h>
+#include <infinoted/infinoted-worker.h>
 
 #include <libinfinity/server/infd-server-pool.h>
 #include <libinfinity/server/infd-directory.h>
@@ -46,8 +47,13 @@ struct _InfinotedRun {
 
   InfdXmppServer* xmpp4;
   InfdXmppServer* xmpp6;
+  InfdXmppServer* xmpp_unix;
   gnutls_dh_params_t dh_params;
 
+  /* Additional threads accepting connections, see InfinotedWorker */
+  InfinotedWorker** workers;
+  guint n_workers;
+
 #ifdef LIBINFINITY_HAVE_AVAHI
   InfDiscoveryAvahi* avahi;
 #endif
@@ -24,6 +24,7 @@
 #include <infinoted/infinoted-pam.h>
 
 #include <libinfinity/common/inf-cert-util.h>
+#include <libinfinity/common/inf-file-util.h>
 #include <libinfinity/common/inf-init.h>
 #include <libinfinity/common/inf-error.h>
 #include <libinfinity/inf-i18n.h>
@@ -147,6 +148,123 @@ infinoted_startup_load_certificate(InfinotedLog* log,
   return result;
 }
 
+static gboolean
+infinoted_startup_enable_session_tickets(InfinotedStartup* startup,
+                                         GError** error)
+{
+  const gchar* key_file;
+  gnutls_datum_t key;
+  gchar* contents;
+  gsize length;
+  GError* local_error;
+  gboolean result;
+  int res;
+
+  key_file = startup->options->session_ticket_key_file;
+  if(key_file == NULL)
+  {
+    return inf_certificate_credentials_enable_session_tickets(
+      startup->credentials,
+      NULL,
+      error
+    );
+  }
+
+  /* Generate a key in any case, to find out what size it has to be */
+  res = gnutls_session_ticket_key_generate(&key);
+  if(res != GNUTLS_E_SUCCESS)
+  {
+    inf_gnutls_set_error(error, res);
+    return FALSE;
+  }
+
+  local_error = NULL;
+  if(g_file_get_contents(key_file, &contents, &length, &local_error) == TRUE)
+  {
+    /* Do not overwrite a key of a different size, for example one written
+     * by another GnuTLS version, since it might still be in use. */
+    if(length != key.size)
+    {
+      g_set_error(
+        error,
+        G_FILE_ERROR,
+        G_FILE_ERROR_INVAL,
+        _("Session ticket key \"%s\" has %lu bytes instead of %u. Remove "
+          "the file to create a new key."),
+        key_file,
+        (unsigned long)length,
+        key.size
+      );
+
+      result = FALSE;
+    }
+    else
+    {
+      memcpy(key.data, contents, length);
+      result = TRUE;
+    }
+
+    memset(contents, 0, length);
+    g_free(contents);
+
+    if(result == FALSE)
+    {
+      memset(key.data, 0, key.size);
+      gnutls_free(key.data);
+      return FALSE;
+    }
+  }
+  else if(local_error->domain != G_FILE_ERROR ||
+          local_error->code != G_FILE_ERROR_NOENT)
+  {
+    /* Do not replace a key that could not be read, for example because of
+     * missing permissions */
+    g_propagate_error(error, local_error);
+    memset(key.data, 0, key.size);
+    gnutls_free(key.data);
+    return FALSE;
+  }
+  else
+  {
+    g_error_free(local_error);
+
+    infinoted_log_info(
+      startup->log,
+      _("Creating new session ticket key \"%s\""),
+      key_file
+    );
+
+    result = infinoted_util_create_dirname(key_file, error);
+    if(result == TRUE)
+    {
+      /* Creates the file with 0600 permission right away */
+      result = inf_file_util_write_private_data(
+        key_file,
+        key.data,
+        key.size,
+        error
+      );
+    }
+
+    if(result == FALSE)
+    {
+      memset(key.data, 0, key.size);
+      gnutls_free(key.data);
+      return FALSE;
+    }
+  }
+
+  result = inf_certificate_credentials_enable_session_tickets(
+    startup->credentials,
+    &key,
+    error
+  );
+
+  memset(key.data, 0, key.size);
+  gnutls_free(key.data);
+  return result;
+}
+
 static gboolean
 infinoted_startup_load_credentials(InfinotedStartup* startup,
                                    GError** error)
@@ -200,6 +318,12 @@ infinoted_startup_load_credentials(InfinotedStartup* startup,
       inf_gnutls_set_error(error, res);
       return FALSE;
     }
+
+    if(startup->options->tls_session_resumption == TRUE)
+    {
+      if(infinoted_startup_enable_session_tickets(startup, error) == FALSE)
+        return FALSE;
+    }
   }
 
   return TRUE;
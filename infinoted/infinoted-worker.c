@@ -0,0 +1,375 @@
+/* libinfinity - a GObject-based infinote implementation
+ * Copyright (C) 2007-2015 Armin Burgmeier <armin@arbur.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+/* A worker runs its own InfStandaloneIo in a separate thread. It listens on
+ * the same addresses and ports as the main servers, with SO_REUSEPORT, so
+ * that the kernel distributes incoming connections among the main thread
+ * and all workers. A worker performs the TLS handshake, SASL authentication,
+ * encryption, compression and XML parsing for the connections it accepted,
+ * and hands each connection to the directory in the main thread via an
+ * InfThreadConnection once it is open. Documents and sessions remain in the
+ * main thread, since InfdDirectory and the sessions are not thread-safe. */
+
+#include <infinoted/infinoted-worker.h>
+
+#include <libinfinity/server/infd-xmpp-server.h>
+#include <libinfinity/server/infd-xml-server.h>
+#include <libinfinity/common/inf-thread-connection.h>
+#include <libinfinity/common/inf-standalone-io.h>
+#include <libinfinity/inf-signals.h>
+
+struct _InfinotedWorker {
+  InfStandaloneIo* io;
+  InfIo* main_io;
+  /* Not referenced, so that the directory, and with it the connections
+   * handed to it, can be released while the worker thread still runs */
+  InfdDirectory* directory;
+  GThread* thread;
+
+  /* Only accessed in the worker thread once it runs */
+  GSList* servers;
+  /* Connections which have been accepted, but are not yet open */
+  GSList* connections;
+};
+
+typedef struct _InfinotedWorkerHandover InfinotedWorkerHandover;
+struct _InfinotedWorkerHandover {
+  InfinotedWorker* worker;
+  InfThreadConnection* connection;
+};
+
+static void
+infinoted_worker_handover_free(gpointer data)
+{
+  InfinotedWorkerHandover* handover;
+  handover = (InfinotedWorkerHandover*)data;
+
+  g_object_unref(handover->connection);
+  g_slice_free(InfinotedWorkerHandover, handover);
+}
+
+/* Runs in the main thread */
+static void
+infinoted_worker_handover_func(gpointer user_data)
+{
+  InfinotedWorkerHandover* handover;
+  handover = (InfinotedWorkerHandover*)user_data;
+
+  /* If the addition fails, the connection is closed when the handover is
+   * freed, as in infd_server_pool_new_connection_cb(). */
+  infd_directory_add_connection(
+    handover->worker->directory,
+    INF_XML_CONNECTION(handover->connection)
+  );
+}
+
+static void
+infinoted_worker_remove_connection(InfinotedWorker* worker,
+                                   InfXmlConnection* connection);
+
+static void
+infinoted_worker_notify_status_cb(GObject* object,
+                                  GParamSpec* pspec,
+                                  gpointer user_data)
+{
+  InfinotedWorker* worker;
+  InfXmlConnection* connection;
+  InfXmlConnectionStatus status;
+  InfinotedWorkerHandover* handover;
+
+  worker = (InfinotedWorker*)user_data;
+  connection = INF_XML_CONNECTION(object);
+  g_object_get(object, "status", &status, NULL);
+
+  switch(status)
+  {
+  case INF_XML_CONNECTION_OPEN:
+    handover = g_slice_new(InfinotedWorkerHandover);
+    handover->worker = worker;
+    handover->connection = inf_thread_connection_new(
+      worker->main_io,
+      INF_IO(worker->io),
+      connection
+    );
+
+    inf_io_add_dispatch(
+      worker->main_io,
+      infinoted_worker_handover_func,
+      handover,
+      infinoted_worker_handover_free
+    );
+
+    infinoted_worker_remove_connection(worker, connection);
+    break;
+  case INF_XML_CONNECTION_CLOSING:
+  case INF_XML_CONNECTION_CLOSED:
+    infinoted_worker_remove_connection(worker, connection);
+    break;
+  case INF_XML_CONNECTION_OPENING:
+    break;
+  default:
+    g_assert_not_reached();
+    break;
+  }
+}
+
+static void
+infinoted_worker_remove_connection(InfinotedWorker* worker,
+                                   InfXmlConnection* connection)
+{
+  inf_signal_handlers_disconnect_by_func(
+    G_OBJECT(connection),
+    G_CALLBACK(infinoted_worker_notify_status_cb),
+    worker
+  );
+
+  worker->connections = g_slist_remove(worker->connections, connection);
+  g_object_unref(connection);
+}
+
+static void
+infinoted_worker_new_connection_cb(InfdXmlServer* server,
+                                   InfXmlConnection* connection,
+                                   gpointer user_data)
+{
+  InfinotedWorker* worker;
+  worker = (InfinotedWorker*)user_data;
+
+  /* Keep the connection until the handshake and authentication are done */
+  worker->connections = g_slist_prepend(worker->connections, connection);
+  g_object_ref(connection);
+
+  g_signal_connect(
+    G_OBJECT(connection),
+    "notify::status",
+    G_CALLBACK(infinoted_worker_notify_status_cb),
+    worker
+  );
+}
+
+/* Runs in the worker thread while it runs, or in the main thread before the
+ * worker thread has been started */
+static void
+infinoted_worker_close(InfinotedWorker* worker)
+{
+  InfdXmlServer* server;
+  InfXmlConnection* connection;
+  InfdXmlServerStatus status;
+
+  while(worker->servers != NULL)
+  {
+    server = INFD_XML_SERVER(worker->servers->data);
+    worker->servers = g_slist_delete_link(worker->servers, worker->servers);
+
+    inf_signal_handlers_disconnect_by_func(
+      G_OBJECT(server),
+      G_CALLBACK(infinoted_worker_new_connection_cb),
+      worker
+    );
+
+    g_object_get(G_OBJECT(server), "status", &status, NULL);
+    if(status != INFD_XML_SERVER_CLOSED)
+      infd_xml_server_close(server);
+
+    g_object_unref(server);
+  }
+
+  while(worker->connections != NULL)
+  {
+    connection = INF_XML_CONNECTION(worker->connections->data);
+    g_object_ref(connection);
+
+    infinoted_worker_remove_connection(worker, connection);
+    inf_xml_connection_close(connection);
+    g_object_unref(connection);
+  }
+}
+
+static void
+infinoted_worker_stop_func(gpointer user_data)
+{
+  InfinotedWorker* worker;
+  worker = (InfinotedWorker*)user_data;
+
+  infinoted_worker_close(worker);
+  inf_standalone_io_loop_quit(worker->io);
+}
+
+static gpointer
+infinoted_worker_thread_func(gpointer data)
+{
+  InfinotedWorker* worker;
+  worker = (InfinotedWorker*)data;
+
+  inf_standalone_io_loop(worker->io);
+  return NULL;
+}
+
+/**
+ * infinoted_worker_new:
+ * @startup: Startup parameters for the Infinote Server.
+ * @io: The #InfIo of the main thread.
+ * @directory: The directory to which accepted connections are added.
+ * @servers: (array length=n_servers): The open servers of the main thread.
+ * @n_servers: Number of elements in @servers.
+ * @error: Location to store error information, if any.
+ *
+ * Starts a new worker thread which listens on the same address and port as
+ * each of @servers, and adds the connections it accepts to @directory once
+ * they have been authenticated. @servers need to have been created with
+ * #InfdTcpServer:reuse-port set to %TRUE.
+ *
+ * The worker does not hold a reference on @directory. Connections are only
+ * added to it while @io runs, so @directory needs to stay alive until @io
+ * is no longer run.
+ *
+ * Returns: A new #InfinotedWorker, free with infinoted_worker_free(). Or
+ * %NULL, on error.
+ */
+InfinotedWorker*
+infinoted_worker_new(InfinotedStartup* startup,
+                     InfIo* io,
+                     InfdDirectory* directory,
+                     InfdTcpServer* const* servers,
+                     guint n_servers,
+                     GError** error)
+{
+  InfinotedWorker* worker;
+  InfdTcpServer* tcp;
+  InfdXmppServer* xmpp;
+  InfIpAddress* address;
+  guint port;
+  guint timeout;
+  guint i;
+
+  worker = g_slice_new(InfinotedWorker);
+  worker->io = inf_standalone_io_new();
+  worker->main_io = io;
+  worker->directory = directory;
+  worker->thread = NULL;
+  worker->servers = NULL;
+  worker->connections = NULL;
+
+  g_object_ref(io);
+
+  timeout = MIN(startup->options->slow_client_timeout, G_MAXUINT / 1000);
+
+  for(i = 0; i < n_servers; ++i)
+  {
+    g_object_get(
+      G_OBJECT(servers[i]),
+      "local-address", &address,
+      "local-port", &port,
+      NULL
+    );
+
+    tcp = INFD_TCP_SERVER(
+      g_object_new(
+        INFD_TYPE_TCP_SERVER,
+        "io", INF_IO(worker->io),
+        "local-address", address,
+        "local-port", port,
+        "congestion-timeout", timeout * 1000,
+        "reuse-port", TRUE,
+        NULL
+      )
+    );
+
+    if(address != NULL)
+      inf_ip_address_free(address);
+
+    infd_tcp_server_set_keepalive(tcp, &startup->keepalive);
+
+    if(!infd_tcp_server_open(tcp, error))
+    {
+      g_object_unref(tcp);
+      infinoted_worker_free(worker);
+      return NULL;
+    }
+
+    xmpp = infd_xmpp_server_new(
+      tcp,
+      startup->options->security_policy,
+      startup->credentials,
+      startup->sasl_context,
+      startup->sasl_context ? "PLAIN" : NULL
+    );
+
+    g_object_set(
+      G_OBJECT(xmpp),
+      "compression", startup->options->compression,
+      NULL
+    );
+
+    g_signal_connect(
+      G_OBJECT(xmpp),
+      "new-connection",
+      G_CALLBACK(infinoted_worker_new_connection_cb),
+      worker
+    );
+
+    worker->servers = g_slist_prepend(worker->servers, xmpp);
+    g_object_unref(tcp);
+  }
+
+  worker->thread = g_thread_new(
+    "infinoted-worker",
+    infinoted_worker_thread_func,
+    worker
+  );
+
+  return worker;
+}
+
+/**
+ * infinoted_worker_free:
+ * @worker: A #InfinotedWorker.
+ *
+ * Closes the servers of @worker and stops its thread. This should only be
+ * done once the directory has been released, since the connections that
+ * have been handed to it by @worker need the worker thread to be closed.
+ */
+void
+infinoted_worker_free(InfinotedWorker* worker)
+{
+  if(worker->thread != NULL)
+  {
+    inf_io_add_dispatch(
+      INF_IO(worker->io),
+      infinoted_worker_stop_func,
+      worker,
+      NULL
+    );
+
+    g_thread_join(worker->thread);
+  }
+  else
+  {
+    infinoted_worker_close(worker);
+  }
+
+  g_assert(worker->servers == NULL);
+  g_assert(worker->connections == NULL);
+
+  g_object_unref(worker->main_io);
+  g_object_unref(worker->io);
+  g_slice_free(InfinotedWorker, worker);
+}
+
+/* vim:set et sw=2 ts=2: */
@@ -20,6 +20,7 @@
 #include "util/infinoted-plugin-util-navigate-browser.h"
 
 #include <infinoted/infinoted-plugin-manager.h>
+#include <libinfinity/communication/inf-communication-registry.h>
 #include <libinfinity/common/inf-request-result.h>
 #include <libinfinity/inf-i18n.h>
 
@@ -58,6 +59,9 @@ static const gchar infinoted_plugin_dbus_introspection[] =
   "      <arg type='as' name='permissions' direction='in'/>"
   "      <arg type='a{sb}' name='sheet' direction='out'/>"
   "    </method>"
+  "    <method name='connection_statistics'>"
+  "      <arg type='a(stttttuutat)' name='statistics' direction='out'/>"
+  "    </method>"
   "  </interface>"
   "</node>";
 
@@ -764,6 +768,97 @@ infinoted_plugin_dbus_navigate_done(InfBrowser* browser,
   }
 }
 
+typedef struct _InfinotedPluginDbusStatisticsData
+  InfinotedPluginDbusStatisticsData;
+struct _InfinotedPluginDbusStatisticsData {
+  InfCommunicationRegistry* registry;
+  GVariantBuilder* builder;
+};
+
+static void
+infinoted_plugin_dbus_connection_statistics_foreach_func(
+  InfXmlConnection* connection,
+  gpointer user_data)
+{
+  InfinotedPluginDbusStatisticsData* data;
+  InfXmlConnectionStatistics statistics;
+  InfCommunicationRegistryStatistics registry_statistics;
+  GVariantBuilder histogram;
+  gchar* remote_id;
+  guint i;
+
+  data = (InfinotedPluginDbusStatisticsData*)user_data;
+
+  inf_xml_connection_get_statistics(connection, &statistics);
+  if(!inf_communication_registry_get_statistics(data->registry,
+                                                connection,
+                                                &registry_statistics))
+  {
+    memset(&registry_statistics, 0, sizeof(registry_statistics));
+  }
+
+  g_variant_builder_init(&histogram, G_VARIANT_TYPE("at"));
+  for(i = 0; i < INF_COMMUNICATION_REGISTRY_LATENCY_BUCKETS; ++i)
+  {
+    g_variant_builder_add(
+      &histogram,
+      "t",
+      registry_statistics.latency_histogram[i]
+    );
+  }
+
+  g_object_get(G_OBJECT(connection), "remote-id", &remote_id, NULL);
+
+  g_variant_builder_add(
+    data->builder,
+    "(stttttuut@at)",
+    remote_id,
+    statistics.bytes_sent,
+    statistics.bytes_received,
+    statistics.messages_sent,
+    statistics.messages_received,
+    statistics.send_queue_length,
+    registry_statistics.n_queued,
+    registry_statistics.n_enqueued,
+    registry_statistics.n_sent,
+    g_variant_builder_end(&histogram)
+  );
+
+  g_free(remote_id);
+}
+
+static void
+infinoted_plugin_dbus_connection_statistics(
+  InfinotedPluginDbus* plugin,
+  InfinotedPluginDbusInvocation* invocation)
+{
+  InfdDirectory* directory;
+  InfinotedPluginDbusStatisticsData data;
+  GVariantBuilder builder;
+
+  directory = infinoted_plugin_manager_get_directory(plugin->manager);
+
+  data.registry = inf_communication_manager_get_registry(
+    infd_directory_get_communication_manager(directory)
+  );
+  data.builder = &builder;
+
+  g_variant_builder_init(&builder, G_VARIANT_TYPE("a(stttttuutat)"));
+
+  infd_directory_foreach_connection(
+    directory,
+    infinoted_plugin_dbus_connection_statistics_foreach_func,
+    &data
+  );
+
+  g_dbus_method_invocation_return_value(
+    invocation->invocation,
+    g_variant_new("(@a(stttttuutat))", g_variant_builder_end(&builder))
+  );
+
+  infinoted_plugin_dbus_invocation_free(plugin, invocation);
+}
+
 static void
 infinoted_plugin_dbus_main_invocation(gpointer user_data)
 {
@@ -824,6 +919,14 @@ infinoted_plugin_dbus_main_invocation(gpointer user_data)
     if(navigate != NULL)
       invocation->navigate = navigate;
   }
+  /* This command does not operate on a node. */
+  else if(strcmp(invocation->method_name, "connection_statistics") == 0)
+  {
+    infinoted_plugin_dbus_connection_statistics(
+      invocation->plugin,
+      invocation
+    );
+  }
   else
   {
     g_dbus_method_invocation_return_error_literal(
@@ -64,47 +64,89 @@ infinoted_plugin_note_chat_session_new(InfIo* io,
   return INF_SESSION(session);
 }
 
-static InfSession*
-infinoted_plugin_note_chat_session_read(InfdStorage* storage,
-                                        InfIo* io,
-                                        InfCommunicationManager* manager,
+static gboolean
+infinoted_plugin_note_chat_session_load(InfdStorage* storage,
                                         const gchar* path,
                                         gpointer user_data,
+                                        InfBuffer** buffer,
+                                        InfUserTable** user_table,
                                         GError** error)
 {
-  InfChatBuffer* buffer;
+  InfChatBuffer* chat_buffer;
   gboolean result;
-  InfChatSession* session;
 
   g_assert(INFD_IS_FILESYSTEM_STORAGE(storage));
 
-  buffer = inf_chat_buffer_new(256);
+  chat_buffer = inf_chat_buffer_new(256);
 
   result = infd_chat_filesystem_format_read(
     INFD_FILESYSTEM_STORAGE(storage),
     path,
-    buffer,
+    chat_buffer,
     error
   );
 
   if(result == FALSE)
   {
-    g_object_unref(buffer);
-    return NULL;
+    g_object_unref(chat_buffer);
+    return FALSE;
   }
 
+  *buffer = INF_BUFFER(chat_buffer);
+  *user_table = NULL;
+  return TRUE;
+}
+
+static InfSession*
+infinoted_plugin_note_chat_session_create(InfIo* io,
+                                          InfCommunicationManager* manager,
+                                          InfBuffer* buffer,
+                                          InfUserTable* user_table,
+                                          gpointer user_data)
+{
+  InfChatSession* session;
+
   session = inf_chat_session_new(
     manager,
-    buffer,
+    INF_CHAT_BUFFER(buffer),
     INF_SESSION_RUNNING,
     NULL,
     NULL
   );
 
-  g_object_unref(buffer);
   return INF_SESSION(session);
 }
 
+static InfSession*
+infinoted_plugin_note_chat_session_read(InfdStorage* storage,
+                                        InfIo* io,
+                                        InfCommunicationManager* manager,
+                                        const gchar* path,
+                                        gpointer user_data,
+                                        GError** error)
+{
+  InfBuffer* buffer;
+  InfUserTable* user_table;
+  InfSession* session;
+
+  if(!infinoted_plugin_note_chat_session_load(storage, path, user_data,
+                                              &buffer, &user_table, error))
+  {
+    return NULL;
+  }
+
+  session = infinoted_plugin_note_chat_session_create(
+    io,
+    manager,
+    buffer,
+    user_table,
+    user_data
+  );
+
+  g_object_unref(buffer);
+  return session;
+}
+
 static gboolean
 infinoted_plugin_note_chat_session_write(InfdStorage* storage,
                                          InfSession* session,
@@ -126,7 +168,10 @@ const InfdNotePlugin INFINOTED_PLUGIN_NOTE_CHAT_PLUGIN = {
   "InfChat",
   infinoted_plugin_note_chat_session_new,
   infinoted_plugin_note_chat_session_read,
-  infinoted_plugin_note_chat_session_write
+  infinoted_plugin_note_chat_session_write,
+  infinoted_plugin_note_chat_session_load,
+  infinoted_plugin_note_chat_session_create,
+  NULL
 };
 
 /* Infinoted plugin glue */
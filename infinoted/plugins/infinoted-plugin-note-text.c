@@ -19,6 +19,7 @@
 
 #include <infinoted/infinoted-plugin-manager.h>
 #include <infinoted/infinoted-parameter.h>
+#include <infinoted/infinoted-log.h>
 
 #include <libinftext/inf-text-session.h>
 #include <libinftext/inf-text-default-buffer.h>
@@ -30,6 +31,15 @@ typedef struct _InfinotedPluginNoteText InfinotedPluginNoteText;
 struct _InfinotedPluginNoteText {
   InfinotedPluginManager* manager;
   const InfdNotePlugin* plugin;
+
+  gboolean journal;
+  guint journal_compact_size;
+};
+
+typedef struct _InfinotedPluginNoteTextSessionInfo
+  InfinotedPluginNoteTextSessionInfo;
+struct _InfinotedPluginNoteTextSessionInfo {
+  InfTextFilesystemJournal* journal;
 };
 
 /* Note plugin implementation */
@@ -61,42 +71,55 @@ infinoted_plugin_note_text_session_new(InfIo* io,
   return INF_SESSION(session);
 }
 
-static InfSession*
-infinoted_plugin_note_text_session_read(InfdStorage* storage,
-                                        InfIo* io,
-                                        InfCommunicationManager* manager,
+static gboolean
+infinoted_plugin_note_text_session_load(InfdStorage* storage,
                                         const gchar* path,
                                         gpointer user_data,
+                                        InfBuffer** buffer,
+                                        InfUserTable** user_table,
                                         GError** error)
 {
-  InfUserTable* user_table;
-  InfTextBuffer* buffer;
+  InfUserTable* table;
+  InfTextBuffer* text_buffer;
   gboolean result;
-  InfTextSession* session;
 
   g_assert(INFD_IS_FILESYSTEM_STORAGE(storage));
 
-  user_table = inf_user_table_new();
-  buffer = INF_TEXT_BUFFER(inf_text_default_buffer_new("UTF-8"));
+  table = inf_user_table_new();
+  text_buffer = INF_TEXT_BUFFER(inf_text_default_buffer_new("UTF-8"));
 
   result = inf_text_filesystem_format_read(
     INFD_FILESYSTEM_STORAGE(storage),
     path,
-    user_table,
-    buffer,
+    table,
+    text_buffer,
     error
   );
 
   if(result == FALSE)
   {
-    g_object_unref(user_table);
-    g_object_unref(buffer);
-    return NULL;
+    g_object_unref(table);
+    g_object_unref(text_buffer);
+    return FALSE;
   }
 
+  *buffer = INF_BUFFER(text_buffer);
+  *user_table = table;
+  return TRUE;
+}
+
+static InfSession*
+infinoted_plugin_note_text_session_create(InfIo* io,
+                                          InfCommunicationManager* manager,
+                                          InfBuffer* buffer,
+                                          InfUserTable* user_table,
+                                          gpointer user_data)
+{
+  InfTextSession* session;
+
   session = inf_text_session_new_with_user_table(
     manager,
-    buffer,
+    INF_TEXT_BUFFER(buffer),
     io,
     user_table,
     INF_SESSION_RUNNING,
@@ -104,10 +127,39 @@ infinoted_plugin_note_text_session_read(InfdStorage* storage,
     NULL
   );
 
+  return INF_SESSION(session);
+}
+
+static InfSession*
+infinoted_plugin_note_text_session_read(InfdStorage* storage,
+                                        InfIo* io,
+                                        InfCommunicationManager* manager,
+                                        const gchar* path,
+                                        gpointer user_data,
+                                        GError** error)
+{
+  InfBuffer* buffer;
+  InfUserTable* user_table;
+  InfSession* session;
+
+  if(!infinoted_plugin_note_text_session_load(storage, path, user_data,
+                                              &buffer, &user_table, error))
+  {
+    return NULL;
+  }
+
+  session = infinoted_plugin_note_text_session_create(
+    io,
+    manager,
+    buffer,
+    user_table,
+    user_data
+  );
+
   g_object_unref(user_table);
   g_object_unref(buffer);
 
-  return INF_SESSION(session);
+  return session;
 }
 
 static gboolean
@@ -126,13 +178,41 @@ infinoted_plugin_note_text_session_write(InfdStorage* storage,
   );
 }
 
+static gsize
+infinoted_plugin_note_text_buffer_size(InfBuffer* buffer,
+                                       gpointer user_data)
+{
+  InfTextBuffer* text_buffer;
+  InfTextBufferIter* iter;
+  gsize size;
+
+  text_buffer = INF_TEXT_BUFFER(buffer);
+  size = 0;
+
+  iter = inf_text_buffer_create_begin_iter(text_buffer);
+  if(iter != NULL)
+  {
+    do
+    {
+      size += inf_text_buffer_iter_get_bytes(text_buffer, iter);
+    } while(inf_text_buffer_iter_next(text_buffer, iter));
+
+    inf_text_buffer_destroy_iter(text_buffer, iter);
+  }
+
+  return size;
+}
+
 const InfdNotePlugin INFINOTED_PLUGIN_NOTE_TEXT_PLUGIN = {
   NULL,
   "InfdFilesystemStorage",
   "InfText",
   infinoted_plugin_note_text_session_new,
   infinoted_plugin_note_text_session_read,
-  infinoted_plugin_note_text_session_write
+  infinoted_plugin_note_text_session_write,
+  infinoted_plugin_note_text_session_load,
+  infinoted_plugin_note_text_session_create,
+  infinoted_plugin_note_text_buffer_size
 };
 
 /* Infinoted plugin glue */
@@ -144,6 +224,8 @@ infinoted_plugin_note_text_info_initialize(gpointer plugin_info)
 
   plugin->manager = NULL;
   plugin->plugin = NULL;
+  plugin->journal = FALSE;
+  plugin->journal_compact_size = 1024;
 }
 
 static gboolean
@@ -202,8 +284,101 @@ infinoted_plugin_note_text_deinitialize(gpointer plugin_info)
   }
 }
 
+static void
+infinoted_plugin_note_text_session_added(const InfBrowserIter* iter,
+                                         InfSessionProxy* proxy,
+                                         gpointer plugin_info,
+                                         gpointer session_info)
+{
+  InfinotedPluginNoteText* plugin;
+  InfinotedPluginNoteTextSessionInfo* info;
+  InfdDirectory* directory;
+  InfdStorage* storage;
+  InfSession* session;
+  gchar* path;
+  GError* error;
+
+  plugin = (InfinotedPluginNoteText*)plugin_info;
+  info = (InfinotedPluginNoteTextSessionInfo*)session_info;
+  info->journal = NULL;
+
+  directory = infinoted_plugin_manager_get_directory(plugin->manager);
+  storage = infd_directory_get_storage(directory);
+
+  if(plugin->journal == FALSE || !INFD_IS_FILESYSTEM_STORAGE(storage))
+    return;
+
+  g_object_get(G_OBJECT(proxy), "session", &session, NULL);
+  path = inf_browser_get_path(INF_BROWSER(directory), iter);
+
+  error = NULL;
+  info->journal = inf_text_filesystem_journal_open(
+    INFD_FILESYSTEM_STORAGE(storage),
+    infd_directory_get_io(directory),
+    path,
+    inf_session_get_user_table(session),
+    INF_TEXT_BUFFER(inf_session_get_buffer(session)),
+    (gsize)plugin->journal_compact_size * 1024,
+    &error
+  );
+
+  if(info->journal == NULL)
+  {
+    infinoted_log_warning(
+      infinoted_plugin_manager_get_log(plugin->manager),
+      _("Failed to open journal for session \"%s\": %s\n\n"
+        "Changes to the session are only stored when it is saved."),
+      path,
+      error->message
+    );
+
+    g_error_free(error);
+  }
+
+  g_free(path);
+  g_object_unref(session);
+}
+
+static void
+infinoted_plugin_note_text_session_removed(const InfBrowserIter* iter,
+                                           InfSessionProxy* proxy,
+                                           gpointer plugin_info,
+                                           gpointer session_info)
+{
+  InfinotedPluginNoteTextSessionInfo* info;
+  info = (InfinotedPluginNoteTextSessionInfo*)session_info;
+
+  if(info->journal != NULL)
+  {
+    inf_text_filesystem_journal_close(info->journal);
+    info->journal = NULL;
+  }
+}
+
 static const InfinotedParameterInfo INFINOTED_PLUGIN_NOTE_TEXT_OPTIONS[] = {
   {
+    "journal",
+    INFINOTED_PARAMETER_BOOLEAN,
+    0,
+    offsetof(InfinotedPluginNoteText, journal),
+    infinoted_parameter_convert_boolean,
+    0,
+    N_("Whether to record every change to a document in a journal next to "
+       "it, so that no changes are lost if the server is terminated before "
+       "the document has been saved."),
+    NULL
+  }, {
+    "journal-compact-size",
+    INFINOTED_PARAMETER_INT,
+    0,
+    offsetof(InfinotedPluginNoteText, journal_compact_size),
+    infinoted_parameter_convert_nonnegative,
+    0,
+    N_("Size, in kilobytes, of a journal from which on the document is "
+       "written to disk in the background and the journal is emptied. If "
+       "0, the journal is only emptied when the document is saved."),
+    N_("KILOBYTES")
+  }, {
     NULL,
     0,
     0,
@@ -218,15 +393,15 @@ const InfinotedPlugin INFINOTED_PLUGIN = {
   INFINOTED_PLUGIN_NOTE_TEXT_OPTIONS,
   sizeof(InfinotedPluginNoteText),
   0,
-  0,
-  NULL,
+  sizeof(InfinotedPluginNoteTextSessionInfo),
+  "InfTextSession",
   infinoted_plugin_note_text_info_initialize,
   infinoted_plugin_note_text_initialize,
   infinoted_plugin_note_text_deinitialize,
   NULL,
   NULL,
-  NULL,
-  NULL
+  infinoted_plugin_note_text_session_added,
+  infinoted_plugin_note_text_session_removed
 };
 
 /* vim:set et sw=2 ts=2: */
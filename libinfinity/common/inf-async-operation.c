@@ -27,15 +27,28 @@
  * #InfAsyncOperation is a simple mechanism to run some code in a separate
  * worker thread and then, once the result is computed, notify the main thread
  * about the result.
+ *
+ * All operations of the process share a pool of worker threads. The number
+ * of threads in the pool is bounded, so that many concurrent operations do
+ * not exhaust the threads available to the process. If all threads are busy
+ * then operations are queued and run in the order in which they have been
+ * started. Operations that are cancelled before a thread has picked them up
+ * are not run at all.
  **/
 
 #include <libinfinity/common/inf-async-operation.h>
 #include <libinfinity/inf-i18n.h>
 
+/* Lower bound for the number of threads in the pool. The operations are
+ * typically blocking on something else than the CPU, such as name
+ * resolution, so we allow more threads than there are processors. */
+#define INF_ASYNC_OPERATION_MIN_THREADS 4
+
 struct _InfAsyncOperation {
   InfIo* io;
   InfIoDispatch* dispatch;
-  GThread* thread;
+  /* Whether the operation has been started and not yet dispatched */
+  gboolean running;
   GMutex mutex;
 
   InfAsyncOperationRunFunc run_func;
@@ -46,6 +59,8 @@ struct _InfAsyncOperation {
   GDestroyNotify run_notify;
 };
 
+static GThreadPool* inf_async_operation_pool;
+
 static void
 inf_async_operation_dispatch(gpointer data)
 {
@@ -64,18 +79,31 @@ inf_async_operation_dispatch(gpointer data)
 
   op->run_data = NULL;
   op->run_notify = NULL;
-  op->thread = NULL;
+  op->running = FALSE;
   g_mutex_clear(&op->mutex);
 
   inf_async_operation_free(op);
 }
 
-static gpointer
-inf_async_operation_thread_start(gpointer data)
+static void
+inf_async_operation_run(gpointer data,
+                        gpointer user_data)
 {
   InfAsyncOperation* op;
   op = (InfAsyncOperation*)data;
 
+  /* Don't bother running the operation if it has been cancelled while it
+   * was waiting for a free thread. */
+  g_mutex_lock(&op->mutex);
+  if(op->io == NULL)
+  {
+    g_mutex_unlock(&op->mutex);
+    g_mutex_clear(&op->mutex);
+    g_slice_free(InfAsyncOperation, op);
+    return;
+  }
+  g_mutex_unlock(&op->mutex);
+
   op->run_func(&op->run_data, &op->run_notify, op->user_data);
 
   g_mutex_lock(&op->mutex);
@@ -99,11 +127,8 @@ inf_async_operation_thread_start(gpointer data)
 
     g_mutex_unlock(&op->mutex);
     g_mutex_clear(&op->mutex);
-    g_thread_unref(op->thread);
     g_slice_free(InfAsyncOperation, op);
   }
-
-  return NULL;
 }
 
 static void
@@ -131,7 +156,8 @@ inf_async_operation_io_unref_func(gpointer user_data,
  * @user_data: Additional user data to pass to both functions.
  *
  * This function creates a new #InfAsyncOperation. The function given by
- * @run_func will be run asynchronously in a worker thread. Once the function
+ * @run_func will be run asynchronously in a worker thread of a pool shared
+ * by all operations of the process. Once the function
  * finishes, its result is passed back to the main thread defined by @io, and
  * @done_func is called with the computed result in the main thread.
  *
@@ -169,7 +195,7 @@ inf_async_operation_new(InfIo* io,
 
   op->io = io;
   op->dispatch = NULL;
-  op->thread = NULL;
+  op->running = FALSE;
 
   op->run_func = run_func;
   op->done_func = done_func;
@@ -193,7 +219,8 @@ inf_async_operation_new(InfIo* io,
  * @error: Location to store error information, if any.
  *
  * Starts the operation given in @op. The operation must have been created
- * before with inf_async_operation_new(). If the operation cannot be started,
+ * before with inf_async_operation_new(). It is run as soon as a worker thread
+ * becomes available. If the operation cannot be started,
  * @error is set and %FALSE is returned. In that case, the operation must not
  * be used anymore since it will be automatically freed.
  *
@@ -203,21 +230,31 @@ gboolean
 inf_async_operation_start(InfAsyncOperation* op,
                           GError** error)
 {
+  static gsize pool_initialized = 0;
+
   g_return_val_if_fail(op != NULL, FALSE);
-  g_return_val_if_fail(op->thread == NULL, FALSE);
+  g_return_val_if_fail(op->running == FALSE, FALSE);
+
+  if(g_once_init_enter(&pool_initialized))
+  {
+    inf_async_operation_pool = g_thread_pool_new(
+      inf_async_operation_run,
+      NULL,
+      MAX(INF_ASYNC_OPERATION_MIN_THREADS, 2 * g_get_num_processors()),
+      FALSE,
+      NULL
+    );
+
+    g_once_init_leave(&pool_initialized, 1);
+  }
 
   g_mutex_init(&op->mutex);
   g_mutex_lock(&op->mutex);
 
-  op->thread = g_thread_try_new(
-    "InfAsyncOperation",
-    inf_async_operation_thread_start,
-    op,
-    error
-  );
-
-  if(op->thread == NULL)
+  op->running = TRUE;
+  if(!g_thread_pool_push(inf_async_operation_pool, op, error))
   {
+    op->running = FALSE;
     g_mutex_unlock(&op->mutex);
     g_mutex_clear(&op->mutex);
     inf_async_operation_free(op);
@@ -242,7 +279,7 @@ inf_async_operation_free(InfAsyncOperation* op)
 {
   g_return_if_fail(op != NULL);
 
-  if(op->thread == NULL)
+  if(op->running == FALSE)
   {
     /* The async operation has not started yet,
      * or it has finished (dispatched) already. */
@@ -263,11 +300,13 @@ inf_async_operation_free(InfAsyncOperation* op)
 
     if(op->dispatch == NULL)
     {
-      /* We have not dispatched yet, i.e. the worker thread is still running.
-       * We keep the object alive, but remove the IO object, so that the
-       * worker thread does not attempt to dispatch. This also allows to
-       * unreference the IO object from this point onwards. The operation
-       * object is deleted when the thread finishes. */
+      /* We have not dispatched yet, i.e. the operation is still queued or
+       * the worker thread is still running. We keep the object alive, but
+       * remove the IO object, so that the worker thread does not attempt to
+       * dispatch, or does not run the operation at all if it has not
+       * started yet. This also allows to unreference the IO object from
+       * this point onwards. The operation object is deleted when the worker
+       * thread is done with it. */
       g_object_weak_unref(
         G_OBJECT(op->io),
         inf_async_operation_io_unref_func,
@@ -287,7 +326,6 @@ inf_async_operation_free(InfAsyncOperation* op)
 
       g_mutex_unlock(&op->mutex);
       g_mutex_clear(&op->mutex);
-      g_thread_unref(op->thread);
       g_slice_free(InfAsyncOperation, op);
     }
   }
@@ -27,15 +27,26 @@
  *
  * This is a thin wrapper class for #gnutls_certificate_credentials_t. It
  * provides reference counting and a boxed GType for it.
+ *
+ * In addition, it can hold a key for TLS session tickets. Since the same
+ * credentials are normally used for all connections of a server, this
+ * allows clients to resume a session on any of them, see
+ * inf_certificate_credentials_enable_session_tickets().
  **/
 
 #include <libinfinity/common/inf-certificate-credentials.h>
+#include <libinfinity/common/inf-error.h>
+
+#include <string.h>
 
 G_DEFINE_BOXED_TYPE(InfCertificateCredentials, inf_certificate_credentials, inf_certificate_credentials_ref, inf_certificate_credentials_unref)
 
 struct _InfCertificateCredentials {
-  guint ref_count;
+  /* Atomic, since a TLS handshake running in a worker thread can hold a
+   * reference */
+  gint ref_count;
   gnutls_certificate_credentials_t creds;
+  gnutls_datum_t ticket_key;
 };
 
 /**
@@ -56,6 +67,8 @@ inf_certificate_credentials_new(void)
 
   creds->ref_count = 1;
   gnutls_certificate_allocate_credentials(&creds->creds);
+  creds->ticket_key.data = NULL;
+  creds->ticket_key.size = 0;
 
   return creds;
 }
@@ -72,7 +85,7 @@ InfCertificateCredentials*
 inf_certificate_credentials_ref(InfCertificateCredentials* creds)
 {
   g_return_val_if_fail(creds != NULL, NULL);
-  ++creds->ref_count;
+  g_atomic_int_inc(&creds->ref_count);
   return creds;
 }
 
@@ -87,9 +100,16 @@ void
 inf_certificate_credentials_unref(InfCertificateCredentials* creds)
 {
   g_return_if_fail(creds != NULL);
-  if(!--creds->ref_count)
+  if(g_atomic_int_dec_and_test(&creds->ref_count))
   {
     gnutls_certificate_free_credentials(creds->creds);
+
+    if(creds->ticket_key.data != NULL)
+    {
+      memset(creds->ticket_key.data, 0, creds->ticket_key.size);
+      gnutls_free(creds->ticket_key.data);
+    }
+
     g_slice_free(InfCertificateCredentials, creds);
   }
 }
@@ -110,4 +130,87 @@ inf_certificate_credentials_get(InfCertificateCredentials* creds)
   return creds->creds;
 }
 
+/**
+ * inf_certificate_credentials_enable_session_tickets:
+ * @creds: A #InfCertificateCredentials.
+ * @key: (allow-none): The key to encrypt session tickets with, or %NULL.
+ * @error: Location to store error information, if any, or %NULL.
+ *
+ * Makes server-side connections using @creds issue TLS session tickets to
+ * their clients. With a ticket, a client can resume its session when it
+ * reconnects, which skips the certificate exchange and key agreement of a
+ * full handshake.
+ *
+ * Tickets are encrypted with @key, which needs to have been created by
+ * gnutls_session_ticket_key_generate(). If @key is %NULL, a new key is
+ * generated, which means that tickets issued before are no longer
+ * accepted. Pass the same key again, for example after a server restart,
+ * to keep existing tickets valid. The key is copied.
+ *
+ * This only affects connections whose TLS handshake starts after the call.
+ *
+ * Returns: %TRUE on success, or %FALSE if a new key could not be generated.
+ */
+gboolean
+inf_certificate_credentials_enable_session_tickets(
+  InfCertificateCredentials* creds,
+  const gnutls_datum_t* key,
+  GError** error)
+{
+  gnutls_datum_t new_key;
+  int res;
+
+  g_return_val_if_fail(creds != NULL, FALSE);
+  g_return_val_if_fail(key == NULL || key->size > 0, FALSE);
+  g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+  if(key != NULL)
+  {
+    new_key.data = gnutls_malloc(key->size);
+    new_key.size = key->size;
+    memcpy(new_key.data, key->data, key->size);
+  }
+  else
+  {
+    res = gnutls_session_ticket_key_generate(&new_key);
+    if(res != GNUTLS_E_SUCCESS)
+    {
+      inf_gnutls_set_error(error, res);
+      return FALSE;
+    }
+  }
+
+  if(creds->ticket_key.data != NULL)
+  {
+    memset(creds->ticket_key.data, 0, creds->ticket_key.size);
+    gnutls_free(creds->ticket_key.data);
+  }
+
+  creds->ticket_key = new_key;
+  return TRUE;
+}
+
+/**
+ * inf_certificate_credentials_get_session_ticket_key:
+ * @creds: A #InfCertificateCredentials.
+ *
+ * Returns the key that session tickets are encrypted with, or %NULL if
+ * session tickets have not been enabled with
+ * inf_certificate_credentials_enable_session_tickets().
+ *
+ * Returns: (transfer none) (allow-none): The session ticket key of @creds,
+ * or %NULL.
+ */
+const gnutls_datum_t*
+inf_certificate_credentials_get_session_ticket_key(
+  InfCertificateCredentials* creds)
+{
+  g_return_val_if_fail(creds != NULL, NULL);
+
+  if(creds->ticket_key.data == NULL)
+    return NULL;
+
+  return &creds->ticket_key;
+}
+
 /* vim:set et sw=2 ts=2: */
@@ -63,6 +63,10 @@ static const GFlagsValue inf_io_event_values[] = {
     INF_IO_ERROR,
     "INF_IO_ERROR",
     "error"
+  }, {
+    INF_IO_EDGE_TRIGGERED,
+    "INF_IO_EDGE_TRIGGERED",
+    "edge-triggered"
   }, {
     0,
     NULL,
@@ -77,13 +77,19 @@ typedef struct _InfIoDispatch InfIoDispatch;
  * @INF_IO_ERROR: An error with the socket occurred, or the connection has
  * been closed. Use getsockopt() to read the %SO_ERROR option to find out what
  * the problem is.
+ * @INF_IO_EDGE_TRIGGERED: Not an event by itself, but a hint that the watch
+ * function always reads or writes until the socket would block. Such a watch
+ * may only be notified when the socket becomes ready, instead of for as long
+ * as it stays ready. Implementations are free to ignore this flag, and it is
+ * never passed to the watch function.
  *
  * This enumeration specifies events that can be watched.
  */
 typedef enum _InfIoEvent {
-  INF_IO_INCOMING = 1 << 0,
-  INF_IO_OUTGOING = 1 << 1,
-  INF_IO_ERROR    = 1 << 2
+  INF_IO_INCOMING       = 1 << 0,
+  INF_IO_OUTGOING       = 1 << 1,
+  INF_IO_ERROR          = 1 << 2,
+  INF_IO_EDGE_TRIGGERED = 1 << 3
 } InfIoEvent;
 
 /**
@@ -34,6 +34,15 @@
  *
  * There can at most be one hostname lookup at a time. If you need more than
  * one concurrent hostname lookup, use multiple #InfNameResolver objects.
+ *
+ * Successful lookups are kept in a cache that is shared by all resolver
+ * objects of the process. As long as a cached result has not expired,
+ * inf_name_resolver_start() reports it without making a DNS query. Results
+ * expire after the TTL of the SRV records they were obtained from, but no
+ * later than one minute after the lookup, since the system resolver does not
+ * report the TTL of A and AAAA records. A result is removed from the cache
+ * when inf_name_resolver_lookup_backup() is called and no backup addresses
+ * are left, that is when none of its addresses could be connected to.
  **/
 
 #include <libinfinity/common/inf-name-resolver.h>
@@ -78,6 +87,7 @@ struct _InfNameResolverSRV {
   guint priority;
   guint weight;
   guint port;
+  guint ttl;
   gchar* address;
 };
 
@@ -92,9 +102,18 @@ struct _InfNameResolverResult {
   InfNameResolverSRV* srvs;
   guint n_srvs;
 
+  /* Number of seconds the result may be cached */
+  guint ttl;
+
   GError* error;
 };
 
+typedef struct _InfNameResolverCacheEntry InfNameResolverCacheEntry;
+struct _InfNameResolverCacheEntry {
+  InfNameResolverResult result;
+  gint64 expires;
+};
+
 typedef struct _InfNameResolverPrivate InfNameResolverPrivate;
 struct _InfNameResolverPrivate {
   InfIo* io;
@@ -103,6 +122,7 @@ struct _InfNameResolverPrivate {
   gchar* srv;
 
   InfAsyncOperation* operation;
+  InfIoDispatch* cache_dispatch;
 
   /* Output */
   InfNameResolverResult result;
@@ -123,10 +143,21 @@ enum {
   LAST_SIGNAL
 };
 
+/* Maximum time, in seconds, for which a lookup result is cached */
+#define INF_NAME_RESOLVER_CACHE_TTL 60
+
 #define INF_NAME_RESOLVER_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE((obj), INF_TYPE_NAME_RESOLVER, InfNameResolverPrivate))
 
 static guint name_resolver_signals[LAST_SIGNAL];
 
+/* Process-wide cache of lookup results, protected by a mutex since it is
+ * shared by all resolvers, no matter which thread their InfIo runs in. */
+static GMutex inf_name_resolver_cache_mutex;
+static GHashTable* inf_name_resolver_cache;
+/* Time after which expired results are removed from the cache with the next
+ * insertion, in microseconds. */
+static gint64 inf_name_resolver_cache_prune_time;
+
 G_DEFINE_TYPE_WITH_CODE(InfNameResolver, inf_name_resolver, G_TYPE_OBJECT,
   G_ADD_PRIVATE(InfNameResolver))
 
@@ -137,6 +168,7 @@ inf_name_resolver_result_nullify(InfNameResolverResult* result)
   result->n_entries = 0;
   result->srvs = NULL;
   result->n_srvs = 0;
+  result->ttl = 0;
   result->error = NULL;
 }
 
@@ -168,6 +200,167 @@ inf_name_resolver_result_free(gpointer result_ptr)
   g_slice_free(InfNameResolverResult, result);
 }
 
+/* Copies the entries and SRV records of src into dest, but not the error */
+static void
+inf_name_resolver_result_copy(InfNameResolverResult* dest,
+                              const InfNameResolverResult* src)
+{
+  guint i;
+
+  dest->entries = g_new(InfNameResolverEntry, src->n_entries);
+  dest->n_entries = src->n_entries;
+  for(i = 0; i < src->n_entries; ++i)
+  {
+    dest->entries[i].address = inf_ip_address_copy(src->entries[i].address);
+    dest->entries[i].port = src->entries[i].port;
+  }
+
+  dest->srvs = g_new(InfNameResolverSRV, src->n_srvs);
+  dest->n_srvs = src->n_srvs;
+  for(i = 0; i < src->n_srvs; ++i)
+  {
+    dest->srvs[i] = src->srvs[i];
+    dest->srvs[i].address = g_strdup(src->srvs[i].address);
+  }
+
+  dest->ttl = src->ttl;
+  dest->error = NULL;
+}
+
+/* Cache, can be accessed from any thread */
+
+static void
+inf_name_resolver_cache_entry_free(gpointer entry_ptr)
+{
+  InfNameResolverCacheEntry* entry;
+  entry = (InfNameResolverCacheEntry*)entry_ptr;
+
+  inf_name_resolver_result_cleanup(&entry->result);
+  g_slice_free(InfNameResolverCacheEntry, entry);
+}
+
+static gboolean
+inf_name_resolver_cache_expired_func(gpointer key,
+                                     gpointer value,
+                                     gpointer user_data)
+{
+  InfNameResolverCacheEntry* entry;
+  entry = (InfNameResolverCacheEntry*)value;
+
+  return entry->expires <= *(const gint64*)user_data;
+}
+
+static gchar*
+inf_name_resolver_cache_key(InfNameResolverPrivate* priv)
+{
+  return g_strdup_printf(
+    "%s\n%s\n%s",
+    priv->hostname,
+    priv->service != NULL ? priv->service : "",
+    priv->srv != NULL ? priv->srv : ""
+  );
+}
+
+static gboolean
+inf_name_resolver_cache_lookup(InfNameResolverPrivate* priv,
+                               InfNameResolverResult* result)
+{
+  InfNameResolverCacheEntry* entry;
+  gchar* key;
+  gboolean found;
+
+  key = inf_name_resolver_cache_key(priv);
+  found = FALSE;
+
+  g_mutex_lock(&inf_name_resolver_cache_mutex);
+  if(inf_name_resolver_cache != NULL)
+  {
+    entry = g_hash_table_lookup(inf_name_resolver_cache, key);
+    if(entry != NULL)
+    {
+      if(entry->expires > g_get_monotonic_time())
+      {
+        inf_name_resolver_result_copy(result, &entry->result);
+        found = TRUE;
+      }
+      else
+      {
+        g_hash_table_remove(inf_name_resolver_cache, key);
+      }
+    }
+  }
+  g_mutex_unlock(&inf_name_resolver_cache_mutex);
+
+  g_free(key);
+  return found;
+}
+
+static void
+inf_name_resolver_cache_insert(InfNameResolverPrivate* priv,
+                               const InfNameResolverResult* result)
+{
+  InfNameResolverCacheEntry* entry;
+  gint64 now;
+
+  /* Errors are not cached, so that the lookup is retried right away */
+  if(result->error != NULL || result->n_entries == 0 || result->ttl == 0)
+    return;
+
+  now = g_get_monotonic_time();
+  entry = g_slice_new(InfNameResolverCacheEntry);
+  inf_name_resolver_result_copy(&entry->result, result);
+  entry->expires = now + (gint64)result->ttl * G_USEC_PER_SEC;
+
+  g_mutex_lock(&inf_name_resolver_cache_mutex);
+  if(inf_name_resolver_cache == NULL)
+  {
+    inf_name_resolver_cache = g_hash_table_new_full(
+      g_str_hash,
+      g_str_equal,
+      g_free,
+      inf_name_resolver_cache_entry_free
+    );
+  }
+
+  /* Results of names that are not looked up again are only removed here.
+   * Since no result is cached for longer than INF_NAME_RESOLVER_CACHE_TTL,
+   * going through the cache at most once in that interval keeps it bounded
+   * by the number of names looked up within twice the interval. */
+  if(now >= inf_name_resolver_cache_prune_time)
+  {
+    g_hash_table_foreach_remove(
+      inf_name_resolver_cache,
+      inf_name_resolver_cache_expired_func,
+      &now
+    );
+
+    inf_name_resolver_cache_prune_time =
+      now + (gint64)INF_NAME_RESOLVER_CACHE_TTL * G_USEC_PER_SEC;
+  }
+
+  g_hash_table_replace(
+    inf_name_resolver_cache,
+    inf_name_resolver_cache_key(priv),
+    entry
+  );
+  g_mutex_unlock(&inf_name_resolver_cache_mutex);
+}
+
+static void
+inf_name_resolver_cache_remove(InfNameResolverPrivate* priv)
+{
+  gchar* key;
+
+  key = inf_name_resolver_cache_key(priv);
+
+  g_mutex_lock(&inf_name_resolver_cache_mutex);
+  if(inf_name_resolver_cache != NULL)
+    g_hash_table_remove(inf_name_resolver_cache, key);
+  g_mutex_unlock(&inf_name_resolver_cache_mutex);
+
+  g_free(key);
+}
+
 /* Worker thread */
 
 #ifndef G_OS_WIN32
@@ -323,6 +516,7 @@ inf_name_resolver_parse_srv_record(const char* msg,
   srv->priority = prio;
   srv->weight = weight;
   srv->port = port;
+  srv->ttl = ttl;
   srv->address = g_strdup(buf);
   return cur;
 }
@@ -448,6 +642,7 @@ inf_name_resolver_lookup_srv(const gchar* query,
     srv.priority = item->Data.SRV.wPriority;
     srv.weight = item->Data.SRV.wWeight;
     srv.port = item->Data.SRV.wPort;
+    srv.ttl = item->dwTtl;
     srv.address = g_strdup(item->Data.SRV.pNameTarget); // TODO: utf16_to_utf8?
     g_array_append_val(array, srv);
   }
@@ -717,12 +912,17 @@ inf_name_resolver_resolve(const gchar* hostname,
   InfNameResolverResult* result;
   gchar* query;
   GError* error;
+  guint i;
 
   error = NULL;
 
   result = g_slice_new(InfNameResolverResult);
   inf_name_resolver_result_nullify(result);
 
+  /* getaddrinfo() does not tell us the TTL of the A/AAAA records, so we
+   * assume a short one. */
+  result->ttl = INF_NAME_RESOLVER_CACHE_TTL;
+
   /* Look up a SRV record */
   if(srv != NULL)
   {
@@ -749,6 +949,9 @@ inf_name_resolver_resolve(const gchar* hostname,
     }
     else if(result->n_srvs > 0)
     {
+      for(i = 0; i < result->n_srvs; ++i)
+        result->ttl = MIN(result->ttl, result->srvs[i].ttl);
+
       result->entries = inf_name_resolver_resolve_srv(
         &result->srvs,
         &result->n_srvs,
@@ -871,6 +1074,7 @@ inf_name_resolver_done_func(gpointer run_data,
 
   /* Nullify this so that the destroy notify lets the data alive */
   inf_name_resolver_result_nullify(result);
+  inf_name_resolver_cache_insert(priv, &priv->result);
 
   g_signal_emit(
     G_OBJECT(resolver),
@@ -928,6 +1132,25 @@ inf_name_resolver_backup_done_func(gpointer run_data,
   );
 }
 
+static void
+inf_name_resolver_cached_func(gpointer user_data)
+{
+  InfNameResolver* resolver;
+  InfNameResolverPrivate* priv;
+
+  resolver = INF_NAME_RESOLVER(user_data);
+  priv = INF_NAME_RESOLVER_PRIVATE(resolver);
+
+  priv->cache_dispatch = NULL;
+
+  g_signal_emit(
+    G_OBJECT(resolver),
+    name_resolver_signals[RESOLVED],
+    0,
+    NULL
+  );
+}
+
 static void
 inf_name_resolver_init(InfNameResolver* resolver)
 {
@@ -940,6 +1163,7 @@ inf_name_resolver_init(InfNameResolver* resolver)
   priv->srv = NULL;
 
   priv->operation = NULL;
+  priv->cache_dispatch = NULL;
 
   inf_name_resolver_result_nullify(&priv->result);
 }
@@ -959,6 +1183,12 @@ inf_name_resolver_dispose(GObject* object)
     priv->operation = NULL;
   }
 
+  if(priv->cache_dispatch != NULL)
+  {
+    inf_io_remove_dispatch(priv->io, priv->cache_dispatch);
+    priv->cache_dispatch = NULL;
+  }
+
   if(priv->io != NULL)
   {
     g_object_unref(G_OBJECT(priv->io));
@@ -1254,6 +1484,11 @@ inf_name_resolver_get_srv(InfNameResolver* resolver)
  * result can no longer be obtained with the inf_name_resolver_get_address()
  * and inf_name_resolver_get_port() functions.
  *
+ * If a result for the same hostname, service and SRV record is in the
+ * cache and has not yet expired, it is used without making a DNS query. The
+ * #InfNameResolver::resolved signal is still emitted asynchronously in that
+ * case.
+ *
  * Returns: %TRUE on success or %FALSE if a (synchronous) error occurred.
  */
 gboolean
@@ -1268,10 +1503,23 @@ inf_name_resolver_start(InfNameResolver* resolver,
 
   priv = INF_NAME_RESOLVER_PRIVATE(resolver);
   g_return_val_if_fail(priv->operation == NULL, FALSE);
+  g_return_val_if_fail(priv->cache_dispatch == NULL, FALSE);
 
   inf_name_resolver_result_cleanup(&priv->result);
   inf_name_resolver_result_nullify(&priv->result);
 
+  if(inf_name_resolver_cache_lookup(priv, &priv->result))
+  {
+    priv->cache_dispatch = inf_io_add_dispatch(
+      priv->io,
+      inf_name_resolver_cached_func,
+      resolver,
+      NULL
+    );
+
+    return TRUE;
+  }
+
   priv->operation = inf_async_operation_new(
     priv->io,
     inf_name_resolver_run_func,
@@ -1303,7 +1551,9 @@ inf_name_resolver_start(InfNameResolver* resolver,
  * The function returns %FALSE if there are no backup addresses available, or
  * %TRUE otherwise. If it returns %TRUE, it the #InfNameResolver::resolved
  * signal will be emitted again, and when it is, more addresses might be
- * available from the resolver object.
+ * available from the resolver object. If it returns %FALSE, the result of
+ * the lookup is removed from the cache, so that the next call to
+ * inf_name_resolver_start() makes a new DNS query.
  *
  * Returns: %TRUE if looking up backup addresses is attempted, or %FALSE
  * otherwise.
@@ -1320,9 +1570,14 @@ inf_name_resolver_lookup_backup(InfNameResolver* resolver,
 
   priv = INF_NAME_RESOLVER_PRIVATE(resolver);
   g_return_val_if_fail(priv->operation == NULL, FALSE);
+  g_return_val_if_fail(priv->cache_dispatch == NULL, FALSE);
 
   if(priv->result.n_srvs == 0)
+  {
+    /* None of the addresses worked, so they are probably outdated */
+    inf_name_resolver_cache_remove(priv);
     return FALSE;
+  }
 
   if(priv->result.error != NULL)
   {
@@ -1369,7 +1624,7 @@ inf_name_resolver_finished(InfNameResolver* resolver)
 
   priv = INF_NAME_RESOLVER_PRIVATE(resolver);
 
-  if(priv->operation != NULL)
+  if(priv->operation != NULL || priv->cache_dispatch != NULL)
     return FALSE;
 
   return TRUE;
@@ -1443,4 +1698,20 @@ inf_name_resolver_get_port(InfNameResolver* resolver,
   return priv->result.entries[index].port;
 }
 
+/**
+ * inf_name_resolver_clear_cache:
+ *
+ * Removes all results from the cache that is shared by all #InfNameResolver
+ * objects, so that subsequent lookups make new DNS queries. This can be
+ * used when the network configuration of the host has changed.
+ */
+void
+inf_name_resolver_clear_cache(void)
+{
+  g_mutex_lock(&inf_name_resolver_cache_mutex);
+  if(inf_name_resolver_cache != NULL)
+    g_hash_table_remove_all(inf_name_resolver_cache);
+  g_mutex_unlock(&inf_name_resolver_cache_mutex);
+}
+
 /* vim:set et sw=2 ts=2: */
@@ -106,6 +106,9 @@ guint
 inf_name_resolver_get_port(InfNameResolver* resolver,
                            guint index);
 
+void
+inf_name_resolver_clear_cache(void);
+
 G_END_DECLS
 
 #endif /* __INF_NAME_RESOLVER_H__ */
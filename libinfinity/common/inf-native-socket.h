@@ -48,12 +48,16 @@ typedef int InfNativeSocket;
 /* This is not a typo here. On Windows, connect() returns WSAEWOULDBLOCK on
  * a non-blocking socket. */
 # define INF_NATIVE_SOCKET_EINPROGRESS    WSAEWOULDBLOCK
+# define INF_NATIVE_SOCKET_ETIMEDOUT      WSAETIMEDOUT
+# define INF_NATIVE_SOCKET_ENOPROTOOPT    WSAENOPROTOOPT
 #else
 extern const int INF_NATIVE_SOCKET_SENDRECV_FLAGS;
 # define INF_NATIVE_SOCKET_LAST_ERROR     errno
 # define INF_NATIVE_SOCKET_EINTR          EINTR
 # define INF_NATIVE_SOCKET_EAGAIN         EAGAIN
 # define INF_NATIVE_SOCKET_EINPROGRESS    EINPROGRESS
+# define INF_NATIVE_SOCKET_ETIMEDOUT      ETIMEDOUT
+# define INF_NATIVE_SOCKET_ENOPROTOOPT    ENOPROTOOPT
 # define closesocket(s) close(s)
 # define INVALID_SOCKET -1
 #endif
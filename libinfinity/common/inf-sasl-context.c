@@ -32,7 +32,14 @@
  * to give control back to a main loop while waiting for user input.
  *
  * This wrapper makes sure the callback is called in another thread so that it
- * can block without affecting the rest of the program.
+ * can block without affecting the rest of the program. The SASL steps of all
+ * sessions are run on a thread pool shared by all #InfSaslContext objects,
+ * whose size is bounded by the number of processors. Steps of the same
+ * session are never run concurrently and are processed in the order in which
+ * they have been requested. While a step waits for a property to be provided
+ * it does not occupy a slot of the pool, so that sessions waiting for user
+ * input do not delay the others. Use inf_sasl_context_get_queue_statistics()
+ * to find out how long sessions had to wait for the pool.
  * Use inf_sasl_context_session_feed() as a replacement for gsasl_step64().
  * Instead of returning the result data directly, the function calls a
  * callback once all properties requested have been provided.
@@ -80,13 +87,21 @@ struct _InfSaslContextSession {
    * need the mutex for this if InfIo would allow to set the
    * InfIoDispatch pointer before executing the dispatch. */
   InfIoDispatch* dispatch;
-  GThread* thread;
+  /* Whether there is a job for this session in the thread pool, since when
+   * it has been waiting there, whether a pool thread has started running it,
+   * and whether the session has been stopped before that happened, in which
+   * case the job frees what is left of the session. Protected by the pool
+   * mutex. */
+  gboolean scheduled;
+  gint64 scheduled_time;
+  gboolean running;
+  gboolean cancelled;
   /* This flag tells whether we are currently processing user data in the
    * helper thread. It is meant as a simple indicator in the main thread
    * whether more data can be given to the context or not. */
   gboolean stepping;
 
-  /* used in session thread only */
+  /* used in the session's pool job only */
   gchar* step64;
   InfSaslContextSessionFeedFunc feed_func;
   gpointer feed_user_data;
@@ -138,8 +153,22 @@ struct _InfSaslContext {
   /* protects the session list, the callback function and access to the
    * Gsasl object. */
   GMutex mutex;
+
+  /* Queueing statistics, protected by the pool mutex */
+  guint64 n_jobs;
+  gint64 total_queue_delay;
+  gint64 max_queue_delay;
 };
 
+/* The pool running the SASL steps of all sessions. The pool mutex protects
+ * the scheduling state of the sessions and the number of pool threads that
+ * currently wait for a property to be provided. */
+static GThreadPool* inf_sasl_context_pool;
+static guint inf_sasl_context_pool_size;
+static guint inf_sasl_context_pool_n_blocked;
+static GMutex inf_sasl_context_pool_mutex;
+static GCond inf_sasl_context_pool_cond;
+
 /*
  * Message handling
  */
@@ -341,6 +370,25 @@ inf_sasl_context_session_message_func(gpointer user_data)
   }
 }
 
+static void
+inf_sasl_context_pool_set_blocked(gboolean blocked)
+{
+  g_mutex_lock(&inf_sasl_context_pool_mutex);
+
+  if(blocked)
+    ++inf_sasl_context_pool_n_blocked;
+  else
+    --inf_sasl_context_pool_n_blocked;
+
+  g_thread_pool_set_max_threads(
+    inf_sasl_context_pool,
+    inf_sasl_context_pool_size + inf_sasl_context_pool_n_blocked,
+    NULL
+  );
+
+  g_mutex_unlock(&inf_sasl_context_pool_mutex);
+}
+
 static int
 inf_sasl_context_gsasl_callback(Gsasl* gsasl,
                                 Gsasl_session* gsasl_session,
@@ -369,6 +417,10 @@ inf_sasl_context_gsasl_callback(Gsasl* gsasl,
 
   g_mutex_unlock(&session->context->mutex);
 
+  /* This can take arbitrarily long, for example if the user is asked for a
+   * password, so let another thread take our place in the pool meanwhile. */
+  inf_sasl_context_pool_set_blocked(TRUE);
+
   session->retval = G_MAXINT;
   while(session->status == INF_SASL_CONTEXT_SESSION_INNER &&
         session->retval == G_MAXINT)
@@ -378,6 +430,8 @@ inf_sasl_context_gsasl_callback(Gsasl* gsasl,
     inf_sasl_context_message_free(message);
   }
 
+  inf_sasl_context_pool_set_blocked(FALSE);
+
   g_mutex_lock(&session->context->mutex);
 
   /* return on terminate */
@@ -388,100 +442,163 @@ inf_sasl_context_gsasl_callback(Gsasl* gsasl,
   return session->retval;
 }
 
-static void*
-inf_sasl_context_thread_func(gpointer data)
+static void
+inf_sasl_context_session_step(InfSaslContextSession* session)
 {
-  InfSaslContextSession* session;
-  InfSaslContextMessage* message;
-
-  session = (InfSaslContextSession*)data;
-
   int retval;
   char* output;
   InfSaslContextSessionFeedFunc feed_func;
   gpointer feed_user_data;
 
-  /* Wait for something to do */
-  while(session->status != INF_SASL_CONTEXT_SESSION_TERMINATE)
+  g_mutex_lock(&session->context->mutex);
+
+  g_assert(session->dispatch == NULL);
+
+  /* This might call the gsasl callback once or more in which we wait
+   * for input from the main thread. */
+  retval = gsasl_step64(
+    session->session,
+    session->step64,
+    &output
+  );
+
+  g_mutex_unlock(&session->context->mutex);
+
+  g_free(session->step64);
+  session->step64 = NULL;
+
+  if(retval != GSASL_OK && retval != GSASL_NEEDS_MORE)
+    output = NULL;
+
+  /* Only process the result when we were not requested to terminate
+   * within the gsasl callback. */
+  if(session->status != INF_SASL_CONTEXT_SESSION_TERMINATE)
   {
-    switch(session->status)
-    {
-    case INF_SASL_CONTEXT_SESSION_OUTER:
-      message = g_async_queue_pop(session->session_queue);
-      inf_sasl_context_session_message_func(message);
-      inf_sasl_context_message_free(message);
-      break;
-    case INF_SASL_CONTEXT_SESSION_INNER:
-      g_mutex_lock(&session->context->mutex);
+    feed_func = session->feed_func;
+    feed_user_data = session->feed_user_data;
+    session->feed_func = NULL; /* clear, so that feed can be called again */
+
+    session->status = INF_SASL_CONTEXT_SESSION_OUTER;
+
+    g_mutex_lock(&session->context->mutex);
+
+    g_assert(session->dispatch == NULL);
+
+    session->dispatch = inf_io_add_dispatch(
+      INF_IO(session->main_io),
+      inf_sasl_context_session_message_func,
+      inf_sasl_context_message_stepped(
+        session,
+        output,
+        retval,
+        feed_func,
+        feed_user_data
+      ),
+      inf_sasl_context_message_free
+    );
 
-      g_assert(session->dispatch == NULL);
+    g_mutex_unlock(&session->context->mutex);
+  }
+  else
+  {
+    session->feed_func = NULL;
+    if(output) gsasl_free(output);
+  }
+}
 
-      /* This might call the gsasl callback once or more in which we wait
-       * for input from the main thread. */
-      retval = gsasl_step64(
-        session->session,
-        session->step64,
-        &output
-      );
+/* Runs in the thread pool. Processes the messages queued for the session
+ * until there are no more, or until the session is terminated. There is only
+ * ever one job per session, so the session's messages are handled in
+ * order. */
+static void
+inf_sasl_context_session_run(gpointer data,
+                             gpointer user_data)
+{
+  InfSaslContextSession* session;
+  InfSaslContext* context;
+  InfSaslContextMessage* message;
+  gint64 delay;
 
-      g_mutex_unlock(&session->context->mutex);
+  session = (InfSaslContextSession*)data;
+  context = session->context;
 
-      g_free(session->step64);
-      session->step64 = NULL;
+  g_mutex_lock(&inf_sasl_context_pool_mutex);
+  if(session->cancelled == TRUE)
+  {
+    /* The session has been stopped while the job was queued, and everything
+     * else has been freed already. The context might be gone as well. */
+    g_mutex_unlock(&inf_sasl_context_pool_mutex);
+    g_async_queue_unref(session->session_queue);
+    g_slice_free(InfSaslContextSession, session);
+    return;
+  }
 
-      if(retval != GSASL_OK && retval != GSASL_NEEDS_MORE)
-        output = NULL;
+  session->running = TRUE;
+  delay = g_get_monotonic_time() - session->scheduled_time;
+  ++context->n_jobs;
+  context->total_queue_delay += delay;
+  if(delay > context->max_queue_delay)
+    context->max_queue_delay = delay;
+  g_mutex_unlock(&inf_sasl_context_pool_mutex);
 
-      /* Only process the result when we were not requested to terminate
-       * within the gsasl callback. */
-      if(session->status != INF_SASL_CONTEXT_SESSION_TERMINATE)
-      {
-        feed_func = session->feed_func;
-        feed_user_data = session->feed_user_data;
-        session->feed_func = NULL; /* clear, so that feed can be called again */
-
-        session->status = INF_SASL_CONTEXT_SESSION_OUTER;
-
-        g_mutex_lock(&session->context->mutex);
-
-        g_assert(session->dispatch == NULL);
-
-        session->dispatch = inf_io_add_dispatch(
-          INF_IO(session->main_io),
-          inf_sasl_context_session_message_func,
-          inf_sasl_context_message_stepped(
-            session,
-            output,
-            retval,
-            feed_func,
-            feed_user_data
-          ),
-          inf_sasl_context_message_free
-        );
-
-        g_mutex_unlock(&session->context->mutex);
-      }
-      else
+  while(session->status != INF_SASL_CONTEXT_SESSION_TERMINATE)
+  {
+    message = g_async_queue_try_pop(session->session_queue);
+    if(message == NULL)
+    {
+      /* Nothing to do anymore. Check again with the pool mutex held, since
+       * a new message might have been pushed in the meanwhile, in which case
+       * the pusher relies on us to process it. */
+      g_mutex_lock(&inf_sasl_context_pool_mutex);
+      if(g_async_queue_length(session->session_queue) <= 0)
       {
-        session->feed_func = NULL;
-        if(output) gsasl_free(output);
+        session->scheduled = FALSE;
+        session->running = FALSE;
+        g_cond_broadcast(&inf_sasl_context_pool_cond);
+        g_mutex_unlock(&inf_sasl_context_pool_mutex);
+        return;
       }
 
-      break;
-    case INF_SASL_CONTEXT_SESSION_TERMINATE:
-    default:
-      g_assert_not_reached();
-      break;
+      g_mutex_unlock(&inf_sasl_context_pool_mutex);
+    }
+    else
+    {
+      inf_sasl_context_session_message_func(message);
+      inf_sasl_context_message_free(message);
+
+      if(session->status == INF_SASL_CONTEXT_SESSION_INNER)
+        inf_sasl_context_session_step(session);
     }
   }
 
-  return NULL;
+  /* Note that the session can be freed as soon as we unlock the mutex */
+  g_mutex_lock(&inf_sasl_context_pool_mutex);
+  session->scheduled = FALSE;
+  session->running = FALSE;
+  g_cond_broadcast(&inf_sasl_context_pool_cond);
+  g_mutex_unlock(&inf_sasl_context_pool_mutex);
 }
 
 /*
  * Helper functions
  */
 
+static void
+inf_sasl_context_session_push(InfSaslContextSession* session,
+                              InfSaslContextMessage* message)
+{
+  g_async_queue_push(session->session_queue, message);
+
+  g_mutex_lock(&inf_sasl_context_pool_mutex);
+  if(session->scheduled == FALSE)
+  {
+    session->scheduled = TRUE;
+    session->scheduled_time = g_get_monotonic_time();
+    g_thread_pool_push(inf_sasl_context_pool, session, NULL);
+  }
+  g_mutex_unlock(&inf_sasl_context_pool_mutex);
+}
+
 static InfSaslContextSession*
 inf_sasl_context_start_session(InfSaslContext* context,
                                InfIo* io,
@@ -489,7 +606,23 @@ inf_sasl_context_start_session(InfSaslContext* context,
                                gpointer session_data,
                                GError** error)
 {
+  static gsize pool_initialized = 0;
   InfSaslContextSession* session;
+
+  if(g_once_init_enter(&pool_initialized))
+  {
+    inf_sasl_context_pool_size = g_get_num_processors();
+    inf_sasl_context_pool = g_thread_pool_new(
+      inf_sasl_context_session_run,
+      NULL,
+      inf_sasl_context_pool_size,
+      FALSE,
+      NULL
+    );
+
+    g_once_init_leave(&pool_initialized, 1);
+  }
+
   session = g_slice_new(InfSaslContextSession);
 
   session->context = context;
@@ -500,7 +633,10 @@ inf_sasl_context_start_session(InfSaslContext* context,
   session->session_queue =
     g_async_queue_new_full(inf_sasl_context_message_free);
   session->dispatch = NULL;
-  session->thread = NULL;
+  session->scheduled = FALSE;
+  session->scheduled_time = 0;
+  session->running = FALSE;
+  session->cancelled = FALSE;
   session->stepping = FALSE;
 
   session->status = INF_SASL_CONTEXT_SESSION_OUTER;
@@ -512,22 +648,6 @@ inf_sasl_context_start_session(InfSaslContext* context,
   context->sessions = g_slist_prepend(context->sessions, session);
   gsasl_session_hook_set(gsasl_session, session);
 
-  session->thread = g_thread_try_new(
-    "InfSaslContext",
-    inf_sasl_context_thread_func,
-    session,
-    error
-  );
-
-  if(session->thread == NULL)
-  {
-    context->sessions = g_slist_remove(context->sessions, session);
-    g_async_queue_unref(session->session_queue);
-    g_object_unref(session->main_io);
-    g_slice_free(InfSaslContextSession, session);
-    return NULL;
-  }
-
   return session;
 }
 
@@ -571,6 +691,10 @@ inf_sasl_context_new(GError** error)
   sasl->callback_user_data = NULL;
   sasl->callback_notify = NULL;
 
+  sasl->n_jobs = 0;
+  sasl->total_queue_delay = 0;
+  sasl->max_queue_delay = 0;
+
   gsasl_callback_set(gsasl, inf_sasl_context_gsasl_callback);
   gsasl_callback_hook_set(gsasl, sasl);
 
@@ -615,7 +739,7 @@ inf_sasl_context_unref(InfSaslContext* context)
   {
     /* Note that we don't need to lock the mutex here since if nobody has a
      * reference anymore then they cannot access the session list concurrently
-     * anyway. Also, the session threads do not access the list at all. */
+     * anyway. Also, the session jobs do not access the list at all. */
     while(context->sessions != NULL)
     {
       inf_sasl_context_stop_session(
@@ -625,7 +749,7 @@ inf_sasl_context_unref(InfSaslContext* context)
     }
 
     /* Again we don't need to lock the mutex for this since all session
-     * threads have been stopped at this point. */
+     * jobs have been stopped at this point. */
     gsasl_done(context->gsasl);
     g_mutex_clear(&context->mutex);
 
@@ -959,7 +1083,10 @@ inf_sasl_context_server_supports_mechanism(InfSaslContext* context,
  *
  * Finishes @session and frees all resources allocated to it. This can be used
  * to cancel an authentication session, or to free it after it finished
- * (either successfully or not).
+ * (either successfully or not). If data for @session is currently being
+ * processed in a background thread, then this function waits until that
+ * has been aborted. Data that is only queued for processing is discarded
+ * without waiting.
  *
  * @session should no longer be used after this function was called.
  */
@@ -967,6 +1094,8 @@ void
 inf_sasl_context_stop_session(InfSaslContext* context,
                               InfSaslContextSession* session)
 {
+  gboolean queued;
+
   g_return_if_fail(context != NULL);
   g_return_if_fail(session != NULL);
 
@@ -975,13 +1104,25 @@ inf_sasl_context_stop_session(InfSaslContext* context,
   g_return_if_fail(session->context == context);
   g_mutex_unlock(&context->mutex);
 
-  /* Tell client thread to terminate */
-  g_async_queue_push(
-    session->session_queue,
-    inf_sasl_context_message_terminate(session)
-  );
+  /* If a pool thread is running the session's job, tell it to terminate
+   * and wait for it to finish. If the job is still queued, then it has not
+   * touched the session yet, and we do not wait for a thread to become
+   * free, which can take long when the pool is busy. The pool mutex is
+   * held until the session has been cleaned up, so that the job cannot
+   * start meanwhile. Otherwise there is nobody accessing the session
+   * anymore. */
+  g_mutex_lock(&inf_sasl_context_pool_mutex);
+  queued = session->scheduled == TRUE && session->running == FALSE;
+  if(session->scheduled == TRUE && session->running == TRUE)
+  {
+    g_async_queue_push(
+      session->session_queue,
+      inf_sasl_context_message_terminate(session)
+    );
 
-  g_thread_join(session->thread);
+    while(session->scheduled == TRUE)
+      g_cond_wait(&inf_sasl_context_pool_cond, &inf_sasl_context_pool_mutex);
+  }
 
   g_mutex_lock(&context->mutex);
   if(session->dispatch != NULL)
@@ -991,15 +1132,20 @@ inf_sasl_context_stop_session(InfSaslContext* context,
   gsasl_finish(session->session);
   g_mutex_unlock(&context->mutex);
 
-  /* Note that this assertion should hold because us pushing the terminate
-   * message into the end of the queue, and all other queued messages will
-   * have been processed before. */
-  g_async_queue_unref(session->session_queue);
-
   g_object_unref(session->main_io);
-
   g_free(session->step64);
-  g_slice_free(InfSaslContextSession, session);
+
+  /* The queued job drops the messages that are still queued, and frees the
+   * session once it gets to run. */
+  if(queued == TRUE)
+    session->cancelled = TRUE;
+  g_mutex_unlock(&inf_sasl_context_pool_mutex);
+
+  if(queued == FALSE)
+  {
+    g_async_queue_unref(session->session_queue);
+    g_slice_free(InfSaslContextSession, session);
+  }
 }
 
 /**
@@ -1070,8 +1216,8 @@ inf_sasl_context_session_continue(InfSaslContextSession* session,
 {
   g_return_if_fail(session != NULL);
 
-  g_async_queue_push(
-    session->session_queue,
+  inf_sasl_context_session_push(
+    session,
     inf_sasl_context_message_continue(session, retval)
   );
 }
@@ -1105,8 +1251,8 @@ inf_sasl_context_session_feed(InfSaslContextSession* session,
 
   session->stepping = TRUE;
 
-  g_async_queue_push(
-    session->session_queue,
+  inf_sasl_context_session_push(
+    session,
     inf_sasl_context_message_step(session, data, func, user_data)
   );
 }
@@ -1128,4 +1274,34 @@ inf_sasl_context_session_is_processing(InfSaslContextSession* session)
   return session->stepping;
 }
 
+/**
+ * inf_sasl_context_get_queue_statistics:
+ * @context: A #InfSaslContext.
+ * @n_jobs: (out) (allow-none): Location to store the number of jobs that
+ * have been run for sessions of @context, or %NULL.
+ * @total_delay: (out) (allow-none): Location to store the sum of the time
+ * the jobs have been waiting for a free thread, in microseconds, or %NULL.
+ * @max_delay: (out) (allow-none): Location to store the longest time a job
+ * has been waiting for a free thread, in microseconds, or %NULL.
+ *
+ * Returns statistics about how long the sessions of @context had to wait
+ * for the shared thread pool before their data could be processed. A job
+ * is scheduled whenever data is fed to a session or a requested property
+ * has been provided while the session was idle.
+ */
+void
+inf_sasl_context_get_queue_statistics(InfSaslContext* context,
+                                      guint64* n_jobs,
+                                      gint64* total_delay,
+                                      gint64* max_delay)
+{
+  g_return_if_fail(context != NULL);
+
+  g_mutex_lock(&inf_sasl_context_pool_mutex);
+  if(n_jobs != NULL) *n_jobs = context->n_jobs;
+  if(total_delay != NULL) *total_delay = context->total_queue_delay;
+  if(max_delay != NULL) *max_delay = context->max_queue_delay;
+  g_mutex_unlock(&inf_sasl_context_pool_mutex);
+}
+
 /* vim:set et sw=2 ts=2: */
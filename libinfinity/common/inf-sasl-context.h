@@ -174,6 +174,12 @@ inf_sasl_context_session_feed(InfSaslContextSession* session,
 gboolean
 inf_sasl_context_session_is_processing(InfSaslContextSession* session);
 
+void
+inf_sasl_context_get_queue_statistics(InfSaslContext* context,
+                                      guint64* n_jobs,
+                                      gint64* total_delay,
+                                      gint64* max_delay);
+
 G_END_DECLS
 
 #endif /* __INF_SASL_CONTEXT_H__ */
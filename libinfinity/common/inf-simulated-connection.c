@@ -28,10 +28,21 @@
  * where a #InfXmlConnection is expected. Use
  * inf_simulated_connection_connect() to connect two such connections so that
  * data sent through one is received by the other.
+ *
+ * In %INF_SIMULATED_CONNECTION_EMULATED mode, the connection emulates the
+ * conditions of a real network link: each message is delivered after the
+ * time it takes to transmit it with #InfSimulatedConnection:bandwidth bytes
+ * per second, plus #InfSimulatedConnection:latency milliseconds, plus a
+ * random delay of up to #InfSimulatedConnection:jitter milliseconds. Unless
+ * #InfSimulatedConnection:reorder is set, messages are never delivered
+ * before a message that was sent earlier. The properties affect the
+ * messages sent through the connection they are set on, so for a symmetric
+ * link they need to be set on both connections.
  */
 
 #include <libinfinity/common/inf-simulated-connection.h>
 #include <libinfinity/common/inf-xml-connection.h>
+#include <libinfinity/common/inf-xml-util.h>
 #include <libinfinity/inf-define-enum.h>
 
 static const GEnumValue inf_simulated_connection_mode_values[] = {
@@ -47,6 +58,10 @@ static const GEnumValue inf_simulated_connection_mode_values[] = {
     INF_SIMULATED_CONNECTION_IO_CONTROLLED,
     "INF_SIMULATED_CONNECTION_IO_CONTROLLED",
     "io-controlled"
+  }, {
+    INF_SIMULATED_CONNECTION_EMULATED,
+    "INF_SIMULATED_CONNECTION_EMULATED",
+    "emulated"
   }, {
     0,
     NULL,
@@ -54,6 +69,13 @@ static const GEnumValue inf_simulated_connection_mode_values[] = {
   }
 };
 
+/* A message in emulated mode, waiting for its delivery time */
+typedef struct _InfSimulatedConnectionPacket InfSimulatedConnectionPacket;
+struct _InfSimulatedConnectionPacket {
+  xmlNodePtr xml;
+  gint64 delivery;
+};
+
 typedef struct _InfSimulatedConnectionPrivate InfSimulatedConnectionPrivate;
 struct _InfSimulatedConnectionPrivate {
   InfIo* io;
@@ -64,6 +86,21 @@ struct _InfSimulatedConnectionPrivate {
 
   xmlNodePtr queue;
   xmlNodePtr queue_last_item;
+
+  /* Network emulation */
+  guint latency;
+  guint jitter;
+  guint bandwidth;
+  gboolean reorder;
+  guint seed;
+  GRand* rand;
+  GString* buffer;
+
+  /* Packets sorted by delivery time, all times are monotonic time */
+  GQueue packets;
+  InfIoTimeout* packet_timeout;
+  gint64 link_free;
+  gint64 last_delivery;
 };
 
 enum {
@@ -74,13 +111,20 @@ enum {
   PROP_TARGET,
   PROP_MODE,
 
+  PROP_LATENCY,
+  PROP_JITTER,
+  PROP_BANDWIDTH,
+  PROP_REORDER,
+  PROP_SEED,
+
   /* From InfXmlConnection */
   PROP_STATUS,
   PROP_NETWORK,
   PROP_LOCAL_ID,
   PROP_REMOTE_ID,
   PROP_LOCAL_CERTIFICATE,
-  PROP_REMOTE_CERTIFICATE
+  PROP_REMOTE_CERTIFICATE,
+  PROP_CONGESTED
 };
 
 #define INF_SIMULATED_CONNECTION_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE((obj), INF_TYPE_SIMULATED_CONNECTION, InfSimulatedConnectionPrivate))
@@ -95,6 +139,7 @@ static void
 inf_simulated_connection_clear_queue(InfSimulatedConnection* connection)
 {
   InfSimulatedConnectionPrivate* priv;
+  InfSimulatedConnectionPacket* packet;
   xmlNodePtr next;
 
   priv = INF_SIMULATED_CONNECTION_PRIVATE(connection);
@@ -115,6 +160,24 @@ inf_simulated_connection_clear_queue(InfSimulatedConnection* connection)
   }
 
   priv->queue_last_item = NULL;
+
+  if(priv->packet_timeout != NULL)
+  {
+    g_assert(priv->io != NULL);
+
+    inf_io_remove_timeout(priv->io, priv->packet_timeout);
+    priv->packet_timeout = NULL;
+  }
+
+  while(!g_queue_is_empty(&priv->packets))
+  {
+    packet = g_queue_pop_head(&priv->packets);
+    xmlFreeNode(packet->xml);
+    g_slice_free(InfSimulatedConnectionPacket, packet);
+  }
+
+  priv->link_free = 0;
+  priv->last_delivery = 0;
 }
 
 static void
@@ -184,9 +247,26 @@ inf_simulated_connection_init(InfSimulatedConnection* connection)
   priv = INF_SIMULATED_CONNECTION_PRIVATE(connection);
 
   priv->io = NULL;
+  priv->io_handler = NULL;
 
   priv->target = NULL;
   priv->mode = INF_SIMULATED_CONNECTION_IMMEDIATE;
+
+  priv->queue = NULL;
+  priv->queue_last_item = NULL;
+
+  priv->latency = 0;
+  priv->jitter = 0;
+  priv->bandwidth = 0;
+  priv->reorder = FALSE;
+  priv->seed = 0;
+  priv->rand = g_rand_new_with_seed(0);
+  priv->buffer = g_string_new(NULL);
+
+  g_queue_init(&priv->packets);
+  priv->packet_timeout = NULL;
+  priv->link_free = 0;
+  priv->last_delivery = 0;
 }
 
 static void
@@ -200,6 +280,7 @@ inf_simulated_connection_dispose(GObject* object)
 
   inf_simulated_connection_unset_target(connection);
   g_assert(priv->io_handler == NULL);
+  g_assert(priv->packet_timeout == NULL);
 
   if(priv->io != NULL)
   {
@@ -210,6 +291,22 @@ inf_simulated_connection_dispose(GObject* object)
   G_OBJECT_CLASS(inf_simulated_connection_parent_class)->dispose(object);
 }
 
+static void
+inf_simulated_connection_finalize(GObject* object)
+{
+  InfSimulatedConnection* connection;
+  InfSimulatedConnectionPrivate* priv;
+
+  connection = INF_SIMULATED_CONNECTION(object);
+  priv = INF_SIMULATED_CONNECTION_PRIVATE(connection);
+
+  g_assert(g_queue_is_empty(&priv->packets));
+  g_rand_free(priv->rand);
+  g_string_free(priv->buffer, TRUE);
+
+  G_OBJECT_CLASS(inf_simulated_connection_parent_class)->finalize(object);
+}
+
 static void
 inf_simulated_connection_set_property(GObject* object,
                                       guint prop_id,
@@ -239,6 +336,22 @@ inf_simulated_connection_set_property(GObject* object,
   case PROP_MODE:
     inf_simulated_connection_set_mode(sim, g_value_get_enum(value));
     break;
+  case PROP_LATENCY:
+    priv->latency = g_value_get_uint(value);
+    break;
+  case PROP_JITTER:
+    priv->jitter = g_value_get_uint(value);
+    break;
+  case PROP_BANDWIDTH:
+    priv->bandwidth = g_value_get_uint(value);
+    break;
+  case PROP_REORDER:
+    priv->reorder = g_value_get_boolean(value);
+    break;
+  case PROP_SEED:
+    priv->seed = g_value_get_uint(value);
+    g_rand_set_seed(priv->rand, priv->seed);
+    break;
   default:
     G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
     break;
@@ -269,6 +382,21 @@ inf_simulated_connection_get_property(GObject* object,
   case PROP_MODE:
     g_value_set_enum(value, priv->mode);
     break;
+  case PROP_LATENCY:
+    g_value_set_uint(value, priv->latency);
+    break;
+  case PROP_JITTER:
+    g_value_set_uint(value, priv->jitter);
+    break;
+  case PROP_BANDWIDTH:
+    g_value_set_uint(value, priv->bandwidth);
+    break;
+  case PROP_REORDER:
+    g_value_set_boolean(value, priv->reorder);
+    break;
+  case PROP_SEED:
+    g_value_set_uint(value, priv->seed);
+    break;
   case PROP_STATUS:
     if(priv->target != NULL)
       g_value_set_enum(value, INF_XML_CONNECTION_OPEN);
@@ -294,6 +422,10 @@ inf_simulated_connection_get_property(GObject* object,
   case PROP_REMOTE_CERTIFICATE:
     g_value_set_boxed(value, NULL);
     break;
+  case PROP_CONGESTED:
+    /* Messages are handed to the target without any buffering limits */
+    g_value_set_boolean(value, FALSE);
+    break;
   default:
     G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
     break;
@@ -327,6 +459,139 @@ inf_simulated_connection_dispatch_func(gpointer user_data)
   inf_simulated_connection_flush(connection);
 }
 
+static void
+inf_simulated_connection_packet_timeout_func(gpointer user_data);
+
+static void
+inf_simulated_connection_schedule(InfSimulatedConnection* connection)
+{
+  InfSimulatedConnectionPrivate* priv;
+  InfSimulatedConnectionPacket* packet;
+  gint64 delay;
+
+  priv = INF_SIMULATED_CONNECTION_PRIVATE(connection);
+  g_assert(priv->io != NULL);
+
+  if(priv->packet_timeout != NULL)
+  {
+    inf_io_remove_timeout(priv->io, priv->packet_timeout);
+    priv->packet_timeout = NULL;
+  }
+
+  packet = g_queue_peek_head(&priv->packets);
+  if(packet != NULL)
+  {
+    delay = packet->delivery - g_get_monotonic_time();
+    if(delay < 0) delay = 0;
+
+    priv->packet_timeout = inf_io_add_timeout(
+      priv->io,
+      (delay + 999) / 1000,
+      inf_simulated_connection_packet_timeout_func,
+      connection,
+      NULL
+    );
+  }
+}
+
+static void
+inf_simulated_connection_packet_timeout_func(gpointer user_data)
+{
+  InfSimulatedConnection* connection;
+  InfSimulatedConnectionPrivate* priv;
+  InfSimulatedConnectionPacket* packet;
+  gint64 now;
+
+  connection = INF_SIMULATED_CONNECTION(user_data);
+  priv = INF_SIMULATED_CONNECTION_PRIVATE(connection);
+
+  priv->packet_timeout = NULL;
+  now = g_get_monotonic_time();
+
+  g_object_ref(connection);
+
+  /* Receiving a message might close the connection, which clears the
+   * queue. */
+  while(priv->target != NULL)
+  {
+    packet = g_queue_peek_head(&priv->packets);
+    if(packet == NULL || packet->delivery > now)
+      break;
+
+    g_queue_pop_head(&priv->packets);
+
+    inf_xml_connection_sent(INF_XML_CONNECTION(connection), packet->xml);
+    inf_xml_connection_received(
+      INF_XML_CONNECTION(priv->target),
+      packet->xml
+    );
+
+    xmlFreeNode(packet->xml);
+    g_slice_free(InfSimulatedConnectionPacket, packet);
+  }
+
+  if(priv->target != NULL && priv->packet_timeout == NULL)
+    inf_simulated_connection_schedule(connection);
+
+  g_object_unref(connection);
+}
+
+static void
+inf_simulated_connection_emulate(InfSimulatedConnection* connection,
+                                 xmlNodePtr xml)
+{
+  InfSimulatedConnectionPrivate* priv;
+  InfSimulatedConnectionPacket* packet;
+  GList* item;
+  gint64 now;
+
+  priv = INF_SIMULATED_CONNECTION_PRIVATE(connection);
+  now = g_get_monotonic_time();
+
+  packet = g_slice_new(InfSimulatedConnectionPacket);
+  packet->xml = xml;
+
+  /* The message is transmitted after the previous one has left the link */
+  if(priv->link_free < now)
+    priv->link_free = now;
+
+  if(priv->bandwidth > 0)
+  {
+    g_string_truncate(priv->buffer, 0);
+    inf_xml_util_serialize_node(xml, priv->buffer);
+
+    priv->link_free +=
+      (gint64)priv->buffer->len * G_USEC_PER_SEC / priv->bandwidth;
+  }
+
+  packet->delivery = priv->link_free + (gint64)priv->latency * 1000;
+
+  if(priv->jitter > 0)
+  {
+    packet->delivery +=
+      g_rand_int_range(priv->rand, 0, (gint32)priv->jitter * 1000 + 1);
+  }
+
+  if(!priv->reorder && packet->delivery < priv->last_delivery)
+    packet->delivery = priv->last_delivery;
+  if(packet->delivery > priv->last_delivery)
+    priv->last_delivery = packet->delivery;
+
+  /* Messages mostly arrive in order, so search from the back */
+  for(item = priv->packets.tail; item != NULL; item = item->prev)
+    if(((InfSimulatedConnectionPacket*)item->data)->delivery <=
+       packet->delivery)
+      break;
+
+  if(item != NULL)
+    g_queue_insert_after(&priv->packets, item, packet);
+  else
+    g_queue_push_head(&priv->packets, packet);
+
+  if(g_queue_peek_head(&priv->packets) == packet)
+    inf_simulated_connection_schedule(connection);
+}
+
 static void
 inf_simulated_connection_xml_connection_send(InfXmlConnection* connection,
                                              xmlNodePtr xml)
@@ -372,6 +637,10 @@ inf_simulated_connection_xml_connection_send(InfXmlConnection* connection,
       }
     }
 
+    break;
+  case INF_SIMULATED_CONNECTION_EMULATED:
+    xmlUnlinkNode(xml);
+    inf_simulated_connection_emulate(INF_SIMULATED_CONNECTION(connection), xml);
     break;
   default:
     g_assert_not_reached();
@@ -391,6 +660,7 @@ inf_simulated_connection_class_init(
   object_class = G_OBJECT_CLASS(connection_class);
 
   object_class->dispose = inf_simulated_connection_dispose;
+  object_class->finalize = inf_simulated_connection_finalize;
   object_class->set_property = inf_simulated_connection_set_property;
   object_class->get_property = inf_simulated_connection_get_property;
 
@@ -400,7 +670,7 @@ inf_simulated_connection_class_init(
     g_param_spec_object(
       "io",
       "IO",
-      "The main loop to be used for IO_CONTROLLED mode",
+      "The main loop to be used for IO_CONTROLLED and EMULATED mode",
       INF_TYPE_IO,
       G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY
     )
@@ -431,6 +701,77 @@ inf_simulated_connection_class_init(
     )
   );
 
+  g_object_class_install_property(
+    object_class,
+    PROP_LATENCY,
+    g_param_spec_uint(
+      "latency",
+      "Latency",
+      "One-way delay of sent messages in EMULATED mode, in milliseconds",
+      0,
+      G_MAXUINT,
+      0,
+      G_PARAM_READWRITE
+    )
+  );
+
+  g_object_class_install_property(
+    object_class,
+    PROP_JITTER,
+    g_param_spec_uint(
+      "jitter",
+      "Jitter",
+      "Maximum random extra delay of sent messages in EMULATED mode, in "
+      "milliseconds",
+      0,
+      G_MAXINT32 / 1000,
+      0,
+      G_PARAM_READWRITE
+    )
+  );
+
+  g_object_class_install_property(
+    object_class,
+    PROP_BANDWIDTH,
+    g_param_spec_uint(
+      "bandwidth",
+      "Bandwidth",
+      "Number of bytes per second that can be sent in EMULATED mode, or 0 "
+      "for no limit",
+      0,
+      G_MAXUINT,
+      0,
+      G_PARAM_READWRITE
+    )
+  );
+
+  g_object_class_install_property(
+    object_class,
+    PROP_REORDER,
+    g_param_spec_boolean(
+      "reorder",
+      "Reorder",
+      "Whether jitter can make messages arrive in a different order than "
+      "they have been sent in EMULATED mode",
+      FALSE,
+      G_PARAM_READWRITE
+    )
+  );
+
+  g_object_class_install_property(
+    object_class,
+    PROP_SEED,
+    g_param_spec_uint(
+      "seed",
+      "Seed",
+      "Seed of the random number generator used to compute jitter",
+      0,
+      G_MAXUINT,
+      0,
+      G_PARAM_READWRITE
+    )
+  );
+
   g_object_class_override_property(object_class, PROP_STATUS, "status");
   g_object_class_override_property(object_class, PROP_NETWORK, "network");
   g_object_class_override_property(object_class, PROP_LOCAL_ID, "local-id");
@@ -447,6 +788,8 @@ inf_simulated_connection_class_init(
     PROP_REMOTE_CERTIFICATE,
     "remote-certificate"
   );
+
+  g_object_class_override_property(object_class, PROP_CONGESTED, "congested");
 }
 
 static void
@@ -540,9 +883,16 @@ inf_simulated_connection_connect(InfSimulatedConnection* connection,
  * received by the target as soon as a dispatch handler (see
  * inf_io_add_dispatch()) installed on the main loop is called.
  *
+ * In %INF_SIMULATED_CONNECTION_EMULATED mode, messages are received by the
+ * target after a delay that depends on the #InfSimulatedConnection:latency,
+ * #InfSimulatedConnection:jitter and #InfSimulatedConnection:bandwidth
+ * properties, using a timeout installed on the main loop.
+ *
  * When changing the mode from %INF_SIMULATED_CONNECTION_DELAYED or
  * %INF_SIMULATED_CONNECTION_IO_CONTROLLED to
- * %INF_SIMULATED_CONNECTION_IMMEDIATE, then the queue is flushed, too.
+ * %INF_SIMULATED_CONNECTION_IMMEDIATE, or from
+ * %INF_SIMULATED_CONNECTION_EMULATED to any other mode, then the queue is
+ * flushed, too.
  */
 void
 inf_simulated_connection_set_mode(InfSimulatedConnection* connection,
@@ -552,12 +902,17 @@ inf_simulated_connection_set_mode(InfSimulatedConnection* connection,
   priv = INF_SIMULATED_CONNECTION_PRIVATE(connection);
 
   g_return_if_fail(priv->io != NULL ||
-                   mode != INF_SIMULATED_CONNECTION_IO_CONTROLLED);
+                   (mode != INF_SIMULATED_CONNECTION_IO_CONTROLLED &&
+                    mode != INF_SIMULATED_CONNECTION_EMULATED));
 
   if(priv->mode != mode)
   {
-    if(mode == INF_SIMULATED_CONNECTION_IMMEDIATE)
+    if(mode == INF_SIMULATED_CONNECTION_IMMEDIATE ||
+       (priv->mode == INF_SIMULATED_CONNECTION_EMULATED &&
+        priv->target != NULL))
+    {
       inf_simulated_connection_flush(connection);
+    }
 
     priv->mode = mode;
     g_object_notify(G_OBJECT(connection), "mode");
@@ -568,14 +923,17 @@ inf_simulated_connection_set_mode(InfSimulatedConnection* connection,
  * inf_simulated_connection_flush:
  * @connection: A #InfSimulatedConnection.
  *
- * When @connection's mode is %INF_SIMULATED_CONNECTION_DELAYED or
- * %INF_SIMULATED_CONNECTION_IO_CONTROLLED, then calling this function makes
- * the target connection receive all the queued messages.
+ * When @connection's mode is %INF_SIMULATED_CONNECTION_DELAYED,
+ * %INF_SIMULATED_CONNECTION_IO_CONTROLLED or
+ * %INF_SIMULATED_CONNECTION_EMULATED, then calling this function makes the
+ * target connection receive all the queued messages. In emulated mode, they
+ * are received in the order of their scheduled delivery time.
  */
 void
 inf_simulated_connection_flush(InfSimulatedConnection* connection)
 {
   InfSimulatedConnectionPrivate* priv;
+  InfSimulatedConnectionPacket* packet;
   xmlNodePtr next;
 
   priv = INF_SIMULATED_CONNECTION_PRIVATE(connection);
@@ -610,6 +968,26 @@ inf_simulated_connection_flush(InfSimulatedConnection* connection)
   }
 
   priv->queue_last_item = NULL;
+
+  if(priv->packet_timeout != NULL)
+  {
+    inf_io_remove_timeout(priv->io, priv->packet_timeout);
+    priv->packet_timeout = NULL;
+  }
+
+  while(priv->target != NULL && !g_queue_is_empty(&priv->packets))
+  {
+    packet = g_queue_pop_head(&priv->packets);
+
+    inf_xml_connection_sent(INF_XML_CONNECTION(connection), packet->xml);
+    inf_xml_connection_received(
+      INF_XML_CONNECTION(priv->target),
+      packet->xml
+    );
+
+    xmlFreeNode(packet->xml);
+    g_slice_free(InfSimulatedConnectionPacket, packet);
+  }
 }
 
 /* vim:set et sw=2 ts=2: */
@@ -49,6 +49,10 @@ typedef struct _InfSimulatedConnectionClass InfSimulatedConnectionClass;
  * once the application main loop regains control. This requires the simulated
  * connection to have been created with
  * inf_simulated_connection_new_with_io().
+ * @INF_SIMULATED_CONNECTION_EMULATED: Messages are delivered after a delay
+ * computed from the emulated latency, jitter and bandwidth of the
+ * connection. This requires the simulated connection to have been created
+ * with inf_simulated_connection_new_with_io().
  *
  * The mode of a simulated connection defines when sent messages arrive at
  * the target connection.
@@ -56,7 +60,8 @@ typedef struct _InfSimulatedConnectionClass InfSimulatedConnectionClass;
 typedef enum _InfSimulatedConnectionMode {
   INF_SIMULATED_CONNECTION_IMMEDIATE,
   INF_SIMULATED_CONNECTION_DELAYED,
-  INF_SIMULATED_CONNECTION_IO_CONTROLLED
+  INF_SIMULATED_CONNECTION_IO_CONTROLLED,
+  INF_SIMULATED_CONNECTION_EMULATED
 } InfSimulatedConnectionMode;
 
 /**
@@ -37,17 +37,50 @@
  * instead which implements the #InfIo interface. For the GTK+ toolkit, there
  * is #InfGtkIo in the libinfgtk library, to integrate with the Glib main
  * loop.
+ *
+ * On Linux, #InfStandaloneIo uses epoll instead of poll() to wait for
+ * events, so that the cost of adding, updating and removing watches as well
+ * as of waiting for events does not depend on the number of sockets being
+ * watched. This can be turned off by configuring libinfinity with
+ * --disable-epoll. Watches created with %INF_IO_EDGE_TRIGGERED are registered in
+ * edge-triggered mode in that case. If libinfinity has been configured with
+ * io_uring support, poll requests on an io_uring instance are used instead
+ * of epoll. Changes to watches are then queued in userspace and submitted
+ * together right before waiting for events, and edge-triggered watches use
+ * multishot poll requests which stay active across events. Timeouts are
+ * kept in a binary heap, and all timeouts that have elapsed by the time the
+ * loop wakes up are run within the same iteration.
  */
 
 #include <libinfinity/common/inf-standalone-io.h>
 #include <libinfinity/common/inf-io.h>
 
-/* TODO: Modularize the FD handling, then add epoll support */
+#include "config.h"
+
+#if !defined(G_OS_WIN32) && defined(HAVE_IO_URING)
+# define INF_STANDALONE_IO_USE_IO_URING
+#elif !defined(G_OS_WIN32) && defined(HAVE_EPOLL)
+# define INF_STANDALONE_IO_USE_EPOLL
+#endif
+
+/* Whether watches are kept in a hash table, and events are retrieved in
+ * batches which are processed over several iterations. */
+#if defined(INF_STANDALONE_IO_USE_EPOLL) || \
+    defined(INF_STANDALONE_IO_USE_IO_URING)
+# define INF_STANDALONE_IO_USE_WATCH_TABLE
+#endif
 
 #ifdef G_OS_WIN32
 # include <winsock2.h>
 #else
-# include <poll.h>
+# ifdef INF_STANDALONE_IO_USE_EPOLL
+#  include <sys/epoll.h>
+# else
+#  include <poll.h>
+# endif
+# ifdef INF_STANDALONE_IO_USE_IO_URING
+#  include <liburing.h>
+# endif
 # include <errno.h>
 # include <unistd.h>
 #endif /* !G_OS_WIN32 */
@@ -56,6 +89,7 @@
 
 #ifdef G_OS_WIN32
 typedef WSAEVENT InfStandaloneIoNativeEvent;
+typedef long InfStandaloneIoEventMask;
 typedef DWORD InfStandaloneIoPollTimeout;
 typedef DWORD InfStandaloneIoPollResult;
 static const InfStandaloneIoPollResult INF_STANDALONE_IO_POLL_TIMEOUT =
@@ -66,8 +100,44 @@ static const InfStandaloneIoPollTimeout INF_STANDALONE_IO_POLL_INFINITE =
   ((num_events) == 0 ? \
     (Sleep(timeout), WSA_WAIT_TIMEOUT) : \
     (WSAWaitForMultipleEvents(num_events, events, FALSE, timeout, TRUE)))
+#elif defined(INF_STANDALONE_IO_USE_EPOLL)
+/* Maximum number of events retrieved by a single epoll_wait() call */
+#define INF_STANDALONE_IO_EPOLL_BATCH 64
+
+typedef struct epoll_event InfStandaloneIoNativeEvent;
+typedef guint32 InfStandaloneIoEventMask;
+typedef int InfStandaloneIoPollTimeout;
+typedef int InfStandaloneIoPollResult;
+static const InfStandaloneIoPollResult INF_STANDALONE_IO_POLL_TIMEOUT = 0;
+static const InfStandaloneIoPollTimeout INF_STANDALONE_IO_POLL_INFINITE = -1;
+#define inf_standalone_io_poll(epoll_fd, events, num_events, timeout) \
+  (epoll_wait(epoll_fd, events, (int)num_events, timeout))
+#elif defined(INF_STANDALONE_IO_USE_IO_URING)
+/* Size of the submission queue, and maximum number of completions retrieved
+ * after a single wait */
+#define INF_STANDALONE_IO_URING_ENTRIES 256
+#define INF_STANDALONE_IO_URING_BATCH 64
+
+/* Request ID of the poll request for the wakeup pipe. Requests without
+ * meaningful completion, such as poll removals, have ID 0. */
+#define INF_STANDALONE_IO_URING_WAKEUP_ID G_MAXUINT64
+
+/* A completion copied out of the completion queue */
+typedef struct _InfStandaloneIoNativeEvent InfStandaloneIoNativeEvent;
+struct _InfStandaloneIoNativeEvent {
+  guint64 id;
+  gint32 res;
+  guint32 flags;
+};
+
+typedef guint32 InfStandaloneIoEventMask;
+typedef int InfStandaloneIoPollTimeout;
+typedef int InfStandaloneIoPollResult;
+static const InfStandaloneIoPollResult INF_STANDALONE_IO_POLL_TIMEOUT = 0;
+static const InfStandaloneIoPollTimeout INF_STANDALONE_IO_POLL_INFINITE = -1;
 #else
 typedef struct pollfd InfStandaloneIoNativeEvent;
+typedef short InfStandaloneIoEventMask;
 typedef int InfStandaloneIoPollTimeout;
 typedef int InfStandaloneIoPollResult;
 static const InfStandaloneIoPollResult INF_STANDALONE_IO_POLL_TIMEOUT = 0;
@@ -77,9 +147,20 @@ static const InfStandaloneIoPollTimeout INF_STANDALONE_IO_POLL_INFINITE = -1;
 #endif
 
 struct _InfIoWatch {
+#ifdef INF_STANDALONE_IO_USE_WATCH_TABLE
+  /* The socket's value at the time the watch was registered, and the events
+   * that are currently being watched for. */
+  InfNativeSocket fd;
+  InfIoEvent events;
+#ifdef INF_STANDALONE_IO_USE_IO_URING
+  /* ID of the currently active poll request, or 0 if there is none */
+  guint64 id;
+#endif
+#else
   /* TODO: Do we actually need this? We can access the event by
    * priv->events[watchindex+1]. */
   InfStandaloneIoNativeEvent* event;
+#endif
 
   InfNativeSocket* socket;
   InfIoWatchFunc func;
@@ -93,14 +174,21 @@ struct _InfIoWatch {
 };
 
 struct _InfIoTimeout {
-  GTimeVal begin;
-  guint msecs;
+  /* Monotonic time in microseconds at which the timeout elapses */
+  gint64 expiry;
+  /* Position in the timeout heap */
+  guint index;
+
   InfIoTimeoutFunc func;
   gpointer user_data;
   GDestroyNotify notify;
 };
 
 struct _InfIoDispatch {
+  /* Link in the dispatch queue, its data points back to the dispatch */
+  GList link;
+  gboolean queued;
+
   InfIoDispatchFunc func;
   gpointer user_data;
   GDestroyNotify notify;
@@ -108,21 +196,55 @@ struct _InfIoDispatch {
 
 typedef struct _InfStandaloneIoPrivate InfStandaloneIoPrivate;
 struct _InfStandaloneIoPrivate {
+#ifdef INF_STANDALONE_IO_USE_EPOLL
+  int epoll_fd;
+
+  /* Events reported by the last epoll_wait() call which have not yet been
+   * processed. Events of removed watches are cleared to 0. */
+  InfStandaloneIoNativeEvent events[INF_STANDALONE_IO_EPOLL_BATCH];
+  guint ready_pos;
+  guint ready_size;
+#elif defined(INF_STANDALONE_IO_USE_IO_URING)
+  struct io_uring ring;
+  guint64 next_id;
+
+  /* Completions retrieved after the last wait which have not yet been
+   * processed. Completions of poll requests that are no longer active are
+   * ignored. */
+  InfStandaloneIoNativeEvent events[INF_STANDALONE_IO_URING_BATCH];
+  guint ready_pos;
+  guint ready_size;
+#else
   InfStandaloneIoNativeEvent* events;
+#endif
   GMutex mutex;
 
+#ifdef INF_STANDALONE_IO_USE_WATCH_TABLE
+  /* InfNativeSocket* -> InfIoWatch* */
+  GHashTable* watches;
+#ifdef INF_STANDALONE_IO_USE_IO_URING
+  /* guint64* -> InfIoWatch*, for the active poll request of each watch */
+  GHashTable* watch_ids;
+#endif
+#else
   guint fd_size;
   guint fd_alloc;
 
   /* this array has fd_size-1 entries and fd_alloc-1 allocations: */
   InfIoWatch** watches;
+#endif
 
-  GList* timeouts;
-  GList* dispatchs;
+  /* Binary min-heap of InfIoTimeout*, ordered by expiry time */
+  GPtrArray* timeouts;
+  /* Dispatches are run in the order they have been added */
+  GQueue dispatchs;
 
 #ifndef G_OS_WIN32
   int wakeup_pipe[2];
 #endif
+  /* Whether the wakeup pipe or event has been signalled, but the loop has
+   * not yet noticed */
+  gboolean wakeup_pending;
 
   gboolean polling;
   gboolean loop_running;
@@ -155,18 +277,562 @@ G_DEFINE_TYPE_WITH_CODE(InfStandaloneIo, inf_standalone_io, G_TYPE_OBJECT,
   G_ADD_PRIVATE(InfStandaloneIo)
   G_IMPLEMENT_INTERFACE(INF_TYPE_IO, inf_standalone_io_io_iface_init))
 
+static void
+inf_standalone_io_timeout_heap_set(InfStandaloneIoPrivate* priv,
+                                   guint index,
+                                   InfIoTimeout* timeout)
+{
+  priv->timeouts->pdata[index] = timeout;
+  timeout->index = index;
+}
+
+static void
+inf_standalone_io_timeout_heap_sift_up(InfStandaloneIoPrivate* priv,
+                                       guint index)
+{
+  InfIoTimeout* timeout;
+  InfIoTimeout* parent;
+
+  timeout = g_ptr_array_index(priv->timeouts, index);
+  while(index > 0)
+  {
+    parent = g_ptr_array_index(priv->timeouts, (index - 1) / 2);
+    if(parent->expiry <= timeout->expiry)
+      break;
+
+    inf_standalone_io_timeout_heap_set(priv, index, parent);
+    index = (index - 1) / 2;
+  }
+
+  inf_standalone_io_timeout_heap_set(priv, index, timeout);
+}
+
+static void
+inf_standalone_io_timeout_heap_sift_down(InfStandaloneIoPrivate* priv,
+                                         guint index)
+{
+  InfIoTimeout* timeout;
+  InfIoTimeout* child;
+  guint child_index;
+
+  timeout = g_ptr_array_index(priv->timeouts, index);
+  for(;;)
+  {
+    child_index = 2 * index + 1;
+    if(child_index >= priv->timeouts->len)
+      break;
+
+    /* Pick the earlier of both children */
+    child = g_ptr_array_index(priv->timeouts, child_index);
+    if(child_index + 1 < priv->timeouts->len &&
+       ((InfIoTimeout*)g_ptr_array_index(priv->timeouts, child_index + 1))->
+         expiry < child->expiry)
+    {
+      ++child_index;
+      child = g_ptr_array_index(priv->timeouts, child_index);
+    }
+
+    if(timeout->expiry <= child->expiry)
+      break;
+
+    inf_standalone_io_timeout_heap_set(priv, index, child);
+    index = child_index;
+  }
+
+  inf_standalone_io_timeout_heap_set(priv, index, timeout);
+}
+
+static void
+inf_standalone_io_timeout_heap_remove(InfStandaloneIoPrivate* priv,
+                                      InfIoTimeout* timeout)
+{
+  InfIoTimeout* last;
+  guint index;
+
+  index = timeout->index;
+  last = g_ptr_array_remove_index(priv->timeouts, priv->timeouts->len - 1);
+
+  if(last != timeout)
+  {
+    /* Move the last timeout into the gap and restore the heap property */
+    inf_standalone_io_timeout_heap_set(priv, index, last);
+    if(index > 0 &&
+       ((InfIoTimeout*)g_ptr_array_index(priv->timeouts, (index - 1) / 2))->
+         expiry > last->expiry)
+    {
+      inf_standalone_io_timeout_heap_sift_up(priv, index);
+    }
+    else
+    {
+      inf_standalone_io_timeout_heap_sift_down(priv, index);
+    }
+  }
+}
+
+/* Runs all timeouts that have elapsed at the time of the call. Timeouts that
+ * elapse within the same millisecond are thereby handled in a single
+ * iteration. Returns whether any timeout has been run. Call this only with
+ * the mutex locked. */
+static gboolean
+inf_standalone_io_run_timeouts(InfStandaloneIo* io)
+{
+  InfStandaloneIoPrivate* priv;
+  InfIoTimeout* timeout;
+  gint64 current;
+  gboolean result;
+
+  priv = INF_STANDALONE_IO_PRIVATE(io);
+  result = FALSE;
+
+  if(priv->timeouts->len == 0)
+    return FALSE;
+
+  /* Timeouts added by the callbacks below expire after current, so they
+   * are not run before the next iteration. */
+  current = g_get_monotonic_time();
+
+  while(priv->timeouts->len > 0)
+  {
+    timeout = g_ptr_array_index(priv->timeouts, 0);
+    if(timeout->expiry > current)
+      break;
+
+    inf_standalone_io_timeout_heap_remove(priv, timeout);
+    g_mutex_unlock(&priv->mutex);
+
+    timeout->func(timeout->user_data);
+    if(timeout->notify)
+      timeout->notify(timeout->user_data);
+    g_slice_free(InfIoTimeout, timeout);
+
+    g_mutex_lock(&priv->mutex);
+    result = TRUE;
+  }
+
+  return result;
+}
+
+static InfStandaloneIoEventMask
+inf_standalone_io_event_mask(InfIoEvent events)
+{
+  InfStandaloneIoEventMask pevents;
+  pevents = 0;
+
+#ifdef G_OS_WIN32
+  if(events & INF_IO_INCOMING)
+    pevents |= (FD_READ | FD_ACCEPT | FD_CLOSE);
+  if(events & INF_IO_OUTGOING)
+    pevents |= (FD_WRITE | FD_CONNECT);
+#elif defined(INF_STANDALONE_IO_USE_EPOLL)
+  if(events & INF_IO_INCOMING)
+    pevents |= EPOLLIN;
+  if(events & INF_IO_OUTGOING)
+    pevents |= EPOLLOUT;
+  if(events & INF_IO_ERROR)
+    pevents |= (EPOLLERR | EPOLLHUP | EPOLLPRI);
+  if(events & INF_IO_EDGE_TRIGGERED)
+    pevents |= EPOLLET;
+#else
+  if(events & INF_IO_INCOMING)
+    pevents |= POLLIN;
+  if(events & INF_IO_OUTGOING)
+    pevents |= POLLOUT;
+  if(events & INF_IO_ERROR)
+    pevents |= (POLLERR | POLLHUP | POLLNVAL | POLLPRI);
+#endif
+
+  return pevents;
+}
+
+#ifdef INF_STANDALONE_IO_USE_IO_URING
+/* Returns a free submission queue entry. Call this only with the mutex
+ * locked. */
+static struct io_uring_sqe*
+inf_standalone_io_get_sqe(InfStandaloneIo* io)
+{
+  InfStandaloneIoPrivate* priv;
+  struct io_uring_sqe* sqe;
+  int ret;
+
+  priv = INF_STANDALONE_IO_PRIVATE(io);
+
+  sqe = io_uring_get_sqe(&priv->ring);
+  if(sqe == NULL)
+  {
+    /* The submission queue is full, so submit what we have to make room */
+    ret = io_uring_submit(&priv->ring);
+    if(ret < 0)
+      g_warning("io_uring_submit() failed: %s", strerror(-ret));
+
+    sqe = io_uring_get_sqe(&priv->ring);
+    g_assert(sqe != NULL);
+  }
+
+  return sqe;
+}
+
+/* Queues a poll request for the given watch. Edge-triggered watches use a
+ * multishot request which stays active, other watches are re-armed after
+ * their callback has run. Call this only with the mutex locked. */
+static void
+inf_standalone_io_arm_watch(InfStandaloneIo* io,
+                            InfIoWatch* watch)
+{
+  InfStandaloneIoPrivate* priv;
+  struct io_uring_sqe* sqe;
+  InfStandaloneIoEventMask pevents;
+
+  priv = INF_STANDALONE_IO_PRIVATE(io);
+  g_assert(watch->id == 0);
+
+  pevents = inf_standalone_io_event_mask(watch->events);
+  sqe = inf_standalone_io_get_sqe(io);
+
+  if(watch->events & INF_IO_EDGE_TRIGGERED)
+    io_uring_prep_poll_multishot(sqe, watch->fd, pevents);
+  else
+    io_uring_prep_poll_add(sqe, watch->fd, pevents);
+
+  watch->id = ++priv->next_id;
+  io_uring_sqe_set_data64(sqe, watch->id);
+  g_hash_table_insert(priv->watch_ids, &watch->id, watch);
+}
+
+/* Queues the poll request for the wakeup pipe. Call this only with the
+ * mutex locked. */
+static void
+inf_standalone_io_arm_wakeup(InfStandaloneIo* io)
+{
+  InfStandaloneIoPrivate* priv;
+  struct io_uring_sqe* sqe;
+
+  priv = INF_STANDALONE_IO_PRIVATE(io);
+  sqe = inf_standalone_io_get_sqe(io);
+
+  io_uring_prep_poll_multishot(sqe, priv->wakeup_pipe[0], POLLIN | POLLERR);
+  io_uring_sqe_set_data64(sqe, INF_STANDALONE_IO_URING_WAKEUP_ID);
+}
+
+/* Cancels the active poll request of the given watch, if any. Completions
+ * that are still pending for it are ignored. Call this only with the mutex
+ * locked. */
+static void
+inf_standalone_io_disarm_watch(InfStandaloneIo* io,
+                               InfIoWatch* watch)
+{
+  InfStandaloneIoPrivate* priv;
+  struct io_uring_sqe* sqe;
+
+  priv = INF_STANDALONE_IO_PRIVATE(io);
+
+  if(watch->id != 0)
+  {
+    g_hash_table_remove(priv->watch_ids, &watch->id);
+
+    sqe = inf_standalone_io_get_sqe(io);
+    io_uring_prep_poll_remove(sqe, watch->id);
+    io_uring_sqe_set_data64(sqe, 0);
+
+    watch->id = 0;
+  }
+}
+#endif
+
+/* Runs the callback of the given watch. Call this only with the mutex
+ * locked. */
+static void
+inf_standalone_io_run_watch(InfStandaloneIo* io,
+                            InfIoWatch* watch,
+                            InfIoEvent events)
+{
+  InfStandaloneIoPrivate* priv;
+  priv = INF_STANDALONE_IO_PRIVATE(io);
+
+  /* protect from removing the watch object via
+   * inf_io_remove_watch() when running the callback. */
+  watch->executing = TRUE;
+  g_mutex_unlock(&priv->mutex);
+
+  watch->func(watch->socket, events, watch->user_data);
+
+  g_mutex_lock(&priv->mutex);
+  watch->executing = FALSE;
+  if(watch->disposed == TRUE)
+  {
+    g_mutex_unlock(&priv->mutex);
+    if(watch->notify) watch->notify(watch->user_data);
+    g_slice_free(InfIoWatch, watch);
+    g_mutex_lock(&priv->mutex);
+  }
+#ifdef INF_STANDALONE_IO_USE_IO_URING
+  else if(watch->id == 0)
+  {
+    /* Re-arm a one-shot poll request only now, so that it does not report
+     * readiness again that the callback has handled already. If the
+     * callback updated the watch, then it has been re-armed already. */
+    inf_standalone_io_arm_watch(io, watch);
+  }
+#endif
+}
+
+#ifndef G_OS_WIN32
+static void
+inf_standalone_io_read_wakeup(InfStandaloneIo* io,
+                              InfIoEvent events)
+{
+  InfStandaloneIoPrivate* priv;
+  ssize_t ret;
+  char buf[1];
+
+  priv = INF_STANDALONE_IO_PRIVATE(io);
+  priv->wakeup_pending = FALSE;
+
+  /* we were not polling for outgoing */
+  g_assert(~events & INF_IO_OUTGOING);
+  if(events & INF_IO_ERROR)
+  {
+    /* TODO: Read error from FD? */
+    g_warning("Error condition on wakeup pipe");
+    /* TODO: Is there anything we could do here?
+     * Try to re-establish pipe? */
+  }
+  else
+  {
+    ret = read(priv->wakeup_pipe[0], &buf, 1);
+    if(ret == -1)
+    {
+      g_warning(
+        "read() on wakeup pipe failed: %s",
+        strerror(errno)
+      );
+
+      /* TODO: Is there anything we could do here?
+       * Try to re-establish pipe? */
+    }
+    else if(ret == 0)
+    {
+      g_warning("Wakeup pipe received EOF");
+      /* TODO: Is there anything we could do here?
+       * Try to re-establish pipe? */
+    }
+    else
+    {
+      /* this is what we send as wakeup call */
+      g_assert(buf[0] == 'c');
+    }
+  }
+}
+#endif
+
+#ifdef INF_STANDALONE_IO_USE_EPOLL
+/* Processes the next pending event reported by epoll_wait(). Returns TRUE
+ * if a watch callback has been run, or FALSE if there are no more pending
+ * events. Call this only with the mutex locked. */
+static gboolean
+inf_standalone_io_process_ready(InfStandaloneIo* io)
+{
+  InfStandaloneIoPrivate* priv;
+  InfStandaloneIoNativeEvent* event;
+  InfIoWatch* watch;
+  InfIoEvent events;
+
+  priv = INF_STANDALONE_IO_PRIVATE(io);
+
+  while(priv->ready_pos < priv->ready_size)
+  {
+    event = &priv->events[priv->ready_pos];
+    ++priv->ready_pos;
+
+    events = 0;
+    if(event->events & EPOLLIN)
+      events |= INF_IO_INCOMING;
+    if(event->events & EPOLLOUT)
+      events |= INF_IO_OUTGOING;
+    /* We treat EPOLLPRI as error because it should not occur in
+     * infinote. */
+    if(event->events & (EPOLLERR | EPOLLPRI | EPOLLHUP))
+      events |= INF_IO_ERROR;
+
+    /* The watch has been removed since epoll_wait() returned */
+    if(events == 0)
+      continue;
+
+    if(event->data.ptr == NULL)
+    {
+      /* wakeup call */
+      inf_standalone_io_read_wakeup(io, events);
+    }
+    else
+    {
+      watch = (InfIoWatch*)event->data.ptr;
+
+      /* The watch might have been updated since epoll_wait() returned, in
+       * which case we must not report events it no longer asks for. */
+      events &= (watch->events | INF_IO_ERROR);
+
+      if(events != 0)
+      {
+        inf_standalone_io_run_watch(io, watch, events);
+        return TRUE;
+      }
+    }
+  }
+
+  priv->ready_pos = 0;
+  priv->ready_size = 0;
+  return FALSE;
+}
+#elif defined(INF_STANDALONE_IO_USE_IO_URING)
+/* Processes the next pending completion. Returns TRUE if a watch callback
+ * has been run, or FALSE if there are no more pending completions. Call
+ * this only with the mutex locked. */
+static gboolean
+inf_standalone_io_process_ready(InfStandaloneIo* io)
+{
+  InfStandaloneIoPrivate* priv;
+  InfStandaloneIoNativeEvent* event;
+  InfIoWatch* watch;
+  InfIoEvent events;
+
+  priv = INF_STANDALONE_IO_PRIVATE(io);
+
+  while(priv->ready_pos < priv->ready_size)
+  {
+    event = &priv->events[priv->ready_pos];
+    ++priv->ready_pos;
+
+    if(event->id == 0)
+      continue;
+
+    events = 0;
+    if(event->res < 0)
+    {
+      events |= INF_IO_ERROR;
+    }
+    else
+    {
+      if(event->res & POLLIN)
+        events |= INF_IO_INCOMING;
+      if(event->res & POLLOUT)
+        events |= INF_IO_OUTGOING;
+      /* We treat POLLPRI as error because it should not occur in
+       * infinote. */
+      if(event->res & (POLLERR | POLLPRI | POLLHUP | POLLNVAL))
+        events |= INF_IO_ERROR;
+    }
+
+    if(event->id == INF_STANDALONE_IO_URING_WAKEUP_ID)
+    {
+      /* wakeup call */
+      if(~event->flags & IORING_CQE_F_MORE)
+        inf_standalone_io_arm_wakeup(io);
+
+      inf_standalone_io_read_wakeup(io, events);
+    }
+    else
+    {
+      /* The watch has been removed or updated since the request
+       * completed */
+      watch = g_hash_table_lookup(priv->watch_ids, &event->id);
+      if(watch == NULL)
+        continue;
+
+      /* The request is no longer active if the kernel does not promise
+       * more completions for it. */
+      if(~event->flags & IORING_CQE_F_MORE)
+      {
+        g_hash_table_remove(priv->watch_ids, &watch->id);
+        watch->id = 0;
+      }
+
+      events &= (watch->events | INF_IO_ERROR);
+
+      if(events != 0)
+      {
+        inf_standalone_io_run_watch(io, watch, events);
+        return TRUE;
+      }
+      else if(watch->id == 0)
+      {
+        inf_standalone_io_arm_watch(io, watch);
+      }
+    }
+  }
+
+  priv->ready_pos = 0;
+  priv->ready_size = 0;
+  return FALSE;
+}
+#endif
+
+#ifdef INF_STANDALONE_IO_USE_IO_URING
+/* Waits for at least one completion to become available, or for the timeout
+ * to elapse. Does not touch the submission queue, so that this can be called
+ * without the mutex locked. Returns 1 if completions are available, 0 on
+ * timeout and -1 on error, with errno set. */
+static InfStandaloneIoPollResult
+inf_standalone_io_wait_cqe(InfStandaloneIo* io,
+                           InfStandaloneIoPollTimeout timeout)
+{
+  InfStandaloneIoPrivate* priv;
+  struct io_uring_cqe* cqe;
+  struct __kernel_timespec ts;
+  int ret;
+
+  priv = INF_STANDALONE_IO_PRIVATE(io);
+
+  ts.tv_sec = timeout / 1000;
+  ts.tv_nsec = (long long)(timeout % 1000) * 1000000;
+
+  ret = io_uring_wait_cqes(
+    &priv->ring,
+    &cqe,
+    1,
+    timeout == INF_STANDALONE_IO_POLL_INFINITE ? NULL : &ts,
+    NULL
+  );
+
+  if(ret == -ETIME)
+    return 0;
+
+  if(ret < 0)
+  {
+    errno = -ret;
+    return -1;
+  }
+
+  return 1;
+}
+
+/* Copies available completions out of the completion queue. Returns the
+ * number of completions copied. Call this only with the mutex locked. */
 static guint
-inf_standalone_io_timeval_diff(GTimeVal* first,
-                               GTimeVal* second)
+inf_standalone_io_reap_cqes(InfStandaloneIo* io)
 {
-  g_assert(first->tv_sec > second->tv_sec ||
-           (first->tv_sec == second->tv_sec &&
-            first->tv_usec >= second->tv_usec));
+  InfStandaloneIoPrivate* priv;
+  struct io_uring_cqe* cqes[INF_STANDALONE_IO_URING_BATCH];
+  unsigned int n_cqes;
+  unsigned int i;
 
-  /* Don't risk overflow, don't need to convert to signed int */
-  return (first->tv_sec - second->tv_sec) * 1000 +
-         (first->tv_usec+500)/1000 - (second->tv_usec+500)/1000;
+  priv = INF_STANDALONE_IO_PRIVATE(io);
+
+  n_cqes = io_uring_peek_batch_cqe(
+    &priv->ring,
+    cqes,
+    INF_STANDALONE_IO_URING_BATCH
+  );
+
+  for(i = 0; i < n_cqes; ++i)
+  {
+    priv->events[i].id = io_uring_cqe_get_data64(cqes[i]);
+    priv->events[i].res = cqes[i]->res;
+    priv->events[i].flags = cqes[i]->flags;
+  }
+
+  io_uring_cq_advance(&priv->ring, n_cqes);
+  return n_cqes;
 }
+#endif
 
 /* Run one iteration of the main loop. Call this only with the mutex locked
  * and a local reference added to io. */
@@ -175,65 +841,95 @@ inf_standalone_io_iteration_impl(InfStandaloneIo* io,
                                  InfStandaloneIoPollTimeout timeout)
 {
   InfStandaloneIoPrivate* priv;
-  InfIoEvent events;
   InfStandaloneIoPollResult result;
-  guint i;
 
-  GList* item;
-  GTimeVal current;
-  InfIoWatch* watch;
   InfIoTimeout* cur_timeout;
   InfIoDispatch* dispatch;
-  guint elapsed;
+  guint n_dispatchs;
+  gint64 current;
+  gint64 remaining;
+
+#ifndef INF_STANDALONE_IO_USE_WATCH_TABLE
+  InfIoEvent events;
+  InfIoWatch* watch;
+  guint i;
+#endif
+#ifdef INF_STANDALONE_IO_USE_IO_URING
+  int ret;
+#endif
 
 #ifdef G_OS_WIN32
   gchar* error_message;
   WSANETWORKEVENTS wsa_events;
   const InfStandaloneIoEventTableEntry* entry;
-#else
-  ssize_t ret;
-  char buf[1];
 #endif
 
   priv = INF_STANDALONE_IO_PRIVATE(io);
 
+#ifdef INF_STANDALONE_IO_USE_WATCH_TABLE
+  /* Handle events left over from the previous epoll_wait() call before
+   * waiting for new ones. */
+  if(inf_standalone_io_process_ready(io) == TRUE)
+    return;
+#endif
+
   /* Find number of milliseconds to wait */
-  if(priv->dispatchs != NULL)
+  if(!g_queue_is_empty(&priv->dispatchs))
   {
     /* TODO: Don't even poll */
     timeout = 0;
   }
-  else
+  else if(priv->timeouts->len > 0)
   {
-    g_get_current_time(&current);
-    for(item = priv->timeouts; item != NULL; item = g_list_next(item))
-    {
-      cur_timeout = (InfIoTimeout*)item->data;
-      elapsed = inf_standalone_io_timeval_diff(&current, &cur_timeout->begin);
+    /* The earliest timeout is at the top of the heap */
+    cur_timeout = g_ptr_array_index(priv->timeouts, 0);
+    current = g_get_monotonic_time();
 
-      if(elapsed >= cur_timeout->msecs)
-      {
-        /* already elapsed */
-        /* TODO: Don't even poll */
-        timeout = 0;
-        /* no need to check other timeouts */
-        break;
-      }
-      else
+    if(cur_timeout->expiry <= current)
+    {
+      /* already elapsed */
+      /* TODO: Don't even poll */
+      timeout = 0;
+    }
+    else
+    {
+      /* Round up, so that we do not wake up before the timeout elapsed */
+      remaining = (cur_timeout->expiry - current + 999) / 1000;
+      if(timeout == INF_STANDALONE_IO_POLL_INFINITE ||
+         remaining < (gint64)(guint)timeout)
       {
-        if(timeout == INF_STANDALONE_IO_POLL_INFINITE ||
-           cur_timeout->msecs - elapsed < (guint)timeout)
-        {
-          timeout = cur_timeout->msecs - elapsed;
-        }
+        timeout = (InfStandaloneIoPollTimeout)remaining;
       }
     }
   }
 
+#ifdef INF_STANDALONE_IO_USE_IO_URING
+  /* Submit all requests that have been queued since the last iteration in
+   * one go. Requests queued while we are waiting are submitted after
+   * waking up the loop. */
+  if(io_uring_sq_ready(&priv->ring) > 0)
+  {
+    ret = io_uring_submit(&priv->ring);
+    if(ret < 0)
+      g_warning("io_uring_submit() failed: %s", strerror(-ret));
+  }
+#endif
+
   priv->polling = TRUE;
   g_mutex_unlock(&priv->mutex);
 
+#ifdef INF_STANDALONE_IO_USE_EPOLL
+  result = inf_standalone_io_poll(
+    priv->epoll_fd,
+    priv->events,
+    INF_STANDALONE_IO_EPOLL_BATCH,
+    timeout
+  );
+#elif defined(INF_STANDALONE_IO_USE_IO_URING)
+  result = inf_standalone_io_wait_cqe(io, timeout);
+#else
   result = inf_standalone_io_poll(priv->events, priv->fd_size, timeout);
+#endif
 
   g_mutex_lock(&priv->mutex);
   priv->polling = FALSE;
@@ -255,34 +951,44 @@ inf_standalone_io_iteration_impl(InfStandaloneIo* io,
   if(result == -1)
   {
     if(errno != EINTR)
+    {
+#ifdef INF_STANDALONE_IO_USE_EPOLL
+      g_warning("epoll_wait() failed: %s\n", strerror(errno));
+#elif defined(INF_STANDALONE_IO_USE_IO_URING)
+      g_warning("io_uring_wait_cqes() failed: %s\n", strerror(errno));
+#else
       g_warning("poll() failed: %s\n", strerror(errno));
+#endif
+    }
 
     return;
   }
 #endif
 
-  if(result == INF_STANDALONE_IO_POLL_TIMEOUT)
+#ifdef INF_STANDALONE_IO_USE_IO_URING
+  if(result > 0)
+    result = inf_standalone_io_reap_cqes(io);
+#endif
+
+#ifdef INF_STANDALONE_IO_USE_WATCH_TABLE
+  /* Remember the reported events before running any callbacks, they are
+   * processed in the next iterations if we return early. */
+  if(result > 0)
   {
-    /* No file descriptor is active, so check whether a timeout elapsed */
-    g_get_current_time(&current);
-    for(item = priv->timeouts; item != NULL; item = g_list_next(item))
-    {
-      cur_timeout = (InfIoTimeout*)item->data;
-      elapsed = inf_standalone_io_timeval_diff(&current, &cur_timeout->begin);
-      if(elapsed >= cur_timeout->msecs)
-      {
-        priv->timeouts = g_list_delete_link(priv->timeouts, item);
-        g_mutex_unlock(&priv->mutex);
+    priv->ready_pos = 0;
+    priv->ready_size = result;
+  }
+#endif
 
-        cur_timeout->func(cur_timeout->user_data);
-        if(cur_timeout->notify)
-          cur_timeout->notify(cur_timeout->user_data);
-        g_slice_free(InfIoTimeout, cur_timeout);
+  /* Run elapsed timeouts even if sockets are active, so that timeouts are
+   * not starved by busy connections. Events on sockets that are active as
+   * well will be reported again in the next iteration. */
+  if(inf_standalone_io_run_timeouts(io) == TRUE)
+    return;
 
-        g_mutex_lock(&priv->mutex);
-        return;
-      }
-    }
+  if(result == INF_STANDALONE_IO_POLL_TIMEOUT)
+  {
+    /* Neither a file descriptor is active nor has a timeout elapsed */
   }
 #ifdef G_OS_WIN32
   else if(result >= WSA_WAIT_EVENT_0 &&
@@ -292,6 +998,7 @@ inf_standalone_io_iteration_impl(InfStandaloneIo* io,
     {
       /* wakeup call */
       WSAResetEvent(priv->events[0]);
+      priv->wakeup_pending = FALSE;
     }
     else
     {
@@ -321,26 +1028,16 @@ inf_standalone_io_iteration_impl(InfStandaloneIo* io,
         }
       }
 
-      /* protect from removing the watch object via
-       * inf_io_remove_watch() when running the callback. */
-      watch->executing = TRUE;
-      g_mutex_unlock(&priv->mutex);
-
-      watch->func(watch->socket, events, watch->user_data);
-
-      g_mutex_lock(&priv->mutex);
-      watch->executing = FALSE;
-      if(watch->disposed == TRUE)
-      {
-        g_mutex_unlock(&priv->mutex);
-        if(watch->notify) watch->notify(watch->user_data);
-        g_slice_free(InfIoWatch, watch);
-        g_mutex_lock(&priv->mutex);
-      }
-
+      inf_standalone_io_run_watch(io, watch, events);
       return;
     }
   }
+#elif defined(INF_STANDALONE_IO_USE_WATCH_TABLE)
+  else if(result > 0)
+  {
+    if(inf_standalone_io_process_ready(io) == TRUE)
+      return;
+  }
 #else
   else if(result > 0)
   {
@@ -365,63 +1062,12 @@ inf_standalone_io_iteration_impl(InfStandaloneIo* io,
           if(i == 0)
           {
             /* wakeup call */
-
-            /* we were not polling for outgoing */
-            g_assert(~events & INF_IO_OUTGOING);
-            if(events & INF_IO_ERROR)
-            {
-              /* TODO: Read error from FD? */
-              g_warning("Error condition on wakeup pipe");
-              /* TODO: Is there anything we could do here?
-               * Try to re-establish pipe? */
-            }
-            else
-            {
-              ret = read(priv->events[0].fd, &buf, 1);
-              if(ret == -1)
-              {
-                g_warning(
-                  "read() on wakeup pipe failed: %s",
-                  strerror(errno)
-                );
-
-                /* TODO: Is there anything we could do here?
-                 * Try to re-establish pipe? */
-              }
-              else if(ret == 0)
-              {
-                g_warning("Wakeup pipe received EOF");
-                /* TODO: Is there anything we could do here?
-                 * Try to re-establish pipe? */
-              }
-              else
-              {
-                /* this is what we send as wakeup call */
-                g_assert(buf[0] == 'c');
-              }
-            }
+            inf_standalone_io_read_wakeup(io, events);
           }
           else
           {
             watch = priv->watches[i-1];
-
-            /* protect from removing the watch object via
-             * inf_io_remove_watch() when running the callback. */
-            watch->executing = TRUE;
-            g_mutex_unlock(&priv->mutex);
-
-            watch->func(watch->socket, events, watch->user_data);
-
-            g_mutex_lock(&priv->mutex);
-            watch->executing = FALSE;
-            if(watch->disposed == TRUE)
-            {
-              g_mutex_unlock(&priv->mutex);
-              if(watch->notify) watch->notify(watch->user_data);
-              g_slice_free(InfIoWatch, watch);
-              g_mutex_lock(&priv->mutex);
-            }
-
+            inf_standalone_io_run_watch(io, watch, events);
             return;
           }
         }
@@ -430,11 +1076,15 @@ inf_standalone_io_iteration_impl(InfStandaloneIo* io,
   }
 #endif
 
-  /* neither timeout nor IO fired, so try a dispatched message */
-  if(priv->dispatchs != NULL)
+  /* neither timeout nor IO fired, so run the dispatched messages. Only run
+   * the ones that are queued already, so that a dispatch function queueing
+   * new dispatches does not prevent us from returning. */
+  n_dispatchs = g_queue_get_length(&priv->dispatchs);
+  while(n_dispatchs > 0 && !g_queue_is_empty(&priv->dispatchs))
   {
-    dispatch = (InfIoDispatch*)priv->dispatchs->data;
-    priv->dispatchs = g_list_delete_link(priv->dispatchs, priv->dispatchs);
+    dispatch = (InfIoDispatch*)g_queue_peek_head(&priv->dispatchs);
+    g_queue_unlink(&priv->dispatchs, &dispatch->link);
+    dispatch->queued = FALSE;
     g_mutex_unlock(&priv->mutex);
 
     dispatch->func(dispatch->user_data);
@@ -443,6 +1093,7 @@ inf_standalone_io_iteration_impl(InfStandaloneIo* io,
     g_slice_free(InfIoDispatch, dispatch);
 
     g_mutex_lock(&priv->mutex);
+    --n_dispatchs;
   }
 }
 
@@ -454,11 +1105,59 @@ inf_standalone_io_init(InfStandaloneIo* io)
 #ifdef G_OS_WIN32
   gchar* error_message;
 #endif
+#ifdef INF_STANDALONE_IO_USE_EPOLL
+  struct epoll_event event;
+#endif
+#ifdef INF_STANDALONE_IO_USE_IO_URING
+  int ret;
+#endif
 
   priv = INF_STANDALONE_IO_PRIVATE(io);
 
   g_mutex_init(&priv->mutex);
 
+#ifdef INF_STANDALONE_IO_USE_EPOLL
+  priv->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if(priv->epoll_fd == -1)
+    g_error("Failed to create epoll instance: %s", strerror(errno));
+
+  if(pipe(priv->wakeup_pipe) == -1)
+    g_error("Failed to create wakeup pipe: %s", strerror(errno));
+
+  /* The wakeup pipe is the only file descriptor registered with NULL as
+   * user data. */
+  event.events = EPOLLIN | EPOLLERR;
+  event.data.ptr = NULL;
+  if(epoll_ctl(priv->epoll_fd, EPOLL_CTL_ADD, priv->wakeup_pipe[0],
+               &event) == -1)
+  {
+    g_error("Failed to watch wakeup pipe: %s", strerror(errno));
+  }
+
+  priv->ready_pos = 0;
+  priv->ready_size = 0;
+  priv->watches = g_hash_table_new(NULL, NULL);
+#elif defined(INF_STANDALONE_IO_USE_IO_URING)
+  ret = io_uring_queue_init(INF_STANDALONE_IO_URING_ENTRIES, &priv->ring, 0);
+  if(ret < 0)
+    g_error("Failed to create io_uring instance: %s", strerror(-ret));
+
+  /* Waiting for completions with a timeout must not touch the submission
+   * queue, since other threads may queue requests at the same time. */
+  if(~priv->ring.features & IORING_FEAT_EXT_ARG)
+    g_error("io_uring instance does not support waiting with a timeout");
+
+  if(pipe(priv->wakeup_pipe) == -1)
+    g_error("Failed to create wakeup pipe: %s", strerror(errno));
+
+  priv->next_id = 0;
+  priv->ready_pos = 0;
+  priv->ready_size = 0;
+  priv->watches = g_hash_table_new(NULL, NULL);
+  priv->watch_ids = g_hash_table_new(g_int64_hash, g_int64_equal);
+
+  inf_standalone_io_arm_wakeup(io);
+#else
   priv->fd_size = 0;
   priv->fd_alloc = 4;
 
@@ -492,8 +1191,11 @@ inf_standalone_io_init(InfStandaloneIo* io)
 #endif
 
   priv->watches = g_malloc(sizeof(InfIoWatch*) * (priv->fd_alloc - 1) );
-  priv->timeouts = NULL;
-  priv->dispatchs = NULL;
+#endif
+
+  priv->timeouts = g_ptr_array_new();
+  g_queue_init(&priv->dispatchs);
+  priv->wakeup_pending = FALSE;
 
   priv->polling = FALSE;
   priv->loop_running = FALSE;
@@ -504,11 +1206,15 @@ inf_standalone_io_finalize(GObject* object)
 {
   InfStandaloneIo* io;
   InfStandaloneIoPrivate* priv;
-  guint i;
-  GList* item;
   InfIoWatch* watch;
   InfIoTimeout* timeout;
   InfIoDispatch* dispatch;
+#ifdef INF_STANDALONE_IO_USE_WATCH_TABLE
+  GHashTableIter iter;
+  gpointer value;
+#else
+  guint i;
+#endif
 #ifdef G_OS_WIN32
   gchar* error_message;
 #endif
@@ -518,9 +1224,16 @@ inf_standalone_io_finalize(GObject* object)
 
   g_mutex_lock(&priv->mutex);
 
+#ifdef INF_STANDALONE_IO_USE_WATCH_TABLE
+  g_hash_table_iter_init(&iter, priv->watches);
+  while(g_hash_table_iter_next(&iter, NULL, &value))
+  {
+    watch = (InfIoWatch*)value;
+#else
   for(i = 1; i < priv->fd_size; ++i)
   {
     watch = priv->watches[i - 1];
+#endif
 
     /* cannot dispose the IO while running a callback since the IO is
      * reffed on the stack. */
@@ -541,17 +1254,23 @@ inf_standalone_io_finalize(GObject* object)
     g_slice_free(InfIoWatch, watch);
   }
 
-  for(item = priv->timeouts; item != NULL; item = g_list_next(item))
+  while(priv->timeouts->len > 0)
   {
-    timeout = (InfIoTimeout*)item->data;
+    timeout = g_ptr_array_remove_index_fast(
+      priv->timeouts,
+      priv->timeouts->len - 1
+    );
+
     if(timeout->notify)
       timeout->notify(timeout->user_data);
     g_slice_free(InfIoTimeout, timeout);
   }
 
-  for(item = priv->dispatchs; item != NULL; item = g_list_next(item))
+  while(!g_queue_is_empty(&priv->dispatchs))
   {
-    dispatch = (InfIoDispatch*)item->data;
+    dispatch = (InfIoDispatch*)g_queue_peek_head(&priv->dispatchs);
+    g_queue_unlink(&priv->dispatchs, &dispatch->link);
+
     if(dispatch->notify)
       dispatch->notify(dispatch->user_data);
     g_slice_free(InfIoDispatch, dispatch);
@@ -569,10 +1288,22 @@ inf_standalone_io_finalize(GObject* object)
   }
 #endif
 
+#ifdef INF_STANDALONE_IO_USE_EPOLL
+  g_hash_table_destroy(priv->watches);
+
+  if(close(priv->epoll_fd) == -1)
+    g_warning("Failed to close epoll instance: %s", strerror(errno));
+#elif defined(INF_STANDALONE_IO_USE_IO_URING)
+  g_hash_table_destroy(priv->watches);
+  g_hash_table_destroy(priv->watch_ids);
+
+  /* This also cancels all poll requests that are still active */
+  io_uring_queue_exit(&priv->ring);
+#else
   g_free(priv->events);
   g_free(priv->watches);
-  g_list_free(priv->timeouts);
-  g_list_free(priv->dispatchs);
+#endif
+  g_ptr_array_free(priv->timeouts, TRUE);
 
 #ifndef G_OS_WIN32
   if(close(priv->wakeup_pipe[0]) == -1)
@@ -598,6 +1329,29 @@ inf_standalone_io_finalize(GObject* object)
   G_OBJECT_CLASS(inf_standalone_io_parent_class)->finalize(object);
 }
 
+#ifdef INF_STANDALONE_IO_USE_WATCH_TABLE
+static gboolean
+inf_standalone_io_find_watch(InfStandaloneIo* io,
+                             InfIoWatch* watch)
+{
+  InfStandaloneIoPrivate* priv;
+  priv = INF_STANDALONE_IO_PRIVATE(io);
+
+  /* A watch that is disposed but still executing is no longer in the
+   * table, or has been replaced by another watch for the same socket. */
+  return g_hash_table_lookup(priv->watches, watch->socket) == watch;
+}
+
+static gboolean
+inf_standalone_io_find_watch_by_socket(InfStandaloneIo* io,
+                                       InfNativeSocket* socket)
+{
+  InfStandaloneIoPrivate* priv;
+  priv = INF_STANDALONE_IO_PRIVATE(io);
+
+  return g_hash_table_lookup(priv->watches, socket) != NULL;
+}
+#else
 static InfIoWatch**
 inf_standalone_io_find_watch(InfStandaloneIo* io,
                              InfIoWatch* watch)
@@ -628,6 +1382,7 @@ inf_standalone_io_find_watch_by_socket(InfStandaloneIo* io,
 
   return NULL;
 }
+#endif
 
 static void
 inf_standalone_io_wakeup(InfStandaloneIo* io)
@@ -636,8 +1391,9 @@ inf_standalone_io_wakeup(InfStandaloneIo* io)
    * called whenever a watch changes or a timeout or dispatch is added, so
    * that the new event is taken into account. */
   /* Should only ever be called with the IO's mutex being locked. */
-  /* TODO: Turn this into a noop if called from the same thread the loop
-   * runs in? */
+  /* This is a noop if called from the thread the loop runs in, since that
+   * thread cannot be polling at the same time. Several wakeups before the
+   * loop gets to handle the first one are coalesced into one. */
 
   InfStandaloneIoPrivate* priv;
 #ifndef G_OS_WIN32
@@ -648,10 +1404,14 @@ inf_standalone_io_wakeup(InfStandaloneIo* io)
 #endif
   priv = INF_STANDALONE_IO_PRIVATE(io);
 
-  if(priv->polling)
+  if(priv->polling && !priv->wakeup_pending)
   {
 #ifdef G_OS_WIN32
-    if(WSASetEvent(priv->events[0]) == FALSE)
+    if(WSASetEvent(priv->events[0]) == TRUE)
+    {
+      priv->wakeup_pending = TRUE;
+    }
+    else
     {
       error_message = g_win32_error_message(WSAGetLastError());
 
@@ -665,7 +1425,11 @@ inf_standalone_io_wakeup(InfStandaloneIo* io)
 #else
     c = 'c';
     ret = write(priv->wakeup_pipe[1], &c, 1);
-    if(ret == -1)
+    if(ret == 1)
+    {
+      priv->wakeup_pending = TRUE;
+    }
+    else if(ret == -1)
     {
       g_warning(
         "write() failed when attempting to wake up the main loop: %s",
@@ -699,29 +1463,25 @@ inf_standalone_io_io_add_watch(InfIo* io,
 {
   InfStandaloneIoPrivate* priv;
   InfIoWatch* watch;
-  long pevents;
+
+#ifdef INF_STANDALONE_IO_USE_EPOLL
+  struct epoll_event event;
+#elif !defined(INF_STANDALONE_IO_USE_IO_URING)
   guint i;
+#endif
+
+#ifndef INF_STANDALONE_IO_USE_IO_URING
+  /* With io_uring, the mask is computed when arming the watch */
+  InfStandaloneIoEventMask pevents;
+#endif
 
 #ifdef G_OS_WIN32
   gchar* error_message;
 #endif
 
   priv = INF_STANDALONE_IO_PRIVATE(io);
-
-#ifdef G_OS_WIN32
-  pevents = 0;
-  if(events & INF_IO_INCOMING)
-    pevents |= (FD_READ | FD_ACCEPT | FD_CLOSE);
-  if(events & INF_IO_OUTGOING)
-    pevents |= (FD_WRITE | FD_CONNECT);
-#else
-  pevents = 0;
-  if(events & INF_IO_INCOMING)
-    pevents |= POLLIN;
-  if(events & INF_IO_OUTGOING)
-    pevents |= POLLOUT;
-  if(events & INF_IO_ERROR)
-    pevents |= (POLLERR | POLLHUP | POLLNVAL | POLLPRI);
+#ifndef INF_STANDALONE_IO_USE_IO_URING
+  pevents = inf_standalone_io_event_mask(events);
 #endif
 
   g_mutex_lock(&priv->mutex);
@@ -735,6 +1495,32 @@ inf_standalone_io_io_add_watch(InfIo* io,
     return NULL;
   }
 
+#ifdef INF_STANDALONE_IO_USE_EPOLL
+  watch = g_slice_new(InfIoWatch);
+  watch->fd = *socket;
+  watch->events = events;
+
+  event.events = pevents;
+  event.data.ptr = watch;
+  if(epoll_ctl(priv->epoll_fd, EPOLL_CTL_ADD, *socket, &event) == -1)
+  {
+    g_warning("epoll_ctl() failed: %s", strerror(errno));
+    g_slice_free(InfIoWatch, watch);
+
+    g_mutex_unlock(&priv->mutex);
+    return NULL;
+  }
+
+  g_hash_table_insert(priv->watches, socket, watch);
+#elif defined(INF_STANDALONE_IO_USE_IO_URING)
+  watch = g_slice_new(InfIoWatch);
+  watch->fd = *socket;
+  watch->events = events;
+  watch->id = 0;
+
+  inf_standalone_io_arm_watch(INF_STANDALONE_IO(io), watch);
+  g_hash_table_insert(priv->watches, socket, watch);
+#else
   /* TODO: If we are currently polling we should not modify the fds array
    * array but do this after wakeup directly after the poll call. */
 
@@ -790,6 +1576,8 @@ inf_standalone_io_io_add_watch(InfIo* io,
 
   watch = g_slice_new(InfIoWatch);
   watch->event = &priv->events[priv->fd_size];
+#endif
+
   watch->socket = socket;
   watch->func = func;
   watch->user_data = user_data;
@@ -797,10 +1585,19 @@ inf_standalone_io_io_add_watch(InfIo* io,
   watch->executing = FALSE;
   watch->disposed = FALSE;
 
+  /* With epoll, the new watch takes effect immediately, even if another
+   * thread is currently waiting in epoll_wait(), so there is no need to
+   * wake it up. With io_uring, the loop needs to submit the poll request
+   * first. */
+#ifdef INF_STANDALONE_IO_USE_IO_URING
+  inf_standalone_io_wakeup(INF_STANDALONE_IO(io));
+#elif !defined(INF_STANDALONE_IO_USE_EPOLL)
   priv->watches[priv->fd_size-1] = watch;
   ++priv->fd_size;
 
   inf_standalone_io_wakeup(INF_STANDALONE_IO(io));
+#endif
+
   g_mutex_unlock(&priv->mutex);
 
   return watch;
@@ -812,40 +1609,55 @@ inf_standalone_io_io_update_watch(InfIo* io,
                                   InfIoEvent events)
 {
   InfStandaloneIoPrivate* priv;
-  InfIoWatch** watch_iter;
-  long pevents;
+
+#ifdef INF_STANDALONE_IO_USE_EPOLL
+  struct epoll_event event;
+#endif
+
+#ifndef INF_STANDALONE_IO_USE_IO_URING
+  InfStandaloneIoEventMask pevents;
+#endif
 
 #ifdef G_OS_WIN32
   gchar* error_message;
 #endif
 
   priv = INF_STANDALONE_IO_PRIVATE(io);
-
-#ifdef G_OS_WIN32
-  pevents = 0;
-  if(events & INF_IO_INCOMING)
-    pevents |= (FD_READ | FD_ACCEPT | FD_CLOSE);
-  if(events & INF_IO_OUTGOING)
-    pevents |= (FD_WRITE | FD_CONNECT);
-#else
-  pevents = 0;
-  if(events & INF_IO_INCOMING)
-    pevents |= POLLIN;
-  if(events & INF_IO_OUTGOING)
-    pevents |= POLLOUT;
-  if(events & INF_IO_ERROR)
-    pevents |= (POLLERR | POLLHUP | POLLNVAL | POLLPRI);
+#ifndef INF_STANDALONE_IO_USE_IO_URING
+  pevents = inf_standalone_io_event_mask(events);
 #endif
 
   g_mutex_lock(&priv->mutex);
 
-  watch_iter = inf_standalone_io_find_watch(INF_STANDALONE_IO(io), watch);
-  if(watch_iter != NULL)
+  if(inf_standalone_io_find_watch(INF_STANDALONE_IO(io), watch))
   {
+    /* Update */
+#ifdef INF_STANDALONE_IO_USE_EPOLL
+    watch->events = events;
+
+    /* Note that this also re-arms an edge-triggered watch, so that it is
+     * notified again if the socket is ready for the given events. */
+    event.events = pevents;
+    event.data.ptr = watch;
+    if(*watch->socket == watch->fd &&
+       epoll_ctl(priv->epoll_fd, EPOLL_CTL_MOD, watch->fd, &event) == -1)
+    {
+      g_warning("epoll_ctl() failed: %s", strerror(errno));
+    }
+#elif defined(INF_STANDALONE_IO_USE_IO_URING)
+    /* Replace the active poll request by one for the new events. Like with
+     * epoll, this re-arms an edge-triggered watch. If the watch is updated
+     * from its own callback after a one-shot request has completed, then
+     * there is no active request, and the watch is not re-armed again after
+     * the callback. */
+    watch->events = events;
+
+    inf_standalone_io_disarm_watch(INF_STANDALONE_IO(io), watch);
+    inf_standalone_io_arm_watch(INF_STANDALONE_IO(io), watch);
+    inf_standalone_io_wakeup(INF_STANDALONE_IO(io));
+#else
     /* TODO: If we are currently polling we should not modify the fds array
      * array but do this after wakeup directly after the poll call. */
-
-    /* Update */
 #ifdef G_OS_WIN32
     if(WSAEventSelect(*watch->socket, *watch->event, pevents) == SOCKET_ERROR)
     {
@@ -858,6 +1670,7 @@ inf_standalone_io_io_update_watch(InfIo* io,
 #endif
 
     inf_standalone_io_wakeup(INF_STANDALONE_IO(io));
+#endif
   }
 
   g_mutex_unlock(&priv->mutex);
@@ -868,8 +1681,13 @@ inf_standalone_io_io_remove_watch(InfIo* io,
                                   InfIoWatch* watch)
 {
   InfStandaloneIoPrivate* priv;
+
+#ifdef INF_STANDALONE_IO_USE_EPOLL
+  guint i;
+#elif !defined(INF_STANDALONE_IO_USE_IO_URING)
   InfIoWatch** watch_iter;
   guint index;
+#endif
 
 #ifdef G_OS_WIN32
   gchar* error_message;
@@ -879,6 +1697,49 @@ inf_standalone_io_io_remove_watch(InfIo* io,
 
   g_mutex_lock(&priv->mutex);
 
+#ifdef INF_STANDALONE_IO_USE_WATCH_TABLE
+  if(inf_standalone_io_find_watch(INF_STANDALONE_IO(io), watch))
+  {
+    g_hash_table_remove(priv->watches, watch->socket);
+
+#ifdef INF_STANDALONE_IO_USE_IO_URING
+    /* An active poll request keeps the socket open in the kernel even if
+     * its owner has closed it already, so make sure the removal is
+     * submitted soon. Completions that are still pending for the watch are
+     * ignored, since its request ID is no longer known. */
+    inf_standalone_io_disarm_watch(INF_STANDALONE_IO(io), watch);
+    inf_standalone_io_wakeup(INF_STANDALONE_IO(io));
+#else
+    /* If the owner of the socket has closed it already, then the kernel has
+     * removed it from the epoll set, and the file descriptor might even have
+     * been reused for another socket since. */
+    if(*watch->socket == watch->fd)
+    {
+      if(epoll_ctl(priv->epoll_fd, EPOLL_CTL_DEL, watch->fd, NULL) == -1)
+        g_warning("epoll_ctl() failed: %s", strerror(errno));
+    }
+
+    /* Make sure we do not process pending events for this watch */
+    for(i = priv->ready_pos; i < priv->ready_size; ++i)
+      if(priv->events[i].data.ptr == watch)
+        priv->events[i].events = 0;
+#endif
+
+    if(watch->executing)
+    {
+      /* The callback of the watch is currently running. Wait for it to
+       * return before freeing the user_data and the InfIoWatch struct. */
+      watch->disposed = TRUE;
+    }
+    else
+    {
+      /* Free user_data */
+      if(watch->notify)
+        watch->notify(watch->user_data);
+      g_slice_free(InfIoWatch, watch);
+    }
+  }
+#else
   watch_iter = inf_standalone_io_find_watch(INF_STANDALONE_IO(io), watch);
   if(watch_iter != NULL)
   {
@@ -939,6 +1800,7 @@ inf_standalone_io_io_remove_watch(InfIo* io,
 
     inf_standalone_io_wakeup(INF_STANDALONE_IO(io));
   }
+#endif
 
   g_mutex_unlock(&priv->mutex);
 }
@@ -956,15 +1818,19 @@ inf_standalone_io_io_add_timeout(InfIo* io,
   priv = INF_STANDALONE_IO_PRIVATE(io);
   timeout = g_slice_new(InfIoTimeout);
 
-  g_get_current_time(&timeout->begin);
-  timeout->msecs = msecs;
+  timeout->expiry = g_get_monotonic_time() + (gint64)msecs * 1000;
   timeout->func = func;
   timeout->user_data = user_data;
   timeout->notify = notify;
 
   g_mutex_lock(&priv->mutex);
-  priv->timeouts = g_list_prepend(priv->timeouts, timeout);
-  inf_standalone_io_wakeup(INF_STANDALONE_IO(io));
+  g_ptr_array_add(priv->timeouts, timeout);
+  inf_standalone_io_timeout_heap_sift_up(priv, priv->timeouts->len - 1);
+
+  /* The main loop only needs to wake up if it might be waiting for longer
+   * than until the new timeout elapses. */
+  if(timeout->index == 0)
+    inf_standalone_io_wakeup(INF_STANDALONE_IO(io));
   g_mutex_unlock(&priv->mutex);
 
   return timeout;
@@ -975,16 +1841,16 @@ inf_standalone_io_io_remove_timeout(InfIo* io,
                                     InfIoTimeout* timeout)
 {
   InfStandaloneIoPrivate* priv;
-  GList* item;
 
   priv = INF_STANDALONE_IO_PRIVATE(io);
 
   g_mutex_lock(&priv->mutex);
 
-  item = g_list_find(priv->timeouts, timeout);
-  if(item != NULL)
+  /* The timeout is not in the heap anymore if it is currently running */
+  if(timeout->index < priv->timeouts->len &&
+     g_ptr_array_index(priv->timeouts, timeout->index) == timeout)
   {
-    priv->timeouts = g_list_delete_link(priv->timeouts, item);
+    inf_standalone_io_timeout_heap_remove(priv, timeout);
     g_mutex_unlock(&priv->mutex);
 
     if(timeout->notify)
@@ -1013,12 +1879,16 @@ inf_standalone_io_io_add_dispatch(InfIo* io,
   priv = INF_STANDALONE_IO_PRIVATE(io);
   dispatch = g_slice_new(InfIoDispatch);
 
+  dispatch->link.data = dispatch;
+  dispatch->link.prev = NULL;
+  dispatch->link.next = NULL;
+  dispatch->queued = TRUE;
   dispatch->func = func;
   dispatch->user_data = user_data;
   dispatch->notify = notify;
 
   g_mutex_lock(&priv->mutex);
-  priv->dispatchs = g_list_prepend(priv->dispatchs, dispatch);
+  g_queue_push_tail_link(&priv->dispatchs, &dispatch->link);
   inf_standalone_io_wakeup(INF_STANDALONE_IO(io));
   g_mutex_unlock(&priv->mutex);
 
@@ -1030,16 +1900,16 @@ inf_standalone_io_io_remove_dispatch(InfIo* io,
                                      InfIoDispatch* dispatch)
 {
   InfStandaloneIoPrivate* priv;
-  GList* item;
 
   priv = INF_STANDALONE_IO_PRIVATE(io);
 
   g_mutex_lock(&priv->mutex);
 
-  item = g_list_find(priv->dispatchs, dispatch);
-  if(item != NULL)
+  /* The dispatch is no longer queued if it is currently running */
+  if(dispatch->queued)
   {
-    priv->dispatchs = g_list_delete_link(priv->dispatchs, item);
+    g_queue_unlink(&priv->dispatchs, &dispatch->link);
+    dispatch->queued = FALSE;
     g_mutex_unlock(&priv->mutex);
 
     if(dispatch->notify)
@@ -35,6 +35,12 @@ _inf_tcp_connection_accepted(InfIo* io,
                              const InfKeepalive* keepalive,
                              GError** error);
 
+InfTcpConnection*
+_inf_tcp_connection_accepted_unix(InfIo* io,
+                                  InfNativeSocket socket,
+                                  const gchar* path,
+                                  GError** error);
+
 G_END_DECLS
 
 #endif /* __INF_TCP_CONNECTION_PRIVATE_H__ */
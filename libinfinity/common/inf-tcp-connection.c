@@ -38,6 +38,44 @@
  * When the hostname has been resolved and a connection has been made, the
  * #InfTcpConnection:remote-address and #InfTcpConnection:remote-port
  * properties are updated to reflect the address actually connected to.
+ *
+ * If the hostname resolves to more than one address, the connection attempts
+ * alternate between IPv6 and IPv4 addresses, and a new attempt is started
+ * every 250 milliseconds, or as soon as the previous attempt fails, while
+ * the earlier ones are still in progress. The first attempt that succeeds is
+ * used, and all others are cancelled. This way, an unreachable address only
+ * delays the connection by a short time instead of a full connection
+ * timeout.
+ *
+ * Data passed to inf_tcp_connection_send() is appended to a queue of
+ * segments, and handed to the kernel with as few system calls as possible.
+ * While the connection is corked with inf_tcp_connection_cork(), new data is
+ * only queued, so that a burst of messages leaves in a few large segments
+ * when it is uncorked again with inf_tcp_connection_uncork(). Similarly,
+ * inf_tcp_connection_begin_batch() holds back data for all connections of
+ * the calling thread until inf_tcp_connection_end_batch(), which is done
+ * automatically while received data is processed, so that messages relayed
+ * to many connections do not cost a system call per message and connection.
+ *
+ * If the remote host does not read data as fast as it is sent, the send
+ * buffer keeps growing. When it reaches #InfTcpConnection:high-water-mark
+ * bytes, the #InfTcpConnection:congested property is set to %TRUE, and it is
+ * reset to %FALSE once the buffer has been drained to
+ * #InfTcpConnection:low-water-mark bytes. If
+ * #InfTcpConnection:congestion-timeout is set, the connection is closed with
+ * an error if it stays congested for longer than the given time.
+ *
+ * Incoming data is read into a receive buffer until the socket would block,
+ * and then reported with a single #InfTcpConnection::received emission. The
+ * buffer grows while the remote host sends data faster than it is
+ * processed, up to #InfTcpConnection:max-receive-buffer-size bytes, and
+ * shrinks again when traffic slows down.
+ *
+ * If #InfTcpConnection:unix-path is set, the connection is made to a Unix
+ * domain socket at the given path instead, which is cheaper for processes
+ * running on the same host as the server. Such connections report the IPv4
+ * loopback address and port 0 as both their local and remote endpoint.
+ * Unix domain sockets are not supported on Windows.
  **/
 
 #include <libinfinity/common/inf-tcp-connection.h>
@@ -58,6 +96,7 @@
 # include <sys/types.h>
 # include <sys/socket.h>
 # include <netinet/in.h>
+# include <sys/un.h>
 # include <net/if.h>
 # include <arpa/inet.h>
 # include <unistd.h>
@@ -69,6 +108,17 @@
 # include <ws2tcpip.h>
 #endif
 
+#ifndef G_OS_WIN32
+# include <sys/uio.h>
+typedef struct iovec InfTcpConnectionIoVec;
+# define INF_TCP_CONNECTION_IOVEC_BASE(vec) ((vec).iov_base)
+# define INF_TCP_CONNECTION_IOVEC_LEN(vec) ((vec).iov_len)
+#else
+typedef WSABUF InfTcpConnectionIoVec;
+# define INF_TCP_CONNECTION_IOVEC_BASE(vec) ((vec).buf)
+# define INF_TCP_CONNECTION_IOVEC_LEN(vec) ((vec).len)
+#endif
+
 static const GEnumValue inf_tcp_connection_status_values[] = {
   {
     INF_TCP_CONNECTION_CONNECTING,
@@ -89,6 +139,28 @@ static const GEnumValue inf_tcp_connection_status_values[] = {
   }
 };
 
+/* A chunk of the send queue. New data is appended to the last segment as
+ * long as it fits, so that small messages are coalesced. */
+typedef struct _InfTcpConnectionSegment InfTcpConnectionSegment;
+struct _InfTcpConnectionSegment {
+  InfTcpConnectionSegment* next;
+  guint8* data;
+  gsize alloc;
+  /* Data before begin has already been sent, data up to end is queued */
+  gsize begin;
+  gsize end;
+};
+
+/* A connection attempt to one of the addresses reported by the resolver,
+ * made in parallel to the other attempts. */
+typedef struct _InfTcpConnectionAttempt InfTcpConnectionAttempt;
+struct _InfTcpConnectionAttempt {
+  InfTcpConnection* connection;
+  InfNativeSocket socket;
+  InfIoWatch* watch;
+  guint index;
+};
+
 typedef struct _InfTcpConnectionPrivate InfTcpConnectionPrivate;
 struct _InfTcpConnectionPrivate {
   InfIo* io;
@@ -96,20 +168,47 @@ struct _InfTcpConnectionPrivate {
   InfIoWatch* watch;
 
   InfNameResolver* resolver;
+  /* Resolver entries in the order in which they are tried, and the number
+   * of them that have been tried already. */
+  GArray* resolver_order;
   guint resolver_index;
 
+  GSList* attempts;
+  InfIoTimeout* attempt_timeout;
+  GError* attempt_error;
+
   InfTcpConnectionStatus status;
   InfNativeSocket socket;
   InfKeepalive keepalive;
 
   InfIpAddress* remote_address;
   guint remote_port;
+  gchar* unix_path;
   unsigned int device_index;
 
-  guint8* queue;
-  gsize front_pos;
-  gsize back_pos;
-  gsize alloc;
+  InfTcpConnectionSegment* queue_head;
+  InfTcpConnectionSegment* queue_tail;
+  InfTcpConnectionSegment* spare_segment;
+  gsize queued;
+  guint cork_count;
+  /* Whether the connection is in the current thread's send batch */
+  gboolean batched;
+
+  gsize high_water_mark;
+  gsize low_water_mark;
+  gboolean congested;
+
+  guint congestion_timeout;
+  InfIoTimeout* congestion_timeout_handle;
+
+  gchar* recv_buffer;
+  gsize recv_alloc;
+  gsize max_recv_alloc;
+  /* Continues reading if more data was available than read at once */
+  InfIoDispatch* incoming_dispatch;
+
+  guint64 bytes_sent;
+  guint64 bytes_received;
 };
 
 enum {
@@ -125,9 +224,17 @@ enum {
   PROP_REMOTE_PORT,
   PROP_LOCAL_ADDRESS,
   PROP_LOCAL_PORT,
+  PROP_UNIX_PATH,
 
   PROP_DEVICE_INDEX,
-  PROP_DEVICE_NAME
+  PROP_DEVICE_NAME,
+
+  PROP_HIGH_WATER_MARK,
+  PROP_LOW_WATER_MARK,
+  PROP_CONGESTED,
+  PROP_CONGESTION_TIMEOUT,
+
+  PROP_MAX_RECEIVE_BUFFER_SIZE
 };
 
 enum {
@@ -138,8 +245,56 @@ enum {
   LAST_SIGNAL
 };
 
+/* Default send queue size, in bytes, above which the connection is
+ * considered congested, and below which it is considered uncongested
+ * again. */
+#define INF_TCP_CONNECTION_DEFAULT_HIGH_WATER_MARK (256 * 1024)
+#define INF_TCP_CONNECTION_DEFAULT_LOW_WATER_MARK (64 * 1024)
+
+/* Default size of a send queue segment. Larger messages get a segment of
+ * their own size. */
+#define INF_TCP_CONNECTION_SEGMENT_SIZE (16 * 1024)
+
+/* Maximum number of segments handed to the kernel in one system call */
+#define INF_TCP_CONNECTION_MAX_IOVEC 64
+
+/* Time, in milliseconds, after which the next address is tried while the
+ * previous connection attempt is still in progress, as suggested by
+ * RFC 8305. */
+#define INF_TCP_CONNECTION_ATTEMPT_DELAY 250
+
+/* Initial and minimum size of the receive buffer, and the default size up
+ * to which it can grow. */
+#define INF_TCP_CONNECTION_MIN_RECEIVE_BUFFER_SIZE 4096
+#define INF_TCP_CONNECTION_DEFAULT_MAX_RECEIVE_BUFFER_SIZE (256 * 1024)
+
+/* Number of full receive buffers read in one go, before other connections
+ * get their turn */
+#define INF_TCP_CONNECTION_MAX_RECEIVE_BUFFERS_PER_WAKEUP 4
+
 #define INF_TCP_CONNECTION_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE((obj), INF_TYPE_TCP_CONNECTION, InfTcpConnectionPrivate))
 
+/* Connections that have been sent data while a batch was active in the
+ * current thread, see inf_tcp_connection_begin_batch(). */
+typedef struct _InfTcpConnectionBatch InfTcpConnectionBatch;
+struct _InfTcpConnectionBatch {
+  guint depth;
+  GPtrArray* connections;
+};
+
+static void
+inf_tcp_connection_batch_free(gpointer data)
+{
+  InfTcpConnectionBatch* batch;
+  batch = (InfTcpConnectionBatch*)data;
+
+  g_ptr_array_free(batch->connections, TRUE);
+  g_slice_free(InfTcpConnectionBatch, batch);
+}
+
+static GPrivate inf_tcp_connection_batch =
+  G_PRIVATE_INIT(inf_tcp_connection_batch_free);
+
 static guint tcp_connection_signals[LAST_SIGNAL];
 
 INF_DEFINE_ENUM_TYPE(InfTcpConnectionStatus, inf_tcp_connection_status, inf_tcp_connection_status_values)
@@ -157,6 +312,9 @@ inf_tcp_connection_addr_info(InfNativeSocket socket,
     struct sockaddr in_generic;
     struct sockaddr_in in;
     struct sockaddr_in6 in6;
+#ifndef G_OS_WIN32
+    struct sockaddr_un un;
+#endif
   } native_addr;
   socklen_t len;
   int res;
@@ -190,6 +348,16 @@ inf_tcp_connection_addr_info(InfNativeSocket socket,
     if(port != NULL)
       *port = ntohs(native_addr.in6.sin6_port);
     break;
+#ifndef G_OS_WIN32
+  case AF_UNIX:
+    /* Unix domain sockets have no IP endpoint; report the loopback address
+     * so that users of the connection need not handle them specially. */
+    if(address != NULL)
+      *address = inf_ip_address_new_loopback4();
+    if(port != NULL)
+      *port = 0;
+    break;
+#endif
   default:
     g_assert_not_reached();
     break;
@@ -223,7 +391,9 @@ inf_tcp_connection_configure_socket(InfNativeSocket socket,
     return FALSE;
   }
 
-  if(fcntl(socket, F_SETFL, result | O_NONBLOCK) == -1)
+  /* Sockets accepted with accept4() are non-blocking already */
+  if((result & O_NONBLOCK) == 0 &&
+     fcntl(socket, F_SETFL, result | O_NONBLOCK) == -1)
   {
     errcode = INF_NATIVE_SOCKET_LAST_ERROR;
     inf_native_socket_make_error(errcode, error);
@@ -269,6 +439,76 @@ inf_tcp_connection_system_error(InfTcpConnection* connection,
   g_error_free(error);
 }
 
+static void
+inf_tcp_connection_congestion_timeout_func(gpointer user_data)
+{
+  InfTcpConnection* connection;
+  InfTcpConnectionPrivate* priv;
+
+  connection = INF_TCP_CONNECTION(user_data);
+  priv = INF_TCP_CONNECTION_PRIVATE(connection);
+
+  priv->congestion_timeout_handle = NULL;
+
+  /* The remote side did not read any of our data for too long, so give up
+   * on it instead of buffering an ever-growing amount of data. */
+  g_object_ref(connection);
+  inf_tcp_connection_system_error(connection, INF_NATIVE_SOCKET_ETIMEDOUT);
+  g_object_unref(connection);
+}
+
+static void
+inf_tcp_connection_reset_congestion_timeout(InfTcpConnection* connection)
+{
+  InfTcpConnectionPrivate* priv;
+  priv = INF_TCP_CONNECTION_PRIVATE(connection);
+
+  if(priv->congestion_timeout_handle != NULL)
+  {
+    inf_io_remove_timeout(priv->io, priv->congestion_timeout_handle);
+    priv->congestion_timeout_handle = NULL;
+  }
+
+  if(priv->congested == TRUE && priv->congestion_timeout > 0)
+  {
+    priv->congestion_timeout_handle = inf_io_add_timeout(
+      priv->io,
+      priv->congestion_timeout,
+      inf_tcp_connection_congestion_timeout_func,
+      connection,
+      NULL
+    );
+  }
+}
+
+/* Checks the size of the send queue against the water marks, and updates
+ * the congested flag accordingly. This must be called whenever the size of
+ * the send queue or one of the water marks changes. */
+static void
+inf_tcp_connection_update_congestion(InfTcpConnection* connection)
+{
+  InfTcpConnectionPrivate* priv;
+  gsize queued;
+  gboolean congested;
+
+  priv = INF_TCP_CONNECTION_PRIVATE(connection);
+  queued = priv->queued;
+
+  if(priv->high_water_mark == 0)
+    congested = FALSE;
+  else if(priv->congested == FALSE)
+    congested = (queued >= priv->high_water_mark);
+  else
+    congested = (queued > priv->low_water_mark);
+
+  if(congested != priv->congested)
+  {
+    priv->congested = congested;
+    inf_tcp_connection_reset_congestion_timeout(connection);
+    g_object_notify(G_OBJECT(connection), "congested");
+  }
+}
+
 static void
 inf_tcp_connection_io(InfNativeSocket* socket,
                       InfIoEvent events,
@@ -282,10 +522,12 @@ inf_tcp_connection_connected(InfTcpConnection* connection)
   priv = INF_TCP_CONNECTION_PRIVATE(connection);
 
   priv->status = INF_TCP_CONNECTION_CONNECTED;
-  priv->front_pos = 0;
-  priv->back_pos = 0;
+  g_assert(priv->queue_head == NULL);
 
-  priv->events = INF_IO_INCOMING | INF_IO_ERROR;
+  /* inf_tcp_connection_io_incoming() and inf_tcp_connection_io_outgoing()
+   * both keep going until the socket would block, or, when reading, arrange
+   * to continue via a dispatch. */
+  priv->events = INF_IO_INCOMING | INF_IO_ERROR | INF_IO_EDGE_TRIGGERED;
 
   if(priv->watch == NULL)
   {
@@ -304,40 +546,63 @@ inf_tcp_connection_connected(InfTcpConnection* connection)
   }
 
   g_object_freeze_notify(G_OBJECT(connection));
+  g_object_notify(G_OBJECT(connection), "status");
+  g_object_notify(G_OBJECT(connection), "local-address");
+  g_object_notify(G_OBJECT(connection), "local-port");
+  g_object_thaw_notify(G_OBJECT(connection));
+}
 
-  /* Update adresses from resolver */
-  if(priv->resolver != NULL)
-  {
-    if(priv->remote_address != NULL)
-      inf_ip_address_free(priv->remote_address);
+static void
+inf_tcp_connection_attempt_free(InfTcpConnection* connection,
+                                InfTcpConnectionAttempt* attempt)
+{
+  InfTcpConnectionPrivate* priv;
+  priv = INF_TCP_CONNECTION_PRIVATE(connection);
 
-    priv->remote_address = inf_ip_address_copy(
-      inf_name_resolver_get_address(priv->resolver, priv->resolver_index)
-    );
+  if(attempt->watch != NULL)
+    inf_io_remove_watch(priv->io, attempt->watch);
+  if(attempt->socket != INVALID_SOCKET)
+    closesocket(attempt->socket);
+
+  g_slice_free(InfTcpConnectionAttempt, attempt);
+}
 
-    priv->remote_port =
-      inf_name_resolver_get_port(priv->resolver, priv->resolver_index);
+/* Cancels all connection attempts that are still in progress, and forgets
+ * about the addresses that have been tried already. */
+static void
+inf_tcp_connection_reset_attempts(InfTcpConnection* connection)
+{
+  InfTcpConnectionPrivate* priv;
+  InfTcpConnectionAttempt* attempt;
 
-    g_object_notify(G_OBJECT(connection), "remote-address");
-    g_object_notify(G_OBJECT(connection), "remote-port");
+  priv = INF_TCP_CONNECTION_PRIVATE(connection);
 
-    priv->resolver_index = 0;
+  while(priv->attempts != NULL)
+  {
+    attempt = (InfTcpConnectionAttempt*)priv->attempts->data;
+    priv->attempts = g_slist_delete_link(priv->attempts, priv->attempts);
+    inf_tcp_connection_attempt_free(connection, attempt);
   }
 
-  g_object_notify(G_OBJECT(connection), "status");
-  g_object_notify(G_OBJECT(connection), "local-address");
-  g_object_notify(G_OBJECT(connection), "local-port");
-  g_object_thaw_notify(G_OBJECT(connection));
-}
+  if(priv->attempt_timeout != NULL)
+  {
+    inf_io_remove_timeout(priv->io, priv->attempt_timeout);
+    priv->attempt_timeout = NULL;
+  }
 
-static gboolean
-inf_tcp_connection_open_with_resolver(InfTcpConnection* connection,
-                                      GError** error);
+  if(priv->attempt_error != NULL)
+  {
+    g_error_free(priv->attempt_error);
+    priv->attempt_error = NULL;
+  }
 
-/* Handles when an error occurred during connection. Returns FALSE when the
- * error was fatal. In this case, it has already emitted the "error" signal.
- * Returns TRUE, if another connection attempt is made. */
-static gboolean
+  g_array_set_size(priv->resolver_order, 0);
+  priv->resolver_index = 0;
+}
+
+/* Handles when an error occurred during connection. The connection attempt
+ * is given up, and the "error" signal is emitted. */
+static void
 inf_tcp_connection_connection_error(InfTcpConnection* connection,
                                     const GError* error)
 {
@@ -360,19 +625,7 @@ inf_tcp_connection_connection_error(InfTcpConnection* connection,
   }
 
   if(priv->resolver != NULL)
-  {
-    /* Try next address, if there is one */
-    if(priv->resolver_index <
-       inf_name_resolver_get_n_addresses(priv->resolver))
-    {
-      ++priv->resolver_index;
-      if(inf_tcp_connection_open_with_resolver(connection, NULL) == TRUE)
-        return TRUE;
-    }
-
-    /* No new addresses available */
-    priv->resolver_index = 0;
-  }
+    inf_tcp_connection_reset_attempts(connection);
 
   g_signal_emit(
     G_OBJECT(connection),
@@ -380,15 +633,64 @@ inf_tcp_connection_connection_error(InfTcpConnection* connection,
     0,
     error
   );
+}
 
-  return FALSE;
+/* Configures the socket created in *sock and starts connecting it to the
+ * given native address. in_progress is set to FALSE if the connection has
+ * been established right away. If connect() fails, the socket is left in
+ * *sock so that the caller can close it. */
+static gboolean
+inf_tcp_connection_connect_native(InfNativeSocket* sock,
+                                  const struct sockaddr* addr,
+                                  socklen_t addrlen,
+                                  const InfKeepalive* keepalive,
+                                  gboolean* in_progress,
+                                  GError** error)
+{
+  int result;
+  int errcode;
+
+  if(*sock == INVALID_SOCKET)
+  {
+    inf_native_socket_make_error(INF_NATIVE_SOCKET_LAST_ERROR, error);
+    return FALSE;
+  }
+
+  /* Set socket non-blocking and keepalive */
+  if(!inf_tcp_connection_configure_socket(*sock, keepalive, error))
+  {
+    closesocket(*sock);
+    *sock = INVALID_SOCKET;
+    return FALSE;
+  }
+
+  /* Connect */
+  do
+  {
+    result = connect(*sock, addr, addrlen);
+    errcode = INF_NATIVE_SOCKET_LAST_ERROR;
+    if(result == -1 &&
+       errcode != INF_NATIVE_SOCKET_EINTR &&
+       errcode != INF_NATIVE_SOCKET_EINPROGRESS)
+    {
+      inf_native_socket_make_error(errcode, error);
+      return FALSE;
+    }
+  } while(result == -1 && errcode != INF_NATIVE_SOCKET_EINPROGRESS);
+
+  *in_progress = (result != 0);
+  return TRUE;
 }
 
+/* Creates a new socket in *sock and starts connecting it to the given
+ * address, see inf_tcp_connection_connect_native(). */
 static gboolean
-inf_tcp_connection_open_real(InfTcpConnection* connection,
-                             const InfIpAddress* address,
-                             guint port,
-                             GError** error)
+inf_tcp_connection_connect_socket(InfTcpConnection* connection,
+                                  const InfIpAddress* address,
+                                  guint port,
+                                  InfNativeSocket* sock,
+                                  gboolean* in_progress,
+                                  GError** error)
 {
   InfTcpConnectionPrivate* priv;
 
@@ -399,24 +701,13 @@ inf_tcp_connection_open_real(InfTcpConnection* connection,
 
   struct sockaddr* addr;
   socklen_t addrlen;
-  int result;
-  int errcode;
-  const InfKeepalive* keepalive;
-  GError* local_error;
 
   priv = INF_TCP_CONNECTION_PRIVATE(connection);
 
-  g_assert(priv->status == INF_TCP_CONNECTION_CLOSED ||
-           priv->status == INF_TCP_CONNECTION_CONNECTING);
-
-  /* Close previous socket */
-  if(priv->socket != INVALID_SOCKET)
-    closesocket(priv->socket);
-
   switch(inf_ip_address_get_family(address))
   {
   case INF_IP_ADDRESS_IPV4:
-    priv->socket = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+    *sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
     addr = (struct sockaddr*)&native_address.in;
     addrlen = sizeof(struct sockaddr_in);
 
@@ -431,7 +722,7 @@ inf_tcp_connection_open_real(InfTcpConnection* connection,
 
     break;
   case INF_IP_ADDRESS_IPV6:
-    priv->socket = socket(PF_INET6, SOCK_STREAM, IPPROTO_TCP);
+    *sock = socket(PF_INET6, SOCK_STREAM, IPPROTO_TCP);
     addr = (struct sockaddr*)&native_address.in6;
     addrlen = sizeof(struct sockaddr_in6);
 
@@ -452,46 +743,113 @@ inf_tcp_connection_open_real(InfTcpConnection* connection,
     break;
   }
 
-  if(priv->socket == INVALID_SOCKET)
+  return inf_tcp_connection_connect_native(
+    sock,
+    addr,
+    addrlen,
+    &priv->keepalive,
+    in_progress,
+    error
+  );
+}
+
+/* Creates a new socket in *sock and starts connecting it to the Unix domain
+ * socket at the connection's unix-path, see
+ * inf_tcp_connection_connect_native(). */
+static gboolean
+inf_tcp_connection_connect_unix(InfTcpConnection* connection,
+                                InfNativeSocket* sock,
+                                gboolean* in_progress,
+                                GError** error)
+{
+#ifndef G_OS_WIN32
+  InfTcpConnectionPrivate* priv;
+  struct sockaddr_un native_address;
+  InfKeepalive keepalive;
+
+  priv = INF_TCP_CONNECTION_PRIVATE(connection);
+
+  if(strlen(priv->unix_path) >= sizeof(native_address.sun_path))
   {
-    inf_native_socket_make_error(INF_NATIVE_SOCKET_LAST_ERROR, error);
+    inf_native_socket_make_error(ENAMETOOLONG, error);
     return FALSE;
   }
 
-  /* Set socket non-blocking and keepalive */
-  keepalive = &priv->keepalive;
-  if(!inf_tcp_connection_configure_socket(priv->socket, keepalive, error))
-  {
+  memset(&native_address, 0, sizeof(native_address));
+  native_address.sun_family = AF_UNIX;
+  strcpy(native_address.sun_path, priv->unix_path);
+
+  /* Keepalives are pointless for local connections */
+  keepalive.mask = 0;
+
+  *sock = socket(PF_UNIX, SOCK_STREAM, 0);
+
+  return inf_tcp_connection_connect_native(
+    sock,
+    (struct sockaddr*)&native_address,
+    sizeof(native_address),
+    &keepalive,
+    in_progress,
+    error
+  );
+#else
+  inf_native_socket_make_error(WSAEAFNOSUPPORT, error);
+  return FALSE;
+#endif
+}
+
+static gboolean
+inf_tcp_connection_open_real(InfTcpConnection* connection,
+                             const InfIpAddress* address,
+                             guint port,
+                             GError** error)
+{
+  InfTcpConnectionPrivate* priv;
+  gboolean in_progress;
+  gboolean result;
+  GError* local_error;
+
+  priv = INF_TCP_CONNECTION_PRIVATE(connection);
+
+  g_assert(priv->status == INF_TCP_CONNECTION_CLOSED);
+
+  /* Close previous socket */
+  if(priv->socket != INVALID_SOCKET)
     closesocket(priv->socket);
-    priv->socket = INVALID_SOCKET;
-    return FALSE;
+
+  local_error = NULL;
+  if(priv->unix_path != NULL)
+  {
+    result = inf_tcp_connection_connect_unix(
+      connection,
+      &priv->socket,
+      &in_progress,
+      &local_error
+    );
+  }
+  else
+  {
+    result = inf_tcp_connection_connect_socket(
+      connection,
+      address,
+      port,
+      &priv->socket,
+      &in_progress,
+      &local_error
+    );
   }
 
-  /* Connect */
-  do
+  if(!result)
   {
-    result = connect(priv->socket, addr, addrlen);
-    errcode = INF_NATIVE_SOCKET_LAST_ERROR;
-    if(result == -1 &&
-       errcode != INF_NATIVE_SOCKET_EINTR &&
-       errcode != INF_NATIVE_SOCKET_EINPROGRESS)
-    {
-      local_error = NULL;
-      inf_native_socket_make_error(errcode, &local_error);
-      if(inf_tcp_connection_connection_error(connection, local_error) == TRUE)
-      {
-        /* In this case, we could recover from the error by connecting to a
-         * different address. */
-        g_error_free(local_error);
-        return TRUE;
-      }
+    /* Errors from connect() are reported via the "error" signal as well */
+    if(priv->socket != INVALID_SOCKET)
+      inf_tcp_connection_connection_error(connection, local_error);
 
-      g_propagate_error(error, local_error);
-      return FALSE;
-    }
-  } while(result == -1 && errcode != INF_NATIVE_SOCKET_EINPROGRESS);
+    g_propagate_error(error, local_error);
+    return FALSE;
+  }
 
-  if(result == 0)
+  if(!in_progress)
   {
     /* Connection fully established */
     inf_tcp_connection_connected(connection);
@@ -501,7 +859,7 @@ inf_tcp_connection_open_real(InfTcpConnection* connection,
     g_assert(priv->watch == NULL);
 
     /* Connection establishment in progress */
-    priv->events = INF_IO_OUTGOING | INF_IO_ERROR;
+    priv->events = INF_IO_OUTGOING | INF_IO_ERROR | INF_IO_EDGE_TRIGGERED;
 
     priv->watch = inf_io_add_watch(
       priv->io,
@@ -512,133 +870,661 @@ inf_tcp_connection_open_real(InfTcpConnection* connection,
       NULL
     );
 
-    if(priv->status != INF_TCP_CONNECTION_CONNECTING)
-    {
-      priv->status = INF_TCP_CONNECTION_CONNECTING;
-      g_object_notify(G_OBJECT(connection), "status");
-    }
+    priv->status = INF_TCP_CONNECTION_CONNECTING;
+    g_object_notify(G_OBJECT(connection), "status");
   }
 
   return TRUE;
 }
 
-static gboolean
-inf_tcp_connection_open_with_resolver(InfTcpConnection* connection,
-                                      GError** error)
+/* Appends the resolver entries that have not been tried yet to the order of
+ * connection attempts, alternating between address families and starting
+ * with the family of the first new entry, as described in RFC 8305. */
+static void
+inf_tcp_connection_update_order(InfTcpConnection* connection)
 {
   InfTcpConnectionPrivate* priv;
-  GError* local_error;
-  gboolean success;
+  InfIpAddressFamily family;
+  guint first;
+  guint n;
+  guint* same;
+  guint* other;
+  guint n_same;
+  guint n_other;
+  guint i;
 
   priv = INF_TCP_CONNECTION_PRIVATE(connection);
 
-  g_assert(priv->status == INF_TCP_CONNECTION_CLOSED ||
-           priv->status == INF_TCP_CONNECTION_CONNECTING);
+  first = priv->resolver_order->len;
+  n = inf_name_resolver_get_n_addresses(priv->resolver);
+  if(first >= n) return;
+
+  family = inf_ip_address_get_family(
+    inf_name_resolver_get_address(priv->resolver, first)
+  );
+
+  same = g_new(guint, n - first);
+  other = g_new(guint, n - first);
+  n_same = 0;
+  n_other = 0;
 
-  if(inf_name_resolver_finished(priv->resolver))
+  for(i = first; i < n; ++i)
   {
-    if(priv->resolver_index < 
-       inf_name_resolver_get_n_addresses(priv->resolver))
+    if(inf_ip_address_get_family(
+         inf_name_resolver_get_address(priv->resolver, i)) == family)
     {
-      return inf_tcp_connection_open_real(
-        connection,
-        inf_name_resolver_get_address(priv->resolver, priv->resolver_index),
-        inf_name_resolver_get_port(priv->resolver, priv->resolver_index),
-        error
-      );
+      same[n_same++] = i;
     }
-
-    /* We need to look up more addresses */
-    g_object_freeze_notify(G_OBJECT(connection));
-    if(priv->status != INF_TCP_CONNECTION_CONNECTING)
+    else
     {
-      priv->status = INF_TCP_CONNECTION_CONNECTING;
-      g_object_notify(G_OBJECT(connection), "status");
+      other[n_other++] = i;
     }
+  }
 
-    local_error = NULL;
-    if(priv->resolver_index == 0)
-      success = inf_name_resolver_start(priv->resolver, &local_error);
-    else
-      success = inf_name_resolver_lookup_backup(priv->resolver, &local_error);
-
-    if(local_error != NULL)
+  for(i = 0; i < n_same || i < n_other; ++i)
+  {
+    if(i < n_same)
+      g_array_append_val(priv->resolver_order, same[i]);
+    if(i < n_other)
+      g_array_append_val(priv->resolver_order, other[i]);
+  }
+
+  g_free(same);
+  g_free(other);
+}
+
+/* Makes the given socket, connected to the index-th resolver entry, the
+ * socket of the connection, and cancels all other attempts. */
+static void
+inf_tcp_connection_attempt_succeeded(InfTcpConnection* connection,
+                                     InfNativeSocket socket,
+                                     guint index)
+{
+  InfTcpConnectionPrivate* priv;
+  priv = INF_TCP_CONNECTION_PRIVATE(connection);
+
+  if(priv->socket != INVALID_SOCKET)
+    closesocket(priv->socket);
+
+  priv->socket = socket;
+  inf_tcp_connection_reset_attempts(connection);
+
+  g_object_freeze_notify(G_OBJECT(connection));
+
+  /* Update adresses from resolver */
+  if(priv->remote_address != NULL)
+    inf_ip_address_free(priv->remote_address);
+
+  priv->remote_address = inf_ip_address_copy(
+    inf_name_resolver_get_address(priv->resolver, index)
+  );
+
+  priv->remote_port = inf_name_resolver_get_port(priv->resolver, index);
+
+  g_object_notify(G_OBJECT(connection), "remote-address");
+  g_object_notify(G_OBJECT(connection), "remote-port");
+
+  inf_tcp_connection_connected(connection);
+  g_object_thaw_notify(G_OBJECT(connection));
+}
+
+static void
+inf_tcp_connection_next_attempt(InfTcpConnection* connection);
+
+static void
+inf_tcp_connection_attempt_io(InfNativeSocket* socket,
+                              InfIoEvent events,
+                              gpointer user_data)
+{
+  InfTcpConnectionAttempt* attempt;
+  InfTcpConnection* connection;
+  InfTcpConnectionPrivate* priv;
+  InfNativeSocket connected_socket;
+  socklen_t len;
+  int errcode;
+
+  attempt = (InfTcpConnectionAttempt*)user_data;
+  connection = attempt->connection;
+  priv = INF_TCP_CONNECTION_PRIVATE(connection);
+  g_object_ref(connection);
+
+  g_assert(priv->status == INF_TCP_CONNECTION_CONNECTING);
+
+  len = sizeof(int);
+#ifdef G_OS_WIN32
+  getsockopt(*socket, SOL_SOCKET, SO_ERROR, (char*)&errcode, &len);
+#else
+  getsockopt(*socket, SOL_SOCKET, SO_ERROR, &errcode, &len);
+#endif
+
+  if(errcode == 0)
+  {
+    /* Remove the watch while it still refers to the socket, so that the IO
+     * unregisters the socket before the connection makes its own watch for
+     * it. */
+    inf_io_remove_watch(priv->io, attempt->watch);
+    attempt->watch = NULL;
+
+    connected_socket = attempt->socket;
+    attempt->socket = INVALID_SOCKET;
+
+    inf_tcp_connection_attempt_succeeded(
+      connection,
+      connected_socket,
+      attempt->index
+    );
+  }
+  else
+  {
+    if(priv->attempt_error != NULL)
+      g_error_free(priv->attempt_error);
+
+    priv->attempt_error = NULL;
+    inf_native_socket_make_error(errcode, &priv->attempt_error);
+
+    priv->attempts = g_slist_remove(priv->attempts, attempt);
+    inf_tcp_connection_attempt_free(connection, attempt);
+
+    /* Do not wait for the attempt delay to try the next address */
+    inf_tcp_connection_next_attempt(connection);
+  }
+
+  g_object_unref(connection);
+}
+
+static void
+inf_tcp_connection_attempt_timeout_func(gpointer user_data)
+{
+  InfTcpConnection* connection;
+  InfTcpConnectionPrivate* priv;
+
+  connection = INF_TCP_CONNECTION(user_data);
+  priv = INF_TCP_CONNECTION_PRIVATE(connection);
+
+  priv->attempt_timeout = NULL;
+
+  g_object_ref(connection);
+  inf_tcp_connection_next_attempt(connection);
+  g_object_unref(connection);
+}
+
+/* Starts connecting to the next address in the attempt order. Returns FALSE
+ * if this failed right away, in which case the error is remembered in
+ * priv->attempt_error. */
+static gboolean
+inf_tcp_connection_start_attempt(InfTcpConnection* connection)
+{
+  InfTcpConnectionPrivate* priv;
+  InfTcpConnectionAttempt* attempt;
+  InfNativeSocket sock;
+  gboolean in_progress;
+  GError* error;
+  guint index;
+
+  priv = INF_TCP_CONNECTION_PRIVATE(connection);
+  g_assert(priv->resolver_index < priv->resolver_order->len);
+
+  index = g_array_index(priv->resolver_order, guint, priv->resolver_index);
+  ++priv->resolver_index;
+
+  sock = INVALID_SOCKET;
+  error = NULL;
+
+  if(!inf_tcp_connection_connect_socket(
+       connection,
+       inf_name_resolver_get_address(priv->resolver, index),
+       inf_name_resolver_get_port(priv->resolver, index),
+       &sock,
+       &in_progress,
+       &error))
+  {
+    if(sock != INVALID_SOCKET)
+      closesocket(sock);
+
+    if(priv->attempt_error != NULL)
+      g_error_free(priv->attempt_error);
+    priv->attempt_error = error;
+    return FALSE;
+  }
+
+  if(!in_progress)
+  {
+    inf_tcp_connection_attempt_succeeded(connection, sock, index);
+    return TRUE;
+  }
+
+  attempt = g_slice_new(InfTcpConnectionAttempt);
+  attempt->connection = connection;
+  attempt->socket = sock;
+  attempt->index = index;
+
+  attempt->watch = inf_io_add_watch(
+    priv->io,
+    &attempt->socket,
+    INF_IO_OUTGOING | INF_IO_ERROR | INF_IO_EDGE_TRIGGERED,
+    inf_tcp_connection_attempt_io,
+    attempt,
+    NULL
+  );
+
+  priv->attempts = g_slist_prepend(priv->attempts, attempt);
+
+  /* Try the next address if this attempt takes too long */
+  if(priv->attempt_timeout != NULL)
+  {
+    inf_io_remove_timeout(priv->io, priv->attempt_timeout);
+    priv->attempt_timeout = NULL;
+  }
+
+  if(priv->resolver_index < priv->resolver_order->len)
+  {
+    priv->attempt_timeout = inf_io_add_timeout(
+      priv->io,
+      INF_TCP_CONNECTION_ATTEMPT_DELAY,
+      inf_tcp_connection_attempt_timeout_func,
+      connection,
+      NULL
+    );
+  }
+
+  return TRUE;
+}
+
+/* Starts a hostname lookup, or a lookup of backup addresses if addresses
+ * have been tried already. If this is not possible, the connection attempt
+ * fails. */
+static gboolean
+inf_tcp_connection_lookup(InfTcpConnection* connection,
+                          GError** error)
+{
+  InfTcpConnectionPrivate* priv;
+  GError* local_error;
+  gboolean success;
+
+  priv = INF_TCP_CONNECTION_PRIVATE(connection);
+  g_assert(priv->attempts == NULL);
+
+  g_object_freeze_notify(G_OBJECT(connection));
+  if(priv->status != INF_TCP_CONNECTION_CONNECTING)
+  {
+    priv->status = INF_TCP_CONNECTION_CONNECTING;
+    g_object_notify(G_OBJECT(connection), "status");
+  }
+
+  local_error = NULL;
+  if(priv->resolver_index == 0)
+    success = inf_name_resolver_start(priv->resolver, &local_error);
+  else
+    success = inf_name_resolver_lookup_backup(priv->resolver, &local_error);
+
+  if(success == FALSE)
+  {
+    /* No more addresses available; report the last connection error */
+    if(local_error == NULL)
     {
-      inf_tcp_connection_connection_error(connection, local_error);
-      g_propagate_error(error, local_error);
+      g_assert(priv->attempt_error != NULL);
+      local_error = priv->attempt_error;
+      priv->attempt_error = NULL;
     }
 
-    g_object_thaw_notify(G_OBJECT(connection));
-    return success;
+    inf_tcp_connection_connection_error(connection, local_error);
+    g_propagate_error(error, local_error);
   }
 
+  g_object_thaw_notify(G_OBJECT(connection));
+  return success;
+}
+
+static void
+inf_tcp_connection_next_attempt(InfTcpConnection* connection)
+{
+  InfTcpConnectionPrivate* priv;
+  priv = INF_TCP_CONNECTION_PRIVATE(connection);
+
+  g_assert(priv->status == INF_TCP_CONNECTION_CONNECTING);
+
   /* The resolver is currently doing something. Wait until it finishes, and
    * then try again. */
-  return TRUE;
+  if(!inf_name_resolver_finished(priv->resolver))
+    return;
+
+  inf_tcp_connection_update_order(connection);
+  while(priv->resolver_index < priv->resolver_order->len)
+    if(inf_tcp_connection_start_attempt(connection) == TRUE)
+      return;
+
+  /* Wait for the attempts that are still in progress */
+  if(priv->attempts != NULL)
+    return;
+
+  inf_tcp_connection_lookup(connection, NULL);
 }
 
-static gboolean
-inf_tcp_connection_send_real(InfTcpConnection* connection,
-                             gconstpointer data,
-                             guint* len)
+static void
+inf_tcp_connection_free_segment(InfTcpConnection* connection,
+                                InfTcpConnectionSegment* segment)
 {
   InfTcpConnectionPrivate* priv;
-  gconstpointer send_data;
-  guint send_len;
-  int errcode;
+  priv = INF_TCP_CONNECTION_PRIVATE(connection);
+
+  /* Keep one segment of default size around, so that a connection that is
+   * sending small messages does not allocate a new segment for each. */
+  if(priv->spare_segment == NULL &&
+     segment->alloc == INF_TCP_CONNECTION_SEGMENT_SIZE)
+  {
+    segment->next = NULL;
+    segment->begin = 0;
+    segment->end = 0;
+    priv->spare_segment = segment;
+  }
+  else
+  {
+    g_free(segment);
+  }
+}
+
+static void
+inf_tcp_connection_clear_queue(InfTcpConnection* connection)
+{
+  InfTcpConnectionPrivate* priv;
+  InfTcpConnectionSegment* segment;
+
+  priv = INF_TCP_CONNECTION_PRIVATE(connection);
+
+  while(priv->queue_head != NULL)
+  {
+    segment = priv->queue_head;
+    priv->queue_head = segment->next;
+    inf_tcp_connection_free_segment(connection, segment);
+  }
+
+  priv->queue_tail = NULL;
+  priv->queued = 0;
+}
+
+static void
+inf_tcp_connection_enqueue(InfTcpConnection* connection,
+                           gconstpointer data,
+                           gsize len)
+{
+  InfTcpConnectionPrivate* priv;
+  InfTcpConnectionSegment* segment;
+  gsize alloc;
+  gsize chunk;
+
+  priv = INF_TCP_CONNECTION_PRIVATE(connection);
+  priv->queued += len;
+
+  /* Fill up the last segment first */
+  segment = priv->queue_tail;
+  if(segment != NULL && segment->end < segment->alloc)
+  {
+    chunk = MIN(len, segment->alloc - segment->end);
+    memcpy(segment->data + segment->end, data, chunk);
+    segment->end += chunk;
+
+    data = (const guint8*)data + chunk;
+    len -= chunk;
+  }
+
+  if(len > 0)
+  {
+    if(priv->spare_segment != NULL && len <= priv->spare_segment->alloc)
+    {
+      segment = priv->spare_segment;
+      priv->spare_segment = NULL;
+    }
+    else
+    {
+      alloc = MAX(len, INF_TCP_CONNECTION_SEGMENT_SIZE);
+      segment = g_malloc(sizeof(InfTcpConnectionSegment) + alloc);
+      segment->data = (guint8*)(segment + 1);
+      segment->alloc = alloc;
+      segment->begin = 0;
+      segment->end = 0;
+    }
+
+    memcpy(segment->data, data, len);
+    segment->end = len;
+    segment->next = NULL;
+
+    if(priv->queue_tail != NULL)
+      priv->queue_tail->next = segment;
+    else
+      priv->queue_head = segment;
+    priv->queue_tail = segment;
+  }
+}
+
+/* Hands as much of the send queue to the kernel as it takes, with one
+ * system call for up to INF_TCP_CONNECTION_MAX_IOVEC segments, and emits
+ * the sent signal for each segment that has been sent completely. */
+static void
+inf_tcp_connection_flush(InfTcpConnection* connection)
+{
+  InfTcpConnectionPrivate* priv;
+  InfTcpConnectionIoVec vec[INF_TCP_CONNECTION_MAX_IOVEC];
+  InfTcpConnectionSegment* segment;
+  InfTcpConnectionSegment* sent_head;
+  InfTcpConnectionSegment* sent_tail;
+  guint n_vec;
   ssize_t result;
+  int errcode;
+#ifndef G_OS_WIN32
+  struct msghdr msg;
+#else
+  DWORD sent_bytes;
+#endif
 
   priv = INF_TCP_CONNECTION_PRIVATE(connection);
   g_assert(priv->status == INF_TCP_CONNECTION_CONNECTED);
 
-  g_assert(data != NULL);
-  g_assert(len != NULL);
+  sent_head = NULL;
+  sent_tail = NULL;
 
-  send_data = data;
-  send_len = *len;
+  g_object_ref(connection);
 
-  do
+  while(priv->queue_head != NULL)
   {
-    result = send(
-      priv->socket,
-      send_data,
-      send_len,
-      INF_NATIVE_SOCKET_SENDRECV_FLAGS
-    );
+    n_vec = 0;
+    for(segment = priv->queue_head;
+        segment != NULL && n_vec < INF_TCP_CONNECTION_MAX_IOVEC;
+        segment = segment->next)
+    {
+      INF_TCP_CONNECTION_IOVEC_BASE(vec[n_vec]) =
+        (gpointer)(segment->data + segment->begin);
+      INF_TCP_CONNECTION_IOVEC_LEN(vec[n_vec]) = segment->end - segment->begin;
+      ++n_vec;
+    }
+
+#ifndef G_OS_WIN32
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = vec;
+    msg.msg_iovlen = n_vec;
+
+    result = sendmsg(priv->socket, &msg, INF_NATIVE_SOCKET_SENDRECV_FLAGS);
+#else
+    if(WSASend(priv->socket, vec, n_vec, &sent_bytes, 0, NULL, NULL) == 0)
+      result = sent_bytes;
+    else
+      result = -1;
+#endif
 
     /* Preserve error code so that it is not modified by future calls */
     errcode = INF_NATIVE_SOCKET_LAST_ERROR;
 
-    if(result < 0 &&
-       errcode != INF_NATIVE_SOCKET_EINTR &&
-       errcode != INF_NATIVE_SOCKET_EAGAIN)
+    if(result < 0 && errcode == INF_NATIVE_SOCKET_EINTR)
+      continue;
+    if(result < 0 && errcode == INF_NATIVE_SOCKET_EAGAIN)
+      break;
+
+    if(result < 0)
     {
       inf_tcp_connection_system_error(connection, errcode);
-      return FALSE;
+      break;
     }
     else if(result == 0)
     {
       inf_tcp_connection_close(connection);
-      return FALSE;
+      break;
     }
-    else if(result > 0)
+
+    /* Move segments that have been sent completely out of the queue */
+    priv->queued -= result;
+    priv->bytes_sent += result;
+    while(result > 0)
     {
-      send_data = (const char*)send_data + result;
-      send_len -= result;
+      segment = priv->queue_head;
+      if((gsize)result < segment->end - segment->begin)
+      {
+        segment->begin += result;
+        result = 0;
+      }
+      else
+      {
+        result -= segment->end - segment->begin;
+        priv->queue_head = segment->next;
+        if(priv->queue_head == NULL)
+          priv->queue_tail = NULL;
+
+        segment->next = NULL;
+        if(sent_tail != NULL)
+          sent_tail->next = segment;
+        else
+          sent_head = segment;
+        sent_tail = segment;
+      }
     }
-  } while( (send_len > 0) &&
-           (result > 0 || errcode == INF_NATIVE_SOCKET_EINTR) &&
-           (priv->socket != INVALID_SOCKET) );
+  }
 
-  *len -= send_len;
-  return TRUE;
+  if(priv->status == INF_TCP_CONNECTION_CONNECTED)
+  {
+    /* Wait for the socket to become writable if not everything could be
+     * sent, and stop waiting once everything has been sent. */
+    if(priv->queue_head != NULL && (~priv->events & INF_IO_OUTGOING))
+    {
+      priv->events |= INF_IO_OUTGOING;
+      inf_io_update_watch(priv->io, priv->watch, priv->events);
+    }
+    else if(priv->queue_head == NULL && (priv->events & INF_IO_OUTGOING))
+    {
+      priv->events &= ~INF_IO_OUTGOING;
+      inf_io_update_watch(priv->io, priv->watch, priv->events);
+    }
+  }
+
+  /* The segments are no longer part of the queue, so they stay valid even
+   * if a signal handler sends more data or closes the connection. */
+  while(sent_head != NULL)
+  {
+    segment = sent_head;
+    sent_head = segment->next;
+
+    if(priv->status == INF_TCP_CONNECTION_CONNECTED)
+    {
+      g_signal_emit(
+        G_OBJECT(connection),
+        tcp_connection_signals[SENT],
+        0,
+        segment->data,
+        (guint)segment->end
+      );
+    }
+
+    inf_tcp_connection_free_segment(connection, segment);
+  }
+
+  /* Only update this after the signal emission, since more data might be
+   * sent in response to the congestion being cleared. */
+  inf_tcp_connection_update_congestion(connection);
+  g_object_unref(connection);
+}
+
+/* Flushes the send queue, or, if a send batch is active in the current
+ * thread, adds the connection to the batch so that it is flushed when the
+ * batch ends. */
+static void
+inf_tcp_connection_flush_or_batch(InfTcpConnection* connection)
+{
+  InfTcpConnectionPrivate* priv;
+  InfTcpConnectionBatch* batch;
+
+  priv = INF_TCP_CONNECTION_PRIVATE(connection);
+  batch = g_private_get(&inf_tcp_connection_batch);
+
+  if(batch != NULL && batch->depth > 0)
+  {
+    if(!priv->batched)
+    {
+      priv->batched = TRUE;
+      g_ptr_array_add(batch->connections, g_object_ref(connection));
+    }
+
+    inf_tcp_connection_update_congestion(connection);
+  }
+  else
+  {
+    inf_tcp_connection_flush(connection);
+  }
+}
+
+static void
+inf_tcp_connection_resize_receive_buffer(InfTcpConnection* connection,
+                                         gsize alloc)
+{
+  InfTcpConnectionPrivate* priv;
+  priv = INF_TCP_CONNECTION_PRIVATE(connection);
+
+  if(alloc != priv->recv_alloc)
+  {
+    priv->recv_buffer = g_realloc(priv->recv_buffer, alloc);
+    priv->recv_alloc = alloc;
+  }
+}
+
+/* Emits the received signal for the first len bytes in the receive buffer.
+ * Returns FALSE if the connection was closed by a signal handler. */
+static gboolean
+inf_tcp_connection_flush_received(InfTcpConnection* connection,
+                                  gsize len)
+{
+  InfTcpConnectionPrivate* priv;
+  priv = INF_TCP_CONNECTION_PRIVATE(connection);
+
+  g_signal_emit(
+    G_OBJECT(connection),
+    tcp_connection_signals[RECEIVED],
+    0,
+    priv->recv_buffer,
+    (guint)len
+  );
+
+  return priv->status != INF_TCP_CONNECTION_CLOSED;
+}
+
+static void
+inf_tcp_connection_incoming_dispatch_func(gpointer user_data);
+
+static void
+inf_tcp_connection_remove_incoming_dispatch(InfTcpConnection* connection)
+{
+  InfTcpConnectionPrivate* priv;
+  priv = INF_TCP_CONNECTION_PRIVATE(connection);
+
+  if(priv->incoming_dispatch != NULL)
+  {
+    inf_io_remove_dispatch(priv->io, priv->incoming_dispatch);
+    priv->incoming_dispatch = NULL;
+  }
 }
 
 static void
 inf_tcp_connection_io_incoming(InfTcpConnection* connection)
 {
   InfTcpConnectionPrivate* priv;
-  gchar buf[2048];
+  gsize len;
+  gsize total;
+  gsize max_total;
   int errcode;
   ssize_t result;
 
@@ -646,34 +1532,110 @@ inf_tcp_connection_io_incoming(InfTcpConnection* connection)
 
   g_assert(priv->status == INF_TCP_CONNECTION_CONNECTED);
 
+  /* If more data has arrived while a dispatch to continue reading was
+   * pending, it is read now, so the dispatch is no longer needed. */
+  inf_tcp_connection_remove_incoming_dispatch(connection);
+
+  /* Read everything that is available into the receive buffer, and report
+   * it with a single signal emission. Only if the buffer cannot grow any
+   * further, report what we have so far and start over. Stop after a few
+   * buffers though, so that a fast peer cannot keep the thread busy while
+   * other connections wait. */
+  len = 0;
+  total = 0;
+  max_total =
+    priv->max_recv_alloc * INF_TCP_CONNECTION_MAX_RECEIVE_BUFFERS_PER_WAKEUP;
+
   do
   {
-    result = recv(priv->socket, buf, 2048, INF_NATIVE_SOCKET_SENDRECV_FLAGS);
-    errcode = INF_NATIVE_SOCKET_LAST_ERROR;
-
-    if(result < 0 &&
-       errcode != INF_NATIVE_SOCKET_EINTR &&
-       errcode != INF_NATIVE_SOCKET_EAGAIN)
+    if(len == priv->recv_alloc)
     {
-      inf_tcp_connection_system_error(connection, errcode);
-    }
-    else if(result == 0)
-    {
-      inf_tcp_connection_close(connection);
+      if(priv->recv_alloc < priv->max_recv_alloc)
+      {
+        inf_tcp_connection_resize_receive_buffer(
+          connection,
+          MIN(priv->recv_alloc * 2, priv->max_recv_alloc)
+        );
+      }
+      else
+      {
+        if(!inf_tcp_connection_flush_received(connection, len))
+          return;
+        len = 0;
+      }
     }
-    else if(result > 0)
+
+    result = recv(
+      priv->socket,
+      priv->recv_buffer + len,
+      priv->recv_alloc - len,
+      INF_NATIVE_SOCKET_SENDRECV_FLAGS
+    );
+
+    errcode = INF_NATIVE_SOCKET_LAST_ERROR;
+
+    if(result > 0)
     {
-      g_signal_emit(
-        G_OBJECT(connection),
-        tcp_connection_signals[RECEIVED],
-        0,
-        buf,
-        (guint)result
-      );
+      len += result;
+      total += result;
+      priv->bytes_received += result;
     }
-  } while( ((result > 0) ||
-            (result < 0 && errcode == INF_NATIVE_SOCKET_EINTR)) &&
-           (priv->status != INF_TCP_CONNECTION_CLOSED));
+  } while((result > 0 && total < max_total) ||
+          (result < 0 && errcode == INF_NATIVE_SOCKET_EINTR));
+
+  /* Report data received before an error or EOF before the error or EOF
+   * itself. */
+  if(len > 0)
+    if(!inf_tcp_connection_flush_received(connection, len))
+      return;
+
+  if(result < 0 && errcode != INF_NATIVE_SOCKET_EAGAIN)
+  {
+    inf_tcp_connection_system_error(connection, errcode);
+  }
+  else if(result == 0)
+  {
+    inf_tcp_connection_close(connection);
+  }
+  else if(result > 0)
+  {
+    /* The socket has not been drained, so an edge-triggered watch would not
+     * report it again. Continue once the IO has handled other events. */
+    priv->incoming_dispatch = inf_io_add_dispatch(
+      priv->io,
+      inf_tcp_connection_incoming_dispatch_func,
+      connection,
+      NULL
+    );
+  }
+  else if(total < priv->recv_alloc / 4 &&
+          priv->recv_alloc > INF_TCP_CONNECTION_MIN_RECEIVE_BUFFER_SIZE)
+  {
+    /* Traffic has slowed down, so give back some of the memory */
+    inf_tcp_connection_resize_receive_buffer(
+      connection,
+      MAX(priv->recv_alloc / 2, INF_TCP_CONNECTION_MIN_RECEIVE_BUFFER_SIZE)
+    );
+  }
+}
+
+static void
+inf_tcp_connection_incoming_dispatch_func(gpointer user_data)
+{
+  InfTcpConnection* connection;
+  InfTcpConnectionPrivate* priv;
+
+  connection = INF_TCP_CONNECTION(user_data);
+  priv = INF_TCP_CONNECTION_PRIVATE(connection);
+  priv->incoming_dispatch = NULL;
+
+  g_object_ref(connection);
+
+  inf_tcp_connection_begin_batch();
+  inf_tcp_connection_io_incoming(connection);
+  inf_tcp_connection_end_batch();
+
+  g_object_unref(connection);
 }
 
 static void
@@ -684,9 +1646,6 @@ inf_tcp_connection_io_outgoing(InfTcpConnection* connection)
   socklen_t len;
   int errcode;
 
-  gconstpointer data;
-  guint data_len;
-
   priv = INF_TCP_CONNECTION_PRIVATE(connection);
   switch(priv->status)
   {
@@ -704,40 +1663,15 @@ inf_tcp_connection_io_outgoing(InfTcpConnection* connection)
     }
     else
     {
-      inf_tcp_connection_system_error(connection, errcode);
-    }
-
-    break;
-  case INF_TCP_CONNECTION_CONNECTED:
-    g_assert(priv->back_pos < priv->front_pos);
-    g_assert(priv->events & INF_IO_OUTGOING);
-
-    data = priv->queue + priv->back_pos;
-    data_len = priv->front_pos - priv->back_pos;
-    if(inf_tcp_connection_send_real(connection, data, &data_len) == TRUE)
-    {
-      priv->back_pos += data_len;
-
-      if(priv->front_pos == priv->back_pos)
-      {
-        /* sent everything */
-        priv->front_pos = 0;
-        priv->back_pos = 0;
-
-        priv->events &= ~INF_IO_OUTGOING;
-
-        inf_io_update_watch(priv->io, priv->watch, priv->events);
-      }
-
-      g_signal_emit(
-        G_OBJECT(connection),
-        tcp_connection_signals[SENT],
-        0,
-        data,
-        data_len
-      );
+      inf_tcp_connection_system_error(connection, errcode);
     }
 
+    break;
+  case INF_TCP_CONNECTION_CONNECTED:
+    g_assert(priv->queue_head != NULL);
+    g_assert(priv->events & INF_IO_OUTGOING);
+
+    inf_tcp_connection_flush(connection);
     break;
   case INF_TCP_CONNECTION_CLOSED:
   default:
@@ -809,7 +1743,9 @@ inf_tcp_connection_io(InfNativeSocket* socket,
   {
     if(events & INF_IO_INCOMING)
     {
+      inf_tcp_connection_begin_batch();
       inf_tcp_connection_io_incoming(connection);
+      inf_tcp_connection_end_batch();
     }
 
     /* It may happen that the above closes the connection and we received
@@ -844,7 +1780,8 @@ inf_tcp_connection_resolved_cb(InfNameResolver* resolver,
     {
       /* If there was an error, no additional addresses are available */
       g_assert(
-        priv->resolver_index == inf_name_resolver_get_n_addresses(resolver)
+        priv->resolver_order->len ==
+          inf_name_resolver_get_n_addresses(resolver)
       );
 
       inf_tcp_connection_connection_error(connection, error);
@@ -853,7 +1790,7 @@ inf_tcp_connection_resolved_cb(InfNameResolver* resolver,
     {
       /* If there was no error, try opening a connection to the resolved
        * address(es). */
-      inf_tcp_connection_open_with_resolver(connection, NULL);
+      inf_tcp_connection_next_attempt(connection);
     }
   }
 }
@@ -901,19 +1838,41 @@ inf_tcp_connection_init(InfTcpConnection* connection)
   priv->events = 0;
   priv->watch = NULL;
   priv->resolver = NULL;
+  priv->resolver_order = g_array_new(FALSE, FALSE, sizeof(guint));
   priv->resolver_index = 0;
+  priv->attempts = NULL;
+  priv->attempt_timeout = NULL;
+  priv->attempt_error = NULL;
   priv->status = INF_TCP_CONNECTION_CLOSED;
   priv->socket = INVALID_SOCKET;
   priv->keepalive.mask = 0;
 
   priv->remote_address = NULL;
   priv->remote_port = 0;
+  priv->unix_path = NULL;
   priv->device_index = 0;
 
-  priv->queue = g_malloc(1024);
-  priv->front_pos = 0;
-  priv->back_pos = 0;
-  priv->alloc = 1024;
+  priv->queue_head = NULL;
+  priv->queue_tail = NULL;
+  priv->spare_segment = NULL;
+  priv->queued = 0;
+  priv->cork_count = 0;
+  priv->batched = FALSE;
+
+  priv->high_water_mark = INF_TCP_CONNECTION_DEFAULT_HIGH_WATER_MARK;
+  priv->low_water_mark = INF_TCP_CONNECTION_DEFAULT_LOW_WATER_MARK;
+  priv->congested = FALSE;
+
+  priv->congestion_timeout = 0;
+  priv->congestion_timeout_handle = NULL;
+
+  priv->recv_buffer = g_malloc(INF_TCP_CONNECTION_MIN_RECEIVE_BUFFER_SIZE);
+  priv->recv_alloc = INF_TCP_CONNECTION_MIN_RECEIVE_BUFFER_SIZE;
+  priv->max_recv_alloc = INF_TCP_CONNECTION_DEFAULT_MAX_RECEIVE_BUFFER_SIZE;
+  priv->incoming_dispatch = NULL;
+
+  priv->bytes_sent = 0;
+  priv->bytes_received = 0;
 }
 
 static void
@@ -951,10 +1910,15 @@ inf_tcp_connection_finalize(GObject* object)
   if(priv->remote_address != NULL)
     inf_ip_address_free(priv->remote_address);
 
+  g_free(priv->unix_path);
+
   if(priv->socket != INVALID_SOCKET)
     closesocket(priv->socket);
 
-  g_free(priv->queue);
+  inf_tcp_connection_clear_queue(connection);
+  g_free(priv->spare_segment);
+  g_free(priv->recv_buffer);
+  g_array_free(priv->resolver_order, TRUE);
 
   G_OBJECT_CLASS(inf_tcp_connection_parent_class)->finalize(object);
 }
@@ -1018,6 +1982,11 @@ inf_tcp_connection_set_property(GObject* object,
     g_assert(priv->status == INF_TCP_CONNECTION_CLOSED);
     priv->remote_port = g_value_get_uint(value);
     break;
+  case PROP_UNIX_PATH:
+    g_assert(priv->status == INF_TCP_CONNECTION_CLOSED);
+    g_free(priv->unix_path);
+    priv->unix_path = g_value_dup_string(value);
+    break;
   case PROP_DEVICE_INDEX:
     g_assert(priv->status == INF_TCP_CONNECTION_CLOSED);
     /* TODO: Verify that such a device exists */
@@ -1045,6 +2014,29 @@ inf_tcp_connection_set_property(GObject* object,
     }
 #endif
     break;
+  case PROP_HIGH_WATER_MARK:
+    priv->high_water_mark = g_value_get_uint(value);
+    if(priv->low_water_mark > priv->high_water_mark)
+    {
+      priv->low_water_mark = priv->high_water_mark;
+      g_object_notify(G_OBJECT(object), "low-water-mark");
+    }
+
+    inf_tcp_connection_update_congestion(connection);
+    break;
+  case PROP_LOW_WATER_MARK:
+    priv->low_water_mark = MIN(g_value_get_uint(value), priv->high_water_mark);
+    inf_tcp_connection_update_congestion(connection);
+    break;
+  case PROP_CONGESTION_TIMEOUT:
+    priv->congestion_timeout = g_value_get_uint(value);
+    if(priv->status == INF_TCP_CONNECTION_CONNECTED)
+      inf_tcp_connection_reset_congestion_timeout(connection);
+    break;
+  case PROP_MAX_RECEIVE_BUFFER_SIZE:
+    /* A larger buffer is only shrunk once traffic slows down */
+    priv->max_recv_alloc = g_value_get_uint(value);
+    break;
   default:
     G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
     break;
@@ -1124,6 +2116,9 @@ inf_tcp_connection_get_property(GObject* object,
       g_value_set_uint(value, port);
     }
 
+    break;
+  case PROP_UNIX_PATH:
+    g_value_set_string(value, priv->unix_path);
     break;
   case PROP_DEVICE_INDEX:
     g_value_set_uint(value, priv->device_index);
@@ -1158,6 +2153,21 @@ inf_tcp_connection_get_property(GObject* object,
     }
 #endif
     break;
+  case PROP_HIGH_WATER_MARK:
+    g_value_set_uint(value, priv->high_water_mark);
+    break;
+  case PROP_LOW_WATER_MARK:
+    g_value_set_uint(value, priv->low_water_mark);
+    break;
+  case PROP_CONGESTED:
+    g_value_set_boolean(value, priv->congested);
+    break;
+  case PROP_CONGESTION_TIMEOUT:
+    g_value_set_uint(value, priv->congestion_timeout);
+    break;
+  case PROP_MAX_RECEIVE_BUFFER_SIZE:
+    g_value_set_uint(value, priv->max_recv_alloc);
+    break;
   default:
     G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
     break;
@@ -1182,11 +2192,20 @@ inf_tcp_connection_error(InfTcpConnection* connection,
     priv->watch = NULL;
   }
 
+  inf_tcp_connection_remove_incoming_dispatch(connection);
+
+  /* Queued data can no longer be sent */
+  inf_tcp_connection_clear_queue(connection);
+
   if(priv->status != INF_TCP_CONNECTION_CLOSED)
   {
     priv->status = INF_TCP_CONNECTION_CLOSED;
     g_object_notify(G_OBJECT(connection), "status");
   }
+
+  /* Do this only after the status change, so that nobody attempts to send
+   * more data in response to the congestion being cleared. */
+  inf_tcp_connection_update_congestion(connection);
 }
 
 static void
@@ -1305,6 +2324,18 @@ inf_tcp_connection_class_init(InfTcpConnectionClass* tcp_connection_class)
     )
   );
 
+  g_object_class_install_property(
+    object_class,
+    PROP_UNIX_PATH,
+    g_param_spec_string(
+      "unix-path",
+      "Unix path",
+      "Path of a Unix domain socket to connect to instead of a TCP endpoint",
+      NULL,
+      G_PARAM_READWRITE
+    )
+  );
+
   g_object_class_install_property(
     object_class,
     PROP_DEVICE_INDEX,
@@ -1331,6 +2362,78 @@ inf_tcp_connection_class_init(InfTcpConnectionClass* tcp_connection_class)
     )
   );
 
+  g_object_class_install_property(
+    object_class,
+    PROP_HIGH_WATER_MARK,
+    g_param_spec_uint(
+      "high-water-mark",
+      "High water mark",
+      "Number of bytes in the send queue at which the connection becomes "
+      "congested, or 0 to never consider the connection congested",
+      0,
+      G_MAXUINT,
+      INF_TCP_CONNECTION_DEFAULT_HIGH_WATER_MARK,
+      G_PARAM_READWRITE
+    )
+  );
+
+  g_object_class_install_property(
+    object_class,
+    PROP_LOW_WATER_MARK,
+    g_param_spec_uint(
+      "low-water-mark",
+      "Low water mark",
+      "Number of bytes in the send queue at or below which a congested "
+      "connection is no longer considered congested",
+      0,
+      G_MAXUINT,
+      INF_TCP_CONNECTION_DEFAULT_LOW_WATER_MARK,
+      G_PARAM_READWRITE
+    )
+  );
+
+  g_object_class_install_property(
+    object_class,
+    PROP_CONGESTED,
+    g_param_spec_boolean(
+      "congested",
+      "Congested",
+      "Whether the send queue has grown beyond the high water mark",
+      FALSE,
+      G_PARAM_READABLE
+    )
+  );
+
+  g_object_class_install_property(
+    object_class,
+    PROP_CONGESTION_TIMEOUT,
+    g_param_spec_uint(
+      "congestion-timeout",
+      "Congestion timeout",
+      "Time in milliseconds after which a connection that stays congested "
+      "is closed with an error, or 0 to never close it",
+      0,
+      G_MAXUINT,
+      0,
+      G_PARAM_READWRITE
+    )
+  );
+
+  g_object_class_install_property(
+    object_class,
+    PROP_MAX_RECEIVE_BUFFER_SIZE,
+    g_param_spec_uint(
+      "max-receive-buffer-size",
+      "Maximum receive buffer size",
+      "Number of bytes up to which the receive buffer grows, which is the "
+      "largest amount of data reported by a single received signal",
+      INF_TCP_CONNECTION_MIN_RECEIVE_BUFFER_SIZE,
+      G_MAXUINT,
+      INF_TCP_CONNECTION_DEFAULT_MAX_RECEIVE_BUFFER_SIZE,
+      G_PARAM_READWRITE
+    )
+  );
+
   /**
    * InfTcpConnection::sent:
    * @connection: The #InfTcpConnection through which the data has been sent.
@@ -1338,6 +2441,12 @@ inf_tcp_connection_class_init(InfTcpConnectionClass* tcp_connection_class)
    * @length: A #guint holding the number of bytes that has been sent.
    *
    * This signal is emitted whenever data has been sent over the connection.
+   * It is emitted once for each segment of the send queue that has been
+   * handed to the kernel completely, in the order the data was queued. A
+   * segment holds up to 16 KiB, and can contain the data of several calls to
+   * inf_tcp_connection_send(), or only part of the data of a single call, so
+   * the emissions do not correspond to individual sends. Use @length to keep
+   * track of how much of the queued data has been sent.
    */
   tcp_connection_signals[SENT] = g_signal_new(
     "sent",
@@ -1510,13 +2619,58 @@ inf_tcp_connection_new_resolve(InfIo* io,
   return tcp;
 }
 
+/**
+ * inf_tcp_connection_new_unix: (constructor)
+ * @io: A #InfIo object used to watch for activity.
+ * @path: The path of the Unix domain socket to eventually connect to.
+ *
+ * Creates a new #InfTcpConnection which connects to the Unix domain socket
+ * at @path instead of a TCP endpoint. Its #InfTcpConnection:remote-address
+ * is the IPv4 loopback address, and its #InfTcpConnection:remote-port is 0.
+ *
+ * The argument is stored as a property for an eventual
+ * inf_tcp_connection_open() call, this function itself does not
+ * establish a connection.
+ *
+ * Returns: (transfer full): A new #InfTcpConnection. Free with
+ * g_object_unref().
+ */
+InfTcpConnection*
+inf_tcp_connection_new_unix(InfIo* io,
+                            const gchar* path)
+{
+  InfTcpConnection* tcp;
+  InfIpAddress* address;
+
+  g_return_val_if_fail(INF_IS_IO(io), NULL);
+  g_return_val_if_fail(path != NULL, NULL);
+
+  address = inf_ip_address_new_loopback4();
+
+  tcp = INF_TCP_CONNECTION(
+    g_object_new(
+      INF_TYPE_TCP_CONNECTION,
+      "io", io,
+      "remote-address", address,
+      "remote-port", 0,
+      "unix-path", path,
+      NULL
+    )
+  );
+
+  inf_ip_address_free(address);
+  return tcp;
+}
+
 /**
  * inf_tcp_connection_open:
  * @connection: A #InfTcpConnection.
  * @error: Location to store error information.
  *
  * Attempts to open @connection. Make sure to have set the "remote-address"
- * and "remote-port" property before calling this function. If an error
+ * and "remote-port" property, or the "resolver" or "unix-path" property,
+ * before calling this function. If "unix-path" is set, it takes precedence
+ * over the other ones. If an error
  * occurs, the function returns %FALSE and @error is set. Note however that
  * the connection might not be fully open when the function returns
  * (check the "status" property if you need to know). If an asynchronous
@@ -1538,20 +2692,45 @@ inf_tcp_connection_open(InfTcpConnection* connection,
   g_return_val_if_fail(priv->status == INF_TCP_CONNECTION_CLOSED, FALSE);
 
   g_return_val_if_fail(
-    priv->remote_address != NULL || priv->resolver != NULL,
+    priv->remote_address != NULL ||
+    priv->resolver != NULL ||
+    priv->unix_path != NULL,
     FALSE
   );
 
   g_return_val_if_fail(
     priv->remote_port != 0 ||
-    priv->resolver != NULL,
+    priv->resolver != NULL ||
+    priv->unix_path != NULL,
     FALSE
   );
 
-  if(priv->resolver != NULL)
+  if(priv->unix_path != NULL)
+  {
+    if(priv->remote_address == NULL)
+    {
+      priv->remote_address = inf_ip_address_new_loopback4();
+      g_object_notify(G_OBJECT(connection), "remote-address");
+    }
+
+    return inf_tcp_connection_open_real(connection, NULL, 0, error);
+  }
+  else if(priv->resolver != NULL)
   {
     g_assert(priv->resolver_index == 0);
-    return inf_tcp_connection_open_with_resolver(connection, error);
+
+    /* The hostname is looked up again for every connection, so that no
+     * outdated addresses are used. Results which have not yet expired are
+     * answered from the resolver's cache without a DNS query. */
+    if(!inf_name_resolver_finished(priv->resolver))
+    {
+      /* Use the result of the lookup that is currently running */
+      priv->status = INF_TCP_CONNECTION_CONNECTING;
+      g_object_notify(G_OBJECT(connection), "status");
+      return TRUE;
+    }
+
+    return inf_tcp_connection_lookup(connection, error);
   }
   else
   {
@@ -1588,11 +2767,19 @@ inf_tcp_connection_close(InfTcpConnection* connection)
     priv->watch = NULL;
   }
 
-  priv->front_pos = 0;
-  priv->back_pos = 0;
+  inf_tcp_connection_remove_incoming_dispatch(connection);
+  inf_tcp_connection_reset_attempts(connection);
+  inf_tcp_connection_clear_queue(connection);
+
+  g_object_ref(connection);
 
   priv->status = INF_TCP_CONNECTION_CLOSED;
   g_object_notify(G_OBJECT(connection), "status");
+
+  /* Do this only after the status change, so that nobody attempts to send
+   * more data in response to the congestion being cleared. */
+  inf_tcp_connection_update_congestion(connection);
+  g_object_unref(connection);
 }
 
 /**
@@ -1601,10 +2788,14 @@ inf_tcp_connection_close(InfTcpConnection* connection)
  * @data: (type guint8*) (array length=len): The data to send.
  * @len: Number of bytes to send.
  *
- * Sends data through the TCP connection. The data is not sent immediately,
- * but enqueued to a buffer and will be sent as soon as kernel space
- * becomes available. The "sent" signal will be emitted when data has
- * really been sent.
+ * Sends data through the TCP connection. The data is appended to the send
+ * queue, which is handed to the kernel right away unless the connection is
+ * corked or the kernel cannot take more data at the moment. In the latter
+ * cases, the data is sent as soon as the connection is uncorked or kernel
+ * space becomes available, or, if a send batch is active, when the batch
+ * ends. The "sent" signal will be emitted when data has really been sent,
+ * once per completed segment of the send queue rather than once per call to
+ * this function.
  **/
 void
 inf_tcp_connection_send(InfTcpConnection* connection,
@@ -1612,8 +2803,6 @@ inf_tcp_connection_send(InfTcpConnection* connection,
                         guint len)
 {
   InfTcpConnectionPrivate* priv;
-  gconstpointer sent_data;
-  guint sent_len;
 
   g_return_if_fail(INF_IS_TCP_CONNECTION(connection));
   g_return_if_fail(len == 0 || data != NULL);
@@ -1621,91 +2810,151 @@ inf_tcp_connection_send(InfTcpConnection* connection,
   priv = INF_TCP_CONNECTION_PRIVATE(connection);
   g_return_if_fail(priv->status == INF_TCP_CONNECTION_CONNECTED);
 
-  g_object_ref(connection);
-
-  /* Check whether we have data currently queued. If we have, then we need
-   * to wait until that data has been sent before sending the new data. */
-  if(priv->front_pos == priv->back_pos)
-  {
-    /* Must not be set, because otherwise we would need something to send,
-     * but there is nothing in the queue. */
-    g_assert(~priv->events & INF_IO_OUTGOING);
+  if(len == 0)
+    return;
 
-    /* Nothing in queue, send data directly. */
-    sent_len = len;
-    sent_data = data;
+  inf_tcp_connection_enqueue(connection, data, len);
 
-    if(inf_tcp_connection_send_real(connection, data, &sent_len) == TRUE)
-    {
-      data = (const char*)data + sent_len;
-      len -= sent_len;
-    }
-    else
-    {
-      /* Sending failed. The error signal has been emitted. */
-      /* Set len to zero so that we don't enqueue data. */
-      len = 0;
-      sent_len = 0;
-    }
-  }
+  /* If we are waiting for the socket to become writable, then the new data
+   * is sent together with what is already queued. */
+  if(priv->cork_count == 0 && (~priv->events & INF_IO_OUTGOING))
+    inf_tcp_connection_flush_or_batch(connection);
   else
+    inf_tcp_connection_update_congestion(connection);
+}
+
+/**
+ * inf_tcp_connection_cork:
+ * @connection: A #InfTcpConnection.
+ *
+ * Holds back data passed to inf_tcp_connection_send() in the send queue
+ * until inf_tcp_connection_uncork() is called, so that a burst of messages
+ * is handed to the kernel with few system calls and leaves in few large
+ * packets. Calls can be nested, and data is only sent once each call has
+ * been matched by a call to inf_tcp_connection_uncork().
+ **/
+void
+inf_tcp_connection_cork(InfTcpConnection* connection)
+{
+  InfTcpConnectionPrivate* priv;
+
+  g_return_if_fail(INF_IS_TCP_CONNECTION(connection));
+
+  priv = INF_TCP_CONNECTION_PRIVATE(connection);
+  ++priv->cork_count;
+}
+
+/**
+ * inf_tcp_connection_uncork:
+ * @connection: A #InfTcpConnection corked with inf_tcp_connection_cork().
+ *
+ * Undoes a call to inf_tcp_connection_cork(). If this was the last
+ * outstanding call, the data that has been queued in the meanwhile is sent.
+ **/
+void
+inf_tcp_connection_uncork(InfTcpConnection* connection)
+{
+  InfTcpConnectionPrivate* priv;
+
+  g_return_if_fail(INF_IS_TCP_CONNECTION(connection));
+
+  priv = INF_TCP_CONNECTION_PRIVATE(connection);
+  g_return_if_fail(priv->cork_count > 0);
+
+  --priv->cork_count;
+
+  if(priv->cork_count == 0 &&
+     priv->status == INF_TCP_CONNECTION_CONNECTED &&
+     priv->queue_head != NULL &&
+     (~priv->events & INF_IO_OUTGOING))
   {
-    /* Nothing sent */
-    sent_len = 0;
+    inf_tcp_connection_flush_or_batch(connection);
   }
+}
 
-  /* If we couldn't send all the data... */
-  if(len > 0)
+/**
+ * inf_tcp_connection_begin_batch:
+ *
+ * Starts a send batch in the calling thread. Until the batch is ended with
+ * inf_tcp_connection_end_batch(), data passed to inf_tcp_connection_send()
+ * on any connection is only queued, as if all connections were corked. When
+ * the batch ends, each connection that has been sent data is flushed once.
+ * This way, a message that is relayed to many connections, for example to
+ * all subscribers of a session, costs one system call per connection for
+ * everything that has been sent during the batch, rather than one per
+ * message.
+ *
+ * Received data is always processed within a batch, so that replies and
+ * relayed messages caused by one #InfTcpConnection::received emission leave
+ * together. Batches can be nested, and only the outermost
+ * inf_tcp_connection_end_batch() call flushes the connections. Batches are
+ * per thread, and only affect connections used in the calling thread.
+ **/
+void
+inf_tcp_connection_begin_batch(void)
+{
+  InfTcpConnectionBatch* batch;
+
+  batch = g_private_get(&inf_tcp_connection_batch);
+  if(batch == NULL)
   {
-    /* If we have not enough space for the new data, move queue data back
-     * onto the beginning of the queue, if not already */
-    if(priv->alloc - priv->front_pos < len && priv->back_pos > 0)
-    {
-      memmove(
-        priv->queue,
-        priv->queue + priv->back_pos,
-        priv->front_pos - priv->back_pos
-      );
+    batch = g_slice_new(InfTcpConnectionBatch);
+    batch->depth = 0;
+    batch->connections = g_ptr_array_new();
+    g_private_set(&inf_tcp_connection_batch, batch);
+  }
 
-      priv->front_pos -= priv->back_pos;
-      priv->back_pos = 0;
-    }
+  ++batch->depth;
+}
 
-    /* Allocate more memory if there is still not enough space */
-    if(priv->alloc - priv->front_pos < len)
-    {
-      /* Make sure we allocate enough */
-      priv->alloc = priv->front_pos + len;
+/**
+ * inf_tcp_connection_end_batch:
+ *
+ * Ends a send batch started with inf_tcp_connection_begin_batch(). If this
+ * was the outermost batch of the calling thread, all connections that have
+ * been sent data in the meanwhile are flushed, except those that are still
+ * corked with inf_tcp_connection_cork(). These are flushed when they are
+ * uncorked.
+ **/
+void
+inf_tcp_connection_end_batch(void)
+{
+  InfTcpConnectionBatch* batch;
+  InfTcpConnectionPrivate* priv;
+  InfTcpConnection* connection;
+  GPtrArray* connections;
+  guint i;
 
-      /* Always allocate a multiple of 1024 */
-      if(priv->alloc % 1024 != 0)
-        priv->alloc = priv->alloc + (1024 - priv->alloc % 1024);
+  batch = g_private_get(&inf_tcp_connection_batch);
+  g_return_if_fail(batch != NULL && batch->depth > 0);
 
-      priv->queue = g_realloc(priv->queue, priv->alloc);
-    }
+  --batch->depth;
+  if(batch->depth > 0 || batch->connections->len == 0)
+    return;
 
-    memcpy(priv->queue + priv->front_pos, data, len);
-    priv->front_pos += len;
+  /* Flushing emits the sent signal, whose handlers might start another
+   * batch, so take the connections out of this one first. */
+  connections = batch->connections;
+  batch->connections = g_ptr_array_new();
 
-    if(~priv->events & INF_IO_OUTGOING)
+  for(i = 0; i < connections->len; ++i)
+  {
+    connection = INF_TCP_CONNECTION(g_ptr_array_index(connections, i));
+    priv = INF_TCP_CONNECTION_PRIVATE(connection);
+    priv->batched = FALSE;
+
+    if(priv->cork_count == 0 &&
+       priv->status == INF_TCP_CONNECTION_CONNECTED &&
+       priv->queue_head != NULL &&
+       (~priv->events & INF_IO_OUTGOING))
     {
-      priv->events |= INF_IO_OUTGOING;
-      inf_io_update_watch(priv->io, priv->watch, priv->events);
+      inf_tcp_connection_flush(connection);
     }
-  }
 
-  if(sent_len > 0)
-  {
-    g_signal_emit(
-      G_OBJECT(connection),
-      tcp_connection_signals[SENT],
-      0,
-      sent_data,
-      sent_len
-    );
+    g_object_unref(connection);
   }
 
-  g_object_unref(connection);
+  g_ptr_array_free(connections, TRUE);
 }
 
 /**
@@ -1741,6 +2990,22 @@ inf_tcp_connection_get_remote_port(InfTcpConnection* connection)
   return INF_TCP_CONNECTION_PRIVATE(connection)->remote_port;
 }
 
+/**
+ * inf_tcp_connection_get_unix_path:
+ * @connection: A #InfTcpConnection.
+ *
+ * Returns the path of the Unix domain socket to which @connection is (or
+ * was) connected or connecting, or %NULL if it is a TCP connection.
+ *
+ * Returns: (allow-none): The path of the Unix domain socket, or %NULL.
+ **/
+const gchar*
+inf_tcp_connection_get_unix_path(InfTcpConnection* connection)
+{
+  g_return_val_if_fail(INF_IS_TCP_CONNECTION(connection), NULL);
+  return INF_TCP_CONNECTION_PRIVATE(connection)->unix_path;
+}
+
 /**
  * inf_tcp_connection_set_keepalive:
  * @connection: A #InfTcpConnection.
@@ -1797,6 +3062,75 @@ inf_tcp_connection_get_keepalive(InfTcpConnection* connection)
   return &INF_TCP_CONNECTION_PRIVATE(connection)->keepalive;
 }
 
+/**
+ * inf_tcp_connection_get_send_queue_length:
+ * @connection: A #InfTcpConnection.
+ *
+ * Returns the number of bytes that have been passed to
+ * inf_tcp_connection_send() but could not yet be handed to the kernel,
+ * because the remote side does not read fast enough.
+ *
+ * Returns: The number of bytes in @connection's send queue.
+ */
+gsize
+inf_tcp_connection_get_send_queue_length(InfTcpConnection* connection)
+{
+  InfTcpConnectionPrivate* priv;
+
+  g_return_val_if_fail(INF_IS_TCP_CONNECTION(connection), 0);
+
+  priv = INF_TCP_CONNECTION_PRIVATE(connection);
+  return priv->queued;
+}
+
+/**
+ * inf_tcp_connection_get_congested:
+ * @connection: A #InfTcpConnection.
+ *
+ * Returns whether @connection is congested. A connection becomes congested
+ * when its send queue grows to #InfTcpConnection:high-water-mark bytes, and
+ * it stops being congested when the send queue has been drained to
+ * #InfTcpConnection:low-water-mark bytes. Users of the connection can watch
+ * the #InfTcpConnection:congested property to stop producing data while the
+ * remote side does not keep up.
+ *
+ * Returns: %TRUE if @connection is congested, or %FALSE otherwise.
+ */
+gboolean
+inf_tcp_connection_get_congested(InfTcpConnection* connection)
+{
+  g_return_val_if_fail(INF_IS_TCP_CONNECTION(connection), FALSE);
+  return INF_TCP_CONNECTION_PRIVATE(connection)->congested;
+}
+
+/**
+ * inf_tcp_connection_get_statistics:
+ * @connection: A #InfTcpConnection.
+ * @bytes_sent: (out) (allow-none): Location to store the number of bytes
+ * handed to the kernel, or %NULL.
+ * @bytes_received: (out) (allow-none): Location to store the number of
+ * bytes received, or %NULL.
+ *
+ * Returns the number of bytes transmitted over @connection since it was
+ * created. The counters are not reset when the connection is closed and
+ * opened again.
+ */
+void
+inf_tcp_connection_get_statistics(InfTcpConnection* connection,
+                                  guint64* bytes_sent,
+                                  guint64* bytes_received)
+{
+  InfTcpConnectionPrivate* priv;
+
+  g_return_if_fail(INF_IS_TCP_CONNECTION(connection));
+  priv = INF_TCP_CONNECTION_PRIVATE(connection);
+
+  if(bytes_sent != NULL)
+    *bytes_sent = priv->bytes_sent;
+  if(bytes_received != NULL)
+    *bytes_received = priv->bytes_received;
+}
+
 /* Creates a new TCP connection from an accepted socket. This is only used
  * by InfdTcpServer and should not be considered regular API. Do not call
  * this function. Language bindings should not wrap it. */
@@ -1835,4 +3169,34 @@ _inf_tcp_connection_accepted(InfIo* io,
   return connection;
 }
 
+/* Creates a new connection from a socket accepted on a Unix domain socket
+ * bound to path. Like _inf_tcp_connection_accepted(), this is only used by
+ * InfdTcpServer. */
+InfTcpConnection*
+_inf_tcp_connection_accepted_unix(InfIo* io,
+                                  InfNativeSocket socket,
+                                  const gchar* path,
+                                  GError** error)
+{
+  InfTcpConnection* connection;
+  InfTcpConnectionPrivate* priv;
+  InfKeepalive keepalive;
+
+  g_return_val_if_fail(INF_IS_IO(io), NULL);
+  g_return_val_if_fail(socket != INVALID_SOCKET, NULL);
+  g_return_val_if_fail(path != NULL, NULL);
+
+  keepalive.mask = 0;
+  if(inf_tcp_connection_configure_socket(socket, &keepalive, error) != TRUE)
+    return NULL;
+
+  connection = inf_tcp_connection_new_unix(io, path);
+
+  priv = INF_TCP_CONNECTION_PRIVATE(connection);
+  priv->socket = socket;
+
+  inf_tcp_connection_connected(connection);
+  return connection;
+}
+
 /* vim:set et sw=2 ts=2: */
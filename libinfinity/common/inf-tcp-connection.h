@@ -119,6 +119,10 @@ InfTcpConnection*
 inf_tcp_connection_new_resolve(InfIo* io,
                                InfNameResolver* resolver);
 
+InfTcpConnection*
+inf_tcp_connection_new_unix(InfIo* io,
+                            const gchar* path);
+
 gboolean
 inf_tcp_connection_open(InfTcpConnection* connection,
                         GError** error);
@@ -131,12 +135,27 @@ inf_tcp_connection_send(InfTcpConnection* connection,
                         gconstpointer data,
                         guint len);
 
+void
+inf_tcp_connection_cork(InfTcpConnection* connection);
+
+void
+inf_tcp_connection_uncork(InfTcpConnection* connection);
+
+void
+inf_tcp_connection_begin_batch(void);
+
+void
+inf_tcp_connection_end_batch(void);
+
 InfIpAddress*
 inf_tcp_connection_get_remote_address(InfTcpConnection* connection);
 
 guint
 inf_tcp_connection_get_remote_port(InfTcpConnection* connection);
 
+const gchar*
+inf_tcp_connection_get_unix_path(InfTcpConnection* connection);
+
 gboolean
 inf_tcp_connection_set_keepalive(InfTcpConnection* connection,
                                  const InfKeepalive* keepalive,
@@ -145,6 +164,17 @@ inf_tcp_connection_set_keepalive(InfTcpConnection* connection,
 const InfKeepalive*
 inf_tcp_connection_get_keepalive(InfTcpConnection* connection);
 
+gsize
+inf_tcp_connection_get_send_queue_length(InfTcpConnection* connection);
+
+gboolean
+inf_tcp_connection_get_congested(InfTcpConnection* connection);
+
+void
+inf_tcp_connection_get_statistics(InfTcpConnection* connection,
+                                  guint64* bytes_sent,
+                                  guint64* bytes_received);
+
 G_END_DECLS
 
 #endif /* __INF_TCP_CONNECTION_H__ */
@@ -0,0 +1,975 @@
+/* libinfinity - a GObject-based infinote implementation
+ * Copyright (C) 2007-2015 Armin Burgmeier <armin@arbur.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+/**
+ * SECTION:inf-thread-connection
+ * @title: InfThreadConnection
+ * @short_description: Use a connection from a different thread
+ * @include: libinfinity/common/inf-thread-connection.h
+ * @see_also: #InfXmlConnection, #InfIo
+ * @stability: Unstable
+ *
+ * #InfThreadConnection makes a #InfXmlConnection which is driven by the
+ * #InfIo of one thread usable in a different thread, running a different
+ * #InfIo. It implements #InfXmlConnection itself. Messages sent through it
+ * are handed to the wrapped connection with inf_io_add_dispatch(), and
+ * messages received by the wrapped connection, its status changes and its
+ * errors are handed back the same way. This way, the expensive parts of a
+ * connection, such as TLS, compression and XML parsing, can run in a worker
+ * thread, while the messages themselves are processed in the main thread.
+ *
+ * The #InfThreadConnection must be created in the thread that runs the
+ * #InfIo of the wrapped connection, and is afterwards only used in the
+ * thread that runs #InfThreadConnection:io. The properties of the wrapped
+ * connection are mirrored with a short delay. Messages are copied when they
+ * are handed from one thread to the other, so that each tree of XML nodes
+ * is only ever accessed from one thread.
+ *
+ * The #InfIo of the wrapped connection needs to keep running until the
+ * #InfThreadConnection has been finalized, since the wrapped connection is
+ * closed and released in its own thread afterwards.
+ */
+
+#include <libinfinity/common/inf-thread-connection.h>
+#include <libinfinity/common/inf-tcp-connection.h>
+#include <libinfinity/common/inf-certificate-chain.h>
+
+#include <string.h>
+
+/* Properties of the wrapped connection, taken in its thread and applied to
+ * the InfThreadConnection in the thread of its InfIo */
+typedef struct _InfThreadConnectionState InfThreadConnectionState;
+struct _InfThreadConnectionState {
+  InfXmlConnectionStatus status;
+  gchar* network;
+  gchar* local_id;
+  gchar* remote_id;
+  gpointer local_certificate;
+  InfCertificateChain* remote_certificate;
+  gboolean congested;
+};
+
+/* Shared between the InfThreadConnection and the thread of the wrapped
+ * connection. It lives until the wrapped connection has been released in its
+ * thread, which can be after the InfThreadConnection has been finalized. */
+typedef struct _InfThreadConnectionLink InfThreadConnectionLink;
+struct _InfThreadConnectionLink {
+  /* Only accessed in the thread of the wrapped connection */
+  InfXmlConnection* connection;
+
+  /* The InfThreadConnection, for as long as it is alive */
+  GWeakRef proxy;
+  /* The InfIo of the InfThreadConnection, which events are posted to */
+  InfIo* io;
+
+  /* Messages to be sent through the wrapped connection. A dispatch in the
+   * thread of the wrapped connection is pending while this is not empty. */
+  GMutex mutex;
+  GQueue outgoing;
+};
+
+typedef enum _InfThreadConnectionEventType {
+  INF_THREAD_CONNECTION_EVENT_STATE,
+  INF_THREAD_CONNECTION_EVENT_SENT,
+  INF_THREAD_CONNECTION_EVENT_RECEIVED,
+  INF_THREAD_CONNECTION_EVENT_ERROR
+} InfThreadConnectionEventType;
+
+/* Something that happened to the wrapped connection, to be reported by the
+ * InfThreadConnection in its own thread */
+typedef struct _InfThreadConnectionEvent InfThreadConnectionEvent;
+struct _InfThreadConnectionEvent {
+  InfThreadConnection* proxy;
+  InfThreadConnectionEventType type;
+  InfXmlConnectionStatistics statistics;
+
+  InfThreadConnectionState state;
+  xmlNodePtr xml;
+  GError* error;
+};
+
+typedef struct _InfThreadConnectionPrivate InfThreadConnectionPrivate;
+struct _InfThreadConnectionPrivate {
+  InfIo* io;
+  InfIo* connection_io;
+  /* Only set during construction, owned by the link afterwards */
+  InfXmlConnection* connection;
+  InfThreadConnectionLink* link;
+
+  InfThreadConnectionState state;
+  InfXmlConnectionStatistics statistics;
+};
+
+enum {
+  PROP_0,
+
+  PROP_IO,
+  PROP_CONNECTION_IO,
+  PROP_CONNECTION,
+
+  /* From InfXmlConnection */
+  PROP_STATUS,
+  PROP_NETWORK,
+  PROP_LOCAL_ID,
+  PROP_REMOTE_ID,
+  PROP_LOCAL_CERTIFICATE,
+  PROP_REMOTE_CERTIFICATE,
+  PROP_CONGESTED
+};
+
+/* Properties of the wrapped connection that are mirrored */
+static const gchar* const INF_THREAD_CONNECTION_MIRRORED_PROPERTIES[] = {
+  "notify::status",
+  "notify::network",
+  "notify::local-id",
+  "notify::remote-id",
+  "notify::local-certificate",
+  "notify::remote-certificate",
+  "notify::congested"
+};
+
+#define INF_THREAD_CONNECTION_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE((obj), INF_TYPE_THREAD_CONNECTION, InfThreadConnectionPrivate))
+
+static void inf_thread_connection_xml_connection_iface_init(InfXmlConnectionInterface* iface);
+G_DEFINE_TYPE_WITH_CODE(InfThreadConnection, inf_thread_connection, G_TYPE_OBJECT,
+  G_ADD_PRIVATE(InfThreadConnection)
+  G_IMPLEMENT_INTERFACE(INF_TYPE_XML_CONNECTION, inf_thread_connection_xml_connection_iface_init))
+
+static void
+inf_thread_connection_state_get(InfThreadConnectionState* state,
+                                InfXmlConnection* connection)
+{
+  g_object_get(
+    G_OBJECT(connection),
+    "status", &state->status,
+    "network", &state->network,
+    "local-id", &state->local_id,
+    "remote-id", &state->remote_id,
+    "local-certificate", &state->local_certificate,
+    "remote-certificate", &state->remote_certificate,
+    "congested", &state->congested,
+    NULL
+  );
+}
+
+static void
+inf_thread_connection_state_clear(InfThreadConnectionState* state)
+{
+  g_free(state->network);
+  g_free(state->local_id);
+  g_free(state->remote_id);
+
+  if(state->remote_certificate != NULL)
+    inf_certificate_chain_unref(state->remote_certificate);
+
+  state->network = NULL;
+  state->local_id = NULL;
+  state->remote_id = NULL;
+  state->remote_certificate = NULL;
+}
+
+/* Replaces *dest by *src if they differ, taking ownership of *src */
+static gboolean
+inf_thread_connection_take_string(gchar** dest,
+                                  gchar** src)
+{
+  if(g_strcmp0(*dest, *src) == 0)
+    return FALSE;
+
+  g_free(*dest);
+  *dest = *src;
+  *src = NULL;
+  return TRUE;
+}
+
+static void
+inf_thread_connection_apply_state(InfThreadConnection* connection,
+                                  InfThreadConnectionState* state)
+{
+  InfThreadConnectionPrivate* priv;
+  GObject* object;
+
+  priv = INF_THREAD_CONNECTION_PRIVATE(connection);
+  object = G_OBJECT(connection);
+
+  g_object_freeze_notify(object);
+
+  /* Once the connection is being closed from this side, ignore status
+   * changes that the wrapped connection went through before it was asked
+   * to close. */
+  if(state->status != priv->state.status &&
+     (priv->state.status != INF_XML_CONNECTION_CLOSING ||
+      state->status == INF_XML_CONNECTION_CLOSED))
+  {
+    priv->state.status = state->status;
+    g_object_notify(object, "status");
+  }
+
+  if(inf_thread_connection_take_string(&priv->state.network, &state->network))
+    g_object_notify(object, "network");
+
+  if(inf_thread_connection_take_string(&priv->state.local_id,
+                                       &state->local_id))
+  {
+    g_object_notify(object, "local-id");
+  }
+
+  if(inf_thread_connection_take_string(&priv->state.remote_id,
+                                       &state->remote_id))
+  {
+    g_object_notify(object, "remote-id");
+  }
+
+  if(state->local_certificate != priv->state.local_certificate)
+  {
+    priv->state.local_certificate = state->local_certificate;
+    g_object_notify(object, "local-certificate");
+  }
+
+  if(state->remote_certificate != priv->state.remote_certificate)
+  {
+    if(priv->state.remote_certificate != NULL)
+      inf_certificate_chain_unref(priv->state.remote_certificate);
+
+    priv->state.remote_certificate = state->remote_certificate;
+    state->remote_certificate = NULL;
+    g_object_notify(object, "remote-certificate");
+  }
+
+  if(state->congested != priv->state.congested)
+  {
+    priv->state.congested = state->congested;
+    g_object_notify(object, "congested");
+  }
+
+  g_object_thaw_notify(object);
+}
+
+/*
+ * Events, reported by the wrapped connection in its thread
+ */
+
+static InfThreadConnectionEvent*
+inf_thread_connection_event_new(InfThreadConnectionLink* link,
+                                InfThreadConnectionEventType type)
+{
+  InfThreadConnectionEvent* event;
+  InfThreadConnection* proxy;
+
+  /* Nobody is interested anymore if the InfThreadConnection is gone */
+  proxy = g_weak_ref_get(&link->proxy);
+  if(proxy == NULL)
+    return NULL;
+
+  event = g_slice_new0(InfThreadConnectionEvent);
+  event->proxy = proxy;
+  event->type = type;
+
+  inf_xml_connection_get_statistics(link->connection, &event->statistics);
+  return event;
+}
+
+static void
+inf_thread_connection_event_free(gpointer data)
+{
+  InfThreadConnectionEvent* event;
+  event = (InfThreadConnectionEvent*)data;
+
+  inf_thread_connection_state_clear(&event->state);
+  if(event->xml != NULL)
+    xmlFreeNode(event->xml);
+  if(event->error != NULL)
+    g_error_free(event->error);
+
+  g_object_unref(event->proxy);
+  g_slice_free(InfThreadConnectionEvent, event);
+}
+
+static void
+inf_thread_connection_event_func(gpointer user_data)
+{
+  InfThreadConnectionEvent* event;
+  InfThreadConnectionPrivate* priv;
+
+  event = (InfThreadConnectionEvent*)user_data;
+  priv = INF_THREAD_CONNECTION_PRIVATE(event->proxy);
+
+  priv->statistics = event->statistics;
+
+  switch(event->type)
+  {
+  case INF_THREAD_CONNECTION_EVENT_STATE:
+    inf_thread_connection_apply_state(event->proxy, &event->state);
+    break;
+  case INF_THREAD_CONNECTION_EVENT_SENT:
+    if(priv->state.status != INF_XML_CONNECTION_CLOSED)
+      inf_xml_connection_sent(INF_XML_CONNECTION(event->proxy), event->xml);
+    break;
+  case INF_THREAD_CONNECTION_EVENT_RECEIVED:
+    if(priv->state.status != INF_XML_CONNECTION_CLOSED)
+    {
+      inf_xml_connection_received(
+        INF_XML_CONNECTION(event->proxy),
+        event->xml
+      );
+    }
+
+    break;
+  case INF_THREAD_CONNECTION_EVENT_ERROR:
+    inf_xml_connection_error(INF_XML_CONNECTION(event->proxy), event->error);
+    break;
+  default:
+    g_assert_not_reached();
+    break;
+  }
+}
+
+static void
+inf_thread_connection_post(InfThreadConnectionLink* link,
+                           InfThreadConnectionEvent* event)
+{
+  inf_io_add_dispatch(
+    link->io,
+    inf_thread_connection_event_func,
+    event,
+    inf_thread_connection_event_free
+  );
+}
+
+static void
+inf_thread_connection_notify_cb(GObject* object,
+                                GParamSpec* pspec,
+                                gpointer user_data)
+{
+  InfThreadConnectionLink* link;
+  InfThreadConnectionEvent* event;
+
+  link = (InfThreadConnectionLink*)user_data;
+  event = inf_thread_connection_event_new(
+    link,
+    INF_THREAD_CONNECTION_EVENT_STATE
+  );
+
+  if(event != NULL)
+  {
+    inf_thread_connection_state_get(&event->state, link->connection);
+    inf_thread_connection_post(link, event);
+  }
+}
+
+static void
+inf_thread_connection_sent_cb(InfXmlConnection* connection,
+                              xmlNodePtr xml,
+                              gpointer user_data)
+{
+  InfThreadConnectionLink* link;
+  InfThreadConnectionEvent* event;
+
+  link = (InfThreadConnectionLink*)user_data;
+  event = inf_thread_connection_event_new(
+    link,
+    INF_THREAD_CONNECTION_EVENT_SENT
+  );
+
+  if(event != NULL)
+  {
+    event->xml = xmlCopyNode(xml, 1);
+    inf_thread_connection_post(link, event);
+  }
+}
+
+static void
+inf_thread_connection_received_cb(InfXmlConnection* connection,
+                                  xmlNodePtr xml,
+                                  gpointer user_data)
+{
+  InfThreadConnectionLink* link;
+  InfThreadConnectionEvent* event;
+
+  link = (InfThreadConnectionLink*)user_data;
+  event = inf_thread_connection_event_new(
+    link,
+    INF_THREAD_CONNECTION_EVENT_RECEIVED
+  );
+
+  if(event != NULL)
+  {
+    event->xml = xmlCopyNode(xml, 1);
+    inf_thread_connection_post(link, event);
+  }
+}
+
+static void
+inf_thread_connection_error_cb(InfXmlConnection* connection,
+                               const GError* error,
+                               gpointer user_data)
+{
+  InfThreadConnectionLink* link;
+  InfThreadConnectionEvent* event;
+
+  link = (InfThreadConnectionLink*)user_data;
+  event = inf_thread_connection_event_new(
+    link,
+    INF_THREAD_CONNECTION_EVENT_ERROR
+  );
+
+  if(event != NULL)
+  {
+    event->error = g_error_copy(error);
+    inf_thread_connection_post(link, event);
+  }
+}
+
+/*
+ * Requests, handled in the thread of the wrapped connection
+ */
+
+static void
+inf_thread_connection_send_func(gpointer user_data)
+{
+  InfThreadConnectionLink* link;
+  InfXmlConnectionStatus status;
+  GQueue outgoing;
+  xmlNodePtr xml;
+
+  link = (InfThreadConnectionLink*)user_data;
+
+  g_mutex_lock(&link->mutex);
+  outgoing = link->outgoing;
+  g_queue_init(&link->outgoing);
+  g_mutex_unlock(&link->mutex);
+
+  /* Send everything that has been queued in the meanwhile in one go */
+  inf_tcp_connection_begin_batch();
+
+  while((xml = g_queue_pop_head(&outgoing)) != NULL)
+  {
+    status = INF_XML_CONNECTION_CLOSED;
+    if(link->connection != NULL)
+      g_object_get(G_OBJECT(link->connection), "status", &status, NULL);
+
+    if(status == INF_XML_CONNECTION_OPEN)
+      inf_xml_connection_send(link->connection, xml);
+    else
+      xmlFreeNode(xml);
+  }
+
+  inf_tcp_connection_end_batch();
+}
+
+static void
+inf_thread_connection_close_func(gpointer user_data)
+{
+  InfThreadConnectionLink* link;
+  InfXmlConnectionStatus status;
+
+  link = (InfThreadConnectionLink*)user_data;
+  if(link->connection != NULL)
+  {
+    g_object_get(G_OBJECT(link->connection), "status", &status, NULL);
+    if(status == INF_XML_CONNECTION_OPEN ||
+       status == INF_XML_CONNECTION_OPENING)
+    {
+      inf_xml_connection_close(link->connection);
+    }
+  }
+}
+
+static void
+inf_thread_connection_release_func(gpointer user_data)
+{
+  InfThreadConnectionLink* link;
+  link = (InfThreadConnectionLink*)user_data;
+
+  g_assert(link->connection != NULL);
+
+  g_signal_handlers_disconnect_by_data(G_OBJECT(link->connection), link);
+
+  /* Messages that have been sent before the InfThreadConnection went away
+   * are still delivered before the connection is closed. */
+  inf_thread_connection_send_func(link);
+  inf_thread_connection_close_func(link);
+
+  g_object_unref(link->connection);
+  link->connection = NULL;
+}
+
+static void
+inf_thread_connection_link_free(gpointer data)
+{
+  InfThreadConnectionLink* link;
+  xmlNodePtr xml;
+
+  link = (InfThreadConnectionLink*)data;
+
+  /* If the release function did not run because the InfIo of the wrapped
+   * connection has been finalized, just drop the connection. */
+  if(link->connection != NULL)
+  {
+    g_signal_handlers_disconnect_by_data(G_OBJECT(link->connection), link);
+    g_object_unref(link->connection);
+  }
+
+  while((xml = g_queue_pop_head(&link->outgoing)) != NULL)
+    xmlFreeNode(xml);
+
+  g_mutex_clear(&link->mutex);
+  g_weak_ref_clear(&link->proxy);
+  g_object_unref(link->io);
+  g_slice_free(InfThreadConnectionLink, link);
+}
+
+/*
+ * GObject overrides
+ */
+
+static void
+inf_thread_connection_init(InfThreadConnection* connection)
+{
+  InfThreadConnectionPrivate* priv;
+  priv = INF_THREAD_CONNECTION_PRIVATE(connection);
+
+  priv->io = NULL;
+  priv->connection_io = NULL;
+  priv->connection = NULL;
+  priv->link = NULL;
+
+  memset(&priv->state, 0, sizeof(InfThreadConnectionState));
+  priv->state.status = INF_XML_CONNECTION_CLOSED;
+  memset(&priv->statistics, 0, sizeof(InfXmlConnectionStatistics));
+}
+
+static void
+inf_thread_connection_constructed(GObject* object)
+{
+  InfThreadConnection* connection;
+  InfThreadConnectionPrivate* priv;
+  InfThreadConnectionLink* link;
+  guint i;
+
+  connection = INF_THREAD_CONNECTION(object);
+  priv = INF_THREAD_CONNECTION_PRIVATE(connection);
+
+  G_OBJECT_CLASS(inf_thread_connection_parent_class)->constructed(object);
+
+  g_assert(priv->io != NULL);
+  g_assert(priv->connection_io != NULL);
+  g_assert(priv->connection != NULL);
+
+  link = g_slice_new(InfThreadConnectionLink);
+  link->connection = priv->connection;
+  g_weak_ref_init(&link->proxy, connection);
+  link->io = priv->io;
+  g_object_ref(link->io);
+  g_mutex_init(&link->mutex);
+  g_queue_init(&link->outgoing);
+
+  priv->connection = NULL;
+  priv->link = link;
+
+  inf_thread_connection_state_get(&priv->state, link->connection);
+  inf_xml_connection_get_statistics(link->connection, &priv->statistics);
+
+  for(i = 0; i < G_N_ELEMENTS(INF_THREAD_CONNECTION_MIRRORED_PROPERTIES); ++i)
+  {
+    g_signal_connect(
+      G_OBJECT(link->connection),
+      INF_THREAD_CONNECTION_MIRRORED_PROPERTIES[i],
+      G_CALLBACK(inf_thread_connection_notify_cb),
+      link
+    );
+  }
+
+  g_signal_connect(
+    G_OBJECT(link->connection),
+    "sent",
+    G_CALLBACK(inf_thread_connection_sent_cb),
+    link
+  );
+
+  g_signal_connect(
+    G_OBJECT(link->connection),
+    "received",
+    G_CALLBACK(inf_thread_connection_received_cb),
+    link
+  );
+
+  g_signal_connect(
+    G_OBJECT(link->connection),
+    "error",
+    G_CALLBACK(inf_thread_connection_error_cb),
+    link
+  );
+}
+
+static void
+inf_thread_connection_dispose(GObject* object)
+{
+  InfThreadConnection* connection;
+  InfThreadConnectionPrivate* priv;
+
+  connection = INF_THREAD_CONNECTION(object);
+  priv = INF_THREAD_CONNECTION_PRIVATE(connection);
+
+  /* The wrapped connection can only be touched in its own thread */
+  if(priv->link != NULL)
+  {
+    inf_io_add_dispatch(
+      priv->connection_io,
+      inf_thread_connection_release_func,
+      priv->link,
+      inf_thread_connection_link_free
+    );
+
+    priv->link = NULL;
+  }
+
+  if(priv->connection != NULL)
+  {
+    g_object_unref(priv->connection);
+    priv->connection = NULL;
+  }
+
+  if(priv->connection_io != NULL)
+  {
+    g_object_unref(priv->connection_io);
+    priv->connection_io = NULL;
+  }
+
+  if(priv->io != NULL)
+  {
+    g_object_unref(priv->io);
+    priv->io = NULL;
+  }
+
+  G_OBJECT_CLASS(inf_thread_connection_parent_class)->dispose(object);
+}
+
+static void
+inf_thread_connection_finalize(GObject* object)
+{
+  InfThreadConnection* connection;
+  InfThreadConnectionPrivate* priv;
+
+  connection = INF_THREAD_CONNECTION(object);
+  priv = INF_THREAD_CONNECTION_PRIVATE(connection);
+
+  inf_thread_connection_state_clear(&priv->state);
+
+  G_OBJECT_CLASS(inf_thread_connection_parent_class)->finalize(object);
+}
+
+static void
+inf_thread_connection_set_property(GObject* object,
+                                   guint prop_id,
+                                   const GValue* value,
+                                   GParamSpec* pspec)
+{
+  InfThreadConnection* connection;
+  InfThreadConnectionPrivate* priv;
+
+  connection = INF_THREAD_CONNECTION(object);
+  priv = INF_THREAD_CONNECTION_PRIVATE(connection);
+
+  switch(prop_id)
+  {
+  case PROP_IO:
+    g_assert(priv->io == NULL); /* construct only */
+    priv->io = INF_IO(g_value_dup_object(value));
+    break;
+  case PROP_CONNECTION_IO:
+    g_assert(priv->connection_io == NULL); /* construct only */
+    priv->connection_io = INF_IO(g_value_dup_object(value));
+    break;
+  case PROP_CONNECTION:
+    g_assert(priv->connection == NULL); /* construct only */
+    priv->connection = INF_XML_CONNECTION(g_value_dup_object(value));
+    break;
+  case PROP_STATUS:
+  case PROP_NETWORK:
+  case PROP_LOCAL_ID:
+  case PROP_REMOTE_ID:
+  case PROP_LOCAL_CERTIFICATE:
+  case PROP_REMOTE_CERTIFICATE:
+  case PROP_CONGESTED:
+    /* read only */
+  default:
+    G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+    break;
+  }
+}
+
+static void
+inf_thread_connection_get_property(GObject* object,
+                                   guint prop_id,
+                                   GValue* value,
+                                   GParamSpec* pspec)
+{
+  InfThreadConnection* connection;
+  InfThreadConnectionPrivate* priv;
+
+  connection = INF_THREAD_CONNECTION(object);
+  priv = INF_THREAD_CONNECTION_PRIVATE(connection);
+
+  switch(prop_id)
+  {
+  case PROP_IO:
+    g_value_set_object(value, priv->io);
+    break;
+  case PROP_CONNECTION_IO:
+    g_value_set_object(value, priv->connection_io);
+    break;
+  case PROP_STATUS:
+    g_value_set_enum(value, priv->state.status);
+    break;
+  case PROP_NETWORK:
+    g_value_set_string(value, priv->state.network);
+    break;
+  case PROP_LOCAL_ID:
+    g_value_set_string(value, priv->state.local_id);
+    break;
+  case PROP_REMOTE_ID:
+    g_value_set_string(value, priv->state.remote_id);
+    break;
+  case PROP_LOCAL_CERTIFICATE:
+    g_value_set_pointer(value, priv->state.local_certificate);
+    break;
+  case PROP_REMOTE_CERTIFICATE:
+    g_value_set_boxed(value, priv->state.remote_certificate);
+    break;
+  case PROP_CONGESTED:
+    g_value_set_boolean(value, priv->state.congested);
+    break;
+  case PROP_CONNECTION:
+    /* write only */
+  default:
+    G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+    break;
+  }
+}
+
+/*
+ * InfXmlConnection interface implementation
+ */
+
+static void
+inf_thread_connection_xml_connection_close(InfXmlConnection* connection)
+{
+  InfThreadConnectionPrivate* priv;
+  priv = INF_THREAD_CONNECTION_PRIVATE(connection);
+
+  g_assert(priv->link != NULL);
+
+  if(priv->state.status == INF_XML_CONNECTION_OPEN ||
+     priv->state.status == INF_XML_CONNECTION_OPENING)
+  {
+    /* The wrapped connection reports CLOSED once it is done */
+    priv->state.status = INF_XML_CONNECTION_CLOSING;
+    g_object_notify(G_OBJECT(connection), "status");
+
+    inf_io_add_dispatch(
+      priv->connection_io,
+      inf_thread_connection_close_func,
+      priv->link,
+      NULL
+    );
+  }
+}
+
+static void
+inf_thread_connection_xml_connection_send(InfXmlConnection* connection,
+                                          xmlNodePtr xml)
+{
+  InfThreadConnectionPrivate* priv;
+  InfThreadConnectionLink* link;
+
+  priv = INF_THREAD_CONNECTION_PRIVATE(connection);
+  link = priv->link;
+
+  g_assert(link != NULL);
+
+  /* Nothing is sent anymore once closing has been requested */
+  if(priv->state.status != INF_XML_CONNECTION_OPEN)
+  {
+    xmlFreeNode(xml);
+    return;
+  }
+
+  xmlUnlinkNode(xml);
+
+  g_mutex_lock(&link->mutex);
+
+  if(g_queue_is_empty(&link->outgoing))
+  {
+    inf_io_add_dispatch(
+      priv->connection_io,
+      inf_thread_connection_send_func,
+      link,
+      NULL
+    );
+  }
+
+  g_queue_push_tail(&link->outgoing, xml);
+  g_mutex_unlock(&link->mutex);
+}
+
+static void
+inf_thread_connection_xml_connection_get_statistics(
+  InfXmlConnection* connection,
+  InfXmlConnectionStatistics* statistics)
+{
+  InfThreadConnectionPrivate* priv;
+  priv = INF_THREAD_CONNECTION_PRIVATE(connection);
+
+  *statistics = priv->statistics;
+
+  /* Also count messages that have not yet reached the other thread */
+  if(priv->link != NULL)
+  {
+    g_mutex_lock(&priv->link->mutex);
+    statistics->send_queue_length += g_queue_get_length(&priv->link->outgoing);
+    g_mutex_unlock(&priv->link->mutex);
+  }
+}
+
+/*
+ * GObject type registration
+ */
+
+static void
+inf_thread_connection_class_init(InfThreadConnectionClass* connection_class)
+{
+  GObjectClass* object_class;
+  object_class = G_OBJECT_CLASS(connection_class);
+
+  object_class->constructed = inf_thread_connection_constructed;
+  object_class->dispose = inf_thread_connection_dispose;
+  object_class->finalize = inf_thread_connection_finalize;
+  object_class->set_property = inf_thread_connection_set_property;
+  object_class->get_property = inf_thread_connection_get_property;
+
+  g_object_class_install_property(
+    object_class,
+    PROP_IO,
+    g_param_spec_object(
+      "io",
+      "IO",
+      "The main loop of the thread in which the connection is used",
+      INF_TYPE_IO,
+      G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY
+    )
+  );
+
+  g_object_class_install_property(
+    object_class,
+    PROP_CONNECTION_IO,
+    g_param_spec_object(
+      "connection-io",
+      "Connection IO",
+      "The main loop of the thread in which the wrapped connection runs",
+      INF_TYPE_IO,
+      G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY
+    )
+  );
+
+  g_object_class_install_property(
+    object_class,
+    PROP_CONNECTION,
+    g_param_spec_object(
+      "connection",
+      "Connection",
+      "The wrapped connection",
+      INF_TYPE_XML_CONNECTION,
+      G_PARAM_WRITABLE | G_PARAM_CONSTRUCT_ONLY
+    )
+  );
+
+  g_object_class_override_property(object_class, PROP_STATUS, "status");
+  g_object_class_override_property(object_class, PROP_NETWORK, "network");
+  g_object_class_override_property(object_class, PROP_LOCAL_ID, "local-id");
+  g_object_class_override_property(object_class, PROP_REMOTE_ID, "remote-id");
+
+  g_object_class_override_property(
+    object_class,
+    PROP_LOCAL_CERTIFICATE,
+    "local-certificate"
+  );
+
+  g_object_class_override_property(
+    object_class,
+    PROP_REMOTE_CERTIFICATE,
+    "remote-certificate"
+  );
+
+  g_object_class_override_property(object_class, PROP_CONGESTED, "congested");
+}
+
+static void
+inf_thread_connection_xml_connection_iface_init(
+  InfXmlConnectionInterface* iface)
+{
+  iface->close = inf_thread_connection_xml_connection_close;
+  iface->send = inf_thread_connection_xml_connection_send;
+  iface->get_statistics = inf_thread_connection_xml_connection_get_statistics;
+}
+
+/*
+ * Public API
+ */
+
+/**
+ * inf_thread_connection_new: (constructor)
+ * @io: The #InfIo of the thread in which the new connection is used.
+ * @connection_io: The #InfIo of the thread in which @connection runs.
+ * @connection: The connection to wrap.
+ *
+ * Creates a new #InfThreadConnection which makes @connection available in
+ * the thread running @io. This function must be called in the thread
+ * running @connection_io, and @connection must not be used directly
+ * anymore afterwards, except in that thread. The new connection is
+ * afterwards only used in the thread running @io.
+ *
+ * @connection_io needs to keep running until the returned connection has
+ * been finalized, so that @connection can be released in its thread.
+ *
+ * Returns: (transfer full): A new #InfThreadConnection.
+ **/
+InfThreadConnection*
+inf_thread_connection_new(InfIo* io,
+                          InfIo* connection_io,
+                          InfXmlConnection* connection)
+{
+  GObject* object;
+
+  g_return_val_if_fail(INF_IS_IO(io), NULL);
+  g_return_val_if_fail(INF_IS_IO(connection_io), NULL);
+  g_return_val_if_fail(INF_IS_XML_CONNECTION(connection), NULL);
+
+  object = g_object_new(
+    INF_TYPE_THREAD_CONNECTION,
+    "io", io,
+    "connection-io", connection_io,
+    "connection", connection,
+    NULL
+  );
+
+  return INF_THREAD_CONNECTION(object);
+}
+
+/* vim:set et sw=2 ts=2: */
@@ -0,0 +1,73 @@
+/* libinfinity - a GObject-based infinote implementation
+ * Copyright (C) 2007-2015 Armin Burgmeier <armin@arbur.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef __INF_THREAD_CONNECTION_H__
+#define __INF_THREAD_CONNECTION_H__
+
+#include <libinfinity/common/inf-xml-connection.h>
+#include <libinfinity/common/inf-io.h>
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define INF_TYPE_THREAD_CONNECTION                 (inf_thread_connection_get_type())
+#define INF_THREAD_CONNECTION(obj)                 (G_TYPE_CHECK_INSTANCE_CAST((obj), INF_TYPE_THREAD_CONNECTION, InfThreadConnection))
+#define INF_THREAD_CONNECTION_CLASS(klass)         (G_TYPE_CHECK_CLASS_CAST((klass), INF_TYPE_THREAD_CONNECTION, InfThreadConnectionClass))
+#define INF_IS_THREAD_CONNECTION(obj)              (G_TYPE_CHECK_INSTANCE_TYPE((obj), INF_TYPE_THREAD_CONNECTION))
+#define INF_IS_THREAD_CONNECTION_CLASS(klass)      (G_TYPE_CHECK_CLASS_TYPE((klass), INF_TYPE_THREAD_CONNECTION))
+#define INF_THREAD_CONNECTION_GET_CLASS(obj)       (G_TYPE_INSTANCE_GET_CLASS((obj), INF_TYPE_THREAD_CONNECTION, InfThreadConnectionClass))
+
+typedef struct _InfThreadConnection InfThreadConnection;
+typedef struct _InfThreadConnectionClass InfThreadConnectionClass;
+
+/**
+ * InfThreadConnectionClass:
+ *
+ * This structure does not contain any public fields.
+ */
+struct _InfThreadConnectionClass {
+  /*< private >*/
+  GObjectClass parent_class;
+};
+
+/**
+ * InfThreadConnection:
+ *
+ * #InfThreadConnection is an opaque data type. You should only access it
+ * via the public API functions.
+ */
+struct _InfThreadConnection {
+  /*< private >*/
+  GObject parent;
+};
+
+GType
+inf_thread_connection_get_type(void) G_GNUC_CONST;
+
+InfThreadConnection*
+inf_thread_connection_new(InfIo* io,
+                          InfIo* connection_io,
+                          InfXmlConnection* connection);
+
+G_END_DECLS
+
+#endif /* __INF_THREAD_CONNECTION_H__ */
+
+/* vim:set et sw=2 ts=2: */
@@ -40,12 +40,19 @@
  * IDs must be unique and every host must see the same ID for the other hosts
  * in the network. This is no longer fulfilled by simple IP addresses, but for
  * example for JIDs when sending XML messages over a jabber server.
+ *
+ * Implementations should also provide the #InfXmlConnection:congested
+ * property, which is set to %TRUE while outgoing data cannot be transmitted
+ * as fast as it is being sent. Connections that never buffer outgoing data
+ * can simply always report %FALSE.
  */
 
 #include <libinfinity/common/inf-xml-connection.h>
 #include <libinfinity/common/inf-certificate-chain.h>
 #include <libinfinity/inf-define-enum.h>
 
+#include <string.h>
+
 static const GEnumValue inf_xml_connection_status_values[] = {
   {
     INF_XML_CONNECTION_CLOSED,
@@ -113,6 +120,10 @@ inf_xml_connection_default_init(InfXmlConnectionInterface* iface)
    *
    * Signal which is emitted when an XML node has been received by this
    * connection.
+   *
+   * @node is owned by @connection and only valid during the signal
+   * emission. It must not be modified or freed; use xmlCopyNode() to keep
+   * it, or a part of it, around.
    */
   connection_signals[RECEIVED] = g_signal_new(
     "received",
@@ -222,6 +233,21 @@ inf_xml_connection_default_init(InfXmlConnectionInterface* iface)
       G_PARAM_READABLE
     )
   );
+
+  /* A connection is congested if data is sent faster than the remote site
+   * reads it, so that it piles up locally. Users of the connection should
+   * refrain from sending non-essential data while this is set. */
+  g_object_interface_install_property(
+    iface,
+    g_param_spec_boolean(
+      "congested",
+      "Congested",
+      "Whether outgoing data is piling up because the remote site does "
+      "not read it fast enough",
+      FALSE,
+      G_PARAM_READABLE
+    )
+  );
 }
 
 /**
@@ -368,4 +394,30 @@ inf_xml_connection_error(InfXmlConnection* connection,
   );
 }
 
+/**
+ * inf_xml_connection_get_statistics:
+ * @connection: A #InfXmlConnection.
+ * @statistics: (out caller-allocates): Location to store the traffic
+ * counters of @connection.
+ *
+ * Fills @statistics with the number of bytes and messages that have been
+ * transmitted over @connection, and the amount of data waiting to be sent.
+ * Connections that do not collect statistics report all counters as 0.
+ **/
+void
+inf_xml_connection_get_statistics(InfXmlConnection* connection,
+                                  InfXmlConnectionStatistics* statistics)
+{
+  InfXmlConnectionInterface* iface;
+
+  g_return_if_fail(INF_IS_XML_CONNECTION(connection));
+  g_return_if_fail(statistics != NULL);
+
+  memset(statistics, 0, sizeof(InfXmlConnectionStatistics));
+
+  iface = INF_XML_CONNECTION_GET_IFACE(connection);
+  if(iface->get_statistics != NULL)
+    iface->get_statistics(connection, statistics);
+}
+
 /* vim:set et sw=2 ts=2: */
@@ -59,11 +59,34 @@ typedef enum _InfXmlConnectionStatus {
   INF_XML_CONNECTION_OPENING
 } InfXmlConnectionStatus;
 
+/**
+ * InfXmlConnectionStatistics:
+ * @bytes_sent: Number of bytes sent over the underlying transport.
+ * @bytes_received: Number of bytes received from the underlying transport.
+ * @messages_sent: Number of messages passed to inf_xml_connection_send().
+ * @messages_received: Number of messages received from the remote host.
+ * @send_queue_length: Number of bytes waiting in the underlying transport
+ * because they could not be sent yet.
+ *
+ * Traffic counters of an #InfXmlConnection, as returned by
+ * inf_xml_connection_get_statistics().
+ */
+typedef struct _InfXmlConnectionStatistics InfXmlConnectionStatistics;
+struct _InfXmlConnectionStatistics {
+  guint64 bytes_sent;
+  guint64 bytes_received;
+  guint64 messages_sent;
+  guint64 messages_received;
+  guint64 send_queue_length;
+};
+
 /**
  * InfXmlConnectionInterface:
  * @open: Virtual function to start the connection.
  * @close: Virtual function to stop the connection.
  * @send: Virtual function to transmit data over the connection.
+ * @get_statistics: Virtual function to fill in the traffic counters of the
+ * connection, or %NULL if the connection does not collect statistics.
  * @sent: Default signal handler of the #InfXmlConnection::sent signal.
  * @received: Default signal handler of the #InfXmlConnection::received
  * signal.
@@ -84,6 +107,8 @@ struct _InfXmlConnectionInterface {
   void (*close)(InfXmlConnection* connection);
   void (*send)(InfXmlConnection* connection,
                xmlNodePtr xml);
+  void (*get_statistics)(InfXmlConnection* connection,
+                         InfXmlConnectionStatistics* statistics);
 
   /* Signals */
   void (*sent)(InfXmlConnection* connection,
@@ -123,6 +148,10 @@ void
 inf_xml_connection_error(InfXmlConnection* connection,
                          const GError* error);
 
+void
+inf_xml_connection_get_statistics(InfXmlConnection* connection,
+                                  InfXmlConnectionStatistics* statistics);
+
 G_END_DECLS
 
 #endif /* __INF_XML_CONNECTION_H__ */
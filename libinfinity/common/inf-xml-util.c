@@ -956,4 +956,217 @@ inf_xml_util_new_error_from_node(xmlNodePtr xml)
   return result;
 }
 
+/* Characters that need to be escaped in text and in attribute values. A
+ * non-zero entry is the index of the replacement in
+ * inf_xml_util_escapes. */
+static const guint8 inf_xml_util_escape_text[256] = {
+  ['&'] = 1, ['<'] = 2, ['>'] = 3, ['\r'] = 5
+};
+
+static const guint8 inf_xml_util_escape_attribute[256] = {
+  ['&'] = 1, ['<'] = 2, ['>'] = 3, ['"'] = 4,
+  ['\r'] = 5, ['\n'] = 6, ['\t'] = 7
+};
+
+static const gchar* const inf_xml_util_escapes[] = {
+  NULL, "&amp;", "&lt;", "&gt;", "&quot;", "&#13;", "&#10;", "&#9;"
+};
+
+/* Returns the length of the initial part of data which does not need to be
+ * escaped. All characters that need escaping are below 0x40, so as long as
+ * no byte of a word is below that value, we can skip the whole word. */
+static gsize
+inf_xml_util_plain_length(const guchar* data,
+                          gsize len,
+                          const guint8* table)
+{
+  guint64 word;
+  gsize i;
+  gsize end;
+
+  i = 0;
+  while(i < len)
+  {
+    if(i + sizeof(word) <= len)
+    {
+      memcpy(&word, data + i, sizeof(word));
+      if(((word - G_GUINT64_CONSTANT(0x4040404040404040)) & ~word &
+          G_GUINT64_CONSTANT(0x8080808080808080)) == 0)
+      {
+        i += sizeof(word);
+        continue;
+      }
+    }
+
+    end = MIN(i + sizeof(word), len);
+    for(; i < end; ++i)
+      if(table[data[i]] != 0)
+        return i;
+  }
+
+  return len;
+}
+
+static void
+inf_xml_util_append_escaped(GString* str,
+                            const xmlChar* text,
+                            const guint8* table)
+{
+  gsize len;
+  gsize plain;
+
+  if(text == NULL)
+    return;
+
+  len = strlen((const gchar*)text);
+  while(len > 0)
+  {
+    plain = inf_xml_util_plain_length(text, len, table);
+    g_string_append_len(str, (const gchar*)text, plain);
+    if(plain == len)
+      break;
+
+    g_string_append(str, inf_xml_util_escapes[table[text[plain]]]);
+    text += plain + 1;
+    len -= plain + 1;
+  }
+}
+
+static void
+inf_xml_util_append_name(GString* str,
+                         xmlNsPtr ns,
+                         const xmlChar* name)
+{
+  if(ns != NULL && ns->prefix != NULL)
+  {
+    g_string_append(str, (const gchar*)ns->prefix);
+    g_string_append_c(str, ':');
+  }
+
+  g_string_append(str, (const gchar*)name);
+}
+
+/**
+ * inf_xml_util_serialize_node:
+ * @xml: A #xmlNodePtr.
+ * @str: A #GString to append the serialized node to.
+ *
+ * Appends the XML representation of @xml and all of its children to @str,
+ * without any formatting. The result is equivalent to what xmlNodeDump()
+ * produces, but it is generated much faster, since this function does not
+ * need to associate @xml with a document. Text is written as UTF-8, with
+ * only the characters escaped that are required to be escaped.
+ *
+ * Only element, text, CDATA, entity reference, comment and processing
+ * instruction nodes are serialized; other node types are ignored.
+ */
+void
+inf_xml_util_serialize_node(xmlNodePtr xml,
+                            GString* str)
+{
+  xmlNsPtr ns;
+  xmlAttrPtr attr;
+  xmlNodePtr child;
+
+  g_return_if_fail(xml != NULL);
+  g_return_if_fail(str != NULL);
+
+  switch(xml->type)
+  {
+  case XML_ELEMENT_NODE:
+    g_string_append_c(str, '<');
+    inf_xml_util_append_name(str, xml->ns, xml->name);
+
+    for(ns = xml->nsDef; ns != NULL; ns = ns->next)
+    {
+      g_string_append(str, " xmlns");
+      if(ns->prefix != NULL)
+      {
+        g_string_append_c(str, ':');
+        g_string_append(str, (const gchar*)ns->prefix);
+      }
+
+      g_string_append(str, "=\"");
+      inf_xml_util_append_escaped(str, ns->href, inf_xml_util_escape_attribute);
+      g_string_append_c(str, '"');
+    }
+
+    for(attr = xml->properties; attr != NULL; attr = attr->next)
+    {
+      g_string_append_c(str, ' ');
+      inf_xml_util_append_name(str, attr->ns, attr->name);
+      g_string_append(str, "=\"");
+
+      for(child = attr->children; child != NULL; child = child->next)
+      {
+        if(child->type == XML_TEXT_NODE)
+        {
+          inf_xml_util_append_escaped(
+            str,
+            child->content,
+            inf_xml_util_escape_attribute
+          );
+        }
+        else if(child->type == XML_ENTITY_REF_NODE)
+        {
+          g_string_append_c(str, '&');
+          g_string_append(str, (const gchar*)child->name);
+          g_string_append_c(str, ';');
+        }
+      }
+
+      g_string_append_c(str, '"');
+    }
+
+    if(xml->children == NULL)
+    {
+      g_string_append(str, "/>");
+    }
+    else
+    {
+      g_string_append_c(str, '>');
+      for(child = xml->children; child != NULL; child = child->next)
+        inf_xml_util_serialize_node(child, str);
+
+      g_string_append(str, "</");
+      inf_xml_util_append_name(str, xml->ns, xml->name);
+      g_string_append_c(str, '>');
+    }
+
+    break;
+  case XML_TEXT_NODE:
+    inf_xml_util_append_escaped(str, xml->content, inf_xml_util_escape_text);
+    break;
+  case XML_CDATA_SECTION_NODE:
+    g_string_append(str, "<![CDATA[");
+    if(xml->content != NULL)
+      g_string_append(str, (const gchar*)xml->content);
+    g_string_append(str, "]]>");
+    break;
+  case XML_ENTITY_REF_NODE:
+    g_string_append_c(str, '&');
+    g_string_append(str, (const gchar*)xml->name);
+    g_string_append_c(str, ';');
+    break;
+  case XML_COMMENT_NODE:
+    g_string_append(str, "<!--");
+    if(xml->content != NULL)
+      g_string_append(str, (const gchar*)xml->content);
+    g_string_append(str, "-->");
+    break;
+  case XML_PI_NODE:
+    g_string_append(str, "<?");
+    g_string_append(str, (const gchar*)xml->name);
+    if(xml->content != NULL)
+    {
+      g_string_append_c(str, ' ');
+      g_string_append(str, (const gchar*)xml->content);
+    }
+    g_string_append(str, "?>");
+    break;
+  default:
+    break;
+  }
+}
+
 /* vim:set et sw=2 ts=2: */
@@ -143,6 +143,10 @@ inf_xml_util_new_node_from_error(GError* error,
 GError*
 inf_xml_util_new_error_from_node(xmlNodePtr xml);
 
+void
+inf_xml_util_serialize_node(xmlNodePtr xml,
+                            GString* str);
+
 G_END_DECLS
 
 #endif /* __INF_XML_UTIL_H__ */
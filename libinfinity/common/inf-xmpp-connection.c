@@ -33,6 +33,18 @@
  * not need to adhere to the XMPP standard. It is in the responsibility of the
  * user of this class to send only XML message that the remote counterpart can
  * understand.
+ *
+ * If the #InfXmppConnection:compression property is set on both sides, the
+ * stream is compressed with zlib as described in XEP-0138. Compression is
+ * negotiated before authentication, and after TLS when TLS is used, so that
+ * outgoing data is compressed before it is encrypted. Every message is
+ * flushed individually, so compression does not delay any message.
+ *
+ * Once authentication has completed, two sites that both have the
+ * #InfXmppConnection:binary-encoding property set switch from XML to a
+ * compact binary encoding of the same messages. This is transparent to
+ * users of the connection, which keep sending and receiving #xmlNodePtr
+ * messages; it merely saves the cost of generating and parsing XML text.
  **/
 
 #include <libinfinity/common/inf-xmpp-connection.h>
@@ -46,6 +58,8 @@
 #include <libinfinity/inf-define-enum.h>
 
 #include <gnutls/x509.h>
+#include <libxml/parserInternals.h> /* xmlStringText */
+#include <zlib.h>
 
 #include <errno.h>
 #include <string.h>
@@ -118,6 +132,8 @@ typedef enum _InfXmppConnectionStatus {
   INF_XMPP_CONNECTION_AUTH_AWAITING_FEATURES,
   /* <starttls> request has been sent (client only) */
   INF_XMPP_CONNECTION_ENCRYPTION_REQUESTED,
+  /* <compress> request has been sent (client only) */
+  INF_XMPP_CONNECTION_COMPRESSION_REQUESTED,
   /* TLS handshake is being performed */
   INF_XMPP_CONNECTION_HANDSHAKING,
   /* SASL authentication is in progress */
@@ -152,6 +168,99 @@ struct _InfXmppConnectionMessage {
   gpointer user_data;
 };
 
+/* Incoming messages are built in an arena that is reset after each
+ * top-level message has been processed. New blocks are prepended, so the
+ * first block in the list is the one being allocated from. */
+typedef struct _InfXmppConnectionArenaBlock InfXmppConnectionArenaBlock;
+struct _InfXmppConnectionArenaBlock {
+  InfXmppConnectionArenaBlock* next;
+  gsize size;
+  gsize used;
+};
+
+/* A TLS handshake step running in a worker thread. While it runs, the
+ * worker owns the GnuTLS session; the main thread must not touch it. The
+ * step keeps a reference on the credentials the session uses, since the
+ * connection may release its own one while the step is still running. */
+typedef struct _InfXmppConnectionHandshake InfXmppConnectionHandshake;
+struct _InfXmppConnectionHandshake {
+  InfXmppConnection* xmpp;
+  InfIo* io; /* NULL if the handshake was cancelled */
+  InfIoDispatch* dispatch;
+
+  gnutls_session_t session;
+  InfCertificateCredentials* creds;
+  GByteArray* input;
+  guint input_pos;
+  GString* output;
+
+  int result;
+  gnutls_x509_crt_t own_cert;
+  InfCertificateChain* peer_cert;
+  GError* error;
+};
+
+/* Namespace of the binary encoding stream feature, and of the <binary/>
+ * element with which the switch to it is requested and acknowledged */
+#define INF_XMPP_CONNECTION_BINARY_NS \
+  "http://infinote.0x539.de/protocol/binary"
+
+/* Space reserved for the length prefix of an outgoing binary record, which
+ * is the maximum size of an encoded 64 bit number */
+#define INF_XMPP_CONNECTION_BINARY_HEADER_SIZE 10
+
+/* Element and attribute names are only sent once per direction and
+ * referred to by index afterwards, for up to this many names. Both sites
+ * must agree on this value. */
+#define INF_XMPP_CONNECTION_BINARY_MAX_NAMES 1024
+
+/* Maximum nesting depth of received binary messages */
+#define INF_XMPP_CONNECTION_BINARY_MAX_DEPTH 256
+
+/* Maximum size of a received binary record. Incomplete records are buffered
+ * until they are complete, so without a limit the remote site could make us
+ * allocate arbitrary amounts of memory by announcing a huge record. This is
+ * in the order of the limit libxml2 imposes on text nodes in the XML
+ * encoding. */
+#define INF_XMPP_CONNECTION_BINARY_MAX_RECORD_SIZE (8 * 1024 * 1024)
+
+/* In the binary encoding, every message is a record prefixed by its length
+ * as a base-128 varint; a record of length zero ends the stream, like
+ * </stream:stream> does in XML. A record consists of one element, which is
+ * encoded as its name, the number of attributes, each attribute as name and
+ * value, and then its children, each one starting with one of the kinds
+ * below. Names are either a varint index into the names sent before, or 0
+ * followed by the name as a string, which then gets the next index. Strings
+ * are a varint length followed by raw UTF-8. */
+typedef enum _InfXmppConnectionBinaryKind {
+  INF_XMPP_CONNECTION_BINARY_END = 0,
+  INF_XMPP_CONNECTION_BINARY_ELEMENT = 1,
+  INF_XMPP_CONNECTION_BINARY_TEXT = 2
+} InfXmppConnectionBinaryKind;
+
+/* Attribute values that are numbers or state vectors, as produced by
+ * inf_adopted_state_vector_to_string(), are sent as varints instead of
+ * strings. They are written back exactly as they were when received. */
+typedef enum _InfXmppConnectionBinaryValue {
+  INF_XMPP_CONNECTION_BINARY_VALUE_STRING = 0,
+  INF_XMPP_CONNECTION_BINARY_VALUE_NUMBER = 1,
+  INF_XMPP_CONNECTION_BINARY_VALUE_VECTOR = 2
+} InfXmppConnectionBinaryValue;
+
+/* Size of the buffers that data is deflated into before sending, and inflated
+ * into before parsing */
+#define INF_XMPP_CONNECTION_COMPRESSION_BUFFER_SIZE (16 * 1024)
+
+/* State of the zlib stream compression. Both directions are compressed from
+ * the same point in the stream on. */
+typedef struct _InfXmppConnectionCompression InfXmppConnectionCompression;
+struct _InfXmppConnectionCompression {
+  z_stream deflate;
+  z_stream inflate;
+  Bytef deflate_buffer[INF_XMPP_CONNECTION_COMPRESSION_BUFFER_SIZE];
+  Bytef inflate_buffer[INF_XMPP_CONNECTION_COMPRESSION_BUFFER_SIZE];
+};
+
 typedef struct _InfXmppConnectionPrivate InfXmppConnectionPrivate;
 struct _InfXmppConnectionPrivate {
   InfTcpConnection* tcp;
@@ -171,16 +280,22 @@ struct _InfXmppConnectionPrivate {
   guint position;
 
   /* Message queue */
-  xmlDocPtr doc;
-  xmlBufferPtr buf;
+  GString* buf;
   InfXmppConnectionMessage* messages;
   InfXmppConnectionMessage* last_message;
 
+  /* Statistics */
+  guint64 messages_sent;
+  guint64 messages_received;
+
   /* XML parsing */
   guint parsing; /* Whether we are currently in an XML parser or GnuTLS callback */
   xmlParserCtxtPtr parser;
   xmlNodePtr root;
   xmlNodePtr cur;
+  InfXmppConnectionArenaBlock* arena;
+  xmlDictPtr names;
+  GString* text;
 
   /* Transport layer security */
   gnutls_session_t session;
@@ -189,6 +304,37 @@ struct _InfXmppConnectionPrivate {
   InfCertificateChain* peer_cert;
   const gchar* pull_data;
   gsize pull_len;
+  gchar* record_buffer;
+  gsize record_buffer_size;
+  InfXmppConnectionHandshake* handshake;
+  GByteArray* handshake_input;
+  /* Parameters of the last established session, to resume it from when
+   * reconnecting. Only used on the client side. */
+  GBytes* session_data;
+  gboolean session_resumed;
+
+  /* Stream compression */
+  gboolean compression_enabled;
+  InfXmppConnectionCompression* compression;
+  /* Set when the stream needs to be reinitiated after compression has been
+   * negotiated, which cannot be done from within the XML parser. */
+  gboolean restart_stream;
+  guint64 compression_raw_sent;
+  guint64 compression_compressed_sent;
+  guint64 compression_raw_received;
+  guint64 compression_compressed_received;
+
+  /* Binary encoding */
+  gboolean binary_enabled;
+  gboolean binary_in;
+  gboolean binary_out;
+  /* Number of bytes fed into the XML parser, and the position at which the
+   * remote site switched to the binary encoding */
+  goffset parser_fed;
+  goffset binary_offset;
+  GHashTable* binary_out_names;
+  GPtrArray* binary_in_names;
+  GByteArray* binary_input;
 
   /* SASL */
   InfSaslContext* sasl_context;
@@ -211,6 +357,8 @@ enum {
 
   PROP_TLS_ENABLED,
   PROP_CREDENTIALS,
+  PROP_COMPRESSION,
+  PROP_BINARY_ENCODING,
 
   PROP_SASL_CONTEXT,
   PROP_SASL_MECHANISMS,
@@ -221,11 +369,35 @@ enum {
   PROP_LOCAL_ID,
   PROP_REMOTE_ID,
   PROP_LOCAL_CERTIFICATE,
-  PROP_REMOTE_CERTIFICATE
+  PROP_REMOTE_CERTIFICATE,
+  PROP_CONGESTED
 };
 
+/* Initial size of the buffer that outgoing messages are serialized into,
+ * and the size above which it is released again after a message was sent */
+#define INF_XMPP_CONNECTION_SEND_BUFFER_SIZE 4096
+#define INF_XMPP_CONNECTION_MAX_SEND_BUFFER_SIZE (256 * 1024)
+
+/* Size of the blocks of the arena for incoming messages. One block is kept
+ * around between messages; larger messages allocate more blocks which are
+ * freed again once the message has been processed. */
+#define INF_XMPP_CONNECTION_ARENA_BLOCK_SIZE (16 * 1024)
+#define INF_XMPP_CONNECTION_ARENA_HEADER_SIZE \
+  ((sizeof(InfXmppConnectionArenaBlock) + 15) & ~(gsize)15)
+
+/* Element and attribute names are interned, so that they do not need to be
+ * copied for every message. Since the remote side controls these names, we
+ * stop interning at some point and copy them into the arena instead. */
+#define INF_XMPP_CONNECTION_MAX_INTERNED_NAMES 1024
+
 #define INF_XMPP_CONNECTION_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE((obj), INF_TYPE_XMPP_CONNECTION, InfXmppConnectionPrivate))
 
+/* TLS handshakes of all connections run in one shared pool of worker
+ * threads, so that the key exchange does not block the main loop. The
+ * mutex protects the io and dispatch fields of running handshakes. */
+static GThreadPool* inf_xmpp_connection_handshake_pool;
+static GMutex inf_xmpp_connection_handshake_mutex;
+
 static GQuark inf_xmpp_connection_stream_error_quark;
 static GQuark inf_xmpp_connection_auth_error_quark;
 
@@ -549,6 +721,226 @@ inf_xmpp_connection_auth_strerror(InfXmppConnectionAuthError code)
   }
 }
 
+/*
+ * Incoming XML
+ */
+
+static gpointer
+inf_xmpp_connection_arena_alloc(InfXmppConnection* xmpp,
+                                gsize size)
+{
+  InfXmppConnectionPrivate* priv;
+  InfXmppConnectionArenaBlock* block;
+  gsize block_size;
+  gpointer result;
+
+  priv = INF_XMPP_CONNECTION_PRIVATE(xmpp);
+  size = (size + 15) & ~(gsize)15;
+
+  block = priv->arena;
+  if(block == NULL || block->used + size > block->size)
+  {
+    block_size = MAX(size, INF_XMPP_CONNECTION_ARENA_BLOCK_SIZE);
+    block = g_malloc(INF_XMPP_CONNECTION_ARENA_HEADER_SIZE + block_size);
+    block->next = priv->arena;
+    block->size = block_size;
+    block->used = 0;
+    priv->arena = block;
+  }
+
+  result = (guint8*)block + INF_XMPP_CONNECTION_ARENA_HEADER_SIZE +
+    block->used;
+  block->used += size;
+  return result;
+}
+
+/* Releases all incoming XML at once, keeping one block for the next
+ * message. */
+static void
+inf_xmpp_connection_arena_reset(InfXmppConnection* xmpp,
+                                gboolean keep_block)
+{
+  InfXmppConnectionPrivate* priv;
+  InfXmppConnectionArenaBlock* block;
+  InfXmppConnectionArenaBlock* next;
+  InfXmppConnectionArenaBlock* keep;
+
+  priv = INF_XMPP_CONNECTION_PRIVATE(xmpp);
+  keep = NULL;
+
+  for(block = priv->arena; block != NULL; block = next)
+  {
+    next = block->next;
+    if(keep_block && keep == NULL &&
+       block->size == INF_XMPP_CONNECTION_ARENA_BLOCK_SIZE)
+    {
+      keep = block;
+      keep->next = NULL;
+      keep->used = 0;
+    }
+    else
+    {
+      g_free(block);
+    }
+  }
+
+  priv->arena = keep;
+  priv->root = NULL;
+  priv->cur = NULL;
+
+  if(priv->text != NULL)
+    g_string_truncate(priv->text, 0);
+}
+
+static xmlChar*
+inf_xmpp_connection_arena_strndup(InfXmppConnection* xmpp,
+                                  const xmlChar* str,
+                                  gsize len)
+{
+  xmlChar* result;
+
+  result = inf_xmpp_connection_arena_alloc(xmpp, len + 1);
+  memcpy(result, str, len);
+  result[len] = '\0';
+  return result;
+}
+
+static const xmlChar*
+inf_xmpp_connection_intern(InfXmppConnection* xmpp,
+                           const xmlChar* name)
+{
+  InfXmppConnectionPrivate* priv;
+  const xmlChar* result;
+
+  priv = INF_XMPP_CONNECTION_PRIVATE(xmpp);
+
+  if(xmlDictSize(priv->names) < INF_XMPP_CONNECTION_MAX_INTERNED_NAMES)
+  {
+    result = xmlDictLookup(priv->names, name, -1);
+    if(result != NULL)
+      return result;
+  }
+
+  return inf_xmpp_connection_arena_strndup(
+    xmpp,
+    name,
+    strlen((const gchar*)name)
+  );
+}
+
+/* The nodes are filled in the same way as xmlNewNode() and xmlNewProp()
+ * would do, but they live in the arena. They must therefore never be freed
+ * or modified with libxml2 functions. */
+static xmlNodePtr
+inf_xmpp_connection_arena_node(InfXmppConnection* xmpp,
+                               xmlElementType type,
+                               const xmlChar* name)
+{
+  xmlNodePtr node;
+
+  node = inf_xmpp_connection_arena_alloc(xmpp, sizeof(xmlNode));
+  memset(node, 0, sizeof(xmlNode));
+  node->type = type;
+  node->name = name;
+  return node;
+}
+
+static void
+inf_xmpp_connection_arena_append(xmlNodePtr parent,
+                                 xmlNodePtr child)
+{
+  child->parent = parent;
+  child->prev = parent->last;
+
+  if(parent->last != NULL)
+    parent->last->next = child;
+  else
+    parent->children = child;
+
+  parent->last = child;
+}
+
+static xmlNodePtr
+inf_xmpp_connection_arena_text(InfXmppConnection* xmpp,
+                               const xmlChar* content,
+                               gsize len)
+{
+  xmlNodePtr text;
+
+  text = inf_xmpp_connection_arena_node(xmpp, XML_TEXT_NODE, xmlStringText);
+  text->content = inf_xmpp_connection_arena_strndup(xmpp, content, len);
+  return text;
+}
+
+static xmlAttrPtr
+inf_xmpp_connection_arena_prop(InfXmppConnection* xmpp,
+                               xmlNodePtr node,
+                               xmlAttrPtr last_prop,
+                               const xmlChar* name,
+                               const xmlChar* value,
+                               gsize value_len)
+{
+  xmlAttrPtr prop;
+  xmlNodePtr text;
+
+  prop = inf_xmpp_connection_arena_alloc(xmpp, sizeof(xmlAttr));
+  memset(prop, 0, sizeof(xmlAttr));
+  prop->type = XML_ATTRIBUTE_NODE;
+  prop->name = name;
+  prop->parent = node;
+
+  if(value != NULL)
+  {
+    text = inf_xmpp_connection_arena_text(xmpp, value, value_len);
+    text->parent = (xmlNodePtr)prop;
+    prop->children = text;
+    prop->last = text;
+  }
+
+  prop->prev = last_prop;
+  if(last_prop != NULL)
+    last_prop->next = prop;
+  else
+    node->properties = prop;
+
+  return prop;
+}
+
+/* Character data can be reported in several pieces by the parser, so it is
+ * collected and added as a single text node once the next element starts
+ * or the current one ends. */
+static void
+inf_xmpp_connection_flush_text(InfXmppConnection* xmpp)
+{
+  InfXmppConnectionPrivate* priv;
+  xmlNodePtr text;
+
+  priv = INF_XMPP_CONNECTION_PRIVATE(xmpp);
+
+  if(priv->text->len > 0)
+  {
+    g_assert(priv->cur != NULL);
+
+    text = inf_xmpp_connection_arena_text(
+      xmpp,
+      (const xmlChar*)priv->text->str,
+      priv->text->len
+    );
+
+    inf_xmpp_connection_arena_append(priv->cur, text);
+
+    if(priv->text->allocated_len > INF_XMPP_CONNECTION_MAX_SEND_BUFFER_SIZE)
+    {
+      g_string_free(priv->text, TRUE);
+      priv->text = g_string_sized_new(INF_XMPP_CONNECTION_SEND_BUFFER_SIZE);
+    }
+    else
+    {
+      g_string_truncate(priv->text, 0);
+    }
+  }
+}
+
 /*
  * Message queue
  */
@@ -610,6 +1002,64 @@ inf_xmpp_connection_pop_message(InfXmppConnection* connection)
   g_slice_free(InfXmppConnectionMessage, message);
 }
 
+static InfXmppConnectionCompression*
+inf_xmpp_connection_compression_new(void)
+{
+  InfXmppConnectionCompression* compression;
+  compression = g_slice_new(InfXmppConnectionCompression);
+
+  compression->deflate.zalloc = Z_NULL;
+  compression->deflate.zfree = Z_NULL;
+  compression->deflate.opaque = Z_NULL;
+  if(deflateInit(&compression->deflate, Z_DEFAULT_COMPRESSION) != Z_OK)
+  {
+    g_slice_free(InfXmppConnectionCompression, compression);
+    return NULL;
+  }
+
+  compression->inflate.zalloc = Z_NULL;
+  compression->inflate.zfree = Z_NULL;
+  compression->inflate.opaque = Z_NULL;
+  compression->inflate.next_in = Z_NULL;
+  compression->inflate.avail_in = 0;
+  if(inflateInit(&compression->inflate) != Z_OK)
+  {
+    deflateEnd(&compression->deflate);
+    g_slice_free(InfXmppConnectionCompression, compression);
+    return NULL;
+  }
+
+  return compression;
+}
+
+static void
+inf_xmpp_connection_compression_free(InfXmppConnectionCompression* compr)
+{
+  deflateEnd(&compr->deflate);
+  inflateEnd(&compr->inflate);
+  g_slice_free(InfXmppConnectionCompression, compr);
+}
+
+/* Starts compressing the stream in both directions */
+static void
+inf_xmpp_connection_compression_start(InfXmppConnection* xmpp,
+                                      InfXmppConnectionCompression* compr)
+{
+  InfXmppConnectionPrivate* priv;
+  priv = INF_XMPP_CONNECTION_PRIVATE(xmpp);
+
+  g_assert(priv->compression == NULL);
+  priv->compression = compr;
+
+  priv->compression_raw_sent = 0;
+  priv->compression_compressed_sent = 0;
+  priv->compression_raw_received = 0;
+  priv->compression_compressed_received = 0;
+}
+
+static void
+inf_xmpp_connection_tls_handshake_cancel(InfXmppConnection* xmpp);
+
 /* Note that this function does not change the state of xmpp, so it might
  * rest in a state where it expects to actually have the resources available
  * that are cleared here. Be sure to adjust state after having called
@@ -655,10 +1105,19 @@ inf_xmpp_connection_clear(InfXmppConnection* xmpp)
   }
 #endif
 
+  inf_xmpp_connection_tls_handshake_cancel(xmpp);
+
+  if(priv->handshake_input != NULL)
+  {
+    g_byte_array_free(priv->handshake_input, TRUE);
+    priv->handshake_input = NULL;
+  }
+
   if(priv->session != NULL)
   {
     gnutls_deinit(priv->session);
     priv->session = NULL;
+    priv->session_resumed = FALSE;
 
     g_object_notify(G_OBJECT(xmpp), "tls-enabled");
   }
@@ -669,11 +1128,7 @@ inf_xmpp_connection_clear(InfXmppConnection* xmpp)
     priv->parser = NULL;
 
     if(priv->root != NULL)
-    {
-      xmlFreeNode(priv->root);
-      priv->root = NULL;
-      priv->cur = NULL;
-    }
+      inf_xmpp_connection_arena_reset(xmpp, TRUE);
   }
 
   while(priv->messages != NULL)
@@ -681,25 +1136,56 @@ inf_xmpp_connection_clear(InfXmppConnection* xmpp)
 
   if(priv->buf != NULL)
   {
-    g_assert(priv->doc != NULL);
-
-    xmlBufferFree(priv->buf);
-    xmlFreeDoc(priv->doc);
-
+    g_string_free(priv->buf, TRUE);
     priv->buf = NULL;
-    priv->doc = NULL;
   }
 
   priv->pull_data = NULL;
   priv->pull_len = 0;
 
+  g_free(priv->record_buffer);
+  priv->record_buffer = NULL;
+  priv->record_buffer_size = 0;
+
+  if(priv->compression != NULL)
+  {
+    inf_xmpp_connection_compression_free(priv->compression);
+    priv->compression = NULL;
+  }
+
+  priv->restart_stream = FALSE;
+
+  priv->binary_in = FALSE;
+  priv->binary_out = FALSE;
+  priv->parser_fed = 0;
+  priv->binary_offset = 0;
+
+  if(priv->binary_out_names != NULL)
+  {
+    g_hash_table_destroy(priv->binary_out_names);
+    priv->binary_out_names = NULL;
+  }
+
+  if(priv->binary_in_names != NULL)
+  {
+    g_ptr_array_free(priv->binary_in_names, TRUE);
+    priv->binary_in_names = NULL;
+  }
+
+  if(priv->binary_input != NULL)
+  {
+    g_byte_array_free(priv->binary_input, TRUE);
+    priv->binary_input = NULL;
+  }
+
   g_object_thaw_notify(G_OBJECT(xmpp));
 }
 
+/* Passes data on to TLS, or directly to the TCP connection */
 static void
-inf_xmpp_connection_send_chars(InfXmppConnection* xmpp,
-                               gconstpointer data,
-                               guint len)
+inf_xmpp_connection_send_transport(InfXmppConnection* xmpp,
+                                   gconstpointer data,
+                                   guint len)
 {
   InfXmppConnectionPrivate* priv;
   ssize_t cur_bytes;
@@ -707,18 +1193,6 @@ inf_xmpp_connection_send_chars(InfXmppConnection* xmpp,
 
   priv = INF_XMPP_CONNECTION_PRIVATE(xmpp);
 
-  g_assert(priv->status != INF_XMPP_CONNECTION_HANDSHAKING &&
-           priv->status != INF_XMPP_CONNECTION_CLOSED);
-
-  if(INF_XMPP_CONNECTION_PRINT_TRAFFIC)
-    printf("\033[00;34m%.*s\033[00;00m\n", (int)len, (const char*)data);
-
-  /* From here on we go into a GnuTLS callback. Set this flag to prevent
-   * premature cleanup -- make sure that if the connection is being brought
-   * down from a GnuTLS callback then we keep the GnuTLS context around
-   * until the gntuls_record_send() call finishes. */
-  ++priv->parsing;
-
   if(priv->session != NULL)
   {
     do
@@ -757,6 +1231,80 @@ inf_xmpp_connection_send_chars(InfXmppConnection* xmpp,
     priv->position += len;
     inf_tcp_connection_send(priv->tcp, data, len);
   }
+}
+
+/* Compresses data and sends it. The data is flushed, so that the remote
+ * site can process it without waiting for more data. */
+static void
+inf_xmpp_connection_send_compressed(InfXmppConnection* xmpp,
+                                    gconstpointer data,
+                                    guint len)
+{
+  InfXmppConnectionPrivate* priv;
+  InfXmppConnectionCompression* compression;
+  guint produced;
+  int res;
+
+  priv = INF_XMPP_CONNECTION_PRIVATE(xmpp);
+  compression = priv->compression;
+
+  compression->deflate.next_in = (Bytef*)data;
+  compression->deflate.avail_in = len;
+  priv->compression_raw_sent += len;
+
+  do
+  {
+    compression->deflate.next_out = compression->deflate_buffer;
+    compression->deflate.avail_out = sizeof(compression->deflate_buffer);
+
+    /* This can only fail with Z_BUF_ERROR if there is nothing left to
+     * flush, which is harmless. */
+    res = deflate(&compression->deflate, Z_SYNC_FLUSH);
+    g_assert(res == Z_OK || res == Z_BUF_ERROR);
+
+    produced =
+      sizeof(compression->deflate_buffer) - compression->deflate.avail_out;
+
+    if(produced > 0)
+    {
+      priv->compression_compressed_sent += produced;
+      inf_xmpp_connection_send_transport(
+        xmpp,
+        compression->deflate_buffer,
+        produced
+      );
+
+      /* Sending can make the connection go down */
+      if(priv->status == INF_XMPP_CONNECTION_CLOSED)
+        break;
+    }
+  } while(compression->deflate.avail_out == 0);
+}
+
+static void
+inf_xmpp_connection_send_chars(InfXmppConnection* xmpp,
+                               gconstpointer data,
+                               guint len)
+{
+  InfXmppConnectionPrivate* priv;
+  priv = INF_XMPP_CONNECTION_PRIVATE(xmpp);
+
+  g_assert(priv->status != INF_XMPP_CONNECTION_HANDSHAKING &&
+           priv->status != INF_XMPP_CONNECTION_CLOSED);
+
+  if(INF_XMPP_CONNECTION_PRINT_TRAFFIC)
+    printf("\033[00;34m%.*s\033[00;00m\n", (int)len, (const char*)data);
+
+  /* From here on we go into a GnuTLS callback. Set this flag to prevent
+   * premature cleanup -- make sure that if the connection is being brought
+   * down from a GnuTLS callback then we keep the GnuTLS context around
+   * until the gntuls_record_send() call finishes. */
+  ++priv->parsing;
+
+  if(priv->compression != NULL)
+    inf_xmpp_connection_send_compressed(xmpp, data, len);
+  else
+    inf_xmpp_connection_send_transport(xmpp, data, len);
 
   g_assert(priv->parsing > 0);
   if(--priv->parsing == 0)
@@ -773,41 +1321,452 @@ inf_xmpp_connection_send_chars(InfXmppConnection* xmpp,
   }
 }
 
-static void
-inf_xmpp_connection_send_xml(InfXmppConnection* xmpp,
-                             xmlNodePtr xml)
-{
-  InfXmppConnectionPrivate* priv;
-  priv = INF_XMPP_CONNECTION_PRIVATE(xmpp);
+/*
+ * Binary encoding of outgoing messages
+ */
 
-  g_return_if_fail(priv->doc != NULL);
-  g_return_if_fail(priv->buf != NULL);
+static guint
+inf_xmpp_connection_binary_uint_to_bytes(guint64 value,
+                                         guint8* bytes)
+{
+  guint len;
 
-  xmlDocSetRootElement(priv->doc, xml);
-  xmlNodeDump(priv->buf, priv->doc, xml, 0, 0);
-  xmlUnlinkNode(xml);
-  xmlSetListDoc(xml, NULL);
+  len = 0;
+  while(value >= 0x80)
+  {
+    bytes[len++] = (guint8)(value & 0x7f) | 0x80;
+    value >>= 7;
+  }
 
-  /* Keep the object alive during the send_chars call, so that we can check
-   * the buffer variable afterwards. */
-  g_object_ref(xmpp);
+  bytes[len++] = (guint8)value;
+  return len;
+}
 
-  inf_xmpp_connection_send_chars(
-    xmpp,
-    xmlBufferContent(priv->buf),
-    xmlBufferLength(priv->buf)
-  );
+static void
+inf_xmpp_connection_binary_write_uint(GString* str,
+                                      guint64 value)
+{
+  guint8 bytes[INF_XMPP_CONNECTION_BINARY_HEADER_SIZE];
+  guint len;
 
-  /* The connection might be closed & cleared as a result from
-   * inf_xmpp_connection_send_chars(), so make sure the buffer still
-   * exists before emptying it. */
-  if(priv->buf != NULL)
-    xmlBufferEmpty(priv->buf);
+  len = inf_xmpp_connection_binary_uint_to_bytes(value, bytes);
+  g_string_append_len(str, (const gchar*)bytes, len);
+}
 
-  g_object_unref(xmpp);
+static void
+inf_xmpp_connection_binary_write_string(GString* str,
+                                        const gchar* value,
+                                        gsize len)
+{
+  inf_xmpp_connection_binary_write_uint(str, len);
+  g_string_append_len(str, value, len);
 }
 
-/*
+static void
+inf_xmpp_connection_binary_write_name(InfXmppConnection* xmpp,
+                                      GString* str,
+                                      const xmlChar* prefix,
+                                      const xmlChar* name)
+{
+  InfXmppConnectionPrivate* priv;
+  gchar* full_name;
+  guint index;
+
+  priv = INF_XMPP_CONNECTION_PRIVATE(xmpp);
+
+  if(prefix != NULL)
+    full_name = g_strconcat((const gchar*)prefix, ":", name, NULL);
+  else
+    full_name = (gchar*)name;
+
+  index = GPOINTER_TO_UINT(
+    g_hash_table_lookup(priv->binary_out_names, full_name)
+  );
+
+  if(index > 0)
+  {
+    inf_xmpp_connection_binary_write_uint(str, index);
+  }
+  else
+  {
+    inf_xmpp_connection_binary_write_uint(str, 0);
+    inf_xmpp_connection_binary_write_string(
+      str,
+      full_name,
+      strlen(full_name)
+    );
+
+    index = g_hash_table_size(priv->binary_out_names);
+    if(index < INF_XMPP_CONNECTION_BINARY_MAX_NAMES)
+    {
+      g_hash_table_insert(
+        priv->binary_out_names,
+        g_strdup(full_name),
+        GUINT_TO_POINTER(index + 1)
+      );
+    }
+  }
+
+  if(prefix != NULL)
+    g_free(full_name);
+}
+
+/* Parses a decimal number that can be written back exactly as it is, i.e.
+ * one without leading zeros that fits into 64 bit. */
+static gboolean
+inf_xmpp_connection_binary_parse_uint(const gchar* str,
+                                      gsize len,
+                                      guint64* value)
+{
+  guint64 result;
+  gsize i;
+
+  if(len == 0 || len > 19 || (str[0] == '0' && len > 1))
+    return FALSE;
+
+  result = 0;
+  for(i = 0; i < len; ++i)
+  {
+    if(str[i] < '0' || str[i] > '9')
+      return FALSE;
+    result = result * 10 + (str[i] - '0');
+  }
+
+  *value = result;
+  return TRUE;
+}
+
+/* Parses the id:n component of a state vector that ends at or before end,
+ * and returns the position after it, or NULL if there is no such
+ * component at str. */
+static const gchar*
+inf_xmpp_connection_binary_parse_component(const gchar* str,
+                                           const gchar* end,
+                                           guint64* id,
+                                           guint64* n)
+{
+  const gchar* sep;
+  const gchar* colon;
+
+  sep = memchr(str, ';', end - str);
+  if(sep == NULL) sep = end;
+
+  colon = memchr(str, ':', sep - str);
+  if(colon == NULL)
+    return NULL;
+
+  if(!inf_xmpp_connection_binary_parse_uint(str, colon - str, id))
+    return NULL;
+  if(!inf_xmpp_connection_binary_parse_uint(colon + 1, sep - colon - 1, n))
+    return NULL;
+
+  return sep;
+}
+
+static void
+inf_xmpp_connection_binary_write_value(GString* str,
+                                       const gchar* value,
+                                       gsize len)
+{
+  const gchar* end;
+  const gchar* pos;
+  guint64 id;
+  guint64 n;
+  guint count;
+
+  if(inf_xmpp_connection_binary_parse_uint(value, len, &n))
+  {
+    g_string_append_c(str, INF_XMPP_CONNECTION_BINARY_VALUE_NUMBER);
+    inf_xmpp_connection_binary_write_uint(str, n);
+    return;
+  }
+
+  /* Check whether this is a state vector, and count its components */
+  end = value + len;
+  pos = value;
+  count = 0;
+
+  while(len > 0)
+  {
+    pos = inf_xmpp_connection_binary_parse_component(pos, end, &id, &n);
+    if(pos == NULL)
+      break;
+
+    ++count;
+    if(pos == end)
+      break;
+
+    ++pos; /* Skip ';' */
+  }
+
+  if(len == 0 || pos != end)
+  {
+    g_string_append_c(str, INF_XMPP_CONNECTION_BINARY_VALUE_STRING);
+    inf_xmpp_connection_binary_write_string(str, value, len);
+    return;
+  }
+
+  g_string_append_c(str, INF_XMPP_CONNECTION_BINARY_VALUE_VECTOR);
+  inf_xmpp_connection_binary_write_uint(str, count);
+
+  pos = value;
+  for(;;)
+  {
+    pos = inf_xmpp_connection_binary_parse_component(pos, end, &id, &n);
+    inf_xmpp_connection_binary_write_uint(str, id);
+    inf_xmpp_connection_binary_write_uint(str, n);
+
+    if(pos == end)
+      break;
+    ++pos;
+  }
+}
+
+/* Returns the character data of a text-like node in the same way as the
+ * XML parser would report it to the remote site, or NULL if it has none. */
+static const xmlChar*
+inf_xmpp_connection_binary_node_text(xmlNodePtr xml)
+{
+  xmlEntityPtr entity;
+
+  switch(xml->type)
+  {
+  case XML_TEXT_NODE:
+  case XML_CDATA_SECTION_NODE:
+    return xml->content;
+  case XML_ENTITY_REF_NODE:
+    entity = xmlGetPredefinedEntity(xml->name);
+    if(entity != NULL)
+      return entity->content;
+    return NULL;
+  default:
+    return NULL;
+  }
+}
+
+static void
+inf_xmpp_connection_binary_write_element(InfXmppConnection* xmpp,
+                                         GString* str,
+                                         xmlNodePtr xml)
+{
+  xmlNsPtr ns;
+  xmlAttrPtr attr;
+  xmlNodePtr child;
+  xmlNodePtr text_end;
+  const xmlChar* text;
+  GString* value;
+  gsize len;
+  guint n_attrs;
+
+  inf_xmpp_connection_binary_write_name(
+    xmpp,
+    str,
+    xml->ns != NULL ? xml->ns->prefix : NULL,
+    xml->name
+  );
+
+  n_attrs = 0;
+  for(ns = xml->nsDef; ns != NULL; ns = ns->next)
+    ++n_attrs;
+  for(attr = xml->properties; attr != NULL; attr = attr->next)
+    ++n_attrs;
+
+  inf_xmpp_connection_binary_write_uint(str, n_attrs);
+
+  /* The remote site does not process namespaces, so namespace
+   * declarations are transmitted as plain attributes */
+  for(ns = xml->nsDef; ns != NULL; ns = ns->next)
+  {
+    if(ns->prefix != NULL)
+    {
+      inf_xmpp_connection_binary_write_name(
+        xmpp,
+        str,
+        (const xmlChar*)"xmlns",
+        ns->prefix
+      );
+    }
+    else
+    {
+      inf_xmpp_connection_binary_write_name(
+        xmpp,
+        str,
+        NULL,
+        (const xmlChar*)"xmlns"
+      );
+    }
+
+    inf_xmpp_connection_binary_write_value(
+      str,
+      (const gchar*)ns->href,
+      strlen((const gchar*)ns->href)
+    );
+  }
+
+  for(attr = xml->properties; attr != NULL; attr = attr->next)
+  {
+    inf_xmpp_connection_binary_write_name(
+      xmpp,
+      str,
+      attr->ns != NULL ? attr->ns->prefix : NULL,
+      attr->name
+    );
+
+    if(attr->children != NULL && attr->children->next == NULL &&
+       attr->children->type == XML_TEXT_NODE)
+    {
+      /* The common case of an attribute created by xmlNewProp() */
+      text = attr->children->content;
+      inf_xmpp_connection_binary_write_value(
+        str,
+        (const gchar*)text,
+        strlen((const gchar*)text)
+      );
+    }
+    else
+    {
+      value = g_string_new(NULL);
+      for(child = attr->children; child != NULL; child = child->next)
+      {
+        text = inf_xmpp_connection_binary_node_text(child);
+        if(text != NULL)
+          g_string_append(value, (const gchar*)text);
+      }
+
+      inf_xmpp_connection_binary_write_value(str, value->str, value->len);
+      g_string_free(value, TRUE);
+    }
+  }
+
+  child = xml->children;
+  while(child != NULL)
+  {
+    if(child->type == XML_ELEMENT_NODE)
+    {
+      g_string_append_c(str, INF_XMPP_CONNECTION_BINARY_ELEMENT);
+      inf_xmpp_connection_binary_write_element(xmpp, str, child);
+      child = child->next;
+    }
+    else if(inf_xmpp_connection_binary_node_text(child) != NULL)
+    {
+      /* Adjacent text is merged into one text node, which is what the
+       * XML parser on the remote site would do as well */
+      len = 0;
+      for(text_end = child; text_end != NULL; text_end = text_end->next)
+      {
+        text = inf_xmpp_connection_binary_node_text(text_end);
+        if(text == NULL) break;
+        len += strlen((const gchar*)text);
+      }
+
+      if(len > 0)
+      {
+        g_string_append_c(str, INF_XMPP_CONNECTION_BINARY_TEXT);
+        inf_xmpp_connection_binary_write_uint(str, len);
+
+        for(; child != text_end; child = child->next)
+        {
+          g_string_append(
+            str,
+            (const gchar*)inf_xmpp_connection_binary_node_text(child)
+          );
+        }
+      }
+
+      child = text_end;
+    }
+    else
+    {
+      /* Comments and processing instructions are not transmitted */
+      child = child->next;
+    }
+  }
+
+  g_string_append_c(str, INF_XMPP_CONNECTION_BINARY_END);
+}
+
+/* Appends xml as a binary record to str, and returns the offset in str at
+ * which the record starts. */
+static gsize
+inf_xmpp_connection_binary_write_record(InfXmppConnection* xmpp,
+                                        GString* str,
+                                        xmlNodePtr xml)
+{
+  guint8 header[INF_XMPP_CONNECTION_BINARY_HEADER_SIZE];
+  gsize start;
+  guint len;
+
+  /* Leave room for the length, which is only known afterwards */
+  start = str->len;
+  g_string_set_size(str, start + INF_XMPP_CONNECTION_BINARY_HEADER_SIZE);
+
+  inf_xmpp_connection_binary_write_element(xmpp, str, xml);
+
+  len = inf_xmpp_connection_binary_uint_to_bytes(
+    str->len - start - INF_XMPP_CONNECTION_BINARY_HEADER_SIZE,
+    header
+  );
+
+  start += INF_XMPP_CONNECTION_BINARY_HEADER_SIZE - len;
+  memcpy(str->str + start, header, len);
+  return start;
+}
+
+static void
+inf_xmpp_connection_send_xml(InfXmppConnection* xmpp,
+                             xmlNodePtr xml)
+{
+  InfXmppConnectionPrivate* priv;
+  gsize offset;
+
+  priv = INF_XMPP_CONNECTION_PRIVATE(xmpp);
+
+  g_return_if_fail(priv->buf != NULL);
+
+  if(priv->binary_out)
+  {
+    offset = inf_xmpp_connection_binary_write_record(xmpp, priv->buf, xml);
+  }
+  else
+  {
+    /* This does not need to attach xml to a document, as xmlNodeDump()
+     * would, which walks the whole tree twice to set and unset the
+     * document. */
+    offset = 0;
+    inf_xml_util_serialize_node(xml, priv->buf);
+  }
+
+  /* Keep the object alive during the send_chars call, so that we can check
+   * the buffer variable afterwards. */
+  g_object_ref(xmpp);
+
+  inf_xmpp_connection_send_chars(
+    xmpp,
+    priv->buf->str + offset,
+    priv->buf->len - offset
+  );
+
+  /* The connection might be closed & cleared as a result from
+   * inf_xmpp_connection_send_chars(), so make sure the buffer still
+   * exists before emptying it. Do not hold on to the memory of an
+   * exceptionally large message, such as a session synchronization. */
+  if(priv->buf != NULL)
+  {
+    if(priv->buf->allocated_len > INF_XMPP_CONNECTION_MAX_SEND_BUFFER_SIZE)
+    {
+      g_string_free(priv->buf, TRUE);
+      priv->buf = g_string_sized_new(INF_XMPP_CONNECTION_SEND_BUFFER_SIZE);
+    }
+    else
+    {
+      g_string_truncate(priv->buf, 0);
+    }
+  }
+
+  g_object_unref(xmpp);
+}
+
+/*
  * Helper functions
  */
 static xmlNodePtr
@@ -847,16 +1806,51 @@ inf_xmpp_connection_node_new_sasl(const gchar* name)
   );
 }
 
+static xmlNodePtr
+inf_xmpp_connection_node_new_compress(const gchar* name)
+{
+  return inf_xmpp_connection_node_new(
+    name,
+    "http://jabber.org/protocol/compress"
+  );
+}
+
 /*
  * XMPP deinitialization
  */
 
-/* Terminates the XMPP session and closes the connection. */
+/* Sends </stream:stream>, or its binary equivalent */
 static void
-inf_xmpp_connection_terminate(InfXmppConnection* xmpp)
+inf_xmpp_connection_send_stream_end(InfXmppConnection* xmpp)
 {
   static const gchar xmpp_connection_deinit_request[] = "</stream:stream>";
+  static const gchar xmpp_connection_binary_deinit_request[] = { 0 };
+
+  InfXmppConnectionPrivate* priv;
+  priv = INF_XMPP_CONNECTION_PRIVATE(xmpp);
+
+  if(priv->binary_out)
+  {
+    inf_xmpp_connection_send_chars(
+      xmpp,
+      xmpp_connection_binary_deinit_request,
+      sizeof(xmpp_connection_binary_deinit_request)
+    );
+  }
+  else
+  {
+    inf_xmpp_connection_send_chars(
+      xmpp,
+      xmpp_connection_deinit_request,
+      sizeof(xmpp_connection_deinit_request) - 1
+    );
+  }
+}
 
+/* Terminates the XMPP session and closes the connection. */
+static void
+inf_xmpp_connection_terminate(InfXmppConnection* xmpp)
+{
   InfXmppConnectionPrivate* priv;
   xmlNodePtr abort;
 
@@ -890,13 +1884,7 @@ inf_xmpp_connection_terminate(InfXmppConnection* xmpp)
       /* inf_xmpp_connection_send_xml() above might have caused
        * status update: */
       if(priv->status != INF_XMPP_CONNECTION_CLOSED)
-      {
-        inf_xmpp_connection_send_chars(
-          xmpp,
-          xmpp_connection_deinit_request,
-          sizeof(xmpp_connection_deinit_request) - 1
-        );
-      }
+        inf_xmpp_connection_send_stream_end(xmpp);
     }
 
     /* One of the send() calls above might have caused status update */
@@ -1038,9 +2026,6 @@ inf_xmpp_connection_terminate_error(InfXmppConnection* xmpp,
 static void
 inf_xmpp_connection_deinitiate(InfXmppConnection* xmpp)
 {
-  static const gchar xmpp_connection_deinitiate_request[] =
-    "</stream:stream>";
-
   InfXmppConnectionPrivate* priv;
   xmlNodePtr abort;
 
@@ -1074,11 +2059,7 @@ inf_xmpp_connection_deinitiate(InfXmppConnection* xmpp)
     }
   }
 
-  inf_xmpp_connection_send_chars(
-    xmpp,
-    xmpp_connection_deinitiate_request,
-    sizeof(xmpp_connection_deinitiate_request) - 1
-  );
+  inf_xmpp_connection_send_stream_end(xmpp);
 
   priv->status = INF_XMPP_CONNECTION_CLOSING_STREAM;
   g_object_notify(G_OBJECT(xmpp), "status");
@@ -1157,16 +2138,14 @@ inf_xmpp_connection_tls_pull(gnutls_transport_ptr_t ptr,
 }
 
 static gnutls_x509_crt_t
-inf_xmpp_connection_tls_import_own_certificate(InfXmppConnection* xmpp,
+inf_xmpp_connection_tls_import_own_certificate(gnutls_session_t session,
                                                GError** error)
 {
-  InfXmppConnectionPrivate* priv;
   const gnutls_datum_t* cert_raw;
   gnutls_x509_crt_t cert;
   int res;
 
-  priv = INF_XMPP_CONNECTION_PRIVATE(xmpp);
-  cert_raw = gnutls_certificate_get_ours(priv->session);
+  cert_raw = gnutls_certificate_get_ours(session);
 
   if(cert_raw == NULL)
     return NULL;
@@ -1190,10 +2169,9 @@ inf_xmpp_connection_tls_import_own_certificate(InfXmppConnection* xmpp,
 }
 
 static InfCertificateChain*
-inf_xmpp_connection_tls_import_peer_certificate(InfXmppConnection* xmpp,
+inf_xmpp_connection_tls_import_peer_certificate(gnutls_session_t session,
                                                 GError** error)
 {
-  InfXmppConnectionPrivate* priv;
   const gnutls_datum_t* certs_raw;
   unsigned int list_size;
   unsigned int n_certs;
@@ -1201,8 +2179,7 @@ inf_xmpp_connection_tls_import_peer_certificate(InfXmppConnection* xmpp,
   int res;
   guint i;
 
-  priv = INF_XMPP_CONNECTION_PRIVATE(xmpp);
-  certs_raw = gnutls_certificate_get_peers(priv->session, &list_size);
+  certs_raw = gnutls_certificate_get_peers(session, &list_size);
 
   if(certs_raw == NULL)
     return NULL;
@@ -1261,65 +2238,273 @@ inf_xmpp_connection_tls_import_peer_certificate(InfXmppConnection* xmpp,
   return inf_certificate_chain_new(certs, list_size);
 }
 
-static void
-inf_xmpp_connection_tls_handshake(InfXmppConnection* xmpp)
+static ssize_t
+inf_xmpp_connection_tls_handshake_push(gnutls_transport_ptr_t ptr,
+                                       const void* data,
+                                       size_t len)
 {
-  InfXmppConnectionPrivate* priv;
-  int ret;
+  InfXmppConnectionHandshake* handshake;
+  handshake = (InfXmppConnectionHandshake*)ptr;
 
-  InfCertificateChain* chain;
-  GError* error;
+  /* Collect the data, it is sent from the main thread when the
+   * handshake step is done. */
+  g_string_append_len(handshake->output, data, len);
+  return len;
+}
 
-  priv = INF_XMPP_CONNECTION_PRIVATE(xmpp);
-  g_assert(priv->status == INF_XMPP_CONNECTION_HANDSHAKING);
-  g_assert(priv->session != NULL);
+static ssize_t
+inf_xmpp_connection_tls_handshake_pull(gnutls_transport_ptr_t ptr,
+                                       void* data,
+                                       size_t len)
+{
+  InfXmppConnectionHandshake* handshake;
+  size_t pull_len;
 
-  ret = gnutls_handshake(priv->session);
-  switch(ret)
+  handshake = (InfXmppConnectionHandshake*)ptr;
+
+  if(handshake->input_pos == handshake->input->len)
   {
-  case GNUTLS_E_AGAIN:
-    /* Wait for more data */
-    break;
-  case 0:
-    /* Handshake finished successfully */
-    priv->status = INF_XMPP_CONNECTION_CONNECTED;
-    g_object_notify(G_OBJECT(xmpp), "tls-enabled");
+    gnutls_transport_set_errno(handshake->session, EAGAIN);
+    return -1;
+  }
 
-    error = NULL;
+  pull_len = handshake->input->len - handshake->input_pos;
+  if(len < pull_len) pull_len = len;
 
-    /* Extract own certificate */
-    g_assert(priv->own_cert == NULL);
-    priv->own_cert =
-      inf_xmpp_connection_tls_import_own_certificate(xmpp, &error);
-    if(error == NULL)
-    {
+  memcpy(data, handshake->input->data + handshake->input_pos, pull_len);
+  handshake->input_pos += pull_len;
+  return pull_len;
+}
+
+static void
+inf_xmpp_connection_tls_handshake_free(InfXmppConnectionHandshake* handshake)
+{
+  if(handshake->session != NULL)
+    gnutls_deinit(handshake->session);
+  /* Only release the credentials after the session using them is gone */
+  if(handshake->creds != NULL)
+    inf_certificate_credentials_unref(handshake->creds);
+  if(handshake->own_cert != NULL)
+    gnutls_x509_crt_deinit(handshake->own_cert);
+  if(handshake->peer_cert != NULL)
+    inf_certificate_chain_unref(handshake->peer_cert);
+  if(handshake->error != NULL)
+    g_error_free(handshake->error);
+  if(handshake->io != NULL)
+    g_object_unref(handshake->io);
+
+  g_byte_array_free(handshake->input, TRUE);
+  g_string_free(handshake->output, TRUE);
+  g_slice_free(InfXmppConnectionHandshake, handshake);
+}
+
+static void
+inf_xmpp_connection_tls_handshake_dispatch(gpointer user_data);
+
+/* Runs in a worker thread */
+static void
+inf_xmpp_connection_tls_handshake_run(gpointer data,
+                                      gpointer user_data)
+{
+  InfXmppConnectionHandshake* handshake;
+  handshake = (InfXmppConnectionHandshake*)data;
+
+  handshake->result = gnutls_handshake(handshake->session);
+
+  /* Parsing the certificates is done here as well, so that the main thread
+   * only needs to show them to the certificate callback. */
+  if(handshake->result == 0)
+  {
+    handshake->own_cert = inf_xmpp_connection_tls_import_own_certificate(
+      handshake->session,
+      &handshake->error
+    );
+
+    if(handshake->error == NULL)
+    {
+      handshake->peer_cert = inf_xmpp_connection_tls_import_peer_certificate(
+        handshake->session,
+        &handshake->error
+      );
+    }
+  }
+
+  g_mutex_lock(&inf_xmpp_connection_handshake_mutex);
+  if(handshake->io != NULL)
+  {
+    handshake->dispatch = inf_io_add_dispatch(
+      handshake->io,
+      inf_xmpp_connection_tls_handshake_dispatch,
+      handshake,
+      NULL
+    );
+
+    g_mutex_unlock(&inf_xmpp_connection_handshake_mutex);
+  }
+  else
+  {
+    /* The connection was closed in the meanwhile */
+    g_mutex_unlock(&inf_xmpp_connection_handshake_mutex);
+    inf_xmpp_connection_tls_handshake_free(handshake);
+  }
+}
+
+/* Hands the data received so far to a new handshake step in the worker
+ * pool, unless one is already running. In that case, the data is picked
+ * up by the next step once the running one is done. */
+static void
+inf_xmpp_connection_tls_handshake(InfXmppConnection* xmpp)
+{
+  static gsize pool_initialized = 0;
+  InfXmppConnectionPrivate* priv;
+  InfXmppConnectionHandshake* handshake;
+
+  priv = INF_XMPP_CONNECTION_PRIVATE(xmpp);
+  g_assert(priv->status == INF_XMPP_CONNECTION_HANDSHAKING);
+  g_assert(priv->session != NULL);
+
+  if(priv->handshake != NULL)
+    return;
+
+  if(g_once_init_enter(&pool_initialized))
+  {
+    inf_xmpp_connection_handshake_pool = g_thread_pool_new(
+      inf_xmpp_connection_tls_handshake_run,
+      NULL,
+      g_get_num_processors(),
+      FALSE,
+      NULL
+    );
+
+    g_once_init_leave(&pool_initialized, 1);
+  }
+
+  handshake = g_slice_new(InfXmppConnectionHandshake);
+  handshake->xmpp = xmpp;
+  g_object_get(G_OBJECT(priv->tcp), "io", &handshake->io, NULL);
+  handshake->dispatch = NULL;
+  handshake->session = priv->session;
+  handshake->creds = inf_certificate_credentials_ref(priv->creds);
+  handshake->input = priv->handshake_input;
+  handshake->input_pos = 0;
+  handshake->output = g_string_new(NULL);
+  handshake->result = 0;
+  handshake->own_cert = NULL;
+  handshake->peer_cert = NULL;
+  handshake->error = NULL;
+
+  if(handshake->input == NULL)
+    handshake->input = g_byte_array_new();
+  priv->handshake_input = NULL;
+
+  gnutls_transport_set_ptr(priv->session, handshake);
+
+  gnutls_transport_set_push_function(
+    priv->session,
+    inf_xmpp_connection_tls_handshake_push
+  );
+
+  gnutls_transport_set_pull_function(
+    priv->session,
+    inf_xmpp_connection_tls_handshake_pull
+  );
+
+  priv->handshake = handshake;
+  g_thread_pool_push(inf_xmpp_connection_handshake_pool, handshake, NULL);
+}
+
+/* Stops waiting for a running handshake step, for example because the
+ * connection is closed. The session is freed together with the step. */
+static void
+inf_xmpp_connection_tls_handshake_cancel(InfXmppConnection* xmpp)
+{
+  InfXmppConnectionPrivate* priv;
+  InfXmppConnectionHandshake* handshake;
+  InfIo* io;
+
+  priv = INF_XMPP_CONNECTION_PRIVATE(xmpp);
+  handshake = priv->handshake;
+  if(handshake == NULL)
+    return;
+
+  g_assert(handshake->session == priv->session);
+  priv->handshake = NULL;
+  priv->session = NULL;
+
+  g_mutex_lock(&inf_xmpp_connection_handshake_mutex);
+  if(handshake->dispatch != NULL)
+  {
+    /* The worker is done already, but the result was not dispatched yet */
+    inf_io_remove_dispatch(handshake->io, handshake->dispatch);
+    g_mutex_unlock(&inf_xmpp_connection_handshake_mutex);
+
+    inf_xmpp_connection_tls_handshake_free(handshake);
+  }
+  else
+  {
+    /* The worker is still running, let it clean up when it is done */
+    io = handshake->io;
+    handshake->io = NULL;
+    g_mutex_unlock(&inf_xmpp_connection_handshake_mutex);
+
+    g_object_unref(io);
+  }
+}
+
+static void
+inf_xmpp_connection_tls_handshake_done(InfXmppConnection* xmpp,
+                                       InfXmppConnectionHandshake* handshake)
+{
+  InfXmppConnectionPrivate* priv;
+  GError* error;
+
+  priv = INF_XMPP_CONNECTION_PRIVATE(xmpp);
+
+  switch(handshake->result)
+  {
+  case GNUTLS_E_AGAIN:
+    /* Wait for more data */
+    break;
+  case 0:
+    /* Handshake finished successfully */
+    priv->status = INF_XMPP_CONNECTION_CONNECTED;
+    priv->session_resumed = gnutls_session_is_resumed(priv->session) != 0;
+    g_object_notify(G_OBJECT(xmpp), "tls-enabled");
+
+    /* Take over the certificates imported by the worker */
+    error = handshake->error;
+    handshake->error = NULL;
+
+    g_assert(priv->own_cert == NULL);
+    priv->own_cert = handshake->own_cert;
+    handshake->own_cert = NULL;
+
+    g_assert(priv->peer_cert == NULL);
+    priv->peer_cert = handshake->peer_cert;
+    handshake->peer_cert = NULL;
+
+    if(error == NULL)
+    {
       if(priv->own_cert != NULL)
         g_object_notify(G_OBJECT(xmpp), "local-certificate");
-    
-      /* Extract peer certificate */
-      g_assert(priv->peer_cert == NULL);
-      priv->peer_cert =
-        inf_xmpp_connection_tls_import_peer_certificate(xmpp, &error);
-      if(error == NULL)
+
+      /* Require the server to show us its certificate */
+      if(priv->peer_cert == NULL)
       {
-        /* Require the server to show us its certificate */
-        if(priv->peer_cert == NULL)
-        {
-          if(priv->site == INF_XMPP_CONNECTION_CLIENT)
-          {
-            g_set_error_literal(
-              &error,
-              inf_xmpp_connection_error_quark(),
-              INF_XMPP_CONNECTION_ERROR_NO_CERTIFICATE_PROVIDED,
-              _("The server did not provide a certificate")
-            );
-          }
-        }
-        else
+        if(priv->site == INF_XMPP_CONNECTION_CLIENT)
         {
-          g_object_notify(G_OBJECT(xmpp), "remote-certificate");
+          g_set_error_literal(
+            &error,
+            inf_xmpp_connection_error_quark(),
+            INF_XMPP_CONNECTION_ERROR_NO_CERTIFICATE_PROVIDED,
+            _("The server did not provide a certificate")
+          );
         }
       }
+      else
+      {
+        g_object_notify(G_OBJECT(xmpp), "remote-certificate");
+      }
     }
 
     if(error != NULL)
@@ -1353,13 +2538,21 @@ inf_xmpp_connection_tls_handshake(InfXmppConnection* xmpp)
     break;
   default:
     error = NULL;
-    inf_gnutls_set_error(&error, ret);
+    inf_gnutls_set_error(&error, handshake->result);
     inf_xml_connection_error(INF_XML_CONNECTION(xmpp), error);
     g_error_free(error);
 
     gnutls_deinit(priv->session);
     priv->session = NULL;
 
+    /* The server might not accept the session anymore that we tried to
+     * resume, so do not try it again. */
+    if(priv->session_data != NULL)
+    {
+      g_bytes_unref(priv->session_data);
+      priv->session_data = NULL;
+    }
+
     switch(priv->site)
     {
     case INF_XMPP_CONNECTION_CLIENT:
@@ -1385,10 +2578,39 @@ inf_xmpp_connection_tls_handshake(InfXmppConnection* xmpp)
   }
 }
 
+/* Remembers the parameters of the current session, so that it can be
+ * resumed on the next connection. This is done once the XMPP session is
+ * ready, because with TLS 1.3 the session ticket is only sent after the
+ * handshake. */
+static void
+inf_xmpp_connection_tls_store_session_data(InfXmppConnection* xmpp)
+{
+  InfXmppConnectionPrivate* priv;
+  gnutls_datum_t data;
+  int res;
+
+  priv = INF_XMPP_CONNECTION_PRIVATE(xmpp);
+  g_assert(priv->site == INF_XMPP_CONNECTION_CLIENT);
+
+  if(priv->session == NULL)
+    return;
+
+  res = gnutls_session_get_data2(priv->session, &data);
+  if(res != GNUTLS_E_SUCCESS)
+    return;
+
+  if(priv->session_data != NULL)
+    g_bytes_unref(priv->session_data);
+
+  priv->session_data = g_bytes_new(data.data, data.size);
+  gnutls_free(data.data);
+}
+
 static void
 inf_xmpp_connection_tls_init(InfXmppConnection* xmpp)
 {
   InfXmppConnectionPrivate* priv;
+  const gnutls_datum_t* ticket_key;
 
   priv = INF_XMPP_CONNECTION_PRIVATE(xmpp);
   g_assert(priv->session == NULL);
@@ -1448,6 +2670,34 @@ inf_xmpp_connection_tls_init(InfXmppConnection* xmpp)
     inf_certificate_credentials_get(priv->creds)
   );
 
+  switch(priv->site)
+  {
+  case INF_XMPP_CONNECTION_CLIENT:
+    /* Offer to resume the previous session. If the server does not
+     * accept it, a full handshake is made. */
+    if(priv->session_data != NULL)
+    {
+      gnutls_session_set_data(
+        priv->session,
+        g_bytes_get_data(priv->session_data, NULL),
+        g_bytes_get_size(priv->session_data)
+      );
+    }
+
+    break;
+  case INF_XMPP_CONNECTION_SERVER:
+    ticket_key = inf_certificate_credentials_get_session_ticket_key(
+      priv->creds
+    );
+
+    if(ticket_key != NULL)
+      gnutls_session_ticket_enable_server(priv->session, ticket_key);
+    break;
+  default:
+    g_assert_not_reached();
+    break;
+  }
+
   gnutls_transport_set_ptr(priv->session, xmpp);
 
   gnutls_transport_set_push_function(
@@ -1866,89 +3116,369 @@ inf_xmpp_connection_sasl_init(InfXmppConnection* xmpp,
  * XMPP messaging
  */
 
-/* This does actually process the start_element event after several
- * special cases have been handled in sax_start_element(). */
+/*
+ * Binary encoding negotiation
+ */
+
+/* Whether xml is the binary stream feature, or a request or
+ * acknowledgement to switch to the binary encoding */
+static gboolean
+inf_xmpp_connection_binary_is_request(xmlNodePtr xml)
+{
+  xmlChar* xmlns;
+  gboolean result;
+
+  if(strcmp((const gchar*)xml->name, "binary") != 0)
+    return FALSE;
+
+  xmlns = xmlGetProp(xml, (const xmlChar*)"xmlns");
+  if(xmlns == NULL)
+    return FALSE;
+
+  result = strcmp((const gchar*)xmlns, INF_XMPP_CONNECTION_BINARY_NS) == 0;
+  xmlFree(xmlns);
+  return result;
+}
+
 static void
-inf_xmpp_connection_process_start_element(InfXmppConnection* xmpp,
-                                          const xmlChar* name,
-                                          const xmlChar** attrs)
+inf_xmpp_connection_binary_start_out(InfXmppConnection* xmpp)
 {
   InfXmppConnectionPrivate* priv;
-  xmlNodePtr node;
+  priv = INF_XMPP_CONNECTION_PRIVATE(xmpp);
 
-  const xmlChar** attr;
-  const xmlChar* attr_name;
-  const xmlChar* attr_value;
+  g_assert(priv->binary_out == FALSE);
+
+  priv->binary_out_names =
+    g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  priv->binary_out = TRUE;
+}
 
+/* Makes all data after the message currently being parsed go to the binary
+ * decoder. This needs to be called from within an XML parser callback. */
+static void
+inf_xmpp_connection_binary_start_in(InfXmppConnection* xmpp)
+{
+  InfXmppConnectionPrivate* priv;
   priv = INF_XMPP_CONNECTION_PRIVATE(xmpp);
-  node = xmlNewNode(NULL, name);
 
-  if(attrs != NULL)
-  {
-    attr = attrs;
-    while(*attr != NULL)
-    {
-      attr_name = *attr;
-      ++ attr;
+  g_assert(priv->binary_in == FALSE);
+  g_assert(priv->parser != NULL);
 
-      attr_value = *attr;
-      ++ attr;
+  /* The XML parser is not used anymore. Stopping it makes it ignore the
+   * rest of the current chunk, which inf_xmpp_connection_feed() passes on
+   * to the binary decoder instead. */
+  priv->binary_offset = xmlByteConsumed(priv->parser);
+  xmlStopParser(priv->parser);
 
-      xmlNewProp(node, attr_name, attr_value);
-    }
-  }
+  priv->binary_in_names = g_ptr_array_new_with_free_func(g_free);
+  priv->binary_input = g_byte_array_new();
+  priv->binary_in = TRUE;
+}
 
-  if(priv->root == NULL)
+static void
+inf_xmpp_connection_process_binary(InfXmppConnection* xmpp)
+{
+  InfXmppConnectionPrivate* priv;
+  xmlNodePtr ack;
+
+  priv = INF_XMPP_CONNECTION_PRIVATE(xmpp);
+
+  /* Ignore the request if we did not offer the binary encoding, or if we did
+   * not ask for it, respectively. */
+  if(priv->binary_in == TRUE)
+    return;
+
+  if(priv->site == INF_XMPP_CONNECTION_SERVER)
   {
-    g_assert(priv->cur == NULL);
+    if(priv->binary_enabled == FALSE)
+      return;
 
-    priv->root = node;
-    priv->cur = node;
+    /* The client sends binary data right after its request, and switches
+     * its incoming data once it receives our acknowledgement. */
+    inf_xmpp_connection_binary_start_in(xmpp);
+
+    ack = inf_xmpp_connection_node_new("binary", INF_XMPP_CONNECTION_BINARY_NS);
+    inf_xmpp_connection_send_xml(xmpp, ack);
+    xmlFreeNode(ack);
+
+    if(priv->status == INF_XMPP_CONNECTION_READY)
+      inf_xmpp_connection_binary_start_out(xmpp);
   }
   else
   {
-    g_assert(priv->cur != NULL);
-    priv->cur = xmlAddChild(priv->cur, node);
+    if(priv->binary_out == FALSE)
+      return;
+
+    inf_xmpp_connection_binary_start_in(xmpp);
   }
 }
 
-static void
-inf_xmpp_connection_process_connected(InfXmppConnection* xmpp,
-                                      const xmlChar** attrs)
-{
-  /* TODO: xml:lang and id field are missing here */
-  static const gchar xmpp_connection_initial_request[] = 
-    "<stream:stream xmlns:stream=\"http://etherx.jabber.org/streams\" "
-    "xmlns=\"jabber:client\" version=\"1.0\" from=\"%s\">";
+/*
+ * Stream compression negotiation
+ */
 
+/* Whether stream compression may be negotiated in the current state. It is
+ * negotiated before authentication, and not before TLS if TLS is required,
+ * since TLS cannot be started on top of a compressed stream. */
+static gboolean
+inf_xmpp_connection_compression_allowed(InfXmppConnection* xmpp)
+{
   InfXmppConnectionPrivate* priv;
-  char* mech_list;
-  char* begin;
-  char* end;
+  priv = INF_XMPP_CONNECTION_PRIVATE(xmpp);
 
-  gchar* reply;
+  return priv->compression_enabled == TRUE &&
+         priv->compression == NULL &&
+         (priv->session != NULL ||
+          priv->security_policy != INF_XMPP_CONNECTION_SECURITY_ONLY_TLS);
+}
 
-  xmlNodePtr features;
-  xmlNodePtr starttls;
-  xmlNodePtr mechanisms;
-  xmlNodePtr mechanism;
-  gchar* mechanism_dup;
-  GError* error;
+/* Returns whether xml, a <compression> feature or a <compress> request,
+ * contains the zlib method. */
+static gboolean
+inf_xmpp_connection_compression_has_zlib(xmlNodePtr xml)
+{
+  xmlNodePtr child;
+  xmlChar* method;
+  gboolean result;
 
-  priv = INF_XMPP_CONNECTION_PRIVATE(xmpp);
-  g_assert(priv->site == INF_XMPP_CONNECTION_SERVER);
-  g_assert(priv->parser != NULL);
+  for(child = xml->children; child != NULL; child = child->next)
+  {
+    if(strcmp((const gchar*)child->name, "method") == 0)
+    {
+      method = xmlNodeGetContent(child);
+      result = method != NULL && strcmp((const gchar*)method, "zlib") == 0;
+      if(method != NULL) xmlFree(method);
 
-  g_assert(priv->status == INF_XMPP_CONNECTION_CONNECTED ||
-           priv->status == INF_XMPP_CONNECTION_AUTH_CONNECTED);
+      if(result)
+        return TRUE;
+    }
+  }
 
-  reply = g_strdup_printf(
-    xmpp_connection_initial_request,
-    priv->local_hostname
-  );
+  return FALSE;
+}
 
-  inf_xmpp_connection_send_chars(xmpp, reply, strlen(reply));
-  g_free(reply);
+/* Handles a <compress> request of the client (server only) */
+static void
+inf_xmpp_connection_process_compress(InfXmppConnection* xmpp,
+                                     xmlNodePtr xml)
+{
+  InfXmppConnectionPrivate* priv;
+  InfXmppConnectionCompression* compression;
+  xmlNodePtr reply;
+
+  priv = INF_XMPP_CONNECTION_PRIVATE(xmpp);
+  g_assert(priv->site == INF_XMPP_CONNECTION_SERVER);
+  g_assert(priv->status == INF_XMPP_CONNECTION_INITIATED);
+
+  compression = NULL;
+  if(!inf_xmpp_connection_compression_has_zlib(xml))
+  {
+    reply = inf_xmpp_connection_node_new_compress("failure");
+    xmlNewChild(reply, NULL, (const xmlChar*)"unsupported-method", NULL);
+  }
+  else
+  {
+    compression = inf_xmpp_connection_compression_new();
+    if(compression == NULL)
+    {
+      reply = inf_xmpp_connection_node_new_compress("failure");
+      xmlNewChild(reply, NULL, (const xmlChar*)"setup-failed", NULL);
+    }
+    else
+    {
+      reply = inf_xmpp_connection_node_new_compress("compressed");
+    }
+  }
+
+  inf_xmpp_connection_send_xml(xmpp, reply);
+  xmlFreeNode(reply);
+
+  /* On failure, the stream goes on uncompressed and the client can continue
+   * with authentication. */
+  if(compression != NULL)
+  {
+    if(priv->status == INF_XMPP_CONNECTION_INITIATED)
+    {
+      /* Everything after <compressed/> is compressed, including the new
+       * <stream:stream> which the client sends to restart the stream. */
+      inf_xmpp_connection_compression_start(xmpp, compression);
+      priv->status = INF_XMPP_CONNECTION_CONNECTED;
+      priv->restart_stream = TRUE;
+    }
+    else
+    {
+      /* Connection went down while sending */
+      inf_xmpp_connection_compression_free(compression);
+    }
+  }
+}
+
+/* Handles the server's response to our <compress> request (client only) */
+static void
+inf_xmpp_connection_process_compression(InfXmppConnection* xmpp,
+                                        xmlNodePtr xml)
+{
+  InfXmppConnectionPrivate* priv;
+  InfXmppConnectionCompression* compression;
+  GError* error;
+
+  priv = INF_XMPP_CONNECTION_PRIVATE(xmpp);
+  g_assert(priv->site == INF_XMPP_CONNECTION_CLIENT);
+  g_assert(priv->status == INF_XMPP_CONNECTION_COMPRESSION_REQUESTED);
+
+  if(strcmp((const gchar*)xml->name, "compressed") == 0)
+  {
+    compression = inf_xmpp_connection_compression_new();
+    if(compression == NULL)
+    {
+      /* The server compresses everything from now on, so we cannot go on */
+      error = g_error_new_literal(
+        inf_xmpp_connection_error_quark(),
+        INF_XMPP_CONNECTION_ERROR_COMPRESSION_FAILURE,
+        _("Failed to set up stream compression")
+      );
+
+      inf_xml_connection_error(INF_XML_CONNECTION(xmpp), error);
+      g_error_free(error);
+
+      inf_xmpp_connection_terminate(xmpp);
+    }
+    else
+    {
+      /* Restart the stream with a compressed <stream:stream>. We might be in
+       * an XML callback here, so this is done in end_parsing(), since it
+       * replaces the XML parser. */
+      inf_xmpp_connection_compression_start(xmpp, compression);
+      priv->status = INF_XMPP_CONNECTION_CONNECTED;
+      priv->restart_stream = TRUE;
+    }
+  }
+  else if(strcmp((const gchar*)xml->name, "failure") == 0)
+  {
+    /* We do not keep the stream features around to go on with
+     * authentication, but the server only fails if it could not set up
+     * the compression at all. */
+    error = g_error_new_literal(
+      inf_xmpp_connection_error_quark(),
+      INF_XMPP_CONNECTION_ERROR_COMPRESSION_FAILURE,
+      _("The server cannot compress the stream")
+    );
+
+    inf_xml_connection_error(INF_XML_CONNECTION(xmpp), error);
+    g_error_free(error);
+
+    inf_xmpp_connection_deinitiate(xmpp);
+  }
+  else
+  {
+    /* We got neither 'compressed' nor 'failure'. Ignore and wait for either
+     * of them. */
+  }
+}
+
+/* This does actually process the start_element event after several
+ * special cases have been handled in sax_start_element(). */
+static void
+inf_xmpp_connection_process_start_element(InfXmppConnection* xmpp,
+                                          const xmlChar* name,
+                                          const xmlChar** attrs)
+{
+  InfXmppConnectionPrivate* priv;
+  xmlNodePtr node;
+
+  const xmlChar** attr;
+  const xmlChar* attr_name;
+  const xmlChar* attr_value;
+  xmlAttrPtr last_prop;
+
+  priv = INF_XMPP_CONNECTION_PRIVATE(xmpp);
+
+  if(priv->root != NULL)
+    inf_xmpp_connection_flush_text(xmpp);
+
+  node = inf_xmpp_connection_arena_node(
+    xmpp,
+    XML_ELEMENT_NODE,
+    inf_xmpp_connection_intern(xmpp, name)
+  );
+
+  if(attrs != NULL)
+  {
+    last_prop = NULL;
+    attr = attrs;
+    while(*attr != NULL)
+    {
+      attr_name = *attr;
+      ++ attr;
+
+      attr_value = *attr;
+      ++ attr;
+
+      last_prop = inf_xmpp_connection_arena_prop(
+        xmpp,
+        node,
+        last_prop,
+        inf_xmpp_connection_intern(xmpp, attr_name),
+        attr_value,
+        attr_value != NULL ? strlen((const gchar*)attr_value) : 0
+      );
+    }
+  }
+
+  if(priv->root == NULL)
+  {
+    g_assert(priv->cur == NULL);
+
+    priv->root = node;
+    priv->cur = node;
+  }
+  else
+  {
+    g_assert(priv->cur != NULL);
+    inf_xmpp_connection_arena_append(priv->cur, node);
+    priv->cur = node;
+  }
+}
+
+static void
+inf_xmpp_connection_process_connected(InfXmppConnection* xmpp,
+                                      const xmlChar** attrs)
+{
+  /* TODO: xml:lang and id field are missing here */
+  static const gchar xmpp_connection_initial_request[] = 
+    "<stream:stream xmlns:stream=\"http://etherx.jabber.org/streams\" "
+    "xmlns=\"jabber:client\" version=\"1.0\" from=\"%s\">";
+
+  InfXmppConnectionPrivate* priv;
+  char* mech_list;
+  char* begin;
+  char* end;
+
+  gchar* reply;
+
+  xmlNodePtr features;
+  xmlNodePtr starttls;
+  xmlNodePtr compression;
+  xmlNodePtr binary;
+  xmlNodePtr mechanisms;
+  xmlNodePtr mechanism;
+  gchar* mechanism_dup;
+  GError* error;
+
+  priv = INF_XMPP_CONNECTION_PRIVATE(xmpp);
+  g_assert(priv->site == INF_XMPP_CONNECTION_SERVER);
+  g_assert(priv->parser != NULL);
+
+  g_assert(priv->status == INF_XMPP_CONNECTION_CONNECTED ||
+           priv->status == INF_XMPP_CONNECTION_AUTH_CONNECTED);
+
+  reply = g_strdup_printf(
+    xmpp_connection_initial_request,
+    priv->local_hostname
+  );
+
+  inf_xmpp_connection_send_chars(xmpp, reply, strlen(reply));
+  g_free(reply);
 
   /* <stream:stream> was sent, so change status to initiated */
   switch(priv->status)
@@ -1966,8 +3496,9 @@ inf_xmpp_connection_process_connected(InfXmppConnection* xmpp,
 
   features = xmlNewNode(NULL, (const xmlChar*)"stream:features");
 
-  /* Don't offer TLS if we have already authenticated. It's pointless now. */
-  if(priv->session == NULL &&
+  /* Don't offer TLS if we have already authenticated. It's pointless now.
+   * Also, TLS cannot be started on a compressed stream. */
+  if(priv->session == NULL && priv->compression == NULL &&
      priv->status != INF_XMPP_CONNECTION_AUTH_INITIATED)
   {
     if(priv->security_policy != INF_XMPP_CONNECTION_SECURITY_ONLY_UNSECURED)
@@ -1979,6 +3510,34 @@ inf_xmpp_connection_process_connected(InfXmppConnection* xmpp,
     }
   }
 
+  if(priv->status == INF_XMPP_CONNECTION_INITIATED &&
+     inf_xmpp_connection_compression_allowed(xmpp))
+  {
+    compression = inf_xmpp_connection_node_new(
+      "compression",
+      "http://jabber.org/features/compress"
+    );
+
+    xmlAddChild(features, compression);
+    xmlNewTextChild(
+      compression,
+      NULL,
+      (const xmlChar*)"method",
+      (const xmlChar*)"zlib"
+    );
+  }
+
+  if(priv->status == INF_XMPP_CONNECTION_AUTH_INITIATED &&
+     priv->binary_enabled)
+  {
+    binary = inf_xmpp_connection_node_new(
+      "binary",
+      INF_XMPP_CONNECTION_BINARY_NS
+    );
+
+    xmlAddChild(features, binary);
+  }
+
   if(priv->status == INF_XMPP_CONNECTION_INITIATED)
   {
     /* Not yet authenticated, so give the client a list of authentication
@@ -2082,6 +3641,15 @@ inf_xmpp_connection_process_initiated(InfXmppConnection* xmpp,
   g_assert(priv->site == INF_XMPP_CONNECTION_SERVER);
   g_assert(priv->status == INF_XMPP_CONNECTION_INITIATED);
 
+  /* The client can request compression instead of TLS or authentication if
+   * we offered it. */
+  if(strcmp((const gchar*)xml->name, "compress") == 0 &&
+     inf_xmpp_connection_compression_allowed(xmpp))
+  {
+    inf_xmpp_connection_process_compress(xmpp, xml);
+    return;
+  }
+
   /* TODO: Actually, RFC 3920 specifies in 5.1.3 that we MUST offer the
    * starttls attribute if the client's stream version is at least 1.0. We
    * don't do so if security_policy is
@@ -2090,7 +3658,7 @@ inf_xmpp_connection_process_initiated(InfXmppConnection* xmpp,
 
   /* I'm not totally sure how to do this in full compliance with the RFC.
    * Maybe we can ship with a simple self-signed ad-hoc certificate. */
-  if(priv->session == NULL &&
+  if(priv->session == NULL && priv->compression == NULL &&
      priv->security_policy != INF_XMPP_CONNECTION_SECURITY_ONLY_UNSECURED)
   {
     if(strcmp((const gchar*)xml->name, "starttls") == 0)
@@ -2316,6 +3884,7 @@ inf_xmpp_connection_process_features(InfXmppConnection* xmpp,
   xmlNodePtr child;
   xmlNodePtr req;
   xmlNodePtr starttls;
+  xmlNodePtr compress;
   const char* suggestion;
   GError* error;
 
@@ -2390,7 +3959,34 @@ inf_xmpp_connection_process_features(InfXmppConnection* xmpp,
     }
   }
 
-  /* If we did not request TLS above, then go on with authentication */
+  /* If we did not request TLS above, then request compression if both
+   * sites support it. */
+  if(priv->status == INF_XMPP_CONNECTION_AWAITING_FEATURES &&
+     inf_xmpp_connection_compression_allowed(xmpp))
+  {
+    for(child = xml->children; child != NULL; child = child->next)
+      if(strcmp((const gchar*)child->name, "compression") == 0)
+        break;
+
+    if(child != NULL && inf_xmpp_connection_compression_has_zlib(child))
+    {
+      compress = inf_xmpp_connection_node_new_compress("compress");
+      xmlNewTextChild(
+        compress,
+        NULL,
+        (const xmlChar*)"method",
+        (const xmlChar*)"zlib"
+      );
+
+      inf_xmpp_connection_send_xml(xmpp, compress);
+      xmlFreeNode(compress);
+
+      priv->status = INF_XMPP_CONNECTION_COMPRESSION_REQUESTED;
+    }
+  }
+
+  /* If we did not request TLS or compression above, then go on with
+   * authentication */
   if(priv->status == INF_XMPP_CONNECTION_AWAITING_FEATURES)
   {
     for(child = xml->children; child != NULL; child = child->next)
@@ -2435,6 +4031,33 @@ inf_xmpp_connection_process_features(InfXmppConnection* xmpp,
   }
   else if(priv->status == INF_XMPP_CONNECTION_AUTH_AWAITING_FEATURES)
   {
+    inf_xmpp_connection_tls_store_session_data(xmpp);
+
+    if(priv->binary_enabled)
+    {
+      for(child = xml->children; child != NULL; child = child->next)
+        if(inf_xmpp_connection_binary_is_request(child))
+          break;
+
+      /* Everything we send after the request is binary. The server switches
+       * its incoming data at the same point. */
+      if(child != NULL)
+      {
+        req = inf_xmpp_connection_node_new(
+          "binary",
+          INF_XMPP_CONNECTION_BINARY_NS
+        );
+
+        inf_xmpp_connection_send_xml(xmpp, req);
+        xmlFreeNode(req);
+
+        if(priv->status == INF_XMPP_CONNECTION_CLOSED)
+          return;
+
+        inf_xmpp_connection_binary_start_out(xmpp);
+      }
+    }
+
     priv->status = INF_XMPP_CONNECTION_READY;
     g_object_notify(G_OBJECT(xmpp), "status");
   }
@@ -2634,9 +4257,10 @@ inf_xmpp_connection_process_authentication(InfXmppConnection* xmpp,
 
 /* This actually processes the end element after having handled some
  * special cases in sax_end_element(). */
+/* Processes a complete top-level message in priv->root, and releases it
+ * afterwards. */
 static void
-inf_xmpp_connection_process_end_element(InfXmppConnection* xmpp,
-                                        const xmlChar* name)
+inf_xmpp_connection_process_message(InfXmppConnection* xmpp)
 {
   InfXmppConnectionPrivate* priv;
   InfXmppConnectionStreamError stream_code;
@@ -2644,94 +4268,160 @@ inf_xmpp_connection_process_end_element(InfXmppConnection* xmpp,
 
   priv = INF_XMPP_CONNECTION_PRIVATE(xmpp);
 
-  g_assert(priv->cur != NULL);
-  /* This should have raised a sax_error. */
-  g_assert(strcmp((const gchar*)priv->cur->name, (const gchar*)name) == 0);
-
-  priv->cur = priv->cur->parent;
-  if(priv->cur == NULL)
+  /* Got a complete XML message */
+  if(strcmp((const gchar*)priv->root->name, "stream:error") == 0)
   {
-    /* Got a complete XML message */
-    if(strcmp((const gchar*)name, "stream:error") == 0)
+    /* Just emit error signal in this case. If the stream is supposed to
+     * be closed, a </stream:stream> should follow. */
+    stream_code = INF_XMPP_CONNECTION_STREAM_ERROR_FAILED;
+    if(priv->root->children != NULL)
     {
-      /* Just emit error signal in this case. If the stream is supposed to
-       * be closed, a </stream:stream> should follow. */
-      stream_code = INF_XMPP_CONNECTION_STREAM_ERROR_FAILED;
-      if(priv->root->children != NULL)
-      {
-        stream_code = inf_xmpp_connection_stream_error_from_condition(
-          (const gchar*)priv->root->children->name
-        );
-      }
-
-      error = NULL;
-      g_set_error_literal(
-        &error,
-        inf_xmpp_connection_stream_error_quark,
-        stream_code,
-        inf_xmpp_connection_stream_strerror(stream_code)
+      stream_code = inf_xmpp_connection_stream_error_from_condition(
+        (const gchar*)priv->root->children->name
       );
+    }
+
+    error = NULL;
+    g_set_error_literal(
+      &error,
+      inf_xmpp_connection_stream_error_quark,
+      stream_code,
+      inf_xmpp_connection_stream_strerror(stream_code)
+    );
 
-      /* TODO: Incorporate text child of the stream:error request, if any */
+    /* TODO: Incorporate text child of the stream:error request, if any */
 
-      inf_xml_connection_error(INF_XML_CONNECTION(xmpp), error);
-      g_error_free(error);
-    }
-    else
+    inf_xml_connection_error(INF_XML_CONNECTION(xmpp), error);
+    g_error_free(error);
+  }
+  else
+  {
+    switch(priv->status)
     {
-      switch(priv->status)
+    case INF_XMPP_CONNECTION_INITIATED:
+      /* The client should be waiting for <stream:stream> from the server
+       * in this state, and sax_end_element() should not have called this
+       * function. */
+      g_assert(priv->site == INF_XMPP_CONNECTION_SERVER);
+      inf_xmpp_connection_process_initiated(xmpp, priv->root);
+      break;
+    case INF_XMPP_CONNECTION_AWAITING_FEATURES:
+    case INF_XMPP_CONNECTION_AUTH_AWAITING_FEATURES:
+      /* This is a client-only state */
+      g_assert(priv->site == INF_XMPP_CONNECTION_CLIENT);
+      inf_xmpp_connection_process_features(xmpp, priv->root);
+      break;
+    case INF_XMPP_CONNECTION_ENCRYPTION_REQUESTED:
+      /* This is a client-only state */
+      g_assert(priv->site == INF_XMPP_CONNECTION_CLIENT);
+      inf_xmpp_connection_process_encryption(xmpp, priv->root);
+      break;
+    case INF_XMPP_CONNECTION_COMPRESSION_REQUESTED:
+      /* This is a client-only state */
+      g_assert(priv->site == INF_XMPP_CONNECTION_CLIENT);
+      inf_xmpp_connection_process_compression(xmpp, priv->root);
+      break;
+    case INF_XMPP_CONNECTION_AUTHENTICATING:
+      inf_xmpp_connection_process_authentication(xmpp, priv->root);
+      break;
+    case INF_XMPP_CONNECTION_READY:
+      if(inf_xmpp_connection_binary_is_request(priv->root))
       {
-      case INF_XMPP_CONNECTION_INITIATED:
-        /* The client should be waiting for <stream:stream> from the server
-         * in this state, and sax_end_element() should not have called this
-         * function. */
-        g_assert(priv->site == INF_XMPP_CONNECTION_SERVER);
-        inf_xmpp_connection_process_initiated(xmpp, priv->root);
-        break;
-      case INF_XMPP_CONNECTION_AWAITING_FEATURES:
-      case INF_XMPP_CONNECTION_AUTH_AWAITING_FEATURES:
-        /* This is a client-only state */
-        g_assert(priv->site == INF_XMPP_CONNECTION_CLIENT);
-        inf_xmpp_connection_process_features(xmpp, priv->root);
-        break;
-      case INF_XMPP_CONNECTION_ENCRYPTION_REQUESTED:
-        /* This is a client-only state */
-        g_assert(priv->site == INF_XMPP_CONNECTION_CLIENT);
-        inf_xmpp_connection_process_encryption(xmpp, priv->root);
-        break;
-      case INF_XMPP_CONNECTION_AUTHENTICATING:
-        inf_xmpp_connection_process_authentication(xmpp, priv->root);
-        break;
-      case INF_XMPP_CONNECTION_READY:
+        inf_xmpp_connection_process_binary(xmpp);
+      }
+      else
+      {
+        ++priv->messages_received;
         inf_xml_connection_received(INF_XML_CONNECTION(xmpp), priv->root);
-        break;
-      case INF_XMPP_CONNECTION_CLOSING_STREAM:
-        /* We are waiting for </stream:stream>. It can be that we receive
-         * other XML nodes from the remote side before that happens, but we
-         * ignore them here. */
-        break;
-      case INF_XMPP_CONNECTION_AUTH_INITIATED:
-        /* The client should be waiting for <stream:stream> from the server
-         * in this state, and sax_end_element should not have called this
-         * function. Also, this is a client-only state (the server goes
-         * directly to READY after having received <stream:stream>). */
-      case INF_XMPP_CONNECTION_CONNECTING:
-      case INF_XMPP_CONNECTION_CONNECTED:
-      case INF_XMPP_CONNECTION_AUTH_CONNECTED:
-      case INF_XMPP_CONNECTION_HANDSHAKING:
-      case INF_XMPP_CONNECTION_CLOSING_GNUTLS:
-      case INF_XMPP_CONNECTION_CLOSED:
-      default:
-        g_assert_not_reached();
-        break;
       }
-    }
-
-    xmlFreeNode(priv->root);
-    priv->root = NULL;
-    priv->cur = NULL;
-  }
-}
+      break;
+    case INF_XMPP_CONNECTION_CLOSING_STREAM:
+      /* We are waiting for </stream:stream>. It can be that we receive
+       * other XML nodes from the remote side before that happens, but we
+       * ignore them here. */
+      break;
+    case INF_XMPP_CONNECTION_AUTH_INITIATED:
+      /* The client should be waiting for <stream:stream> from the server
+       * in this state, and sax_end_element should not have called this
+       * function. Also, this is a client-only state (the server goes
+       * directly to READY after having received <stream:stream>). */
+    case INF_XMPP_CONNECTION_CONNECTING:
+    case INF_XMPP_CONNECTION_CONNECTED:
+    case INF_XMPP_CONNECTION_AUTH_CONNECTED:
+    case INF_XMPP_CONNECTION_HANDSHAKING:
+    case INF_XMPP_CONNECTION_CLOSING_GNUTLS:
+    case INF_XMPP_CONNECTION_CLOSED:
+    default:
+      g_assert_not_reached();
+      break;
+    }
+  }
+
+  inf_xmpp_connection_arena_reset(xmpp, TRUE);
+}
+
+static void
+inf_xmpp_connection_process_end_element(InfXmppConnection* xmpp,
+                                        const xmlChar* name)
+{
+  InfXmppConnectionPrivate* priv;
+  priv = INF_XMPP_CONNECTION_PRIVATE(xmpp);
+
+  g_assert(priv->cur != NULL);
+  /* This should have raised a sax_error. */
+  g_assert(strcmp((const gchar*)priv->cur->name, (const gchar*)name) == 0);
+
+  inf_xmpp_connection_flush_text(xmpp);
+  priv->cur = priv->cur->parent;
+  if(priv->cur == NULL)
+    inf_xmpp_connection_process_message(xmpp);
+}
+
+/* Handles </stream:stream>, or its binary equivalent */
+static void
+inf_xmpp_connection_process_stream_end(InfXmppConnection* xmpp)
+{
+  InfXmppConnectionPrivate* priv;
+  priv = INF_XMPP_CONNECTION_PRIVATE(xmpp);
+
+  switch(priv->status)
+  {
+  case INF_XMPP_CONNECTION_CLOSING_STREAM:
+    /* This is the </stream:stream> we were waiting for. */
+  case INF_XMPP_CONNECTION_AUTHENTICATING:
+    /* I think we should receive a failure first, but some evil server
+     * might send </stream:stream> directly. */
+  case INF_XMPP_CONNECTION_INITIATED:
+  case INF_XMPP_CONNECTION_AUTH_INITIATED:
+  case INF_XMPP_CONNECTION_AWAITING_FEATURES:
+  case INF_XMPP_CONNECTION_AUTH_AWAITING_FEATURES:
+  case INF_XMPP_CONNECTION_ENCRYPTION_REQUESTED:
+  case INF_XMPP_CONNECTION_COMPRESSION_REQUESTED:
+  case INF_XMPP_CONNECTION_READY:
+    /* Also terminate stream in these states */
+    inf_xmpp_connection_terminate(xmpp);
+    break;
+  case INF_XMPP_CONNECTION_CLOSED:
+  case INF_XMPP_CONNECTION_CLOSING_GNUTLS:
+    /* This can happen if the connection was terminated by start_element and
+     * the XML parser processed the corresponding end tag in the same
+     * xmlParseChunk() invocation. */
+    break;
+  case INF_XMPP_CONNECTION_CONNECTED:
+  case INF_XMPP_CONNECTION_AUTH_CONNECTED:
+    /* We should not get </stream:stream> before we got <stream:stream>,
+     * which would have caused us to change into the INITIATED state. The
+     * XML parser should have reported an error in this case. */
+  case INF_XMPP_CONNECTION_HANDSHAKING:
+    /* received_cb should not call the XML parser or the binary decoder in
+     * these states */
+  case INF_XMPP_CONNECTION_CONNECTING:
+    /* We should not even receive something in these states */
+  default:
+    g_assert_not_reached();
+    break;
+  }
+}
 
 static void
 inf_xmpp_connection_sax_start_element(void* context,
@@ -2804,6 +4494,7 @@ inf_xmpp_connection_sax_start_element(void* context,
   case INF_XMPP_CONNECTION_AWAITING_FEATURES:
   case INF_XMPP_CONNECTION_AUTH_AWAITING_FEATURES:
   case INF_XMPP_CONNECTION_ENCRYPTION_REQUESTED:
+  case INF_XMPP_CONNECTION_COMPRESSION_REQUESTED:
   case INF_XMPP_CONNECTION_AUTHENTICATING:
   case INF_XMPP_CONNECTION_READY:
     inf_xmpp_connection_process_start_element(xmpp, name, attrs);
@@ -2857,41 +4548,7 @@ inf_xmpp_connection_sax_end_element(void* context,
              priv->status == INF_XMPP_CONNECTION_CLOSING_GNUTLS ||
              priv->status == INF_XMPP_CONNECTION_CLOSED);
 
-    switch(priv->status)
-    {
-    case INF_XMPP_CONNECTION_CLOSING_STREAM:
-      /* This is the </stream:stream> we were waiting for. */
-    case INF_XMPP_CONNECTION_AUTHENTICATING:
-      /* I think we should receive a failure first, but some evil server
-       * might send </stream:stream> directly. */
-    case INF_XMPP_CONNECTION_INITIATED:
-    case INF_XMPP_CONNECTION_AUTH_INITIATED:
-    case INF_XMPP_CONNECTION_AWAITING_FEATURES:
-    case INF_XMPP_CONNECTION_AUTH_AWAITING_FEATURES:
-    case INF_XMPP_CONNECTION_ENCRYPTION_REQUESTED:
-    case INF_XMPP_CONNECTION_READY:
-      /* Also terminate stream in these states */
-      inf_xmpp_connection_terminate(xmpp);
-      break;
-    case INF_XMPP_CONNECTION_CLOSED:
-    case INF_XMPP_CONNECTION_CLOSING_GNUTLS:
-      /* This can happen if the connection was terminated by start_element and
-       * the XML parser processed the corresponding end tag in the same
-       * xmlParseChunk() invocation. */
-      break;
-    case INF_XMPP_CONNECTION_CONNECTED:
-    case INF_XMPP_CONNECTION_AUTH_CONNECTED:
-      /* We should not get </stream:stream> before we got <stream:stream>,
-       * which would have caused us to change into the INITIATED state. The
-       * XML parser should have reported an error in this case. */
-    case INF_XMPP_CONNECTION_HANDSHAKING:
-      /* received_cb should not call the XML parser in these states */
-    case INF_XMPP_CONNECTION_CONNECTING:
-      /* We should not even receive something in these states */
-    default:
-      g_assert_not_reached();
-      break;
-    }
+    inf_xmpp_connection_process_stream_end(xmpp);
   }
 }
 
@@ -2915,7 +4572,7 @@ inf_xmpp_connection_sax_characters(void* context,
   else
   {
     g_assert(priv->cur != NULL);
-    xmlNodeAddContentLen(priv->cur, content, len);
+    g_string_append_len(priv->text, (const gchar*)content, len);
   }
 }
 
@@ -3055,6 +4712,9 @@ inf_xmpp_connection_initiate(InfXmppConnection* xmpp)
   g_assert(priv->status == INF_XMPP_CONNECTION_CONNECTED ||
            priv->status == INF_XMPP_CONNECTION_AUTH_CONNECTED);
 
+  priv->restart_stream = FALSE;
+  priv->parser_fed = 0;
+
   /* Create XML parser for incoming data */
   if(priv->parser != NULL) xmlFreeParserCtxt(priv->parser);
   priv->parser = xmlCreatePushParserCtxt(
@@ -3067,10 +4727,7 @@ inf_xmpp_connection_initiate(InfXmppConnection* xmpp)
 
   /* Create XML buffer for outgoing data */
   if(priv->buf == NULL)
-  {
-    priv->buf = xmlBufferCreate();
-    priv->doc = xmlNewDoc((const xmlChar*)"1.0");
-  }
+    priv->buf = g_string_sized_new(INF_XMPP_CONNECTION_SEND_BUFFER_SIZE);
 
   if(priv->site == INF_XMPP_CONNECTION_CLIENT)
   {
@@ -3097,23 +4754,636 @@ inf_xmpp_connection_initiate(InfXmppConnection* xmpp)
   }
 }
 
-/*
- * Signal handlers.
- */
-
-static void
-inf_xmpp_connection_received_cb_sent_func(InfXmppConnection* xmpp,
-                                          gpointer user_data)
-{
-  InfXmppConnectionPrivate* priv;
-  priv = INF_XMPP_CONNECTION_PRIVATE(xmpp);
-
-  /* Terminating </stream:stream> and GnuTLS bye have been sent, so
-   * close underlaying TCP connection. This will trigger a TCP status
-   * notify. */
-  inf_tcp_connection_close(priv->tcp);
-}
-
+/*
+ * Signal handlers.
+ */
+
+/*
+ * Binary decoding of incoming messages
+ */
+
+static gboolean
+inf_xmpp_connection_binary_read_uint(const guint8** pos,
+                                     const guint8* end,
+                                     guint64* value)
+{
+  guint64 result;
+  guint shift;
+  guint8 byte;
+
+  result = 0;
+  for(shift = 0; *pos < end && shift < 64; shift += 7)
+  {
+    byte = **pos;
+    ++*pos;
+
+    result |= (guint64)(byte & 0x7f) << shift;
+    if((byte & 0x80) == 0)
+    {
+      *value = result;
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+static gboolean
+inf_xmpp_connection_binary_read_string(const guint8** pos,
+                                       const guint8* end,
+                                       const gchar** str,
+                                       gsize* len)
+{
+  guint64 length;
+
+  if(!inf_xmpp_connection_binary_read_uint(pos, end, &length))
+    return FALSE;
+  if(length > (guint64)(end - *pos))
+    return FALSE;
+
+  /* This also rejects embedded NUL characters */
+  if(!g_utf8_validate((const gchar*)*pos, length, NULL))
+    return FALSE;
+
+  *str = (const gchar*)*pos;
+  *len = length;
+  *pos += length;
+  return TRUE;
+}
+
+/* The returned name is owned by the name table, which is kept until the
+ * connection is closed, so it can be used directly in arena nodes. */
+static gboolean
+inf_xmpp_connection_binary_read_name(InfXmppConnection* xmpp,
+                                     const guint8** pos,
+                                     const guint8* end,
+                                     const xmlChar** name)
+{
+  InfXmppConnectionPrivate* priv;
+  guint64 index;
+  const gchar* str;
+  gsize len;
+
+  priv = INF_XMPP_CONNECTION_PRIVATE(xmpp);
+
+  if(!inf_xmpp_connection_binary_read_uint(pos, end, &index))
+    return FALSE;
+
+  if(index > 0)
+  {
+    if(index > priv->binary_in_names->len)
+      return FALSE;
+
+    *name = g_ptr_array_index(priv->binary_in_names, index - 1);
+    return TRUE;
+  }
+
+  if(!inf_xmpp_connection_binary_read_string(pos, end, &str, &len))
+    return FALSE;
+  if(len == 0)
+    return FALSE;
+
+  if(priv->binary_in_names->len < INF_XMPP_CONNECTION_BINARY_MAX_NAMES)
+  {
+    *name = (const xmlChar*)g_strndup(str, len);
+    g_ptr_array_add(priv->binary_in_names, (gpointer)*name);
+  }
+  else
+  {
+    *name = inf_xmpp_connection_arena_strndup(
+      xmpp,
+      (const xmlChar*)str,
+      len
+    );
+  }
+
+  return TRUE;
+}
+
+/* Decodes an attribute value into value */
+static gboolean
+inf_xmpp_connection_binary_read_value(const guint8** pos,
+                                      const guint8* end,
+                                      GString* value)
+{
+  const gchar* str;
+  gsize len;
+  guint64 count;
+  guint64 id;
+  guint64 n;
+
+  g_string_truncate(value, 0);
+  if(*pos == end)
+    return FALSE;
+
+  switch(*(*pos)++)
+  {
+  case INF_XMPP_CONNECTION_BINARY_VALUE_STRING:
+    if(!inf_xmpp_connection_binary_read_string(pos, end, &str, &len))
+      return FALSE;
+
+    g_string_append_len(value, str, len);
+    return TRUE;
+  case INF_XMPP_CONNECTION_BINARY_VALUE_NUMBER:
+    if(!inf_xmpp_connection_binary_read_uint(pos, end, &n))
+      return FALSE;
+
+    g_string_append_printf(value, "%" G_GUINT64_FORMAT, n);
+    return TRUE;
+  case INF_XMPP_CONNECTION_BINARY_VALUE_VECTOR:
+    if(!inf_xmpp_connection_binary_read_uint(pos, end, &count))
+      return FALSE;
+
+    for(; count > 0; --count)
+    {
+      if(!inf_xmpp_connection_binary_read_uint(pos, end, &id))
+        return FALSE;
+      if(!inf_xmpp_connection_binary_read_uint(pos, end, &n))
+        return FALSE;
+
+      if(value->len > 0)
+        g_string_append_c(value, ';');
+
+      g_string_append_printf(
+        value,
+        "%" G_GUINT64_FORMAT ":%" G_GUINT64_FORMAT,
+        id,
+        n
+      );
+    }
+
+    return TRUE;
+  default:
+    return FALSE;
+  }
+}
+
+static gboolean
+inf_xmpp_connection_binary_read_element(InfXmppConnection* xmpp,
+                                        const guint8** pos,
+                                        const guint8* end,
+                                        guint depth,
+                                        xmlNodePtr* result)
+{
+  InfXmppConnectionPrivate* priv;
+  xmlNodePtr node;
+  xmlNodePtr child;
+  xmlAttrPtr last_prop;
+  const xmlChar* name;
+  const gchar* text;
+  gsize len;
+  guint64 n_attrs;
+
+  priv = INF_XMPP_CONNECTION_PRIVATE(xmpp);
+
+  if(depth > INF_XMPP_CONNECTION_BINARY_MAX_DEPTH)
+    return FALSE;
+
+  if(!inf_xmpp_connection_binary_read_name(xmpp, pos, end, &name))
+    return FALSE;
+
+  node = inf_xmpp_connection_arena_node(xmpp, XML_ELEMENT_NODE, name);
+
+  if(!inf_xmpp_connection_binary_read_uint(pos, end, &n_attrs))
+    return FALSE;
+
+  last_prop = NULL;
+  for(; n_attrs > 0; --n_attrs)
+  {
+    if(!inf_xmpp_connection_binary_read_name(xmpp, pos, end, &name))
+      return FALSE;
+    if(!inf_xmpp_connection_binary_read_value(pos, end, priv->text))
+      return FALSE;
+
+    last_prop = inf_xmpp_connection_arena_prop(
+      xmpp,
+      node,
+      last_prop,
+      name,
+      (const xmlChar*)priv->text->str,
+      priv->text->len
+    );
+  }
+
+  g_string_truncate(priv->text, 0);
+
+  for(;;)
+  {
+    if(*pos == end)
+      return FALSE;
+
+    switch(*(*pos)++)
+    {
+    case INF_XMPP_CONNECTION_BINARY_END:
+      *result = node;
+      return TRUE;
+    case INF_XMPP_CONNECTION_BINARY_ELEMENT:
+      if(!inf_xmpp_connection_binary_read_element(xmpp, pos, end,
+                                                  depth + 1, &child))
+      {
+        return FALSE;
+      }
+
+      inf_xmpp_connection_arena_append(node, child);
+      break;
+    case INF_XMPP_CONNECTION_BINARY_TEXT:
+      if(!inf_xmpp_connection_binary_read_string(pos, end, &text, &len))
+        return FALSE;
+
+      if(len > 0)
+      {
+        child = inf_xmpp_connection_arena_text(
+          xmpp,
+          (const xmlChar*)text,
+          len
+        );
+
+        inf_xmpp_connection_arena_append(node, child);
+      }
+
+      break;
+    default:
+      return FALSE;
+    }
+  }
+}
+
+static void
+inf_xmpp_connection_binary_error(InfXmppConnection* xmpp)
+{
+  InfXmppConnectionPrivate* priv;
+  GError* error;
+
+  priv = INF_XMPP_CONNECTION_PRIVATE(xmpp);
+
+  error = g_error_new_literal(
+    inf_xmpp_connection_error_quark(),
+    INF_XMPP_CONNECTION_ERROR_BINARY_ENCODING_FAILURE,
+    _("The remote site sent malformed binary-encoded data")
+  );
+
+  inf_xml_connection_error(INF_XML_CONNECTION(xmpp), error);
+  g_error_free(error);
+
+  /* We cannot make sense of anything the remote site sends anymore */
+  inf_tcp_connection_close(priv->tcp);
+}
+
+/* Decodes and processes all complete records in data, and keeps the rest
+ * until more data arrives. */
+static void
+inf_xmpp_connection_binary_receive(InfXmppConnection* xmpp,
+                                   const gchar* data,
+                                   gsize len)
+{
+  InfXmppConnectionPrivate* priv;
+  const guint8* begin;
+  const guint8* end;
+  const guint8* pos;
+  const guint8* record;
+  guint64 record_len;
+  gboolean buffered;
+
+  priv = INF_XMPP_CONNECTION_PRIVATE(xmpp);
+
+  /* Only copy the data if part of a record is left over from before */
+  buffered = priv->binary_input->len > 0;
+  if(buffered)
+  {
+    g_byte_array_append(priv->binary_input, (const guint8*)data, len);
+    begin = priv->binary_input->data;
+    end = begin + priv->binary_input->len;
+  }
+  else
+  {
+    begin = (const guint8*)data;
+    end = begin + len;
+  }
+
+  pos = begin;
+  while(pos < end)
+  {
+    record = pos;
+    if(!inf_xmpp_connection_binary_read_uint(&record, end, &record_len))
+    {
+      /* Either the length itself is incomplete, or it is invalid */
+      if(end - pos >= INF_XMPP_CONNECTION_BINARY_HEADER_SIZE)
+      {
+        inf_xmpp_connection_binary_error(xmpp);
+        return;
+      }
+
+      break;
+    }
+
+    if(record_len > INF_XMPP_CONNECTION_BINARY_MAX_RECORD_SIZE)
+    {
+      g_byte_array_set_size(priv->binary_input, 0);
+
+      inf_xmpp_connection_terminate_error(
+        xmpp,
+        INF_XMPP_CONNECTION_STREAM_ERROR_POLICY_VIOLATION,
+        _("The remote site sent a message exceeding the maximum size")
+      );
+
+      return;
+    }
+
+    if(record_len > (guint64)(end - record))
+      break;
+
+    pos = record + record_len;
+
+    if(record_len == 0)
+    {
+      inf_xmpp_connection_process_stream_end(xmpp);
+    }
+    else
+    {
+      if(!inf_xmpp_connection_binary_read_element(xmpp, &record, pos, 0,
+                                                  &priv->root) ||
+         record != pos)
+      {
+        inf_xmpp_connection_arena_reset(xmpp, TRUE);
+        inf_xmpp_connection_binary_error(xmpp);
+        return;
+      }
+
+      inf_xmpp_connection_process_message(xmpp);
+    }
+
+    /* The connection might have been closed while processing */
+    if(priv->status == INF_XMPP_CONNECTION_CLOSING_GNUTLS ||
+       priv->status == INF_XMPP_CONNECTION_CLOSED)
+    {
+      return;
+    }
+  }
+
+  if(buffered)
+    g_byte_array_remove_range(priv->binary_input, 0, pos - begin);
+  else if(pos < end)
+    g_byte_array_append(priv->binary_input, pos, end - pos);
+}
+
+/* Passes decrypted and decompressed data on to the XML parser, or to the
+ * binary decoder once the remote site has switched to the binary
+ * encoding. */
+static void
+inf_xmpp_connection_feed(InfXmppConnection* xmpp,
+                         const gchar* data,
+                         gsize len)
+{
+  InfXmppConnectionPrivate* priv;
+  goffset fed;
+
+  priv = INF_XMPP_CONNECTION_PRIVATE(xmpp);
+
+  if(priv->binary_in)
+  {
+    inf_xmpp_connection_binary_receive(xmpp, data, len);
+    return;
+  }
+
+  fed = priv->parser_fed;
+  priv->parser_fed += len;
+  xmlParseChunk(priv->parser, data, len, 0);
+
+  if(priv->binary_in &&
+     priv->status != INF_XMPP_CONNECTION_CLOSING_GNUTLS &&
+     priv->status != INF_XMPP_CONNECTION_CLOSED)
+  {
+    /* The switch happened within this chunk, and the XML parser has stopped
+     * right after the element that announced it. */
+    if(priv->binary_offset < fed || priv->binary_offset > priv->parser_fed)
+      inf_xmpp_connection_binary_error(xmpp);
+    else if(priv->binary_offset < priv->parser_fed)
+      inf_xmpp_connection_binary_receive(
+        xmpp,
+        data + (priv->binary_offset - fed),
+        priv->parser_fed - priv->binary_offset
+      );
+  }
+}
+
+/* Feeds received data into the XML parser, inflating it first if the
+ * stream is compressed. */
+static void
+inf_xmpp_connection_parse(InfXmppConnection* xmpp,
+                          const gchar* data,
+                          gsize len)
+{
+  InfXmppConnectionPrivate* priv;
+  InfXmppConnectionCompression* compression;
+  guint produced;
+  GError* error;
+  int res;
+
+  priv = INF_XMPP_CONNECTION_PRIVATE(xmpp);
+  compression = priv->compression;
+
+  if(compression == NULL)
+  {
+    inf_xmpp_connection_feed(xmpp, data, len);
+    return;
+  }
+
+  compression->inflate.next_in = (Bytef*)data;
+  compression->inflate.avail_in = len;
+  priv->compression_compressed_received += len;
+
+  do
+  {
+    compression->inflate.next_out = compression->inflate_buffer;
+    compression->inflate.avail_out = sizeof(compression->inflate_buffer);
+
+    res = inflate(&compression->inflate, Z_SYNC_FLUSH);
+    if(res != Z_OK && res != Z_BUF_ERROR)
+    {
+      error = NULL;
+      g_set_error(
+        &error,
+        inf_xmpp_connection_error_quark(),
+        INF_XMPP_CONNECTION_ERROR_COMPRESSION_FAILURE,
+        _("Failed to decompress received data: %s"),
+        compression->inflate.msg != NULL ?
+          compression->inflate.msg : _("Unexpected end of stream")
+      );
+
+      inf_xml_connection_error(INF_XML_CONNECTION(xmpp), error);
+      g_error_free(error);
+
+      /* We cannot make sense of anything the remote site sends anymore */
+      inf_tcp_connection_close(priv->tcp);
+      return;
+    }
+
+    produced =
+      sizeof(compression->inflate_buffer) - compression->inflate.avail_out;
+
+    if(produced > 0)
+    {
+      priv->compression_raw_received += produced;
+      inf_xmpp_connection_feed(
+        xmpp,
+        (const char*)compression->inflate_buffer,
+        produced
+      );
+
+      if(priv->status == INF_XMPP_CONNECTION_CLOSING_GNUTLS ||
+         priv->status == INF_XMPP_CONNECTION_CLOSED)
+      {
+        return;
+      }
+    }
+  } while(compression->inflate.avail_out == 0);
+}
+
+/* Decrypts all records that can be decrypted with the data received so
+ * far, and feeds each of them into the XML parser in one piece. */
+static void
+inf_xmpp_connection_receive_records(InfXmppConnection* xmpp)
+{
+  InfXmppConnectionPrivate* priv;
+  gsize record_size;
+  ssize_t res;
+  GError* error;
+  gboolean receiving;
+
+  priv = INF_XMPP_CONNECTION_PRIVATE(xmpp);
+
+  /* Make room for a full record, so that gnutls_record_recv() does not
+   * hand out a record in several pieces. */
+  record_size = gnutls_record_get_max_size(priv->session);
+  if(priv->record_buffer_size < record_size)
+  {
+    g_free(priv->record_buffer);
+    priv->record_buffer = g_malloc(record_size);
+    priv->record_buffer_size = record_size;
+  }
+
+  receiving = TRUE;
+  while(receiving && (priv->pull_len > 0 ||
+                      gnutls_record_check_pending(priv->session) > 0))
+  {
+    res = gnutls_record_recv(
+      priv->session,
+      priv->record_buffer,
+      priv->record_buffer_size
+    );
+
+    if(res < 0)
+    {
+      /* Just try again if we were interrupted */
+      if(res != GNUTLS_E_INTERRUPTED && res != GNUTLS_E_AGAIN)
+      {
+        /* A TLS error occurred. */
+        error = NULL;
+        inf_gnutls_set_error(&error, res);
+        inf_xml_connection_error(INF_XML_CONNECTION(xmpp), error);
+        g_error_free(error);
+
+        /* We cannot assume that GnuTLS is working enough to send a
+         * final </stream:stream> or something, so just close the
+         * underlaying TCP connection. */
+        inf_tcp_connection_close(priv->tcp);
+        receiving = FALSE;
+      }
+    }
+    else if(res == 0)
+    {
+      /* Remote site sent gnutls_bye. This involves session closure. */
+      inf_tcp_connection_close(priv->tcp);
+      receiving = FALSE;
+    }
+    else
+    {
+      /* Feed decoded data into XML parser */
+      if(INF_XMPP_CONNECTION_PRINT_TRAFFIC)
+      {
+        printf(
+          "\033[00;32m%.*s\033[00;00m\n",
+          (int)res,
+          priv->record_buffer
+        );
+      }
+
+      inf_xmpp_connection_parse(xmpp, priv->record_buffer, res);
+
+      /* If the callback changed made us disconnect then don't try
+       * to read more data. */
+      if(priv->status == INF_XMPP_CONNECTION_CLOSING_GNUTLS ||
+         priv->status == INF_XMPP_CONNECTION_CLOSED)
+      {
+        receiving = FALSE;
+      }
+    }
+  }
+}
+
+static void
+inf_xmpp_connection_received_cb_sent_func(InfXmppConnection* xmpp,
+                                          gpointer user_data)
+{
+  InfXmppConnectionPrivate* priv;
+  priv = INF_XMPP_CONNECTION_PRIVATE(xmpp);
+
+  /* Terminating </stream:stream> and GnuTLS bye have been sent, so
+   * close underlaying TCP connection. This will trigger a TCP status
+   * notify. */
+  inf_tcp_connection_close(priv->tcp);
+}
+
+/* Called when done with processing received data. If the connection was
+ * closed in the meanwhile, this cleans up what could not be cleaned up
+ * while processing. */
+static void
+inf_xmpp_connection_end_parsing(InfXmppConnection* xmpp)
+{
+  InfXmppConnectionPrivate* priv;
+  priv = INF_XMPP_CONNECTION_PRIVATE(xmpp);
+
+  g_assert(priv->parsing > 0);
+  if(--priv->parsing == 0)
+  {
+    if(priv->status == INF_XMPP_CONNECTION_CLOSING_GNUTLS ||
+       priv->status == INF_XMPP_CONNECTION_CLOSED)
+    {
+      /* Status changed to CLOSING_GNUTLS, this means that someone called
+       * _terminate(). Clean up any resources in use (XML parser, GnuTLS
+       * session etc. */
+      inf_xmpp_connection_clear(xmpp);
+
+      if(priv->status != INF_XMPP_CONNECTION_CLOSED)
+      {
+        /* Close the TCP connection after remaining stuff has been sent out
+         * in case it is not closed already. */
+        inf_xmpp_connection_push_message(
+          xmpp,
+          inf_xmpp_connection_received_cb_sent_func,
+          NULL,
+          NULL
+        );
+      }
+
+      g_object_notify(G_OBJECT(xmpp), "status");
+    }
+    else if(priv->status == INF_XMPP_CONNECTION_AUTH_CONNECTED)
+    {
+      /* Reinitiate connection after successful authentication */
+      /* TODO: Only do this if status at the beginning of this call was
+       * AUTHENTICATING */
+      inf_xmpp_connection_initiate(xmpp);
+    }
+    else if(priv->status == INF_XMPP_CONNECTION_CONNECTED &&
+            priv->restart_stream == TRUE)
+    {
+      /* Reinitiate connection after compression has been negotiated */
+      inf_xmpp_connection_initiate(xmpp);
+    }
+  }
+}
+
 static void
 inf_xmpp_connection_sent_cb(InfTcpConnection* tcp,
                             gconstpointer data,
@@ -3180,10 +5450,6 @@ inf_xmpp_connection_received_cb(InfTcpConnection* tcp,
 {
   InfXmppConnection* xmpp;
   InfXmppConnectionPrivate* priv;
-  gchar buffer[2048];
-  ssize_t res;
-  GError* error;
-  gboolean receiving;
 
   xmpp = INF_XMPP_CONNECTION(user_data);
   priv = INF_XMPP_CONNECTION_PRIVATE(xmpp);
@@ -3195,6 +5461,10 @@ inf_xmpp_connection_received_cb(InfTcpConnection* tcp,
 
   g_object_ref(xmpp);
 
+  /* Collect everything we send in response to the received data, also to
+   * other connections, and send it in one go when we are done. */
+  inf_tcp_connection_begin_batch();
+
   g_assert(priv->parsing == 0);
   g_assert(priv->parser != NULL);
 
@@ -3203,118 +5473,143 @@ inf_xmpp_connection_received_cb(InfTcpConnection* tcp,
    * in that case. */
   ++priv->parsing;
 
-  /* If we have a GnuTLS session, prepare data to be read by
-   * gnutls_record_recv(). */
-  if(priv->session != NULL)
+  if(priv->status == INF_XMPP_CONNECTION_HANDSHAKING)
   {
+    /* The handshake runs in a worker thread. Queue the data for it; any
+     * data following the handshake is processed once it is done, in
+     * inf_xmpp_connection_tls_handshake_dispatch(). */
+    g_assert(priv->session != NULL);
+
+    if(priv->handshake_input == NULL)
+      priv->handshake_input = g_byte_array_new();
+    g_byte_array_append(priv->handshake_input, data, len);
+
+    inf_xmpp_connection_tls_handshake(xmpp);
+  }
+  else if(priv->session != NULL)
+  {
+    /* Prepare data to be read by gnutls_record_recv(). */
     g_assert(priv->pull_len == 0);
     priv->pull_data = data;
     priv->pull_len = len;
-  }
 
-  if(priv->status == INF_XMPP_CONNECTION_HANDSHAKING)
+    inf_xmpp_connection_receive_records(xmpp);
+  }
+  else
   {
-    g_assert(priv->session != NULL);
-    inf_xmpp_connection_tls_handshake(xmpp);
+    /* Feed input directly into XML parser */
+    if(INF_XMPP_CONNECTION_PRINT_TRAFFIC)
+      printf("\033[00;31m%.*s\033[00;00m\n", (int)len, (const char*)data);
+    inf_xmpp_connection_parse(xmpp, data, len);
   }
 
-  /* Note that this is not an else branch, since if the XMPP handshake
-   * finishes, the status will change and then we process initial data
-   * here, if any. */
-  if(priv->status != INF_XMPP_CONNECTION_HANDSHAKING &&
-     priv->status != INF_XMPP_CONNECTION_CLOSING_GNUTLS)
+  inf_xmpp_connection_end_parsing(xmpp);
+
+  inf_tcp_connection_end_batch();
+  g_object_unref(xmpp);
+}
+
+static void
+inf_xmpp_connection_tls_handshake_dispatch(gpointer user_data)
+{
+  InfXmppConnectionHandshake* handshake;
+  InfXmppConnection* xmpp;
+  InfXmppConnectionPrivate* priv;
+  GByteArray* input;
+
+  handshake = (InfXmppConnectionHandshake*)user_data;
+  xmpp = handshake->xmpp;
+  priv = INF_XMPP_CONNECTION_PRIVATE(xmpp);
+
+  g_mutex_lock(&inf_xmpp_connection_handshake_mutex);
+  handshake->dispatch = NULL;
+  g_mutex_unlock(&inf_xmpp_connection_handshake_mutex);
+
+  g_assert(priv->handshake == handshake);
+  g_assert(priv->session == handshake->session);
+  g_assert(priv->status == INF_XMPP_CONNECTION_HANDSHAKING);
+
+  /* The session belongs to the main thread again */
+  priv->handshake = NULL;
+  handshake->session = NULL;
+
+  gnutls_transport_set_ptr(priv->session, xmpp);
+
+  gnutls_transport_set_push_function(
+    priv->session,
+    inf_xmpp_connection_tls_push
+  );
+
+  gnutls_transport_set_pull_function(
+    priv->session,
+    inf_xmpp_connection_tls_pull
+  );
+
+  /* Data that the handshake did not consume comes before the data that was
+   * received while it was running. */
+  input = priv->handshake_input;
+  priv->handshake_input = NULL;
+  if(handshake->input_pos < handshake->input->len)
   {
-    if(priv->session != NULL)
+    g_byte_array_remove_range(handshake->input, 0, handshake->input_pos);
+    if(input != NULL)
     {
-      receiving = TRUE;
-      while(receiving && (priv->pull_len > 0 ||
-                          gnutls_record_check_pending(priv->session) > 0))
-      {
-        res = gnutls_record_recv(priv->session, buffer, 2048);
-        if(res < 0)
-        {
-          /* Just try again if we were interrupted */
-          if(res != GNUTLS_E_INTERRUPTED && res != GNUTLS_E_AGAIN)
-          {
-            /* A TLS error occurred. */
-            error = NULL;
-            inf_gnutls_set_error(&error, res);
-            inf_xml_connection_error(INF_XML_CONNECTION(xmpp), error);
-            g_error_free(error);
-
-            /* We cannot assume that GnuTLS is working enough to send a
-             * final </stream:stream> or something, so just close the
-             * underlaying TCP connection. */
-            inf_tcp_connection_close(priv->tcp);
-            receiving = FALSE;
-          }
-        }
-        else if(res == 0)
-        {
-          /* Remote site sent gnutls_bye. This involves session closure. */
-          inf_tcp_connection_close(priv->tcp);
-          receiving = FALSE;
-        }
-        else
-        {
-          /* Feed decoded data into XML parser */
-          if(INF_XMPP_CONNECTION_PRINT_TRAFFIC)
-            printf("\033[00;32m%.*s\033[00;00m\n", (int)res, buffer);
-          xmlParseChunk(priv->parser, buffer, res, 0);
-
-          /* If the callback changed made us disconnect then don't try
-           * to read more data. */
-          if(priv->status == INF_XMPP_CONNECTION_CLOSING_GNUTLS ||
-             priv->status == INF_XMPP_CONNECTION_CLOSED)
-          {
-            receiving = FALSE;
-          }
-        }
-      }
-    }
-    else
-    {
-      /* Feed input directly into XML parser */
-      if(INF_XMPP_CONNECTION_PRINT_TRAFFIC)
-        printf("\033[00;31m%.*s\033[00;00m\n", (int)len, (const char*)data);
-      xmlParseChunk(priv->parser, data, len, 0);
+      g_byte_array_append(handshake->input, input->data, input->len);
+      g_byte_array_free(input, TRUE);
     }
+
+    input = handshake->input;
+    handshake->input = g_byte_array_new();
   }
 
-  g_assert(priv->parsing > 0);
-  if(--priv->parsing == 0)
+  g_object_ref(xmpp);
+  inf_tcp_connection_begin_batch();
+  ++priv->parsing;
+
+  if(handshake->output->len > 0)
   {
-    if(priv->status == INF_XMPP_CONNECTION_CLOSING_GNUTLS ||
-       priv->status == INF_XMPP_CONNECTION_CLOSED)
-    {
-      /* Status changed to CLOSING_GNUTLS, this means that someone called
-       * _terminate(). Clean up any resources in use (XML parser, GnuTLS
-       * session etc. */
-      inf_xmpp_connection_clear(xmpp);
+    priv->position += handshake->output->len;
+    inf_tcp_connection_send(
+      priv->tcp,
+      handshake->output->str,
+      handshake->output->len
+    );
+  }
 
-      if(priv->status != INF_XMPP_CONNECTION_CLOSED)
-      {
-        /* Close the TCP connection after remaining stuff has been sent out
-         * in case it is not closed already. */
-        inf_xmpp_connection_push_message(
-          xmpp,
-          inf_xmpp_connection_received_cb_sent_func,
-          NULL,
-          NULL
-        );
-      }
+  inf_xmpp_connection_tls_handshake_done(xmpp, handshake);
+  inf_xmpp_connection_tls_handshake_free(handshake);
 
-      g_object_notify(G_OBJECT(xmpp), "status");
+  if(input != NULL && input->len > 0)
+  {
+    if(priv->status == INF_XMPP_CONNECTION_HANDSHAKING)
+    {
+      /* More handshake data has arrived in the meanwhile */
+      priv->handshake_input = input;
+      input = NULL;
+
+      inf_xmpp_connection_tls_handshake(xmpp);
     }
-    else if(priv->status == INF_XMPP_CONNECTION_AUTH_CONNECTED)
+    else if(priv->status != INF_XMPP_CONNECTION_CLOSING_GNUTLS &&
+            priv->status != INF_XMPP_CONNECTION_CLOSED &&
+            priv->session != NULL)
     {
-      /* Reinitiate connection after successful authentication */
-      /* TODO: Only do this if status at the beginning of this call was
-       * AUTHENTICATING */
-      inf_xmpp_connection_initiate(xmpp);
+      /* The handshake is done, process what the remote site sent after it */
+      g_assert(priv->pull_len == 0);
+      priv->pull_data = (const gchar*)input->data;
+      priv->pull_len = input->len;
+
+      inf_xmpp_connection_receive_records(xmpp);
+      priv->pull_data = NULL;
+      priv->pull_len = 0;
     }
   }
 
+  if(input != NULL)
+    g_byte_array_free(input, TRUE);
+
+  inf_xmpp_connection_end_parsing(xmpp);
+
+  inf_tcp_connection_end_batch();
   g_object_unref(xmpp);
 }
 
@@ -3367,7 +5662,7 @@ inf_xmpp_connection_notify_status_cb(InfTcpConnection* tcp,
       g_assert(priv->session == NULL);
       g_assert(priv->messages == NULL);
       g_assert(priv->parser == NULL);
-      g_assert(priv->doc == NULL);
+      g_assert(priv->buf == NULL);
       g_assert(priv->position == 0);
       g_assert(priv->sasl_session == NULL);
     }
@@ -3411,6 +5706,15 @@ inf_xmpp_connection_notify_status_cb(InfTcpConnection* tcp,
   }
 }
 
+static void
+inf_xmpp_connection_notify_congested_cb(InfTcpConnection* tcp,
+                                        GParamSpec* pspec,
+                                        gpointer user_data)
+{
+  /* Our congestion state is the one of the underlying TCP connection */
+  g_object_notify(G_OBJECT(user_data), "congested");
+}
+
 /*
  * Utility functions.
  */
@@ -3464,6 +5768,12 @@ inf_xmpp_connection_set_tcp(InfXmppConnection* xmpp,
       xmpp
     );
 
+    inf_signal_handlers_disconnect_by_func(
+      G_OBJECT(priv->tcp),
+      G_CALLBACK(inf_xmpp_connection_notify_congested_cb),
+      xmpp
+    );
+
     g_object_unref(G_OBJECT(priv->tcp));
   }
 
@@ -3501,6 +5811,13 @@ inf_xmpp_connection_set_tcp(InfXmppConnection* xmpp,
       xmpp
     );
 
+    g_signal_connect(
+      G_OBJECT(tcp),
+      "notify::congested",
+      G_CALLBACK(inf_xmpp_connection_notify_congested_cb),
+      xmpp
+    );
+
     g_object_get(G_OBJECT(tcp), "status", &tcp_status, NULL);
 
     switch(tcp_status)
@@ -3543,6 +5860,7 @@ inf_xmpp_connection_get_xml_status(InfXmppConnection* xmpp)
   case INF_XMPP_CONNECTION_AWAITING_FEATURES:
   case INF_XMPP_CONNECTION_AUTH_AWAITING_FEATURES:
   case INF_XMPP_CONNECTION_ENCRYPTION_REQUESTED:
+  case INF_XMPP_CONNECTION_COMPRESSION_REQUESTED:
   case INF_XMPP_CONNECTION_HANDSHAKING:
   case INF_XMPP_CONNECTION_AUTHENTICATING:
     return INF_XML_CONNECTION_OPENING;
@@ -3584,6 +5902,23 @@ inf_xmpp_connection_get_address_id(InfIpAddress* addr,
   return addr_id;
 }
 
+/* Connections over a Unix domain socket all have the same address and port,
+ * so the server end is identified by the socket path instead, and each
+ * client by the socket path together with its connection. */
+static gchar*
+inf_xmpp_connection_get_unix_id(InfXmppConnection* xmpp,
+                                const gchar* path,
+                                gboolean local)
+{
+  InfXmppConnectionPrivate* priv;
+  priv = INF_XMPP_CONNECTION_PRIVATE(xmpp);
+
+  if((priv->site == INF_XMPP_CONNECTION_SERVER) == local)
+    return g_strdup_printf("unix:%s", path);
+  else
+    return g_strdup_printf("unix:%s#%p", path, (void*)priv->tcp);
+}
+
 /*
  * GObject overrides
  */
@@ -3610,12 +5945,17 @@ inf_xmpp_connection_init(InfXmppConnection* connection)
   priv->messages = NULL;
   priv->last_message = NULL;
 
+  priv->messages_sent = 0;
+  priv->messages_received = 0;
+
   priv->parsing = 0;
   priv->parser = NULL;
   priv->root = NULL;
   priv->cur = NULL;
+  priv->arena = NULL;
+  priv->names = xmlDictCreate();
+  priv->text = g_string_sized_new(INF_XMPP_CONNECTION_SEND_BUFFER_SIZE);
 
-  priv->doc = NULL;
   priv->buf = NULL;
 
   priv->session = NULL;
@@ -3624,6 +5964,29 @@ inf_xmpp_connection_init(InfXmppConnection* connection)
   priv->peer_cert = NULL;
   priv->pull_data = NULL;
   priv->pull_len = 0;
+  priv->record_buffer = NULL;
+  priv->record_buffer_size = 0;
+  priv->handshake = NULL;
+  priv->handshake_input = NULL;
+  priv->session_data = NULL;
+  priv->session_resumed = FALSE;
+
+  priv->compression_enabled = FALSE;
+  priv->compression = NULL;
+  priv->restart_stream = FALSE;
+  priv->compression_raw_sent = 0;
+  priv->compression_compressed_sent = 0;
+  priv->compression_raw_received = 0;
+  priv->compression_compressed_received = 0;
+
+  priv->binary_enabled = TRUE;
+  priv->binary_in = FALSE;
+  priv->binary_out = FALSE;
+  priv->parser_fed = 0;
+  priv->binary_offset = 0;
+  priv->binary_out_names = NULL;
+  priv->binary_in_names = NULL;
+  priv->binary_input = NULL;
 
   priv->sasl_context = NULL;
   priv->sasl_own_context = NULL;
@@ -3735,6 +6098,13 @@ inf_xmpp_connection_finalize(GObject* object)
   if(priv->sasl_error)
     g_error_free(priv->sasl_error);
 
+  if(priv->session_data != NULL)
+    g_bytes_unref(priv->session_data);
+
+  inf_xmpp_connection_arena_reset(xmpp, FALSE);
+  xmlDictFree(priv->names);
+  g_string_free(priv->text, TRUE);
+
   G_OBJECT_CLASS(inf_xmpp_connection_parent_class)->finalize(object);
 }
 
@@ -3800,6 +6170,12 @@ inf_xmpp_connection_set_property(GObject* object,
     if(priv->creds != NULL) inf_certificate_credentials_unref(priv->creds);
     priv->creds = g_value_dup_boxed(value);
 
+    break;
+  case PROP_COMPRESSION:
+    priv->compression_enabled = g_value_get_boolean(value);
+    break;
+  case PROP_BINARY_ENCODING:
+    priv->binary_enabled = g_value_get_boolean(value);
     break;
   case PROP_SASL_CONTEXT:
     /* Cannot change context when currently in use */
@@ -3842,6 +6218,7 @@ inf_xmpp_connection_get_property(GObject* object,
   InfXmppConnectionPrivate* priv;
   InfIpAddress* addr;
   guint port;
+  const gchar* path;
   gchar* id;
 
   xmpp = INF_XMPP_CONNECTION(object);
@@ -3870,6 +6247,12 @@ inf_xmpp_connection_get_property(GObject* object,
   case PROP_CREDENTIALS:
     g_value_set_boxed(value, priv->creds);
     break;
+  case PROP_COMPRESSION:
+    g_value_set_boolean(value, priv->compression_enabled);
+    break;
+  case PROP_BINARY_ENCODING:
+    g_value_set_boolean(value, priv->binary_enabled);
+    break;
   case PROP_SASL_CONTEXT:
     g_value_set_boxed(value, priv->sasl_context);
     break;
@@ -3886,6 +6269,17 @@ inf_xmpp_connection_get_property(GObject* object,
     /* TODO: Perhaps we could also use JIDs here, but we have to make sure
      * then that they are unique within the whole network, which is
      * not so easy, and address/port serves the purpose equally well. */
+    path = inf_tcp_connection_get_unix_path(priv->tcp);
+    if(path != NULL)
+    {
+      g_value_take_string(
+        value,
+        inf_xmpp_connection_get_unix_id(xmpp, path, TRUE)
+      );
+
+      break;
+    }
+
     g_object_get(
       G_OBJECT(priv->tcp),
       "local-address", &addr,
@@ -3899,6 +6293,17 @@ inf_xmpp_connection_get_property(GObject* object,
     g_value_take_string(value, id);
     break;
   case PROP_REMOTE_ID:
+    path = inf_tcp_connection_get_unix_path(priv->tcp);
+    if(path != NULL)
+    {
+      g_value_take_string(
+        value,
+        inf_xmpp_connection_get_unix_id(xmpp, path, FALSE)
+      );
+
+      break;
+    }
+
     addr = inf_tcp_connection_get_remote_address(priv->tcp);
     port = inf_tcp_connection_get_remote_port(priv->tcp);
     id = inf_xmpp_connection_get_address_id(addr, port);
@@ -3910,6 +6315,12 @@ inf_xmpp_connection_get_property(GObject* object,
   case PROP_REMOTE_CERTIFICATE:
     g_value_set_boxed(value, priv->peer_cert);
     break;
+  case PROP_CONGESTED:
+    if(priv->tcp != NULL)
+      g_value_set_boolean(value, inf_tcp_connection_get_congested(priv->tcp));
+    else
+      g_value_set_boolean(value, FALSE);
+    break;
   default:
     G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
     break;
@@ -4006,6 +6417,7 @@ inf_xmpp_connection_xml_connection_close(InfXmlConnection* connection)
   case INF_XMPP_CONNECTION_AUTH_INITIATED:
   case INF_XMPP_CONNECTION_AWAITING_FEATURES:
   case INF_XMPP_CONNECTION_AUTH_AWAITING_FEATURES:
+  case INF_XMPP_CONNECTION_COMPRESSION_REQUESTED:
   case INF_XMPP_CONNECTION_READY:
     inf_xmpp_connection_deinitiate(INF_XMPP_CONNECTION(connection));
     break;
@@ -4024,6 +6436,7 @@ inf_xmpp_connection_xml_connection_send(InfXmlConnection* connection,
 
   g_assert(priv->status == INF_XMPP_CONNECTION_READY);
 
+  ++priv->messages_sent;
   inf_xmpp_connection_send_xml(INF_XMPP_CONNECTION(connection), xml);
 
   /* It can happen that while calling inf_xmpp_connection_send_xml we
@@ -4044,6 +6457,32 @@ inf_xmpp_connection_xml_connection_send(InfXmlConnection* connection,
   }
 }
 
+static void
+inf_xmpp_connection_xml_connection_get_statistics(
+  InfXmlConnection* connection,
+  InfXmlConnectionStatistics* statistics)
+{
+  InfXmppConnectionPrivate* priv;
+  priv = INF_XMPP_CONNECTION_PRIVATE(connection);
+
+  /* Byte counts are taken from the TCP connection, so they include the
+   * XMPP stream itself and the TLS and compression overhead. */
+  if(priv->tcp != NULL)
+  {
+    inf_tcp_connection_get_statistics(
+      priv->tcp,
+      &statistics->bytes_sent,
+      &statistics->bytes_received
+    );
+
+    statistics->send_queue_length =
+      inf_tcp_connection_get_send_queue_length(priv->tcp);
+  }
+
+  statistics->messages_sent = priv->messages_sent;
+  statistics->messages_received = priv->messages_received;
+}
+
 /*
  * GObject type registration
  */
@@ -4154,6 +6593,31 @@ inf_xmpp_connection_class_init(InfXmppConnectionClass* xmpp_class)
     )
   );
 
+  g_object_class_install_property(
+    object_class,
+    PROP_COMPRESSION,
+    g_param_spec_boolean(
+      "compression",
+      "Compression",
+      "Whether to compress the stream if the remote site supports it",
+      FALSE,
+      G_PARAM_READWRITE | G_PARAM_CONSTRUCT
+    )
+  );
+
+  g_object_class_install_property(
+    object_class,
+    PROP_BINARY_ENCODING,
+    g_param_spec_boolean(
+      "binary-encoding",
+      "Binary encoding",
+      "Whether to exchange messages in a binary encoding instead of XML if "
+      "the remote site supports it",
+      TRUE,
+      G_PARAM_READWRITE | G_PARAM_CONSTRUCT
+    )
+  );
+
   g_object_class_install_property(
     object_class,
     PROP_SASL_CONTEXT,
@@ -4194,6 +6658,8 @@ inf_xmpp_connection_class_init(InfXmppConnectionClass* xmpp_class)
     PROP_REMOTE_CERTIFICATE,
     "remote-certificate"
   );
+
+  g_object_class_override_property(object_class, PROP_CONGESTED, "congested");
 }
 
 static void
@@ -4203,6 +6669,7 @@ inf_xmpp_connection_xml_connection_iface_init(
   iface->open = inf_xmpp_connection_xml_connection_open;
   iface->close = inf_xmpp_connection_xml_connection_close;
   iface->send = inf_xmpp_connection_xml_connection_send;
+  iface->get_statistics = inf_xmpp_connection_xml_connection_get_statistics;
 }
 
 /*
@@ -4497,6 +6964,156 @@ inf_xmpp_connection_get_dh_prime_bits(InfXmppConnection* xmpp)
   return (guint)bits;
 }
 
+/**
+ * inf_xmpp_connection_get_tls_resumed:
+ * @xmpp: A #InfXmppConnection.
+ *
+ * Returns whether the TLS handshake of @xmpp resumed a previous session
+ * instead of making a full handshake. This function can only be used if
+ * inf_xmpp_connection_get_tls_enabled() returns true.
+ *
+ * Returns: %TRUE if the TLS session was resumed, or %FALSE otherwise.
+ */
+gboolean
+inf_xmpp_connection_get_tls_resumed(InfXmppConnection* xmpp)
+{
+  g_return_val_if_fail(INF_IS_XMPP_CONNECTION(xmpp), FALSE);
+  g_return_val_if_fail(inf_xmpp_connection_get_tls_enabled(xmpp), FALSE);
+
+  return INF_XMPP_CONNECTION_PRIVATE(xmpp)->session_resumed;
+}
+
+/**
+ * inf_xmpp_connection_get_tls_session_data:
+ * @xmpp: A client-side #InfXmppConnection.
+ *
+ * Returns the parameters of the last TLS session of @xmpp, which allow the
+ * session to be resumed by a later connection to the same server. They
+ * become available when the connection has been fully established, and
+ * stay available after it has been closed again. If @xmpp is reopened, it
+ * automatically offers the server to resume the session.
+ *
+ * The data can be passed to inf_xmpp_connection_set_tls_session_data() of
+ * another connection to the same server. It contains the session's secret
+ * key material, so it should not be made accessible to anyone else.
+ *
+ * Returns: (transfer none) (allow-none): The session data of @xmpp, or
+ * %NULL if no session has been established yet.
+ */
+GBytes*
+inf_xmpp_connection_get_tls_session_data(InfXmppConnection* xmpp)
+{
+  g_return_val_if_fail(INF_IS_XMPP_CONNECTION(xmpp), NULL);
+  return INF_XMPP_CONNECTION_PRIVATE(xmpp)->session_data;
+}
+
+/**
+ * inf_xmpp_connection_set_tls_session_data:
+ * @xmpp: A client-side #InfXmppConnection.
+ * @data: (allow-none): Session data obtained by
+ * inf_xmpp_connection_get_tls_session_data(), or %NULL.
+ *
+ * Sets the TLS session which @xmpp offers the server to resume in its next
+ * TLS handshake. If the server accepts it, the certificate exchange and
+ * the key agreement of a full handshake are skipped. Otherwise, or if
+ * @data is %NULL, a full handshake is made.
+ */
+void
+inf_xmpp_connection_set_tls_session_data(InfXmppConnection* xmpp,
+                                         GBytes* data)
+{
+  InfXmppConnectionPrivate* priv;
+
+  g_return_if_fail(INF_IS_XMPP_CONNECTION(xmpp));
+
+  priv = INF_XMPP_CONNECTION_PRIVATE(xmpp);
+  g_return_if_fail(priv->site == INF_XMPP_CONNECTION_CLIENT);
+
+  if(data != NULL)
+    g_bytes_ref(data);
+  if(priv->session_data != NULL)
+    g_bytes_unref(priv->session_data);
+
+  priv->session_data = data;
+}
+
+/**
+ * inf_xmpp_connection_get_compression_statistics:
+ * @xmpp: A #InfXmppConnection.
+ * @raw_sent: (out) (allow-none): Location to store the number of bytes
+ * that were compressed for sending, or %NULL.
+ * @compressed_sent: (out) (allow-none): Location to store the number of
+ * bytes sent after compression, or %NULL.
+ * @raw_received: (out) (allow-none): Location to store the number of bytes
+ * received after decompression, or %NULL.
+ * @compressed_received: (out) (allow-none): Location to store the number of
+ * compressed bytes received, or %NULL.
+ *
+ * Returns how much data has been transferred in compressed form since
+ * stream compression was negotiated for @xmpp, see the
+ * #InfXmppConnection:compression property. The byte counts refer to the
+ * data below the XML layer but above TLS, and are zero if the stream is not
+ * compressed.
+ *
+ * Returns: %TRUE if the stream of @xmpp is compressed, or %FALSE otherwise.
+ */
+gboolean
+inf_xmpp_connection_get_compression_statistics(InfXmppConnection* xmpp,
+                                               guint64* raw_sent,
+                                               guint64* compressed_sent,
+                                               guint64* raw_received,
+                                               guint64* compressed_received)
+{
+  InfXmppConnectionPrivate* priv;
+
+  g_return_val_if_fail(INF_IS_XMPP_CONNECTION(xmpp), FALSE);
+
+  priv = INF_XMPP_CONNECTION_PRIVATE(xmpp);
+
+  if(priv->compression == NULL)
+  {
+    if(raw_sent != NULL) *raw_sent = 0;
+    if(compressed_sent != NULL) *compressed_sent = 0;
+    if(raw_received != NULL) *raw_received = 0;
+    if(compressed_received != NULL) *compressed_received = 0;
+    return FALSE;
+  }
+
+  if(raw_sent != NULL)
+    *raw_sent = priv->compression_raw_sent;
+  if(compressed_sent != NULL)
+    *compressed_sent = priv->compression_compressed_sent;
+  if(raw_received != NULL)
+    *raw_received = priv->compression_raw_received;
+  if(compressed_received != NULL)
+    *compressed_received = priv->compression_compressed_received;
+
+  return TRUE;
+}
+
+/**
+ * inf_xmpp_connection_get_binary_encoding_active:
+ * @xmpp: A #InfXmppConnection.
+ *
+ * Returns whether messages are exchanged with the remote site in the binary
+ * encoding, see the #InfXmppConnection:binary-encoding property. This is
+ * decided once authentication has completed. For a client, it only becomes
+ * %TRUE when the server has confirmed the switch, which can be shortly after
+ * the connection has become open.
+ *
+ * Returns: Whether @xmpp uses the binary encoding in both directions.
+ */
+gboolean
+inf_xmpp_connection_get_binary_encoding_active(InfXmppConnection* xmpp)
+{
+  InfXmppConnectionPrivate* priv;
+
+  g_return_val_if_fail(INF_IS_XMPP_CONNECTION(xmpp), FALSE);
+
+  priv = INF_XMPP_CONNECTION_PRIVATE(xmpp);
+  return priv->binary_in && priv->binary_out;
+}
+
 /**
  * inf_xmpp_connection_set_certificate_callback:
  * @xmpp: A #InfXmppConnection.
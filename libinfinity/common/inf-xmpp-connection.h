@@ -107,6 +107,10 @@ typedef enum _InfXmppConnectionSecurityPolicy {
  * provide any authentication mechanisms.
  * @INF_XMPP_CONNECTION_ERROR_NO_SUITABLE_MECHANISM: The server does not offer
  * a suitable authentication mechanism that is accepted by the client.
+ * @INF_XMPP_CONNECTION_ERROR_COMPRESSION_FAILURE: Stream compression could
+ * not be set up, or the compressed data received is corrupt.
+ * @INF_XMPP_CONNECTION_ERROR_BINARY_ENCODING_FAILURE: The remote site sent
+ * data in the binary encoding that could not be decoded.
  * @INF_XMPP_CONNECTION_ERROR_FAILED: General error code for otherwise
  * unknown errors.
  *
@@ -121,6 +125,8 @@ typedef enum _InfXmppConnectionError {
   INF_XMPP_CONNECTION_ERROR_CERTIFICATE_NOT_TRUSTED,
   INF_XMPP_CONNECTION_ERROR_AUTHENTICATION_UNSUPPORTED,
   INF_XMPP_CONNECTION_ERROR_NO_SUITABLE_MECHANISM,
+  INF_XMPP_CONNECTION_ERROR_COMPRESSION_FAILURE,
+  INF_XMPP_CONNECTION_ERROR_BINARY_ENCODING_FAILURE,
 
   INF_XMPP_CONNECTION_ERROR_FAILED
 } InfXmppConnectionError;
@@ -350,6 +356,26 @@ inf_xmpp_connection_get_tls_protocol(InfXmppConnection* xmpp);
 guint
 inf_xmpp_connection_get_dh_prime_bits(InfXmppConnection* xmpp);
 
+gboolean
+inf_xmpp_connection_get_tls_resumed(InfXmppConnection* xmpp);
+
+GBytes*
+inf_xmpp_connection_get_tls_session_data(InfXmppConnection* xmpp);
+
+void
+inf_xmpp_connection_set_tls_session_data(InfXmppConnection* xmpp,
+                                         GBytes* data);
+
+gboolean
+inf_xmpp_connection_get_compression_statistics(InfXmppConnection* xmpp,
+                                               guint64* raw_sent,
+                                               guint64* compressed_sent,
+                                               guint64* raw_received,
+                                               guint64* compressed_received);
+
+gboolean
+inf_xmpp_connection_get_binary_encoding_active(InfXmppConnection* xmpp);
+
 void
 inf_xmpp_connection_set_certificate_callback(InfXmppConnection* xmpp,
                                              gnutls_certificate_request_t req,
@@ -51,6 +51,11 @@
  * name resolver. Once the hostname has been looked up, and if another
  * connection with the same address and port number exists already, the new
  * connection is removed in favor of the already existing one.
+ *
+ * For client-side connections, the XMPP manager also remembers the TLS
+ * session established with each host. When a new connection to the same
+ * host is added, it offers the server to resume that session, which makes
+ * reconnecting considerably cheaper than a full TLS handshake.
  */
 
 typedef enum _InfXmppManagerKeyKind {
@@ -89,6 +94,8 @@ struct _InfXmppManagerConnectionInfo {
 typedef struct _InfXmppManagerPrivate InfXmppManagerPrivate;
 struct _InfXmppManagerPrivate {
   GTree* connections;
+  /* Remote hostname -> GBytes with TLS session data */
+  GHashTable* sessions;
 };
 
 enum {
@@ -616,6 +623,80 @@ inf_xmpp_manager_notify_resolver_cb(GObject* object,
   inf_xmpp_manager_update_keys(info->manager, info, TRUE);
 }
 
+static void
+inf_xmpp_manager_notify_status_cb(GObject* object,
+                                  GParamSpec* pspec,
+                                  gpointer user_data)
+{
+  InfXmppManagerConnectionInfo* info;
+  InfXmppManagerPrivate* priv;
+  InfXmlConnectionStatus status;
+  InfXmppConnectionSite site;
+  gchar* remote_hostname;
+  GBytes* data;
+
+  info = (InfXmppManagerConnectionInfo*)user_data;
+  priv = INF_XMPP_MANAGER_PRIVATE(info->manager);
+
+  g_object_get(
+    object,
+    "status", &status,
+    "site", &site,
+    "remote-hostname", &remote_hostname,
+    NULL
+  );
+
+  /* Remember the TLS session of client connections once they are
+   * established, so that new connections to the same host can resume it. */
+  if(status == INF_XML_CONNECTION_OPEN &&
+     site == INF_XMPP_CONNECTION_CLIENT &&
+     remote_hostname != NULL)
+  {
+    data = inf_xmpp_connection_get_tls_session_data(info->xmpp);
+    if(data != NULL)
+    {
+      g_hash_table_insert(
+        priv->sessions,
+        remote_hostname,
+        g_bytes_ref(data)
+      );
+
+      remote_hostname = NULL;
+    }
+  }
+
+  g_free(remote_hostname);
+}
+
+static void
+inf_xmpp_manager_resume_session(InfXmppManager* manager,
+                                InfXmppConnection* xmpp)
+{
+  InfXmppManagerPrivate* priv;
+  InfXmppConnectionSite site;
+  gchar* remote_hostname;
+  GBytes* data;
+
+  priv = INF_XMPP_MANAGER_PRIVATE(manager);
+
+  g_object_get(
+    G_OBJECT(xmpp),
+    "site", &site,
+    "remote-hostname", &remote_hostname,
+    NULL
+  );
+
+  if(site == INF_XMPP_CONNECTION_CLIENT && remote_hostname != NULL &&
+     inf_xmpp_connection_get_tls_session_data(xmpp) == NULL)
+  {
+    data = g_hash_table_lookup(priv->sessions, remote_hostname);
+    if(data != NULL)
+      inf_xmpp_connection_set_tls_session_data(xmpp, data);
+  }
+
+  g_free(remote_hostname);
+}
+
 static InfXmppManagerConnectionInfo*
 inf_xmpp_manager_connection_info_new(InfXmppManager* manager,
                                      InfXmppConnection* xmpp)
@@ -635,6 +716,13 @@ inf_xmpp_manager_connection_info_new(InfXmppManager* manager,
   info->n_keys = 0;
   g_object_ref(xmpp);
 
+  g_signal_connect(
+    G_OBJECT(xmpp),
+    "notify::status",
+    G_CALLBACK(inf_xmpp_manager_notify_status_cb),
+    info
+  );
+
   g_signal_connect(
     G_OBJECT(tcp),
     "notify::remote-address",
@@ -690,6 +778,12 @@ inf_xmpp_manager_connection_info_free(InfXmppManagerConnectionInfo* info)
     info
   );
 
+  inf_signal_handlers_disconnect_by_func(
+    info->xmpp,
+    G_CALLBACK(inf_xmpp_manager_notify_status_cb),
+    info
+  );
+
   g_object_unref(tcp);
   g_object_unref(info->xmpp);
   g_free(info->keys);
@@ -722,6 +816,13 @@ inf_xmpp_manager_init(InfXmppManager* manager)
     inf_xmpp_manager_key_free,
     NULL
   );
+
+  priv->sessions = g_hash_table_new_full(
+    g_str_hash,
+    g_str_equal,
+    g_free,
+    (GDestroyNotify)g_bytes_unref
+  );
 }
 
 static void
@@ -745,6 +846,17 @@ inf_xmpp_manager_dispose(GObject* object)
   G_OBJECT_CLASS(inf_xmpp_manager_parent_class)->dispose(object);
 }
 
+static void
+inf_xmpp_manager_finalize(GObject* object)
+{
+  InfXmppManagerPrivate* priv;
+  priv = INF_XMPP_MANAGER_PRIVATE(object);
+
+  g_hash_table_destroy(priv->sessions);
+
+  G_OBJECT_CLASS(inf_xmpp_manager_parent_class)->finalize(object);
+}
+
 static void
 inf_xmpp_manager_class_init(InfXmppManagerClass* xmpp_manager_class)
 {
@@ -752,6 +864,7 @@ inf_xmpp_manager_class_init(InfXmppManagerClass* xmpp_manager_class)
   object_class = G_OBJECT_CLASS(xmpp_manager_class);
 
   object_class->dispose = inf_xmpp_manager_dispose;
+  object_class->finalize = inf_xmpp_manager_finalize;
   xmpp_manager_class->connection_added = NULL;
   xmpp_manager_class->connection_removed = NULL;
 
@@ -938,6 +1051,12 @@ inf_xmpp_manager_contains_connection(InfXmppManager* manager,
  * inf_xmpp_manager_lookup_connection_by_address(),
  * inf_xmpp_manager_lookup_connection_by_hostname() and
  * inf_xmpp_manager_contains_connection().
+ *
+ * If @connection is a client-side connection without a TLS session to
+ * resume, and @manager has seen a TLS session with the same remote
+ * hostname before, then @connection will offer to resume that session,
+ * see inf_xmpp_connection_set_tls_session_data(). For this to take
+ * effect, @connection should be added before its TLS handshake starts.
  */
 void
 inf_xmpp_manager_add_connection(InfXmppManager* manager,
@@ -956,6 +1075,8 @@ inf_xmpp_manager_add_connection(InfXmppManager* manager,
     inf_xmpp_manager_connection_info_free(info);
   g_return_if_fail(was_added == TRUE);
 
+  inf_xmpp_manager_resume_session(manager, connection);
+
   g_signal_emit(
     G_OBJECT(manager),
     xmpp_manager_signals[CONNECTION_ADDED],
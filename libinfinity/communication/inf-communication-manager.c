@@ -498,4 +498,22 @@ inf_communication_manager_get_factory_for(InfCommunicationManager* manager,
   return NULL;
 }
 
+/**
+ * inf_communication_manager_get_registry:
+ * @manager: A #InfCommunicationManager.
+ *
+ * Returns the #InfCommunicationRegistry that the groups created by @manager
+ * use to send and receive messages. This can be used to configure how
+ * messages to congested connections are handled, or to query congestion
+ * statistics for a connection.
+ *
+ * Returns: (transfer none): The #InfCommunicationRegistry of @manager.
+ */
+InfCommunicationRegistry*
+inf_communication_manager_get_registry(InfCommunicationManager* manager)
+{
+  g_return_val_if_fail(INF_COMMUNICATION_IS_MANAGER(manager), NULL);
+  return INF_COMMUNICATION_MANAGER_PRIVATE(manager)->registry;
+}
+
 /* vim:set et sw=2 ts=2: */
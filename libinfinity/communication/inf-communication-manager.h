@@ -23,6 +23,7 @@
 #include <libinfinity/communication/inf-communication-hosted-group.h>
 #include <libinfinity/communication/inf-communication-joined-group.h>
 #include <libinfinity/communication/inf-communication-factory.h>
+#include <libinfinity/communication/inf-communication-registry.h>
 
 #include <glib-object.h>
 
@@ -86,6 +87,9 @@ inf_communication_manager_get_factory_for(InfCommunicationManager* manager,
                                           const gchar* network,
                                           const gchar* method_name);
 
+InfCommunicationRegistry*
+inf_communication_manager_get_registry(InfCommunicationManager* manager);
+
 G_END_DECLS
 
 #endif /* __INF_COMMUNICATION_MANAGER_H__ */
@@ -34,18 +34,69 @@
  * inf_communication_method_enqueued() when sending the message cannot be
  * cancelled anymore via inf_communication_registry_cancel_messages() and
  * inf_communication_method_sent() when the message has been sent.
+ *
+ * If a connection cannot transmit data as fast as messages are sent to it,
+ * it reports to be congested via the #InfXmlConnection:congested property.
+ * Depending on #InfCommunicationRegistry:congestion-policy, the registry then
+ * holds back further messages for that connection until the congestion has
+ * cleared. The number of times a connection became congested and the number
+ * of messages held back can be queried with
+ * inf_communication_registry_get_congestion_stats(). So that a peer which
+ * stops reading cannot make the registry hold back an unbounded number of
+ * messages, the connection is closed once more than
+ * #InfCommunicationRegistry:max-held-messages messages are waiting for it.
+ *
+ * In addition, the registry records for each connection how many messages
+ * it has sent and how long each of them took from
+ * inf_communication_registry_send() until the connection reported it as
+ * sent. These, together with the current queue depths, are available via
+ * inf_communication_registry_get_statistics().
  **/
 
 #include <libinfinity/communication/inf-communication-registry.h>
 #include <libinfinity/communication/inf-communication-group-private.h>
 #include <libinfinity/common/inf-xml-util.h>
 #include <libinfinity/inf-signals.h>
+#include <libinfinity/inf-define-enum.h>
 
 #include <string.h>
 
 /* TODO: Store connection->InfCommunicationRegistryConnection hashtable,
  * store network and remote_id there, only point to in key. */
 
+static const GEnumValue inf_communication_congestion_policy_values[] = {
+  {
+    INF_COMMUNICATION_CONGESTION_POLICY_NONE,
+    "INF_COMMUNICATION_CONGESTION_POLICY_NONE",
+    "none"
+  }, {
+    INF_COMMUNICATION_CONGESTION_POLICY_PAUSE,
+    "INF_COMMUNICATION_CONGESTION_POLICY_PAUSE",
+    "pause"
+  }, {
+    0,
+    NULL,
+    NULL
+  }
+};
+
+typedef struct _InfCommunicationRegistryConnection
+  InfCommunicationRegistryConnection;
+struct _InfCommunicationRegistryConnection {
+  /* Number of registrations for this connection */
+  guint ref_count;
+  gboolean congested;
+
+  /* Statistics */
+  guint n_congestions;
+  guint n_held_messages;
+  guint64 n_sent;
+
+  /* Number of messages currently in the outer queues of all entries */
+  guint n_queued;
+  guint64 latency_histogram[INF_COMMUNICATION_REGISTRY_LATENCY_BUCKETS];
+};
+
 typedef struct _InfCommunicationRegistryKey InfCommunicationRegistryKey;
 struct _InfCommunicationRegistryKey {
   InfXmlConnection* connection;
@@ -73,6 +124,12 @@ struct _InfCommunicationRegistryEntry {
 
   xmlNodePtr enqueued_list;
   xmlNodePtr sent_list;
+
+  /* Time at which each message in the queue or the inner queue was passed
+   * to inf_communication_registry_send(), oldest first, in microseconds.
+   * Entries before send_times_begin have already been sent. */
+  GArray* send_times;
+  guint send_times_begin;
 };
 
 typedef struct _InfCommunicationRegistryForeachMethodData
@@ -87,20 +144,108 @@ typedef struct _InfCommunicationRegistryPrivate
 struct _InfCommunicationRegistryPrivate {
   GHashTable* connections;
   GHashTable* entries;
+
+  InfCommunicationCongestionPolicy congestion_policy;
+  guint max_held_messages;
+};
+
+enum {
+  PROP_0,
+
+  PROP_CONGESTION_POLICY,
+  PROP_MAX_HELD_MESSAGES
 };
 
 #define INF_COMMUNICATION_REGISTRY_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE((obj), INF_COMMUNICATION_TYPE_REGISTRY, InfCommunicationRegistryPrivate))
 
+INF_DEFINE_ENUM_TYPE(InfCommunicationCongestionPolicy, inf_communication_congestion_policy, inf_communication_congestion_policy_values)
 G_DEFINE_TYPE_WITH_CODE(InfCommunicationRegistry, inf_communication_registry, G_TYPE_OBJECT,
   G_ADD_PRIVATE(InfCommunicationRegistry))
 
 /* Maximum number of messages enqueued at the same time */
 static const guint INF_COMMUNICATION_REGISTRY_INNER_QUEUE_LIMIT = 5;
 
+/* Default maximum number of messages waiting for a congested connection */
+static const guint INF_COMMUNICATION_REGISTRY_MAX_HELD_MESSAGES = 4096;
+
+/* Returns whether messages for connection should be held back in the
+ * outer queue because the connection cannot keep up. */
+static gboolean
+inf_communication_registry_is_paused(InfCommunicationRegistry* registry,
+                                     InfXmlConnection* connection)
+{
+  InfCommunicationRegistryPrivate* priv;
+  InfCommunicationRegistryConnection* reg;
+
+  priv = INF_COMMUNICATION_REGISTRY_PRIVATE(registry);
+  if(priv->congestion_policy != INF_COMMUNICATION_CONGESTION_POLICY_PAUSE)
+    return FALSE;
+
+  /* If the connection is not registered anymore, then the remaining
+   * entries only flush their final messages. Don't hold them back. */
+  reg = g_hash_table_lookup(priv->connections, connection);
+  if(reg == NULL)
+    return FALSE;
+
+  return reg->congested;
+}
+
+static void
+inf_communication_registry_record_sent(InfCommunicationRegistry* registry,
+                                       InfCommunicationRegistryEntry* entry)
+{
+  InfCommunicationRegistryPrivate* priv;
+  InfCommunicationRegistryConnection* reg;
+  gint64 elapsed;
+  guint bucket;
+
+  priv = INF_COMMUNICATION_REGISTRY_PRIVATE(registry);
+
+  /* Messages sent while the entry is being freed are not accounted for. */
+  if(entry->send_times_begin >= entry->send_times->len)
+    return;
+
+  elapsed = g_get_monotonic_time() - g_array_index(
+    entry->send_times,
+    gint64,
+    entry->send_times_begin
+  );
+
+  ++ entry->send_times_begin;
+  if(entry->send_times_begin == entry->send_times->len)
+  {
+    g_array_set_size(entry->send_times, 0);
+    entry->send_times_begin = 0;
+  }
+  else if(entry->send_times_begin > entry->send_times->len / 2)
+  {
+    g_array_remove_range(entry->send_times, 0, entry->send_times_begin);
+    entry->send_times_begin = 0;
+  }
+
+  reg = g_hash_table_lookup(priv->connections, entry->key.connection);
+  if(reg != NULL)
+  {
+    /* Bucket 0 holds messages sent within less than a millisecond, bucket
+     * i those that took between 2^(i-1) and 2^i milliseconds. */
+    if(elapsed < 1000)
+      bucket = 0;
+    else
+      bucket = g_bit_storage((gulong)(elapsed / 1000));
+
+    if(bucket >= INF_COMMUNICATION_REGISTRY_LATENCY_BUCKETS)
+      bucket = INF_COMMUNICATION_REGISTRY_LATENCY_BUCKETS - 1;
+
+    ++ reg->n_sent;
+    ++ reg->latency_histogram[bucket];
+  }
+}
+
 static void
 inf_communication_registry_send_real(InfCommunicationRegistryEntry* entry,
                                      guint num_messages)
 {
+  InfCommunicationRegistryConnection* reg;
   InfXmlConnection* connection;
   InfXmlConnectionStatus status;
 
@@ -121,11 +266,20 @@ inf_communication_registry_send_real(InfCommunicationRegistryEntry* entry,
 
   inf_xml_util_set_attribute(container, "name", entry->key.group_name);
 
+  /* The connection is not registered anymore if the entry only flushes its
+   * final messages, and it may have been registered anew since then. */
+  reg = g_hash_table_lookup(
+    INF_COMMUNICATION_REGISTRY_PRIVATE(entry->registry)->connections,
+    entry->key.connection
+  );
+
   for(i = 0; i < num_messages && ((xml = entry->queue_begin) != NULL); ++ i)
   {
     entry->queue_begin = entry->queue_begin->next;
     if(entry->queue_begin == NULL) entry->queue_end = NULL;
     ++ entry->inner_count;
+    if(reg != NULL && reg->n_queued > 0)
+      -- reg->n_queued;
 
     xmlUnlinkNode(xml);
     xmlAddChild(container, xml);
@@ -240,6 +394,7 @@ inf_communication_registry_entry_free(gpointer data)
   if(!entry->registered)
     g_object_unref(entry->key.connection);
 
+  g_array_free(entry->send_times, TRUE);
   g_free(entry->key.publisher_id);
   g_slice_free(InfCommunicationRegistryEntry, entry);
 }
@@ -443,6 +598,7 @@ inf_communication_registry_sent_cb(InfXmlConnection* connection,
         for(cur = child->children; cur != NULL; cur = cur->next)
         {
           g_assert(entry->inner_count > 0);
+          inf_communication_registry_record_sent(registry, entry);
 
           /* Still registered */
           if(entry->activation_count > 0)
@@ -483,7 +639,8 @@ inf_communication_registry_sent_cb(InfXmlConnection* connection,
      * decreased, so we can send more messages now. */
     /* Send next bunch of messages if inner_count reached zero, meaning no
      * more messages have been enqueued, for better packing. */
-    if(entry->inner_count == 0 && entry->queue_end != NULL)
+    if(entry->inner_count == 0 && entry->queue_end != NULL &&
+       !inf_communication_registry_is_paused(registry, connection))
     {
       inf_communication_registry_send_real(
         entry,
@@ -548,24 +705,111 @@ inf_communication_registry_notify_status_cb(GObject* object,
   }
 }
 
+/* Hands held back messages for connection to the connection, after its
+ * congestion has cleared or after the congestion policy changed. */
+static void
+inf_communication_registry_resume(InfCommunicationRegistry* registry,
+                                  InfXmlConnection* connection)
+{
+  InfCommunicationRegistryPrivate* priv;
+  InfCommunicationRegistryEntry* entry;
+  InfXmlConnectionStatus status;
+  GHashTableIter iter;
+  gpointer value;
+
+  priv = INF_COMMUNICATION_REGISTRY_PRIVATE(registry);
+  g_object_ref(connection);
+
+  /* Sending messages can run arbitrary callbacks which might modify the
+   * entry table, so look up the next entry with pending messages from
+   * scratch after each send. Once an entry has been sent something, its
+   * inner count is non-zero, so that it is not picked again. */
+  do
+  {
+    g_object_get(G_OBJECT(connection), "status", &status, NULL);
+    if(status != INF_XML_CONNECTION_OPEN)
+      break;
+    if(inf_communication_registry_is_paused(registry, connection))
+      break;
+
+    entry = NULL;
+    g_hash_table_iter_init(&iter, priv->entries);
+    while(g_hash_table_iter_next(&iter, NULL, &value))
+    {
+      entry = (InfCommunicationRegistryEntry*)value;
+      if(entry->key.connection == connection &&
+         entry->inner_count == 0 && entry->queue_end != NULL)
+      {
+        break;
+      }
+
+      entry = NULL;
+    }
+
+    if(entry != NULL)
+    {
+      inf_communication_registry_send_real(
+        entry,
+        INF_COMMUNICATION_REGISTRY_INNER_QUEUE_LIMIT
+      );
+    }
+  } while(entry != NULL);
+
+  g_object_unref(connection);
+}
+
+static void
+inf_communication_registry_notify_congested_cb(GObject* object,
+                                               GParamSpec* pspec,
+                                               gpointer user_data)
+{
+  InfCommunicationRegistry* registry;
+  InfCommunicationRegistryPrivate* priv;
+  InfCommunicationRegistryConnection* reg;
+  gboolean congested;
+
+  registry = INF_COMMUNICATION_REGISTRY(user_data);
+  priv = INF_COMMUNICATION_REGISTRY_PRIVATE(registry);
+
+  reg = g_hash_table_lookup(priv->connections, object);
+  g_assert(reg != NULL);
+
+  g_object_get(object, "congested", &congested, NULL);
+  if(congested == reg->congested)
+    return;
+
+  reg->congested = congested;
+  if(congested == TRUE)
+    ++ reg->n_congestions;
+  else
+    inf_communication_registry_resume(registry, INF_XML_CONNECTION(object));
+}
+
 static void
 inf_communication_registry_add_connection(InfCommunicationRegistry* registry,
                                           InfXmlConnection* connection)
 {
   InfCommunicationRegistryPrivate* priv;
-  gpointer reg;
+  InfCommunicationRegistryConnection* reg;
 
   priv = INF_COMMUNICATION_REGISTRY_PRIVATE(registry);
   reg = g_hash_table_lookup(priv->connections, connection);
-  g_hash_table_steal(priv->connections, connection);
 
   if(reg == NULL)
   {
-    g_hash_table_insert(
-      priv->connections,
-      connection,
-      GUINT_TO_POINTER(1)
-    );
+    reg = g_slice_new(InfCommunicationRegistryConnection);
+    reg->ref_count = 1;
+    reg->n_congestions = 0;
+    reg->n_held_messages = 0;
+    reg->n_sent = 0;
+    reg->n_queued = 0;
+    memset(reg->latency_histogram, 0, sizeof(reg->latency_histogram));
+
+    g_object_get(G_OBJECT(connection), "congested", &reg->congested, NULL);
+    if(reg->congested == TRUE)
+      ++ reg->n_congestions;
+
+    g_hash_table_insert(priv->connections, connection, reg);
 
     g_object_ref(connection);
 
@@ -589,14 +833,17 @@ inf_communication_registry_add_connection(InfCommunicationRegistry* registry,
       G_CALLBACK(inf_communication_registry_notify_status_cb),
       registry
     );
+
+    g_signal_connect(
+      G_OBJECT(connection),
+      "notify::congested",
+      G_CALLBACK(inf_communication_registry_notify_congested_cb),
+      registry
+    );
   }
   else
   {
-    g_hash_table_insert(
-      priv->connections,
-      connection,
-      GUINT_TO_POINTER(1+GPOINTER_TO_UINT(reg))
-    );
+    ++ reg->ref_count;
   }
 }
 
@@ -605,26 +852,17 @@ inf_communication_registry_remove_connection(InfCommunicationRegistry* rgstry,
                                              InfXmlConnection* connection)
 {
   InfCommunicationRegistryPrivate* priv;
-  gpointer reg;
-  guint count;
+  InfCommunicationRegistryConnection* reg;
 
   priv = INF_COMMUNICATION_REGISTRY_PRIVATE(rgstry);
   reg = g_hash_table_lookup(priv->connections, connection);
   g_assert(reg != NULL);
 
-  g_hash_table_steal(priv->connections, connection);
-
-  count = GPOINTER_TO_UINT(reg);
-  if(--count > 0)
-  {
-    g_hash_table_insert(
-      priv->connections,
-      connection,
-      GUINT_TO_POINTER(count)
-    );
-  }
-  else
+  if(--reg->ref_count == 0)
   {
+    g_hash_table_remove(priv->connections, connection);
+    g_slice_free(InfCommunicationRegistryConnection, reg);
+
     inf_signal_handlers_disconnect_by_func(
       G_OBJECT(connection),
       G_CALLBACK(inf_communication_registry_received_cb),
@@ -643,6 +881,12 @@ inf_communication_registry_remove_connection(InfCommunicationRegistry* rgstry,
       rgstry
     );
 
+    inf_signal_handlers_disconnect_by_func(
+      G_OBJECT(connection),
+      G_CALLBACK(inf_communication_registry_notify_congested_cb),
+      rgstry
+    );
+
     g_object_unref(connection);
   }
 }
@@ -716,6 +960,9 @@ inf_communication_registry_init(InfCommunicationRegistry* registry)
     NULL,
     inf_communication_registry_entry_free
   );
+
+  priv->congestion_policy = INF_COMMUNICATION_CONGESTION_POLICY_NONE;
+  priv->max_held_messages = INF_COMMUNICATION_REGISTRY_MAX_HELD_MESSAGES;
 }
 
 static void
@@ -725,6 +972,7 @@ inf_communication_registry_dispose(GObject* object)
   InfCommunicationRegistryPrivate* priv;
   GHashTableIter iter;
   gpointer key;
+  gpointer value;
 
   registry = INF_COMMUNICATION_REGISTRY(object);
   priv = INF_COMMUNICATION_REGISTRY_PRIVATE(registry);
@@ -740,7 +988,7 @@ inf_communication_registry_dispose(GObject* object)
      * the signal handlers cannot be disconnected easily this way as we
      * don't have access to the registry in the FreeFunc. */
     g_hash_table_iter_init(&iter, priv->connections);
-    while(g_hash_table_iter_next(&iter, &key, NULL))
+    while(g_hash_table_iter_next(&iter, &key, &value))
     {
       inf_signal_handlers_disconnect_by_func(
         G_OBJECT(key),
@@ -760,6 +1008,13 @@ inf_communication_registry_dispose(GObject* object)
         registry
       );
 
+      inf_signal_handlers_disconnect_by_func(
+        G_OBJECT(key),
+        G_CALLBACK(inf_communication_registry_notify_congested_cb),
+        registry
+      );
+
+      g_slice_free(InfCommunicationRegistryConnection, value);
       g_object_unref(key);
     }
   }
@@ -770,6 +1025,63 @@ inf_communication_registry_dispose(GObject* object)
   G_OBJECT_CLASS(inf_communication_registry_parent_class)->dispose(object);
 }
 
+static void
+inf_communication_registry_set_property(GObject* object,
+                                        guint prop_id,
+                                        const GValue* value,
+                                        GParamSpec* pspec)
+{
+  InfCommunicationRegistry* registry;
+  registry = INF_COMMUNICATION_REGISTRY(object);
+
+  switch(prop_id)
+  {
+  case PROP_CONGESTION_POLICY:
+    inf_communication_registry_set_congestion_policy(
+      registry,
+      g_value_get_enum(value)
+    );
+
+    break;
+  case PROP_MAX_HELD_MESSAGES:
+    inf_communication_registry_set_max_held_messages(
+      registry,
+      g_value_get_uint(value)
+    );
+
+    break;
+  default:
+    G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+    break;
+  }
+}
+
+static void
+inf_communication_registry_get_property(GObject* object,
+                                        guint prop_id,
+                                        GValue* value,
+                                        GParamSpec* pspec)
+{
+  InfCommunicationRegistry* registry;
+  InfCommunicationRegistryPrivate* priv;
+
+  registry = INF_COMMUNICATION_REGISTRY(object);
+  priv = INF_COMMUNICATION_REGISTRY_PRIVATE(registry);
+
+  switch(prop_id)
+  {
+  case PROP_CONGESTION_POLICY:
+    g_value_set_enum(value, priv->congestion_policy);
+    break;
+  case PROP_MAX_HELD_MESSAGES:
+    g_value_set_uint(value, priv->max_held_messages);
+    break;
+  default:
+    G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+    break;
+  }
+}
+
 static void
 inf_communication_registry_class_init(
   InfCommunicationRegistryClass* registry_class)
@@ -778,6 +1090,36 @@ inf_communication_registry_class_init(
   object_class = G_OBJECT_CLASS(registry_class);
 
   object_class->dispose = inf_communication_registry_dispose;
+  object_class->set_property = inf_communication_registry_set_property;
+  object_class->get_property = inf_communication_registry_get_property;
+
+  g_object_class_install_property(
+    object_class,
+    PROP_CONGESTION_POLICY,
+    g_param_spec_enum(
+      "congestion-policy",
+      "Congestion policy",
+      "How to handle messages for connections which are congested",
+      INF_COMMUNICATION_TYPE_CONGESTION_POLICY,
+      INF_COMMUNICATION_CONGESTION_POLICY_NONE,
+      G_PARAM_READWRITE
+    )
+  );
+
+  g_object_class_install_property(
+    object_class,
+    PROP_MAX_HELD_MESSAGES,
+    g_param_spec_uint(
+      "max-held-messages",
+      "Maximum held messages",
+      "Maximum number of messages held back for a congested connection "
+      "before the connection is closed, or 0 for no limit",
+      0,
+      G_MAXUINT,
+      INF_COMMUNICATION_REGISTRY_MAX_HELD_MESSAGES,
+      G_PARAM_READWRITE
+    )
+  );
 }
 
 /**
@@ -865,6 +1207,9 @@ inf_communication_registry_register(InfCommunicationRegistry* registry,
     entry->enqueued_list = NULL;
     entry->sent_list = NULL;
 
+    entry->send_times = g_array_new(FALSE, FALSE, sizeof(gint64));
+    entry->send_times_begin = 0;
+
     g_object_weak_ref(
       G_OBJECT(group),
       inf_communication_registry_group_unrefed,
@@ -895,6 +1240,7 @@ inf_communication_registry_unregister(InfCommunicationRegistry* registry,
   InfCommunicationRegistryEntry* entry;
   InfXmlConnectionStatus status;
   xmlNodePtr xml;
+  gboolean flush;
 
   g_return_if_fail(INF_COMMUNICATION_IS_REGISTRY(registry));
   g_return_if_fail(INF_COMMUNICATION_IS_GROUP(group));
@@ -912,6 +1258,7 @@ inf_communication_registry_unregister(InfCommunicationRegistry* registry,
   entry = g_hash_table_lookup(priv->entries, &key);
   g_assert(entry != NULL && entry->registered == TRUE);
 
+  flush = FALSE;
   if( (entry->queue_end != NULL || entry->inner_count > 0) &&
      status != INF_XML_CONNECTION_CLOSING &&
      status != INF_XML_CONNECTION_CLOSED)
@@ -927,6 +1274,12 @@ inf_communication_registry_unregister(InfCommunicationRegistry* registry,
     /* Keep an additional reference on the connection as the connection will
      * be unregistered below. */
     g_object_ref(connection);
+
+    /* If nothing is in the inner queue, then the messages have been held
+     * back because the connection is congested. Nothing would trigger
+     * sending them after unregistration, so send them right away. */
+    if(entry->inner_count == 0)
+      flush = TRUE;
   }
   else
   {
@@ -936,6 +1289,9 @@ inf_communication_registry_unregister(InfCommunicationRegistry* registry,
 
   g_free(key.publisher_id);
   inf_communication_registry_remove_connection(registry, connection);
+
+  if(flush == TRUE)
+    inf_communication_registry_send_real(entry, G_MAXUINT);
 }
 
 /**
@@ -989,6 +1345,13 @@ inf_communication_registry_is_registered(InfCommunicationRegistry* registry,
  * called when sending the message can no longer be cancelled via
  * inf_communication_registry_cancel_messages().
  *
+ * If the connection is congested and
+ * #InfCommunicationRegistry:congestion-policy is
+ * %INF_COMMUNICATION_CONGESTION_POLICY_PAUSE, the message is held back. If
+ * this would make more than #InfCommunicationRegistry:max-held-messages
+ * messages wait for @connection, the message is dropped and @connection is
+ * closed instead, since its peer does not keep up with reading.
+ *
  * This function takes ownership of @xml.
  */
 void
@@ -1000,6 +1363,8 @@ inf_communication_registry_send(InfCommunicationRegistry* registry,
   InfCommunicationRegistryPrivate* priv;
   InfCommunicationRegistryKey key;
   InfCommunicationRegistryEntry* entry;
+  InfCommunicationRegistryConnection* reg;
+  gint64 enqueue_time;
 
   g_return_if_fail(INF_COMMUNICATION_IS_REGISTRY(registry));
   g_return_if_fail(INF_COMMUNICATION_IS_GROUP(group));
@@ -1014,6 +1379,21 @@ inf_communication_registry_send(InfCommunicationRegistry* registry,
 
   entry = g_hash_table_lookup(priv->entries, &key);
   g_assert(entry != NULL && entry->registered == TRUE);
+  g_free(key.publisher_id);
+
+  reg = g_hash_table_lookup(priv->connections, connection);
+  g_assert(reg != NULL);
+
+  if(inf_communication_registry_is_paused(registry, connection) &&
+     priv->max_held_messages > 0 && reg->n_queued >= priv->max_held_messages)
+  {
+    xmlFreeNode(xml);
+    inf_xml_connection_close(connection);
+    return;
+  }
+
+  enqueue_time = g_get_monotonic_time();
+  g_array_append_val(entry->send_times, enqueue_time);
 
   xmlUnlinkNode(xml);
   if(entry->queue_end == NULL)
@@ -1027,17 +1407,23 @@ inf_communication_registry_send(InfCommunicationRegistry* registry,
     entry->queue_end = xml;
   }
 
+  ++ reg->n_queued;
+
+  /* If the connection is congested, keep the message in the outer queue
+   * until the connection has caught up. */
+  if(inf_communication_registry_is_paused(registry, connection))
+  {
+    ++ reg->n_held_messages;
+  }
   /* If there is something in the inner queue, don't send directly but wait
    * until the message has been sent, for better packing. */
-  if(entry->inner_count == 0)
+  else if(entry->inner_count == 0)
   {
     inf_communication_registry_send_real(
       entry,
       INF_COMMUNICATION_REGISTRY_INNER_QUEUE_LIMIT - entry->inner_count
     );
   }
-
-  g_free(key.publisher_id);
 }
 
 /**
@@ -1057,6 +1443,9 @@ inf_communication_registry_cancel_messages(InfCommunicationRegistry* registry,
   InfCommunicationRegistryPrivate* priv;
   InfCommunicationRegistryKey key;
   InfCommunicationRegistryEntry* entry;
+  InfCommunicationRegistryConnection* reg;
+  xmlNodePtr xml;
+  guint n_cancelled;
 
   g_return_if_fail(INF_COMMUNICATION_IS_REGISTRY(registry));
   g_return_if_fail(INF_COMMUNICATION_IS_GROUP(group));
@@ -1071,6 +1460,21 @@ inf_communication_registry_cancel_messages(InfCommunicationRegistry* registry,
   entry = g_hash_table_lookup(priv->entries, &key);
   g_assert(entry != NULL && entry->registered == TRUE);
 
+  /* The cancelled messages are the most recently sent ones, so drop their
+   * send times from the end. */
+  n_cancelled = 0;
+  for(xml = entry->queue_begin; xml != NULL; xml = xml->next)
+    ++ n_cancelled;
+
+  g_assert(entry->send_times->len - entry->send_times_begin >= n_cancelled);
+  g_array_set_size(
+    entry->send_times,
+    entry->send_times->len - n_cancelled
+  );
+
+  reg = g_hash_table_lookup(priv->connections, connection);
+  reg->n_queued -= MIN(reg->n_queued, n_cancelled);
+
   /* TODO: Don't cancel messages prior activation? */
   xmlFreeNodeList(entry->queue_begin);
   entry->queue_begin = NULL;
@@ -1079,4 +1483,211 @@ inf_communication_registry_cancel_messages(InfCommunicationRegistry* registry,
   g_free(key.publisher_id);
 }
 
+/**
+ * inf_communication_registry_set_congestion_policy:
+ * @registry: A #InfCommunicationRegistry.
+ * @policy: The new congestion policy.
+ *
+ * Sets how messages for congested connections are handled. See
+ * #InfCommunicationCongestionPolicy for the available policies. If the
+ * policy is changed to %INF_COMMUNICATION_CONGESTION_POLICY_NONE, messages
+ * which are currently held back are sent immediately.
+ */
+void
+inf_communication_registry_set_congestion_policy(
+  InfCommunicationRegistry* registry,
+  InfCommunicationCongestionPolicy policy)
+{
+  InfCommunicationRegistryPrivate* priv;
+  GList* connections;
+  GList* item;
+
+  g_return_if_fail(INF_COMMUNICATION_IS_REGISTRY(registry));
+
+  priv = INF_COMMUNICATION_REGISTRY_PRIVATE(registry);
+  if(priv->congestion_policy == policy)
+    return;
+
+  priv->congestion_policy = policy;
+
+  if(policy == INF_COMMUNICATION_CONGESTION_POLICY_NONE)
+  {
+    connections = g_hash_table_get_keys(priv->connections);
+    for(item = connections; item != NULL; item = item->next)
+      inf_communication_registry_resume(registry, item->data);
+    g_list_free(connections);
+  }
+
+  g_object_notify(G_OBJECT(registry), "congestion-policy");
+}
+
+/**
+ * inf_communication_registry_get_congestion_policy:
+ * @registry: A #InfCommunicationRegistry.
+ *
+ * Returns how messages for congested connections are handled.
+ *
+ * Returns: The #InfCommunicationCongestionPolicy used by @registry.
+ */
+InfCommunicationCongestionPolicy
+inf_communication_registry_get_congestion_policy(
+  InfCommunicationRegistry* registry)
+{
+  g_return_val_if_fail(
+    INF_COMMUNICATION_IS_REGISTRY(registry),
+    INF_COMMUNICATION_CONGESTION_POLICY_NONE
+  );
+
+  return INF_COMMUNICATION_REGISTRY_PRIVATE(registry)->congestion_policy;
+}
+
+/**
+ * inf_communication_registry_set_max_held_messages:
+ * @registry: A #InfCommunicationRegistry.
+ * @max_held_messages: The maximum number of messages to hold back for a
+ * congested connection, or 0 for no limit.
+ *
+ * Sets how many messages @registry holds back for a congested connection
+ * under %INF_COMMUNICATION_CONGESTION_POLICY_PAUSE. If another message is
+ * sent to a connection which already has this many messages waiting, the
+ * connection is closed. The limit applies to the sum of the messages
+ * waiting in all groups the connection is registered with.
+ */
+void
+inf_communication_registry_set_max_held_messages(
+  InfCommunicationRegistry* registry,
+  guint max_held_messages)
+{
+  InfCommunicationRegistryPrivate* priv;
+
+  g_return_if_fail(INF_COMMUNICATION_IS_REGISTRY(registry));
+
+  priv = INF_COMMUNICATION_REGISTRY_PRIVATE(registry);
+  if(priv->max_held_messages == max_held_messages)
+    return;
+
+  priv->max_held_messages = max_held_messages;
+  g_object_notify(G_OBJECT(registry), "max-held-messages");
+}
+
+/**
+ * inf_communication_registry_get_max_held_messages:
+ * @registry: A #InfCommunicationRegistry.
+ *
+ * Returns the maximum number of messages held back for a congested
+ * connection, see inf_communication_registry_set_max_held_messages().
+ *
+ * Returns: The maximum number of held messages, or 0 if there is no limit.
+ */
+guint
+inf_communication_registry_get_max_held_messages(
+  InfCommunicationRegistry* registry)
+{
+  g_return_val_if_fail(INF_COMMUNICATION_IS_REGISTRY(registry), 0);
+  return INF_COMMUNICATION_REGISTRY_PRIVATE(registry)->max_held_messages;
+}
+
+/**
+ * inf_communication_registry_get_congestion_stats:
+ * @registry: A #InfCommunicationRegistry.
+ * @connection: A #InfXmlConnection.
+ * @n_congestions: (out) (allow-none): Location to store the number of times
+ * @connection became congested, or %NULL.
+ * @n_held_messages: (out) (allow-none): Location to store the number of
+ * messages which were held back because @connection was congested, or
+ * %NULL.
+ *
+ * Returns congestion statistics for @connection. The statistics are
+ * collected for as long as @connection is registered with at least one
+ * group. If @connection is not registered, the function returns %FALSE and
+ * the output parameters are left untouched.
+ *
+ * Returns: %TRUE if @connection is registered, or %FALSE otherwise.
+ */
+gboolean
+inf_communication_registry_get_congestion_stats(
+  InfCommunicationRegistry* registry,
+  InfXmlConnection* connection,
+  guint* n_congestions,
+  guint* n_held_messages)
+{
+  InfCommunicationRegistryPrivate* priv;
+  InfCommunicationRegistryConnection* reg;
+
+  g_return_val_if_fail(INF_COMMUNICATION_IS_REGISTRY(registry), FALSE);
+  g_return_val_if_fail(INF_IS_XML_CONNECTION(connection), FALSE);
+
+  priv = INF_COMMUNICATION_REGISTRY_PRIVATE(registry);
+  reg = g_hash_table_lookup(priv->connections, connection);
+  if(reg == NULL)
+    return FALSE;
+
+  if(n_congestions != NULL)
+    *n_congestions = reg->n_congestions;
+  if(n_held_messages != NULL)
+    *n_held_messages = reg->n_held_messages;
+
+  return TRUE;
+}
+
+/**
+ * inf_communication_registry_get_statistics:
+ * @registry: A #InfCommunicationRegistry.
+ * @connection: A #InfXmlConnection.
+ * @statistics: (out): Location to store the statistics for @connection.
+ *
+ * Returns traffic statistics for @connection, see
+ * #InfCommunicationRegistryStatistics. The message counts and the latency
+ * histogram are collected for as long as @connection is registered with at
+ * least one group, the queue depths are summed over all groups @connection
+ * is registered with. If @connection is not registered, the function
+ * returns %FALSE and @statistics is left untouched.
+ *
+ * Returns: %TRUE if @connection is registered, or %FALSE otherwise.
+ */
+gboolean
+inf_communication_registry_get_statistics(
+  InfCommunicationRegistry* registry,
+  InfXmlConnection* connection,
+  InfCommunicationRegistryStatistics* statistics)
+{
+  InfCommunicationRegistryPrivate* priv;
+  InfCommunicationRegistryConnection* reg;
+  InfCommunicationRegistryEntry* entry;
+  GHashTableIter iter;
+  xmlNodePtr xml;
+
+  g_return_val_if_fail(INF_COMMUNICATION_IS_REGISTRY(registry), FALSE);
+  g_return_val_if_fail(INF_IS_XML_CONNECTION(connection), FALSE);
+  g_return_val_if_fail(statistics != NULL, FALSE);
+
+  priv = INF_COMMUNICATION_REGISTRY_PRIVATE(registry);
+  reg = g_hash_table_lookup(priv->connections, connection);
+  if(reg == NULL)
+    return FALSE;
+
+  statistics->n_queued = 0;
+  statistics->n_enqueued = 0;
+  statistics->n_sent = reg->n_sent;
+
+  memcpy(
+    statistics->latency_histogram,
+    reg->latency_histogram,
+    sizeof(reg->latency_histogram)
+  );
+
+  g_hash_table_iter_init(&iter, priv->entries);
+  while(g_hash_table_iter_next(&iter, NULL, (gpointer*)&entry))
+  {
+    if(entry->key.connection == connection)
+    {
+      for(xml = entry->queue_begin; xml != NULL; xml = xml->next)
+        ++ statistics->n_queued;
+      statistics->n_enqueued += entry->inner_count;
+    }
+  }
+
+  return TRUE;
+}
+
 /* vim:set et sw=2 ts=2: */
@@ -34,9 +34,64 @@ G_BEGIN_DECLS
 #define INF_COMMUNICATION_IS_REGISTRY_CLASS(klass)      (G_TYPE_CHECK_CLASS_TYPE((klass), INF_COMMUNICATION_TYPE_REGISTRY))
 #define INF_COMMUNICATION_REGISTRY_GET_CLASS(obj)       (G_TYPE_INSTANCE_GET_CLASS((obj), INF_COMMUNICATION_TYPE_REGISTRY, InfCommunicationRegistryClass))
 
+#define INF_COMMUNICATION_TYPE_CONGESTION_POLICY        (inf_communication_congestion_policy_get_type())
+
 typedef struct _InfCommunicationRegistry InfCommunicationRegistry;
 typedef struct _InfCommunicationRegistryClass InfCommunicationRegistryClass;
 
+/**
+ * INF_COMMUNICATION_REGISTRY_LATENCY_BUCKETS:
+ *
+ * The number of buckets in the latency histogram of
+ * #InfCommunicationRegistryStatistics.
+ */
+#define INF_COMMUNICATION_REGISTRY_LATENCY_BUCKETS 16
+
+/**
+ * InfCommunicationCongestionPolicy:
+ * @INF_COMMUNICATION_CONGESTION_POLICY_NONE: Messages are handed to the
+ * connection as soon as possible, even if the connection is congested.
+ * @INF_COMMUNICATION_CONGESTION_POLICY_PAUSE: While a connection is
+ * congested, no new messages are handed to it. They are kept in the
+ * registry's queue, where they can still be cancelled with
+ * inf_communication_registry_cancel_messages(), and are sent as soon as the
+ * connection is no longer congested. If more than
+ * #InfCommunicationRegistry:max-held-messages messages are waiting, the
+ * connection is closed.
+ *
+ * Specifies how #InfCommunicationRegistry handles messages for a connection
+ * whose #InfXmlConnection:congested property is set.
+ */
+typedef enum _InfCommunicationCongestionPolicy {
+  INF_COMMUNICATION_CONGESTION_POLICY_NONE,
+  INF_COMMUNICATION_CONGESTION_POLICY_PAUSE
+} InfCommunicationCongestionPolicy;
+
+/**
+ * InfCommunicationRegistryStatistics:
+ * @n_queued: The number of messages that are waiting in the registry's
+ * queue and can still be cancelled.
+ * @n_enqueued: The number of messages that have been handed to the
+ * connection but have not yet been sent.
+ * @n_sent: The total number of messages that have been sent.
+ * @latency_histogram: The number of sent messages by the time it took from
+ * inf_communication_registry_send() until they were sent. Bucket 0 counts
+ * messages that took less than one millisecond, bucket i those that took
+ * between 2^(i-1) and 2^i milliseconds. The last bucket also counts all
+ * messages that took even longer.
+ *
+ * Per-connection traffic statistics collected by #InfCommunicationRegistry,
+ * see inf_communication_registry_get_statistics().
+ */
+typedef struct _InfCommunicationRegistryStatistics
+  InfCommunicationRegistryStatistics;
+struct _InfCommunicationRegistryStatistics {
+  guint n_queued;
+  guint n_enqueued;
+  guint64 n_sent;
+  guint64 latency_histogram[INF_COMMUNICATION_REGISTRY_LATENCY_BUCKETS];
+};
+
 /**
  * InfCommunicationRegistryClass:
  *
@@ -58,6 +113,9 @@ struct _InfCommunicationRegistry {
   GObject parent_instance;
 };
 
+GType
+inf_communication_congestion_policy_get_type(void) G_GNUC_CONST;
+
 GType
 inf_communication_registry_get_type(void) G_GNUC_CONST;
 
@@ -88,6 +146,37 @@ inf_communication_registry_cancel_messages(InfCommunicationRegistry* registry,
                                            InfCommunicationGroup* group,
                                            InfXmlConnection* connection);
 
+void
+inf_communication_registry_set_congestion_policy(
+  InfCommunicationRegistry* registry,
+  InfCommunicationCongestionPolicy policy);
+
+InfCommunicationCongestionPolicy
+inf_communication_registry_get_congestion_policy(
+  InfCommunicationRegistry* registry);
+
+void
+inf_communication_registry_set_max_held_messages(
+  InfCommunicationRegistry* registry,
+  guint max_held_messages);
+
+guint
+inf_communication_registry_get_max_held_messages(
+  InfCommunicationRegistry* registry);
+
+gboolean
+inf_communication_registry_get_congestion_stats(
+  InfCommunicationRegistry* registry,
+  InfXmlConnection* connection,
+  guint* n_congestions,
+  guint* n_held_messages);
+
+gboolean
+inf_communication_registry_get_statistics(
+  InfCommunicationRegistry* registry,
+  InfXmlConnection* connection,
+  InfCommunicationRegistryStatistics* statistics);
+
 G_END_DECLS
 
 #endif /* __INF_COMMUNICATION_REGISTRY_H__ */
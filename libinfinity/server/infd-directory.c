@@ -38,6 +38,8 @@
 #include <libinfinity/server/infd-account-storage.h>
 #include <libinfinity/server/infd-request.h>
 #include <libinfinity/server/infd-progress-request.h>
+#include <libinfinity/adopted/inf-adopted-session.h>
+#include <libinfinity/adopted/inf-adopted-user.h>
 #include <libinfinity/common/inf-session.h>
 #include <libinfinity/common/inf-chat-session.h>
 #include <libinfinity/common/inf-request-result.h>
@@ -82,6 +84,9 @@ struct _InfdDirectoryNode {
       InfIoTimeout* save_timeout;
       /* Whether we hold a weak reference or a strong reference on session */
       gboolean weakref;
+      /* Link in the priv->sessions queue while a strong reference on
+       * session is held, or NULL */
+      GList* lru_link;
     } note;
 
     struct {
@@ -99,10 +104,29 @@ struct _InfdDirectoryNode {
        * This is required because the nodes field may be NULL due to an empty
        * subdirectory or due to an unexplored subdirectory. */
       gboolean explored;
+      /* Number of child nodes */
+      guint n_children;
+      /* Index of the names of the child nodes and of the nodes that are
+       * about to be created by sync-ins and subscription requests, mapping
+       * infd_directory_node_name_key() to InfdDirectoryNameEntry. Only
+       * built for folders with many children, NULL otherwise. */
+      GHashTable* names;
     } subdir;
   } shared;
 };
 
+typedef struct _InfdDirectoryNameEntry InfdDirectoryNameEntry;
+struct _InfdDirectoryNameEntry {
+  /* A child node with this name, or NULL */
+  InfdDirectoryNode* node;
+  /* Number of child nodes with this name. This can be more than one when
+   * names read from the storage differ only in case. */
+  guint n_nodes;
+  /* Number of sync-ins and subscription requests creating a node with
+   * this name */
+  guint n_pending;
+};
+
 typedef struct _InfdDirectorySessionSaveTimeoutData
   InfdDirectorySessionSaveTimeoutData;
 struct _InfdDirectorySessionSaveTimeoutData {
@@ -122,6 +146,45 @@ struct _InfdDirectorySyncIn {
   InfdRequest* request;
 };
 
+typedef enum _InfdDirectoryLoadType {
+  INFD_DIRECTORY_LOAD_EXPLORE,
+  INFD_DIRECTORY_LOAD_SESSION
+} InfdDirectoryLoadType;
+
+/* A connection waiting for a load to finish */
+typedef struct _InfdDirectoryLoadWaiter InfdDirectoryLoadWaiter;
+struct _InfdDirectoryLoadWaiter {
+  InfXmlConnection* connection;
+  gchar* seq;
+};
+
+/* A subdirectory or a session which is being read from the storage in the
+ * background, see infd_storage_run_async(). The fields below the task are
+ * owned by the worker thread until the task has finished. */
+typedef struct _InfdDirectoryLoad InfdDirectoryLoad;
+struct _InfdDirectoryLoad {
+  InfdDirectory* directory;
+  InfdDirectoryLoadType type;
+  InfdDirectoryNode* node;
+  InfRequest* request;
+  /* Whether the request was made by a local subscription */
+  gboolean local;
+  GSList* waiters;
+  InfdStorageTask* task;
+
+  gchar* path;
+  const InfdNotePlugin* plugin;
+  GError* error;
+
+  /* INFD_DIRECTORY_LOAD_EXPLORE */
+  GSList* storage_nodes;
+  GPtrArray* storage_acls;
+
+  /* INFD_DIRECTORY_LOAD_SESSION */
+  InfBuffer* buffer;
+  InfUserTable* user_table;
+};
+
 typedef enum _InfdDirectorySubreqType {
   INFD_DIRECTORY_SUBREQ_CHAT,
   INFD_DIRECTORY_SUBREQ_SESSION,
@@ -205,6 +268,14 @@ struct _InfdDirectoryPrivate {
 
   GSList* sync_ins;
   GSList* subscription_requests;
+  GSList* loads;
+
+  /* Maximum number of bytes used by sessions, or 0 for no limit */
+  guint64 memory_budget;
+  /* Nodes with a strong reference on their session, least recently used
+   * first */
+  GQueue* sessions;
+  InfIoTimeout* memory_timeout;
 
   InfdSessionProxy* chat_session;
 };
@@ -220,6 +291,8 @@ enum {
   PROP_PRIVATE_KEY,
   PROP_CERTIFICATE,
 
+  PROP_MEMORY_BUDGET,
+
   /* read only */
   PROP_CHAT_SESSION,
   PROP_STATUS
@@ -279,6 +352,20 @@ static GQuark infd_directory_node_id_quark;
 /* TODO: This should be a property: */
 static const guint INFD_DIRECTORY_SAVE_TIMEOUT = 60000;
 
+/* Estimated number of bytes a request in a request log occupies, used to
+ * account for the memory of a session's history */
+static const guint INFD_DIRECTORY_REQUEST_SIZE = 256;
+
+/* Time after a change to a loaded session until the memory budget is
+ * checked again, so that a stream of edits does not cause a check for every
+ * single request. */
+static const guint INFD_DIRECTORY_MEMORY_CHECK_INTERVAL = 1000;
+
+/* Number of children from which on a folder keeps an index of the names of
+ * its children, so that a name can be looked up without going through all
+ * of them. */
+static const guint INFD_DIRECTORY_NAME_INDEX_THRESHOLD = 64;
+
 static void infd_directory_communication_object_iface_init(InfCommunicationObjectInterface* iface);
 static void infd_directory_browser_iface_init(InfBrowserInterface* iface);
 G_DEFINE_TYPE_WITH_CODE(InfdDirectory, infd_directory, G_TYPE_OBJECT,
@@ -367,6 +454,19 @@ infd_directory_node_make_path(InfdDirectoryNode* node,
   g_string_free(str, FALSE);
 }
 
+/* Returns the storage path of the child called name of the node at path.
+ * Other than infd_directory_node_make_path(), this does not require the
+ * parent node, so that it can be used from a storage worker thread. */
+static gchar*
+infd_directory_make_child_path(const gchar* path,
+                               const gchar* name)
+{
+  if(path[0] == '/' && path[1] == '\0')
+    return g_strconcat("/", name, NULL);
+  else
+    return g_strconcat(path, "/", name, NULL);
+}
+
 /*
  * Save timeout
  */
@@ -377,44 +477,38 @@ infd_directory_node_unlink_session(InfdDirectory* directory,
                                    InfdDirectoryNode* node,
                                    InfdRequest* request);
 
-static void
-infd_directory_session_save_timeout_data_free(gpointer data)
-{
-  g_slice_free(InfdDirectorySessionSaveTimeoutData, data);
-}
-
-static void
-infd_directory_session_save_timeout_func(gpointer user_data)
+/* Writes the session of node into the storage and drops it from memory.
+ * If writing fails the session is kept. */
+static gboolean
+infd_directory_node_unload_session(InfdDirectory* directory,
+                                   InfdDirectoryNode* node)
 {
-  InfdDirectorySessionSaveTimeoutData* timeout_data;
   InfdDirectoryPrivate* priv;
   GError* error;
   gchar* path;
   gboolean result;
   InfSession* session;
 
-  timeout_data = (InfdDirectorySessionSaveTimeoutData*)user_data;
-
-  g_assert(timeout_data->node->type == INFD_DIRECTORY_NODE_NOTE);
-  g_assert(timeout_data->node->shared.note.save_timeout != NULL);
-  priv = INFD_DIRECTORY_PRIVATE(timeout_data->directory);
+  g_assert(node->type == INFD_DIRECTORY_NODE_NOTE);
+  g_assert(node->shared.note.save_timeout == NULL);
+  priv = INFD_DIRECTORY_PRIVATE(directory);
   error = NULL;
 
-  infd_directory_node_get_path(timeout_data->node, &path, NULL);
+  infd_directory_node_get_path(node, &path, NULL);
 
   g_object_get(
-    G_OBJECT(timeout_data->node->shared.note.session),
+    G_OBJECT(node->shared.note.session),
     "session", &session,
     NULL
   );
 
   /* TODO: Only write if the buffer modified-flag is set */
 
-  result = timeout_data->node->shared.note.plugin->session_write(
+  result = node->shared.note.plugin->session_write(
     priv->storage,
     session,
     path,
-    timeout_data->node->shared.note.plugin->user_data,
+    node->shared.note.plugin->user_data,
     &error
   );
 
@@ -422,9 +516,6 @@ infd_directory_session_save_timeout_func(gpointer user_data)
 
   /* TODO: Unset modified flag of buffer if result == TRUE */
 
-  /* The timeout is removed automatically after it has elapsed */
-  timeout_data->node->shared.note.save_timeout = NULL;
-
   if(result == FALSE)
   {
     g_warning(
@@ -438,14 +529,35 @@ infd_directory_session_save_timeout_func(gpointer user_data)
   }
   else
   {
-    infd_directory_node_unlink_session(
-      timeout_data->directory,
-      timeout_data->node,
-      NULL
-    );
+    infd_directory_node_unlink_session(directory, node, NULL);
   }
 
   g_free(path);
+  return result;
+}
+
+static void
+infd_directory_session_save_timeout_data_free(gpointer data)
+{
+  g_slice_free(InfdDirectorySessionSaveTimeoutData, data);
+}
+
+static void
+infd_directory_session_save_timeout_func(gpointer user_data)
+{
+  InfdDirectorySessionSaveTimeoutData* timeout_data;
+  timeout_data = (InfdDirectorySessionSaveTimeoutData*)user_data;
+
+  g_assert(timeout_data->node->type == INFD_DIRECTORY_NODE_NOTE);
+  g_assert(timeout_data->node->shared.note.save_timeout != NULL);
+
+  /* The timeout is removed automatically after it has elapsed */
+  timeout_data->node->shared.note.save_timeout = NULL;
+
+  infd_directory_node_unload_session(
+    timeout_data->directory,
+    timeout_data->node
+  );
 }
 
 static void
@@ -472,6 +584,278 @@ infd_directory_start_session_save_timeout(InfdDirectory* directory,
   }
 }
 
+/*
+ * Memory budget
+ */
+
+static void
+infd_directory_request_log_size_foreach_func(InfUser* user,
+                                             gpointer user_data)
+{
+  InfAdoptedRequestLog* log;
+  guint64* n_requests;
+
+  n_requests = (guint64*)user_data;
+
+  if(INF_ADOPTED_IS_USER(user))
+  {
+    log = inf_adopted_user_get_request_log(INF_ADOPTED_USER(user));
+
+    *n_requests += inf_adopted_request_log_get_end(log) -
+      inf_adopted_request_log_get_begin(log);
+  }
+}
+
+/* Estimates the memory used by the session of node, from the size of its
+ * buffer and the number of requests in its request logs. */
+static guint64
+infd_directory_node_get_memory_usage(InfdDirectoryNode* node)
+{
+  const InfdNotePlugin* plugin;
+  InfSession* session;
+  guint64 n_requests;
+  guint64 usage;
+
+  g_assert(node->type == INFD_DIRECTORY_NODE_NOTE);
+  g_assert(node->shared.note.session != NULL);
+
+  plugin = node->shared.note.plugin;
+  usage = 0;
+
+  g_object_get(
+    G_OBJECT(node->shared.note.session),
+    "session", &session,
+    NULL
+  );
+
+  if(plugin->buffer_size != NULL)
+    usage += plugin->buffer_size(inf_session_get_buffer(session),
+                                 plugin->user_data);
+
+  if(INF_ADOPTED_IS_SESSION(session))
+  {
+    n_requests = 0;
+
+    inf_user_table_foreach_user(
+      inf_session_get_user_table(session),
+      infd_directory_request_log_size_foreach_func,
+      &n_requests
+    );
+
+    usage += n_requests * INFD_DIRECTORY_REQUEST_SIZE;
+  }
+
+  g_object_unref(session);
+  return usage;
+}
+
+/* Marks the session of node as the most recently used one */
+static void
+infd_directory_node_touch_session(InfdDirectory* directory,
+                                  InfdDirectoryNode* node)
+{
+  InfdDirectoryPrivate* priv;
+  priv = INFD_DIRECTORY_PRIVATE(directory);
+
+  g_assert(node->type == INFD_DIRECTORY_NODE_NOTE);
+  g_assert(node->shared.note.weakref == FALSE);
+
+  if(node->shared.note.lru_link != NULL)
+  {
+    g_queue_unlink(priv->sessions, node->shared.note.lru_link);
+    g_queue_push_tail_link(priv->sessions, node->shared.note.lru_link);
+  }
+  else
+  {
+    g_queue_push_tail(priv->sessions, node);
+    node->shared.note.lru_link = g_queue_peek_tail_link(priv->sessions);
+  }
+}
+
+static void
+infd_directory_node_forget_session(InfdDirectory* directory,
+                                   InfdDirectoryNode* node)
+{
+  InfdDirectoryPrivate* priv;
+  priv = INFD_DIRECTORY_PRIVATE(directory);
+
+  g_assert(node->type == INFD_DIRECTORY_NODE_NOTE);
+
+  if(node->shared.note.lru_link != NULL)
+  {
+    g_queue_delete_link(priv->sessions, node->shared.note.lru_link);
+    node->shared.note.lru_link = NULL;
+  }
+}
+
+static void
+infd_directory_memory_timeout_func(gpointer user_data)
+{
+  InfdDirectory* directory;
+  InfdDirectoryPrivate* priv;
+  InfdDirectoryNode* node;
+  GList* item;
+  GList* next;
+  guint64 usage;
+  guint64 node_usage;
+
+  directory = INFD_DIRECTORY(user_data);
+  priv = INFD_DIRECTORY_PRIVATE(directory);
+
+  /* The timeout is removed automatically after it has elapsed */
+  priv->memory_timeout = NULL;
+
+  if(priv->memory_budget == 0 || priv->storage == NULL)
+    return;
+
+  usage = infd_directory_get_memory_usage(directory);
+
+  /* Unload idle sessions, least recently used first, until we are within
+   * the budget again. Sessions with subscribed connections or running
+   * synchronizations are kept, since dropping them would disconnect their
+   * users. */
+  for(item = priv->sessions->head;
+      item != NULL && usage > priv->memory_budget;
+      item = next)
+  {
+    /* Unloading the session removes item from the queue */
+    next = item->next;
+    node = (InfdDirectoryNode*)item->data;
+
+    if(infd_session_proxy_is_idle(node->shared.note.session))
+    {
+      node_usage = infd_directory_node_get_memory_usage(node);
+
+      if(node->shared.note.save_timeout != NULL)
+      {
+        inf_io_remove_timeout(priv->io, node->shared.note.save_timeout);
+        node->shared.note.save_timeout = NULL;
+      }
+
+      if(infd_directory_node_unload_session(directory, node))
+        usage -= node_usage;
+    }
+  }
+}
+
+/* Checks whether the memory budget is exceeded, after delay milliseconds.
+ * If a check is already scheduled, no additional one is made. */
+static void
+infd_directory_schedule_memory_check(InfdDirectory* directory,
+                                     guint delay)
+{
+  InfdDirectoryPrivate* priv;
+  priv = INFD_DIRECTORY_PRIVATE(directory);
+
+  if(priv->memory_budget != 0 && priv->memory_timeout == NULL &&
+     priv->io != NULL)
+  {
+    priv->memory_timeout = inf_io_add_timeout(
+      priv->io,
+      delay,
+      infd_directory_memory_timeout_func,
+      directory,
+      NULL
+    );
+  }
+}
+
+static void
+infd_directory_session_end_execute_request_cb(InfAdoptedAlgorithm* algorithm,
+                                              InfAdoptedUser* user,
+                                              InfAdoptedRequest* request,
+                                              InfAdoptedRequest* translated,
+                                              const GError* error,
+                                              gpointer user_data)
+{
+  /* The session might have grown, which can push other sessions out of the
+   * budget. */
+  infd_directory_schedule_memory_check(
+    INFD_DIRECTORY(user_data),
+    INFD_DIRECTORY_MEMORY_CHECK_INTERVAL
+  );
+}
+
+static void
+infd_directory_session_notify_algorithm_cb(GObject* object,
+                                           GParamSpec* pspec,
+                                           gpointer user_data)
+{
+  InfAdoptedAlgorithm* algorithm;
+  algorithm = inf_adopted_session_get_algorithm(INF_ADOPTED_SESSION(object));
+
+  if(algorithm != NULL)
+  {
+    g_signal_connect_after(
+      G_OBJECT(algorithm),
+      "end-execute-request",
+      G_CALLBACK(infd_directory_session_end_execute_request_cb),
+      user_data
+    );
+  }
+}
+
+/* Watches the session of proxy for requests, which change its size. The
+ * algorithm of a session is only created once it is running, so wait for it
+ * if the session is still being synchronized. */
+static void
+infd_directory_session_watch_size(InfdDirectory* directory,
+                                  InfdSessionProxy* proxy)
+{
+  InfSession* session;
+
+  g_object_get(G_OBJECT(proxy), "session", &session, NULL);
+  if(INF_ADOPTED_IS_SESSION(session))
+  {
+    g_signal_connect(
+      G_OBJECT(session),
+      "notify::algorithm",
+      G_CALLBACK(infd_directory_session_notify_algorithm_cb),
+      directory
+    );
+
+    infd_directory_session_notify_algorithm_cb(
+      G_OBJECT(session),
+      NULL,
+      directory
+    );
+  }
+
+  g_object_unref(session);
+}
+
+static void
+infd_directory_session_unwatch_size(InfdDirectory* directory,
+                                    InfdSessionProxy* proxy)
+{
+  InfSession* session;
+  InfAdoptedAlgorithm* algorithm;
+
+  g_object_get(G_OBJECT(proxy), "session", &session, NULL);
+  if(INF_ADOPTED_IS_SESSION(session))
+  {
+    inf_signal_handlers_disconnect_by_func(
+      G_OBJECT(session),
+      G_CALLBACK(infd_directory_session_notify_algorithm_cb),
+      directory
+    );
+
+    algorithm =
+      inf_adopted_session_get_algorithm(INF_ADOPTED_SESSION(session));
+
+    if(algorithm != NULL)
+    {
+      inf_signal_handlers_disconnect_by_func(
+        G_OBJECT(algorithm),
+        G_CALLBACK(infd_directory_session_end_execute_request_cb),
+        directory
+      );
+    }
+  }
+
+  g_object_unref(session);
+}
+
 static void
 infd_directory_session_weak_ref_cb(gpointer data,
                                    GObject* where_the_object_was)
@@ -506,10 +890,13 @@ infd_directory_session_idle_notify_cb(GObject* object,
   /* Drop session from memory if it remains idle */
   if(infd_session_proxy_is_idle(INFD_SESSION_PROXY(object)))
   {
-    if(node->shared.note.weakref == FALSE &&
-       node->shared.note.save_timeout == NULL)
+    if(node->shared.note.weakref == FALSE)
     {
-      infd_directory_start_session_save_timeout(directory, node);
+      if(node->shared.note.save_timeout == NULL)
+        infd_directory_start_session_save_timeout(directory, node);
+
+      infd_directory_node_touch_session(directory, node);
+      infd_directory_schedule_memory_check(directory, 0);
     }
   }
   else
@@ -526,6 +913,8 @@ infd_directory_session_idle_notify_cb(GObject* object,
         infd_directory_session_weak_ref_cb,
         node
       );
+
+      infd_directory_node_touch_session(directory, node);
     }
     else if(node->shared.note.save_timeout != NULL)
     {
@@ -622,6 +1011,9 @@ infd_directory_release_session(InfdDirectory* directory,
     directory
   );
 
+  if(node->shared.note.weakref == FALSE)
+    infd_directory_session_unwatch_size(directory, session);
+
   g_object_set_qdata(
     G_OBJECT(session),
     infd_directory_node_id_quark,
@@ -638,6 +1030,7 @@ infd_directory_release_session(InfdDirectory* directory,
   }
   else
   {
+    infd_directory_node_forget_session(directory, node);
     g_object_unref(session);
   }
 
@@ -1404,23 +1797,21 @@ infd_directory_verify_all_acls(InfdDirectory* directory,
     g_hash_table_destroy(own_table);
 }
 
-/* node can be NULL. If node is not NULL, additional sheets are returned
- * which correspond to erasure of the current ACL for the node. This allows
- * the ACL change to be performed atomically on the node.
+/* Converts an ACL as read from the storage at path into a sheet set. node
+ * can be NULL. If node is not NULL, additional sheets are returned which
+ * correspond to erasure of the current ACL for the node. This allows the ACL
+ * change to be performed atomically on the node.
  *
  * The verify_accounts table is a cache when verifying whether the accounts
  * present in the sheet exist or not. */
 static InfAclSheetSet*
-infd_directory_read_acl(InfdDirectory* directory,
-                        const gchar* path,
-                        InfdDirectoryNode* node,
-                        GHashTable* verify_accounts,
-                        GError** error)
+infd_directory_acl_from_storage(InfdDirectory* directory,
+                                const gchar* path,
+                                InfdDirectoryNode* node,
+                                GSList* acl,
+                                GHashTable* verify_accounts)
 {
   InfdDirectoryPrivate* priv;
-  InfBrowserIter iter;
-  GError* local_error;
-  GSList* acl;
   GSList* item;
   InfdStorageAcl* storage_acl;
   InfAclSheetSet* sheet_set;
@@ -1430,17 +1821,6 @@ infd_directory_read_acl(InfdDirectory* directory,
 
   priv = INFD_DIRECTORY_PRIVATE(directory);
 
-  g_assert(priv->storage != NULL);
-
-  local_error = NULL;
-  acl = infd_storage_read_acl(priv->storage, path, &local_error);
-
-  if(local_error != NULL)
-  {
-    g_propagate_error(error, local_error);
-    return FALSE;
-  }
-
   /* If there are any ACLs set already for this node, then clear them. This
    * should usually not happen because we only call this function for new
    * nodes, but it can happen when the storage is changed on the fly and the
@@ -1464,8 +1844,6 @@ infd_directory_read_acl(InfdDirectory* directory,
     sheet->perms = storage_acl->perms;
   }
 
-  infd_storage_acl_list_free(acl);
-
   if(priv->account_storage != NULL)
   {
     verify_sheets = infd_directory_verify_acl(
@@ -1490,6 +1868,46 @@ infd_directory_read_acl(InfdDirectory* directory,
   return sheet_set;
 }
 
+/* Reads the ACL for the node at path from the storage, see
+ * infd_directory_acl_from_storage() for the meaning of node and
+ * verify_accounts. */
+static InfAclSheetSet*
+infd_directory_read_acl(InfdDirectory* directory,
+                        const gchar* path,
+                        InfdDirectoryNode* node,
+                        GHashTable* verify_accounts,
+                        GError** error)
+{
+  InfdDirectoryPrivate* priv;
+  GError* local_error;
+  GSList* acl;
+  InfAclSheetSet* sheet_set;
+
+  priv = INFD_DIRECTORY_PRIVATE(directory);
+
+  g_assert(priv->storage != NULL);
+
+  local_error = NULL;
+  acl = infd_storage_read_acl(priv->storage, path, &local_error);
+
+  if(local_error != NULL)
+  {
+    g_propagate_error(error, local_error);
+    return NULL;
+  }
+
+  sheet_set = infd_directory_acl_from_storage(
+    directory,
+    path,
+    node,
+    acl,
+    verify_accounts
+  );
+
+  infd_storage_acl_list_free(acl);
+  return sheet_set;
+}
+
 static void
 infd_directory_report_support(InfdDirectory* directory,
                               gboolean* add_account,
@@ -2109,8 +2527,218 @@ infd_directory_node_unlink_child_sessions(InfdDirectory* directory,
   }
 }
 
+/*
+ * Name index
+ */
+
+/* Two names are equal in the sense of infd_directory_node_name_equal() if
+ * and only if their keys are equal. */
+static gchar*
+infd_directory_node_name_key(const gchar* name)
+{
+  gchar* folded;
+  gchar* key;
+
+  folded = g_utf8_casefold(name, -1);
+  key = g_utf8_collate_key(folded, -1);
+  g_free(folded);
+
+  return key;
+}
+
+static void
+infd_directory_name_entry_free(gpointer data)
+{
+  g_slice_free(InfdDirectoryNameEntry, data);
+}
+
+static InfdDirectoryNameEntry*
+infd_directory_node_lookup_name(InfdDirectoryNode* parent,
+                                const gchar* name)
+{
+  InfdDirectoryNameEntry* entry;
+  gchar* key;
+
+  g_assert(parent->shared.subdir.names != NULL);
+
+  key = infd_directory_node_name_key(name);
+  entry = g_hash_table_lookup(parent->shared.subdir.names, key);
+  g_free(key);
+
+  return entry;
+}
+
+/* Adds name to the name index of parent, if it has one. node is the child
+ * node with that name, or NULL if the name is taken by a node that is about
+ * to be created. */
+static void
+infd_directory_node_index_name(InfdDirectoryNode* parent,
+                               const gchar* name,
+                               InfdDirectoryNode* node)
+{
+  InfdDirectoryNameEntry* entry;
+  gchar* key;
+
+  g_assert(parent->type == INFD_DIRECTORY_NODE_SUBDIRECTORY);
+  if(parent->shared.subdir.names == NULL) return;
+
+  key = infd_directory_node_name_key(name);
+  entry = g_hash_table_lookup(parent->shared.subdir.names, key);
+
+  if(entry == NULL)
+  {
+    entry = g_slice_new(InfdDirectoryNameEntry);
+    entry->node = NULL;
+    entry->n_nodes = 0;
+    entry->n_pending = 0;
+
+    g_hash_table_insert(parent->shared.subdir.names, key, entry);
+  }
+  else
+  {
+    g_free(key);
+  }
+
+  if(node != NULL)
+  {
+    if(entry->node == NULL)
+      entry->node = node;
+    ++ entry->n_nodes;
+  }
+  else
+  {
+    ++ entry->n_pending;
+  }
+}
+
+/* Reverts infd_directory_node_index_name() */
+static void
+infd_directory_node_unindex_name(InfdDirectoryNode* parent,
+                                 const gchar* name,
+                                 InfdDirectoryNode* node)
+{
+  InfdDirectoryNameEntry* entry;
+  InfdDirectoryNode* child;
+  gchar* key;
+  gchar* child_key;
+
+  g_assert(parent->type == INFD_DIRECTORY_NODE_SUBDIRECTORY);
+  if(parent->shared.subdir.names == NULL) return;
+
+  key = infd_directory_node_name_key(name);
+  entry = g_hash_table_lookup(parent->shared.subdir.names, key);
+  g_assert(entry != NULL);
+
+  if(node != NULL)
+  {
+    g_assert(entry->n_nodes > 0);
+    -- entry->n_nodes;
+
+    if(entry->node == node)
+    {
+      entry->node = NULL;
+
+      /* Find the other node with the same name */
+      child = parent->shared.subdir.child;
+      while(entry->n_nodes > 0 && entry->node == NULL)
+      {
+        g_assert(child != NULL);
+        if(child != node)
+        {
+          child_key = infd_directory_node_name_key(child->name);
+          if(strcmp(child_key, key) == 0)
+            entry->node = child;
+          g_free(child_key);
+        }
+
+        child = child->next;
+      }
+    }
+  }
+  else
+  {
+    g_assert(entry->n_pending > 0);
+    -- entry->n_pending;
+  }
+
+  if(entry->n_nodes == 0 && entry->n_pending == 0)
+    g_hash_table_remove(parent->shared.subdir.names, key);
+
+  g_free(key);
+}
+
+static void
+infd_directory_node_build_name_index(InfdDirectory* directory,
+                                     InfdDirectoryNode* node)
+{
+  InfdDirectoryPrivate* priv;
+  InfdDirectoryNode* child;
+  InfdDirectorySyncIn* sync_in;
+  InfdDirectorySubreq* subreq;
+  GSList* item;
+
+  priv = INFD_DIRECTORY_PRIVATE(directory);
+
+  g_assert(node->type == INFD_DIRECTORY_NODE_SUBDIRECTORY);
+  g_assert(node->shared.subdir.names == NULL);
+
+  node->shared.subdir.names = g_hash_table_new_full(
+    g_str_hash,
+    g_str_equal,
+    g_free,
+    infd_directory_name_entry_free
+  );
+
+  for(child = node->shared.subdir.child; child != NULL; child = child->next)
+    infd_directory_node_index_name(node, child->name, child);
+
+  for(item = priv->sync_ins; item != NULL; item = item->next)
+  {
+    sync_in = (InfdDirectorySyncIn*)item->data;
+    if(sync_in->parent == node && sync_in->name != NULL)
+      infd_directory_node_index_name(node, sync_in->name, NULL);
+  }
+
+  for(item = priv->subscription_requests; item != NULL; item = item->next)
+  {
+    subreq = (InfdDirectorySubreq*)item->data;
+
+    switch(subreq->type)
+    {
+    case INFD_DIRECTORY_SUBREQ_CHAT:
+    case INFD_DIRECTORY_SUBREQ_SESSION:
+      break;
+    case INFD_DIRECTORY_SUBREQ_ADD_NODE:
+      if(subreq->shared.add_node.parent == node)
+      {
+        infd_directory_node_index_name(
+          node,
+          subreq->shared.add_node.name,
+          NULL
+        );
+      }
+      break;
+    case INFD_DIRECTORY_SUBREQ_SYNC_IN:
+    case INFD_DIRECTORY_SUBREQ_SYNC_IN_SUBSCRIBE:
+      if(subreq->shared.sync_in.parent == node)
+      {
+        infd_directory_node_index_name(
+          node,
+          subreq->shared.sync_in.name,
+          NULL
+        );
+      }
+      break;
+    default:
+      g_assert_not_reached();
+      break;
+    }
+  }
+}
+
 static void
-infd_directory_node_link(InfdDirectoryNode* node,
+infd_directory_node_link(InfdDirectory* directory,
+                         InfdDirectoryNode* node,
                          InfdDirectoryNode* parent)
 {
   g_return_if_fail(node != NULL);
@@ -2129,6 +2757,14 @@ infd_directory_node_link(InfdDirectoryNode* node,
   }
 
   parent->shared.subdir.child = node;
+  ++ parent->shared.subdir.n_children;
+
+  /* Once built, the index is kept even if the folder shrinks again */
+  if(parent->shared.subdir.names != NULL)
+    infd_directory_node_index_name(parent, node->name, node);
+  else if(parent->shared.subdir.n_children >=
+          INFD_DIRECTORY_NAME_INDEX_THRESHOLD)
+    infd_directory_node_build_name_index(directory, parent);
 }
 
 static void
@@ -2149,6 +2785,10 @@ infd_directory_node_unlink(InfdDirectoryNode* node)
 
   if(node->next != NULL)
     node->next->prev = node->prev;
+
+  g_assert(node->parent->shared.subdir.n_children > 0);
+  -- node->parent->shared.subdir.n_children;
+  infd_directory_node_unindex_name(node->parent, node->name, node);
 }
 
 /* This function takes ownership of name. If write_acl the ACL is written to
@@ -2191,7 +2831,7 @@ infd_directory_node_new_common(InfdDirectory* directory,
 
   if(parent != NULL)
   {
-    infd_directory_node_link(node, parent);
+    infd_directory_node_link(directory, node, parent);
   }
   else
   {
@@ -2226,6 +2866,8 @@ infd_directory_node_new_subdirectory(InfdDirectory* directory,
   node->shared.subdir.connections = NULL;
   node->shared.subdir.child = NULL;
   node->shared.subdir.explored = FALSE;
+  node->shared.subdir.n_children = 0;
+  node->shared.subdir.names = NULL;
 
   return node;
 }
@@ -2255,6 +2897,7 @@ infd_directory_node_new_note(InfdDirectory* directory,
   node->shared.note.plugin = plugin;
   node->shared.note.save_timeout = NULL;
   node->shared.note.weakref = FALSE;
+  node->shared.note.lru_link = NULL;
 
   return node;
 }
@@ -2295,6 +2938,12 @@ static void
 infd_directory_remove_subreq(InfdDirectory* directory,
                              InfdDirectorySubreq* request);
 
+static void
+infd_directory_cancel_loads(InfdDirectory* directory,
+                            InfdDirectoryNode* node,
+                            InfDirectoryError code,
+                            const gchar* message);
+
 static void
 infd_directory_node_free(InfdDirectory* directory,
                          InfdDirectoryNode* node)
@@ -2313,6 +2962,14 @@ infd_directory_node_free(InfdDirectory* directory,
 
   priv = INFD_DIRECTORY_PRIVATE(directory);
 
+  /* Stop reading the node from storage, if we are */
+  infd_directory_cancel_loads(
+    directory,
+    node,
+    INF_DIRECTORY_ERROR_NO_SUCH_NODE,
+    inf_directory_strerror(INF_DIRECTORY_ERROR_NO_SUCH_NODE)
+  );
+
   switch(node->type)
   {
   case INFD_DIRECTORY_NODE_SUBDIRECTORY:
@@ -2327,6 +2984,14 @@ infd_directory_node_free(InfdDirectory* directory,
       }
     }
 
+    /* Sync-ins and subscription requests into this node are released
+     * below; they do not need to be removed from the index anymore. */
+    if(node->shared.subdir.names != NULL)
+    {
+      g_hash_table_destroy(node->shared.subdir.names);
+      node->shared.subdir.names = NULL;
+    }
+
     break;
   case INFD_DIRECTORY_NODE_NOTE:
     /* Sessions must have been explicitely unlinked before; we might still
@@ -2560,14 +3225,34 @@ infd_directory_enforce_single_acl(InfdDirectory* directory,
             break;
           case INFD_DIRECTORY_SUBREQ_ADD_NODE:
             if(subreq->connection == connection)
+            {
               if(subreq->shared.add_node.parent->id == node->id)
+              {
+                infd_directory_node_unindex_name(
+                  node,
+                  subreq->shared.add_node.name,
+                  NULL
+                );
+
                 subreq->shared.add_node.parent = NULL;
+              }
+            }
             break;
           case INFD_DIRECTORY_SUBREQ_SYNC_IN:
           case INFD_DIRECTORY_SUBREQ_SYNC_IN_SUBSCRIBE:
             if(subreq->connection == connection)
+            {
               if(subreq->shared.sync_in.parent->id == node->id)
+              {
+                infd_directory_node_unindex_name(
+                  node,
+                  subreq->shared.sync_in.name,
+                  NULL
+                );
+
                 subreq->shared.sync_in.parent = NULL;
+              }
+            }
             break;
           default:
             g_assert_not_reached();
@@ -3678,6 +4363,9 @@ infd_directory_sync_in_synchronization_complete_cb(InfSession* session,
   plugin = sync_in->plugin;
   priv = INFD_DIRECTORY_PRIVATE(directory);
 
+  /* The name is now taken by the node itself */
+  infd_directory_node_unindex_name(sync_in->parent, sync_in->name, NULL);
+
   node = infd_directory_node_new_note(
     directory,
     sync_in->parent,
@@ -3784,6 +4472,8 @@ infd_directory_add_sync_in(InfdDirectory* directory,
 
   g_object_ref(sync_in->proxy);
   g_object_ref(sync_in->request);
+
+  infd_directory_node_index_name(parent, name, NULL);
   
   g_object_get(G_OBJECT(proxy), "session", &session, NULL);
 
@@ -3840,6 +4530,11 @@ infd_directory_remove_sync_in(InfdDirectory* directory,
   /* TODO: Fail request with a cancelled error? */
   g_object_unref(sync_in->request);
 
+  /* The name has been passed on to the new node if the synchronization
+   * completed, see infd_directory_sync_in_synchronization_complete_cb(). */
+  if(sync_in->name != NULL)
+    infd_directory_node_unindex_name(sync_in->parent, sync_in->name, NULL);
+
   if(sync_in->sheet_set != NULL)
     inf_acl_sheet_set_free(sync_in->sheet_set);
   g_free(sync_in->name);
@@ -4010,6 +4705,8 @@ infd_directory_add_subreq_add_node(InfdDirectory* directory,
   subreq->shared.add_node.proxy = proxy;
   subreq->shared.add_node.request = request;
 
+  infd_directory_node_index_name(parent, name, NULL);
+
   g_object_ref(request);
   g_object_ref(group);
   return subreq;
@@ -4082,6 +4779,8 @@ infd_directory_add_subreq_sync_in(InfdDirectory* directory,
   subreq->shared.sync_in.proxy = proxy;
   subreq->shared.sync_in.request = request;
 
+  infd_directory_node_index_name(parent, name, NULL);
+
   g_object_ref(request);
   g_object_ref(sync_group);
   g_object_ref(sub_group);
@@ -4137,6 +4836,38 @@ infd_directory_unlink_subreq(InfdDirectory* directory,
 
   priv = INFD_DIRECTORY_PRIVATE(directory);
 
+  /* Release the name of the node the request was going to create */
+  switch(request->type)
+  {
+  case INFD_DIRECTORY_SUBREQ_CHAT:
+  case INFD_DIRECTORY_SUBREQ_SESSION:
+    break;
+  case INFD_DIRECTORY_SUBREQ_ADD_NODE:
+    if(request->shared.add_node.parent != NULL)
+    {
+      infd_directory_node_unindex_name(
+        request->shared.add_node.parent,
+        request->shared.add_node.name,
+        NULL
+      );
+    }
+    break;
+  case INFD_DIRECTORY_SUBREQ_SYNC_IN:
+  case INFD_DIRECTORY_SUBREQ_SYNC_IN_SUBSCRIBE:
+    if(request->shared.sync_in.parent != NULL)
+    {
+      infd_directory_node_unindex_name(
+        request->shared.sync_in.parent,
+        request->shared.sync_in.name,
+        NULL
+      );
+    }
+    break;
+  default:
+    g_assert_not_reached();
+    break;
+  }
+
   priv->subscription_requests =
     g_slist_remove(priv->subscription_requests, request);
 }
@@ -4224,9 +4955,17 @@ infd_directory_node_find_child_by_name(InfdDirectoryNode* parent,
                                        const gchar* name)
 {
   InfdDirectoryNode* node;
+  InfdDirectoryNameEntry* entry;
 
   infd_directory_return_val_if_subdir_fail(parent, NULL);
 
+  if(parent->shared.subdir.names != NULL)
+  {
+    entry = infd_directory_node_lookup_name(parent, name);
+    if(entry == NULL) return NULL;
+    return entry->node;
+  }
+
   for(node = parent->shared.subdir.child; node != NULL; node = node->next)
     if(infd_directory_node_name_equal(node->name, name))
       return node;
@@ -4243,6 +4982,7 @@ infd_directory_node_is_name_available(InfdDirectory* directory,
                                       GError** error)
 {
   gboolean has_sensible_character = FALSE;
+  gboolean exists;
   const gchar* p;
 
   for (p = name; *p != '\0'; p = g_utf8_next_char(p))
@@ -4291,9 +5031,20 @@ infd_directory_node_is_name_available(InfdDirectory* directory,
     return FALSE;
   }
 
-  if(infd_directory_node_find_child_by_name(parent, name)         != NULL ||
-     infd_directory_find_sync_in_by_name(directory, parent, name) != NULL ||
-     infd_directory_find_subreq_by_name(directory, parent, name)  != NULL)
+  if(parent->shared.subdir.names != NULL)
+  {
+    /* The index covers pending sync-ins and subscription requests, too */
+    exists = infd_directory_node_lookup_name(parent, name) != NULL;
+  }
+  else
+  {
+    exists =
+      infd_directory_node_find_child_by_name(parent, name)         != NULL ||
+      infd_directory_find_sync_in_by_name(directory, parent, name) != NULL ||
+      infd_directory_find_subreq_by_name(directory, parent, name)  != NULL;
+  }
+
+  if(exists)
   {
     g_set_error(
       error,
@@ -4309,114 +5060,104 @@ infd_directory_node_is_name_available(InfdDirectory* directory,
   return TRUE;
 }
 
+/* Reads the content of the subdirectory at path from storage, together with
+ * the ACLs of all its children. The ACLs, as lists of InfdStorageAcl, are
+ * appended to acls in the order of the returned node list. This only
+ * accesses the storage, so that it can also run in a storage worker thread
+ * (see infd_storage_run_async()). */
 static gboolean
-infd_directory_node_explore(InfdDirectory* directory,
-                            InfdDirectoryNode* node,
-                            InfdProgressRequest* request,
-                            GError** error)
+infd_directory_read_storage_subdirectory(InfdStorage* storage,
+                                         const gchar* path,
+                                         GSList** list,
+                                         GPtrArray* acls,
+                                         GError** error)
 {
-  InfdDirectoryPrivate* priv;
   InfdStorageNode* storage_node;
-  InfdDirectoryNode* new_node;
-  InfBrowserIter iter;
-  InfdNotePlugin* plugin;
   GError* local_error;
-  GSList* list;
-  InfAclSheetSet* sheet_set;
-  GPtrArray* acls;
-  GHashTable* verify_table;
   GSList* item;
-  gchar* path;
-  gsize len;
-  gsize node_len;
-  gsize sep_len;
-  gsize path_len;
-  guint index;
-
-  priv = INFD_DIRECTORY_PRIVATE(directory);
-
-  g_assert(priv->storage != NULL);
-  g_assert(node->type == INFD_DIRECTORY_NODE_SUBDIRECTORY);
-  g_assert(node->shared.subdir.explored == FALSE);
+  GSList* acl;
+  gchar* child_path;
 
   local_error = NULL;
-  infd_directory_node_get_path(node, &path, &len);
-  list = infd_storage_read_subdirectory(priv->storage, path, &local_error);
+  *list = infd_storage_read_subdirectory(storage, path, &local_error);
 
   if(local_error != NULL)
   {
-    g_free(path);
-    if(request != NULL) inf_request_fail(INF_REQUEST(request), local_error);
     g_propagate_error(error, local_error);
     return FALSE;
   }
 
-  /* First pass: Count the total number of items and read the ACLs for each
-   * node. If there is a problem reading the ACL for one node, cancel the
-   * full exploration. */
-  path_len = len;
-  acls = g_ptr_array_sized_new(16);
-  verify_table = g_hash_table_new(NULL, NULL);
-  for(item = list; item != NULL; item = g_slist_next(item))
+  /* If there is a problem reading the ACL for one node, cancel the full
+   * exploration. */
+  for(item = *list; item != NULL; item = g_slist_next(item))
   {
     storage_node = (InfdStorageNode*)item->data;
-
-    /* Construct the storage path for this node */
-    node_len = strlen(storage_node->name);
-
-    sep_len = 1;
-    if(path[len - 1] == '/') sep_len = 0;
-
-    if(len + sep_len + node_len < path_len)
-    {
-      path_len = len + sep_len + node_len;
-      path = g_realloc(path, path_len + sep_len);
-    }
-
-    if(sep_len > 0)
-      path[len] = '/';
-
-    memcpy(path + len + sep_len, storage_node->name, node_len + 1);
-
-    /* Read ACL */
-    sheet_set = infd_directory_read_acl(
-      directory,
-      path,
-      NULL,
-      verify_table,
-      &local_error
-    );
+    child_path = infd_directory_make_child_path(path, storage_node->name);
+    acl = infd_storage_read_acl(storage, child_path, &local_error);
+    g_free(child_path);
 
     if(local_error != NULL)
     {
-      for(index = 0; index < acls->len; ++index)
-        inf_acl_sheet_set_free(g_ptr_array_index(acls, index));
-      g_ptr_array_free(acls, TRUE);
-      g_hash_table_destroy(verify_table);
-      infd_storage_node_list_free(list);
-      g_free(path);
-      if(request != NULL) inf_request_fail(INF_REQUEST(request), local_error);
+      infd_storage_node_list_free(*list);
+      *list = NULL;
+
       g_propagate_error(error, local_error);
       return FALSE;
     }
 
-    g_ptr_array_add(acls, sheet_set);
+    g_ptr_array_add(acls, acl);
   }
 
-  g_hash_table_destroy(verify_table);
-  node->shared.subdir.explored = TRUE;
+  return TRUE;
+}
 
-  g_free(path);
+/* Fills the directory tree below node with the nodes and ACLs read by
+ * infd_directory_read_storage_subdirectory(). */
+static void
+infd_directory_node_explore_finish(InfdDirectory* directory,
+                                   InfdDirectoryNode* node,
+                                   InfdProgressRequest* request,
+                                   const gchar* path,
+                                   GSList* list,
+                                   GPtrArray* acls)
+{
+  InfdDirectoryPrivate* priv;
+  InfdStorageNode* storage_node;
+  InfdDirectoryNode* new_node;
+  InfBrowserIter iter;
+  InfdNotePlugin* plugin;
+  InfAclSheetSet* sheet_set;
+  GHashTable* verify_table;
+  GSList* item;
+  gchar* child_path;
+  guint index;
+
+  priv = INFD_DIRECTORY_PRIVATE(directory);
+
+  g_assert(node->type == INFD_DIRECTORY_NODE_SUBDIRECTORY);
+  g_assert(node->shared.subdir.explored == FALSE);
+  g_assert(g_slist_length(list) == acls->len);
+
+  node->shared.subdir.explored = TRUE;
   if(request != NULL) infd_progress_request_initiated(request, acls->len);
 
-  /* Second pass, fill the directory tree */
-  index = 0;
+  verify_table = g_hash_table_new(NULL, NULL);
   for(item = list, index = 0;
       item != NULL;
       item = g_slist_next(item), ++index)
   {
     storage_node = (InfdStorageNode*)item->data;
-    sheet_set = (InfAclSheetSet*)g_ptr_array_index(acls, index);
+    child_path = infd_directory_make_child_path(path, storage_node->name);
+
+    sheet_set = infd_directory_acl_from_storage(
+      directory,
+      child_path,
+      NULL,
+      g_ptr_array_index(acls, index),
+      verify_table
+    );
+
+    g_free(child_path);
     new_node = NULL;
 
     switch(storage_node->type)
@@ -4492,7 +5233,7 @@ infd_directory_node_explore(InfdDirectory* directory,
     if(request != NULL) infd_progress_request_progress(request);
   }
 
-  g_ptr_array_free(acls, TRUE);
+  g_hash_table_destroy(verify_table);
 
   if(request != NULL)
   {
@@ -4504,9 +5245,61 @@ infd_directory_node_explore(InfdDirectory* directory,
       inf_request_result_make_explore_node(INF_BROWSER(directory), &iter)
     );
   }
+}
 
-  infd_storage_node_list_free(list);
+static gboolean
+infd_directory_node_explore(InfdDirectory* directory,
+                            InfdDirectoryNode* node,
+                            InfdProgressRequest* request,
+                            GError** error)
+{
+  InfdDirectoryPrivate* priv;
+  GError* local_error;
+  GSList* list;
+  GPtrArray* acls;
+  gchar* path;
+
+  priv = INFD_DIRECTORY_PRIVATE(directory);
+
+  g_assert(priv->storage != NULL);
+  g_assert(node->type == INFD_DIRECTORY_NODE_SUBDIRECTORY);
+  g_assert(node->shared.subdir.explored == FALSE);
+
+  infd_directory_node_get_path(node, &path, NULL);
+  acls = g_ptr_array_new_with_free_func(
+    (GDestroyNotify)infd_storage_acl_list_free
+  );
+
+  local_error = NULL;
+  infd_directory_read_storage_subdirectory(
+    priv->storage,
+    path,
+    &list,
+    acls,
+    &local_error
+  );
+
+  if(local_error != NULL)
+  {
+    g_ptr_array_free(acls, TRUE);
+    g_free(path);
+    if(request != NULL) inf_request_fail(INF_REQUEST(request), local_error);
+    g_propagate_error(error, local_error);
+    return FALSE;
+  }
+
+  infd_directory_node_explore_finish(
+    directory,
+    node,
+    request,
+    path,
+    list,
+    acls
+  );
 
+  infd_storage_node_list_free(list);
+  g_ptr_array_free(acls, TRUE);
+  g_free(path);
   return TRUE;
 }
 
@@ -5036,6 +5829,32 @@ infd_directory_node_remove(InfdDirectory* directory,
   }
 }
 
+/* Creates the session proxy for a session that has just been read from the
+ * storage for node. */
+static InfdSessionProxy*
+infd_directory_node_make_session_proxy(InfdDirectory* directory,
+                                       InfdDirectoryNode* node,
+                                       InfSession* session)
+{
+  InfCommunicationHostedGroup* group;
+  InfdSessionProxy* proxy;
+
+  /* Buffer might have been marked as modified while reading the session, but
+   * as we just read it from the storage, we don't consider it modified. */
+  inf_buffer_set_modified(inf_session_get_buffer(session), FALSE);
+
+  group = infd_directory_create_subscription_group(directory, node->id);
+
+  proxy = infd_directory_create_session_proxy_with_group(
+    directory,
+    session,
+    group
+  );
+
+  g_object_unref(group);
+  return proxy;
+}
+
 /* Returns the session for the given node. This does not link the session
  * (if it isn't already). This means that the next time this function is
  * called, the session will be created again if you don't link it yourself,
@@ -5049,7 +5868,6 @@ infd_directory_node_make_session(InfdDirectory* directory,
   InfSession* session;
   GSList* item;
   InfdDirectorySubreq* subreq;
-  InfCommunicationHostedGroup* group;
   InfdSessionProxy* proxy;
   gchar* path;
 
@@ -5093,168 +5911,725 @@ infd_directory_node_make_session(InfdDirectory* directory,
   g_free(path);
   if(session == NULL) return NULL;
 
-  /* Buffer might have been marked as modified while reading the session, but
-   * as we just read it from the storage, we don't consider it modified. */
-  inf_buffer_set_modified(inf_session_get_buffer(session), FALSE);
-
-  group = infd_directory_create_subscription_group(directory, node->id);
-
-  proxy = infd_directory_create_session_proxy_with_group(
-    directory,
-    session,
-    group
-  );
-
-  g_object_unref(group);
+  proxy = infd_directory_node_make_session_proxy(directory, node, session);
   g_object_unref(session);
 
   return proxy;
 }
 
 /*
- * Network command handling.
+ * Background loading
  */
 
-static gboolean
-infd_directory_verify_sheet_set(InfdDirectory* directory,
-                                const InfAclSheetSet* sheet_set,
-                                GError** error)
+static void
+infd_directory_load_free(gpointer data)
 {
-  InfAclSheetSet* changed_sheets;
-  InfAclSheetSet* copy;
+  InfdDirectoryLoad* load;
+  load = (InfdDirectoryLoad*)data;
 
-  /* TODO: infd_directory_verify_acl() should be able to operate such that
-   * it leaves the passed-in sheet set unmodified, and so that it just
-   * returns TRUE or FALSE depending on whether changes are needed. */
-  copy = inf_acl_sheet_set_copy(sheet_set);
-  inf_acl_sheet_set_sink(copy);
+  /* These are released when the load is removed from the directory */
+  g_assert(load->request == NULL);
+  g_assert(load->waiters == NULL);
 
-  changed_sheets = infd_directory_verify_acl(
-    directory,
-    copy,
-    NULL,
-    TRUE,
-    TRUE
-  );
+  if(load->error != NULL)
+    g_error_free(load->error);
 
-  inf_acl_sheet_set_free(copy);
+  infd_storage_node_list_free(load->storage_nodes);
+  if(load->storage_acls != NULL)
+    g_ptr_array_free(load->storage_acls, TRUE);
 
-  if(changed_sheets != NULL)
-  {
-    g_assert(changed_sheets->n_sheets > 0);
+  if(load->buffer != NULL)
+    g_object_unref(load->buffer);
+  if(load->user_table != NULL)
+    g_object_unref(load->user_table);
 
-    g_set_error(
-      error,
-      inf_directory_error_quark(),
-      INF_DIRECTORY_ERROR_NO_SUCH_ACCOUNT,
-      "There is no such account with ID \"%s\"",
-      inf_acl_account_id_to_string(changed_sheets->sheets[0].account)
-    );
+  g_free(load->path);
+  g_slice_free(InfdDirectoryLoad, load);
+}
 
-    inf_acl_sheet_set_free(changed_sheets);
-    return FALSE;
+static void
+infd_directory_load_free_waiters(GSList* waiters)
+{
+  GSList* item;
+  InfdDirectoryLoadWaiter* waiter;
+
+  for(item = waiters; item != NULL; item = g_slist_next(item))
+  {
+    waiter = (InfdDirectoryLoadWaiter*)item->data;
+    g_free(waiter->seq);
+    g_slice_free(InfdDirectoryLoadWaiter, waiter);
   }
 
-  return TRUE;
+  g_slist_free(waiters);
 }
 
-static InfAclSheetSet*
-infd_directory_sheet_set_from_xml(InfdDirectory* directory,
-                                  xmlNodePtr xml,
-                                  GError** error)
+static InfdDirectoryLoad*
+infd_directory_find_load(InfdDirectory* directory,
+                         InfdDirectoryNode* node)
 {
-  InfAclSheetSet* sheet_set;
-  GError* local_error;
+  InfdDirectoryPrivate* priv;
+  GSList* item;
+  InfdDirectoryLoad* load;
 
-  local_error = NULL;
-  sheet_set = inf_acl_sheet_set_from_xml(xml, &local_error);
+  priv = INFD_DIRECTORY_PRIVATE(directory);
 
-  if(local_error != NULL)
+  for(item = priv->loads; item != NULL; item = g_slist_next(item))
   {
-    g_propagate_error(error, local_error);
-    return NULL;
+    load = (InfdDirectoryLoad*)item->data;
+    if(load->node == node)
+      return load;
   }
 
-  if(sheet_set != NULL)
+  return NULL;
+}
+
+static gboolean
+infd_directory_load_has_waiter(InfdDirectoryLoad* load,
+                               InfXmlConnection* connection)
+{
+  GSList* item;
+  InfdDirectoryLoadWaiter* waiter;
+
+  for(item = load->waiters; item != NULL; item = g_slist_next(item))
   {
-    if(infd_directory_verify_sheet_set(directory, sheet_set, error) != TRUE)
-    {
-      inf_acl_sheet_set_free(sheet_set);
-      return NULL;
-    }
+    waiter = (InfdDirectoryLoadWaiter*)item->data;
+    if(waiter->connection == connection)
+      return TRUE;
   }
 
-  return sheet_set;
+  return FALSE;
 }
 
-static gboolean
-infd_directory_check_auth(InfdDirectory* directory,
-                          InfdDirectoryNode* node,
-                          InfXmlConnection* connection,
-                          const InfAclMask* mask,
-                          GError** error)
+/* Takes ownership of seq */
+static void
+infd_directory_load_add_waiter(InfdDirectoryLoad* load,
+                               InfXmlConnection* connection,
+                               gchar* seq)
 {
-  InfdDirectoryPrivate* priv;
-  InfdDirectoryConnectionInfo* info;
-  InfBrowserIter iter;
-  gboolean result;
+  InfdDirectoryLoadWaiter* waiter;
 
-  priv = INFD_DIRECTORY_PRIVATE(directory);
-  info = g_hash_table_lookup(priv->connections, connection);
-  g_assert(info != NULL);
+  waiter = g_slice_new(InfdDirectoryLoadWaiter);
+  waiter->connection = connection;
+  waiter->seq = seq;
 
-  iter.node_id = node->id;
-  iter.node = node;
+  /* Append, so that connections are replied to in the order in which they
+   * made their requests. */
+  load->waiters = g_slist_append(load->waiters, waiter);
+}
 
-  result = inf_browser_check_acl(
-    INF_BROWSER(directory),
-    &iter,
-    info->account_id,
-    mask,
-    NULL
-  );
+static void
+infd_directory_load_remove_connection(InfdDirectory* directory,
+                                      InfXmlConnection* connection)
+{
+  InfdDirectoryPrivate* priv;
+  GSList* item;
+  GSList* waiter_item;
+  GSList* next;
+  InfdDirectoryLoad* load;
+  InfdDirectoryLoadWaiter* waiter;
 
-  if(result == FALSE)
+  priv = INFD_DIRECTORY_PRIVATE(directory);
+
+  /* The loads themselves keep running, since their result is cached in
+   * the directory tree or is required by other connections. */
+  for(item = priv->loads; item != NULL; item = g_slist_next(item))
   {
-    g_set_error_literal(
-      error,
-      inf_request_error_quark(),
-      INF_REQUEST_ERROR_NOT_AUTHORIZED,
-      _("Permission denied")
-    );
+    load = (InfdDirectoryLoad*)item->data;
+    for(waiter_item = load->waiters; waiter_item != NULL; waiter_item = next)
+    {
+      next = waiter_item->next;
+      waiter = (InfdDirectoryLoadWaiter*)waiter_item->data;
 
-    return FALSE;
+      if(waiter->connection == connection)
+      {
+        load->waiters = g_slist_delete_link(load->waiters, waiter_item);
+        g_free(waiter->seq);
+        g_slice_free(InfdDirectoryLoadWaiter, waiter);
+      }
+    }
   }
-
-  return TRUE;
 }
 
-static InfAclAccountId
-infd_directory_create_acl_account_with_certificate(InfdDirectory* directory,
-                                                   const gchar* account_name,
-                                                   gnutls_x509_crt_t cert,
-                                                   InfXmlConnection* conn,
-                                                   GError** error)
+static void
+infd_directory_send_request_failed(InfdDirectory* directory,
+                                   InfXmlConnection* connection,
+                                   const gchar* seq,
+                                   const GError* error)
 {
   InfdDirectoryPrivate* priv;
-  InfAclAccountId existing;
-  GError* local_error;
-  InfAclMask perms;
-  InfdDirectoryTransientAccount* transient;
-  gchar* dn;
-  gboolean success;
+  xmlNodePtr reply_xml;
 
   priv = INFD_DIRECTORY_PRIVATE(directory);
 
-  local_error = NULL;
-
-  existing = infd_directory_lookup_account_by_name(
-    directory,
-    account_name,
-    &local_error
+  reply_xml = inf_xml_util_new_node_from_error(
+    (GError*)error,
+    NULL,
+    "request-failed"
   );
-  
-  if(local_error != NULL)
+
+  if(seq != NULL) inf_xml_util_set_attribute(reply_xml, "seq", seq);
+
+  inf_communication_group_send_message(
+    INF_COMMUNICATION_GROUP(priv->group),
+    connection,
+    reply_xml
+  );
+}
+
+/* Removes load from the directory, and fails its request and the requests
+ * of all waiting connections with the given error. */
+static void
+infd_directory_load_cancel(InfdDirectory* directory,
+                           InfdDirectoryLoad* load,
+                           const GError* error)
+{
+  InfdDirectoryPrivate* priv;
+  InfRequest* request;
+  GSList* waiters;
+  GSList* item;
+  InfdDirectoryLoadWaiter* waiter;
+
+  priv = INFD_DIRECTORY_PRIVATE(directory);
+
+  priv->loads = g_slist_remove(priv->loads, load);
+
+  request = load->request;
+  waiters = load->waiters;
+  load->request = NULL;
+  load->waiters = NULL;
+
+  /* This frees load, either immediately or as soon as the worker thread has
+   * handed it back. */
+  infd_storage_task_cancel(load->task);
+
+  for(item = waiters; item != NULL; item = g_slist_next(item))
+  {
+    waiter = (InfdDirectoryLoadWaiter*)item->data;
+
+    infd_directory_send_request_failed(
+      directory,
+      waiter->connection,
+      waiter->seq,
+      error
+    );
+  }
+
+  infd_directory_load_free_waiters(waiters);
+
+  inf_request_fail(request, error);
+  g_object_unref(request);
+}
+
+/* Cancels all loads for node, or all loads if node is NULL */
+static void
+infd_directory_cancel_loads(InfdDirectory* directory,
+                            InfdDirectoryNode* node,
+                            InfDirectoryError code,
+                            const gchar* message)
+{
+  InfdDirectoryPrivate* priv;
+  InfdDirectoryLoad* load;
+  GSList* item;
+  GSList* next;
+  GError* error;
+
+  priv = INFD_DIRECTORY_PRIVATE(directory);
+  error = NULL;
+
+  for(item = priv->loads; item != NULL; item = next)
+  {
+    next = item->next;
+    load = (InfdDirectoryLoad*)item->data;
+
+    if(node == NULL || load->node == node)
+    {
+      if(error == NULL)
+      {
+        error = g_error_new_literal(
+          inf_directory_error_quark(),
+          code,
+          message
+        );
+      }
+
+      infd_directory_load_cancel(directory, load, error);
+    }
+  }
+
+  if(error != NULL)
+    g_error_free(error);
+}
+
+static void
+infd_directory_load_explore_run_func(InfdStorage* storage,
+                                     gpointer user_data)
+{
+  InfdDirectoryLoad* load;
+  load = (InfdDirectoryLoad*)user_data;
+
+  infd_directory_read_storage_subdirectory(
+    storage,
+    load->path,
+    &load->storage_nodes,
+    load->storage_acls,
+    &load->error
+  );
+}
+
+static void
+infd_directory_load_session_run_func(InfdStorage* storage,
+                                     gpointer user_data)
+{
+  InfdDirectoryLoad* load;
+  load = (InfdDirectoryLoad*)user_data;
+
+  load->plugin->session_load(
+    storage,
+    load->path,
+    load->plugin->user_data,
+    &load->buffer,
+    &load->user_table,
+    &load->error
+  );
+}
+
+static void
+infd_directory_send_explore(InfdDirectory* directory,
+                            InfdDirectoryNode* node,
+                            InfXmlConnection* connection,
+                            const gchar* seq);
+
+static void
+infd_directory_send_subscribe_session(InfdDirectory* directory,
+                                      InfdDirectoryNode* node,
+                                      InfXmlConnection* connection,
+                                      InfdRequest* request,
+                                      InfdSessionProxy* proxy,
+                                      const gchar* seq);
+
+static void
+infd_directory_load_explore_done(InfdDirectory* directory,
+                                 InfdDirectoryLoad* load,
+                                 GSList* waiters)
+{
+  GSList* item;
+  InfdDirectoryLoadWaiter* waiter;
+
+  if(load->error != NULL)
+  {
+    for(item = waiters; item != NULL; item = g_slist_next(item))
+    {
+      waiter = (InfdDirectoryLoadWaiter*)item->data;
+
+      infd_directory_send_request_failed(
+        directory,
+        waiter->connection,
+        waiter->seq,
+        load->error
+      );
+    }
+
+    inf_request_fail(load->request, load->error);
+  }
+  else
+  {
+    /* Even if all waiting connections are gone, we keep the explored
+     * subdirectory, since we have read it already anyway. */
+    infd_directory_node_explore_finish(
+      directory,
+      load->node,
+      INFD_PROGRESS_REQUEST(load->request),
+      load->path,
+      load->storage_nodes,
+      load->storage_acls
+    );
+
+    for(item = waiters; item != NULL; item = g_slist_next(item))
+    {
+      waiter = (InfdDirectoryLoadWaiter*)item->data;
+
+      infd_directory_send_explore(
+        directory,
+        load->node,
+        waiter->connection,
+        waiter->seq
+      );
+    }
+  }
+}
+
+static void
+infd_directory_load_session_done(InfdDirectory* directory,
+                                 InfdDirectoryLoad* load,
+                                 GSList* waiters)
+{
+  InfdDirectoryPrivate* priv;
+  InfdDirectoryNode* node;
+  InfSession* session;
+  InfdSessionProxy* proxy;
+  InfBrowserIter iter;
+  GSList* item;
+  InfdDirectoryLoadWaiter* waiter;
+  GError* error;
+
+  priv = INFD_DIRECTORY_PRIVATE(directory);
+  node = load->node;
+
+  /* Both remote and local subscriptions join a pending load, so nobody
+   * can have created the session in the meanwhile. */
+  g_assert(node->type == INFD_DIRECTORY_NODE_NOTE);
+  g_assert(node->shared.note.session == NULL);
+
+  if(load->error != NULL)
+  {
+    for(item = waiters; item != NULL; item = g_slist_next(item))
+    {
+      waiter = (InfdDirectoryLoadWaiter*)item->data;
+
+      infd_directory_send_request_failed(
+        directory,
+        waiter->connection,
+        waiter->seq,
+        load->error
+      );
+    }
+
+    inf_request_fail(load->request, load->error);
+  }
+  else if(waiters == NULL && load->local == FALSE)
+  {
+    error = NULL;
+
+    g_set_error_literal(
+      &error,
+      inf_request_error_quark(),
+      INF_REQUEST_ERROR_FAILED,
+      _("All subscribers have disconnected while the session was loaded")
+    );
+
+    inf_request_fail(load->request, error);
+    g_error_free(error);
+  }
+  else
+  {
+    session = load->plugin->session_create(
+      priv->io,
+      priv->communication_manager,
+      load->buffer,
+      load->user_table,
+      load->plugin->user_data
+    );
+
+    proxy = infd_directory_node_make_session_proxy(directory, node, session);
+    g_object_unref(session);
+
+    /* If the session was requested locally, then we finish the request
+     * right away, as in infd_directory_browser_subscribe(), instead of
+     * waiting for the clients to acknowledge the subscription. */
+    for(item = waiters; item != NULL; item = g_slist_next(item))
+    {
+      waiter = (InfdDirectoryLoadWaiter*)item->data;
+
+      g_object_ref(proxy);
+      infd_directory_send_subscribe_session(
+        directory,
+        node,
+        waiter->connection,
+        load->local ? NULL : INFD_REQUEST(load->request),
+        proxy,
+        waiter->seq
+      );
+    }
+
+    if(load->local == TRUE)
+    {
+      iter.node_id = node->id;
+      iter.node = node;
+
+      infd_directory_node_link_session(
+        directory,
+        node,
+        INFD_REQUEST(load->request),
+        proxy
+      );
+
+      inf_request_finish(
+        load->request,
+        inf_request_result_make_subscribe_session(
+          INF_BROWSER(directory),
+          &iter,
+          INF_SESSION_PROXY(proxy)
+        )
+      );
+    }
+
+    g_object_unref(proxy);
+  }
+}
+
+static void
+infd_directory_load_done_func(InfdStorage* storage,
+                              gpointer user_data)
+{
+  InfdDirectoryLoad* load;
+  InfdDirectory* directory;
+  InfdDirectoryPrivate* priv;
+  GSList* waiters;
+
+  load = (InfdDirectoryLoad*)user_data;
+  directory = load->directory;
+  priv = INFD_DIRECTORY_PRIVATE(directory);
+
+  priv->loads = g_slist_remove(priv->loads, load);
+
+  waiters = load->waiters;
+  load->waiters = NULL;
+
+  switch(load->type)
+  {
+  case INFD_DIRECTORY_LOAD_EXPLORE:
+    infd_directory_load_explore_done(directory, load, waiters);
+    break;
+  case INFD_DIRECTORY_LOAD_SESSION:
+    infd_directory_load_session_done(directory, load, waiters);
+    break;
+  default:
+    g_assert_not_reached();
+    break;
+  }
+
+  infd_directory_load_free_waiters(waiters);
+
+  g_object_unref(load->request);
+  load->request = NULL;
+}
+
+/* Starts reading the subdirectory or session of node from the storage in
+ * the background. The load keeps a reference on request, and finishes it
+ * when the storage has been read. */
+static InfdDirectoryLoad*
+infd_directory_load_start(InfdDirectory* directory,
+                          InfdDirectoryLoadType type,
+                          InfdDirectoryNode* node,
+                          InfRequest* request)
+{
+  InfdDirectoryPrivate* priv;
+  InfdDirectoryLoad* load;
+
+  priv = INFD_DIRECTORY_PRIVATE(directory);
+
+  /* If we don't have a background storage then all nodes are in memory */
+  g_assert(priv->storage != NULL);
+  g_assert(infd_directory_find_load(directory, node) == NULL);
+
+  load = g_slice_new(InfdDirectoryLoad);
+  load->directory = directory;
+  load->type = type;
+  load->node = node;
+  load->request = request;
+  load->local = FALSE;
+  load->waiters = NULL;
+  load->task = NULL;
+
+  infd_directory_node_get_path(node, &load->path, NULL);
+  load->plugin = NULL;
+  load->error = NULL;
+
+  load->storage_nodes = NULL;
+  load->storage_acls = NULL;
+  load->buffer = NULL;
+  load->user_table = NULL;
+
+  g_object_ref(request);
+  priv->loads = g_slist_prepend(priv->loads, load);
+
+  switch(type)
+  {
+  case INFD_DIRECTORY_LOAD_EXPLORE:
+    g_assert(node->type == INFD_DIRECTORY_NODE_SUBDIRECTORY);
+
+    load->storage_acls = g_ptr_array_new_with_free_func(
+      (GDestroyNotify)infd_storage_acl_list_free
+    );
+
+    load->task = infd_storage_run_async(
+      priv->storage,
+      priv->io,
+      infd_directory_load_explore_run_func,
+      infd_directory_load_done_func,
+      load,
+      infd_directory_load_free
+    );
+
+    break;
+  case INFD_DIRECTORY_LOAD_SESSION:
+    g_assert(node->type == INFD_DIRECTORY_NODE_NOTE);
+    g_assert(node->shared.note.plugin->session_load != NULL);
+
+    load->plugin = node->shared.note.plugin;
+
+    load->task = infd_storage_run_async(
+      priv->storage,
+      priv->io,
+      infd_directory_load_session_run_func,
+      infd_directory_load_done_func,
+      load,
+      infd_directory_load_free
+    );
+
+    break;
+  default:
+    g_assert_not_reached();
+    break;
+  }
+
+  return load;
+}
+
+/*
+ * Network command handling.
+ */
+
+static gboolean
+infd_directory_verify_sheet_set(InfdDirectory* directory,
+                                const InfAclSheetSet* sheet_set,
+                                GError** error)
+{
+  InfAclSheetSet* changed_sheets;
+  InfAclSheetSet* copy;
+
+  /* TODO: infd_directory_verify_acl() should be able to operate such that
+   * it leaves the passed-in sheet set unmodified, and so that it just
+   * returns TRUE or FALSE depending on whether changes are needed. */
+  copy = inf_acl_sheet_set_copy(sheet_set);
+  inf_acl_sheet_set_sink(copy);
+
+  changed_sheets = infd_directory_verify_acl(
+    directory,
+    copy,
+    NULL,
+    TRUE,
+    TRUE
+  );
+
+  inf_acl_sheet_set_free(copy);
+
+  if(changed_sheets != NULL)
+  {
+    g_assert(changed_sheets->n_sheets > 0);
+
+    g_set_error(
+      error,
+      inf_directory_error_quark(),
+      INF_DIRECTORY_ERROR_NO_SUCH_ACCOUNT,
+      "There is no such account with ID \"%s\"",
+      inf_acl_account_id_to_string(changed_sheets->sheets[0].account)
+    );
+
+    inf_acl_sheet_set_free(changed_sheets);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+static InfAclSheetSet*
+infd_directory_sheet_set_from_xml(InfdDirectory* directory,
+                                  xmlNodePtr xml,
+                                  GError** error)
+{
+  InfAclSheetSet* sheet_set;
+  GError* local_error;
+
+  local_error = NULL;
+  sheet_set = inf_acl_sheet_set_from_xml(xml, &local_error);
+
+  if(local_error != NULL)
+  {
+    g_propagate_error(error, local_error);
+    return NULL;
+  }
+
+  if(sheet_set != NULL)
+  {
+    if(infd_directory_verify_sheet_set(directory, sheet_set, error) != TRUE)
+    {
+      inf_acl_sheet_set_free(sheet_set);
+      return NULL;
+    }
+  }
+
+  return sheet_set;
+}
+
+static gboolean
+infd_directory_check_auth(InfdDirectory* directory,
+                          InfdDirectoryNode* node,
+                          InfXmlConnection* connection,
+                          const InfAclMask* mask,
+                          GError** error)
+{
+  InfdDirectoryPrivate* priv;
+  InfdDirectoryConnectionInfo* info;
+  InfBrowserIter iter;
+  gboolean result;
+
+  priv = INFD_DIRECTORY_PRIVATE(directory);
+  info = g_hash_table_lookup(priv->connections, connection);
+  g_assert(info != NULL);
+
+  iter.node_id = node->id;
+  iter.node = node;
+
+  result = inf_browser_check_acl(
+    INF_BROWSER(directory),
+    &iter,
+    info->account_id,
+    mask,
+    NULL
+  );
+
+  if(result == FALSE)
+  {
+    g_set_error_literal(
+      error,
+      inf_request_error_quark(),
+      INF_REQUEST_ERROR_NOT_AUTHORIZED,
+      _("Permission denied")
+    );
+
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+static InfAclAccountId
+infd_directory_create_acl_account_with_certificate(InfdDirectory* directory,
+                                                   const gchar* account_name,
+                                                   gnutls_x509_crt_t cert,
+                                                   InfXmlConnection* conn,
+                                                   GError** error)
+{
+  InfdDirectoryPrivate* priv;
+  InfAclAccountId existing;
+  GError* local_error;
+  InfAclMask perms;
+  InfdDirectoryTransientAccount* transient;
+  gchar* dn;
+  gboolean success;
+
+  priv = INFD_DIRECTORY_PRIVATE(directory);
+
+  local_error = NULL;
+
+  existing = infd_directory_lookup_account_by_name(
+    directory,
+    account_name,
+    &local_error
+  );
+  
+  if(local_error != NULL)
   {
     g_propagate_error(error, local_error);
     return 0;
@@ -5564,86 +6939,21 @@ infd_directory_get_node_from_xml_typed(InfdDirectory* directory,
   return node;
 }
 
-static gboolean
-infd_directory_handle_explore_node(InfdDirectory* directory,
-                                   InfXmlConnection* connection,
-                                   const xmlNodePtr xml,
-                                   GError** error)
+static void
+infd_directory_send_explore(InfdDirectory* directory,
+                            InfdDirectoryNode* node,
+                            InfXmlConnection* connection,
+                            const gchar* seq)
 {
   InfdDirectoryPrivate* priv;
-  InfdDirectoryNode* node;
-  InfAclMask perms;
-  GSList* item;
-  InfdProgressRequest* request;
-  InfBrowserIter iter;
-  GError* local_error;
   InfdDirectoryNode* child;
   xmlNodePtr reply_xml;
-  gchar* seq;
   guint total;
-  const InfAclSheetSet* sheet_set;
 
   priv = INFD_DIRECTORY_PRIVATE(directory);
 
-  node = infd_directory_get_node_from_xml_typed(
-    directory,
-    xml,
-    "id",
-    INFD_DIRECTORY_NODE_SUBDIRECTORY,
-    error
-  );
-
-  if(node == NULL) return FALSE;
-
-  inf_acl_mask_set1(&perms, INF_ACL_CAN_EXPLORE_NODE);
-  if(!infd_directory_check_auth(directory, node, connection, &perms, error))
-    return FALSE;
-
-  if(node->shared.subdir.explored == FALSE)
-  {
-    request = INFD_PROGRESS_REQUEST(
-      g_object_new(
-        INFD_TYPE_PROGRESS_REQUEST,
-        "type", "explore-node",
-        "node-id", node->id,
-        "requestor", connection,
-        NULL
-      )
-    );
-
-    iter.node_id = node->id;
-    iter.node = node;
-    inf_browser_begin_request(
-      INF_BROWSER(directory),
-      &iter,
-      INF_REQUEST(request)
-    );
-
-    local_error = NULL;
-    infd_directory_node_explore(directory, node, request, &local_error);
-    g_object_unref(request);
-
-    if(local_error != NULL)
-    {
-      g_propagate_error(error, local_error);
-      return FALSE;
-    }
-  }
-
-  if(g_slist_find(node->shared.subdir.connections, connection) != NULL)
-  {
-    g_set_error_literal(
-      error,
-      inf_directory_error_quark(),
-      INF_DIRECTORY_ERROR_ALREADY_EXPLORED,
-      inf_directory_strerror(INF_DIRECTORY_ERROR_ALREADY_EXPLORED)
-    );
-
-    return FALSE;
-  }
-
-  if(!infd_directory_make_seq(directory, connection, xml, &seq, error))
-    return FALSE;
+  g_assert(node->shared.subdir.explored == TRUE);
+  g_assert(g_slist_find(node->shared.subdir.connections, connection) == NULL);
 
   total = 0;
   for(child = node->shared.subdir.child; child != NULL; child = child->next)
@@ -5686,20 +6996,110 @@ infd_directory_handle_explore_node(InfdDirectory* directory,
 
   reply_xml = xmlNewNode(NULL, (const xmlChar*)"explore-end");
 
-  if(seq != NULL) inf_xml_util_set_attribute(reply_xml, "seq", seq);
+  if(seq != NULL) inf_xml_util_set_attribute(reply_xml, "seq", seq);
+
+  inf_communication_group_send_message(
+    INF_COMMUNICATION_GROUP(priv->group),
+    connection,
+    reply_xml
+  );
+
+  /* Remember that this connection explored that node so that it gets
+   * notified when changes occur. */
+  node->shared.subdir.connections = g_slist_prepend(
+    node->shared.subdir.connections,
+    connection
+  );
+}
+
+static gboolean
+infd_directory_handle_explore_node(InfdDirectory* directory,
+                                   InfXmlConnection* connection,
+                                   const xmlNodePtr xml,
+                                   GError** error)
+{
+  InfdDirectoryNode* node;
+  InfAclMask perms;
+  InfdProgressRequest* request;
+  InfdDirectoryLoad* load;
+  InfBrowserIter iter;
+  gchar* seq;
+
+  node = infd_directory_get_node_from_xml_typed(
+    directory,
+    xml,
+    "id",
+    INFD_DIRECTORY_NODE_SUBDIRECTORY,
+    error
+  );
+
+  if(node == NULL) return FALSE;
+
+  inf_acl_mask_set1(&perms, INF_ACL_CAN_EXPLORE_NODE);
+  if(!infd_directory_check_auth(directory, node, connection, &perms, error))
+    return FALSE;
+
+  load = NULL;
+  if(node->shared.subdir.explored == FALSE)
+    load = infd_directory_find_load(directory, node);
+
+  if(g_slist_find(node->shared.subdir.connections, connection) != NULL ||
+     (load != NULL && infd_directory_load_has_waiter(load, connection)))
+  {
+    g_set_error_literal(
+      error,
+      inf_directory_error_quark(),
+      INF_DIRECTORY_ERROR_ALREADY_EXPLORED,
+      inf_directory_strerror(INF_DIRECTORY_ERROR_ALREADY_EXPLORED)
+    );
+
+    return FALSE;
+  }
+
+  if(!infd_directory_make_seq(directory, connection, xml, &seq, error))
+    return FALSE;
+
+  if(node->shared.subdir.explored == FALSE)
+  {
+    /* Read the subdirectory from storage in the background, and reply to
+     * the connection once it has been read. If somebody else is exploring
+     * the node already, then wait for that. */
+    if(load == NULL)
+    {
+      request = INFD_PROGRESS_REQUEST(
+        g_object_new(
+          INFD_TYPE_PROGRESS_REQUEST,
+          "type", "explore-node",
+          "node-id", node->id,
+          "requestor", connection,
+          NULL
+        )
+      );
+
+      iter.node_id = node->id;
+      iter.node = node;
+      inf_browser_begin_request(
+        INF_BROWSER(directory),
+        &iter,
+        INF_REQUEST(request)
+      );
+
+      load = infd_directory_load_start(
+        directory,
+        INFD_DIRECTORY_LOAD_EXPLORE,
+        node,
+        INF_REQUEST(request)
+      );
+
+      g_object_unref(request);
+    }
 
-  inf_communication_group_send_message(
-    INF_COMMUNICATION_GROUP(priv->group),
-    connection,
-    reply_xml
-  );
+    /* This takes ownership of seq */
+    infd_directory_load_add_waiter(load, connection, seq);
+    return TRUE;
+  }
 
-  /* Remember that this connection explored that node so that it gets
-   * notified when changes occur. */
-  node->shared.subdir.connections = g_slist_prepend(
-    node->shared.subdir.connections,
-    connection
-  );
+  infd_directory_send_explore(directory, node, connection, seq);
 
   g_free(seq);
   return TRUE;
@@ -5987,6 +7387,68 @@ infd_directory_handle_remove_node(InfdDirectory* directory,
   }
 }
 
+/* Sends the reply to a subscribe-session request, and creates the
+ * corresponding subscription request. This takes ownership of proxy. */
+static void
+infd_directory_send_subscribe_session(InfdDirectory* directory,
+                                      InfdDirectoryNode* node,
+                                      InfXmlConnection* connection,
+                                      InfdRequest* request,
+                                      InfdSessionProxy* proxy,
+                                      const gchar* seq)
+{
+  InfdDirectoryPrivate* priv;
+  InfCommunicationGroup* group;
+  const gchar* method;
+  xmlNodePtr reply_xml;
+
+  priv = INFD_DIRECTORY_PRIVATE(directory);
+
+  g_object_get(G_OBJECT(proxy), "subscription-group", &group, NULL);
+  method = inf_communication_group_get_method_for_connection(
+    group,
+    connection
+  );
+
+  /* We should always be able to fallback to "central" */
+  g_assert(method != NULL);
+
+  /* Reply that subscription was successful (so far, synchronization may
+   * still fail) and tell identifier. */
+  reply_xml = xmlNewNode(NULL, (const xmlChar*)"subscribe-session");
+
+  xmlNewProp(
+    reply_xml,
+    (const xmlChar*)"group",
+    (const xmlChar*)inf_communication_group_get_name(group)
+  );
+
+  xmlNewProp(
+    reply_xml,
+    (const xmlChar*)"method",
+    (const xmlChar*)method
+  );
+
+  g_object_unref(group);
+  inf_xml_util_set_attribute_uint(reply_xml, "id", node->id);
+  if(seq != NULL) inf_xml_util_set_attribute(reply_xml, "seq", seq);
+
+  /* This gives ownership of proxy to the subscription request */
+  infd_directory_add_subreq_session(
+    directory,
+    connection,
+    request,
+    node->id,
+    proxy
+  );
+
+  inf_communication_group_send_message(
+    INF_COMMUNICATION_GROUP(priv->group),
+    connection,
+    reply_xml
+  );
+}
+
 static gboolean
 infd_directory_handle_subscribe_session(InfdDirectory* directory,
                                         InfXmlConnection* connection,
@@ -5998,13 +7460,11 @@ infd_directory_handle_subscribe_session(InfdDirectory* directory,
   InfAclMask perms;
   GSList* item;
   InfdDirectorySubreq* subreq;
+  InfdDirectoryLoad* load;
   InfdSessionProxy* proxy;
   InfBrowserIter iter;
   InfdRequest* request;
-  InfCommunicationGroup* group;
-  const gchar* method;
   gchar* seq;
-  xmlNodePtr reply_xml;
   GError* local_error;
 
   priv = INFD_DIRECTORY_PRIVATE(directory);
@@ -6056,6 +7516,25 @@ infd_directory_handle_subscribe_session(InfdDirectory* directory,
     }
   }
 
+  /* Check if the session is currently being read from storage */
+  load = infd_directory_find_load(directory, node);
+  if(load != NULL)
+  {
+    g_assert(request == NULL && proxy == NULL);
+
+    if(infd_directory_load_has_waiter(load, connection))
+    {
+      g_set_error_literal(
+        error,
+        inf_directory_error_quark(),
+        INF_DIRECTORY_ERROR_ALREADY_SUBSCRIBED,
+        inf_directory_strerror(INF_DIRECTORY_ERROR_ALREADY_SUBSCRIBED)
+      );
+
+      return FALSE;
+    }
+  }
+
   if(node->shared.note.session != NULL && node->shared.note.weakref == FALSE)
   {
     g_assert(proxy == NULL || proxy == node->shared.note.session);
@@ -6065,6 +7544,13 @@ infd_directory_handle_subscribe_session(InfdDirectory* directory,
   if(!infd_directory_make_seq(directory, connection, xml, &seq, error))
     return FALSE;
 
+  /* Wait for a pending load. This takes ownership of seq. */
+  if(load != NULL)
+  {
+    infd_directory_load_add_waiter(load, connection, seq);
+    return TRUE;
+  }
+
   /* Make a new request if there is no request yet and we don't have a proxy
    * already. If we do have a proxy, then we don't have to read anything from
    * storage. */
@@ -6087,6 +7573,26 @@ infd_directory_handle_subscribe_session(InfdDirectory* directory,
       &iter,
       INF_REQUEST(request)
     );
+
+    /* If the session needs to be read from storage, and the plugin supports
+     * it, do so in the background. A session that is only weakly referenced
+     * is re-used instead. */
+    if(node->shared.note.session == NULL &&
+       node->shared.note.plugin->session_load != NULL &&
+       node->shared.note.plugin->session_create != NULL)
+    {
+      load = infd_directory_load_start(
+        directory,
+        INFD_DIRECTORY_LOAD_SESSION,
+        node,
+        INF_REQUEST(request)
+      );
+
+      g_object_unref(request);
+
+      infd_directory_load_add_waiter(load, connection, seq);
+      return TRUE;
+    }
   }
   else if(request != NULL)
   {
@@ -6114,53 +7620,19 @@ infd_directory_handle_subscribe_session(InfdDirectory* directory,
     g_object_ref(proxy);
   }
 
-  g_object_get(G_OBJECT(proxy), "subscription-group", &group, NULL);
-  method = inf_communication_group_get_method_for_connection(
-    group,
-    connection
-  );
-
-  /* We should always be able to fallback to "central" */
-  g_assert(method != NULL);
-
-  /* Reply that subscription was successful (so far, synchronization may
-   * still fail) and tell identifier. */
-  reply_xml = xmlNewNode(NULL, (const xmlChar*)"subscribe-session");
-
-  xmlNewProp(
-    reply_xml,
-    (const xmlChar*)"group",
-    (const xmlChar*)inf_communication_group_get_name(group)
-  );
-
-  xmlNewProp(
-    reply_xml,
-    (const xmlChar*)"method",
-    (const xmlChar*)method
-  );
-
-  g_object_unref(group);
-  inf_xml_util_set_attribute_uint(reply_xml, "id", node->id);
-  if(seq != NULL) inf_xml_util_set_attribute(reply_xml, "seq", seq);
-
   /* This gives ownership of proxy to the subscription request */
-  infd_directory_add_subreq_session(
+  infd_directory_send_subscribe_session(
     directory,
+    node,
     connection,
     request,
-    node->id,
-    proxy
+    proxy,
+    seq
   );
 
   if(request != NULL)
     g_object_unref(request);
 
-  inf_communication_group_send_message(
-    INF_COMMUNICATION_GROUP(priv->group),
-    connection,
-    reply_xml
-  );
-
   g_free(seq);
   return TRUE;
 }
@@ -7854,6 +9326,9 @@ infd_directory_member_removed_cb(InfCommunicationGroup* group,
       infd_directory_remove_subreq(directory, request);
   }
 
+  /* Do not reply to this connection when pending loads finish */
+  infd_directory_load_remove_connection(directory, connection);
+
   if(priv->root != NULL)
   {
     if(priv->root->shared.subdir.explored == TRUE)
@@ -7931,6 +9406,14 @@ infd_directory_set_storage(InfdDirectory* directory,
   priv = INFD_DIRECTORY_PRIVATE(directory);
   g_assert(priv->root != NULL);
 
+  /* Anything that is still being read belongs to the old storage */
+  infd_directory_cancel_loads(
+    directory,
+    NULL,
+    INF_DIRECTORY_ERROR_FAILED,
+    _("The background storage has been changed")
+  );
+
   /* If we are setting a new storage, then remove all documents. If we are
    * going to no storage, then keep current set of documents. */
   if(storage != NULL)
@@ -8561,6 +10044,11 @@ infd_directory_init(InfdDirectory* directory)
   priv->orig_root_acl = NULL;
   priv->sync_ins = NULL;
   priv->subscription_requests = NULL;
+  priv->loads = NULL;
+
+  priv->memory_budget = 0;
+  priv->sessions = g_queue_new();
+  priv->memory_timeout = NULL;
 
   priv->chat_session = NULL;
 }
@@ -8680,6 +10168,14 @@ infd_directory_dispose(GObject* object)
 
   infd_directory_set_storage(directory, NULL);
   infd_directory_set_account_storage(directory, NULL);
+  g_assert(priv->loads == NULL);
+  g_assert(g_queue_is_empty(priv->sessions));
+
+  if(priv->memory_timeout != NULL)
+  {
+    inf_io_remove_timeout(priv->io, priv->memory_timeout);
+    priv->memory_timeout = NULL;
+  }
 
   g_assert(priv->root != NULL);
   infd_directory_node_free(directory, priv->root);
@@ -8735,6 +10231,7 @@ infd_directory_finalize(GObject* object)
     g_free(priv->transient_accounts[i].dn);
   }
   g_free(priv->transient_accounts);
+  g_queue_free(priv->sessions);
 
   G_OBJECT_CLASS(infd_directory_parent_class)->finalize(object);
 }
@@ -8784,6 +10281,9 @@ infd_directory_set_property(GObject* object,
   case PROP_CERTIFICATE:
     priv->certificate = (InfCertificateChain*)g_value_dup_boxed(value);
     break;
+  case PROP_MEMORY_BUDGET:
+    infd_directory_set_memory_budget(directory, g_value_get_uint64(value));
+    break;
   case PROP_CHAT_SESSION:
   case PROP_STATUS:
     /* read only */
@@ -8825,6 +10325,9 @@ infd_directory_get_property(GObject* object,
   case PROP_CERTIFICATE:
     g_value_set_boxed(value, priv->certificate);
     break;
+  case PROP_MEMORY_BUDGET:
+    g_value_set_uint64(value, priv->memory_budget);
+    break;
   case PROP_CHAT_SESSION:
     g_value_set_object(value, G_OBJECT(priv->chat_session));
     break;
@@ -8847,13 +10350,10 @@ infd_directory_communication_object_received(InfCommunicationObject* object,
                                              const xmlNodePtr node)
 {
   InfdDirectory* directory;
-  InfdDirectoryPrivate* priv;
   GError* local_error;
-  xmlNodePtr reply_xml;
   gchar* seq;
 
   directory = INFD_DIRECTORY(object);
-  priv = INFD_DIRECTORY_PRIVATE(directory);
   local_error = NULL;
 
   if(strcmp((const char*)node->name, "explore-node") == 0)
@@ -9005,19 +10505,14 @@ infd_directory_communication_object_received(InfCommunicationObject* object,
 
     /* An error happened, so tell the client that the request failed and
      * what has gone wrong. */
-    reply_xml = inf_xml_util_new_node_from_error(local_error,
-                                                 NULL,
-                                                 "request-failed");
-
-    if(seq != NULL) inf_xml_util_set_attribute(reply_xml, "seq", seq);
-    g_free(seq);
-
-    inf_communication_group_send_message(
-      INF_COMMUNICATION_GROUP(priv->group),
+    infd_directory_send_request_failed(
+      directory,
       connection,
-      reply_xml
+      seq,
+      local_error
     );
 
+    g_free(seq);
     g_error_free(local_error);
   }
 
@@ -9068,6 +10563,7 @@ infd_directory_browser_subscribe_session(InfBrowser* browser,
     }
 
     node->shared.note.weakref = FALSE;
+    infd_directory_node_touch_session(INFD_DIRECTORY(browser), node);
 
     g_object_set_qdata(
       G_OBJECT(proxy),
@@ -9096,6 +10592,13 @@ infd_directory_browser_subscribe_session(InfBrowser* browser,
     {
       infd_directory_start_session_save_timeout(INFD_DIRECTORY(browser), node);
     }
+
+    infd_directory_session_watch_size(
+      INFD_DIRECTORY(browser),
+      INFD_SESSION_PROXY(proxy)
+    );
+
+    infd_directory_schedule_memory_check(INFD_DIRECTORY(browser), 0);
   }
 }
 
@@ -9135,6 +10638,9 @@ infd_directory_browser_unsubscribe_session(InfBrowser* browser,
       node->shared.note.save_timeout = NULL;
     }
 
+    infd_directory_node_forget_session(directory, node);
+    infd_directory_session_unwatch_size(directory, INFD_SESSION_PROXY(proxy));
+
     g_object_weak_ref(
       G_OBJECT(node->shared.note.session),
       infd_directory_session_weak_ref_cb,
@@ -9264,6 +10770,7 @@ infd_directory_browser_explore(InfBrowser* browser,
   InfdDirectory* directory;
   InfdDirectoryPrivate* priv;
   InfdDirectoryNode* node;
+  InfdDirectoryLoad* load;
   InfdProgressRequest* request;
 
   directory = INFD_DIRECTORY(browser);
@@ -9275,6 +10782,24 @@ infd_directory_browser_explore(InfBrowser* browser,
   g_return_val_if_fail(node->type == INFD_DIRECTORY_NODE_SUBDIRECTORY, NULL);
   g_return_val_if_fail(node->shared.subdir.explored == FALSE, NULL);
 
+  /* If a client is exploring the node already, then the node is being read
+   * in the background, and we simply join that request. */
+  load = infd_directory_find_load(directory, node);
+  if(load != NULL)
+  {
+    if(func != NULL)
+    {
+      g_signal_connect_after(
+        G_OBJECT(load->request),
+        "finished",
+        G_CALLBACK(func),
+        user_data
+      );
+    }
+
+    return load->request;
+  }
+
   request = g_object_new(
     INFD_TYPE_PROGRESS_REQUEST,
     "type", "explore-node",
@@ -9569,6 +11094,7 @@ infd_directory_browser_subscribe(InfBrowser* browser,
   InfdDirectoryPrivate* priv;
   InfdDirectoryNode* node;
   InfdDirectorySubreq* subreq;
+  InfdDirectoryLoad* load;
   InfdRequest* request;
   InfdSessionProxy* proxy;
   GSList* item;
@@ -9587,6 +11113,26 @@ infd_directory_browser_subscribe(InfBrowser* browser,
     NULL
   );
 
+  /* If the session is being read from storage for a client, then join that
+   * request. The session is linked, and the request finished, as soon as
+   * it has been read. */
+  load = infd_directory_find_load(directory, node);
+  if(load != NULL)
+  {
+    if(func != NULL)
+    {
+      g_signal_connect_after(
+        G_OBJECT(load->request),
+        "finished",
+        G_CALLBACK(func),
+        user_data
+      );
+    }
+
+    load->local = TRUE;
+    return load->request;
+  }
+
   /* See whether there is a subreq for this node. If yes, take the request
    * from there instead of creating a new one. Note that this usually does
    * not happen, since clients will ask for pending requests first, and if
@@ -9737,6 +11283,32 @@ infd_directory_browser_get_session(InfBrowser* browser,
   return INF_SESSION_PROXY(node->shared.note.session);
 }
 
+static GSList*
+infd_directory_add_pending_request(GSList* list,
+                                   InfRequest* request,
+                                   const gchar* request_type)
+{
+  gchar* type;
+  gboolean right_type;
+
+  right_type = TRUE;
+  if(request_type != NULL)
+  {
+    g_object_get(G_OBJECT(request), "type", &type, NULL);
+    if(strcmp(type, request_type) != 0)
+      right_type = FALSE;
+    g_free(type);
+  }
+
+  if(right_type == TRUE)
+  {
+    if(g_slist_find(list, request) == NULL)
+      list = g_slist_prepend(list, request);
+  }
+
+  return list;
+}
+
 static GSList*
 infd_directory_browser_list_pending_requests(InfBrowser* browser,
                                              const InfBrowserIter* iter,
@@ -9746,9 +11318,8 @@ infd_directory_browser_list_pending_requests(InfBrowser* browser,
   InfdDirectoryPrivate* priv;
   InfdDirectoryNode* node;
   InfdDirectorySubreq* subreq;
+  InfdDirectoryLoad* load;
   InfRequest* request;
-  gchar* type;
-  gboolean right_type;
   GSList* list;
   GSList* item;
 
@@ -9790,21 +11361,19 @@ infd_directory_browser_list_pending_requests(InfBrowser* browser,
     }
 
     if(request != NULL)
-    {
-      right_type = TRUE;
-      if(request_type != NULL)
-      {
-        g_object_get(G_OBJECT(request), "type", &type, NULL);
-        if(strcmp(type, request_type) != 0)
-          right_type = FALSE;
-        g_free(type);
-      }
+      list = infd_directory_add_pending_request(list, request, request_type);
+  }
 
-      if(right_type == TRUE)
-      {
-        if(g_slist_find(list, request) == NULL)
-          list = g_slist_prepend(list, request);
-      }
+  for(item = priv->loads; item != NULL; item = item->next)
+  {
+    load = (InfdDirectoryLoad*)item->data;
+    if(iter != NULL && load->node == node)
+    {
+      list = infd_directory_add_pending_request(
+        list,
+        load->request,
+        request_type
+      );
     }
   }
 
@@ -10587,6 +12156,21 @@ infd_directory_class_init(InfdDirectoryClass* directory_class)
     )
   );
 
+  g_object_class_install_property(
+    object_class,
+    PROP_MEMORY_BUDGET,
+    g_param_spec_uint64(
+      "memory-budget",
+      "Memory budget",
+      "Number of bytes that idle sessions may occupy before they are "
+      "unloaded, or 0 for no limit",
+      0,
+      G_MAXUINT64,
+      0,
+      G_PARAM_READWRITE
+    )
+  );
+
   g_object_class_install_property(
     object_class,
     PROP_CHAT_SESSION,
@@ -10906,6 +12490,7 @@ infd_directory_add_plugin(InfdDirectory* directory,
       node->shared.note.plugin = plugin;
       node->shared.note.save_timeout = NULL;
       node->shared.note.weakref = FALSE;
+      node->shared.note.lru_link = NULL;
     }
   }
 
@@ -10954,6 +12539,14 @@ infd_directory_remove_plugin(InfdDirectory* directory,
     if(node->type == INFD_DIRECTORY_NODE_NOTE &&
        node->shared.note.plugin == plugin)
     {
+      /* Stop loading the session, if we are */
+      infd_directory_cancel_loads(
+        directory,
+        node,
+        INF_DIRECTORY_ERROR_NOTE_TYPE_UNSUPPORTED,
+        inf_directory_strerror(INF_DIRECTORY_ERROR_NOTE_TYPE_UNSUPPORTED)
+      );
+
       /* First, remove the note's session, if any */
       if(node->shared.note.session != NULL &&
          node->shared.note.weakref == FALSE)
@@ -11481,6 +13074,85 @@ infd_directory_get_chat_session(InfdDirectory* directory)
   return INFD_DIRECTORY_PRIVATE(directory)->chat_session;
 }
 
+/**
+ * infd_directory_set_memory_budget:
+ * @directory: A #InfdDirectory.
+ * @budget: The number of bytes sessions may occupy, or 0.
+ *
+ * Limits the memory used by the sessions of @directory. When the sessions
+ * together occupy more than @budget bytes, idle sessions are saved into the
+ * storage and unloaded, starting with the one that was used least recently,
+ * until the limit is met again. Sessions that have subscribed connections
+ * are never unloaded, so the limit can be exceeded if there are many of
+ * them. The memory used by a session is estimated from the size of its
+ * buffer, as reported by the note plugin, and from the number of requests
+ * in its history.
+ *
+ * If @budget is 0, which is the default, sessions are only unloaded after
+ * they have been idle for some time, independent of their size.
+ */
+void
+infd_directory_set_memory_budget(InfdDirectory* directory,
+                                 guint64 budget)
+{
+  InfdDirectoryPrivate* priv;
+
+  g_return_if_fail(INFD_IS_DIRECTORY(directory));
+  priv = INFD_DIRECTORY_PRIVATE(directory);
+
+  if(priv->memory_budget != budget)
+  {
+    priv->memory_budget = budget;
+    infd_directory_schedule_memory_check(directory, 0);
+
+    g_object_notify(G_OBJECT(directory), "memory-budget");
+  }
+}
+
+/**
+ * infd_directory_get_memory_budget:
+ * @directory: A #InfdDirectory.
+ *
+ * Returns the memory budget of @directory, as set with
+ * infd_directory_set_memory_budget().
+ *
+ * Returns: The maximum number of bytes used by sessions, or 0 if there is
+ * no limit.
+ */
+guint64
+infd_directory_get_memory_budget(InfdDirectory* directory)
+{
+  g_return_val_if_fail(INFD_IS_DIRECTORY(directory), 0);
+  return INFD_DIRECTORY_PRIVATE(directory)->memory_budget;
+}
+
+/**
+ * infd_directory_get_memory_usage:
+ * @directory: A #InfdDirectory.
+ *
+ * Returns an estimate of the number of bytes used by the sessions of
+ * @directory that are currently loaded. This is the value that is compared
+ * to the memory budget, see infd_directory_set_memory_budget().
+ *
+ * Returns: The estimated memory usage of the sessions of @directory.
+ */
+guint64
+infd_directory_get_memory_usage(InfdDirectory* directory)
+{
+  InfdDirectoryPrivate* priv;
+  GList* item;
+  guint64 usage;
+
+  g_return_val_if_fail(INFD_IS_DIRECTORY(directory), 0);
+  priv = INFD_DIRECTORY_PRIVATE(directory);
+
+  usage = 0;
+  for(item = priv->sessions->head; item != NULL; item = item->next)
+    usage += infd_directory_node_get_memory_usage(item->data);
+
+  return usage;
+}
+
 /**
  * infd_directory_create_acl_account:
  * @directory: A #InfdDirectory.
@@ -156,6 +156,16 @@ infd_directory_enable_chat(InfdDirectory* directory,
 InfdSessionProxy*
 infd_directory_get_chat_session(InfdDirectory* directory);
 
+void
+infd_directory_set_memory_budget(InfdDirectory* directory,
+                                 guint64 budget);
+
+guint64
+infd_directory_get_memory_budget(InfdDirectory* directory);
+
+guint64
+infd_directory_get_memory_usage(InfdDirectory* directory);
+
 InfAclAccountId
 infd_directory_create_acl_account(InfdDirectory* directory,
                                   const gchar* account_name,
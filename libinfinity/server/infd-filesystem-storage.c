@@ -33,7 +33,9 @@
 #include <string.h>
 #include <errno.h>
 
-#ifndef G_OS_WIN32
+#ifdef G_OS_WIN32
+# include <io.h>
+#else
 # include <sys/types.h>
 # include <sys/stat.h>
 # include <fcntl.h>
@@ -44,6 +46,10 @@
 typedef struct _InfdFilesystemStoragePrivate InfdFilesystemStoragePrivate;
 struct _InfdFilesystemStoragePrivate {
   gchar* root_directory;
+
+  /* Background I/O worker for infd_storage_run_async(). It has a single
+   * thread, so that tasks are run in the order they have been started. */
+  GThreadPool* worker;
 };
 
 enum {
@@ -204,6 +210,7 @@ infd_filesystem_storage_open_impl(InfdFilesystemStorage* storage,
 #else
   if(strcmp(mode, "r") == 0) open_mode = O_RDONLY;
   else if(strcmp(mode, "w") == 0) open_mode = O_CREAT | O_WRONLY | O_TRUNC;
+  else if(strcmp(mode, "a") == 0) open_mode = O_CREAT | O_WRONLY | O_APPEND;
   else g_assert_not_reached();
   fd = open(path, O_NOFOLLOW | open_mode, 0644);
   if(fd == -1)
@@ -366,6 +373,7 @@ infd_filesystem_storage_init(InfdFilesystemStorage* storage)
   priv = INFD_FILESYSTEM_STORAGE_PRIVATE(storage);
 
   priv->root_directory = NULL;
+  priv->worker = NULL;
 }
 
 static void
@@ -377,6 +385,11 @@ infd_filesystem_storage_finalize(GObject* object)
   storage = INFD_FILESYSTEM_STORAGE(object);
   priv = INFD_FILESYSTEM_STORAGE_PRIVATE(storage);
 
+  /* Every task holds a reference on the storage, so there are no tasks left
+   * at this point. Still wait for the worker to return from the last one. */
+  if(priv->worker != NULL)
+    g_thread_pool_free(priv->worker, FALSE, TRUE);
+
   g_free(priv->root_directory);
 
   G_OBJECT_CLASS(infd_filesystem_storage_parent_class)->finalize(object);
@@ -563,6 +576,7 @@ infd_filesystem_storage_storage_remove_node(InfdStorage* storage,
   gchar* full_name;
   gboolean result;
   int save_errno;
+  guint i;
 
   fs_storage = INFD_FILESYSTEM_STORAGE(storage);
   priv = INFD_FILESYSTEM_STORAGE_PRIVATE(fs_storage);
@@ -589,6 +603,34 @@ infd_filesystem_storage_storage_remove_node(InfdStorage* storage,
   result = inf_file_util_delete(full_name, error);
   g_free(full_name);
 
+  /* Remove the journal of the note and a snapshot left over from an
+   * interrupted compaction of it, if any */
+  for(i = 0; result == TRUE && identifier != NULL && i < 2; ++i)
+  {
+    disk_name = g_strconcat(
+      converted_name,
+      ".",
+      identifier,
+      i == 0 ? ".journal" : ".compact",
+      NULL
+    );
+
+    full_name = g_build_filename(priv->root_directory, disk_name, NULL);
+    g_free(disk_name);
+
+    if(g_unlink(full_name) == -1)
+    {
+      save_errno = errno;
+      if(save_errno != ENOENT)
+      {
+        infd_filesystem_storage_system_error(save_errno, error);
+        result = FALSE;
+      }
+    }
+
+    g_free(full_name);
+  }
+
   if(result == TRUE)
   {
     disk_name = g_strconcat(converted_name, ".xml.acl", NULL);
@@ -799,6 +841,53 @@ infd_filesystem_storage_storage_write_acl(InfdStorage* storage,
   return TRUE;
 }
 
+static void
+infd_filesystem_storage_worker_func(gpointer data,
+                                    gpointer user_data)
+{
+  infd_storage_task_run((InfdStorageTask*)data);
+}
+
+static void
+infd_filesystem_storage_storage_run_async(InfdStorage* storage,
+                                          InfdStorageTask* task)
+{
+  InfdFilesystemStoragePrivate* priv;
+  GError* error;
+
+  priv = INFD_FILESYSTEM_STORAGE_PRIVATE(storage);
+
+  /* The worker is only created when it is first needed, since most
+   * storages are only ever used synchronously. */
+  if(priv->worker == NULL)
+  {
+    error = NULL;
+    priv->worker = g_thread_pool_new(
+      infd_filesystem_storage_worker_func,
+      storage,
+      1,
+      FALSE,
+      &error
+    );
+
+    if(priv->worker == NULL)
+    {
+      g_warning(
+        _("Failed to start the storage I/O thread, running storage "
+          "operations synchronously: %s"),
+        error->message
+      );
+
+      g_error_free(error);
+    }
+  }
+
+  if(priv->worker != NULL)
+    g_thread_pool_push(priv->worker, task, NULL);
+  else
+    infd_storage_task_run(task);
+}
+
 static void
 infd_filesystem_storage_class_init(
   InfdFilesystemStorageClass* filesystem_storage_class)
@@ -840,6 +929,8 @@ infd_filesystem_storage_storage_iface_init(InfdStorageInterface* iface)
     infd_filesystem_storage_storage_read_acl;
   iface->write_acl =
     infd_filesystem_storage_storage_write_acl;
+  iface->run_async =
+    infd_filesystem_storage_storage_run_async;
 }
 
 /**
@@ -918,13 +1009,15 @@ infd_filesystem_storage_get_path(InfdFilesystemStorage* storage,
  * @storage: A #InfdFilesystemStorage.
  * @identifier: The type of node to open.
  * @path: The path to open, in UTF-8.
- * @mode: Either "r" for reading or "w" for writing.
+ * @mode: Either "r" for reading, "w" for writing or "a" for appending.
  * @full_path: (out) (type filename) (transfer full): Return location
  * of the full filename, or %NULL.
  * @error: Location to store error information, if any.
  *
  * Opens a file in the given path within the storage's root directory. If
  * the file exists already, and @mode is set to "w", the file is overwritten.
+ * If @mode is set to "a", data written to the file is always appended to
+ * its end, even if the file is truncated in the meanwhile.
  *
  * If @full_path is not %NULL, then it will be set to a newly allocated
  * string which contains the full name of the opened file, in the Glib file
@@ -1146,4 +1239,49 @@ infd_filesystem_storage_stream_write(FILE* file,
   return fwrite(buffer, 1, len, file);
 }
 
+/**
+ * infd_filesystem_storage_stream_flush:
+ * @file: A #FILE opened with infd_filesystem_storage_open().
+ *
+ * This is a thin wrapper around fflush(). Use this function instead of
+ * fflush() if you have opened the file with infd_filesystem_storage_open(),
+ * to make sure that the same C runtime is flushing the file that has opened
+ * it.
+ *
+ * Returns: The return value of fflush().
+ */
+int
+infd_filesystem_storage_stream_flush(FILE* file)
+{
+  return fflush(file);
+}
+
+/**
+ * infd_filesystem_storage_stream_sync:
+ * @file: A #FILE opened with infd_filesystem_storage_open().
+ *
+ * Flushes @file like infd_filesystem_storage_stream_flush(), and then waits
+ * until the data written to it has reached the disk, so that it survives a
+ * crash of the operating system or a power failure. This can take a long
+ * time, so it should not be called after every small write.
+ *
+ * Returns: 0 on success, or -1 on error, in which case errno is set.
+ */
+int
+infd_filesystem_storage_stream_sync(FILE* file)
+{
+  if(fflush(file) != 0)
+    return -1;
+
+#ifdef G_OS_WIN32
+  return _commit(_fileno(file));
+#elif defined(_POSIX_SYNCHRONIZED_IO) && _POSIX_SYNCHRONIZED_IO > 0
+  /* The file times, which fsync() writes in addition, are not needed to
+   * read the data back */
+  return fdatasync(fileno(file));
+#else
+  return fsync(fileno(file));
+#endif
+}
+
 /* vim:set et sw=2 ts=2: */
@@ -104,6 +104,12 @@ infd_filesystem_storage_stream_write(FILE* file,
                                      gconstpointer buffer,
                                      gsize len);
 
+int
+infd_filesystem_storage_stream_flush(FILE* file);
+
+int
+infd_filesystem_storage_stream_sync(FILE* file);
+
 G_END_DECLS
 
 #endif /* __INFD_FILESYSTEM_STORAGE_H__ */
@@ -53,6 +53,22 @@ typedef gboolean(*InfdNotePluginSessionWrite)(InfdStorage*,
                                               gpointer,
                                               GError**);
 
+typedef gboolean(*InfdNotePluginSessionLoad)(InfdStorage*,
+                                             const gchar*,
+                                             gpointer,
+                                             InfBuffer**,
+                                             InfUserTable**,
+                                             GError**);
+
+typedef InfSession*(*InfdNotePluginSessionCreate)(InfIo*,
+                                                  InfCommunicationManager*,
+                                                  InfBuffer*,
+                                                  InfUserTable*,
+                                                  gpointer);
+
+typedef gsize(*InfdNotePluginBufferSize)(InfBuffer*,
+                                         gpointer);
+
 typedef struct _InfdNotePlugin InfdNotePlugin;
 struct _InfdNotePlugin {
   gpointer user_data;
@@ -67,6 +83,21 @@ struct _InfdNotePlugin {
   InfdNotePluginSessionNew session_new;
   InfdNotePluginSessionRead session_read;
   InfdNotePluginSessionWrite session_write;
+
+  /* Optional. Together these do the same as session_read, but reading
+   * from storage is separated from creating the session, so that
+   * InfdDirectory can run session_load in a background thread. session_load
+   * must therefore only access the storage and the objects it creates
+   * itself. The user table it returns may be NULL. session_create is then
+   * called in the main thread and does not take ownership of the buffer
+   * and user table. */
+  InfdNotePluginSessionLoad session_load;
+  InfdNotePluginSessionCreate session_create;
+
+  /* Optional. Returns an estimate of the number of bytes of memory the
+   * content of the buffer occupies. InfdDirectory uses this to decide which
+   * sessions to unload when its memory budget is exceeded. */
+  InfdNotePluginBufferSize buffer_size;
 };
 
 G_END_DECLS
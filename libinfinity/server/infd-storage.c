@@ -20,6 +20,44 @@
 #include <libinfinity/server/infd-storage.h>
 #include <libinfinity/inf-define-enum.h>
 
+typedef enum _InfdStorageTaskState {
+  INFD_STORAGE_TASK_QUEUED,
+  INFD_STORAGE_TASK_RUNNING,
+  INFD_STORAGE_TASK_DONE,
+  INFD_STORAGE_TASK_CANCELLED
+} InfdStorageTaskState;
+
+struct _InfdStorageTask {
+  InfdStorage* storage;
+  InfIo* io;
+
+  InfdStorageTaskFunc run_func;
+  InfdStorageTaskFunc done_func;
+  gpointer user_data;
+  GDestroyNotify notify;
+
+  /* Protected by infd_storage_task_mutex */
+  InfdStorageTaskState state;
+  InfIoDispatch* dispatch;
+};
+
+typedef struct _InfdStorageAsyncData InfdStorageAsyncData;
+struct _InfdStorageAsyncData {
+  gchar* path;
+  InfAclSheetSet* sheet_set;
+  GCallback func;
+  gpointer user_data;
+
+  /* Results, written by the task's run function */
+  GSList* list;
+  GError* error;
+};
+
+/* A single lock for all tasks, since the worker thread must be able to
+ * release it after handing a task back to the main thread, at which point
+ * the task might already have been freed. */
+static GMutex infd_storage_task_mutex;
+
 static const GEnumValue infd_storage_node_type_values[] = {
   {
     INFD_STORAGE_NODE_SUBDIRECTORY,
@@ -380,4 +418,447 @@ infd_storage_write_acl(InfdStorage* storage,
   return iface->write_acl(storage, path, sheet_set, error);
 }
 
+static void
+infd_storage_task_dispatch_func(gpointer user_data)
+{
+  InfdStorageTask* task;
+  gboolean cancelled;
+
+  task = (InfdStorageTask*)user_data;
+
+  g_mutex_lock(&infd_storage_task_mutex);
+  task->dispatch = NULL;
+  cancelled = (task->state == INFD_STORAGE_TASK_CANCELLED);
+  g_mutex_unlock(&infd_storage_task_mutex);
+
+  if(!cancelled && task->done_func != NULL)
+    task->done_func(task->storage, task->user_data);
+}
+
+static void
+infd_storage_task_free(gpointer data)
+{
+  InfdStorageTask* task;
+  task = (InfdStorageTask*)data;
+
+  if(task->notify != NULL)
+    task->notify(task->user_data);
+
+  g_object_unref(task->io);
+  g_object_unref(task->storage);
+  g_slice_free(InfdStorageTask, task);
+}
+
+/**
+ * infd_storage_run_async:
+ * @storage: A #InfdStorage.
+ * @io: The #InfIo in whose thread @done_func is called.
+ * @run_func: (scope async): Function performing the storage operations.
+ * @done_func: (scope async) (allow-none): Function to be called once
+ * @run_func has finished, or %NULL.
+ * @user_data: Additional data to pass to @run_func and @done_func.
+ * @notify: (allow-none): Function to free @user_data when the task is
+ * freed, or %NULL.
+ *
+ * Runs @run_func without blocking the calling thread, if @storage
+ * supports it. @run_func can call the synchronous storage functions such
+ * as infd_storage_read_subdirectory() on @storage, and should store its
+ * results in @user_data. When it has finished, @done_func is called in the
+ * thread of @io. Tasks on the same storage are run one after the other, in
+ * the order in which they have been started. Note that they are not
+ * ordered with respect to synchronous calls made from other threads.
+ *
+ * If @storage does not support running tasks in the background, then
+ * @run_func is called before this function returns. In either case,
+ * @done_func is never called before this function returns.
+ *
+ * The task can be cancelled with infd_storage_task_cancel() for as long
+ * as @done_func has not yet been called. In that case @done_func is not
+ * called, but @notify is still called to free @user_data, possibly only
+ * after @run_func has finished.
+ *
+ * Returns: (transfer none): A #InfdStorageTask, valid until @done_func
+ * has been called or the task has been cancelled.
+ */
+InfdStorageTask*
+infd_storage_run_async(InfdStorage* storage,
+                       InfIo* io,
+                       InfdStorageTaskFunc run_func,
+                       InfdStorageTaskFunc done_func,
+                       gpointer user_data,
+                       GDestroyNotify notify)
+{
+  InfdStorageInterface* iface;
+  InfdStorageTask* task;
+
+  g_return_val_if_fail(INFD_IS_STORAGE(storage), NULL);
+  g_return_val_if_fail(INF_IS_IO(io), NULL);
+  g_return_val_if_fail(run_func != NULL, NULL);
+
+  task = g_slice_new(InfdStorageTask);
+  task->storage = storage;
+  task->io = io;
+  task->run_func = run_func;
+  task->done_func = done_func;
+  task->user_data = user_data;
+  task->notify = notify;
+  task->state = INFD_STORAGE_TASK_QUEUED;
+  task->dispatch = NULL;
+
+  g_object_ref(storage);
+  g_object_ref(io);
+
+  iface = INFD_STORAGE_GET_IFACE(storage);
+  if(iface->run_async != NULL)
+    iface->run_async(storage, task);
+  else
+    infd_storage_task_run(task);
+
+  return task;
+}
+
+/**
+ * infd_storage_task_run:
+ * @task: A #InfdStorageTask.
+ *
+ * Runs the run function of @task, unless the task has been cancelled, and
+ * then schedules its done function to be called in the thread of the
+ * task's #InfIo. This is most likely only going to be used by #InfdStorage
+ * implementations in their run_async function, and must be called exactly
+ * once for each task. After this function returns, @task must not be
+ * accessed anymore.
+ */
+void
+infd_storage_task_run(InfdStorageTask* task)
+{
+  gboolean cancelled;
+
+  g_return_if_fail(task != NULL);
+
+  g_mutex_lock(&infd_storage_task_mutex);
+  g_assert(task->state == INFD_STORAGE_TASK_QUEUED ||
+           task->state == INFD_STORAGE_TASK_CANCELLED);
+
+  cancelled = (task->state == INFD_STORAGE_TASK_CANCELLED);
+  if(!cancelled)
+    task->state = INFD_STORAGE_TASK_RUNNING;
+  g_mutex_unlock(&infd_storage_task_mutex);
+
+  if(!cancelled)
+    task->run_func(task->storage, task->user_data);
+
+  /* Even a cancelled task is handed back to the thread of the InfIo, so
+   * that its user data is freed in the thread it was created in. */
+  g_mutex_lock(&infd_storage_task_mutex);
+  if(task->state == INFD_STORAGE_TASK_RUNNING)
+    task->state = INFD_STORAGE_TASK_DONE;
+
+  task->dispatch = inf_io_add_dispatch(
+    task->io,
+    infd_storage_task_dispatch_func,
+    task,
+    infd_storage_task_free
+  );
+  g_mutex_unlock(&infd_storage_task_mutex);
+}
+
+/**
+ * infd_storage_task_cancel:
+ * @task: A #InfdStorageTask.
+ *
+ * Cancels @task, so that its done function will not be called. If the run
+ * function is currently being executed, it still runs to completion, but
+ * its result is discarded. This function must be called in the thread of
+ * the task's #InfIo, and must not be called anymore once the done function
+ * has been called.
+ */
+void
+infd_storage_task_cancel(InfdStorageTask* task)
+{
+  InfIoDispatch* dispatch;
+
+  g_return_if_fail(task != NULL);
+
+  g_mutex_lock(&infd_storage_task_mutex);
+  g_assert(task->state != INFD_STORAGE_TASK_CANCELLED);
+
+  task->state = INFD_STORAGE_TASK_CANCELLED;
+  dispatch = task->dispatch;
+  task->dispatch = NULL;
+  g_mutex_unlock(&infd_storage_task_mutex);
+
+  /* If the run function has already finished, then the dispatch has not yet
+   * been executed, since we are running in the same thread. Removing it
+   * frees the task. Otherwise, the task is freed once it has been handed
+   * back by the worker thread. */
+  if(dispatch != NULL)
+    inf_io_remove_dispatch(task->io, dispatch);
+}
+
+static void
+infd_storage_async_data_free(gpointer data)
+{
+  InfdStorageAsyncData* async_data;
+  async_data = (InfdStorageAsyncData*)data;
+
+  if(async_data->sheet_set != NULL)
+    inf_acl_sheet_set_free(async_data->sheet_set);
+  if(async_data->error != NULL)
+    g_error_free(async_data->error);
+
+  g_free(async_data->path);
+  g_slice_free(InfdStorageAsyncData, async_data);
+}
+
+/* If a task is cancelled after its run function has read the list, the
+ * done function does not run, so the list is freed here */
+static void
+infd_storage_read_subdirectory_data_free(gpointer data)
+{
+  InfdStorageAsyncData* async_data;
+  async_data = (InfdStorageAsyncData*)data;
+
+  infd_storage_node_list_free(async_data->list);
+  infd_storage_async_data_free(async_data);
+}
+
+static void
+infd_storage_read_acl_data_free(gpointer data)
+{
+  InfdStorageAsyncData* async_data;
+  async_data = (InfdStorageAsyncData*)data;
+
+  infd_storage_acl_list_free(async_data->list);
+  infd_storage_async_data_free(async_data);
+}
+
+static InfdStorageAsyncData*
+infd_storage_async_data_new(const gchar* path,
+                            GCallback func,
+                            gpointer user_data)
+{
+  InfdStorageAsyncData* async_data;
+
+  async_data = g_slice_new(InfdStorageAsyncData);
+  async_data->path = g_strdup(path);
+  async_data->sheet_set = NULL;
+  async_data->func = func;
+  async_data->user_data = user_data;
+  async_data->list = NULL;
+  async_data->error = NULL;
+
+  return async_data;
+}
+
+static void
+infd_storage_read_subdirectory_run_func(InfdStorage* storage,
+                                        gpointer user_data)
+{
+  InfdStorageAsyncData* async_data;
+  async_data = (InfdStorageAsyncData*)user_data;
+
+  async_data->list = infd_storage_read_subdirectory(
+    storage,
+    async_data->path,
+    &async_data->error
+  );
+}
+
+static void
+infd_storage_read_subdirectory_done_func(InfdStorage* storage,
+                                         gpointer user_data)
+{
+  InfdStorageAsyncData* async_data;
+  InfdStorageReadSubdirectoryFunc func;
+
+  async_data = (InfdStorageAsyncData*)user_data;
+  func = (InfdStorageReadSubdirectoryFunc)async_data->func;
+
+  func(storage, async_data->list, async_data->error, async_data->user_data);
+
+  infd_storage_node_list_free(async_data->list);
+  async_data->list = NULL;
+}
+
+static void
+infd_storage_read_acl_run_func(InfdStorage* storage,
+                               gpointer user_data)
+{
+  InfdStorageAsyncData* async_data;
+  async_data = (InfdStorageAsyncData*)user_data;
+
+  async_data->list = infd_storage_read_acl(
+    storage,
+    async_data->path,
+    &async_data->error
+  );
+}
+
+static void
+infd_storage_read_acl_done_func(InfdStorage* storage,
+                                gpointer user_data)
+{
+  InfdStorageAsyncData* async_data;
+  InfdStorageReadAclFunc func;
+
+  async_data = (InfdStorageAsyncData*)user_data;
+  func = (InfdStorageReadAclFunc)async_data->func;
+
+  func(storage, async_data->list, async_data->error, async_data->user_data);
+
+  infd_storage_acl_list_free(async_data->list);
+  async_data->list = NULL;
+}
+
+static void
+infd_storage_write_acl_run_func(InfdStorage* storage,
+                                gpointer user_data)
+{
+  InfdStorageAsyncData* async_data;
+  async_data = (InfdStorageAsyncData*)user_data;
+
+  infd_storage_write_acl(
+    storage,
+    async_data->path,
+    async_data->sheet_set,
+    &async_data->error
+  );
+}
+
+static void
+infd_storage_write_acl_done_func(InfdStorage* storage,
+                                 gpointer user_data)
+{
+  InfdStorageAsyncData* async_data;
+  InfdStorageWriteAclFunc func;
+
+  async_data = (InfdStorageAsyncData*)user_data;
+  func = (InfdStorageWriteAclFunc)async_data->func;
+
+  if(func != NULL)
+    func(storage, async_data->error, async_data->user_data);
+}
+
+/**
+ * infd_storage_read_subdirectory_async:
+ * @storage: A #InfdStorage.
+ * @io: The #InfIo in whose thread @func is called.
+ * @path: A path pointing to a subdirectory node.
+ * @func: (scope async): Function to be called with the result.
+ * @user_data: Additional data to pass to @func.
+ *
+ * Reads a subdirectory from the storage like
+ * infd_storage_read_subdirectory(), but without blocking the calling
+ * thread if @storage supports it. See infd_storage_run_async() for
+ * details.
+ *
+ * Returns: (transfer none): A #InfdStorageTask which can be used to cancel
+ * the operation.
+ */
+InfdStorageTask*
+infd_storage_read_subdirectory_async(InfdStorage* storage,
+                                     InfIo* io,
+                                     const gchar* path,
+                                     InfdStorageReadSubdirectoryFunc func,
+                                     gpointer user_data)
+{
+  g_return_val_if_fail(INFD_IS_STORAGE(storage), NULL);
+  g_return_val_if_fail(INF_IS_IO(io), NULL);
+  g_return_val_if_fail(path != NULL, NULL);
+  g_return_val_if_fail(func != NULL, NULL);
+
+  return infd_storage_run_async(
+    storage,
+    io,
+    infd_storage_read_subdirectory_run_func,
+    infd_storage_read_subdirectory_done_func,
+    infd_storage_async_data_new(path, G_CALLBACK(func), user_data),
+    infd_storage_read_subdirectory_data_free
+  );
+}
+
+/**
+ * infd_storage_read_acl_async:
+ * @storage: A #InfdStorage.
+ * @io: The #InfIo in whose thread @func is called.
+ * @path: A path pointing to an existing node.
+ * @func: (scope async): Function to be called with the result.
+ * @user_data: Additional data to pass to @func.
+ *
+ * Reads the ACL for the node at @path like infd_storage_read_acl(), but
+ * without blocking the calling thread if @storage supports it. See
+ * infd_storage_run_async() for details.
+ *
+ * Returns: (transfer none): A #InfdStorageTask which can be used to cancel
+ * the operation.
+ */
+InfdStorageTask*
+infd_storage_read_acl_async(InfdStorage* storage,
+                            InfIo* io,
+                            const gchar* path,
+                            InfdStorageReadAclFunc func,
+                            gpointer user_data)
+{
+  g_return_val_if_fail(INFD_IS_STORAGE(storage), NULL);
+  g_return_val_if_fail(INF_IS_IO(io), NULL);
+  g_return_val_if_fail(path != NULL, NULL);
+  g_return_val_if_fail(func != NULL, NULL);
+
+  return infd_storage_run_async(
+    storage,
+    io,
+    infd_storage_read_acl_run_func,
+    infd_storage_read_acl_done_func,
+    infd_storage_async_data_new(path, G_CALLBACK(func), user_data),
+    infd_storage_read_acl_data_free
+  );
+}
+
+/**
+ * infd_storage_write_acl_async:
+ * @storage: A #InfdStorage.
+ * @io: The #InfIo in whose thread @func is called.
+ * @path: A path to an existing node.
+ * @sheet_set: Sheets to set for the node at @path, or %NULL.
+ * @func: (scope async) (allow-none): Function to be called with the
+ * result, or %NULL.
+ * @user_data: Additional data to pass to @func.
+ *
+ * Writes the ACL defined by @sheet_set into storage like
+ * infd_storage_write_acl(), but without blocking the calling thread if
+ * @storage supports it. @sheet_set is copied, so it can be freed or
+ * modified after this function returns. See infd_storage_run_async() for
+ * details.
+ *
+ * Returns: (transfer none): A #InfdStorageTask which can be used to cancel
+ * the operation.
+ */
+InfdStorageTask*
+infd_storage_write_acl_async(InfdStorage* storage,
+                             InfIo* io,
+                             const gchar* path,
+                             const InfAclSheetSet* sheet_set,
+                             InfdStorageWriteAclFunc func,
+                             gpointer user_data)
+{
+  InfdStorageAsyncData* async_data;
+
+  g_return_val_if_fail(INFD_IS_STORAGE(storage), NULL);
+  g_return_val_if_fail(INF_IS_IO(io), NULL);
+  g_return_val_if_fail(path != NULL, NULL);
+
+  async_data = infd_storage_async_data_new(path, G_CALLBACK(func), user_data);
+  if(sheet_set != NULL)
+    async_data->sheet_set = inf_acl_sheet_set_copy(sheet_set);
+
+  return infd_storage_run_async(
+    storage,
+    io,
+    infd_storage_write_acl_run_func,
+    infd_storage_write_acl_done_func,
+    async_data,
+    infd_storage_async_data_free
+  );
+}
+
 /* vim:set et sw=2 ts=2: */
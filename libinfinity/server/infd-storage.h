@@ -23,6 +23,7 @@
 #include <glib-object.h>
 
 #include <libinfinity/common/inf-acl.h>
+#include <libinfinity/common/inf-io.h>
 
 G_BEGIN_DECLS
 
@@ -38,6 +39,15 @@ G_BEGIN_DECLS
 typedef struct _InfdStorage InfdStorage;
 typedef struct _InfdStorageInterface InfdStorageInterface;
 
+/**
+ * InfdStorageTask: (foreign)
+ *
+ * #InfdStorageTask is an opaque data type representing an asynchronous
+ * storage operation started with infd_storage_run_async() or one of the
+ * typed convenience functions such as infd_storage_read_subdirectory_async().
+ */
+typedef struct _InfdStorageTask InfdStorageTask;
+
 typedef enum _InfdStorageNodeType {
   INFD_STORAGE_NODE_SUBDIRECTORY,
   INFD_STORAGE_NODE_NOTE
@@ -58,13 +68,72 @@ struct _InfdStorageAcl {
   InfAclMask perms;  
 };
 
+/**
+ * InfdStorageTaskFunc:
+ * @storage: The #InfdStorage the task runs on.
+ * @user_data: Data passed to infd_storage_run_async().
+ *
+ * Signature of the functions passed to infd_storage_run_async(). The run
+ * function is called in a background thread if the storage supports it,
+ * and may call the synchronous storage functions. The done function is
+ * called afterwards in the thread of the #InfIo passed to
+ * infd_storage_run_async().
+ */
+typedef void(*InfdStorageTaskFunc)(InfdStorage* storage,
+                                   gpointer user_data);
+
+/**
+ * InfdStorageReadSubdirectoryFunc:
+ * @storage: The #InfdStorage that was read from.
+ * @nodes: (element-type InfdStorageNode): The nodes in the subdirectory, or
+ * %NULL if the subdirectory is empty or an error occurred.
+ * @error: Error information in case the operation failed, or %NULL.
+ * @user_data: Data passed to infd_storage_read_subdirectory_async().
+ *
+ * Signature of the function called when
+ * infd_storage_read_subdirectory_async() has finished. @nodes is freed
+ * after the function returns.
+ */
+typedef void(*InfdStorageReadSubdirectoryFunc)(InfdStorage* storage,
+                                               GSList* nodes,
+                                               const GError* error,
+                                               gpointer user_data);
+
+/**
+ * InfdStorageReadAclFunc:
+ * @storage: The #InfdStorage that was read from.
+ * @acl: (element-type InfdStorageAcl): The ACL of the node, or %NULL if it
+ * has none or an error occurred.
+ * @error: Error information in case the operation failed, or %NULL.
+ * @user_data: Data passed to infd_storage_read_acl_async().
+ *
+ * Signature of the function called when infd_storage_read_acl_async() has
+ * finished. @acl is freed after the function returns.
+ */
+typedef void(*InfdStorageReadAclFunc)(InfdStorage* storage,
+                                      GSList* acl,
+                                      const GError* error,
+                                      gpointer user_data);
+
+/**
+ * InfdStorageWriteAclFunc:
+ * @storage: The #InfdStorage that was written to.
+ * @error: Error information in case the operation failed, or %NULL.
+ * @user_data: Data passed to infd_storage_write_acl_async().
+ *
+ * Signature of the function called when infd_storage_write_acl_async() has
+ * finished.
+ */
+typedef void(*InfdStorageWriteAclFunc)(InfdStorage* storage,
+                                       const GError* error,
+                                       gpointer user_data);
+
 struct _InfdStorageInterface {
   GTypeInterface parent;
 
-  /* All these calls are supposed to be synchronous, e.g. completly perform
-   * the required task. Some day, we could implement asynchronous
-   * behaviour in InfdDirectory (e.g. it caches operations and executes
-   * them via the storage in the background). */
+  /* All these calls are synchronous, e.g. completly perform the required
+   * task. Use infd_storage_run_async() to perform them without blocking
+   * the calling thread. */
 
   /* Virtual Table */
   GSList* (*read_subdirectory)(InfdStorage* storage,
@@ -91,6 +160,13 @@ struct _InfdStorageInterface {
                         const gchar* path,
                         const InfAclSheetSet* sheet_set,
                         GError** error);
+
+  /* Optional. Arranges for infd_storage_task_run() to be called for task
+   * in a background thread. Tasks must be run in the order in which they
+   * are passed to this function. If not implemented, tasks are run
+   * synchronously in infd_storage_run_async(). */
+  void (*run_async)(InfdStorage* storage,
+                    InfdStorageTask* task);
 };
 
 GType
@@ -157,6 +233,42 @@ infd_storage_write_acl(InfdStorage* storage,
                        const InfAclSheetSet* sheet_set,
                        GError** error);
 
+InfdStorageTask*
+infd_storage_run_async(InfdStorage* storage,
+                       InfIo* io,
+                       InfdStorageTaskFunc run_func,
+                       InfdStorageTaskFunc done_func,
+                       gpointer user_data,
+                       GDestroyNotify notify);
+
+void
+infd_storage_task_run(InfdStorageTask* task);
+
+void
+infd_storage_task_cancel(InfdStorageTask* task);
+
+InfdStorageTask*
+infd_storage_read_subdirectory_async(InfdStorage* storage,
+                                     InfIo* io,
+                                     const gchar* path,
+                                     InfdStorageReadSubdirectoryFunc func,
+                                     gpointer user_data);
+
+InfdStorageTask*
+infd_storage_read_acl_async(InfdStorage* storage,
+                            InfIo* io,
+                            const gchar* path,
+                            InfdStorageReadAclFunc func,
+                            gpointer user_data);
+
+InfdStorageTask*
+infd_storage_write_acl_async(InfdStorage* storage,
+                             InfIo* io,
+                             const gchar* path,
+                             const InfAclSheetSet* sheet_set,
+                             InfdStorageWriteAclFunc func,
+                             gpointer user_data);
+
 G_END_DECLS
 
 #endif /* __INFD_STORAGE_H__ */
@@ -17,6 +17,11 @@
  * MA 02110-1301, USA.
  */
 
+/* Required for accept4() */
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+
 #include <libinfinity/server/infd-tcp-server.h>
 #include <libinfinity/common/inf-tcp-connection-private.h>
 #include <libinfinity/common/inf-ip-address.h>
@@ -28,6 +33,8 @@
 #ifndef G_OS_WIN32
 # include <sys/types.h>
 # include <sys/socket.h>
+# include <sys/stat.h>
+# include <sys/un.h>
 # include <netinet/in.h>
 # include <arpa/inet.h>
 # include <unistd.h>
@@ -65,8 +72,16 @@ struct _InfdTcpServerPrivate {
 
   InfIpAddress* local_address;
   guint local_port;
+  gchar* unix_path;
 
   InfKeepalive keepalive;
+  guint congestion_timeout;
+  gboolean reuse_port;
+
+  guint64 n_accepted;
+  guint64 n_batches;
+  gint64 total_accept_latency;
+  gint64 max_accept_latency;
 };
 
 enum {
@@ -78,8 +93,11 @@ enum {
 
   PROP_LOCAL_ADDRESS,
   PROP_LOCAL_PORT,
+  PROP_UNIX_PATH,
 
-  PROP_KEEPALIVE
+  PROP_KEEPALIVE,
+  PROP_CONGESTION_TIMEOUT,
+  PROP_REUSE_PORT
 };
 
 enum {
@@ -154,6 +172,21 @@ infd_tcp_server_system_error(InfdTcpServer* server,
   g_error_free(error);
 }
 
+/* Removes the socket file of a server bound to a Unix domain socket, so
+ * that clients fail to connect right away instead of finding a dead
+ * socket. */
+static void
+infd_tcp_server_remove_unix_path(InfdTcpServer* server)
+{
+#ifndef G_OS_WIN32
+  InfdTcpServerPrivate* priv;
+  priv = INFD_TCP_SERVER_PRIVATE(server);
+
+  if(priv->unix_path != NULL)
+    unlink(priv->unix_path);
+#endif
+}
+
 static void
 infd_tcp_server_io(InfNativeSocket* socket,
                    InfIoEvent events,
@@ -171,11 +204,18 @@ infd_tcp_server_io(InfNativeSocket* socket,
     struct sockaddr in_generic;
     struct sockaddr_in in;
     struct sockaddr_in6 in6;
+#ifndef G_OS_WIN32
+    struct sockaddr_un un;
+#endif
   } native_addr;
 
   InfIpAddress* address;
   guint port;
 
+  gint64 wakeup_time;
+  gint64 latency;
+  guint n_accepted;
+
   server = INFD_TCP_SERVER(user_data);
   priv = INFD_TCP_SERVER_PRIVATE(server);
   g_object_ref(G_OBJECT(server));
@@ -193,6 +233,12 @@ infd_tcp_server_io(InfNativeSocket* socket,
   }
   else if(events & INF_IO_INCOMING)
   {
+    /* Accept latency is measured from the time we are woken up, so that it
+     * includes the time spent handling connections accepted earlier in the
+     * same batch. */
+    wakeup_time = g_get_monotonic_time();
+    n_accepted = 0;
+
     do
     {
       /* Note that we do not do anything with native_addr and len. This is
@@ -206,7 +252,17 @@ infd_tcp_server_io(InfNativeSocket* socket,
       errno = 0;
 #endif
       len = sizeof(native_addr);
+#ifdef HAVE_ACCEPT4
+      /* Saves the fcntl() calls to make the new socket non-blocking */
+      new_socket = accept4(
+        priv->socket,
+        &native_addr.in_generic,
+        &len,
+        SOCK_NONBLOCK | SOCK_CLOEXEC
+      );
+#else
       new_socket = accept(priv->socket, &native_addr.in_generic, &len);
+#endif
       errcode = INF_NATIVE_SOCKET_LAST_ERROR;
 
       if(new_socket == INVALID_SOCKET &&
@@ -227,25 +283,52 @@ infd_tcp_server_io(InfNativeSocket* socket,
           address = inf_ip_address_new_raw6(native_addr.in6.sin6_addr.s6_addr);
           port = ntohs(native_addr.in6.sin6_port);
           break;
+#ifndef G_OS_WIN32
+        case AF_UNIX:
+          address = NULL;
+          port = 0;
+          break;
+#endif
         default:
           g_assert_not_reached();
           break;
         }
 
         error = NULL;
-        connection = _inf_tcp_connection_accepted(
-          priv->io,
-          new_socket,
-          address,
-          port,
-          &priv->keepalive,
-          &error
-        );
+        if(address == NULL)
+        {
+          connection = _inf_tcp_connection_accepted_unix(
+            priv->io,
+            new_socket,
+            priv->unix_path,
+            &error
+          );
+        }
+        else
+        {
+          connection = _inf_tcp_connection_accepted(
+            priv->io,
+            new_socket,
+            address,
+            port,
+            &priv->keepalive,
+            &error
+          );
 
-        /* _inf_tcp_connection_accepted() takes ownership of address */
+          /* _inf_tcp_connection_accepted() takes ownership of address */
+        }
 
         if(connection != NULL)
         {
+          if(priv->congestion_timeout > 0)
+          {
+            g_object_set(
+              G_OBJECT(connection),
+              "congestion-timeout", priv->congestion_timeout,
+              NULL
+            );
+          }
+
           g_signal_emit(
             G_OBJECT(server),
             tcp_server_signals[NEW_CONNECTION],
@@ -254,6 +337,13 @@ infd_tcp_server_io(InfNativeSocket* socket,
           );
 
           g_object_unref(connection);
+
+          latency = g_get_monotonic_time() - wakeup_time;
+          ++n_accepted;
+          ++priv->n_accepted;
+          priv->total_accept_latency += latency;
+          if(latency > priv->max_accept_latency)
+            priv->max_accept_latency = latency;
         }
         else
         {
@@ -272,6 +362,9 @@ infd_tcp_server_io(InfNativeSocket* socket,
               (new_socket == INVALID_SOCKET &&
                errcode == INF_NATIVE_SOCKET_EINTR)) &&
              (priv->socket != INVALID_SOCKET));
+
+    if(n_accepted > 0)
+      ++priv->n_batches;
   }
 
   g_object_unref(G_OBJECT(server));
@@ -290,8 +383,16 @@ infd_tcp_server_init(InfdTcpServer* server)
 
   priv->local_address = NULL;
   priv->local_port = 0;
+  priv->unix_path = NULL;
 
   priv->keepalive.mask = 0;
+  priv->congestion_timeout = 0;
+  priv->reuse_port = FALSE;
+
+  priv->n_accepted = 0;
+  priv->n_batches = 0;
+  priv->total_accept_latency = 0;
+  priv->max_accept_latency = 0;
 }
 
 static void
@@ -327,6 +428,8 @@ infd_tcp_server_finalize(GObject* object)
   if(priv->local_address != NULL)
     inf_ip_address_free(priv->local_address);
 
+  g_free(priv->unix_path);
+
   G_OBJECT_CLASS(infd_tcp_server_parent_class)->finalize(object);
 }
 
@@ -359,10 +462,22 @@ infd_tcp_server_set_property(GObject* object,
     g_assert(priv->status == INFD_TCP_SERVER_CLOSED);
     priv->local_port = g_value_get_uint(value);
     break;
+  case PROP_UNIX_PATH:
+    g_assert(priv->status == INFD_TCP_SERVER_CLOSED);
+    g_free(priv->unix_path);
+    priv->unix_path = g_value_dup_string(value);
+    break;
   case PROP_KEEPALIVE:
     g_assert(g_value_get_boxed(value) != NULL);
     priv->keepalive = *(const InfKeepalive*)g_value_get_boxed(value);
     break;
+  case PROP_CONGESTION_TIMEOUT:
+    priv->congestion_timeout = g_value_get_uint(value);
+    break;
+  case PROP_REUSE_PORT:
+    g_assert(priv->status == INFD_TCP_SERVER_CLOSED);
+    priv->reuse_port = g_value_get_boolean(value);
+    break;
   default:
     G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
     break;
@@ -395,9 +510,18 @@ infd_tcp_server_get_property(GObject* object,
   case PROP_LOCAL_PORT:
     g_value_set_uint(value, priv->local_port);
     break;
+  case PROP_UNIX_PATH:
+    g_value_set_string(value, priv->unix_path);
+    break;
   case PROP_KEEPALIVE:
     g_value_set_boxed(value, &priv->keepalive);
     break;
+  case PROP_CONGESTION_TIMEOUT:
+    g_value_set_uint(value, priv->congestion_timeout);
+    break;
+  case PROP_REUSE_PORT:
+    g_value_set_boolean(value, priv->reuse_port);
+    break;
   default:
     G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
     break;
@@ -426,6 +550,8 @@ infd_tcp_server_error(InfdTcpServer* server,
 
   if(priv->status != INFD_TCP_SERVER_CLOSED)
   {
+    infd_tcp_server_remove_unix_path(server);
+
     priv->status = INFD_TCP_SERVER_CLOSED;
     g_object_notify(G_OBJECT(server), "status");
   }
@@ -496,6 +622,18 @@ infd_tcp_server_class_init(InfdTcpServerClass* tcp_server_class)
     )
   );
 
+  g_object_class_install_property(
+    object_class,
+    PROP_UNIX_PATH,
+    g_param_spec_string(
+      "unix-path",
+      "Unix path",
+      "Path of a Unix domain socket to bind to instead of a TCP port",
+      NULL,
+      G_PARAM_READWRITE
+    )
+  );
+
   g_object_class_install_property(
     object_class,
     PROP_KEEPALIVE,
@@ -508,6 +646,35 @@ infd_tcp_server_class_init(InfdTcpServerClass* tcp_server_class)
     )
   );
 
+  g_object_class_install_property(
+    object_class,
+    PROP_CONGESTION_TIMEOUT,
+    g_param_spec_uint(
+      "congestion-timeout",
+      "Congestion timeout",
+      "Time in milliseconds after which accepted connections that stay "
+      "congested are closed, or 0 to never close them",
+      0,
+      G_MAXUINT,
+      0,
+      G_PARAM_READWRITE
+    )
+  );
+
+  g_object_class_install_property(
+    object_class,
+    PROP_REUSE_PORT,
+    g_param_spec_boolean(
+      "reuse-port",
+      "Reuse port",
+      "Whether to allow other servers to bind to the same address and port "
+      "at the same time, with the kernel distributing incoming connections "
+      "among them",
+      FALSE,
+      G_PARAM_READWRITE
+    )
+  );
+
   tcp_server_signals[NEW_CONNECTION] = g_signal_new(
     "new-connection",
     G_OBJECT_CLASS_TYPE(object_class),
@@ -533,6 +700,76 @@ infd_tcp_server_class_init(InfdTcpServerClass* tcp_server_class)
   );
 }
 
+static gboolean
+infd_tcp_server_bind_unix(InfdTcpServer* server,
+                          GError** error)
+{
+#ifndef G_OS_WIN32
+  InfdTcpServerPrivate* priv;
+  struct sockaddr_un native_address;
+  struct stat st;
+  InfNativeSocket probe;
+
+  priv = INFD_TCP_SERVER_PRIVATE(server);
+
+  if(strlen(priv->unix_path) >= sizeof(native_address.sun_path))
+  {
+    inf_native_socket_make_error(ENAMETOOLONG, error);
+    return FALSE;
+  }
+
+  memset(&native_address, 0, sizeof(native_address));
+  native_address.sun_family = AF_UNIX;
+  strcpy(native_address.sun_path, priv->unix_path);
+
+  /* Remove a socket file left behind by a server that did not shut down
+   * cleanly, but do not take over the socket of a server which is still
+   * accepting connections on it. */
+  if(lstat(priv->unix_path, &st) == 0 && S_ISSOCK(st.st_mode))
+  {
+    probe = socket(PF_UNIX, SOCK_STREAM, 0);
+    if(probe != INVALID_SOCKET)
+    {
+      if(connect(probe, (struct sockaddr*)&native_address,
+                 sizeof(native_address)) == 0)
+      {
+        closesocket(probe);
+        inf_native_socket_make_error(EADDRINUSE, error);
+        return FALSE;
+      }
+
+      closesocket(probe);
+    }
+
+    unlink(priv->unix_path);
+  }
+
+  priv->socket = socket(PF_UNIX, SOCK_STREAM, 0);
+  if(priv->socket == INVALID_SOCKET)
+  {
+    inf_native_socket_make_error(INF_NATIVE_SOCKET_LAST_ERROR, error);
+    return FALSE;
+  }
+
+  if(bind(priv->socket, (struct sockaddr*)&native_address,
+          sizeof(native_address)) == -1)
+  {
+    inf_native_socket_make_error(INF_NATIVE_SOCKET_LAST_ERROR, error);
+
+    closesocket(priv->socket);
+    priv->socket = INVALID_SOCKET;
+    return FALSE;
+  }
+
+  priv->status = INFD_TCP_SERVER_BOUND;
+  g_object_notify(G_OBJECT(server), "status");
+  return TRUE;
+#else
+  inf_native_socket_make_error(WSAEAFNOSUPPORT, error);
+  return FALSE;
+#endif
+}
+
 /**
  * infd_tcp_server_bind:
  * @server: A #InfdTcpServer.
@@ -544,6 +781,20 @@ infd_tcp_server_class_init(InfdTcpServerClass* tcp_server_class)
  * is 0, a random available port will be assigned. If the function fails,
  * %FALSE is returned and an error is set.
  *
+ * If #InfdTcpServer:reuse-port is %TRUE, then the socket is bound with
+ * SO_REUSEPORT, so that several servers, typically each one running in its
+ * own thread with its own #InfIo, can listen on the same address and port.
+ * The kernel then distributes incoming connections among them. Binding fails
+ * if the platform does not support this.
+ *
+ * If #InfdTcpServer:unix-path is set, the server is bound to a Unix domain
+ * socket at that path instead, and the other properties are ignored. A
+ * socket file left behind by a previous server at the same path is removed,
+ * unless that server is still running. The socket file is removed again
+ * when the server is closed. Access to the server is controlled by the
+ * permissions of the socket file and its directory. Unix domain sockets are
+ * not supported on Windows.
+ *
  * @server must be in %INFD_TCP_SERVER_CLOSED state for this function to be
  * called.
  *
@@ -563,7 +814,8 @@ infd_tcp_server_bind(InfdTcpServer* server,
   struct sockaddr* addr;
   socklen_t addrlen;
 
-#if !defined(G_OS_WIN32) && defined(HAVE_SO_REUSEADDR)
+#if !defined(G_OS_WIN32) && \
+    (defined(HAVE_SO_REUSEADDR) || defined(HAVE_SO_REUSEPORT))
   int value;
 #endif
 
@@ -572,6 +824,9 @@ infd_tcp_server_bind(InfdTcpServer* server,
 
   g_return_val_if_fail(priv->status == INFD_TCP_SERVER_CLOSED, FALSE);
 
+  if(priv->unix_path != NULL)
+    return infd_tcp_server_bind_unix(server, error);
+
   if(priv->local_address == NULL)
   {
     priv->socket = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
@@ -643,6 +898,29 @@ infd_tcp_server_bind(InfdTcpServer* server,
   }
 #endif
 
+  if(priv->reuse_port)
+  {
+#if !defined(G_OS_WIN32) && defined(HAVE_SO_REUSEPORT)
+    value = 1;
+
+    if(setsockopt(priv->socket, SOL_SOCKET, SO_REUSEPORT, &value,
+        sizeof(int)) == -1)
+    {
+      inf_native_socket_make_error(INF_NATIVE_SOCKET_LAST_ERROR, error);
+
+      closesocket(priv->socket);
+      priv->socket = INVALID_SOCKET;
+      return FALSE;
+    }
+#else
+    inf_native_socket_make_error(INF_NATIVE_SOCKET_ENOPROTOOPT, error);
+
+    closesocket(priv->socket);
+    priv->socket = INVALID_SOCKET;
+    return FALSE;
+#endif
+  }
+
   if(bind(priv->socket, addr, addrlen) == -1)
   {
     inf_native_socket_make_error(INF_NATIVE_SOCKET_LAST_ERROR, error);
@@ -769,7 +1047,10 @@ infd_tcp_server_open(InfdTcpServer* server,
   }
 #endif
 
-  if(listen(priv->socket, 5) == -1)
+  /* Use the largest backlog the system allows, so that connections arriving
+   * in a burst, for example all clients reconnecting after a network outage,
+   * are queued by the kernel instead of being refused. */
+  if(listen(priv->socket, SOMAXCONN) == -1)
   {
     inf_native_socket_make_error(INF_NATIVE_SOCKET_LAST_ERROR, error);
     if(!was_bound)
@@ -778,10 +1059,11 @@ infd_tcp_server_open(InfdTcpServer* server,
     return FALSE;
   }
 
+  /* infd_tcp_server_io() accepts connections until accept() would block */
   priv->watch = inf_io_add_watch(
     priv->io,
     &priv->socket,
-    INF_IO_INCOMING | INF_IO_ERROR,
+    INF_IO_INCOMING | INF_IO_ERROR | INF_IO_EDGE_TRIGGERED,
     infd_tcp_server_io,
     server,
     NULL
@@ -821,6 +1103,8 @@ infd_tcp_server_close(InfdTcpServer* server)
   closesocket(priv->socket);
   priv->socket = INVALID_SOCKET;
 
+  infd_tcp_server_remove_unix_path(server);
+
   priv->status = INFD_TCP_SERVER_CLOSED;
   g_object_notify(G_OBJECT(server), "status");
 }
@@ -858,4 +1142,54 @@ infd_tcp_server_get_keepalive(InfdTcpServer* server)
   return &INFD_TCP_SERVER_PRIVATE(server)->keepalive;
 }
 
+/**
+ * infd_tcp_server_get_accept_statistics:
+ * @server: A #InfdTcpServer.
+ * @n_accepted: (out) (allow-none): Location to store the number of accepted
+ * connections, or %NULL.
+ * @n_batches: (out) (allow-none): Location to store the number of wakeups
+ * in which at least one connection was accepted, or %NULL.
+ * @average_latency: (out) (allow-none): Location to store the average accept
+ * latency in microseconds, or %NULL.
+ * @max_latency: (out) (allow-none): Location to store the maximum accept
+ * latency in microseconds, or %NULL.
+ *
+ * Returns statistics about the connections accepted by @server since it was
+ * created. The accept latency of a connection is the time between @server
+ * being notified about pending connections and the
+ * #InfdTcpServer::new-connection signal for that connection having been
+ * emitted. Since all pending connections are accepted in one go, it includes
+ * the time spent in signal handlers for connections accepted before it in
+ * the same batch. The ratio of @n_accepted to @n_batches shows how many
+ * connections arrive at the same time.
+ */
+void
+infd_tcp_server_get_accept_statistics(InfdTcpServer* server,
+                                      guint64* n_accepted,
+                                      guint64* n_batches,
+                                      gint64* average_latency,
+                                      gint64* max_latency)
+{
+  InfdTcpServerPrivate* priv;
+
+  g_return_if_fail(INFD_IS_TCP_SERVER(server));
+  priv = INFD_TCP_SERVER_PRIVATE(server);
+
+  if(n_accepted != NULL)
+    *n_accepted = priv->n_accepted;
+  if(n_batches != NULL)
+    *n_batches = priv->n_batches;
+
+  if(average_latency != NULL)
+  {
+    if(priv->n_accepted > 0)
+      *average_latency = priv->total_accept_latency / priv->n_accepted;
+    else
+      *average_latency = 0;
+  }
+
+  if(max_latency != NULL)
+    *max_latency = priv->max_accept_latency;
+}
+
 /* vim:set et sw=2 ts=2: */
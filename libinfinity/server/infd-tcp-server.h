@@ -83,6 +83,13 @@ infd_tcp_server_set_keepalive(InfdTcpServer* server,
 const InfKeepalive*
 infd_tcp_server_get_keepalive(InfdTcpServer* server);
 
+void
+infd_tcp_server_get_accept_statistics(InfdTcpServer* server,
+                                      guint64* n_accepted,
+                                      guint64* n_batches,
+                                      gint64* average_latency,
+                                      gint64* max_latency);
+
 G_END_DECLS
 
 #endif /* __INFD_TCP_SERVER_H__ */
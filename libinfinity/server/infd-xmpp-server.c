@@ -41,12 +41,18 @@ struct _InfdXmppServerPrivate {
   InfdXmppServerStatus status;
   gchar* local_hostname;
   InfXmppConnectionSecurityPolicy security_policy;
+  gboolean compression;
+  gboolean binary_encoding;
 
   InfCertificateCredentials* tls_creds;
 
   InfSaslContext* sasl_context;
   InfSaslContext* sasl_own_context;
   gchar* sasl_mechanisms;
+
+  /* TLS handshake statistics */
+  guint64 n_full_handshakes;
+  guint64 n_resumed_handshakes;
 };
 
 enum {
@@ -60,6 +66,8 @@ enum {
   PROP_SASL_MECHANISMS,
 
   PROP_SECURITY_POLICY,
+  PROP_COMPRESSION,
+  PROP_BINARY_ENCODING,
 
   /* Overridden from XML server */
   PROP_STATUS
@@ -80,6 +88,33 @@ G_DEFINE_TYPE_WITH_CODE(InfdXmppServer, infd_xmpp_server, G_TYPE_OBJECT,
   G_ADD_PRIVATE(InfdXmppServer)
   G_IMPLEMENT_INTERFACE(INFD_TYPE_XML_SERVER, infd_xmpp_server_xml_server_iface_init))
 
+static void
+infd_xmpp_server_notify_tls_enabled_cb(GObject* object,
+                                       GParamSpec* pspec,
+                                       gpointer user_data)
+{
+  InfdXmppServerPrivate* priv;
+  InfXmppConnection* xmpp_connection;
+
+  priv = INFD_XMPP_SERVER_PRIVATE(user_data);
+  xmpp_connection = INF_XMPP_CONNECTION(object);
+
+  if(inf_xmpp_connection_get_tls_enabled(xmpp_connection))
+  {
+    if(inf_xmpp_connection_get_tls_resumed(xmpp_connection))
+      ++priv->n_resumed_handshakes;
+    else
+      ++priv->n_full_handshakes;
+
+    /* There is only one handshake per server-side connection */
+    inf_signal_handlers_disconnect_by_func(
+      object,
+      G_CALLBACK(infd_xmpp_server_notify_tls_enabled_cb),
+      user_data
+    );
+  }
+}
+
 static void
 infd_xmpp_server_new_connection_cb(InfdTcpServer* tcp_server,
                                    InfTcpConnection* tcp_connection,
@@ -113,6 +148,23 @@ infd_xmpp_server_new_connection_cb(InfdTcpServer* tcp_server,
 
   g_free(addr_str);
 
+  /* These are only looked at once the client has sent its stream header,
+   * so it is early enough to set them here. */
+  g_object_set(
+    G_OBJECT(xmpp_connection),
+    "compression", priv->compression,
+    "binary-encoding", priv->binary_encoding,
+    NULL
+  );
+
+  g_signal_connect_object(
+    G_OBJECT(xmpp_connection),
+    "notify::tls-enabled",
+    G_CALLBACK(infd_xmpp_server_notify_tls_enabled_cb),
+    xmpp_server,
+    0
+  );
+
   /* We could, alternatively, keep the connection around until authentication
    * has completed and emit the new_connection signal after that, to guarantee
    * that the connection is open when new_connection is emitted. */
@@ -353,11 +405,16 @@ infd_xmpp_server_init(InfdXmppServer* xmpp)
   priv->status = INFD_XMPP_SERVER_CLOSED;
   priv->local_hostname = g_strdup(g_get_host_name());
   priv->security_policy = INF_XMPP_CONNECTION_SECURITY_ONLY_UNSECURED;
+  priv->compression = FALSE;
+  priv->binary_encoding = TRUE;
 
   priv->tls_creds = NULL;
   priv->sasl_context = NULL;
   priv->sasl_own_context = NULL;
   priv->sasl_mechanisms = NULL;
+
+  priv->n_full_handshakes = 0;
+  priv->n_resumed_handshakes = 0;
 }
 
 static void
@@ -462,6 +519,12 @@ infd_xmpp_server_set_property(GObject* object,
   case PROP_SECURITY_POLICY:
     infd_xmpp_server_set_security_policy(xmpp, g_value_get_enum(value));
     break;
+  case PROP_COMPRESSION:
+    priv->compression = g_value_get_boolean(value);
+    break;
+  case PROP_BINARY_ENCODING:
+    priv->binary_encoding = g_value_get_boolean(value);
+    break;
   default:
     G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
     break;
@@ -515,6 +578,12 @@ infd_xmpp_server_get_property(GObject* object,
   case PROP_SECURITY_POLICY:
     g_value_set_enum(value, priv->security_policy);
     break;
+  case PROP_COMPRESSION:
+    g_value_set_boolean(value, priv->compression);
+    break;
+  case PROP_BINARY_ENCODING:
+    g_value_set_boolean(value, priv->binary_encoding);
+    break;
   default:
     G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
     break;
@@ -628,6 +697,30 @@ infd_xmpp_server_class_init(InfdXmppServerClass* xmpp_class)
     )
   );
 
+  g_object_class_install_property(
+    object_class,
+    PROP_COMPRESSION,
+    g_param_spec_boolean(
+      "compression",
+      "Compression",
+      "Whether to offer stream compression to new connections",
+      FALSE,
+      G_PARAM_READWRITE
+    )
+  );
+
+  g_object_class_install_property(
+    object_class,
+    PROP_BINARY_ENCODING,
+    g_param_spec_boolean(
+      "binary-encoding",
+      "Binary encoding",
+      "Whether to offer the binary message encoding to new connections",
+      TRUE,
+      G_PARAM_READWRITE
+    )
+  );
+
   g_object_class_override_property(object_class, PROP_STATUS, "status");
 
   xmpp_server_signals[ERROR] = g_signal_new(
@@ -757,4 +850,32 @@ infd_xmpp_server_get_security_policy(InfdXmppServer* server)
   return INFD_XMPP_SERVER_PRIVATE(server)->security_policy;
 }
 
+/**
+ * infd_xmpp_server_get_handshake_statistics:
+ * @server: A #InfdXmppServer.
+ * @n_full: (out) (allow-none): Location to store the number of full TLS
+ * handshakes, or %NULL.
+ * @n_resumed: (out) (allow-none): Location to store the number of resumed
+ * TLS handshakes, or %NULL.
+ *
+ * Returns how many TLS handshakes with clients have completed since @server
+ * was created, split by whether a full handshake was made or a previous
+ * session was resumed. Sessions can only be resumed if session tickets have
+ * been enabled for the server's credentials, see
+ * inf_certificate_credentials_enable_session_tickets().
+ */
+void
+infd_xmpp_server_get_handshake_statistics(InfdXmppServer* server,
+                                          guint64* n_full,
+                                          guint64* n_resumed)
+{
+  InfdXmppServerPrivate* priv;
+
+  g_return_if_fail(INFD_IS_XMPP_SERVER(server));
+
+  priv = INFD_XMPP_SERVER_PRIVATE(server);
+  if(n_full != NULL) *n_full = priv->n_full_handshakes;
+  if(n_resumed != NULL) *n_resumed = priv->n_resumed_handshakes;
+}
+
 /* vim:set et sw=2 ts=2: */
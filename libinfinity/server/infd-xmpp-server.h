@@ -70,6 +70,11 @@ infd_xmpp_server_set_security_policy(InfdXmppServer* server,
 InfXmppConnectionSecurityPolicy
 infd_xmpp_server_get_security_policy(InfdXmppServer* server);
 
+void
+infd_xmpp_server_get_handshake_statistics(InfdXmppServer* server,
+                                          guint64* n_full,
+                                          guint64* n_resumed);
+
 G_END_DECLS
 
 #endif /* __INFD_XMPP_SERVER_H__ */
@@ -30,18 +30,76 @@
  * implementing a #InfdNotePlugin to handle #InfTextSession<!-- -->s. These
  * functions implement reading and writing the content of an #InfTextSession
  * to an XML file in the storage.
+ *
+ * Writing the whole session is expensive for large documents, so it is
+ * usually done only from time to time. In between, a
+ * #InfTextFilesystemJournal can record every change made to the session in
+ * an append-only file next to it, so that no changes are lost if the
+ * program is terminated before the session has been written.
  */
 
 #include <libinftext/inf-text-filesystem-format.h>
+#include <libinfinity/server/infd-storage.h>
 #include <libinfinity/common/inf-xml-util.h>
+#include <libinfinity/inf-signals.h>
 #include <libinfinity/inf-i18n.h>
 
-#include <string.h>
+#include <glib/gstdio.h>
 
-typedef struct _InfTextFilesystemFormatWriteData {
-  xmlNodePtr root;
-  GHashTable* encountered_authors;
-} InfTextFilesystemFormatWriteData;
+#include <string.h>
+#include <errno.h>
+
+/* Identifiers of the files in the storage that make up a text session */
+#define INF_TEXT_FILESYSTEM_FORMAT_SNAPSHOT "InfText"
+#define INF_TEXT_FILESYSTEM_FORMAT_SNAPSHOT_NEW "InfText.new"
+#define INF_TEXT_FILESYSTEM_FORMAT_SNAPSHOT_COMPACT "InfText.compact"
+#define INF_TEXT_FILESYSTEM_FORMAT_JOURNAL "InfText.journal"
+#define INF_TEXT_FILESYSTEM_FORMAT_JOURNAL_NEW "InfText.journal.new"
+
+/* Records are flushed to the operating system as soon as they are written,
+ * so they survive a crash of the program. They are synced to the disk at
+ * most this many milliseconds later, which bounds what is lost when the
+ * whole system goes down. Syncing after every record would make typing
+ * wait for the disk. */
+#define INF_TEXT_FILESYSTEM_JOURNAL_SYNC_INTERVAL 1000
+
+struct _InfTextFilesystemJournal {
+  InfdFilesystemStorage* storage;
+  InfIo* io;
+  gchar* path;
+  InfUserTable* user_table;
+  InfTextBuffer* buffer;
+  gsize compact_size;
+
+  /* NULL if writing to the journal failed */
+  FILE* stream;
+  gsize size;
+  gsize compact_at;
+
+  /* Set while there are records that have not been synced to disk yet */
+  InfIoTimeout* sync_timeout;
+
+  /* Users for which a record exists in the journal file */
+  GHashTable* users;
+  GString* record;
+
+  /* Compaction running in the background, and the records written since
+   * it has been started */
+  InfdStorageTask* task;
+  GString* pending;
+};
+
+typedef struct _InfTextFilesystemJournalCompaction
+  InfTextFilesystemJournalCompaction;
+struct _InfTextFilesystemJournalCompaction {
+  InfTextFilesystemJournal* journal;
+  InfdFilesystemStorage* storage;
+  gchar* path;
+  GSList* users;
+  InfTextChunk* chunk;
+  guint seq;
+  GError* error;
+};
 
 static GQuark
 inf_text_filesystem_format_error_quark()
@@ -49,6 +107,19 @@ inf_text_filesystem_format_error_quark()
   return g_quark_from_static_string("INF_TEXT_FILESYSTEM_FORMAT_ERROR");
 }
 
+static GQuark
+inf_text_filesystem_format_journal_quark()
+{
+  return g_quark_from_static_string("inf-text-filesystem-format-journal");
+}
+
+/* The sequence number of the last change made to a buffer */
+static GQuark
+inf_text_filesystem_format_journal_seq_quark()
+{
+  return g_quark_from_static_string("inf-text-filesystem-format-journal-seq");
+}
+
 static int
 inf_text_filesystem_format_read_read_func(void* context,
                                           char* buffer,
@@ -256,231 +327,119 @@ inf_text_filesystem_format_read_buffer(InfTextBuffer* buffer,
 }
 
 static void
-inf_text_filesystem_format_write_foreach_user_func(InfUser* user,
-                                                   gpointer user_data)
+inf_text_filesystem_format_system_error(int code,
+                                        GError** error)
 {
-  InfTextFilesystemFormatWriteData* data;
-  gpointer user_id;
-  xmlNodePtr node;
-
-  data = (InfTextFilesystemFormatWriteData*)user_data;
-  user_id = GUINT_TO_POINTER(inf_user_get_id(user));
-
-  /* TODO: Use g_hash_table_contains when we can use glib 2.32 */
-  if(g_hash_table_lookup(data->encountered_authors, user_id) != NULL)
-  {
-    node = xmlNewChild(data->root, NULL, (const xmlChar*)"user", NULL);
-
-    inf_xml_util_set_attribute_uint(node, "id", inf_user_get_id(user));
-    inf_xml_util_set_attribute(node, "name", inf_user_get_name(user));
-    inf_xml_util_set_attribute_double(
-      node,
-      "hue",
-      inf_text_user_get_hue(INF_TEXT_USER(user))
-    );
-  }
+  g_set_error_literal(
+    error,
+    G_FILE_ERROR,
+    g_file_error_from_errno(code),
+    g_strerror(code)
+  );
 }
 
-/**
- * inf_text_filesystem_format_read:
- * @storage: A #InfdFilesystemStorage.
- * @path: Storage path to retrieve the session from.
- * @user_table: An empty #InfUserTable to use as the new session's user table.
- * @buffer: An empty #InfTextBuffer to use as the new session's buffer.
- * @error: Location to store error information, if any, or %NULL.
- *
- * Reads a text session from @path in @storage. The file is expected to have
- * been saved with inf_text_filesystem_format_write() before. The @user_table
- * parameter should be an empty user table that will be used for the session,
- * and the @buffer parameter should be an empty #InfTextBuffer, and the
- * document will be written into this buffer. If the function succeeds, the
- * user table and buffer can be used to create an #InfTextSession with
- * inf_text_session_new_with_user_table(). If the function fails, %FALSE is
- * returned and @error is set.
- *
- * Returns: %TRUE on success or %FALSE on error.
- */
-gboolean
-inf_text_filesystem_format_read(InfdFilesystemStorage* storage,
-                                const gchar* path,
-                                InfUserTable* user_table,
-                                InfTextBuffer* buffer,
-                                GError** error)
+static guint
+inf_text_filesystem_format_get_journal_seq(InfTextBuffer* buffer)
 {
-  FILE* stream;
-  gchar* full_path;
-  gchar* uri;
-
-  xmlDocPtr doc;
-  xmlErrorPtr xmlerror;
-  xmlNodePtr root;
-  xmlNodePtr child;
-  gboolean result;
-
-  g_return_val_if_fail(INFD_IS_FILESYSTEM_STORAGE(storage), FALSE);
-  g_return_val_if_fail(path != NULL, FALSE);
-  g_return_val_if_fail(INF_TEXT_IS_BUFFER(buffer), FALSE);
-  g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
-  g_return_val_if_fail(inf_text_buffer_get_length(buffer) == 0, FALSE);
-
-  /* TODO: Use a SAX parser for better performance */
-  full_path = NULL;
-  stream = infd_filesystem_storage_open(
-    INFD_FILESYSTEM_STORAGE(storage),
-    "InfText",
-    path,
-    "r",
-    &full_path,
-    error
+  return GPOINTER_TO_UINT(
+    g_object_get_qdata(
+      G_OBJECT(buffer),
+      inf_text_filesystem_format_journal_seq_quark()
+    )
   );
+}
 
-  if(stream == NULL)
-  {
-    g_free(full_path);
-    return FALSE;
-  }
-
-  uri = g_filename_to_uri(full_path, NULL, error);
-  g_free(full_path);
-
-  if(uri == NULL)
-    return FALSE;
-
-  doc = xmlReadIO(
-    inf_text_filesystem_format_read_read_func,
-    inf_text_filesystem_format_read_close_func,
-    stream,
-    uri,
-    "UTF-8",
-    XML_PARSE_NOWARNING | XML_PARSE_NOERROR
+static void
+inf_text_filesystem_format_set_journal_seq(InfTextBuffer* buffer,
+                                           guint seq)
+{
+  g_object_set_qdata(
+    G_OBJECT(buffer),
+    inf_text_filesystem_format_journal_seq_quark(),
+    GUINT_TO_POINTER(seq)
   );
+}
 
-  g_free(uri);
-
-  if(doc == NULL)
-  {
-    xmlerror = xmlGetLastError();
-
-    g_set_error(
-      error,
-      g_quark_from_static_string("LIBXML2_PARSER_ERROR"),
-      xmlerror->code,
-      _("Error parsing XML in file \"%s\": [%d]: %s"),
-      path,
-      xmlerror->line,
-      xmlerror->message
-    );
+static void
+inf_text_filesystem_format_users_foreach_func(InfUser* user,
+                                              gpointer user_data)
+{
+  GSList** list;
+  xmlNodePtr node;
 
-    result = FALSE;
-  }
-  else
-  {
-    root = xmlDocGetRootElement(doc);
-    if(strcmp((const char*)root->name, "inf-text-session") != 0)
-    {
-      g_set_error(
-        error,
-        inf_text_filesystem_format_error_quark(),
-        INF_TEXT_FILESYSTEM_FORMAT_ERROR_NOT_A_TEXT_SESSION,
-        _("Error processing file \"%s\": %s"),
-        path,
-        _("The document is not a text session")
-      );
+  list = (GSList**)user_data;
+  node = xmlNewNode(NULL, (const xmlChar*)"user");
 
-      result = FALSE;
-    }
-    else
-    {
-      for(child = root->children; child != NULL; child = child->next)
-      {
-        if(child->type != XML_ELEMENT_NODE)
-          continue;
+  inf_xml_util_set_attribute_uint(node, "id", inf_user_get_id(user));
+  inf_xml_util_set_attribute(node, "name", inf_user_get_name(user));
+  inf_xml_util_set_attribute_double(
+    node,
+    "hue",
+    inf_text_user_get_hue(INF_TEXT_USER(user))
+  );
 
-        if(strcmp((const char*)child->name, "user") == 0)
-        {
-          if(!inf_text_filesystem_format_read_user(user_table, child, error))
-          {
-            g_prefix_error(error, _("Error processing file \"%s\": "), path);
-            result = FALSE;
-            break;
-          }
-        }
-        else if(strcmp((const char*)child->name, "buffer") == 0)
-        {
-          if(!inf_text_filesystem_format_read_buffer(buffer, user_table,
-                                                     child, error))
-          {
-            g_prefix_error(error, _("Error processing file \"%s\": "), path);
-            result = FALSE;
-            break;
-          }
-        }
-      }
+  *list = g_slist_prepend(*list, node);
+}
 
-      if(child == NULL)
-        result = TRUE;
-    }
+/* Returns a list of <user> nodes for all users in user_table. Unlike the
+ * user table itself, the list can be handed to another thread. */
+static GSList*
+inf_text_filesystem_format_users_to_xml(InfUserTable* user_table)
+{
+  GSList* list;
+  list = NULL;
 
-    xmlFreeDoc(doc);
-  }
+  inf_user_table_foreach_user(
+    user_table,
+    inf_text_filesystem_format_users_foreach_func,
+    &list
+  );
 
-  return result;
+  return g_slist_reverse(list);
 }
 
-/**
- * inf_text_filesystem_format_write:
- * @storage: A #InfdFilesystemStorage.
- * @path: Storage path where to write the session to.
- * @user_table: The #InfUserTable to write.
- * @buffer: The #InfTextBuffer to write.
- * @error: Location to store error information, if any, or %NULL.
- *
- * Writes the given user table and buffer into the filesystem storage at
- * @path. If successful, the session can then be read back with
- * inf_text_filesystem_format_read(). If the function fails, %FALSE is
- * returned and @error is set.
- *
- * Returns: %TRUE on success or %FALSE on error.
- */
-gboolean
-inf_text_filesystem_format_write(InfdFilesystemStorage* storage,
-                                 const gchar* path,
-                                 InfUserTable* user_table,
-                                 InfTextBuffer* buffer,
-                                 GError** error)
+/* Writes the text of chunk and those of users that have contributed to it
+ * to the file with the given identifier. This does not access any objects
+ * other than its arguments, and can therefore run in a worker thread. */
+static gboolean
+inf_text_filesystem_format_write_chunk(InfdFilesystemStorage* storage,
+                                       const gchar* identifier,
+                                       const gchar* path,
+                                       GSList* users,
+                                       InfTextChunk* chunk,
+                                       guint journal_seq,
+                                       GError** error)
 {
-  InfTextBufferIter* iter;
+  InfTextChunkIter iter;
+  GHashTable* encountered_authors;
+  GSList* item;
+  xmlNodePtr root;
   xmlNodePtr buffer_node;
   xmlNodePtr segment_node;
 
+  const gchar* encoding;
+  gboolean is_utf8;
   guint author;
-  gchar* content;
-  gsize bytes;
+  guint id;
   gchar* converted;
   gsize converted_bytes;
 
   FILE* stream;
   xmlDocPtr doc;
   xmlErrorPtr xmlerror;
-  gboolean is_utf8;
+  int save_errno;
 
-  InfTextFilesystemFormatWriteData data;
-
-  g_return_val_if_fail(INFD_IS_FILESYSTEM_STORAGE(storage), FALSE);
-  g_return_val_if_fail(path != NULL, FALSE);
-  g_return_val_if_fail(INF_IS_USER_TABLE(user_table), FALSE);
-  g_return_val_if_fail(INF_TEXT_IS_BUFFER(buffer), FALSE);
-  g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+  encoding = inf_text_chunk_get_encoding(chunk);
 
   is_utf8 = TRUE;
-  if(strcmp(inf_text_buffer_get_encoding(buffer), "UTF-8") != 0)
+  if(strcmp(encoding, "UTF-8") != 0)
     is_utf8 = FALSE;
 
   /* Open stream before exporting buffer to XML so possible errors are
    * catched earlier. */
   stream = infd_filesystem_storage_open(
-    INFD_FILESYSTEM_STORAGE(storage),
-    "InfText",
+    storage,
+    identifier,
     path,
     "w",
     NULL,
@@ -490,22 +449,23 @@ inf_text_filesystem_format_write(InfdFilesystemStorage* storage,
   if(stream == NULL)
     return FALSE;
 
-  data.root = xmlNewNode(NULL, (const xmlChar*)"inf-text-session");
-  data.encountered_authors = g_hash_table_new(NULL, NULL);
+  root = xmlNewNode(NULL, (const xmlChar*)"inf-text-session");
+  encountered_authors = g_hash_table_new(NULL, NULL);
+
+  /* Changes in the journal up to this one are contained in the snapshot */
+  if(journal_seq != 0)
+    inf_xml_util_set_attribute_uint(root, "journal-seq", journal_seq);
 
   buffer_node = xmlNewNode(NULL, (const xmlChar*)"buffer");
-  iter = inf_text_buffer_create_begin_iter(buffer);
-  if(iter != NULL)
+  if(inf_text_chunk_iter_init_begin(chunk, &iter))
   {
     do
     {
-      author = inf_text_buffer_iter_get_author(buffer, iter);
-      content = inf_text_buffer_iter_get_text(buffer, iter);
-      bytes = inf_text_buffer_iter_get_bytes(buffer, iter);
+      author = inf_text_chunk_iter_get_author(&iter);
 
       /* TODO: Use g_hash_table_add with glib 2.32 */
       g_hash_table_insert(
-        data.encountered_authors,
+        encountered_authors,
         GUINT_TO_POINTER(author),
         GUINT_TO_POINTER(author)
       );
@@ -522,29 +482,30 @@ inf_text_filesystem_format_write(InfdFilesystemStorage* storage,
       if(is_utf8)
       {
         /* Buffer is UTF-8, no conversion necessary */
-        inf_xml_util_add_child_text(segment_node, content, bytes);
-        g_free(content);
+        inf_xml_util_add_child_text(
+          segment_node,
+          inf_text_chunk_iter_get_text(&iter),
+          inf_text_chunk_iter_get_bytes(&iter)
+        );
       }
       else
       {
         /* Convert from buffer encoding to UTF-8 for storage */
         converted = g_convert(
-          content,
-          bytes,
+          inf_text_chunk_iter_get_text(&iter),
+          inf_text_chunk_iter_get_bytes(&iter),
           "UTF-8",
-          inf_text_buffer_get_encoding(buffer),
+          encoding,
           NULL,
           &converted_bytes,
           error
         );
 
-        g_free(content);
-
         if(converted == NULL)
         {
           xmlFreeNode(buffer_node);
-          xmlFreeNode(data.root);
-          g_hash_table_destroy(data.encountered_authors);
+          xmlFreeNode(root);
+          g_hash_table_destroy(encountered_authors);
           infd_filesystem_storage_stream_close(stream);
           return FALSE;
         }
@@ -552,27 +513,28 @@ inf_text_filesystem_format_write(InfdFilesystemStorage* storage,
         inf_xml_util_add_child_text(segment_node, converted, converted_bytes);
         g_free(converted);
       }
-    } while(inf_text_buffer_iter_next(buffer, iter));
-
-    inf_text_buffer_destroy_iter(buffer, iter);
+    } while(inf_text_chunk_iter_next(&iter));
   }
 
   /* After we wrote the buffer, now write the user table, but only for those
    * users that have contributed to the document. The others we drop, to
    * avoid cluttering the user table too much. */
-  inf_user_table_foreach_user(
-    user_table,
-    inf_text_filesystem_format_write_foreach_user_func,
-    &data
-  );
+  for(item = users; item != NULL; item = item->next)
+  {
+    if(inf_xml_util_get_attribute_uint(item->data, "id", &id, NULL) &&
+       g_hash_table_lookup(encountered_authors, GUINT_TO_POINTER(id)) != NULL)
+    {
+      xmlAddChild(root, xmlCopyNode(item->data, 1));
+    }
+  }
 
-  g_hash_table_destroy(data.encountered_authors);
+  g_hash_table_destroy(encountered_authors);
 
   /* Write the buffer after the users */
-  xmlAddChild(data.root, buffer_node);
+  xmlAddChild(root, buffer_node);
 
   doc = xmlNewDoc((const xmlChar*)"1.0");
-  xmlDocSetRootElement(doc, data.root);
+  xmlDocSetRootElement(doc, root);
 
   /* TODO: At this point, we should tell libxml2 to use
    * infd_filesystem_storage_stream_write() instead of fwrite(),
@@ -593,9 +555,1536 @@ inf_text_filesystem_format_write(InfdFilesystemStorage* storage,
     return FALSE;
   }
 
-  infd_filesystem_storage_stream_close(stream);
   xmlFreeDoc(doc);
+
+  /* The file is moved over the previous snapshot afterwards, and the
+   * journal is emptied, so make sure it has reached the disk. Otherwise,
+   * after a system crash, the snapshot could be empty while the journal
+   * does not have the changes anymore. */
+  if(infd_filesystem_storage_stream_sync(stream) != 0)
+  {
+    save_errno = errno;
+    infd_filesystem_storage_stream_close(stream);
+    inf_text_filesystem_format_system_error(save_errno, error);
+    return FALSE;
+  }
+
+  if(infd_filesystem_storage_stream_close(stream) != 0)
+  {
+    save_errno = errno;
+    inf_text_filesystem_format_system_error(save_errno, error);
+    return FALSE;
+  }
+
   return TRUE;
 }
 
+static gboolean
+inf_text_filesystem_format_move(InfdFilesystemStorage* storage,
+                                const gchar* path,
+                                const gchar* from_identifier,
+                                const gchar* to_identifier,
+                                GError** error)
+{
+  gchar* from_name;
+  gchar* to_name;
+  gboolean result;
+  int save_errno;
+
+  from_name = infd_filesystem_storage_get_path(
+    storage,
+    from_identifier,
+    path,
+    error
+  );
+
+  if(from_name == NULL)
+    return FALSE;
+
+  to_name = infd_filesystem_storage_get_path(
+    storage,
+    to_identifier,
+    path,
+    error
+  );
+
+  if(to_name == NULL)
+  {
+    g_free(from_name);
+    return FALSE;
+  }
+
+  result = TRUE;
+  if(g_rename(from_name, to_name) == -1)
+  {
+    save_errno = errno;
+    inf_text_filesystem_format_system_error(save_errno, error);
+    result = FALSE;
+  }
+
+  g_free(from_name);
+  g_free(to_name);
+  return result;
+}
+
+/* Removes a snapshot left over from a compaction that has not completed.
+ * Errors are ignored, since the file is not read anyway. */
+static void
+inf_text_filesystem_format_remove_compact(InfdFilesystemStorage* storage,
+                                          const gchar* path)
+{
+  gchar* full_name;
+
+  full_name = infd_filesystem_storage_get_path(
+    storage,
+    INF_TEXT_FILESYSTEM_FORMAT_SNAPSHOT_COMPACT,
+    path,
+    NULL
+  );
+
+  if(full_name != NULL)
+  {
+    g_unlink(full_name);
+    g_free(full_name);
+  }
+}
+
+/* Empties the journal of the session at path, if there is one */
+static gboolean
+inf_text_filesystem_format_truncate_journal(InfdFilesystemStorage* storage,
+                                            const gchar* path,
+                                            GError** error)
+{
+  gchar* full_name;
+  gboolean exists;
+  FILE* stream;
+
+  full_name = infd_filesystem_storage_get_path(
+    storage,
+    INF_TEXT_FILESYSTEM_FORMAT_JOURNAL,
+    path,
+    error
+  );
+
+  if(full_name == NULL)
+    return FALSE;
+
+  exists = g_file_test(full_name, G_FILE_TEST_EXISTS);
+  g_free(full_name);
+
+  if(exists)
+  {
+    /* If a journal is open for appending, then it keeps appending to the
+     * truncated file. */
+    stream = infd_filesystem_storage_open(
+      storage,
+      INF_TEXT_FILESYSTEM_FORMAT_JOURNAL,
+      path,
+      "w",
+      NULL,
+      error
+    );
+
+    if(stream == NULL)
+      return FALSE;
+
+    infd_filesystem_storage_stream_close(stream);
+  }
+
+  return TRUE;
+}
+
+static gboolean
+inf_text_filesystem_format_journal_error(gsize offset,
+                                         GError** error)
+{
+  g_set_error(
+    error,
+    inf_text_filesystem_format_error_quark(),
+    INF_TEXT_FILESYSTEM_FORMAT_ERROR_INVALID_JOURNAL,
+    _("Invalid journal record at byte %" G_GSIZE_FORMAT),
+    offset
+  );
+
+  return FALSE;
+}
+
+static gboolean
+inf_text_filesystem_format_replay_insert(InfUserTable* user_table,
+                                         InfTextBuffer* buffer,
+                                         xmlNodePtr xml,
+                                         gsize offset,
+                                         GError** error)
+{
+  guint pos;
+  guint author;
+  InfUser* user;
+  gchar* text;
+  gsize bytes;
+  guint chars;
+  gchar* converted;
+  gsize converted_bytes;
+
+  if(!inf_xml_util_get_attribute_uint_required(xml, "pos", &pos, error))
+    return FALSE;
+  if(!inf_xml_util_get_attribute_uint_required(xml, "author", &author, error))
+    return FALSE;
+
+  if(pos > inf_text_buffer_get_length(buffer))
+    return inf_text_filesystem_format_journal_error(offset, error);
+
+  /* If the author is not known, insert the text without author rather than
+   * refusing to load the document. */
+  user = NULL;
+  if(author != 0)
+    user = inf_user_table_lookup_user_by_id(user_table, author);
+
+  text = inf_xml_util_get_child_text(xml, &bytes, &chars, error);
+  if(text == NULL)
+    return FALSE;
+
+  if(strcmp(inf_text_buffer_get_encoding(buffer), "UTF-8") == 0)
+  {
+    inf_text_buffer_insert_text(buffer, pos, text, bytes, chars, user);
+    g_free(text);
+  }
+  else
+  {
+    converted = g_convert(
+      text,
+      bytes,
+      inf_text_buffer_get_encoding(buffer),
+      "UTF-8",
+      NULL,
+      &converted_bytes,
+      error
+    );
+
+    g_free(text);
+
+    if(converted == NULL)
+      return FALSE;
+
+    inf_text_buffer_insert_text(
+      buffer,
+      pos,
+      converted,
+      converted_bytes,
+      chars,
+      user
+    );
+
+    g_free(converted);
+  }
+
+  return TRUE;
+}
+
+static gboolean
+inf_text_filesystem_format_replay_record(InfUserTable* user_table,
+                                         InfTextBuffer* buffer,
+                                         xmlNodePtr xml,
+                                         gsize offset,
+                                         guint* seq,
+                                         GError** error)
+{
+  guint record_seq;
+  guint id;
+  guint pos;
+  guint len;
+  xmlChar* name;
+  gboolean result;
+
+  if(strcmp((const char*)xml->name, "user") == 0)
+  {
+    /* A user record precedes the first text a user has written into the
+     * journal file. It is applied independently of its sequence number,
+     * since the snapshot only contains the users that have contributed to
+     * the text at the time it was taken. */
+    if(!inf_xml_util_get_attribute_uint_required(xml, "id", &id, error))
+      return FALSE;
+
+    name = inf_xml_util_get_attribute_required(xml, "name", error);
+    if(name == NULL)
+      return FALSE;
+
+    result = TRUE;
+    if(inf_user_table_lookup_user_by_id(user_table, id) == NULL &&
+       inf_user_table_lookup_user_by_name(user_table, (const gchar*)name) ==
+       NULL)
+    {
+      result = inf_text_filesystem_format_read_user(user_table, xml, error);
+    }
+
+    xmlFree(name);
+    return result;
+  }
+
+  if(!inf_xml_util_get_attribute_uint_required(xml, "seq", &record_seq, error))
+    return FALSE;
+
+  /* The change is already contained in the snapshot */
+  if(record_seq <= *seq)
+    return TRUE;
+
+  /* Changes are recorded without gaps, otherwise we could not apply the
+   * following ones. */
+  if(record_seq != *seq + 1)
+    return inf_text_filesystem_format_journal_error(offset, error);
+
+  if(strcmp((const char*)xml->name, "insert") == 0)
+  {
+    result = inf_text_filesystem_format_replay_insert(
+      user_table,
+      buffer,
+      xml,
+      offset,
+      error
+    );
+
+    if(result == FALSE)
+      return FALSE;
+  }
+  else if(strcmp((const char*)xml->name, "delete") == 0)
+  {
+    if(!inf_xml_util_get_attribute_uint_required(xml, "pos", &pos, error))
+      return FALSE;
+    if(!inf_xml_util_get_attribute_uint_required(xml, "len", &len, error))
+      return FALSE;
+
+    if(pos > inf_text_buffer_get_length(buffer) ||
+       len > inf_text_buffer_get_length(buffer) - pos)
+    {
+      return inf_text_filesystem_format_journal_error(offset, error);
+    }
+
+    inf_text_buffer_erase_text(buffer, pos, len, NULL);
+  }
+  else
+  {
+    return inf_text_filesystem_format_journal_error(offset, error);
+  }
+
+  *seq = record_seq;
+  return TRUE;
+}
+
+/* Each journal record is the length of its XML in bytes, a newline
+ * character, the XML and another newline character. */
+static gboolean
+inf_text_filesystem_format_replay_journal(InfUserTable* user_table,
+                                          InfTextBuffer* buffer,
+                                          const gchar* data,
+                                          gsize len,
+                                          guint* seq,
+                                          GError** error)
+{
+  gsize offset;
+  const gchar* newline;
+  gchar* end;
+  guint64 record_len;
+  xmlDocPtr doc;
+  gboolean result;
+
+  offset = 0;
+  while(offset < len)
+  {
+    /* An incomplete record at the end of the journal is the result of the
+     * server being terminated while writing it, and is ignored. */
+    newline = memchr(data + offset, '\n', len - offset);
+    if(newline == NULL)
+      break;
+
+    record_len = g_ascii_strtoull(data + offset, &end, 10);
+    if(end == data + offset || end != newline)
+      return inf_text_filesystem_format_journal_error(offset, error);
+
+    offset = newline - data + 1;
+    if(record_len >= len - offset)
+      break;
+
+    if(data[offset + record_len] != '\n')
+      return inf_text_filesystem_format_journal_error(offset, error);
+
+    doc = xmlReadMemory(
+      data + offset,
+      record_len,
+      NULL,
+      "UTF-8",
+      XML_PARSE_NOWARNING | XML_PARSE_NOERROR
+    );
+
+    if(doc == NULL)
+      return inf_text_filesystem_format_journal_error(offset, error);
+
+    result = inf_text_filesystem_format_replay_record(
+      user_table,
+      buffer,
+      xmlDocGetRootElement(doc),
+      offset,
+      seq,
+      error
+    );
+
+    xmlFreeDoc(doc);
+    if(result == FALSE)
+      return FALSE;
+
+    offset += record_len + 1;
+  }
+
+  return TRUE;
+}
+
+static gboolean
+inf_text_filesystem_format_read_journal(InfdFilesystemStorage* storage,
+                                        const gchar* path,
+                                        InfUserTable* user_table,
+                                        InfTextBuffer* buffer,
+                                        guint* seq,
+                                        GError** error)
+{
+  FILE* stream;
+  GError* local_error;
+  GString* data;
+  gchar chunk[4096];
+  gsize len;
+  int save_errno;
+  gboolean result;
+
+  local_error = NULL;
+  stream = infd_filesystem_storage_open(
+    storage,
+    INF_TEXT_FILESYSTEM_FORMAT_JOURNAL,
+    path,
+    "r",
+    NULL,
+    &local_error
+  );
+
+  if(stream == NULL)
+  {
+    /* No changes have been recorded */
+    if(local_error->domain == G_FILE_ERROR &&
+       local_error->code == G_FILE_ERROR_NOENT)
+    {
+      g_error_free(local_error);
+      return TRUE;
+    }
+
+    g_propagate_error(error, local_error);
+    return FALSE;
+  }
+
+  data = g_string_new(NULL);
+  do
+  {
+    len = infd_filesystem_storage_stream_read(stream, chunk, sizeof(chunk));
+    g_string_append_len(data, chunk, len);
+  } while(len == sizeof(chunk));
+
+  if(ferror(stream))
+  {
+    save_errno = errno;
+    infd_filesystem_storage_stream_close(stream);
+    g_string_free(data, TRUE);
+
+    inf_text_filesystem_format_system_error(save_errno, error);
+    return FALSE;
+  }
+
+  infd_filesystem_storage_stream_close(stream);
+
+  result = inf_text_filesystem_format_replay_journal(
+    user_table,
+    buffer,
+    data->str,
+    data->len,
+    seq,
+    error
+  );
+
+  g_string_free(data, TRUE);
+  return result;
+}
+
+/**
+ * inf_text_filesystem_format_read:
+ * @storage: A #InfdFilesystemStorage.
+ * @path: Storage path to retrieve the session from.
+ * @user_table: An empty #InfUserTable to use as the new session's user table.
+ * @buffer: An empty #InfTextBuffer to use as the new session's buffer.
+ * @error: Location to store error information, if any, or %NULL.
+ *
+ * Reads a text session from @path in @storage. The file is expected to have
+ * been saved with inf_text_filesystem_format_write() before. The @user_table
+ * parameter should be an empty user table that will be used for the session,
+ * and the @buffer parameter should be an empty #InfTextBuffer, and the
+ * document will be written into this buffer. If the function succeeds, the
+ * user table and buffer can be used to create an #InfTextSession with
+ * inf_text_session_new_with_user_table(). If the function fails, %FALSE is
+ * returned and @error is set.
+ *
+ * If changes to the session have been recorded with a
+ * #InfTextFilesystemJournal since it was last written, then these are
+ * applied to @buffer as well.
+ *
+ * Returns: %TRUE on success or %FALSE on error.
+ */
+gboolean
+inf_text_filesystem_format_read(InfdFilesystemStorage* storage,
+                                const gchar* path,
+                                InfUserTable* user_table,
+                                InfTextBuffer* buffer,
+                                GError** error)
+{
+  FILE* stream;
+  gchar* full_path;
+  gchar* uri;
+
+  xmlDocPtr doc;
+  xmlErrorPtr xmlerror;
+  xmlNodePtr root;
+  xmlNodePtr child;
+  gboolean result;
+  GError* local_error;
+  guint seq;
+
+  g_return_val_if_fail(INFD_IS_FILESYSTEM_STORAGE(storage), FALSE);
+  g_return_val_if_fail(path != NULL, FALSE);
+  g_return_val_if_fail(INF_TEXT_IS_BUFFER(buffer), FALSE);
+  g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+  g_return_val_if_fail(inf_text_buffer_get_length(buffer) == 0, FALSE);
+
+  /* A snapshot left over from a compaction that was interrupted, for
+   * example by a crash, is never used: the changes it contains are still in
+   * the previous snapshot and the journal. */
+  inf_text_filesystem_format_remove_compact(storage, path);
+
+  /* TODO: Use a SAX parser for better performance */
+  full_path = NULL;
+  stream = infd_filesystem_storage_open(
+    INFD_FILESYSTEM_STORAGE(storage),
+    INF_TEXT_FILESYSTEM_FORMAT_SNAPSHOT,
+    path,
+    "r",
+    &full_path,
+    error
+  );
+
+  if(stream == NULL)
+  {
+    g_free(full_path);
+    return FALSE;
+  }
+
+  uri = g_filename_to_uri(full_path, NULL, error);
+  g_free(full_path);
+
+  if(uri == NULL)
+    return FALSE;
+
+  doc = xmlReadIO(
+    inf_text_filesystem_format_read_read_func,
+    inf_text_filesystem_format_read_close_func,
+    stream,
+    uri,
+    "UTF-8",
+    XML_PARSE_NOWARNING | XML_PARSE_NOERROR
+  );
+
+  g_free(uri);
+  seq = 0;
+
+  if(doc == NULL)
+  {
+    xmlerror = xmlGetLastError();
+
+    g_set_error(
+      error,
+      g_quark_from_static_string("LIBXML2_PARSER_ERROR"),
+      xmlerror->code,
+      _("Error parsing XML in file \"%s\": [%d]: %s"),
+      path,
+      xmlerror->line,
+      xmlerror->message
+    );
+
+    result = FALSE;
+  }
+  else
+  {
+    root = xmlDocGetRootElement(doc);
+    if(strcmp((const char*)root->name, "inf-text-session") != 0)
+    {
+      g_set_error(
+        error,
+        inf_text_filesystem_format_error_quark(),
+        INF_TEXT_FILESYSTEM_FORMAT_ERROR_NOT_A_TEXT_SESSION,
+        _("Error processing file \"%s\": %s"),
+        path,
+        _("The document is not a text session")
+      );
+
+      result = FALSE;
+    }
+    else
+    {
+      for(child = root->children; child != NULL; child = child->next)
+      {
+        if(child->type != XML_ELEMENT_NODE)
+          continue;
+
+        if(strcmp((const char*)child->name, "user") == 0)
+        {
+          if(!inf_text_filesystem_format_read_user(user_table, child, error))
+          {
+            g_prefix_error(error, _("Error processing file \"%s\": "), path);
+            result = FALSE;
+            break;
+          }
+        }
+        else if(strcmp((const char*)child->name, "buffer") == 0)
+        {
+          if(!inf_text_filesystem_format_read_buffer(buffer, user_table,
+                                                     child, error))
+          {
+            g_prefix_error(error, _("Error processing file \"%s\": "), path);
+            result = FALSE;
+            break;
+          }
+        }
+      }
+
+      if(child == NULL)
+      {
+        local_error = NULL;
+        inf_xml_util_get_attribute_uint(root, "journal-seq", &seq, &local_error);
+
+        if(local_error != NULL)
+        {
+          g_propagate_prefixed_error(
+            error,
+            local_error,
+            _("Error processing file \"%s\": "),
+            path
+          );
+
+          result = FALSE;
+        }
+        else
+        {
+          result = TRUE;
+        }
+      }
+    }
+
+    xmlFreeDoc(doc);
+  }
+
+  if(result == TRUE)
+  {
+    result = inf_text_filesystem_format_read_journal(
+      storage,
+      path,
+      user_table,
+      buffer,
+      &seq,
+      error
+    );
+
+    if(result == FALSE)
+    {
+      g_prefix_error(
+        error,
+        _("Error processing the journal of \"%s\": "),
+        path
+      );
+    }
+    else
+    {
+      inf_text_filesystem_format_set_journal_seq(buffer, seq);
+    }
+  }
+
+  return result;
+}
+
+/* Required by inf_text_filesystem_format_write() */
+static void
+inf_text_filesystem_journal_cancel_compaction(
+  InfTextFilesystemJournal* journal);
+
+static void
+inf_text_filesystem_journal_reset(InfTextFilesystemJournal* journal);
+
+/**
+ * inf_text_filesystem_format_write:
+ * @storage: A #InfdFilesystemStorage.
+ * @path: Storage path where to write the session to.
+ * @user_table: The #InfUserTable to write.
+ * @buffer: The #InfTextBuffer to write.
+ * @error: Location to store error information, if any, or %NULL.
+ *
+ * Writes the given user table and buffer into the filesystem storage at
+ * @path. If successful, the session can then be read back with
+ * inf_text_filesystem_format_read(). If the function fails, %FALSE is
+ * returned and @error is set.
+ *
+ * The session is first written into a temporary file which then replaces
+ * the previous one, so that the previous content is kept if writing fails.
+ * Once the session has been written, the changes recorded in its journal
+ * are no longer needed and the journal is emptied.
+ *
+ * Returns: %TRUE on success or %FALSE on error.
+ */
+gboolean
+inf_text_filesystem_format_write(InfdFilesystemStorage* storage,
+                                 const gchar* path,
+                                 InfUserTable* user_table,
+                                 InfTextBuffer* buffer,
+                                 GError** error)
+{
+  InfTextFilesystemJournal* journal;
+  GSList* users;
+  InfTextChunk* chunk;
+  gboolean result;
+
+  g_return_val_if_fail(INFD_IS_FILESYSTEM_STORAGE(storage), FALSE);
+  g_return_val_if_fail(path != NULL, FALSE);
+  g_return_val_if_fail(INF_IS_USER_TABLE(user_table), FALSE);
+  g_return_val_if_fail(INF_TEXT_IS_BUFFER(buffer), FALSE);
+  g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+  journal = g_object_get_qdata(
+    G_OBJECT(buffer),
+    inf_text_filesystem_format_journal_quark()
+  );
+
+  if(journal != NULL &&
+     (journal->storage != storage || strcmp(journal->path, path) != 0))
+  {
+    journal = NULL;
+  }
+
+  /* A snapshot being written in the background would be older than the one
+   * we are writing now. */
+  if(journal != NULL && journal->task != NULL)
+    inf_text_filesystem_journal_cancel_compaction(journal);
+
+  users = inf_text_filesystem_format_users_to_xml(user_table);
+  chunk = inf_text_buffer_get_slice(
+    buffer,
+    0,
+    inf_text_buffer_get_length(buffer)
+  );
+
+  result = inf_text_filesystem_format_write_chunk(
+    storage,
+    INF_TEXT_FILESYSTEM_FORMAT_SNAPSHOT_NEW,
+    path,
+    users,
+    chunk,
+    inf_text_filesystem_format_get_journal_seq(buffer),
+    error
+  );
+
+  inf_text_chunk_free(chunk);
+  g_slist_free_full(users, (GDestroyNotify)xmlFreeNode);
+
+  if(result == TRUE)
+  {
+    result = inf_text_filesystem_format_move(
+      storage,
+      path,
+      INF_TEXT_FILESYSTEM_FORMAT_SNAPSHOT_NEW,
+      INF_TEXT_FILESYSTEM_FORMAT_SNAPSHOT,
+      error
+    );
+  }
+
+  /* If emptying the journal fails, its records are skipped when reading the
+   * session, since the snapshot carries the sequence number of the last
+   * record it contains. */
+  if(result == TRUE)
+  {
+    if(inf_text_filesystem_format_truncate_journal(storage, path, NULL))
+      if(journal != NULL)
+        inf_text_filesystem_journal_reset(journal);
+  }
+
+  return result;
+}
+
+/*
+ * Journal
+ */
+
+static void
+inf_text_filesystem_journal_open_stream(InfTextFilesystemJournal* journal,
+                                        GError** error)
+{
+  g_assert(journal->stream == NULL);
+
+  journal->stream = infd_filesystem_storage_open(
+    journal->storage,
+    INF_TEXT_FILESYSTEM_FORMAT_JOURNAL,
+    journal->path,
+    "a",
+    NULL,
+    error
+  );
+
+  /* In append mode, the initial position is not necessarily at the end of
+   * the file before the first write. */
+  if(journal->stream != NULL && fseek(journal->stream, 0, SEEK_END) == 0)
+    journal->size = ftell(journal->stream);
+  else
+    journal->size = 0;
+}
+
+static void
+inf_text_filesystem_journal_close_stream(InfTextFilesystemJournal* journal)
+{
+  if(journal->sync_timeout != NULL)
+  {
+    inf_io_remove_timeout(journal->io, journal->sync_timeout);
+    journal->sync_timeout = NULL;
+
+    /* Do not leave the last records unsynced for longer than the interval
+     * just because the journal is closed or replaced */
+    if(journal->stream != NULL)
+      infd_filesystem_storage_stream_sync(journal->stream);
+  }
+
+  if(journal->stream != NULL)
+  {
+    infd_filesystem_storage_stream_close(journal->stream);
+    journal->stream = NULL;
+  }
+}
+
+static void
+inf_text_filesystem_journal_sync_func(gpointer user_data)
+{
+  InfTextFilesystemJournal* journal;
+  int save_errno;
+
+  journal = (InfTextFilesystemJournal*)user_data;
+  journal->sync_timeout = NULL;
+
+  g_assert(journal->stream != NULL);
+
+  if(infd_filesystem_storage_stream_sync(journal->stream) != 0)
+  {
+    save_errno = errno;
+
+    g_warning(
+      _("Failed to write to the journal of \"%s\": %s\n\nChanges are no "
+        "longer recorded until the document has been saved."),
+      journal->path,
+      g_strerror(save_errno)
+    );
+
+    inf_text_filesystem_journal_close_stream(journal);
+  }
+}
+
+/* Called when the session has been written, which also empties the journal
+ * file */
+static void
+inf_text_filesystem_journal_reset(InfTextFilesystemJournal* journal)
+{
+  journal->size = 0;
+  journal->compact_at = journal->compact_size;
+  g_hash_table_remove_all(journal->users);
+
+  /* The journal is consistent again, so we can continue recording changes
+   * if writing to the journal failed before. */
+  if(journal->stream == NULL)
+    inf_text_filesystem_journal_open_stream(journal, NULL);
+}
+
+static void
+inf_text_filesystem_journal_cleanup_run_func(InfdStorage* storage,
+                                             gpointer user_data)
+{
+  inf_text_filesystem_format_remove_compact(
+    INFD_FILESYSTEM_STORAGE(storage),
+    (const gchar*)user_data
+  );
+}
+
+static void
+inf_text_filesystem_journal_cancel_compaction(
+  InfTextFilesystemJournal* journal)
+{
+  g_assert(journal->task != NULL);
+
+  infd_storage_task_cancel(journal->task);
+  journal->task = NULL;
+  g_string_truncate(journal->pending, 0);
+
+  /* The compaction might be writing its snapshot right now, or it might
+   * have written it already, and it is not moved into place anymore.
+   * Remove it in the storage thread after the compaction has finished, and
+   * before the next one starts. */
+  infd_storage_run_async(
+    INFD_STORAGE(journal->storage),
+    journal->io,
+    inf_text_filesystem_journal_cleanup_run_func,
+    NULL,
+    g_strdup(journal->path),
+    g_free
+  );
+}
+
+static void
+inf_text_filesystem_journal_append_record(GString* str,
+                                          xmlNodePtr xml)
+{
+  gsize begin;
+  gchar header[32];
+
+  /* Reserve space for the length, which we only know afterwards */
+  begin = str->len;
+  inf_xml_util_serialize_node(xml, str);
+
+  g_snprintf(
+    header,
+    sizeof(header),
+    "%" G_GSIZE_FORMAT "\n",
+    str->len - begin
+  );
+
+  g_string_insert(str, begin, header);
+  g_string_append_c(str, '\n');
+}
+
+static void
+inf_text_filesystem_journal_write(InfTextFilesystemJournal* journal,
+                                  xmlNodePtr xml)
+{
+  gsize written;
+  int save_errno;
+
+  g_string_truncate(journal->record, 0);
+  inf_text_filesystem_journal_append_record(journal->record, xml);
+
+  /* Keep the records that are not contained in the snapshot being written
+   * in the background, to carry them over into the new journal file. */
+  if(journal->task != NULL)
+  {
+    g_string_append_len(
+      journal->pending,
+      journal->record->str,
+      journal->record->len
+    );
+  }
+
+  if(journal->stream != NULL)
+  {
+    written = infd_filesystem_storage_stream_write(
+      journal->stream,
+      journal->record->str,
+      journal->record->len
+    );
+
+    if(written != journal->record->len ||
+       infd_filesystem_storage_stream_flush(journal->stream) != 0)
+    {
+      save_errno = errno;
+
+      g_warning(
+        _("Failed to write to the journal of \"%s\": %s\n\nChanges are no "
+          "longer recorded until the document has been saved."),
+        journal->path,
+        g_strerror(save_errno)
+      );
+
+      /* Records after a missing one cannot be applied, so stop writing
+       * them altogether. */
+      inf_text_filesystem_journal_close_stream(journal);
+    }
+    else
+    {
+      journal->size += written;
+
+      if(journal->sync_timeout == NULL)
+      {
+        journal->sync_timeout = inf_io_add_timeout(
+          journal->io,
+          INF_TEXT_FILESYSTEM_JOURNAL_SYNC_INTERVAL,
+          inf_text_filesystem_journal_sync_func,
+          journal,
+          NULL
+        );
+      }
+    }
+  }
+
+  if(journal->compact_size != 0 && journal->size >= journal->compact_at &&
+     journal->task == NULL)
+  {
+    inf_text_filesystem_journal_compact(journal);
+  }
+}
+
+static void
+inf_text_filesystem_journal_write_user(InfTextFilesystemJournal* journal,
+                                       guint id)
+{
+  InfUser* user;
+  GSList* list;
+
+  user = inf_user_table_lookup_user_by_id(journal->user_table, id);
+  if(user != NULL)
+  {
+    list = NULL;
+    inf_text_filesystem_format_users_foreach_func(user, &list);
+    inf_text_filesystem_journal_write(journal, list->data);
+    xmlFreeNode(list->data);
+    g_slist_free(list);
+  }
+
+  g_hash_table_insert(journal->users, GUINT_TO_POINTER(id), journal);
+}
+
+static void
+inf_text_filesystem_journal_text_inserted_cb(InfTextBuffer* buffer,
+                                             guint pos,
+                                             InfTextChunk* chunk,
+                                             InfUser* user,
+                                             gpointer user_data)
+{
+  InfTextFilesystemJournal* journal;
+  InfTextChunkIter iter;
+  xmlNodePtr xml;
+  guint author;
+  guint seq;
+  const gchar* encoding;
+  gchar* converted;
+  gsize converted_bytes;
+  GError* error;
+
+  journal = (InfTextFilesystemJournal*)user_data;
+  encoding = inf_text_chunk_get_encoding(chunk);
+
+  if(inf_text_chunk_iter_init_begin(chunk, &iter))
+  {
+    do
+    {
+      author = inf_text_chunk_iter_get_author(&iter);
+      if(author != 0 &&
+         g_hash_table_lookup(journal->users, GUINT_TO_POINTER(author)) == NULL)
+      {
+        inf_text_filesystem_journal_write_user(journal, author);
+      }
+
+      seq = inf_text_filesystem_format_get_journal_seq(buffer) + 1;
+      inf_text_filesystem_format_set_journal_seq(buffer, seq);
+
+      xml = xmlNewNode(NULL, (const xmlChar*)"insert");
+      inf_xml_util_set_attribute_uint(xml, "seq", seq);
+      inf_xml_util_set_attribute_uint(xml, "pos", pos);
+      inf_xml_util_set_attribute_uint(xml, "author", author);
+
+      if(strcmp(encoding, "UTF-8") == 0)
+      {
+        inf_xml_util_add_child_text(
+          xml,
+          inf_text_chunk_iter_get_text(&iter),
+          inf_text_chunk_iter_get_bytes(&iter)
+        );
+      }
+      else
+      {
+        error = NULL;
+        converted = g_convert(
+          inf_text_chunk_iter_get_text(&iter),
+          inf_text_chunk_iter_get_bytes(&iter),
+          "UTF-8",
+          encoding,
+          NULL,
+          &converted_bytes,
+          &error
+        );
+
+        if(converted == NULL)
+        {
+          g_warning(
+            _("Failed to write to the journal of \"%s\": %s\n\nChanges are "
+              "no longer recorded until the document has been saved."),
+            journal->path,
+            error->message
+          );
+
+          g_error_free(error);
+          xmlFreeNode(xml);
+          inf_text_filesystem_journal_close_stream(journal);
+          return;
+        }
+
+        inf_xml_util_add_child_text(xml, converted, converted_bytes);
+        g_free(converted);
+      }
+
+      inf_text_filesystem_journal_write(journal, xml);
+      xmlFreeNode(xml);
+
+      pos += inf_text_chunk_iter_get_length(&iter);
+    } while(inf_text_chunk_iter_next(&iter));
+  }
+}
+
+static void
+inf_text_filesystem_journal_text_erased_cb(InfTextBuffer* buffer,
+                                           guint pos,
+                                           InfTextChunk* chunk,
+                                           InfUser* user,
+                                           gpointer user_data)
+{
+  InfTextFilesystemJournal* journal;
+  xmlNodePtr xml;
+  guint seq;
+
+  journal = (InfTextFilesystemJournal*)user_data;
+
+  seq = inf_text_filesystem_format_get_journal_seq(buffer) + 1;
+  inf_text_filesystem_format_set_journal_seq(buffer, seq);
+
+  xml = xmlNewNode(NULL, (const xmlChar*)"delete");
+  inf_xml_util_set_attribute_uint(xml, "seq", seq);
+  inf_xml_util_set_attribute_uint(xml, "pos", pos);
+  inf_xml_util_set_attribute_uint(
+    xml,
+    "len",
+    inf_text_chunk_get_length(chunk)
+  );
+
+  inf_text_filesystem_journal_write(journal, xml);
+  xmlFreeNode(xml);
+}
+
+static void
+inf_text_filesystem_journal_rotate_foreach_user_func(InfUser* user,
+                                                     gpointer user_data)
+{
+  InfTextFilesystemJournal* journal;
+  GSList* list;
+
+  journal = (InfTextFilesystemJournal*)user_data;
+  list = NULL;
+
+  inf_text_filesystem_format_users_foreach_func(user, &list);
+  inf_text_filesystem_journal_append_record(journal->record, list->data);
+  xmlFreeNode(list->data);
+  g_slist_free(list);
+
+  g_hash_table_insert(
+    journal->users,
+    GUINT_TO_POINTER(inf_user_get_id(user)),
+    journal
+  );
+}
+
+/* Replaces the journal file by one which contains only the changes that
+ * have been made since the snapshot of the last compaction was taken. */
+static gboolean
+inf_text_filesystem_journal_rotate(InfTextFilesystemJournal* journal,
+                                   GError** error)
+{
+  FILE* stream;
+  gsize written;
+  int save_errno;
+
+  /* Start with all users, so that the records in the new file do not
+   * depend on user records in the old one. */
+  g_string_truncate(journal->record, 0);
+  g_hash_table_remove_all(journal->users);
+
+  inf_user_table_foreach_user(
+    journal->user_table,
+    inf_text_filesystem_journal_rotate_foreach_user_func,
+    journal
+  );
+
+  g_string_append_len(
+    journal->record,
+    journal->pending->str,
+    journal->pending->len
+  );
+
+  stream = infd_filesystem_storage_open(
+    journal->storage,
+    INF_TEXT_FILESYSTEM_FORMAT_JOURNAL_NEW,
+    journal->path,
+    "w",
+    NULL,
+    error
+  );
+
+  if(stream == NULL)
+    return FALSE;
+
+  written = infd_filesystem_storage_stream_write(
+    stream,
+    journal->record->str,
+    journal->record->len
+  );
+
+  save_errno = errno;
+
+  /* The new file replaces the old journal, so it needs to be on disk before
+   * the old one is gone */
+  if(written == journal->record->len &&
+     infd_filesystem_storage_stream_sync(stream) != 0)
+  {
+    save_errno = errno;
+    written = 0;
+  }
+
+  if(infd_filesystem_storage_stream_close(stream) != 0 &&
+     written == journal->record->len)
+  {
+    save_errno = errno;
+    written = 0;
+  }
+
+  if(written != journal->record->len)
+  {
+    inf_text_filesystem_format_system_error(save_errno, error);
+    return FALSE;
+  }
+
+  if(!inf_text_filesystem_format_move(journal->storage, journal->path,
+                                      INF_TEXT_FILESYSTEM_FORMAT_JOURNAL_NEW,
+                                      INF_TEXT_FILESYSTEM_FORMAT_JOURNAL,
+                                      error))
+  {
+    return FALSE;
+  }
+
+  /* The old stream still refers to the replaced file */
+  inf_text_filesystem_journal_close_stream(journal);
+  inf_text_filesystem_journal_open_stream(journal, error);
+  return journal->stream != NULL;
+}
+
+static void
+inf_text_filesystem_journal_compaction_run_func(InfdStorage* storage,
+                                                gpointer user_data)
+{
+  InfTextFilesystemJournalCompaction* compaction;
+  gboolean result;
+
+  compaction = (InfTextFilesystemJournalCompaction*)user_data;
+
+  result = inf_text_filesystem_format_write_chunk(
+    INFD_FILESYSTEM_STORAGE(storage),
+    INF_TEXT_FILESYSTEM_FORMAT_SNAPSHOT_COMPACT,
+    compaction->path,
+    compaction->users,
+    compaction->chunk,
+    compaction->seq,
+    &compaction->error
+  );
+
+  /* Remove the partially written snapshot. This is done here rather than
+   * in the main thread, so that it cannot interfere with the next
+   * compaction, which runs in this thread after this one. */
+  if(result == FALSE)
+  {
+    inf_text_filesystem_format_remove_compact(
+      INFD_FILESYSTEM_STORAGE(storage),
+      compaction->path
+    );
+  }
+}
+
+static void
+inf_text_filesystem_journal_compaction_done_func(InfdStorage* storage,
+                                                 gpointer user_data)
+{
+  InfTextFilesystemJournalCompaction* compaction;
+  InfTextFilesystemJournal* journal;
+  GError* error;
+  gboolean moved;
+
+  compaction = (InfTextFilesystemJournalCompaction*)user_data;
+  journal = compaction->journal;
+
+  g_assert(journal->task != NULL);
+  journal->task = NULL;
+
+  error = compaction->error;
+  compaction->error = NULL;
+
+  if(error == NULL)
+  {
+    moved = inf_text_filesystem_format_move(
+      journal->storage,
+      journal->path,
+      INF_TEXT_FILESYSTEM_FORMAT_SNAPSHOT_COMPACT,
+      INF_TEXT_FILESYSTEM_FORMAT_SNAPSHOT,
+      &error
+    );
+
+    /* If this fails, the old journal file is kept, and the records which
+     * are contained in the new snapshot are skipped when reading it. */
+    if(moved == TRUE)
+      inf_text_filesystem_journal_rotate(journal, &error);
+  }
+
+  g_string_truncate(journal->pending, 0);
+
+  if(error != NULL)
+  {
+    g_warning(
+      _("Failed to compact the journal of \"%s\": %s"),
+      journal->path,
+      error->message
+    );
+
+    g_error_free(error);
+
+    /* Don't try again with every change */
+    journal->compact_at = journal->size + journal->compact_size;
+  }
+  else
+  {
+    journal->compact_at = journal->compact_size;
+  }
+}
+
+static void
+inf_text_filesystem_journal_compaction_free(gpointer data)
+{
+  InfTextFilesystemJournalCompaction* compaction;
+  compaction = (InfTextFilesystemJournalCompaction*)data;
+
+  if(compaction->error != NULL)
+    g_error_free(compaction->error);
+
+  g_slist_free_full(compaction->users, (GDestroyNotify)xmlFreeNode);
+  inf_text_chunk_free(compaction->chunk);
+  g_free(compaction->path);
+  g_object_unref(compaction->storage);
+  g_slice_free(InfTextFilesystemJournalCompaction, compaction);
+}
+
+/**
+ * inf_text_filesystem_journal_open:
+ * @storage: A #InfdFilesystemStorage.
+ * @io: The #InfIo of the thread in which @buffer is modified.
+ * @path: Storage path of the session.
+ * @user_table: The #InfUserTable of the session.
+ * @buffer: The #InfTextBuffer of the session.
+ * @compact_size: Size of the journal in bytes from which on it is
+ * compacted, or 0.
+ * @error: Location to store error information, if any, or %NULL.
+ *
+ * Starts recording the changes made to @buffer into a journal next to the
+ * session stored at @path in @storage. Every change is appended to the
+ * journal as soon as it has been made, which is much cheaper than writing
+ * the whole session with inf_text_filesystem_format_write(). If the
+ * program is terminated before the session has been written, then the
+ * changes are recovered by inf_text_filesystem_format_read().
+ *
+ * Each change is handed to the operating system right away, so nothing is
+ * lost if only the program crashes. The journal is synced to the disk at
+ * most one second after a change has been made, and when it is closed. If
+ * the whole system crashes or loses power, then the changes made in the
+ * last second before that might be lost.
+ *
+ * Once the journal has grown to @compact_size bytes, a new snapshot of the
+ * session is written to @storage in the background, and the journal is
+ * replaced by one containing only the changes made after the snapshot was
+ * taken. If @compact_size is 0, this only happens when calling
+ * inf_text_filesystem_journal_compact(). Writing the session with
+ * inf_text_filesystem_format_write() empties the journal as well.
+ *
+ * Only one journal can be open for @buffer at a time. If the function
+ * fails, %NULL is returned and @error is set.
+ *
+ * Returns: (transfer full): A new #InfTextFilesystemJournal, to be closed
+ * with inf_text_filesystem_journal_close(), or %NULL.
+ */
+InfTextFilesystemJournal*
+inf_text_filesystem_journal_open(InfdFilesystemStorage* storage,
+                                 InfIo* io,
+                                 const gchar* path,
+                                 InfUserTable* user_table,
+                                 InfTextBuffer* buffer,
+                                 gsize compact_size,
+                                 GError** error)
+{
+  InfTextFilesystemJournal* journal;
+
+  g_return_val_if_fail(INFD_IS_FILESYSTEM_STORAGE(storage), NULL);
+  g_return_val_if_fail(INF_IS_IO(io), NULL);
+  g_return_val_if_fail(path != NULL, NULL);
+  g_return_val_if_fail(INF_IS_USER_TABLE(user_table), NULL);
+  g_return_val_if_fail(INF_TEXT_IS_BUFFER(buffer), NULL);
+  g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+  g_return_val_if_fail(
+    g_object_get_qdata(
+      G_OBJECT(buffer),
+      inf_text_filesystem_format_journal_quark()
+    ) == NULL,
+    NULL
+  );
+
+  journal = g_slice_new(InfTextFilesystemJournal);
+  journal->storage = storage;
+  journal->io = io;
+  journal->path = g_strdup(path);
+  journal->user_table = user_table;
+  journal->buffer = buffer;
+  journal->compact_size = compact_size;
+  journal->compact_at = compact_size;
+  journal->stream = NULL;
+  journal->sync_timeout = NULL;
+
+  inf_text_filesystem_journal_open_stream(journal, error);
+  if(journal->stream == NULL)
+  {
+    g_free(journal->path);
+    g_slice_free(InfTextFilesystemJournal, journal);
+    return NULL;
+  }
+
+  g_object_ref(storage);
+  g_object_ref(io);
+  g_object_ref(user_table);
+  g_object_ref(buffer);
+
+  journal->users = g_hash_table_new(NULL, NULL);
+  journal->record = g_string_new(NULL);
+  journal->pending = g_string_new(NULL);
+  journal->task = NULL;
+
+  g_signal_connect_after(
+    G_OBJECT(buffer),
+    "text-inserted",
+    G_CALLBACK(inf_text_filesystem_journal_text_inserted_cb),
+    journal
+  );
+
+  g_signal_connect_after(
+    G_OBJECT(buffer),
+    "text-erased",
+    G_CALLBACK(inf_text_filesystem_journal_text_erased_cb),
+    journal
+  );
+
+  g_object_set_qdata(
+    G_OBJECT(buffer),
+    inf_text_filesystem_format_journal_quark(),
+    journal
+  );
+
+  return journal;
+}
+
+/**
+ * inf_text_filesystem_journal_compact:
+ * @journal: A #InfTextFilesystemJournal.
+ *
+ * Writes a snapshot of the session of @journal into the storage in the
+ * background, and then replaces the journal by one that only contains the
+ * changes made since the snapshot was taken. The content of the session is
+ * copied before this function returns, so it can be modified while the
+ * snapshot is being written. If a compaction is already running, then this
+ * function does nothing.
+ */
+void
+inf_text_filesystem_journal_compact(InfTextFilesystemJournal* journal)
+{
+  InfTextFilesystemJournalCompaction* compaction;
+
+  g_return_if_fail(journal != NULL);
+
+  if(journal->task != NULL)
+    return;
+
+  compaction = g_slice_new(InfTextFilesystemJournalCompaction);
+  compaction->journal = journal;
+  compaction->storage = journal->storage;
+  compaction->path = g_strdup(journal->path);
+  compaction->users =
+    inf_text_filesystem_format_users_to_xml(journal->user_table);
+  compaction->chunk = inf_text_buffer_get_slice(
+    journal->buffer,
+    0,
+    inf_text_buffer_get_length(journal->buffer)
+  );
+  compaction->seq = inf_text_filesystem_format_get_journal_seq(
+    journal->buffer
+  );
+  compaction->error = NULL;
+  g_object_ref(compaction->storage);
+
+  g_assert(journal->pending->len == 0);
+
+  journal->task = infd_storage_run_async(
+    INFD_STORAGE(journal->storage),
+    journal->io,
+    inf_text_filesystem_journal_compaction_run_func,
+    inf_text_filesystem_journal_compaction_done_func,
+    compaction,
+    inf_text_filesystem_journal_compaction_free
+  );
+}
+
+/**
+ * inf_text_filesystem_journal_close:
+ * @journal: A #InfTextFilesystemJournal.
+ *
+ * Stops recording changes into @journal, and frees it. A compaction that is
+ * still running is cancelled. The journal file is kept, so that the changes
+ * recorded in it are recovered when reading the session, unless it has
+ * been written with inf_text_filesystem_format_write() before.
+ */
+void
+inf_text_filesystem_journal_close(InfTextFilesystemJournal* journal)
+{
+  g_return_if_fail(journal != NULL);
+
+  if(journal->task != NULL)
+    inf_text_filesystem_journal_cancel_compaction(journal);
+
+  inf_signal_handlers_disconnect_by_func(
+    G_OBJECT(journal->buffer),
+    G_CALLBACK(inf_text_filesystem_journal_text_inserted_cb),
+    journal
+  );
+
+  inf_signal_handlers_disconnect_by_func(
+    G_OBJECT(journal->buffer),
+    G_CALLBACK(inf_text_filesystem_journal_text_erased_cb),
+    journal
+  );
+
+  g_object_set_qdata(
+    G_OBJECT(journal->buffer),
+    inf_text_filesystem_format_journal_quark(),
+    NULL
+  );
+
+  inf_text_filesystem_journal_close_stream(journal);
+
+  g_hash_table_destroy(journal->users);
+  g_string_free(journal->record, TRUE);
+  g_string_free(journal->pending, TRUE);
+
+  g_object_unref(journal->buffer);
+  g_object_unref(journal->user_table);
+  g_object_unref(journal->io);
+  g_object_unref(journal->storage);
+  g_free(journal->path);
+  g_slice_free(InfTextFilesystemJournal, journal);
+}
+
 /* vim:set et sw=2 ts=2: */
@@ -22,6 +22,7 @@
 
 #include <libinftext/inf-text-session.h>
 #include <libinfinity/server/infd-filesystem-storage.h>
+#include <libinfinity/common/inf-io.h>
 
 #include <glib.h>
 
@@ -35,6 +36,8 @@ G_BEGIN_DECLS
  * session contains users with duplicate ID or duplicate name.
  * @INF_TEXT_FILESYSTEM_FORMAT_ERROR_NO_SUCH_USER: A segment of the text
  * document is written by a user which does not exist.
+ * @INF_TEXT_FILESYSTEM_FORMAT_ERROR_INVALID_JOURNAL: The journal of the
+ * session contains a record which cannot be applied.
  *
  * Errors that can occur when reading a #InfTextSession from a
  * #InfdFilesystemStorage.
@@ -42,9 +45,19 @@ G_BEGIN_DECLS
 typedef enum _InfTextFilesystemFormatError {
   INF_TEXT_FILESYSTEM_FORMAT_ERROR_NOT_A_TEXT_SESSION,
   INF_TEXT_FILESYSTEM_FORMAT_ERROR_USER_EXISTS,
-  INF_TEXT_FILESYSTEM_FORMAT_ERROR_NO_SUCH_USER
+  INF_TEXT_FILESYSTEM_FORMAT_ERROR_NO_SUCH_USER,
+  INF_TEXT_FILESYSTEM_FORMAT_ERROR_INVALID_JOURNAL
 } InfTextFilesystemFormatError;
 
+/**
+ * InfTextFilesystemJournal: (foreign)
+ *
+ * #InfTextFilesystemJournal is an opaque data type recording the changes
+ * made to a #InfTextBuffer into the storage, see
+ * inf_text_filesystem_journal_open().
+ */
+typedef struct _InfTextFilesystemJournal InfTextFilesystemJournal;
+
 gboolean
 inf_text_filesystem_format_read(InfdFilesystemStorage* storage,
                                 const gchar* path,
@@ -59,6 +72,21 @@ inf_text_filesystem_format_write(InfdFilesystemStorage* storage,
                                  InfTextBuffer* buffer,
                                  GError** error);
 
+InfTextFilesystemJournal*
+inf_text_filesystem_journal_open(InfdFilesystemStorage* storage,
+                                 InfIo* io,
+                                 const gchar* path,
+                                 InfUserTable* user_table,
+                                 InfTextBuffer* buffer,
+                                 gsize compact_size,
+                                 GError** error);
+
+void
+inf_text_filesystem_journal_compact(InfTextFilesystemJournal* journal);
+
+void
+inf_text_filesystem_journal_close(InfTextFilesystemJournal* journal);
+
 G_END_DECLS
 
 #endif /* __INF_TEXT_FILESYSTEM_FORMAT_H__ */
@@ -0,0 +1,385 @@
+/* libinfinity - a GObject-based infinote implementation
+ * Copyright (C) 2007-2015 Armin Burgmeier <armin@arbur.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+/* Fills a folder of an InfdDirectory with enough children for it to index
+ * their names, partly from storage and partly by adding them, then removes
+ * and renames children and verifies after each step that names of existing
+ * children are rejected when adding a node, case-insensitively, that names
+ * of removed children can be used again, and that the children of the
+ * folder are exactly the expected ones. Two children read from storage
+ * whose names only differ in case make sure that removing one of them keeps
+ * the name of the other one taken.
+ */
+
+#include <libinfinity/server/infd-directory.h>
+#include <libinfinity/server/infd-filesystem-storage.h>
+#include <libinfinity/communication/inf-communication-manager.h>
+#include <libinfinity/common/inf-standalone-io.h>
+#include <libinfinity/common/inf-file-util.h>
+#include <libinfinity/common/inf-init.h>
+
+#include <glib/gstdio.h>
+
+#include <stdio.h>
+#include <string.h>
+
+/* Number of children read from storage, and number of children added
+ * afterwards. The directory indexes the names of a folder from 64 children
+ * on. */
+#define INF_TEST_DIRECTORY_INDEX_N_STORED 70
+#define INF_TEST_DIRECTORY_INDEX_N_ADDED 30
+
+typedef struct _InfTestDirectoryIndex InfTestDirectoryIndex;
+struct _InfTestDirectoryIndex {
+  InfdDirectory* directory;
+  InfBrowserIter root;
+
+  /* Names of the children the root folder should have */
+  GHashTable* expected;
+  gboolean failed;
+};
+
+static void
+inf_test_directory_index_request_cb(InfRequest* request,
+                                    const InfRequestResult* result,
+                                    const GError* error,
+                                    gpointer user_data)
+{
+  gboolean* succeeded;
+  succeeded = (gboolean*)user_data;
+
+  *succeeded = (error == NULL);
+}
+
+static gboolean
+inf_test_directory_index_find(InfTestDirectoryIndex* test,
+                              const gchar* name,
+                              InfBrowserIter* iter)
+{
+  InfBrowser* browser;
+  gboolean result;
+
+  browser = INF_BROWSER(test->directory);
+  *iter = test->root;
+
+  for(result = inf_browser_get_child(browser, iter);
+      result == TRUE;
+      result = inf_browser_get_next(browser, iter))
+  {
+    if(strcmp(inf_browser_get_node_name(browser, iter), name) == 0)
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+/* Adds a child called name, and checks that this succeeds if and only if
+ * should_succeed is set. */
+static void
+inf_test_directory_index_add(InfTestDirectoryIndex* test,
+                             const gchar* name,
+                             gboolean should_succeed)
+{
+  gboolean succeeded;
+
+  succeeded = FALSE;
+  inf_browser_add_subdirectory(
+    INF_BROWSER(test->directory),
+    &test->root,
+    name,
+    NULL,
+    inf_test_directory_index_request_cb,
+    &succeeded
+  );
+
+  if(succeeded != should_succeed)
+  {
+    fprintf(
+      stderr,
+      "Adding \"%s\" %s\n",
+      name,
+      succeeded ? "succeeded although the name is taken" : "failed"
+    );
+
+    test->failed = TRUE;
+  }
+
+  /* Names that were added although they are taken are not tracked, since
+   * the test has failed already. This also keeps test->expected unchanged
+   * while inf_test_directory_index_verify() iterates over it. */
+  if(succeeded && should_succeed)
+    g_hash_table_add(test->expected, g_strdup(name));
+}
+
+static void
+inf_test_directory_index_remove(InfTestDirectoryIndex* test,
+                                const gchar* name)
+{
+  InfBrowserIter iter;
+  gboolean succeeded;
+
+  succeeded = FALSE;
+  if(inf_test_directory_index_find(test, name, &iter))
+  {
+    inf_browser_remove_node(
+      INF_BROWSER(test->directory),
+      &iter,
+      inf_test_directory_index_request_cb,
+      &succeeded
+    );
+  }
+
+  if(!succeeded)
+  {
+    fprintf(stderr, "Removing \"%s\" failed\n", name);
+    test->failed = TRUE;
+  }
+
+  g_hash_table_remove(test->expected, name);
+}
+
+/* A node cannot be renamed in place, so this removes it and adds it again
+ * under the new name. */
+static void
+inf_test_directory_index_rename(InfTestDirectoryIndex* test,
+                                const gchar* name,
+                                const gchar* new_name)
+{
+  inf_test_directory_index_remove(test, name);
+  inf_test_directory_index_add(test, new_name, TRUE);
+}
+
+/* Checks that the children of the root folder are exactly the expected
+ * ones, and that each of their names is taken. */
+static void
+inf_test_directory_index_verify(InfTestDirectoryIndex* test,
+                                const gchar* step)
+{
+  InfBrowser* browser;
+  InfBrowserIter iter;
+  GHashTableIter hash_iter;
+  gpointer name;
+  gchar* upper;
+  gboolean result;
+  guint n_children;
+
+  browser = INF_BROWSER(test->directory);
+  iter = test->root;
+  n_children = 0;
+
+  for(result = inf_browser_get_child(browser, &iter);
+      result == TRUE;
+      result = inf_browser_get_next(browser, &iter))
+  {
+    if(!g_hash_table_contains(test->expected,
+                              inf_browser_get_node_name(browser, &iter)))
+    {
+      fprintf(stderr, "%s: Unexpected child \"%s\"\n", step,
+              inf_browser_get_node_name(browser, &iter));
+      test->failed = TRUE;
+    }
+
+    ++n_children;
+  }
+
+  if(n_children != g_hash_table_size(test->expected))
+  {
+    fprintf(stderr, "%s: %u children instead of %u\n", step, n_children,
+            g_hash_table_size(test->expected));
+    test->failed = TRUE;
+  }
+
+  g_hash_table_iter_init(&hash_iter, test->expected);
+  while(g_hash_table_iter_next(&hash_iter, &name, NULL))
+  {
+    upper = g_utf8_strup(name, -1);
+    inf_test_directory_index_add(test, upper, FALSE);
+    g_free(upper);
+  }
+}
+
+static void
+inf_test_directory_index_run(InfTestDirectoryIndex* test)
+{
+  gchar* name;
+  gchar* new_name;
+  guint i;
+
+  inf_browser_get_root(INF_BROWSER(test->directory), &test->root);
+  inf_browser_explore(INF_BROWSER(test->directory), &test->root, NULL, NULL);
+  inf_test_directory_index_verify(test, "Explore");
+
+  for(i = INF_TEST_DIRECTORY_INDEX_N_STORED;
+      i < INF_TEST_DIRECTORY_INDEX_N_STORED + INF_TEST_DIRECTORY_INDEX_N_ADDED;
+      ++i)
+  {
+    name = g_strdup_printf("folder-%03u", i);
+    inf_test_directory_index_add(test, name, TRUE);
+    g_free(name);
+  }
+
+  inf_test_directory_index_verify(test, "Add");
+
+  /* The other child with the same name in a different case keeps the name
+   * taken, until it is removed as well. */
+  inf_test_directory_index_remove(test, "Dup");
+  inf_test_directory_index_verify(test, "Remove first duplicate");
+  inf_test_directory_index_remove(test, "dup");
+  inf_test_directory_index_add(test, "DUP", TRUE);
+  inf_test_directory_index_verify(test, "Remove second duplicate");
+
+  /* Rename every third child, and every sixth one back to its original
+   * name in a different case. */
+  for(i = 0;
+      i < INF_TEST_DIRECTORY_INDEX_N_STORED + INF_TEST_DIRECTORY_INDEX_N_ADDED;
+      i += 3)
+  {
+    name = g_strdup_printf("folder-%03u", i);
+    new_name = g_strdup_printf("renamed-%03u", i);
+    inf_test_directory_index_rename(test, name, new_name);
+
+    if(i % 2 == 0)
+    {
+      g_free(name);
+      name = g_strdup_printf("Folder-%03u", i);
+      inf_test_directory_index_rename(test, new_name, name);
+    }
+
+    g_free(name);
+    g_free(new_name);
+  }
+
+  inf_test_directory_index_verify(test, "Rename");
+
+  /* Remove all but a few children, so that the folder shrinks below the
+   * size from which on it indexes names */
+  for(i = 8;
+      i < INF_TEST_DIRECTORY_INDEX_N_STORED + INF_TEST_DIRECTORY_INDEX_N_ADDED;
+      ++i)
+  {
+    name = g_strdup_printf("folder-%03u", i);
+    if(g_hash_table_contains(test->expected, name))
+      inf_test_directory_index_remove(test, name);
+    g_free(name);
+  }
+
+  inf_test_directory_index_verify(test, "Shrink");
+}
+
+static gboolean
+inf_test_directory_index_make_stored(const gchar* root_directory,
+                                     GHashTable* expected)
+{
+  gchar* name;
+  gchar* path;
+  guint i;
+
+  for(i = 0; i < INF_TEST_DIRECTORY_INDEX_N_STORED + 2; ++i)
+  {
+    if(i == INF_TEST_DIRECTORY_INDEX_N_STORED)
+      name = g_strdup("Dup");
+    else if(i == INF_TEST_DIRECTORY_INDEX_N_STORED + 1)
+      name = g_strdup("dup");
+    else
+      name = g_strdup_printf("folder-%03u", i);
+
+    path = g_build_filename(root_directory, name, NULL);
+    if(g_mkdir(path, 0755) != 0)
+    {
+      fprintf(stderr, "Failed to create \"%s\"\n", path);
+      g_free(path);
+      g_free(name);
+      return FALSE;
+    }
+
+    g_free(path);
+    g_hash_table_add(expected, name);
+  }
+
+  return TRUE;
+}
+
+int
+main(int argc, char* argv[])
+{
+  InfTestDirectoryIndex test;
+  InfStandaloneIo* io;
+  InfdFilesystemStorage* storage;
+  InfCommunicationManager* manager;
+  GError* error;
+  gchar* root_directory;
+  int result;
+
+  error = NULL;
+  if(inf_init(&error) == FALSE)
+  {
+    fprintf(stderr, "%s\n", error->message);
+    g_error_free(error);
+    return 1;
+  }
+
+  root_directory = g_dir_make_tmp("inf-test-directory-index-XXXXXX", &error);
+  if(root_directory == NULL)
+  {
+    fprintf(stderr, "%s\n", error->message);
+    g_error_free(error);
+    return 1;
+  }
+
+  test.expected = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  test.failed = FALSE;
+
+  result = 1;
+  if(inf_test_directory_index_make_stored(root_directory, test.expected))
+  {
+    io = inf_standalone_io_new();
+    storage = infd_filesystem_storage_new(root_directory);
+    manager = inf_communication_manager_new();
+
+    test.directory = infd_directory_new(
+      INF_IO(io),
+      INFD_STORAGE(storage),
+      manager
+    );
+
+    inf_test_directory_index_run(&test);
+    if(!test.failed)
+      result = 0;
+
+    g_object_unref(test.directory);
+    g_object_unref(manager);
+    g_object_unref(storage);
+    g_object_unref(io);
+  }
+
+  g_hash_table_destroy(test.expected);
+
+  if(!inf_file_util_delete(root_directory, &error))
+  {
+    fprintf(stderr, "%s\n", error->message);
+    g_error_free(error);
+  }
+
+  g_free(root_directory);
+  inf_deinit();
+
+  return result;
+}
+
+/* vim:set et sw=2 ts=2: */
@@ -0,0 +1,396 @@
+/* libinfinity - a GObject-based infinote implementation
+ * Copyright (C) 2007-2015 Armin Burgmeier <armin@arbur.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+/* Loads a number of text documents into an InfdDirectory whose memory
+ * budget only allows for some of them, and verifies that the least recently
+ * loaded ones are unloaded, and that an unloaded document can be loaded
+ * again with its content intact, pushing out the next least recently used
+ * one.
+ */
+
+#include <libinftext/inf-text-session.h>
+#include <libinftext/inf-text-default-buffer.h>
+#include <libinftext/inf-text-filesystem-format.h>
+
+#include <libinfinity/server/infd-directory.h>
+#include <libinfinity/server/infd-filesystem-storage.h>
+#include <libinfinity/communication/inf-communication-manager.h>
+#include <libinfinity/common/inf-standalone-io.h>
+#include <libinfinity/common/inf-file-util.h>
+#include <libinfinity/common/inf-init.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#define INF_TEST_DIRECTORY_MEMORY_NOTE_SIZE 1000
+#define INF_TEST_DIRECTORY_MEMORY_N_NOTES 4
+
+static const gchar* const INF_TEST_DIRECTORY_MEMORY_NAMES[] = {
+  "a", "b", "c", "d"
+};
+
+static InfSession*
+inf_test_directory_memory_session_new(InfIo* io,
+                                      InfCommunicationManager* manager,
+                                      InfSessionStatus status,
+                                      InfCommunicationGroup* sync_group,
+                                      InfXmlConnection* sync_connection,
+                                      const gchar* path,
+                                      gpointer user_data)
+{
+  InfTextSession* session;
+  InfTextBuffer* buffer;
+
+  buffer = INF_TEXT_BUFFER(inf_text_default_buffer_new("UTF-8"));
+
+  session = inf_text_session_new(
+    manager,
+    buffer,
+    io,
+    status,
+    sync_group,
+    sync_connection
+  );
+
+  g_object_unref(buffer);
+  return INF_SESSION(session);
+}
+
+static InfSession*
+inf_test_directory_memory_session_read(InfdStorage* storage,
+                                       InfIo* io,
+                                       InfCommunicationManager* manager,
+                                       const gchar* path,
+                                       gpointer user_data,
+                                       GError** error)
+{
+  InfUserTable* user_table;
+  InfTextBuffer* buffer;
+  InfTextSession* session;
+
+  user_table = inf_user_table_new();
+  buffer = INF_TEXT_BUFFER(inf_text_default_buffer_new("UTF-8"));
+
+  session = NULL;
+  if(inf_text_filesystem_format_read(INFD_FILESYSTEM_STORAGE(storage), path,
+                                     user_table, buffer, error))
+  {
+    session = inf_text_session_new_with_user_table(
+      manager,
+      buffer,
+      io,
+      user_table,
+      INF_SESSION_RUNNING,
+      NULL,
+      NULL
+    );
+  }
+
+  g_object_unref(user_table);
+  g_object_unref(buffer);
+  return INF_SESSION(session);
+}
+
+static gboolean
+inf_test_directory_memory_session_write(InfdStorage* storage,
+                                        InfSession* session,
+                                        const gchar* path,
+                                        gpointer user_data,
+                                        GError** error)
+{
+  return inf_text_filesystem_format_write(
+    INFD_FILESYSTEM_STORAGE(storage),
+    path,
+    inf_session_get_user_table(session),
+    INF_TEXT_BUFFER(inf_session_get_buffer(session)),
+    error
+  );
+}
+
+static gsize
+inf_test_directory_memory_buffer_size(InfBuffer* buffer,
+                                      gpointer user_data)
+{
+  /* The test documents only contain ASCII characters */
+  return inf_text_buffer_get_length(INF_TEXT_BUFFER(buffer));
+}
+
+static const InfdNotePlugin INF_TEST_DIRECTORY_MEMORY_PLUGIN = {
+  NULL,
+  "InfdFilesystemStorage",
+  "InfText",
+  inf_test_directory_memory_session_new,
+  inf_test_directory_memory_session_read,
+  inf_test_directory_memory_session_write,
+  NULL,
+  NULL,
+  inf_test_directory_memory_buffer_size
+};
+
+static gboolean
+inf_test_directory_memory_write_notes(InfdFilesystemStorage* storage,
+                                      GError** error)
+{
+  InfUserTable* user_table;
+  InfTextBuffer* buffer;
+  gchar text[INF_TEST_DIRECTORY_MEMORY_NOTE_SIZE];
+  gchar* path;
+  gboolean result;
+  guint i;
+
+  memset(text, 'x', sizeof(text));
+  user_table = inf_user_table_new();
+
+  result = TRUE;
+  for(i = 0; i < INF_TEST_DIRECTORY_MEMORY_N_NOTES && result == TRUE; ++i)
+  {
+    buffer = INF_TEXT_BUFFER(inf_text_default_buffer_new("UTF-8"));
+    inf_text_buffer_insert_text(
+      buffer,
+      0,
+      text,
+      sizeof(text),
+      sizeof(text),
+      NULL
+    );
+
+    path = g_strconcat("/", INF_TEST_DIRECTORY_MEMORY_NAMES[i], NULL);
+    result = inf_text_filesystem_format_write(
+      storage,
+      path,
+      user_table,
+      buffer,
+      error
+    );
+
+    g_free(path);
+    g_object_unref(buffer);
+  }
+
+  g_object_unref(user_table);
+  return result;
+}
+
+/* Runs the main loop until the directory had a chance to unload sessions */
+static void
+inf_test_directory_memory_settle(InfStandaloneIo* io)
+{
+  inf_io_add_timeout(
+    INF_IO(io),
+    100,
+    (InfIoTimeoutFunc)inf_standalone_io_loop_quit,
+    io,
+    NULL
+  );
+
+  inf_standalone_io_loop(io);
+}
+
+/* Checks that exactly the notes whose names are contained in loaded are in
+ * memory, with their full content. */
+static gboolean
+inf_test_directory_memory_check(InfdDirectory* directory,
+                                const InfBrowserIter* iters,
+                                const gchar* loaded)
+{
+  InfSessionProxy* proxy;
+  InfSession* session;
+  gboolean expected;
+  guint length;
+  guint i;
+
+  for(i = 0; i < INF_TEST_DIRECTORY_MEMORY_N_NOTES; ++i)
+  {
+    proxy = inf_browser_get_session(INF_BROWSER(directory), &iters[i]);
+    expected = strchr(loaded, INF_TEST_DIRECTORY_MEMORY_NAMES[i][0]) != NULL;
+
+    if(expected && proxy == NULL)
+    {
+      fprintf(stderr, "Note \"%s\" has been unloaded\n",
+              INF_TEST_DIRECTORY_MEMORY_NAMES[i]);
+      return FALSE;
+    }
+
+    if(!expected && proxy != NULL)
+    {
+      fprintf(stderr, "Note \"%s\" has not been unloaded\n",
+              INF_TEST_DIRECTORY_MEMORY_NAMES[i]);
+      return FALSE;
+    }
+
+    if(proxy != NULL)
+    {
+      g_object_get(G_OBJECT(proxy), "session", &session, NULL);
+      length = inf_text_buffer_get_length(
+        INF_TEXT_BUFFER(inf_session_get_buffer(session))
+      );
+      g_object_unref(session);
+
+      if(length != INF_TEST_DIRECTORY_MEMORY_NOTE_SIZE)
+      {
+        fprintf(stderr, "Note \"%s\" has %u characters instead of %u\n",
+                INF_TEST_DIRECTORY_MEMORY_NAMES[i], length,
+                INF_TEST_DIRECTORY_MEMORY_NOTE_SIZE);
+        return FALSE;
+      }
+    }
+  }
+
+  if(infd_directory_get_memory_usage(directory) !=
+     strlen(loaded) * INF_TEST_DIRECTORY_MEMORY_NOTE_SIZE)
+  {
+    fprintf(stderr, "Memory usage is %" G_GUINT64_FORMAT " bytes\n",
+            infd_directory_get_memory_usage(directory));
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+static gboolean
+inf_test_directory_memory_run(InfStandaloneIo* io,
+                              InfdDirectory* directory)
+{
+  InfBrowserIter iters[INF_TEST_DIRECTORY_MEMORY_N_NOTES];
+  InfBrowserIter root;
+  InfBrowserIter iter;
+  gboolean result;
+  guint i;
+
+  inf_browser_get_root(INF_BROWSER(directory), &root);
+  inf_browser_explore(INF_BROWSER(directory), &root, NULL, NULL);
+
+  for(i = 0; i < INF_TEST_DIRECTORY_MEMORY_N_NOTES; ++i)
+  {
+    iter = root;
+    for(result = inf_browser_get_child(INF_BROWSER(directory), &iter);
+        result == TRUE;
+        result = inf_browser_get_next(INF_BROWSER(directory), &iter))
+    {
+      if(strcmp(inf_browser_get_node_name(INF_BROWSER(directory), &iter),
+                INF_TEST_DIRECTORY_MEMORY_NAMES[i]) == 0)
+      {
+        break;
+      }
+    }
+
+    if(result == FALSE)
+    {
+      fprintf(stderr, "Note \"%s\" is missing\n",
+              INF_TEST_DIRECTORY_MEMORY_NAMES[i]);
+      return FALSE;
+    }
+
+    iters[i] = iter;
+  }
+
+  /* Load all notes. Only two of them fit into the budget, so the two loaded
+   * first are unloaded again. */
+  for(i = 0; i < INF_TEST_DIRECTORY_MEMORY_N_NOTES; ++i)
+    inf_browser_subscribe(INF_BROWSER(directory), &iters[i], NULL, NULL);
+
+  inf_test_directory_memory_settle(io);
+  if(!inf_test_directory_memory_check(directory, iters, "cd"))
+    return FALSE;
+
+  /* Load the first note again. It must be read back from storage, and push
+   * out the least recently used one of the others. */
+  inf_browser_subscribe(INF_BROWSER(directory), &iters[0], NULL, NULL);
+
+  inf_test_directory_memory_settle(io);
+  if(!inf_test_directory_memory_check(directory, iters, "ad"))
+    return FALSE;
+
+  return TRUE;
+}
+
+int
+main(int argc, char* argv[])
+{
+  InfStandaloneIo* io;
+  InfdFilesystemStorage* storage;
+  InfCommunicationManager* manager;
+  InfdDirectory* directory;
+  GError* error;
+  gchar* root_directory;
+  int result;
+
+  error = NULL;
+  if(inf_init(&error) == FALSE)
+  {
+    fprintf(stderr, "%s\n", error->message);
+    g_error_free(error);
+    return 1;
+  }
+
+  root_directory = g_dir_make_tmp("inf-test-directory-memory-XXXXXX", &error);
+  if(root_directory == NULL)
+  {
+    fprintf(stderr, "%s\n", error->message);
+    g_error_free(error);
+    return 1;
+  }
+
+  io = inf_standalone_io_new();
+  storage = infd_filesystem_storage_new(root_directory);
+  manager = inf_communication_manager_new();
+
+  result = 1;
+  if(!inf_test_directory_memory_write_notes(storage, &error))
+  {
+    fprintf(stderr, "Failed to write notes: %s\n", error->message);
+    g_error_free(error);
+  }
+  else
+  {
+    directory = infd_directory_new(
+      INF_IO(io),
+      INFD_STORAGE(storage),
+      manager
+    );
+
+    infd_directory_add_plugin(directory, &INF_TEST_DIRECTORY_MEMORY_PLUGIN);
+    infd_directory_set_memory_budget(
+      directory,
+      INF_TEST_DIRECTORY_MEMORY_NOTE_SIZE * 5 / 2
+    );
+
+    if(inf_test_directory_memory_run(io, directory))
+      result = 0;
+
+    g_object_unref(directory);
+  }
+
+  g_object_unref(manager);
+  g_object_unref(storage);
+  g_object_unref(io);
+
+  if(!inf_file_util_delete(root_directory, &error))
+  {
+    fprintf(stderr, "%s\n", error->message);
+    g_error_free(error);
+  }
+
+  g_free(root_directory);
+  inf_deinit();
+
+  return result;
+}
+
+/* vim:set et sw=2 ts=2: */
@@ -0,0 +1,72 @@
+#!/bin/sh
+# libinfinity - a GObject-based infinote implementation
+# Copyright (C) 2007-2015 Armin Burgmeier <armin@arbur.net>
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free
+# Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston,
+# MA 02110-1301, USA.
+
+# Compares the poll, epoll and io_uring backends of InfStandaloneIo. The
+# backend is chosen at build time, so this configures and builds libinfinity
+# once per backend in a temporary directory, and runs inf-test-standalone-io
+# with the given arguments against each build. Backends that cannot be built
+# on this system are skipped. The source tree must not be configured itself,
+# since configure refuses to build out of a configured tree.
+# Usage: inf-test-io-backends.sh [n-idle] [n-active] [n-events] [n-timeouts]
+
+srcdir=`cd "\`dirname "$0"\`/.." && pwd`
+if test ! -x "$srcdir/configure"
+then
+  echo "Run autogen.sh in $srcdir first" >&2
+  exit 1
+fi
+
+builddir=`mktemp -d "${TMPDIR:-/tmp}/inf-test-io-backends-XXXXXX"` || exit 1
+trap 'rm -rf "$builddir"' EXIT
+
+result=1
+for backend in poll epoll io_uring
+do
+  case $backend in
+  poll) flags="--disable-epoll --with-liburing=no" ;;
+  epoll) flags="--enable-epoll --with-liburing=no" ;;
+  io_uring) flags="--with-liburing=yes" ;;
+  esac
+
+  mkdir "$builddir/$backend"
+  cd "$builddir/$backend" || exit 1
+
+  if ! "$srcdir/configure" $flags --without-infgtk --without-inftextgtk \
+       --without-infinoted --without-avahi > build.log 2>&1
+  then
+    echo "$backend: not available, see configure output:" >&2
+    tail -n 1 build.log >&2
+    continue
+  fi
+
+  if ! make -C libinfinity > build.log 2>&1 ||
+     ! make -C test inf-test-standalone-io > build.log 2>&1
+  then
+    echo "$backend: build failed:" >&2
+    tail -n 20 build.log >&2
+    exit 1
+  fi
+
+  echo "$backend:"
+  ./test/inf-test-standalone-io "$@" || exit 1
+  echo
+  result=0
+done
+
+exit $result
@@ -0,0 +1,230 @@
+/* libinfinity - a GObject-based infinote implementation
+ * Copyright (C) 2007-2015 Armin Burgmeier <armin@arbur.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+/* Sends a number of messages through a pair of simulated connections in
+ * emulated mode, and verifies that they arrive no earlier than the
+ * configured latency allows, and in order unless reordering is enabled. It
+ * reports the observed one-way delay and the time until all messages have
+ * been received.
+ * Usage: inf-test-simulated-connection [latency] [jitter] [bandwidth]
+ *                                      [n-messages] [reorder]
+ */
+
+#include <libinfinity/common/inf-simulated-connection.h>
+#include <libinfinity/common/inf-standalone-io.h>
+#include <libinfinity/common/inf-xml-connection.h>
+#include <libinfinity/common/inf-xml-util.h>
+#include <libinfinity/common/inf-init.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct _InfTestSimulatedConnection InfTestSimulatedConnection;
+struct _InfTestSimulatedConnection {
+  InfStandaloneIo* io;
+  guint latency;
+  gboolean reorder;
+
+  guint n_messages;
+  guint n_received;
+  guint n_reordered;
+  guint next_seq;
+
+  gint64* send_times;
+  gint64 min_delay;
+  gint64 max_delay;
+  gint64 total_delay;
+  gint64 last_arrival;
+  gboolean failed;
+};
+
+static void
+inf_test_simulated_connection_received_cb(InfXmlConnection* connection,
+                                          xmlNodePtr xml,
+                                          gpointer user_data)
+{
+  InfTestSimulatedConnection* test;
+  guint seq;
+  gint64 delay;
+  gint64 now;
+
+  test = (InfTestSimulatedConnection*)user_data;
+  now = g_get_monotonic_time();
+
+  if(!inf_xml_util_get_attribute_uint_required(xml, "seq", &seq, NULL) ||
+     seq >= test->n_messages)
+  {
+    fprintf(stderr, "Received unexpected message\n");
+    test->failed = TRUE;
+    inf_standalone_io_loop_quit(test->io);
+    return;
+  }
+
+  delay = now - test->send_times[seq];
+  if(delay < (gint64)test->latency * 1000)
+  {
+    fprintf(
+      stderr,
+      "Message %u arrived after %.3f ms, before the latency of %u ms\n",
+      seq,
+      delay / 1000.0,
+      test->latency
+    );
+
+    test->failed = TRUE;
+  }
+
+  if(seq != test->next_seq)
+  {
+    ++test->n_reordered;
+    if(!test->reorder)
+    {
+      fprintf(stderr, "Message %u arrived out of order\n", seq);
+      test->failed = TRUE;
+    }
+  }
+
+  test->next_seq = seq + 1;
+
+  if(test->n_received == 0 || delay < test->min_delay)
+    test->min_delay = delay;
+  if(test->n_received == 0 || delay > test->max_delay)
+    test->max_delay = delay;
+
+  test->total_delay += delay;
+  test->last_arrival = now;
+
+  ++test->n_received;
+  if(test->n_received == test->n_messages)
+    inf_standalone_io_loop_quit(test->io);
+}
+
+int
+main(int argc, char* argv[])
+{
+  InfTestSimulatedConnection test;
+  InfSimulatedConnection* sender;
+  InfSimulatedConnection* receiver;
+  GError* error;
+  GString* payload;
+  xmlNodePtr xml;
+  guint jitter;
+  guint bandwidth;
+  gint64 start;
+  guint i;
+
+  test.latency = (argc > 1) ? atoi(argv[1]) : 50;
+  jitter = (argc > 2) ? atoi(argv[2]) : 10;
+  bandwidth = (argc > 3) ? atoi(argv[3]) : 1024 * 1024;
+  test.n_messages = (argc > 4) ? atoi(argv[4]) : 1000;
+  test.reorder = (argc > 5) ? atoi(argv[5]) != 0 : FALSE;
+
+  if(test.n_messages == 0)
+  {
+    fprintf(stderr, "Need at least one message\n");
+    return 1;
+  }
+
+  error = NULL;
+  if(inf_init(&error) == FALSE)
+  {
+    fprintf(stderr, "%s\n", error->message);
+    g_error_free(error);
+    return 1;
+  }
+
+  test.io = inf_standalone_io_new();
+  test.n_received = 0;
+  test.n_reordered = 0;
+  test.next_seq = 0;
+  test.send_times = g_malloc(sizeof(gint64) * test.n_messages);
+  test.min_delay = 0;
+  test.max_delay = 0;
+  test.total_delay = 0;
+  test.last_arrival = 0;
+  test.failed = FALSE;
+
+  sender = inf_simulated_connection_new_with_io(INF_IO(test.io));
+  receiver = inf_simulated_connection_new_with_io(INF_IO(test.io));
+  inf_simulated_connection_connect(sender, receiver);
+
+  g_object_set(
+    G_OBJECT(sender),
+    "latency", test.latency,
+    "jitter", jitter,
+    "bandwidth", bandwidth,
+    "reorder", test.reorder,
+    "seed", 42,
+    NULL
+  );
+
+  inf_simulated_connection_set_mode(sender, INF_SIMULATED_CONNECTION_EMULATED);
+
+  g_signal_connect(
+    G_OBJECT(receiver),
+    "received",
+    G_CALLBACK(inf_test_simulated_connection_received_cb),
+    &test
+  );
+
+  /* Messages of the size of a typical group message with a small text
+   * operation in it. */
+  payload = g_string_new(NULL);
+  for(i = 0; i < 200; ++i)
+    g_string_append_c(payload, 'a' + i % 26);
+
+  start = g_get_monotonic_time();
+  for(i = 0; i < test.n_messages; ++i)
+  {
+    xml = xmlNewNode(NULL, (const xmlChar*)"request");
+    inf_xml_util_set_attribute_uint(xml, "seq", i);
+    xmlNodeAddContentLen(xml, (const xmlChar*)payload->str, payload->len);
+
+    test.send_times[i] = g_get_monotonic_time();
+    inf_xml_connection_send(INF_XML_CONNECTION(sender), xml);
+  }
+
+  inf_standalone_io_loop(test.io);
+
+  if(!test.failed)
+  {
+    printf(
+      "%u messages: one-way delay min %.3f ms, avg %.3f ms, max %.3f ms, "
+      "%u reordered, all received after %.3f ms\n",
+      test.n_messages,
+      test.min_delay / 1000.0,
+      test.total_delay / 1000.0 / test.n_messages,
+      test.max_delay / 1000.0,
+      test.n_reordered,
+      (test.last_arrival - start) / 1000.0
+    );
+  }
+
+  g_string_free(payload, TRUE);
+  inf_xml_connection_close(INF_XML_CONNECTION(sender));
+  g_object_unref(sender);
+  g_object_unref(receiver);
+  g_object_unref(test.io);
+  g_free(test.send_times);
+  inf_deinit();
+
+  return test.failed ? 1 : 0;
+}
+
+/* vim:set et sw=2 ts=2: */
@@ -0,0 +1,297 @@
+/* libinfinity - a GObject-based infinote implementation
+ * Copyright (C) 2007-2015 Armin Burgmeier <armin@arbur.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+/* Measures how fast InfStandaloneIo dispatches events on a few active
+ * sockets while a large number of idle sockets is being watched as well,
+ * and how fast it adds, removes and runs a large number of timeouts.
+ * Usage: inf-test-standalone-io [n-idle] [n-active] [n-events] [n-timeouts]
+ */
+
+#include <libinfinity/common/inf-standalone-io.h>
+#include <libinfinity/common/inf-io.h>
+#include <libinfinity/common/inf-init.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef G_OS_WIN32
+# include <sys/types.h>
+# include <sys/socket.h>
+# include <sys/resource.h>
+# include <fcntl.h>
+# include <unistd.h>
+# include <errno.h>
+#endif
+
+#ifndef G_OS_WIN32
+typedef struct _InfTestStandaloneIoPair InfTestStandaloneIoPair;
+struct _InfTestStandaloneIoPair {
+  InfNativeSocket sockets[2];
+  InfIoWatch* watch;
+};
+
+typedef struct _InfTestStandaloneIo InfTestStandaloneIo;
+struct _InfTestStandaloneIo {
+  InfStandaloneIo* io;
+  guint n_events;
+  guint max_events;
+  guint n_timeouts;
+};
+
+static InfTestStandaloneIo test;
+
+static void
+inf_test_standalone_io_active_cb(InfNativeSocket* socket,
+                                 InfIoEvent event,
+                                 gpointer user_data)
+{
+  InfTestStandaloneIoPair* pair;
+  char buf[64];
+  ssize_t ret;
+
+  pair = (InfTestStandaloneIoPair*)user_data;
+  g_assert(socket == &pair->sockets[0]);
+
+  if(event & INF_IO_ERROR)
+  {
+    fprintf(stderr, "Error condition on active socket\n");
+    exit(1);
+  }
+
+  /* Drain the socket, since the watch is edge-triggered */
+  do
+  {
+    ret = read(pair->sockets[0], buf, sizeof(buf));
+  } while(ret > 0 || (ret == -1 && errno == EINTR));
+
+  /* Make the socket readable again for the next iteration */
+  if(write(pair->sockets[1], "x", 1) != 1)
+  {
+    fprintf(stderr, "write() failed: %s\n", strerror(errno));
+    exit(1);
+  }
+
+  ++test.n_events;
+  if(test.n_events == test.max_events)
+    inf_standalone_io_loop_quit(test.io);
+}
+
+static void
+inf_test_standalone_io_idle_cb(InfNativeSocket* socket,
+                               InfIoEvent event,
+                               gpointer user_data)
+{
+  fprintf(stderr, "Event on idle socket\n");
+  exit(1);
+}
+
+static void
+inf_test_standalone_io_timeout_cb(gpointer user_data)
+{
+  --test.n_timeouts;
+}
+
+static gboolean
+inf_test_standalone_io_create_pair(InfTestStandaloneIoPair* pair)
+{
+  if(socketpair(AF_UNIX, SOCK_STREAM, 0, pair->sockets) == -1)
+  {
+    fprintf(stderr, "socketpair() failed: %s\n", strerror(errno));
+    return FALSE;
+  }
+
+  fcntl(pair->sockets[0], F_SETFL, O_NONBLOCK);
+  fcntl(pair->sockets[1], F_SETFL, O_NONBLOCK);
+  return TRUE;
+}
+
+static void
+inf_test_standalone_io_raise_fd_limit(guint n_pairs)
+{
+  struct rlimit limit;
+  rlim_t wanted;
+
+  wanted = (rlim_t)n_pairs * 2 + 64;
+  if(getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < wanted)
+  {
+    limit.rlim_cur = wanted;
+    if(limit.rlim_max != RLIM_INFINITY && limit.rlim_cur > limit.rlim_max)
+      limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+}
+#endif
+
+int main(int argc, char* argv[])
+{
+#ifndef G_OS_WIN32
+  GError* error;
+  InfTestStandaloneIoPair* pairs;
+  InfIoTimeout** timeouts;
+  guint n_idle;
+  guint n_active;
+  guint n_pairs;
+  guint n_timeouts;
+  guint n_iterations;
+  guint i;
+  gint64 start;
+  gint64 setup;
+  gint64 end;
+
+  n_idle = (argc > 1) ? atoi(argv[1]) : 10000;
+  n_active = (argc > 2) ? atoi(argv[2]) : 100;
+  test.max_events = (argc > 3) ? atoi(argv[3]) : 1000000;
+  n_timeouts = (argc > 4) ? atoi(argv[4]) : 100000;
+  test.n_events = 0;
+
+  if(n_active == 0 || test.max_events == 0)
+  {
+    fprintf(stderr, "Need at least one active socket and one event\n");
+    return 1;
+  }
+
+  error = NULL;
+  if(inf_init(&error) == FALSE)
+  {
+    fprintf(stderr, "%s\n", error->message);
+    g_error_free(error);
+    return 1;
+  }
+
+  n_pairs = n_idle + n_active;
+  inf_test_standalone_io_raise_fd_limit(n_pairs);
+
+  test.io = inf_standalone_io_new();
+  pairs = g_malloc(sizeof(InfTestStandaloneIoPair) * n_pairs);
+
+  start = g_get_monotonic_time();
+  for(i = 0; i < n_pairs; ++i)
+  {
+    if(!inf_test_standalone_io_create_pair(&pairs[i]))
+    {
+      fprintf(stderr, "Could only create %u of %u socket pairs\n", i, n_pairs);
+      return 1;
+    }
+
+    pairs[i].watch = inf_io_add_watch(
+      INF_IO(test.io),
+      &pairs[i].sockets[0],
+      INF_IO_INCOMING | INF_IO_ERROR | INF_IO_EDGE_TRIGGERED,
+      (i < n_idle) ?
+        inf_test_standalone_io_idle_cb : inf_test_standalone_io_active_cb,
+      &pairs[i],
+      NULL
+    );
+
+    g_assert(pairs[i].watch != NULL);
+  }
+
+  /* Kick off the active sockets */
+  for(i = n_idle; i < n_pairs; ++i)
+  {
+    if(write(pairs[i].sockets[1], "x", 1) != 1)
+    {
+      fprintf(stderr, "write() failed: %s\n", strerror(errno));
+      return 1;
+    }
+  }
+
+  setup = g_get_monotonic_time();
+  inf_standalone_io_loop(test.io);
+  end = g_get_monotonic_time();
+
+  printf(
+    "%u idle, %u active sockets: %u watches added in %.3f ms, "
+    "%u events in %.3f ms (%.0f events/s)\n",
+    n_idle,
+    n_active,
+    n_pairs,
+    (setup - start) / 1000.0,
+    test.n_events,
+    (end - setup) / 1000.0,
+    test.n_events / ((end - setup) / 1000000.0)
+  );
+
+  start = g_get_monotonic_time();
+  for(i = 0; i < n_pairs; ++i)
+  {
+    inf_io_remove_watch(INF_IO(test.io), pairs[i].watch);
+    close(pairs[i].sockets[0]);
+    close(pairs[i].sockets[1]);
+  }
+  end = g_get_monotonic_time();
+
+  printf("%u watches removed in %.3f ms\n", n_pairs, (end - start) / 1000.0);
+
+  g_free(pairs);
+
+  /* Timeouts are spread over one second, and every other one is removed
+   * again before it elapses. */
+  timeouts = g_malloc(sizeof(InfIoTimeout*) * n_timeouts);
+
+  start = g_get_monotonic_time();
+  for(i = 0; i < n_timeouts; ++i)
+  {
+    timeouts[i] = inf_io_add_timeout(
+      INF_IO(test.io),
+      g_random_int_range(0, 1000),
+      inf_test_standalone_io_timeout_cb,
+      NULL,
+      NULL
+    );
+  }
+  setup = g_get_monotonic_time();
+
+  for(i = 0; i < n_timeouts; i += 2)
+    inf_io_remove_timeout(INF_IO(test.io), timeouts[i]);
+  end = g_get_monotonic_time();
+
+  printf(
+    "%u timeouts added in %.3f ms, %u removed in %.3f ms\n",
+    n_timeouts,
+    (setup - start) / 1000.0,
+    (n_timeouts + 1) / 2,
+    (end - setup) / 1000.0
+  );
+
+  test.n_timeouts = n_timeouts / 2;
+  n_iterations = 0;
+  while(test.n_timeouts > 0)
+  {
+    inf_standalone_io_iteration(test.io);
+    ++n_iterations;
+  }
+
+  printf(
+    "%u timeouts run in %u iterations\n",
+    n_timeouts / 2,
+    n_iterations
+  );
+
+  g_free(timeouts);
+  g_object_unref(test.io);
+  inf_deinit();
+#else
+  fprintf(stderr, "This test is not supported on Windows\n");
+#endif
+  return 0;
+}
+
+/* vim:set et sw=2 ts=2: */
@@ -0,0 +1,394 @@
+/* libinfinity - a GObject-based infinote implementation
+ * Copyright (C) 2007-2015 Armin Burgmeier <armin@arbur.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+/* Reads a folder, writes an ACL and reads it back with the asynchronous
+ * functions of InfdFilesystemStorage, and verifies the results. Then it
+ * cancels reads whose results have been read in the background already,
+ * and verifies that their callbacks are not called.
+ */
+
+#include <libinfinity/server/infd-filesystem-storage.h>
+#include <libinfinity/server/infd-storage.h>
+#include <libinfinity/common/inf-standalone-io.h>
+#include <libinfinity/common/inf-file-util.h>
+#include <libinfinity/common/inf-init.h>
+
+#include <stdio.h>
+#include <string.h>
+
+typedef struct _InfTestStorageAsync InfTestStorageAsync;
+struct _InfTestStorageAsync {
+  InfStandaloneIo* io;
+  InfdStorage* storage;
+  InfIoTimeout* timeout;
+
+  /* Set in the worker thread of the storage */
+  GMutex mutex;
+  GCond cond;
+  gboolean ran;
+
+  gboolean failed;
+};
+
+static void
+inf_test_storage_async_timeout_func(gpointer user_data)
+{
+  InfTestStorageAsync* test;
+  test = (InfTestStorageAsync*)user_data;
+
+  fprintf(stderr, "Timed out\n");
+  test->timeout = NULL;
+  test->failed = TRUE;
+  inf_standalone_io_loop_quit(test->io);
+}
+
+/* Runs the main loop until a callback quits it */
+static void
+inf_test_storage_async_wait(InfTestStorageAsync* test)
+{
+  test->timeout = inf_io_add_timeout(
+    INF_IO(test->io),
+    5000,
+    inf_test_storage_async_timeout_func,
+    test,
+    NULL
+  );
+
+  inf_standalone_io_loop(test->io);
+
+  if(test->timeout != NULL)
+  {
+    inf_io_remove_timeout(INF_IO(test->io), test->timeout);
+    test->timeout = NULL;
+  }
+}
+
+static void
+inf_test_storage_async_read_subdirectory_cb(InfdStorage* storage,
+                                            GSList* nodes,
+                                            const GError* error,
+                                            gpointer user_data)
+{
+  InfTestStorageAsync* test;
+  InfdStorageNode* node;
+  gboolean found_a;
+  gboolean found_b;
+  GSList* item;
+
+  test = (InfTestStorageAsync*)user_data;
+  found_a = FALSE;
+  found_b = FALSE;
+
+  if(error != NULL)
+  {
+    fprintf(stderr, "Reading the folder failed: %s\n", error->message);
+    test->failed = TRUE;
+  }
+
+  for(item = nodes; item != NULL; item = item->next)
+  {
+    node = (InfdStorageNode*)item->data;
+    if(node->type == INFD_STORAGE_NODE_SUBDIRECTORY &&
+       strcmp(node->name, "a") == 0 && !found_a)
+    {
+      found_a = TRUE;
+    }
+    else if(node->type == INFD_STORAGE_NODE_SUBDIRECTORY &&
+            strcmp(node->name, "b") == 0 && !found_b)
+    {
+      found_b = TRUE;
+    }
+    else
+    {
+      fprintf(stderr, "Unexpected node \"%s\"\n", node->name);
+      test->failed = TRUE;
+    }
+  }
+
+  if(!found_a || !found_b)
+  {
+    fprintf(stderr, "Subfolders are missing\n");
+    test->failed = TRUE;
+  }
+
+  inf_standalone_io_loop_quit(test->io);
+}
+
+static void
+inf_test_storage_async_write_acl_cb(InfdStorage* storage,
+                                    const GError* error,
+                                    gpointer user_data)
+{
+  InfTestStorageAsync* test;
+  test = (InfTestStorageAsync*)user_data;
+
+  if(error != NULL)
+  {
+    fprintf(stderr, "Writing the ACL failed: %s\n", error->message);
+    test->failed = TRUE;
+  }
+
+  inf_standalone_io_loop_quit(test->io);
+}
+
+static void
+inf_test_storage_async_read_acl_cb(InfdStorage* storage,
+                                   GSList* acl,
+                                   const GError* error,
+                                   gpointer user_data)
+{
+  InfTestStorageAsync* test;
+  InfdStorageAcl* sheet;
+  InfAclMask mask;
+
+  test = (InfTestStorageAsync*)user_data;
+  inf_acl_mask_set1(&mask, INF_ACL_CAN_SUBSCRIBE_SESSION);
+
+  if(error != NULL)
+  {
+    fprintf(stderr, "Reading the ACL failed: %s\n", error->message);
+    test->failed = TRUE;
+  }
+  else if(acl == NULL || acl->next != NULL)
+  {
+    fprintf(stderr, "ACL has %u sheets instead of 1\n", g_slist_length(acl));
+    test->failed = TRUE;
+  }
+  else
+  {
+    sheet = (InfdStorageAcl*)acl->data;
+    if(strcmp(sheet->account_id, "default") != 0 ||
+       !inf_acl_mask_equal(&sheet->mask, &mask) ||
+       !inf_acl_mask_equal(&sheet->perms, &mask))
+    {
+      fprintf(stderr, "ACL differs from the one written\n");
+      test->failed = TRUE;
+    }
+  }
+
+  inf_standalone_io_loop_quit(test->io);
+}
+
+static void
+inf_test_storage_async_cancelled_subdirectory_cb(InfdStorage* storage,
+                                                 GSList* nodes,
+                                                 const GError* error,
+                                                 gpointer user_data)
+{
+  InfTestStorageAsync* test;
+  test = (InfTestStorageAsync*)user_data;
+
+  fprintf(stderr, "Callback of a cancelled folder read was called\n");
+  test->failed = TRUE;
+}
+
+static void
+inf_test_storage_async_cancelled_acl_cb(InfdStorage* storage,
+                                        GSList* acl,
+                                        const GError* error,
+                                        gpointer user_data)
+{
+  InfTestStorageAsync* test;
+  test = (InfTestStorageAsync*)user_data;
+
+  fprintf(stderr, "Callback of a cancelled ACL read was called\n");
+  test->failed = TRUE;
+}
+
+/* Runs in the worker thread of the storage */
+static void
+inf_test_storage_async_signal_run_func(InfdStorage* storage,
+                                       gpointer user_data)
+{
+  InfTestStorageAsync* test;
+  test = (InfTestStorageAsync*)user_data;
+
+  g_mutex_lock(&test->mutex);
+  test->ran = TRUE;
+  g_cond_signal(&test->cond);
+  g_mutex_unlock(&test->mutex);
+}
+
+static void
+inf_test_storage_async_run(InfTestStorageAsync* test)
+{
+  InfAclSheetSet* sheet_set;
+  InfAclSheet* sheet;
+  InfdStorageTask* subdirectory_task;
+  InfdStorageTask* acl_task;
+
+  infd_storage_read_subdirectory_async(
+    test->storage,
+    INF_IO(test->io),
+    "/",
+    inf_test_storage_async_read_subdirectory_cb,
+    test
+  );
+
+  inf_test_storage_async_wait(test);
+  if(test->failed) return;
+
+  sheet_set = inf_acl_sheet_set_new();
+  sheet = inf_acl_sheet_set_add_sheet(
+    sheet_set,
+    inf_acl_account_id_from_string("default")
+  );
+
+  inf_acl_mask_set1(&sheet->mask, INF_ACL_CAN_SUBSCRIBE_SESSION);
+  inf_acl_mask_set1(&sheet->perms, INF_ACL_CAN_SUBSCRIBE_SESSION);
+
+  /* The sheet set is copied, so it can be freed right away */
+  infd_storage_write_acl_async(
+    test->storage,
+    INF_IO(test->io),
+    "/a",
+    sheet_set,
+    inf_test_storage_async_write_acl_cb,
+    test
+  );
+
+  inf_acl_sheet_set_free(sheet_set);
+
+  inf_test_storage_async_wait(test);
+  if(test->failed) return;
+
+  infd_storage_read_acl_async(
+    test->storage,
+    INF_IO(test->io),
+    "/a",
+    inf_test_storage_async_read_acl_cb,
+    test
+  );
+
+  inf_test_storage_async_wait(test);
+  if(test->failed) return;
+
+  /* Tasks run in order, so once the signal task has run, the two reads
+   * before it have their results. Their callbacks have not been dispatched
+   * yet, since the main loop is not running, so they can be cancelled. */
+  subdirectory_task = infd_storage_read_subdirectory_async(
+    test->storage,
+    INF_IO(test->io),
+    "/",
+    inf_test_storage_async_cancelled_subdirectory_cb,
+    test
+  );
+
+  acl_task = infd_storage_read_acl_async(
+    test->storage,
+    INF_IO(test->io),
+    "/a",
+    inf_test_storage_async_cancelled_acl_cb,
+    test
+  );
+
+  infd_storage_run_async(
+    test->storage,
+    INF_IO(test->io),
+    inf_test_storage_async_signal_run_func,
+    NULL,
+    test,
+    NULL
+  );
+
+  g_mutex_lock(&test->mutex);
+  while(!test->ran)
+    g_cond_wait(&test->cond, &test->mutex);
+  g_mutex_unlock(&test->mutex);
+
+  infd_storage_task_cancel(subdirectory_task);
+  infd_storage_task_cancel(acl_task);
+
+  /* Tasks are also handed back in order, so the cancelled callbacks would
+   * have been called before this one quits the loop. */
+  infd_storage_read_subdirectory_async(
+    test->storage,
+    INF_IO(test->io),
+    "/",
+    inf_test_storage_async_read_subdirectory_cb,
+    test
+  );
+
+  inf_test_storage_async_wait(test);
+}
+
+int
+main(int argc, char* argv[])
+{
+  InfTestStorageAsync test;
+  InfdFilesystemStorage* storage;
+  GError* error;
+  gchar* root_directory;
+
+  error = NULL;
+  if(inf_init(&error) == FALSE)
+  {
+    fprintf(stderr, "%s\n", error->message);
+    g_error_free(error);
+    return 1;
+  }
+
+  root_directory = g_dir_make_tmp("inf-test-storage-async-XXXXXX", &error);
+  if(root_directory == NULL)
+  {
+    fprintf(stderr, "%s\n", error->message);
+    g_error_free(error);
+    return 1;
+  }
+
+  storage = infd_filesystem_storage_new(root_directory);
+
+  test.io = inf_standalone_io_new();
+  test.storage = INFD_STORAGE(storage);
+  test.timeout = NULL;
+  g_mutex_init(&test.mutex);
+  g_cond_init(&test.cond);
+  test.ran = FALSE;
+  test.failed = FALSE;
+
+  if(!infd_storage_create_subdirectory(test.storage, "/a", &error) ||
+     !infd_storage_create_subdirectory(test.storage, "/b", &error))
+  {
+    fprintf(stderr, "Failed to create folders: %s\n", error->message);
+    g_error_free(error);
+    test.failed = TRUE;
+  }
+  else
+  {
+    inf_test_storage_async_run(&test);
+  }
+
+  g_object_unref(storage);
+  g_object_unref(test.io);
+  g_cond_clear(&test.cond);
+  g_mutex_clear(&test.mutex);
+
+  if(!inf_file_util_delete(root_directory, &error))
+  {
+    fprintf(stderr, "%s\n", error->message);
+    g_error_free(error);
+  }
+
+  g_free(root_directory);
+  inf_deinit();
+
+  return test.failed ? 1 : 0;
+}
+
+/* vim:set et sw=2 ts=2: */
@@ -17,6 +17,11 @@
  * MA 02110-1301, USA.
  */
 
+/* Without arguments, connects to a remote host, sends a line and prints
+ * everything it receives. With a byte count as argument, measures how fast
+ * that many bytes are received over a loopback connection instead.
+ * Usage: inf-test-tcp-connection [n-bytes] */
+
 #include <libinfinity/common/inf-tcp-connection.h>
 #include <libinfinity/common/inf-ip-address.h>
 #include <libinfinity/common/inf-standalone-io.h>
@@ -27,6 +32,27 @@
 #include <string.h>
 #include <errno.h>
 
+#ifndef G_OS_WIN32
+# include <sys/types.h>
+# include <sys/socket.h>
+# include <netinet/in.h>
+# include <arpa/inet.h>
+# include <fcntl.h>
+# include <unistd.h>
+#endif
+
+#ifndef G_OS_WIN32
+typedef struct _InfTestTcpConnectionTransfer InfTestTcpConnectionTransfer;
+struct _InfTestTcpConnectionTransfer {
+  InfStandaloneIo* io;
+  InfNativeSocket sender;
+  InfIoWatch* watch;
+  gsize to_send;
+  gsize received;
+  guint n_received;
+};
+#endif
+
 static void
 received_cb(InfTcpConnection* connection,
             gconstpointer buffer,
@@ -182,12 +208,187 @@ notify_status_cb(InfTcpConnection* connection,
   g_free(addr_str);
 }
 
+#ifndef G_OS_WIN32
+static void
+transfer_received_cb(InfTcpConnection* connection,
+                     gconstpointer buffer,
+                     guint len,
+                     gpointer user_data)
+{
+  InfTestTcpConnectionTransfer* transfer;
+  transfer = (InfTestTcpConnectionTransfer*)user_data;
+
+  transfer->received += len;
+  ++transfer->n_received;
+}
+
+static void
+transfer_notify_status_cb(InfTcpConnection* connection,
+                          GParamSpec* pspec,
+                          gpointer user_data)
+{
+  InfTestTcpConnectionTransfer* transfer;
+  InfTcpConnectionStatus status;
+
+  transfer = (InfTestTcpConnectionTransfer*)user_data;
+  g_object_get(G_OBJECT(connection), "status", &status, NULL);
+
+  if(status == INF_TCP_CONNECTION_CLOSED)
+    inf_standalone_io_loop_quit(transfer->io);
+}
+
+static void
+transfer_send_cb(InfNativeSocket* socket,
+                 InfIoEvent event,
+                 gpointer user_data)
+{
+  InfTestTcpConnectionTransfer* transfer;
+  static gchar buf[65536];
+  ssize_t result;
+
+  transfer = (InfTestTcpConnectionTransfer*)user_data;
+
+  while(transfer->to_send > 0)
+  {
+    result = send(
+      *socket,
+      buf,
+      MIN(transfer->to_send, sizeof(buf)),
+      INF_NATIVE_SOCKET_SENDRECV_FLAGS
+    );
+
+    if(result < 0 && errno == EINTR)
+      continue;
+    if(result < 0 && errno == EAGAIN)
+      return;
+
+    if(result < 0)
+    {
+      fprintf(stderr, "send() failed: %s\n", strerror(errno));
+      exit(1);
+    }
+
+    transfer->to_send -= result;
+  }
+
+  /* All data has been sent, so close the connection. The receiving side
+   * quits the main loop once it notices. */
+  inf_io_remove_watch(INF_IO(transfer->io), transfer->watch);
+  transfer->watch = NULL;
+  close(transfer->sender);
+  transfer->sender = INVALID_SOCKET;
+}
+
+static int
+run_transfer(InfStandaloneIo* io,
+             gsize n_bytes)
+{
+  InfTestTcpConnectionTransfer transfer;
+  InfTcpConnection* connection;
+  InfIpAddress* addr;
+  InfNativeSocket listener;
+  struct sockaddr_in native_addr;
+  socklen_t len;
+  GError* error;
+  gint64 start;
+  gint64 end;
+
+  listener = socket(AF_INET, SOCK_STREAM, 0);
+  memset(&native_addr, 0, sizeof(native_addr));
+  native_addr.sin_family = AF_INET;
+  native_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  native_addr.sin_port = 0;
+  len = sizeof(native_addr);
+
+  if(listener == INVALID_SOCKET ||
+     bind(listener, (struct sockaddr*)&native_addr, len) == -1 ||
+     listen(listener, 1) == -1 ||
+     getsockname(listener, (struct sockaddr*)&native_addr, &len) == -1)
+  {
+    fprintf(stderr, "Could not set up listener: %s\n", strerror(errno));
+    return 1;
+  }
+
+  addr = inf_ip_address_new_loopback4();
+  connection =
+    inf_tcp_connection_new(INF_IO(io), addr, ntohs(native_addr.sin_port));
+  inf_ip_address_free(addr);
+
+  error = NULL;
+  if(inf_tcp_connection_open(connection, &error) == FALSE)
+  {
+    fprintf(stderr, "Could not open connection: %s\n", error->message);
+    g_error_free(error);
+    return 1;
+  }
+
+  /* The kernel completes the handshake on its own for loopback
+   * connections, so this does not block for long. */
+  transfer.io = io;
+  transfer.sender = accept(listener, NULL, NULL);
+  transfer.to_send = n_bytes;
+  transfer.received = 0;
+  transfer.n_received = 0;
+  close(listener);
+
+  if(transfer.sender == INVALID_SOCKET)
+  {
+    fprintf(stderr, "accept() failed: %s\n", strerror(errno));
+    return 1;
+  }
+
+  fcntl(transfer.sender, F_SETFL, O_NONBLOCK);
+
+  g_signal_connect(
+    G_OBJECT(connection),
+    "received",
+    G_CALLBACK(transfer_received_cb),
+    &transfer
+  );
+
+  g_signal_connect(
+    G_OBJECT(connection),
+    "notify::status",
+    G_CALLBACK(transfer_notify_status_cb),
+    &transfer
+  );
+
+  transfer.watch = inf_io_add_watch(
+    INF_IO(io),
+    &transfer.sender,
+    INF_IO_OUTGOING,
+    transfer_send_cb,
+    &transfer,
+    NULL
+  );
+
+  start = g_get_monotonic_time();
+  inf_standalone_io_loop(io);
+  end = g_get_monotonic_time();
+
+  printf(
+    "%lu bytes received in %.3f ms (%.1f MB/s) with %u emissions "
+    "(%.0f bytes per emission)\n",
+    (unsigned long)transfer.received,
+    (end - start) / 1000.0,
+    transfer.received / ((end - start) / 1000000.0) / (1024.0 * 1024.0),
+    transfer.n_received,
+    transfer.n_received > 0 ?
+      (double)transfer.received / transfer.n_received : 0.0
+  );
+
+  g_object_unref(connection);
+  return transfer.received == n_bytes ? 0 : 1;
+}
+#endif
+
 int main(int argc, char* argv[])
 {
   InfStandaloneIo* io;
   InfNameResolver* resolver;
   InfTcpConnection* connection;
   GError* error;
+  int result;
 
   error = NULL;
   if(inf_init(&error) == FALSE)
@@ -199,6 +400,18 @@ int main(int argc, char* argv[])
 
   io = inf_standalone_io_new();
 
+  if(argc > 1)
+  {
+#ifndef G_OS_WIN32
+    result = run_transfer(io, strtoul(argv[1], NULL, 10));
+#else
+    fprintf(stderr, "Transfer measurement is not supported on Windows\n");
+    result = 1;
+#endif
+    g_object_unref(G_OBJECT(io));
+    return result;
+  }
+
   resolver =
     inf_name_resolver_new(INF_IO(io), "0x539.de", "5223", "_jabber._tcp");
 
@@ -0,0 +1,304 @@
+/* libinfinity - a GObject-based infinote implementation
+ * Copyright (C) 2007-2015 Armin Burgmeier <armin@arbur.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+/* Connects an InfTcpConnection to a loopback listener via an
+ * InfNameResolver, which makes the connection go through its connection
+ * attempts, and verifies that the connection sends and receives data on the
+ * socket of the successful attempt. This is done a few times in a row, so
+ * that file descriptors of earlier connections are reused. */
+
+#include <libinfinity/common/inf-tcp-connection.h>
+#include <libinfinity/common/inf-name-resolver.h>
+#include <libinfinity/common/inf-standalone-io.h>
+#include <libinfinity/common/inf-init.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#ifndef G_OS_WIN32
+# include <sys/types.h>
+# include <sys/socket.h>
+# include <netinet/in.h>
+# include <arpa/inet.h>
+# include <unistd.h>
+#endif
+
+#define INF_TEST_TCP_RESOLVE_N_CONNECTIONS 5
+
+#ifndef G_OS_WIN32
+typedef struct _InfTestTcpResolve InfTestTcpResolve;
+struct _InfTestTcpResolve {
+  InfStandaloneIo* io;
+  InfNativeSocket listener;
+  InfNativeSocket peer;
+  InfIoWatch* watch;
+
+  gboolean sent;
+  gsize received;
+  gboolean failed;
+};
+
+static void
+inf_test_tcp_resolve_accept_cb(InfNativeSocket* socket,
+                               InfIoEvent event,
+                               gpointer user_data)
+{
+  InfTestTcpResolve* test;
+  test = (InfTestTcpResolve*)user_data;
+
+  test->peer = accept(*socket, NULL, NULL);
+  if(test->peer == INVALID_SOCKET)
+  {
+    fprintf(stderr, "accept() failed: %s\n", strerror(errno));
+    test->failed = TRUE;
+    inf_standalone_io_loop_quit(test->io);
+    return;
+  }
+
+  /* The connection can only receive this if it watches its socket */
+  if(send(test->peer, "pong", 4, 0) != 4)
+  {
+    fprintf(stderr, "send() failed: %s\n", strerror(errno));
+    test->failed = TRUE;
+    inf_standalone_io_loop_quit(test->io);
+  }
+}
+
+static void
+inf_test_tcp_resolve_received_cb(InfTcpConnection* connection,
+                                 gconstpointer buffer,
+                                 guint len,
+                                 gpointer user_data)
+{
+  InfTestTcpResolve* test;
+  test = (InfTestTcpResolve*)user_data;
+
+  test->received += len;
+  if(test->received >= 4 && test->sent)
+    inf_standalone_io_loop_quit(test->io);
+}
+
+static void
+inf_test_tcp_resolve_sent_cb(InfTcpConnection* connection,
+                             gconstpointer buffer,
+                             guint len,
+                             gpointer user_data)
+{
+  InfTestTcpResolve* test;
+  test = (InfTestTcpResolve*)user_data;
+
+  test->sent = TRUE;
+  if(test->received >= 4)
+    inf_standalone_io_loop_quit(test->io);
+}
+
+static void
+inf_test_tcp_resolve_error_cb(InfTcpConnection* connection,
+                              const GError* error,
+                              gpointer user_data)
+{
+  InfTestTcpResolve* test;
+  test = (InfTestTcpResolve*)user_data;
+
+  fprintf(stderr, "Connection error: %s\n", error->message);
+  test->failed = TRUE;
+  inf_standalone_io_loop_quit(test->io);
+}
+
+static void
+inf_test_tcp_resolve_notify_status_cb(InfTcpConnection* connection,
+                                      GParamSpec* pspec,
+                                      gpointer user_data)
+{
+  InfTcpConnectionStatus status;
+  g_object_get(G_OBJECT(connection), "status", &status, NULL);
+
+  if(status == INF_TCP_CONNECTION_CONNECTED)
+    inf_tcp_connection_send(connection, "ping", 4);
+}
+
+static void
+inf_test_tcp_resolve_timeout_func(gpointer user_data)
+{
+  InfTestTcpResolve* test;
+  test = (InfTestTcpResolve*)user_data;
+
+  fprintf(stderr, "Timed out\n");
+  test->failed = TRUE;
+  inf_standalone_io_loop_quit(test->io);
+}
+
+static gboolean
+inf_test_tcp_resolve_run(InfTestTcpResolve* test,
+                         guint port)
+{
+  InfNameResolver* resolver;
+  InfTcpConnection* connection;
+  InfIoTimeout* timeout;
+  GError* error;
+  gchar* service;
+  gchar buf[4];
+
+  service = g_strdup_printf("%u", port);
+  resolver = inf_name_resolver_new(INF_IO(test->io), "127.0.0.1", service,
+                                   NULL);
+  g_free(service);
+
+  connection = inf_tcp_connection_new_resolve(INF_IO(test->io), resolver);
+  g_object_unref(resolver);
+
+  g_signal_connect(
+    G_OBJECT(connection),
+    "received",
+    G_CALLBACK(inf_test_tcp_resolve_received_cb),
+    test
+  );
+
+  g_signal_connect(
+    G_OBJECT(connection),
+    "sent",
+    G_CALLBACK(inf_test_tcp_resolve_sent_cb),
+    test
+  );
+
+  g_signal_connect(
+    G_OBJECT(connection),
+    "error",
+    G_CALLBACK(inf_test_tcp_resolve_error_cb),
+    test
+  );
+
+  g_signal_connect(
+    G_OBJECT(connection),
+    "notify::status",
+    G_CALLBACK(inf_test_tcp_resolve_notify_status_cb),
+    test
+  );
+
+  test->peer = INVALID_SOCKET;
+  test->sent = FALSE;
+  test->received = 0;
+
+  error = NULL;
+  if(inf_tcp_connection_open(connection, &error) == FALSE)
+  {
+    fprintf(stderr, "Could not open connection: %s\n", error->message);
+    g_error_free(error);
+    g_object_unref(connection);
+    return FALSE;
+  }
+
+  timeout = inf_io_add_timeout(
+    INF_IO(test->io),
+    5000,
+    inf_test_tcp_resolve_timeout_func,
+    test,
+    NULL
+  );
+
+  inf_standalone_io_loop(test->io);
+
+  if(!test->failed)
+  {
+    inf_io_remove_timeout(INF_IO(test->io), timeout);
+
+    /* The connection must also have written to the socket it got from the
+     * successful attempt. */
+    if(recv(test->peer, buf, sizeof(buf), 0) != 4 ||
+       memcmp(buf, "ping", 4) != 0)
+    {
+      fprintf(stderr, "Peer did not receive the data sent\n");
+      test->failed = TRUE;
+    }
+  }
+
+  inf_tcp_connection_close(connection);
+  g_object_unref(connection);
+
+  if(test->peer != INVALID_SOCKET)
+    close(test->peer);
+
+  return !test->failed;
+}
+#endif
+
+int
+main(int argc, char* argv[])
+{
+#ifndef G_OS_WIN32
+  InfTestTcpResolve test;
+  struct sockaddr_in native_addr;
+  socklen_t len;
+  GError* error;
+  guint i;
+
+  error = NULL;
+  if(inf_init(&error) == FALSE)
+  {
+    fprintf(stderr, "%s\n", error->message);
+    g_error_free(error);
+    return 1;
+  }
+
+  test.io = inf_standalone_io_new();
+  test.failed = FALSE;
+
+  test.listener = socket(AF_INET, SOCK_STREAM, 0);
+  memset(&native_addr, 0, sizeof(native_addr));
+  native_addr.sin_family = AF_INET;
+  native_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  native_addr.sin_port = 0;
+  len = sizeof(native_addr);
+
+  if(test.listener == INVALID_SOCKET ||
+     bind(test.listener, (struct sockaddr*)&native_addr, len) == -1 ||
+     listen(test.listener, INF_TEST_TCP_RESOLVE_N_CONNECTIONS) == -1 ||
+     getsockname(test.listener, (struct sockaddr*)&native_addr, &len) == -1)
+  {
+    fprintf(stderr, "Could not set up listener: %s\n", strerror(errno));
+    return 1;
+  }
+
+  test.watch = inf_io_add_watch(
+    INF_IO(test.io),
+    &test.listener,
+    INF_IO_INCOMING,
+    inf_test_tcp_resolve_accept_cb,
+    &test,
+    NULL
+  );
+
+  for(i = 0; i < INF_TEST_TCP_RESOLVE_N_CONNECTIONS; ++i)
+    if(!inf_test_tcp_resolve_run(&test, ntohs(native_addr.sin_port)))
+      break;
+
+  inf_io_remove_watch(INF_IO(test.io), test.watch);
+  close(test.listener);
+  g_object_unref(test.io);
+  inf_deinit();
+
+  return test.failed ? 1 : 0;
+#else
+  fprintf(stderr, "This test is not supported on Windows\n");
+  return 0;
+#endif
+}
+
+/* vim:set et sw=2 ts=2: */
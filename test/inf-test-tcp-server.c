@@ -92,11 +92,35 @@ new_connection_cb(InfdTcpServer* server,
 {
   InfIpAddress* addr;
   gchar* str;
+  guint64 n_accepted;
+  guint64 n_batches;
+  gint64 average_latency;
+  gint64 max_latency;
+
   g_object_get(G_OBJECT(connection), "remote-address", &addr, NULL);
   str = inf_ip_address_to_string(addr);
   inf_ip_address_free(addr);
 
-  printf("Connection from %s\n", str);
+  /* The statistics do not yet include this connection */
+  infd_tcp_server_get_accept_statistics(
+    server,
+    &n_accepted,
+    &n_batches,
+    &average_latency,
+    &max_latency
+  );
+
+  printf(
+    "Connection from %s (previously accepted %" G_GUINT64_FORMAT
+    " in %" G_GUINT64_FORMAT " batches, accept latency average %"
+    G_GINT64_FORMAT " us, max %" G_GINT64_FORMAT " us)\n",
+    str,
+    n_accepted,
+    n_batches,
+    average_latency,
+    max_latency
+  );
+
   g_free(str);
 
   g_signal_connect(
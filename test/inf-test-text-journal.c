@@ -0,0 +1,374 @@
+/* libinfinity - a GObject-based infinote implementation
+ * Copyright (C) 2007-2015 Armin Burgmeier <armin@arbur.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+/* Makes random edits to a text buffer while recording them with an
+ * InfTextFilesystemJournal, then drops the buffer without writing it, as if
+ * the server had been terminated, and verifies that reading the session
+ * back recovers the edited text. This is done once without and once with
+ * compaction of the journal in the background. Before reading the session
+ * back the second time, it leaves behind the snapshot of an interrupted
+ * compaction, and verifies that reading the session removes it. It reports
+ * how long recording the edits took.
+ * Usage: inf-test-text-journal [n-edits]
+ */
+
+#include <libinftext/inf-text-filesystem-format.h>
+#include <libinftext/inf-text-default-buffer.h>
+#include <libinftext/inf-text-user.h>
+
+#include <libinfinity/server/infd-filesystem-storage.h>
+#include <libinfinity/common/inf-standalone-io.h>
+#include <libinfinity/common/inf-file-util.h>
+#include <libinfinity/common/inf-init.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INF_TEST_TEXT_JOURNAL_PATH "/journal"
+
+static void
+inf_test_text_journal_edit(InfTextBuffer* buffer,
+                           InfUser* user,
+                           GRand* rand)
+{
+  gchar text[10];
+  guint length;
+  guint pos;
+  guint len;
+  guint i;
+
+  length = inf_text_buffer_get_length(buffer);
+  if(length > 0 && g_rand_int_range(rand, 0, 3) == 0)
+  {
+    pos = g_rand_int_range(rand, 0, length);
+    len = MIN(length - pos, (guint)g_rand_int_range(rand, 1, 10));
+    inf_text_buffer_erase_text(buffer, pos, len, user);
+  }
+  else
+  {
+    pos = g_rand_int_range(rand, 0, length + 1);
+    len = g_rand_int_range(rand, 1, sizeof(text));
+    for(i = 0; i < len; ++i)
+      text[i] = 'a' + g_rand_int_range(rand, 0, 26);
+
+    inf_text_buffer_insert_text(buffer, pos, text, len, len, user);
+  }
+}
+
+static gint64
+inf_test_text_journal_record(InfdFilesystemStorage* storage,
+                             InfIo* io,
+                             InfUserTable* user_table,
+                             InfTextBuffer* buffer,
+                             gsize compact_size,
+                             guint n_edits)
+{
+  InfTextFilesystemJournal* journal;
+  InfUser* user;
+  GRand* rand;
+  GError* error;
+  gint64 start;
+  guint i;
+
+  error = NULL;
+  journal = inf_text_filesystem_journal_open(
+    storage,
+    io,
+    INF_TEST_TEXT_JOURNAL_PATH,
+    user_table,
+    buffer,
+    compact_size,
+    &error
+  );
+
+  if(journal == NULL)
+  {
+    fprintf(stderr, "Failed to open journal: %s\n", error->message);
+    g_error_free(error);
+    return -1;
+  }
+
+  user = inf_user_table_lookup_user_by_id(user_table, 1);
+  rand = g_rand_new_with_seed(n_edits);
+
+  start = g_get_monotonic_time();
+  for(i = 0; i < n_edits; ++i)
+    inf_test_text_journal_edit(buffer, user, rand);
+  start = g_get_monotonic_time() - start;
+
+  /* Let compactions finish that have been started while editing */
+  if(compact_size > 0)
+  {
+    inf_io_add_timeout(
+      io,
+      500,
+      (InfIoTimeoutFunc)inf_standalone_io_loop_quit,
+      io,
+      NULL
+    );
+
+    inf_standalone_io_loop(INF_STANDALONE_IO(io));
+  }
+
+  g_rand_free(rand);
+  inf_text_filesystem_journal_close(journal);
+  return start;
+}
+
+/* Creates an incomplete snapshot, as left behind by a compaction that was
+ * interrupted. Returns the name of the file. */
+static gchar*
+inf_test_text_journal_leave_compact(InfdFilesystemStorage* storage)
+{
+  gchar* full_name;
+  GError* error;
+
+  error = NULL;
+  full_name = infd_filesystem_storage_get_path(
+    storage,
+    "InfText.compact",
+    INF_TEST_TEXT_JOURNAL_PATH,
+    &error
+  );
+
+  if(full_name == NULL ||
+     !g_file_set_contents(full_name, "<inf-text-session", -1, &error))
+  {
+    fprintf(stderr, "Failed to create snapshot: %s\n", error->message);
+    g_error_free(error);
+    g_free(full_name);
+    return NULL;
+  }
+
+  return full_name;
+}
+
+/* Reads the session back and compares it to buffer */
+static InfTextBuffer*
+inf_test_text_journal_recover(InfdFilesystemStorage* storage,
+                              InfUserTable* user_table,
+                              InfTextBuffer* buffer)
+{
+  InfTextBuffer* recovered;
+  InfTextChunk* expected_chunk;
+  InfTextChunk* recovered_chunk;
+  gchar* expected;
+  gchar* actual;
+  gsize expected_len;
+  gsize actual_len;
+  GError* error;
+
+  recovered = INF_TEXT_BUFFER(inf_text_default_buffer_new("UTF-8"));
+
+  error = NULL;
+  if(!inf_text_filesystem_format_read(storage, INF_TEST_TEXT_JOURNAL_PATH,
+                                      user_table, recovered, &error))
+  {
+    fprintf(stderr, "Failed to read session: %s\n", error->message);
+    g_error_free(error);
+    g_object_unref(recovered);
+    return NULL;
+  }
+
+  expected_chunk = inf_text_buffer_get_slice(
+    buffer,
+    0,
+    inf_text_buffer_get_length(buffer)
+  );
+
+  recovered_chunk = inf_text_buffer_get_slice(
+    recovered,
+    0,
+    inf_text_buffer_get_length(recovered)
+  );
+
+  expected = inf_text_chunk_get_text(expected_chunk, &expected_len);
+  actual = inf_text_chunk_get_text(recovered_chunk, &actual_len);
+
+  if(expected_len != actual_len ||
+     memcmp(expected, actual, expected_len) != 0)
+  {
+    fprintf(stderr, "Recovered text differs from the edited text\n");
+    g_object_unref(recovered);
+    recovered = NULL;
+  }
+
+  g_free(expected);
+  g_free(actual);
+  inf_text_chunk_free(expected_chunk);
+  inf_text_chunk_free(recovered_chunk);
+  return recovered;
+}
+
+int
+main(int argc, char* argv[])
+{
+  InfStandaloneIo* io;
+  InfdFilesystemStorage* storage;
+  InfAdoptedStateVector* vector;
+  InfTextUser* user;
+  InfUserTable* user_tables[3];
+  InfTextBuffer* buffers[3];
+  GError* error;
+  gchar* root_directory;
+  gchar* compact;
+  guint n_edits;
+  gint64 time;
+  int result;
+  guint i;
+
+  n_edits = (argc > 1) ? atoi(argv[1]) : 10000;
+
+  error = NULL;
+  if(inf_init(&error) == FALSE)
+  {
+    fprintf(stderr, "%s\n", error->message);
+    g_error_free(error);
+    return 1;
+  }
+
+  root_directory = g_dir_make_tmp("inf-test-text-journal-XXXXXX", &error);
+  if(root_directory == NULL)
+  {
+    fprintf(stderr, "%s\n", error->message);
+    g_error_free(error);
+    return 1;
+  }
+
+  io = inf_standalone_io_new();
+  storage = infd_filesystem_storage_new(root_directory);
+
+  for(i = 0; i < 3; ++i)
+  {
+    user_tables[i] = inf_user_table_new();
+    buffers[i] = NULL;
+  }
+
+  vector = inf_adopted_state_vector_new();
+  user = inf_text_user_new(1, "journal", vector, 0.5);
+  inf_adopted_state_vector_free(vector);
+
+  inf_user_table_add_user(user_tables[0], INF_USER(user));
+
+  buffers[0] = INF_TEXT_BUFFER(inf_text_default_buffer_new("UTF-8"));
+  inf_text_buffer_insert_text(buffers[0], 0, "journal", 7, 7, INF_USER(user));
+  g_object_unref(user);
+
+  result = 1;
+  if(!inf_text_filesystem_format_write(storage, INF_TEST_TEXT_JOURNAL_PATH,
+                                       user_tables[0], buffers[0], &error))
+  {
+    fprintf(stderr, "Failed to write session: %s\n", error->message);
+    g_error_free(error);
+  }
+  else
+  {
+    /* Recover edits from the journal alone */
+    time = inf_test_text_journal_record(
+      storage,
+      INF_IO(io),
+      user_tables[0],
+      buffers[0],
+      0,
+      n_edits
+    );
+
+    if(time >= 0)
+    {
+      printf(
+        "%u edits recorded in %.3f ms (%.3f us per edit)\n",
+        n_edits,
+        time / 1000.0,
+        (double)time / n_edits
+      );
+
+      buffers[1] = inf_test_text_journal_recover(
+        storage,
+        user_tables[1],
+        buffers[0]
+      );
+    }
+
+    /* Continue editing the recovered session with compaction, and recover
+     * again from the compacted snapshot and journal. */
+    if(buffers[1] != NULL)
+    {
+      time = inf_test_text_journal_record(
+        storage,
+        INF_IO(io),
+        user_tables[1],
+        buffers[1],
+        16 * 1024,
+        n_edits
+      );
+
+      if(time >= 0)
+      {
+        printf(
+          "%u edits recorded with compaction in %.3f ms "
+          "(%.3f us per edit)\n",
+          n_edits,
+          time / 1000.0,
+          (double)time / n_edits
+        );
+
+        compact = inf_test_text_journal_leave_compact(storage);
+        if(compact != NULL)
+        {
+          buffers[2] = inf_test_text_journal_recover(
+            storage,
+            user_tables[2],
+            buffers[1]
+          );
+
+          if(g_file_test(compact, G_FILE_TEST_EXISTS))
+            fprintf(stderr, "Snapshot of interrupted compaction was kept\n");
+          else if(buffers[2] != NULL)
+            result = 0;
+
+          g_free(compact);
+        }
+      }
+    }
+  }
+
+  for(i = 0; i < 3; ++i)
+  {
+    if(buffers[i] != NULL)
+      g_object_unref(buffers[i]);
+    g_object_unref(user_tables[i]);
+  }
+
+  g_object_unref(storage);
+  g_object_unref(io);
+
+  if(!inf_file_util_delete(root_directory, &error))
+  {
+    fprintf(stderr, "%s\n", error->message);
+    g_error_free(error);
+  }
+
+  g_free(root_directory);
+  inf_deinit();
+
+  return result;
+}
+
+/* vim:set et sw=2 ts=2: */
@@ -0,0 +1,326 @@
+/* libinfinity - a GObject-based infinote implementation
+ * Copyright (C) 2007-2015 Armin Burgmeier <armin@arbur.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+/* Sends messages through an InfThreadConnection to a simulated connection
+ * running in a worker thread, which echoes them back. Verifies that all
+ * messages are reported as sent and come back in order, and that closing
+ * the InfThreadConnection closes the wrapped connection in the worker
+ * thread. It reports the time until all messages have come back.
+ * Usage: inf-test-thread-connection [n-messages]
+ */
+
+#include <libinfinity/common/inf-thread-connection.h>
+#include <libinfinity/common/inf-simulated-connection.h>
+#include <libinfinity/common/inf-standalone-io.h>
+#include <libinfinity/common/inf-xml-connection.h>
+#include <libinfinity/common/inf-xml-util.h>
+#include <libinfinity/common/inf-init.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct _InfTestThreadConnection InfTestThreadConnection;
+struct _InfTestThreadConnection {
+  InfStandaloneIo* io;
+  InfStandaloneIo* worker_io;
+
+  /* Only used in the worker thread */
+  InfSimulatedConnection* local;
+  InfSimulatedConnection* remote;
+
+  InfThreadConnection* connection;
+  guint n_messages;
+  guint n_sent;
+  guint n_received;
+  gint64 start;
+  gboolean failed;
+};
+
+static void
+inf_test_thread_connection_echo_cb(InfXmlConnection* connection,
+                                   xmlNodePtr xml,
+                                   gpointer user_data)
+{
+  inf_xml_connection_send(connection, xmlCopyNode(xml, 1));
+}
+
+static void
+inf_test_thread_connection_sent_cb(InfXmlConnection* connection,
+                                   xmlNodePtr xml,
+                                   gpointer user_data)
+{
+  InfTestThreadConnection* test;
+  test = (InfTestThreadConnection*)user_data;
+
+  ++test->n_sent;
+}
+
+static void
+inf_test_thread_connection_received_cb(InfXmlConnection* connection,
+                                       xmlNodePtr xml,
+                                       gpointer user_data)
+{
+  InfTestThreadConnection* test;
+  guint seq;
+
+  test = (InfTestThreadConnection*)user_data;
+
+  if(!inf_xml_util_get_attribute_uint_required(xml, "seq", &seq, NULL) ||
+     seq != test->n_received)
+  {
+    fprintf(stderr, "Received unexpected message\n");
+    test->failed = TRUE;
+    inf_xml_connection_close(connection);
+    return;
+  }
+
+  ++test->n_received;
+  if(test->n_received == test->n_messages)
+  {
+    printf(
+      "%u messages echoed in %.3f ms\n",
+      test->n_messages,
+      (g_get_monotonic_time() - test->start) / 1000.0
+    );
+
+    inf_xml_connection_close(connection);
+  }
+}
+
+static void
+inf_test_thread_connection_notify_status_cb(GObject* object,
+                                            GParamSpec* pspec,
+                                            gpointer user_data)
+{
+  InfTestThreadConnection* test;
+  InfXmlConnectionStatus status;
+
+  test = (InfTestThreadConnection*)user_data;
+  g_object_get(object, "status", &status, NULL);
+
+  if(status == INF_XML_CONNECTION_CLOSED)
+    inf_standalone_io_loop_quit(test->io);
+}
+
+/* Runs in the main thread */
+static void
+inf_test_thread_connection_start_func(gpointer user_data)
+{
+  InfTestThreadConnection* test;
+  InfXmlConnectionStatus status;
+  xmlNodePtr xml;
+  guint i;
+
+  test = (InfTestThreadConnection*)user_data;
+
+  g_object_get(G_OBJECT(test->connection), "status", &status, NULL);
+  if(status != INF_XML_CONNECTION_OPEN)
+  {
+    fprintf(stderr, "Connection is not open in the main thread\n");
+    test->failed = TRUE;
+    inf_standalone_io_loop_quit(test->io);
+    return;
+  }
+
+  g_signal_connect(
+    G_OBJECT(test->connection),
+    "sent",
+    G_CALLBACK(inf_test_thread_connection_sent_cb),
+    test
+  );
+
+  g_signal_connect(
+    G_OBJECT(test->connection),
+    "received",
+    G_CALLBACK(inf_test_thread_connection_received_cb),
+    test
+  );
+
+  g_signal_connect(
+    G_OBJECT(test->connection),
+    "notify::status",
+    G_CALLBACK(inf_test_thread_connection_notify_status_cb),
+    test
+  );
+
+  test->start = g_get_monotonic_time();
+  for(i = 0; i < test->n_messages; ++i)
+  {
+    xml = xmlNewNode(NULL, (const xmlChar*)"request");
+    inf_xml_util_set_attribute_uint(xml, "seq", i);
+    inf_xml_connection_send(INF_XML_CONNECTION(test->connection), xml);
+  }
+}
+
+/* Runs in the worker thread */
+static void
+inf_test_thread_connection_setup_func(gpointer user_data)
+{
+  InfTestThreadConnection* test;
+  test = (InfTestThreadConnection*)user_data;
+
+  test->local = inf_simulated_connection_new();
+  test->remote = inf_simulated_connection_new();
+  inf_simulated_connection_connect(test->local, test->remote);
+
+  g_signal_connect(
+    G_OBJECT(test->remote),
+    "received",
+    G_CALLBACK(inf_test_thread_connection_echo_cb),
+    test
+  );
+
+  test->connection = inf_thread_connection_new(
+    INF_IO(test->io),
+    INF_IO(test->worker_io),
+    INF_XML_CONNECTION(test->local)
+  );
+
+  inf_io_add_dispatch(
+    INF_IO(test->io),
+    inf_test_thread_connection_start_func,
+    test,
+    NULL
+  );
+}
+
+/* Runs in the worker thread, after the InfThreadConnection is gone */
+static void
+inf_test_thread_connection_stop_func(gpointer user_data)
+{
+  InfTestThreadConnection* test;
+  InfXmlConnectionStatus status;
+
+  test = (InfTestThreadConnection*)user_data;
+
+  g_object_get(G_OBJECT(test->local), "status", &status, NULL);
+  if(status != INF_XML_CONNECTION_CLOSED)
+  {
+    fprintf(stderr, "Wrapped connection has not been closed\n");
+    test->failed = TRUE;
+  }
+
+  g_object_unref(test->local);
+  g_object_unref(test->remote);
+  inf_standalone_io_loop_quit(test->worker_io);
+}
+
+static gpointer
+inf_test_thread_connection_thread_func(gpointer data)
+{
+  inf_standalone_io_loop(INF_STANDALONE_IO(data));
+  return NULL;
+}
+
+int
+main(int argc, char* argv[])
+{
+  InfTestThreadConnection test;
+  GThread* thread;
+  GError* error;
+
+  test.n_messages = (argc > 1) ? atoi(argv[1]) : 10000;
+  if(test.n_messages == 0)
+  {
+    fprintf(stderr, "Need at least one message\n");
+    return 1;
+  }
+
+  error = NULL;
+  if(inf_init(&error) == FALSE)
+  {
+    fprintf(stderr, "%s\n", error->message);
+    g_error_free(error);
+    return 1;
+  }
+
+  test.io = inf_standalone_io_new();
+  test.worker_io = inf_standalone_io_new();
+  test.local = NULL;
+  test.remote = NULL;
+  test.connection = NULL;
+  test.n_sent = 0;
+  test.n_received = 0;
+  test.start = 0;
+  test.failed = FALSE;
+
+  inf_io_add_dispatch(
+    INF_IO(test.worker_io),
+    inf_test_thread_connection_setup_func,
+    &test,
+    NULL
+  );
+
+  thread = g_thread_new(
+    "inf-test-thread-connection",
+    inf_test_thread_connection_thread_func,
+    test.worker_io
+  );
+
+  inf_standalone_io_loop(test.io);
+
+  if(test.n_sent != test.n_messages)
+  {
+    fprintf(
+      stderr,
+      "%u of %u messages reported as sent\n",
+      test.n_sent,
+      test.n_messages
+    );
+
+    test.failed = TRUE;
+  }
+
+  if(test.n_received != test.n_messages)
+  {
+    fprintf(
+      stderr,
+      "%u of %u messages received\n",
+      test.n_received,
+      test.n_messages
+    );
+
+    test.failed = TRUE;
+  }
+
+  /* Releases the wrapped connection in the worker thread, before the stop
+   * function runs there. */
+  g_object_unref(test.connection);
+
+  inf_io_add_dispatch(
+    INF_IO(test.worker_io),
+    inf_test_thread_connection_stop_func,
+    &test,
+    NULL
+  );
+
+  g_thread_join(thread);
+
+  g_object_unref(test.worker_io);
+  g_object_unref(test.io);
+  inf_deinit();
+
+  if(test.failed)
+    return 1;
+
+  printf("Messages arrived in order\n");
+  return 0;
+}
+
+/* vim:set et sw=2 ts=2: */
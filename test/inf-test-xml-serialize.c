@@ -0,0 +1,312 @@
+/* libinfinity - a GObject-based infinote implementation
+ * Copyright (C) 2007-2015 Armin Burgmeier <armin@arbur.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+/* Compares inf_xml_util_serialize_node() with xmlNodeDump() on the messages
+ * of a traffic log, as written by the infinoted traffic-logging plugin and
+ * read by inf-test-traffic-replay. It first checks that both produce
+ * equivalent XML for every message, and then measures how many bytes per
+ * second each of them produces.
+ * Usage: inf-test-xml-serialize <traffic-log> [rounds]
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <libinfinity/common/inf-xml-util.h>
+
+#include <libxml/parser.h>
+#include <libxml/tree.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+static xmlNodePtr
+inf_test_xml_serialize_parse(const gchar* text,
+                             gsize len)
+{
+  xmlDocPtr doc;
+  xmlNodePtr xml;
+
+  doc = xmlReadMemory(
+    text,
+    len,
+    NULL,
+    "UTF-8",
+    XML_PARSE_NOWARNING | XML_PARSE_NOERROR
+  );
+
+  if(doc == NULL)
+    return NULL;
+
+  xml = xmlCopyNode(xmlDocGetRootElement(doc), 1);
+  xmlFreeDoc(doc);
+  return xml;
+}
+
+/* Reads all incoming and outgoing messages from the traffic log. */
+static GPtrArray*
+inf_test_xml_serialize_load(const gchar* filename)
+{
+  FILE* file;
+  GPtrArray* messages;
+  GString* str;
+  xmlNodePtr xml;
+  char* line;
+  size_t n;
+  ssize_t len;
+  char* pos;
+
+  file = fopen(filename, "r");
+  if(file == NULL)
+  {
+    fprintf(stderr, "Failed to open %s: %s\n", filename, strerror(errno));
+    return NULL;
+  }
+
+  messages = g_ptr_array_new_with_free_func((GDestroyNotify)xmlFreeNode);
+  str = g_string_new(NULL);
+  line = NULL;
+  n = 0;
+
+  while((len = getline(&line, &n, file)) >= 0)
+  {
+    if(len > 0 && line[len - 1] == '\n')
+      line[--len] = '\0';
+
+    if(str->len > 0)
+    {
+      /* Continuation of a message containing a newline character */
+      g_string_append_c(str, '\n');
+      g_string_append_len(str, line, len);
+    }
+    else
+    {
+      /* [timestamp] <<< message, or [timestamp] >>> message */
+      pos = strstr(line, "] ");
+      if(line[0] != '[' || pos == NULL || (pos[2] != '<' && pos[2] != '>'))
+        continue;
+      if(strlen(pos) < 6)
+        continue;
+
+      g_string_append(str, pos + 6);
+    }
+
+    xml = inf_test_xml_serialize_parse(str->str, str->len);
+    if(xml != NULL)
+    {
+      g_ptr_array_add(messages, xml);
+      g_string_truncate(str, 0);
+    }
+  }
+
+  free(line);
+  g_string_free(str, TRUE);
+  fclose(file);
+  return messages;
+}
+
+static gchar*
+inf_test_xml_serialize_dump(xmlDocPtr doc,
+                            xmlBufferPtr buf,
+                            xmlNodePtr xml)
+{
+  gchar* result;
+
+  /* This is what InfXmppConnection used to do for every message */
+  xmlDocSetRootElement(doc, xml);
+  xmlNodeDump(buf, doc, xml, 0, 0);
+  xmlUnlinkNode(xml);
+  xmlSetListDoc(xml, NULL);
+
+  result = g_strdup((const gchar*)xmlBufferContent(buf));
+  xmlBufferEmpty(buf);
+  return result;
+}
+
+static gboolean
+inf_test_xml_serialize_verify(GPtrArray* messages,
+                              xmlDocPtr doc,
+                              xmlBufferPtr buf)
+{
+  GString* str;
+  xmlNodePtr reparsed;
+  gchar* expected;
+  gchar* actual;
+  gboolean result;
+  guint i;
+
+  str = g_string_new(NULL);
+  result = TRUE;
+
+  for(i = 0; i < messages->len && result; ++i)
+  {
+    g_string_truncate(str, 0);
+    inf_xml_util_serialize_node(g_ptr_array_index(messages, i), str);
+
+    reparsed = inf_test_xml_serialize_parse(str->str, str->len);
+    if(reparsed == NULL)
+    {
+      fprintf(stderr, "Message %u is not well-formed: %s\n", i, str->str);
+      result = FALSE;
+    }
+    else
+    {
+      expected = inf_test_xml_serialize_dump(
+        doc,
+        buf,
+        g_ptr_array_index(messages, i)
+      );
+
+      actual = inf_test_xml_serialize_dump(doc, buf, reparsed);
+      if(strcmp(expected, actual) != 0)
+      {
+        fprintf(
+          stderr,
+          "Message %u differs:\n  expected: %s\n  actual: %s\n",
+          i,
+          expected,
+          actual
+        );
+
+        result = FALSE;
+      }
+
+      g_free(expected);
+      g_free(actual);
+      xmlFreeNode(reparsed);
+    }
+  }
+
+  g_string_free(str, TRUE);
+  return result;
+}
+
+static void
+inf_test_xml_serialize_report(const gchar* name,
+                              guint64 bytes,
+                              gint64 time)
+{
+  printf(
+    "%-24s %" G_GUINT64_FORMAT " bytes in %.3f ms (%.1f MB/s)\n",
+    name,
+    bytes,
+    time / 1000.0,
+    bytes / (double)time
+  );
+}
+
+int
+main(int argc, char* argv[])
+{
+  GPtrArray* messages;
+  xmlDocPtr doc;
+  xmlBufferPtr buf;
+  GString* str;
+  xmlNodePtr xml;
+  guint rounds;
+  guint round;
+  guint i;
+  guint64 bytes;
+  gint64 start;
+  gint64 libxml_time;
+  gint64 serialize_time;
+
+  if(argc < 2)
+  {
+    fprintf(stderr, "Usage: %s <traffic-log> [rounds]\n", argv[0]);
+    return 1;
+  }
+
+  rounds = (argc > 2) ? atoi(argv[2]) : 100;
+
+  messages = inf_test_xml_serialize_load(argv[1]);
+  if(messages == NULL)
+    return 1;
+
+  if(messages->len == 0)
+  {
+    fprintf(stderr, "No messages in %s\n", argv[1]);
+    g_ptr_array_free(messages, TRUE);
+    return 1;
+  }
+
+  doc = xmlNewDoc((const xmlChar*)"1.0");
+  buf = xmlBufferCreate();
+  str = g_string_sized_new(4096);
+
+  if(!inf_test_xml_serialize_verify(messages, doc, buf))
+  {
+    g_string_free(str, TRUE);
+    xmlBufferFree(buf);
+    xmlFreeDoc(doc);
+    g_ptr_array_free(messages, TRUE);
+    return 1;
+  }
+
+  printf("%u messages, %u rounds\n", messages->len, rounds);
+
+  bytes = 0;
+  start = g_get_monotonic_time();
+  for(round = 0; round < rounds; ++round)
+  {
+    for(i = 0; i < messages->len; ++i)
+    {
+      xml = g_ptr_array_index(messages, i);
+      xmlDocSetRootElement(doc, xml);
+      xmlNodeDump(buf, doc, xml, 0, 0);
+      xmlUnlinkNode(xml);
+      xmlSetListDoc(xml, NULL);
+
+      bytes += xmlBufferLength(buf);
+      xmlBufferEmpty(buf);
+    }
+  }
+  libxml_time = g_get_monotonic_time() - start;
+  inf_test_xml_serialize_report("xmlNodeDump:", bytes, libxml_time);
+
+  bytes = 0;
+  start = g_get_monotonic_time();
+  for(round = 0; round < rounds; ++round)
+  {
+    for(i = 0; i < messages->len; ++i)
+    {
+      inf_xml_util_serialize_node(g_ptr_array_index(messages, i), str);
+      bytes += str->len;
+      g_string_truncate(str, 0);
+    }
+  }
+  serialize_time = g_get_monotonic_time() - start;
+  inf_test_xml_serialize_report(
+    "inf_xml_util_serialize:",
+    bytes,
+    serialize_time
+  );
+
+  if(serialize_time > 0)
+    printf("Speedup: %.2fx\n", libxml_time / (double)serialize_time);
+
+  g_string_free(str, TRUE);
+  xmlBufferFree(buf);
+  xmlFreeDoc(doc);
+  g_ptr_array_free(messages, TRUE);
+  return 0;
+}
+
+/* vim:set et sw=2 ts=2: */
@@ -0,0 +1,650 @@
+/* libinfinity - a GObject-based infinote implementation
+ * Copyright (C) 2007-2015 Armin Burgmeier <armin@arbur.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+/* Sends messages with nested elements, attributes, namespaces, text and more
+ * distinct names than fit into the name table over an unencrypted XMPP
+ * connection on the loopback interface, and verifies that the server
+ * receives exactly the same trees, once in the binary encoding and once in
+ * XML. It then writes truncated, malformed and oversized binary records
+ * directly to the TCP connection, and verifies that the server closes the
+ * connection with an error instead of delivering a message, and that a
+ * record which arrives in two parts is decoded correctly. */
+
+#include <libinfinity/server/infd-xmpp-server.h>
+#include <libinfinity/server/infd-xml-server.h>
+#include <libinfinity/common/inf-standalone-io.h>
+#include <libinfinity/common/inf-xml-connection.h>
+#include <libinfinity/common/inf-xmpp-connection.h>
+#include <libinfinity/common/inf-xml-util.h>
+#include <libinfinity/common/inf-init.h>
+#include <libinfinity/inf-signals.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#define INF_TEST_XMPP_BINARY_PORT 6527
+
+/* More than InfXmppConnection keeps in its name table, so that some names
+ * are sent as strings every time they are used */
+#define INF_TEST_XMPP_BINARY_N_NAMES 1100
+
+/* Less than the maximum nesting depth InfXmppConnection accepts */
+#define INF_TEST_XMPP_BINARY_DEPTH 100
+
+typedef struct _InfTestXmppBinaryInput InfTestXmppBinaryInput;
+struct _InfTestXmppBinaryInput {
+  const gchar* description;
+
+  /* Written to the TCP connection once it is open, and after a short delay,
+   * respectively. */
+  const gchar* first;
+  gsize first_len;
+  const gchar* second;
+  gsize second_len;
+
+  /* Serialization of the message the server should receive, if any */
+  const gchar* expected;
+  gboolean error;
+};
+
+static const InfTestXmppBinaryInput INF_TEST_XMPP_BINARY_INPUTS[] = {
+  { "record split in two parts",
+    "\x05\x00\x01" "a", 4, "\x00\x00", 2, "<a/>", FALSE },
+  { "truncated record",
+    "\x05\x00\x01" "a", 4, NULL, 0, NULL, FALSE },
+  { "unknown name index",
+    "\x03\x05\x00\x00", 4, NULL, 0, NULL, TRUE },
+  { "empty name",
+    "\x03\x00\x00\x00", 4, NULL, 0, NULL, TRUE },
+  { "unknown child kind",
+    "\x05\x00\x01" "a" "\x00\x07", 6, NULL, 0, NULL, TRUE },
+  { "unknown attribute value kind",
+    "\x09\x00\x01" "a" "\x01\x00\x01" "b" "\x07\x00", 10,
+    NULL, 0, NULL, TRUE },
+  { "text exceeding the record",
+    "\x07\x00\x01" "a" "\x00\x02\x10" "x", 8, NULL, 0, NULL, TRUE },
+  { "trailing data in record",
+    "\x06\x00\x01" "a" "\x00\x00\x00", 7, NULL, 0, NULL, TRUE },
+  { "invalid record length",
+    "\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff", 11, NULL, 0, NULL, TRUE },
+  { "oversized record",
+    "\x80\x80\x80\x08", 4, NULL, 0, NULL, TRUE }
+};
+
+typedef struct _InfTestXmppBinary InfTestXmppBinary;
+struct _InfTestXmppBinary {
+  InfStandaloneIo* io;
+  InfdXmppServer* server;
+  InfTcpConnection* tcp;
+  InfXmppConnection* client;
+  InfXmlConnection* server_conn;
+
+  /* NULL when sending messages through the client */
+  const InfTestXmppBinaryInput* input;
+  gboolean binary;
+
+  InfIoTimeout* timeout;
+  InfIoTimeout* second_timeout;
+  InfIoTimeout* close_timeout;
+
+  GQueue expected;
+  guint n_messages;
+  guint n_errors;
+  gboolean failed;
+};
+
+static void
+inf_test_xmpp_binary_add_expected(InfTestXmppBinary* test,
+                                  xmlNodePtr xml)
+{
+  GString* str;
+
+  str = g_string_new(NULL);
+  inf_xml_util_serialize_node(xml, str);
+  g_queue_push_tail(&test->expected, g_string_free(str, FALSE));
+}
+
+/* Sends xml through the client, and remembers what the server should
+ * receive */
+static void
+inf_test_xmpp_binary_send(InfTestXmppBinary* test,
+                          xmlNodePtr xml)
+{
+  inf_test_xmpp_binary_add_expected(test, xml);
+  inf_xml_connection_send(INF_XML_CONNECTION(test->client), xml);
+  ++test->n_messages;
+}
+
+static void
+inf_test_xmpp_binary_send_messages(InfTestXmppBinary* test)
+{
+  xmlNodePtr xml;
+  xmlNodePtr child;
+  xmlNodePtr parent;
+  xmlNsPtr ns;
+  gchar name[32];
+  guint i;
+
+  /* Nested elements, attribute values that are sent as numbers or state
+   * vectors, and ones that look similar but have to stay strings */
+  xml = xmlNewNode(NULL, (const xmlChar*)"request");
+  inf_xml_util_set_attribute_uint(xml, "user", 1);
+  inf_xml_util_set_attribute(xml, "time", "1:2;3:40");
+  inf_xml_util_set_attribute(xml, "zero", "0");
+  inf_xml_util_set_attribute(xml, "max", "18446744073709551615");
+  inf_xml_util_set_attribute(xml, "overflow", "18446744073709551616");
+  inf_xml_util_set_attribute(xml, "leading", "007");
+  inf_xml_util_set_attribute(xml, "vector", "1:2;");
+  inf_xml_util_set_attribute(xml, "empty", "");
+  inf_xml_util_set_attribute(xml, "escaped", "<\"&'>");
+  child = xmlNewChild(xml, NULL, (const xmlChar*)"insert-caret", NULL);
+  inf_xml_util_set_attribute_uint(child, "pos", 5);
+  child = xmlNewChild(child, NULL, (const xmlChar*)"segment", NULL);
+  inf_xml_util_set_attribute_uint(child, "author", 3);
+  inf_xml_util_add_child_text(child, "a < b && \"c\" ]]> d", 18);
+  xmlNewChild(xml, NULL, (const xmlChar*)"empty", NULL);
+  inf_test_xmpp_binary_send(test, xml);
+
+  /* Mixed content with non-ASCII text */
+  xml = xmlNewNode(NULL, (const xmlChar*)"sync-segment");
+  xmlAddChild(xml, xmlNewText((const xmlChar*)"Gr\xc3\xbc\xc3\x9f" "e "));
+  xmlNewChild(xml, NULL, (const xmlChar*)"br", NULL);
+  xmlAddChild(xml, xmlNewText((const xmlChar*)"\xe2\x82\xac\ttab\nline"));
+  inf_test_xmpp_binary_send(test, xml);
+
+  /* Default and prefixed namespaces on elements and attributes */
+  xml = xmlNewNode(NULL, (const xmlChar*)"group");
+  xmlNewNs(xml, (const xmlChar*)"urn:inf-test:default", NULL);
+  ns = xmlNewNs(
+    xml,
+    (const xmlChar*)"urn:inf-test:prefixed",
+    (const xmlChar*)"p"
+  );
+
+  child = xmlNewChild(xml, ns, (const xmlChar*)"item", NULL);
+  xmlNewNsProp(child, ns, (const xmlChar*)"id", (const xmlChar*)"17");
+  xmlNewProp(child, (const xmlChar*)"name", (const xmlChar*)"plain");
+  inf_xml_util_add_child_text(child, "text", 4);
+  inf_test_xmpp_binary_send(test, xml);
+
+  /* Deeply nested elements */
+  xml = xmlNewNode(NULL, (const xmlChar*)"level");
+  parent = xml;
+  for(i = 0; i < INF_TEST_XMPP_BINARY_DEPTH; ++i)
+  {
+    parent = xmlNewChild(parent, NULL, (const xmlChar*)"level", NULL);
+    inf_xml_util_set_attribute_uint(parent, "depth", i);
+  }
+  inf_test_xmpp_binary_send(test, xml);
+
+  /* Fill the name table, and then use both names from within and from
+   * beyond the table again */
+  for(i = 0; i < INF_TEST_XMPP_BINARY_N_NAMES; ++i)
+  {
+    g_snprintf(name, sizeof(name), "element-%u", i);
+    xml = xmlNewNode(NULL, (const xmlChar*)name);
+    g_snprintf(name, sizeof(name), "attribute-%u", i);
+    inf_xml_util_set_attribute_uint(xml, name, i);
+    inf_test_xmpp_binary_send(test, xml);
+  }
+
+  for(i = 0; i < INF_TEST_XMPP_BINARY_N_NAMES; i += 7)
+  {
+    g_snprintf(name, sizeof(name), "element-%u", i);
+    xml = xmlNewNode(NULL, (const xmlChar*)name);
+    child = xmlNewChild(xml, NULL, (const xmlChar*)"request", NULL);
+    g_snprintf(name, sizeof(name), "attribute-%u", i);
+    inf_xml_util_set_attribute(child, name, "value");
+    inf_test_xmpp_binary_send(test, xml);
+  }
+}
+
+static void
+inf_test_xmpp_binary_send_second_func(gpointer user_data)
+{
+  InfTestXmppBinary* test;
+  test = (InfTestXmppBinary*)user_data;
+  test->second_timeout = NULL;
+
+  inf_tcp_connection_send(
+    test->tcp,
+    test->input->second,
+    test->input->second_len
+  );
+}
+
+static void
+inf_test_xmpp_binary_close_func(gpointer user_data)
+{
+  InfTestXmppBinary* test;
+  InfTcpConnectionStatus status;
+
+  test = (InfTestXmppBinary*)user_data;
+  test->close_timeout = NULL;
+
+  /* The server might have closed the connection already */
+  g_object_get(G_OBJECT(test->tcp), "status", &status, NULL);
+  if(status == INF_TCP_CONNECTION_CONNECTED)
+    inf_tcp_connection_close(test->tcp);
+}
+
+static void
+inf_test_xmpp_binary_timeout_func(gpointer user_data)
+{
+  InfTestXmppBinary* test;
+  test = (InfTestXmppBinary*)user_data;
+  test->timeout = NULL;
+
+  fprintf(stderr, "Timeout\n");
+  test->failed = TRUE;
+  inf_standalone_io_loop_quit(test->io);
+}
+
+static void
+inf_test_xmpp_binary_client_notify_status_cb(GObject* object,
+                                             GParamSpec* pspec,
+                                             gpointer user_data)
+{
+  InfTestXmppBinary* test;
+  InfXmlConnectionStatus status;
+
+  test = (InfTestXmppBinary*)user_data;
+  g_object_get(object, "status", &status, NULL);
+
+  if(status != INF_XML_CONNECTION_OPEN)
+    return;
+
+  if(test->input == NULL)
+  {
+    inf_test_xmpp_binary_send_messages(test);
+    return;
+  }
+
+  /* The client has switched its outgoing data to the binary encoding at
+   * this point, and so has the server for its incoming data, so we can write
+   * binary records directly to the TCP connection. */
+  if(test->input->expected != NULL)
+  {
+    g_queue_push_tail(&test->expected, g_strdup(test->input->expected));
+    ++test->n_messages;
+  }
+
+  inf_tcp_connection_send(
+    test->tcp,
+    test->input->first,
+    test->input->first_len
+  );
+
+  if(test->input->second != NULL)
+  {
+    test->second_timeout = inf_io_add_timeout(
+      INF_IO(test->io),
+      50,
+      inf_test_xmpp_binary_send_second_func,
+      test,
+      NULL
+    );
+  }
+
+  test->close_timeout = inf_io_add_timeout(
+    INF_IO(test->io),
+    100,
+    inf_test_xmpp_binary_close_func,
+    test,
+    NULL
+  );
+}
+
+static void
+inf_test_xmpp_binary_received_cb(InfXmlConnection* connection,
+                                 xmlNodePtr xml,
+                                 gpointer user_data)
+{
+  InfTestXmppBinary* test;
+  GString* str;
+  gchar* expected;
+
+  test = (InfTestXmppBinary*)user_data;
+  expected = g_queue_pop_head(&test->expected);
+
+  str = g_string_new(NULL);
+  inf_xml_util_serialize_node(xml, str);
+
+  if(expected == NULL)
+  {
+    fprintf(stderr, "Unexpected message: %s\n", str->str);
+    test->failed = TRUE;
+  }
+  else if(strcmp(expected, str->str) != 0)
+  {
+    fprintf(stderr, "Sent: %s\nReceived: %s\n", expected, str->str);
+    test->failed = TRUE;
+  }
+
+  g_string_free(str, TRUE);
+  g_free(expected);
+
+  if(test->input == NULL && g_queue_is_empty(&test->expected))
+    inf_standalone_io_loop_quit(test->io);
+}
+
+static void
+inf_test_xmpp_binary_error_cb(InfXmlConnection* connection,
+                              const GError* error,
+                              gpointer user_data)
+{
+  InfTestXmppBinary* test;
+  test = (InfTestXmppBinary*)user_data;
+
+  if(test->input == NULL || !test->input->error)
+    fprintf(stderr, "Connection error: %s\n", error->message);
+
+  ++test->n_errors;
+}
+
+static void
+inf_test_xmpp_binary_server_notify_status_cb(GObject* object,
+                                             GParamSpec* pspec,
+                                             gpointer user_data)
+{
+  InfTestXmppBinary* test;
+  InfXmlConnectionStatus status;
+
+  test = (InfTestXmppBinary*)user_data;
+  g_object_get(object, "status", &status, NULL);
+
+  if(status == INF_XML_CONNECTION_CLOSED)
+    inf_standalone_io_loop_quit(test->io);
+}
+
+static void
+inf_test_xmpp_binary_new_connection_cb(InfdXmlServer* server,
+                                       InfXmlConnection* connection,
+                                       gpointer user_data)
+{
+  InfTestXmppBinary* test;
+  test = (InfTestXmppBinary*)user_data;
+
+  g_assert(test->server_conn == NULL);
+  test->server_conn = connection;
+  g_object_ref(connection);
+
+  g_signal_connect(
+    G_OBJECT(connection),
+    "received",
+    G_CALLBACK(inf_test_xmpp_binary_received_cb),
+    test
+  );
+
+  g_signal_connect(
+    G_OBJECT(connection),
+    "error",
+    G_CALLBACK(inf_test_xmpp_binary_error_cb),
+    test
+  );
+
+  g_signal_connect(
+    G_OBJECT(connection),
+    "notify::status",
+    G_CALLBACK(inf_test_xmpp_binary_server_notify_status_cb),
+    test
+  );
+}
+
+/* Connects a new client, and runs the main loop until the messages have
+ * been received or the server has closed the connection. */
+static gboolean
+inf_test_xmpp_binary_run(InfTestXmppBinary* test,
+                         const InfTestXmppBinaryInput* input,
+                         gboolean binary)
+{
+  InfIpAddress* addr;
+  GError* error;
+  gboolean result;
+
+  test->input = input;
+  test->binary = binary;
+  test->n_messages = 0;
+  test->n_errors = 0;
+  test->failed = FALSE;
+  test->second_timeout = NULL;
+  test->close_timeout = NULL;
+
+  g_object_set(G_OBJECT(test->server), "binary-encoding", binary, NULL);
+
+  addr = inf_ip_address_new_loopback4();
+  test->tcp = inf_tcp_connection_new(
+    INF_IO(test->io),
+    addr,
+    INF_TEST_XMPP_BINARY_PORT
+  );
+  inf_ip_address_free(addr);
+
+  test->client = inf_xmpp_connection_new(
+    test->tcp,
+    INF_XMPP_CONNECTION_CLIENT,
+    g_get_host_name(),
+    "localhost",
+    INF_XMPP_CONNECTION_SECURITY_ONLY_UNSECURED,
+    NULL,
+    NULL,
+    NULL
+  );
+
+  g_object_set(G_OBJECT(test->client), "binary-encoding", binary, NULL);
+
+  g_signal_connect(
+    G_OBJECT(test->client),
+    "notify::status",
+    G_CALLBACK(inf_test_xmpp_binary_client_notify_status_cb),
+    test
+  );
+
+  error = NULL;
+  if(inf_tcp_connection_open(test->tcp, &error) == FALSE)
+  {
+    fprintf(stderr, "%s\n", error->message);
+    g_error_free(error);
+    test->failed = TRUE;
+  }
+  else
+  {
+    test->timeout = inf_io_add_timeout(
+      INF_IO(test->io),
+      10000,
+      inf_test_xmpp_binary_timeout_func,
+      test,
+      NULL
+    );
+
+    inf_standalone_io_loop(test->io);
+
+    if(test->timeout != NULL)
+      inf_io_remove_timeout(INF_IO(test->io), test->timeout);
+    if(test->second_timeout != NULL)
+      inf_io_remove_timeout(INF_IO(test->io), test->second_timeout);
+    if(test->close_timeout != NULL)
+      inf_io_remove_timeout(INF_IO(test->io), test->close_timeout);
+  }
+
+  if(!g_queue_is_empty(&test->expected))
+  {
+    fprintf(
+      stderr,
+      "Only %u of %u messages received\n",
+      test->n_messages - g_queue_get_length(&test->expected),
+      test->n_messages
+    );
+
+    test->failed = TRUE;
+    g_queue_foreach(&test->expected, (GFunc)g_free, NULL);
+    g_queue_clear(&test->expected);
+  }
+
+  if(input == NULL)
+  {
+    if(inf_xmpp_connection_get_binary_encoding_active(test->client) != binary)
+    {
+      fprintf(stderr, "Binary encoding not negotiated as requested\n");
+      test->failed = TRUE;
+    }
+
+    if(test->n_errors > 0)
+      test->failed = TRUE;
+  }
+  else if(input->error && test->n_errors == 0)
+  {
+    fprintf(stderr, "No error reported\n");
+    test->failed = TRUE;
+  }
+  else if(!input->error && test->n_errors > 0)
+  {
+    test->failed = TRUE;
+  }
+
+  result = !test->failed;
+
+  inf_signal_handlers_disconnect_by_func(
+    G_OBJECT(test->client),
+    G_CALLBACK(inf_test_xmpp_binary_client_notify_status_cb),
+    test
+  );
+
+  if(test->server_conn != NULL)
+  {
+    inf_signal_handlers_disconnect_by_func(
+      G_OBJECT(test->server_conn),
+      G_CALLBACK(inf_test_xmpp_binary_server_notify_status_cb),
+      test
+    );
+
+    inf_signal_handlers_disconnect_by_func(
+      G_OBJECT(test->server_conn),
+      G_CALLBACK(inf_test_xmpp_binary_received_cb),
+      test
+    );
+
+    inf_signal_handlers_disconnect_by_func(
+      G_OBJECT(test->server_conn),
+      G_CALLBACK(inf_test_xmpp_binary_error_cb),
+      test
+    );
+
+    g_object_unref(test->server_conn);
+    test->server_conn = NULL;
+  }
+
+  g_object_unref(test->client);
+  g_object_unref(test->tcp);
+  test->client = NULL;
+  test->tcp = NULL;
+
+  return result;
+}
+
+int
+main(int argc, char* argv[])
+{
+  InfTestXmppBinary test;
+  InfdTcpServer* tcp;
+  GError* error;
+  int result;
+  guint i;
+
+  error = NULL;
+  if(inf_init(&error) == FALSE)
+  {
+    fprintf(stderr, "%s\n", error->message);
+    g_error_free(error);
+    return 1;
+  }
+
+  test.io = inf_standalone_io_new();
+  test.tcp = NULL;
+  test.client = NULL;
+  test.server_conn = NULL;
+  g_queue_init(&test.expected);
+
+  tcp = g_object_new(
+    INFD_TYPE_TCP_SERVER,
+    "io", test.io,
+    "local-port", INF_TEST_XMPP_BINARY_PORT,
+    NULL
+  );
+
+  if(infd_tcp_server_open(tcp, &error) == FALSE)
+  {
+    fprintf(stderr, "%s\n", error->message);
+    g_error_free(error);
+    return 1;
+  }
+
+  test.server = infd_xmpp_server_new(
+    tcp,
+    INF_XMPP_CONNECTION_SECURITY_ONLY_UNSECURED,
+    NULL,
+    NULL,
+    NULL
+  );
+
+  g_object_unref(tcp);
+
+  g_signal_connect(
+    G_OBJECT(test.server),
+    "new-connection",
+    G_CALLBACK(inf_test_xmpp_binary_new_connection_cb),
+    &test
+  );
+
+  result = 0;
+
+  printf("Round trip in binary encoding... ");
+  fflush(stdout);
+  if(inf_test_xmpp_binary_run(&test, NULL, TRUE))
+    printf("OK\n");
+  else
+    result = 1;
+
+  printf("Round trip in XML... ");
+  fflush(stdout);
+  if(inf_test_xmpp_binary_run(&test, NULL, FALSE))
+    printf("OK\n");
+  else
+    result = 1;
+
+  for(i = 0; i < G_N_ELEMENTS(INF_TEST_XMPP_BINARY_INPUTS); ++i)
+  {
+    printf("%s... ", INF_TEST_XMPP_BINARY_INPUTS[i].description);
+    fflush(stdout);
+
+    if(inf_test_xmpp_binary_run(&test, &INF_TEST_XMPP_BINARY_INPUTS[i], TRUE))
+      printf("OK\n");
+    else
+      result = 1;
+  }
+
+  infd_xml_server_close(INFD_XML_SERVER(test.server));
+  g_object_unref(test.server);
+  g_object_unref(test.io);
+
+  inf_deinit();
+  return result;
+}
+
+/* vim:set et sw=2 ts=2: */
@@ -0,0 +1,432 @@
+/* libinfinity - a GObject-based infinote implementation
+ * Copyright (C) 2007-2015 Armin Burgmeier <armin@arbur.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+/* Measures how fast a client can push synchronization-like messages to a
+ * server over a TLS-secured XMPP connection on the loopback interface. This
+ * covers encryption, decryption and parsing of the incoming messages. Pass
+ * "plain" to compare with an unencrypted connection, "compress" to negotiate
+ * stream compression, and "xml" to turn off the binary message encoding.
+ * Usage: inf-test-xmpp-throughput [n-messages] [message-size] [plain]
+ *                                 [compress] [xml]
+ */
+
+#include <libinfinity/server/infd-xmpp-server.h>
+#include <libinfinity/server/infd-xml-server.h>
+#include <libinfinity/common/inf-cert-util.h>
+#include <libinfinity/common/inf-standalone-io.h>
+#include <libinfinity/common/inf-error.h>
+#include <libinfinity/common/inf-xml-connection.h>
+#include <libinfinity/common/inf-xmpp-connection.h>
+#include <libinfinity/common/inf-xml-util.h>
+#include <libinfinity/common/inf-init.h>
+
+#include <gnutls/x509.h>
+#include <gnutls/gnutls.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INF_TEST_XMPP_THROUGHPUT_PORT 6526
+
+typedef struct _InfTestXmppThroughput InfTestXmppThroughput;
+struct _InfTestXmppThroughput {
+  InfStandaloneIo* io;
+  InfXmppConnection* client;
+  InfXmlConnection* server_conn;
+
+  guint n_messages;
+  guint message_size;
+  guint n_received;
+  guint64 bytes_received;
+
+  gint64 start;
+  gint64 end;
+
+  guint64 compressed_sent;
+  gboolean binary;
+};
+
+static void
+inf_test_xmpp_throughput_received_cb(InfXmlConnection* connection,
+                                     xmlNodePtr xml,
+                                     gpointer user_data)
+{
+  InfTestXmppThroughput* test;
+  xmlNodePtr child;
+
+  test = (InfTestXmppThroughput*)user_data;
+
+  for(child = xml->children; child != NULL; child = child->next)
+    if(child->type == XML_TEXT_NODE)
+      test->bytes_received += strlen((const char*)child->content);
+
+  ++test->n_received;
+  if(test->n_received == test->n_messages)
+  {
+    test->end = g_get_monotonic_time();
+    inf_xmpp_connection_get_compression_statistics(
+      test->client,
+      NULL,
+      &test->compressed_sent,
+      NULL,
+      NULL
+    );
+
+    test->binary = inf_xmpp_connection_get_binary_encoding_active(
+      test->client
+    );
+
+    inf_standalone_io_loop_quit(test->io);
+  }
+}
+
+static void
+inf_test_xmpp_throughput_new_connection_cb(InfdXmlServer* server,
+                                           InfXmlConnection* connection,
+                                           gpointer user_data)
+{
+  InfTestXmppThroughput* test;
+  test = (InfTestXmppThroughput*)user_data;
+
+  g_assert(test->server_conn == NULL);
+  test->server_conn = connection;
+  g_object_ref(connection);
+
+  g_signal_connect(
+    G_OBJECT(connection),
+    "received",
+    G_CALLBACK(inf_test_xmpp_throughput_received_cb),
+    test
+  );
+}
+
+static void
+inf_test_xmpp_throughput_send(InfTestXmppThroughput* test)
+{
+  xmlNodePtr xml;
+  gchar* payload;
+  guint i;
+
+  /* Something that looks roughly like a chunk of synchronized text, so
+   * that the parser has some escaping to do. */
+  payload = g_malloc(test->message_size + 1);
+  for(i = 0; i < test->message_size; ++i)
+    payload[i] = (i % 61 == 60) ? '<' : 'a' + (i % 26);
+  payload[test->message_size] = '\0';
+
+  test->start = g_get_monotonic_time();
+  for(i = 0; i < test->n_messages; ++i)
+  {
+    xml = xmlNewNode(NULL, (const xmlChar*)"sync-segment");
+    inf_xml_util_set_attribute_uint(xml, "user", 1);
+    inf_xml_util_add_child_text(xml, payload, test->message_size);
+    inf_xml_connection_send(INF_XML_CONNECTION(test->client), xml);
+  }
+
+  g_free(payload);
+}
+
+static void
+inf_test_xmpp_throughput_notify_status_cb(GObject* object,
+                                          GParamSpec* pspec,
+                                          gpointer user_data)
+{
+  InfTestXmppThroughput* test;
+  InfXmlConnectionStatus status;
+
+  test = (InfTestXmppThroughput*)user_data;
+  g_object_get(object, "status", &status, NULL);
+
+  if(status == INF_XML_CONNECTION_OPEN)
+  {
+    inf_test_xmpp_throughput_send(test);
+  }
+  else if(status == INF_XML_CONNECTION_CLOSED)
+  {
+    fprintf(stderr, "Connection closed unexpectedly\n");
+    inf_standalone_io_loop_quit(test->io);
+  }
+}
+
+static void
+inf_test_xmpp_throughput_error_cb(InfXmlConnection* connection,
+                                  const GError* error,
+                                  gpointer user_data)
+{
+  fprintf(stderr, "Connection error: %s\n", error->message);
+}
+
+static InfCertificateCredentials*
+inf_test_xmpp_throughput_load_credentials(GError** error)
+{
+  gnutls_x509_privkey_t key;
+  GPtrArray* certs;
+  InfCertificateCredentials* creds;
+  guint i;
+  int res;
+
+  key = inf_cert_util_read_private_key(
+    CERTS_DIR "/test-good-key.pem",
+    error
+  );
+
+  if(key == NULL)
+    return NULL;
+
+  certs = inf_cert_util_read_certificate(
+    CERTS_DIR "/test-good-crt.pem",
+    NULL,
+    error
+  );
+
+  if(certs == NULL)
+  {
+    gnutls_x509_privkey_deinit(key);
+    return NULL;
+  }
+
+  creds = inf_certificate_credentials_new();
+  res = gnutls_certificate_set_x509_key(
+    inf_certificate_credentials_get(creds),
+    (gnutls_x509_crt_t*)certs->pdata,
+    certs->len,
+    key
+  );
+
+  gnutls_x509_privkey_deinit(key);
+  for(i = 0; i < certs->len; ++i)
+    gnutls_x509_crt_deinit(certs->pdata[i]);
+  g_ptr_array_free(certs, TRUE);
+
+  if(res != 0)
+  {
+    inf_certificate_credentials_unref(creds);
+    inf_gnutls_set_error(error, res);
+    return NULL;
+  }
+
+  return creds;
+}
+
+int
+main(int argc, char* argv[])
+{
+  InfTestXmppThroughput test;
+  InfXmppConnectionSecurityPolicy policy;
+  gboolean compression;
+  gboolean binary_encoding;
+  InfCertificateCredentials* server_creds;
+  InfCertificateCredentials* client_creds;
+  InfdTcpServer* tcp;
+  InfdXmppServer* server;
+  InfIpAddress* addr;
+  InfTcpConnection* conn;
+  GError* error;
+  double seconds;
+  int i;
+
+  test.n_messages = (argc > 1) ? atoi(argv[1]) : 10000;
+  test.message_size = (argc > 2) ? atoi(argv[2]) : 8192;
+  test.n_received = 0;
+  test.bytes_received = 0;
+  test.server_conn = NULL;
+  test.start = 0;
+  test.end = 0;
+  test.compressed_sent = 0;
+  test.binary = FALSE;
+
+  policy = INF_XMPP_CONNECTION_SECURITY_ONLY_TLS;
+  compression = FALSE;
+  binary_encoding = TRUE;
+  for(i = 3; i < argc; ++i)
+  {
+    if(strcmp(argv[i], "plain") == 0)
+      policy = INF_XMPP_CONNECTION_SECURITY_ONLY_UNSECURED;
+    else if(strcmp(argv[i], "compress") == 0)
+      compression = TRUE;
+    else if(strcmp(argv[i], "xml") == 0)
+      binary_encoding = FALSE;
+  }
+
+  if(test.n_messages == 0)
+  {
+    fprintf(stderr, "Need at least one message\n");
+    return 1;
+  }
+
+  error = NULL;
+  if(inf_init(&error) == FALSE)
+  {
+    fprintf(stderr, "%s\n", error->message);
+    g_error_free(error);
+    return 1;
+  }
+
+  server_creds = NULL;
+  if(policy != INF_XMPP_CONNECTION_SECURITY_ONLY_UNSECURED)
+  {
+    server_creds = inf_test_xmpp_throughput_load_credentials(&error);
+    if(server_creds == NULL)
+    {
+      fprintf(stderr, "%s\n", error->message);
+      g_error_free(error);
+      return 1;
+    }
+  }
+
+  test.io = inf_standalone_io_new();
+
+  tcp = g_object_new(
+    INFD_TYPE_TCP_SERVER,
+    "io", test.io,
+    "local-port", INF_TEST_XMPP_THROUGHPUT_PORT,
+    NULL
+  );
+
+  if(infd_tcp_server_open(tcp, &error) == FALSE)
+  {
+    fprintf(stderr, "%s\n", error->message);
+    g_error_free(error);
+    return 1;
+  }
+
+  server = infd_xmpp_server_new(tcp, policy, server_creds, NULL, NULL);
+  g_object_unref(tcp);
+  g_object_set(
+    G_OBJECT(server),
+    "compression", compression,
+    "binary-encoding", binary_encoding,
+    NULL
+  );
+
+  g_signal_connect(
+    G_OBJECT(server),
+    "new-connection",
+    G_CALLBACK(inf_test_xmpp_throughput_new_connection_cb),
+    &test
+  );
+
+  /* Without trusted CAs and a certificate callback, the client accepts the
+   * server's certificate as it is. */
+  client_creds = NULL;
+  if(policy != INF_XMPP_CONNECTION_SECURITY_ONLY_UNSECURED)
+    client_creds = inf_certificate_credentials_new();
+
+  addr = inf_ip_address_new_loopback4();
+  conn = inf_tcp_connection_new(
+    INF_IO(test.io),
+    addr,
+    INF_TEST_XMPP_THROUGHPUT_PORT
+  );
+  inf_ip_address_free(addr);
+
+  test.client = inf_xmpp_connection_new(
+    conn,
+    INF_XMPP_CONNECTION_CLIENT,
+    g_get_host_name(),
+    "localhost",
+    policy,
+    client_creds,
+    NULL,
+    NULL
+  );
+
+  g_object_set(
+    G_OBJECT(test.client),
+    "compression", compression,
+    "binary-encoding", binary_encoding,
+    NULL
+  );
+
+  g_signal_connect(
+    G_OBJECT(test.client),
+    "notify::status",
+    G_CALLBACK(inf_test_xmpp_throughput_notify_status_cb),
+    &test
+  );
+
+  g_signal_connect(
+    G_OBJECT(test.client),
+    "error",
+    G_CALLBACK(inf_test_xmpp_throughput_error_cb),
+    NULL
+  );
+
+  if(inf_tcp_connection_open(conn, &error) == FALSE)
+  {
+    fprintf(stderr, "%s\n", error->message);
+    g_error_free(error);
+    return 1;
+  }
+
+  g_object_unref(conn);
+  inf_standalone_io_loop(test.io);
+
+  if(test.n_received < test.n_messages)
+  {
+    fprintf(
+      stderr,
+      "Only %u of %u messages received\n",
+      test.n_received,
+      test.n_messages
+    );
+
+    return 1;
+  }
+
+  seconds = (test.end - test.start) / 1000000.0;
+  printf(
+    "%s, %s: %u messages, %" G_GUINT64_FORMAT " bytes of text in %.3f ms "
+    "(%.1f MB/s, %.0f messages/s)\n",
+    policy == INF_XMPP_CONNECTION_SECURITY_ONLY_UNSECURED ? "Plain" : "TLS",
+    test.binary ? "binary" : "XML",
+    test.n_received,
+    test.bytes_received,
+    seconds * 1000.0,
+    test.bytes_received / seconds / 1000000.0,
+    test.n_received / seconds
+  );
+
+  if(compression)
+  {
+    printf(
+      "%" G_GUINT64_FORMAT " bytes sent after compression\n",
+      test.compressed_sent
+    );
+  }
+
+  inf_xml_connection_close(INF_XML_CONNECTION(test.client));
+  g_object_unref(test.client);
+  if(test.server_conn != NULL)
+    g_object_unref(test.server_conn);
+  infd_xml_server_close(INFD_XML_SERVER(server));
+  g_object_unref(server);
+
+  if(client_creds != NULL)
+    inf_certificate_credentials_unref(client_creds);
+  if(server_creds != NULL)
+    inf_certificate_credentials_unref(server_creds);
+
+  g_object_unref(test.io);
+  inf_deinit();
+  return 0;
+}
+
+/* vim:set et sw=2 ts=2: */